@@ -25,6 +25,7 @@
 #include "UPnP.h"
 #include "Timestamp.h"
 #include "util.h"
+#include "Metrics.h"
 
 #include "Event.h"
 #include "Websocket.h"
@@ -101,10 +102,12 @@ namespace i2p
 			std::string logfile  = ""; i2p::config::GetOption("logfile",  logfile);
 			std::string loglevel = ""; i2p::config::GetOption("loglevel", loglevel);
 			bool logclftime;           i2p::config::GetOption("logclftime", logclftime);
+			bool logdeferred;          i2p::config::GetOption("logdeferred", logdeferred);
 
 			/* setup logging */
 			if (logclftime)
 				i2p::log::Logger().SetTimeFormat ("[%d/%b/%Y:%H:%M:%S %z]");
+			i2p::log::Logger().SetDeferred (logdeferred);
 
 			if (isDaemon && (logs == "" || logs == "stdout"))
 				logs = "file";
@@ -132,7 +135,18 @@ namespace i2p
 			LogPrint(eLogDebug, "FS: data directory: ", datadir);
 
 			bool precomputation; i2p::config::GetOption("precomputation.elgamal", precomputation);
-			i2p::crypto::InitCrypto (precomputation);
+			int elgamalWindowSize; i2p::config::GetOption("precomputation.elgamalwindow", elgamalWindowSize);
+			i2p::crypto::InitCrypto (precomputation, elgamalWindowSize);
+			bool lowMemory; i2p::config::GetOption("lowmemory", lowMemory);
+			if (lowMemory) LogPrint(eLogInfo, "Daemon: low memory profile");
+			i2p::SetI2NPMessagePoolsLowMemory (lowMemory);
+
+			// applied by threads when they start
+			std::string cpus;
+			i2p::config::GetOption("cpuaffinity.transports", cpus); i2p::util::SetThreadGroupAffinity (i2p::util::eThreadGroupTransports, cpus);
+			i2p::config::GetOption("cpuaffinity.tunnels", cpus); i2p::util::SetThreadGroupAffinity (i2p::util::eThreadGroupTunnels, cpus);
+			i2p::config::GetOption("cpuaffinity.crypto", cpus); i2p::util::SetThreadGroupAffinity (i2p::util::eThreadGroupCrypto, cpus);
+			i2p::config::GetOption("cpuaffinity.clients", cpus); i2p::util::SetThreadGroupAffinity (i2p::util::eThreadGroupClients, cpus);
 
 			int netID; i2p::config::GetOption("netid", netID);
 			i2p::context.SetNetID (netID);
@@ -171,6 +185,18 @@ namespace i2p
 			i2p::context.SetAcceptsTunnels (!transit);
 			uint16_t transitTunnels; i2p::config::GetOption("limits.transittunnels", transitTunnels);
 			SetMaxNumTransitTunnels (transitTunnels);
+			int traceSampleRate; i2p::config::GetOption("tracesamplerate", traceSampleRate);
+			i2p::metrics::tracer.SetSampleRate (traceSampleRate);
+			bool ioTrace; i2p::config::GetOption("iotrace", ioTrace);
+			i2p::util::SetIOTracing (ioTrace);
+			std::string tunnelCapture; i2p::config::GetOption("tunnelcapture", tunnelCapture);
+			if (!tunnelCapture.empty ())
+			{
+				if (i2p::metrics::tunnelCapture.Start (tunnelCapture))
+					LogPrint(eLogInfo, "Daemon: capturing tunnel messages to ", tunnelCapture);
+				else
+					LogPrint(eLogError, "Daemon: can't open tunnel capture file ", tunnelCapture);
+			}
 
 			bool isFloodfill; i2p::config::GetOption("floodfill", isFloodfill);
 			if (isFloodfill) {
@@ -359,6 +385,7 @@ namespace i2p
 			i2p::client::context.Stop();
 			LogPrint(eLogInfo, "Daemon: stopping Tunnels");
 			i2p::tunnel::tunnels.Stop();
+			i2p::metrics::tunnelCapture.Stop ();
 
 			if (d.UPnP) 
 			{
@@ -2,6 +2,12 @@
 #include <sstream>
 #include <thread>
 #include <memory>
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
@@ -22,6 +28,7 @@
 #include "HTTPServer.h"
 #include "Daemon.h"
 #include "util.h"
+#include "Metrics.h"
 #ifdef WIN32_APP
 #include "Win32/Win32App.h"
 #endif
@@ -81,6 +88,8 @@ namespace http {
 	const char HTTP_PAGE_I2P_TUNNELS[] = "i2p_tunnels";
 	const char HTTP_PAGE_COMMANDS[] = "commands";
 	const char HTTP_PAGE_LEASESETS[] = "leasesets";
+	const char HTTP_PAGE_LOCKS[] = "locks"; // not in menu
+	const char HTTP_PAGE_MEMORY[] = "memory";
 	const char HTTP_COMMAND_ENABLE_TRANSIT[] = "enable_transit";
 	const char HTTP_COMMAND_DISABLE_TRANSIT[] = "disable_transit";
 	const char HTTP_COMMAND_SHUTDOWN_START[] = "shutdown_start";
@@ -142,9 +151,13 @@ namespace http {
 		s << " " << (int) (bytes / 1024) << "&nbsp;KiB<br>\r\n";
 	}
 
-	static void SetLogLevel (const std::string& level)
+	static void SetLogLevel (const std::string& level, const std::string& category)
 	{
-		if (level == "none" || level == "error" || level == "warn" || level == "info" || level == "debug")
+		if (!category.empty ())
+		{
+			if (!i2p::log::Logger().SetLogLevel (category, level)) return;
+		}
+		else if (level == "none" || level == "error" || level == "warn" || level == "info" || level == "debug")
 			i2p::log::Logger().SetLogLevel(level);
 		else {
 			LogPrint(eLogError, "HTTPServer: unknown loglevel set attempted");
@@ -182,7 +195,8 @@ namespace http {
 			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_TUNNELS << "\">Tunnels</a><br>\r\n"
 			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_TRANSIT_TUNNELS << "\">Transit tunnels</a><br>\r\n"
 			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_TRANSPORTS << "\">Transports</a><br>\r\n"
-			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_I2P_TUNNELS << "\">I2P tunnels</a><br>\r\n";
+			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_I2P_TUNNELS << "\">I2P tunnels</a><br>\r\n"
+			"  <a href=\"" << webroot << "?page=" << HTTP_PAGE_MEMORY << "\">Memory</a><br>\r\n";
 		if (i2p::client::context.GetSAMBridge ())
 			s << "  <a href=\"" << webroot << "?page=" << HTTP_PAGE_SAM_SESSIONS << "\">SAM sessions</a><br>\r\n";
 		s <<
@@ -243,6 +257,20 @@ namespace http {
 		if (family.length () > 0)
 			s << "<b>Family:</b> " << family << "<br>\r\n";
 		s << "<b>Tunnel creation success rate:</b> " << i2p::tunnel::tunnels.GetTunnelCreationSuccessRate () << "%<br>\r\n";
+		s << "<b>Latency (p50/p99):</b> tunnel build " << i2p::metrics::tunnelBuildTime.GetPercentile (0.5) << "/" << i2p::metrics::tunnelBuildTime.GetPercentile (0.99)
+			<< " ms, LeaseSet request " << i2p::metrics::leaseSetRequestTime.GetPercentile (0.5) << "/" << i2p::metrics::leaseSetRequestTime.GetPercentile (0.99)
+			<< " ms, stream first data " << i2p::metrics::streamFirstDataTime.GetPercentile (0.5) << "/" << i2p::metrics::streamFirstDataTime.GetPercentile (0.99) << " ms<br>\r\n";
+		if (i2p::metrics::tracer.IsEnabled ())
+		{
+			static const char * stageNames[i2p::metrics::eNumTraceStages] = { "tunnels", "gateway", "transports", "write" };
+			s << "<b>Traced messages from ingress (p50/p99):</b>";
+			for (int i = 0; i < i2p::metrics::eNumTraceStages; i++)
+			{
+				auto& histogram = i2p::metrics::tracer.GetStageHistogram ((i2p::metrics::TraceStage)i);
+				s << (i ? ", " : " ") << stageNames[i] << " " << histogram.GetPercentile (0.5) << "/" << histogram.GetPercentile (0.99) << " &#181;s";
+			}
+			s << "<br>\r\n";
+		}
 		s << "<b>Received:</b> ";
 		ShowTraffic (s, i2p::transport::transports.GetTotalReceivedBytes ());
 		s << " (" << (double) i2p::transport::transports.GetInBandwidth () / 1024 << " KiB/s)<br>\r\n";
@@ -453,14 +481,14 @@ namespace http {
 			ShowError(s, "I2CP is not enabled");
 	}
 
-	void ShowLeasesSets(std::stringstream& s)
+	static void ShowLeasesSets (std::vector<std::string>& items)
 	{
-		s << "<b>LeaseSets:</b><br>\r\n<br>\r\n";
 		int counter = 1;
 		// for each lease set
 		i2p::data::netdb.VisitLeaseSets(
-			[&s, &counter](const i2p::data::IdentHash dest, std::shared_ptr<i2p::data::LeaseSet> leaseSet)
+			[&items, &counter](const i2p::data::IdentHash dest, std::shared_ptr<i2p::data::LeaseSet> leaseSet)
 			{
+				std::stringstream s;
 				// create copy of lease set so we extract leases
 				i2p::data::LeaseSet ls(leaseSet->GetBuffer(), leaseSet->GetBufferLen());
 				s << "<div class='leaseset";
@@ -482,15 +510,29 @@ namespace http {
 					s << "<b>EndDate:</b> " << ConvertTime(l->endDate) << "<br>\r\n";
 				}
 				s << "</p>\r\n</div>\r\n</div>\r\n";
+				items.push_back (s.str ());
 			}
 		);
 		// end for each lease set
 	}
 
+	void ShowLeasesSets(std::stringstream& s)
+	{
+		s << "<b>LeaseSets:</b><br>\r\n<br>\r\n";
+		std::vector<std::string> items;
+		ShowLeasesSets (items);
+		for (const auto& it: items)
+			s << it;
+	}
+
 	void ShowTunnels (std::stringstream& s)
 	{
 		s << "<b>Tunnels:</b><br>\r\n<br>\r\n";
 		s << "<b>Queue size:</b> " << i2p::tunnel::tunnels.GetQueueSize () << "<br>\r\n";
+		s << "<b>Message buffers (size: requests/hits/pooled):</b>";
+		for (const auto& it: i2p::GetI2NPMessagePoolsStats ())
+			s << " " << it.bufferSize << ": " << it.numRequests << "/" << it.numHits << "/" << it.numResident;
+		s << "<br>\r\n";
 
 		auto ExplPool = i2p::tunnel::tunnels.GetExploratoryPool ();
 
@@ -542,21 +584,135 @@ namespace http {
 		s << "  <a href=\"" << webroot << "?cmd=" << HTTP_COMMAND_LOGLEVEL << "&level=warn&token=" << token << "\">[warn]</a> ";
 		s << "  <a href=\"" << webroot << "?cmd=" << HTTP_COMMAND_LOGLEVEL << "&level=info&token=" << token << "\">[info]</a> ";
 		s << "  <a href=\"" << webroot << "?cmd=" << HTTP_COMMAND_LOGLEVEL << "&level=debug&token=" << token << "\">[debug]</a><br>\r\n";
+		for (int i = 0; i < eNumLogCategories; i++)
+		{
+			auto category = i2p::log::GetLogCategoryName ((LogCategory)i);
+			s << "  " << category << " (" << i2p::log::GetLogLevelName (i2p::log::Logger().GetLogLevel ((LogCategory)i)) << "):";
+			for (int level = eLogNone; level < eNumLogLevels; level++)
+			{
+				auto name = i2p::log::GetLogLevelName ((LogLevel)level);
+				s << " <a href=\"" << webroot << "?cmd=" << HTTP_COMMAND_LOGLEVEL << "&category=" << category << "&level=" << name << "&token=" << token << "\">[" << name << "]</a>";
+			}
+			s << "<br>\r\n";
+		}
+	}
+
+	static void ShowTransitTunnels (std::vector<std::string>& items)
+	{
+		for (const auto& bucket: i2p::tunnel::tunnels.GetTransitTunnels ())
+			for (const auto& it: bucket.tunnels)
+			{
+				std::stringstream s;
+				if (std::dynamic_pointer_cast<i2p::tunnel::TransitTunnelGateway>(it))
+					s << it->GetTunnelID () << " &#8658; ";
+				else if (std::dynamic_pointer_cast<i2p::tunnel::TransitTunnelEndpoint>(it))
+					s << " &#8658; " << it->GetTunnelID ();
+				else
+					s << " &#8658; " << it->GetTunnelID () << " &#8658; ";
+				s << " " << it->GetNumTransmittedBytes () << "<br>\r\n";
+				items.push_back (s.str ());
+			}
 	}
 
 	void ShowTransitTunnels (std::stringstream& s)
 	{
 		s << "<b>Transit tunnels:</b><br>\r\n<br>\r\n";
-		for (const auto& it: i2p::tunnel::tunnels.GetTransitTunnels ())
+		std::vector<std::string> items;
+		ShowTransitTunnels (items);
+		for (const auto& it: items)
+			s << it;
+	}
+
+	static void ShowLocks (std::stringstream& s)
+	{
+		s << "<b>Locks:</b><br>\r\n<br>\r\n";
+#ifdef WITH_LOCK_PROFILING
+		i2p::metrics::WriteLockStats (s);
+#else
+		s << "Lock profiling is disabled, build with WITH_LOCK_PROFILING<br>\r\n";
+#endif
+	}
+
+	static void ShowMemory (std::stringstream& s)
+	{
+		s << "<b>Memory:</b><br>\r\n<br>\r\n";
+		bool lowMemory; i2p::config::GetOption("lowmemory", lowMemory);
+		s << "<b>Profile:</b> " << (lowMemory ? "low memory" : "default") << "<br>\r\n";
+#ifdef __linux__
+		std::ifstream statm ("/proc/self/statm");
+		size_t numPages = 0, numResidentPages = 0;
+		if (statm >> numPages >> numResidentPages)
 		{
-			if (std::dynamic_pointer_cast<i2p::tunnel::TransitTunnelGateway>(it))
-				s << it->GetTunnelID () << " &#8658; ";
-			else if (std::dynamic_pointer_cast<i2p::tunnel::TransitTunnelEndpoint>(it))
-				s << " &#8658; " << it->GetTunnelID ();
-			else
-				s << " &#8658; " << it->GetTunnelID () << " &#8658; ";
-			s << " " << it->GetNumTransmittedBytes () << "<br>\r\n";
+			s << "<b>Resident:</b> ";
+			ShowTraffic (s, (uint64_t)numResidentPages*sysconf (_SC_PAGESIZE));
+			s << "<br>\r\n";
+		}
+#endif
+		// pooled buffers, in use ones are counted where the pool knows them
+		uint64_t total = 0;
+		s << "<br>\r\n<b>I2NP message buffers (size: pooled):</b><br>\r\n";
+		for (const auto& it: i2p::GetI2NPMessagePoolsStats ())
+		{
+			uint64_t bytes = it.numResident > 0 ? it.numResident*it.bufferSize : 0;
+			s << it.bufferSize << ": " << it.numResident << " (";
+			ShowTraffic (s, bytes);
+			s << ")<br>\r\n";
+			total += bytes;
+		}
+		auto& bufferPool = i2p::client::GetTunnelBufferPool ();
+		uint64_t relayBytes = (bufferPool.GetNumInUse () + bufferPool.GetNumFree ())*bufferPool.GetBufferSize ();
+		s << "<b>Relay buffers:</b> " << bufferPool.GetNumInUse () << " in use, " << bufferPool.GetNumFree () << " free of " << bufferPool.GetBufferSize () << " (";
+		ShowTraffic (s, relayBytes);
+		s << ")<br>\r\n";
+		total += relayBytes;
+		auto ssuServer = i2p::transport::transports.GetSSUServer ();
+		if (ssuServer)
+		{
+			auto& packetsPool = ssuServer->GetPacketsPool ();
+			uint64_t bytes = (packetsPool.GetNumInUse () + packetsPool.GetNumFree ())*sizeof (i2p::transport::SSUPacket);
+			s << "<b>SSU packets:</b> " << packetsPool.GetNumInUse () << " in use, " << packetsPool.GetNumFree () << " free (";
+			ShowTraffic (s, bytes);
+			s << ")<br>\r\n";
+			total += bytes;
+		}
+		size_t numPackets = 0, numFreePackets = 0; uint64_t packetsBytes = 0;
+		for (auto& it: i2p::client::context.GetDestinations ())
+		{
+			auto dest = it.second->GetStreamingDestination ();
+			if (!dest) continue;
+			auto& full = dest->GetPacketsPool (); auto& small = dest->GetSmallPacketsPool ();
+			numPackets += full.GetNumInUse () + small.GetNumInUse ();
+			numFreePackets += full.GetNumFree () + small.GetNumFree ();
+			packetsBytes += (full.GetNumInUse () + full.GetNumFree ())*sizeof (i2p::stream::FullPacket) +
+				(small.GetNumInUse () + small.GetNumFree ())*sizeof (i2p::stream::SmallPacket);
+		}
+		s << "<b>Streaming packets:</b> " << numPackets << " in use, " << numFreePackets << " free (";
+		ShowTraffic (s, packetsBytes);
+		s << ")<br>\r\n";
+		total += packetsBytes;
+		s << "<b>Total buffers:</b> ";
+		ShowTraffic (s, total);
+		s << "<br>\r\n";
+
+		// limits
+		s << "<br>\r\n<b>Routers:</b> " << i2p::data::netdb.GetNumRouters ();
+		if (i2p::data::netdb.GetMaxNumRouters ()) s << " of " << i2p::data::netdb.GetMaxNumRouters ();
+		s << " <b>LeaseSets:</b> " << i2p::data::netdb.GetNumLeaseSets () << "<br>\r\n";
+		uint16_t maxTransitTunnels; i2p::config::GetOption("limits.transittunnels", maxTransitTunnels);
+		s << "<b>Transit tunnels:</b> " << i2p::tunnel::tunnels.CountTransitTunnels () << " of " << maxTransitTunnels << "<br>\r\n";
+		s << "<b>Local destinations:</b> " << i2p::client::context.GetDestinations ().size () << "<br>\r\n";
+		s << "<b>Threads (0 - number of cores):</b>";
+		for (auto name: { "destinationthreads", "ntcp2.threads", "ssuthreads", "limits.tunnelthreads", "limits.tunnelbuildthreads" })
+		{
+			uint16_t numThreads; i2p::config::GetOption(name, numThreads);
+			s << " " << name << ": " << numThreads;
 		}
+		s << "<br>\r\n";
+		bool precomputation; i2p::config::GetOption("precomputation.elgamal", precomputation);
+		int elgamalWindowSize; i2p::config::GetOption("precomputation.elgamalwindow", elgamalWindowSize);
+		s << "<b>ElGamal precomputation:</b> ";
+		if (precomputation) s << "window " << elgamalWindowSize; else s << "disabled";
+		s << "<br>\r\n";
 	}
 
 	template<typename Sessions>
@@ -601,7 +757,11 @@ namespace http {
 
 	void ShowTransports (std::stringstream& s)
 	{
-		s << "<b>Transports:</b><br>\r\n<br>\r\n";
+		s << "<b>Transports:</b><br>\r\n";
+		s << "<b>DH keys queue size:</b> " << i2p::transport::transports.GetDHKeysQueueSize ();
+		s << " (" << i2p::transport::transports.GetNumDHKeysStarvations () << " starvations)<br>\r\n";
+		s << "<b>x25519 keys queue size:</b> " << i2p::transport::transports.GetX25519KeysQueueSize ();
+		s << " (" << i2p::transport::transports.GetNumX25519KeysStarvations () << " starvations)<br>\r\n<br>\r\n";
 		auto ntcpServer = i2p::transport::transports.GetNTCPServer ();
 		if (ntcpServer)
 		{
@@ -636,6 +796,8 @@ namespace http {
 				}
 				s << "</p>\r\n</div>\r\n";
 			}
+			auto& packetsPool = ssuServer->GetPacketsPool ();
+			s << "<b>SSU packets:</b> " << packetsPool.GetNumInUse () << " in use, " << packetsPool.GetNumFree () << " free<br>\r\n";
 			auto sessions6 = ssuServer->GetSessionsV6 ();
 			if (!sessions6.empty ())
 			{
@@ -736,6 +898,10 @@ namespace http {
 			s << i2p::client::context.GetAddressBook ().ToAddress(ident);
 			s << "<br>\r\n"<< std::endl;
 		}
+		auto& bufferPool = i2p::client::GetTunnelBufferPool ();
+		s << "<br>\r\n<b>Relay buffers:</b> " << bufferPool.GetNumInUse () << " in use, " << bufferPool.GetNumFree () << " free (";
+		ShowTraffic (s, (bufferPool.GetNumInUse () + bufferPool.GetNumFree ())*bufferPool.GetBufferSize ());
+		s << ")<br>\r\n"<< std::endl;
 		auto& serverTunnels = i2p::client::context.GetServerTunnels ();
 		if (!serverTunnels.empty ()) {
 			s << "<br>\r\n<b>Server Tunnels:</b><br>\r\n<br>\r\n";
@@ -746,6 +912,15 @@ namespace http {
 				s << it.second->GetName () << "</a> &#8658; ";
 				s << i2p::client::context.GetAddressBook ().ToAddress(ident);
 				s << ":" << it.second->GetLocalPort ();
+				auto budget = it.second->GetMemoryBudget ();
+				if (budget)
+				{
+					s << " (memory: ";
+					ShowTraffic (s, budget->GetUsed ());
+					s << " of ";
+					ShowTraffic (s, budget->GetLimit ());
+					s << ")";
+				}
 				s << "</a><br>\r\n"<< std::endl;
 			}
 		}
@@ -787,9 +962,101 @@ namespace http {
 		return date;
 	}
 
-	HTTPConnection::HTTPConnection (std::string hostname, std::shared_ptr<boost::asio::ip::tcp::socket> socket):
+	HTTPPageCache::HTTPPageCache ():
+		m_IsRunning (false), m_Thread (nullptr)
+	{
+	}
+
+	HTTPPageCache::~HTTPPageCache ()
+	{
+		Stop ();
+	}
+
+	void HTTPPageCache::Start ()
+	{
+		m_IsRunning = true;
+		m_Thread = std::unique_ptr<std::thread>(new std::thread (std::bind (&HTTPPageCache::Run, this)));
+	}
+
+	void HTTPPageCache::Stop ()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			m_IsRunning = false;
+			m_StopCondition.notify_one ();
+		}
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			m_Thread = nullptr;
+		}
+	}
+
+	std::shared_ptr<const HTTPPageCache::Page> HTTPPageCache::GetPage (const std::string& name) const
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		auto it = m_Pages.find (name);
+		return it != m_Pages.end () ? it->second : nullptr;
+	}
+
+	void HTTPPageCache::Run ()
+	{
+		i2p::util::InitThread ("HTTPPageCache");
+		std::unique_lock<std::mutex> l(m_Mutex);
+		while (m_IsRunning)
+		{
+			l.unlock ();
+			try
+			{
+				Render ();
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "HTTPServer: page render exception: ", ex.what ());
+			}
+			l.lock ();
+			if (m_IsRunning)
+				m_StopCondition.wait_for (l, std::chrono::seconds (HTTP_PAGE_CACHE_RENDER_INTERVAL));
+		}
+	}
+
+	void HTTPPageCache::Render ()
+	{
+		std::map<std::string, std::shared_ptr<Page> > pages;
+		std::stringstream s;
+		ShowTunnels (s);
+		pages[HTTP_PAGE_TUNNELS] = std::make_shared<Page> ();
+		pages[HTTP_PAGE_TUNNELS]->head = s.str ();
+		s.str ("");
+		ShowTransports (s);
+		pages[HTTP_PAGE_TRANSPORTS] = std::make_shared<Page> ();
+		pages[HTTP_PAGE_TRANSPORTS]->head = s.str ();
+		pages[HTTP_PAGE_TRANSIT_TUNNELS] = std::make_shared<Page> ();
+		pages[HTTP_PAGE_TRANSIT_TUNNELS]->head = "<b>Transit tunnels:</b><br>\r\n<br>\r\n";
+		ShowTransitTunnels (pages[HTTP_PAGE_TRANSIT_TUNNELS]->items);
+		pages[HTTP_PAGE_LEASESETS] = std::make_shared<Page> ();
+		pages[HTTP_PAGE_LEASESETS]->head = "<b>LeaseSets:</b><br>\r\n<br>\r\n";
+		ShowLeasesSets (pages[HTTP_PAGE_LEASESETS]->items);
+		// etag is content hash, so unchanged page is not sent again
+		for (auto& it: pages)
+		{
+			std::hash<std::string> hasher;
+			size_t h = hasher (it.second->head);
+			for (const auto& item: it.second->items)
+				h ^= hasher (item) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			std::stringstream etag;
+			etag << std::hex << h;
+			it.second->etag = etag.str ();
+		}
+		std::unique_lock<std::mutex> l(m_Mutex);
+		for (auto& it: pages)
+			m_Pages[it.first] = it.second;
+	}
+
+	HTTPConnection::HTTPConnection (std::string hostname, std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+		std::shared_ptr<const HTTPPageCache> pageCache):
 		m_Socket (socket), m_Timer (socket->get_io_service ()), m_BufferLen (0),
-		expected_host(hostname)
+		expected_host(hostname), m_PageCache (pageCache)
 	{
 		/* cache options */
 		i2p::config::GetOption("http.auth", needAuth);
@@ -896,6 +1163,31 @@ namespace http {
 				return;
 			}
 		}
+		URL url;
+		url.parse (req.uri);
+		std::string webroot; i2p::config::GetOption("http.webroot", webroot);
+		if (url.path == webroot + "metrics")
+		{
+			// Prometheus text exposition format
+			i2p::metrics::WritePrometheus (s);
+			res.code = 200;
+			res.add_header("Content-Type", "text/plain; version=0.0.4");
+			content = s.str ();
+			SendReply (res, content);
+			return;
+		}
+		if (url.path == webroot + "iotrace.json")
+		{
+			// load in chrome://tracing or Perfetto
+			i2p::util::WriteIOTraceJSON (s);
+			res.code = 200;
+			res.add_header("Content-Type", "application/json");
+			content = s.str ();
+			SendReply (res, content);
+			return;
+		}
+		if (req.uri.find("page=") != std::string::npos && HandleCachedPage (req, res, s))
+			return;
 		// Html5 head start
 		ShowPageHead (s);
 		if (req.uri.find("page=") != std::string::npos) {
@@ -960,6 +1252,10 @@ namespace http {
 			ShowI2PTunnels (s);
 		else if (page == HTTP_PAGE_LEASESETS)
 			ShowLeasesSets(s);
+		else if (page == HTTP_PAGE_LOCKS)
+			ShowLocks (s);
+		else if (page == HTTP_PAGE_MEMORY)
+			ShowMemory (s);
 		else {
 			res.code = 400;
 			ShowError(s, "Unknown page: " + page);
@@ -967,6 +1263,57 @@ namespace http {
 		}
 	}
 
+	bool HTTPConnection::HandleCachedPage (const HTTPReq& req, HTTPRes& res, std::stringstream& s)
+	{
+		if (!m_PageCache) return false;
+		std::map<std::string, std::string> params;
+		URL url;
+
+		url.parse(req.uri);
+		url.parse_query(params);
+		auto page = m_PageCache->GetPage (params["page"]);
+		if (!page) return false; // not cached or not rendered yet
+
+		size_t numPages = (page->items.size () + HTTP_PAGE_CACHE_ITEMS_PER_PAGE - 1) / HTTP_PAGE_CACHE_ITEMS_PER_PAGE;
+		if (!numPages) numPages = 1;
+		size_t num = std::strtoul (params["p"].c_str (), nullptr, 10);
+		if (num >= numPages) num = numPages - 1;
+		std::string etag = "\"" + page->etag + "-" + std::to_string (num) + "\"";
+		res.add_header ("ETag", etag);
+		res.add_header ("Cache-Control", "no-cache");
+		std::string content;
+		if (req.GetHeader ("If-None-Match") == etag)
+		{
+			res.code = 304;
+			SendReply (res, content);
+			return true;
+		}
+
+		ShowPageHead (s);
+		s << page->head;
+		size_t begin = num*HTTP_PAGE_CACHE_ITEMS_PER_PAGE;
+		size_t end = std::min (begin + HTTP_PAGE_CACHE_ITEMS_PER_PAGE, page->items.size ());
+		for (size_t i = begin; i < end; i++)
+			s << page->items[i];
+		if (numPages > 1)
+		{
+			std::string webroot; i2p::config::GetOption("http.webroot", webroot);
+			s << "<br>\r\n";
+			if (num > 0)
+				s << "<a href=\"" << webroot << "?page=" << params["page"] << "&p=" << (num - 1) << "\">&laquo; Prev</a> ";
+			s << (begin + 1) << "-" << end << " of " << page->items.size ();
+			if (num + 1 < numPages)
+				s << " <a href=\"" << webroot << "?page=" << params["page"] << "&p=" << (num + 1) << "\">Next &raquo;</a>";
+			s << "<br>\r\n";
+		}
+		ShowPageTail (s);
+
+		res.code = 200;
+		content = s.str ();
+		SendReply (res, content);
+		return true;
+	}
+
 	void HTTPConnection::HandleCommand (const HTTPReq& req, HTTPRes& res, std::stringstream& s)
 	{
 		std::map<std::string, std::string> params;
@@ -1013,7 +1360,7 @@ namespace http {
 #endif
 		} else if (cmd == HTTP_COMMAND_LOGLEVEL){
 			std::string level = params["level"];
-			SetLogLevel (level);
+			SetLogLevel (level, params["category"]);
 		} else {
 			res.code = 400;
 			ShowError(s, "Unknown command: " + cmd);
@@ -1041,7 +1388,7 @@ namespace http {
 	HTTPServer::HTTPServer (const std::string& address, int port):
 		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),
 		m_Acceptor (m_Service, boost::asio::ip::tcp::endpoint (boost::asio::ip::address::from_string(address), port)),
-		m_Hostname(address)
+		m_Hostname(address), m_PageCache (std::make_shared<HTTPPageCache> ())
 	{
 	}
 
@@ -1070,6 +1417,7 @@ namespace http {
 			LogPrint(eLogInfo, "HTTPServer: password set to ", pass);
 		}
 		m_IsRunning = true;
+		m_PageCache->Start ();
 		m_Thread = std::unique_ptr<std::thread>(new std::thread (std::bind (&HTTPServer::Run, this)));
 		m_Acceptor.listen ();
 		Accept ();
@@ -1085,15 +1433,17 @@ namespace http {
 			m_Thread->join ();
 			m_Thread = nullptr;
 		}
+		m_PageCache->Stop ();
 	}
 
 	void HTTPServer::Run ()
 	{
+		i2p::util::InitThread ("HTTPServer");
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "HTTPServer");
 			}
 			catch (std::exception& ex)
 			{
@@ -1126,7 +1476,7 @@ namespace http {
 
 	void HTTPServer::CreateConnection(std::shared_ptr<boost::asio::ip::tcp::socket> newSocket)
 	{
-		auto conn = std::make_shared<HTTPConnection> (m_Hostname, newSocket);
+		auto conn = std::make_shared<HTTPConnection> (m_Hostname, newSocket, m_PageCache);
 		conn->Receive ();
 	}
 } // http
@@ -6,6 +6,9 @@
 #include <memory>
 #include <map>
 #include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
 #include <boost/asio.hpp>
 #include <sstream>
 #include "HTTP.h"
@@ -16,12 +19,49 @@ namespace http
 {
 	const size_t HTTP_CONNECTION_BUFFER_SIZE = 8192;
 	const int TOKEN_EXPIRATION_TIMEOUT = 30; // in seconds
+	const int HTTP_PAGE_CACHE_RENDER_INTERVAL = 5; // in seconds
+	const size_t HTTP_PAGE_CACHE_ITEMS_PER_PAGE = 500;
+
+	/** @brief snapshots of heavy pages rendered periodically on own thread */
+	class HTTPPageCache
+	{
+		public:
+
+			struct Page
+			{
+				std::string head;
+				std::vector<std::string> items; // paginated
+				std::string etag;
+			};
+
+			HTTPPageCache ();
+			~HTTPPageCache ();
+
+			void Start ();
+			void Stop ();
+
+			std::shared_ptr<const Page> GetPage (const std::string& name) const;
+
+		private:
+
+			void Run ();
+			void Render ();
+
+		private:
+
+			bool m_IsRunning;
+			std::unique_ptr<std::thread> m_Thread;
+			mutable std::mutex m_Mutex;
+			std::condition_variable m_StopCondition;
+			std::map<std::string, std::shared_ptr<const Page> > m_Pages;
+	};
 
 	class HTTPConnection: public std::enable_shared_from_this<HTTPConnection>
 	{
 		public:
 
-			HTTPConnection (std::string serverhost, std::shared_ptr<boost::asio::ip::tcp::socket> socket);
+			HTTPConnection (std::string serverhost, std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+				std::shared_ptr<const HTTPPageCache> pageCache = nullptr);
 			void Receive ();
 
 		private:
@@ -33,6 +73,7 @@ namespace http
 			bool CheckAuth     (const HTTPReq & req);
 			void HandleRequest (const HTTPReq & req);
 			void HandlePage    (const HTTPReq & req, HTTPRes & res, std::stringstream& data);
+			bool HandleCachedPage (const HTTPReq & req, HTTPRes & res, std::stringstream& data);
 			void HandleCommand (const HTTPReq & req, HTTPRes & res, std::stringstream& data);
 			void SendReply     (HTTPRes & res, std::string & content);
 
@@ -47,6 +88,7 @@ namespace http
 			std::string user;
 			std::string pass;
 			std::string expected_host;
+			std::shared_ptr<const HTTPPageCache> m_PageCache;
 
 			static std::map<uint32_t, uint32_t> m_Tokens; // token->timestamp in seconds
 	};
@@ -77,6 +119,7 @@ namespace http
 			boost::asio::io_service::work m_Work;
 			boost::asio::ip::tcp::acceptor m_Acceptor;
 			std::string m_Hostname;
+			std::shared_ptr<HTTPPageCache> m_PageCache;
 	};
 
     //all the below functions are also used by Qt GUI, see mainwindow.cpp -> getStatusPageHtml
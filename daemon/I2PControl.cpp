@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include <sstream>
 #include <openssl/x509.h>
 #include <openssl/pem.h>
@@ -6,6 +8,7 @@
 #include <boost/date_time/local_time/local_time.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/property_tree/ini_parser.hpp>
+#include <boost/algorithm/string.hpp>
 
 // There is bug in boost 1.49 with gcc 4.7 coming with Debian Wheezy
 #define GCC47_BOOST149 ((BOOST_VERSION == 104900) && (__GNUC__ == 4) && (__GNUC_MINOR__ >= 7))
@@ -82,6 +85,9 @@ namespace client
 		m_RouterInfoHandlers["i2p.router.net.tunnels.participating"] = &I2PControlService::TunnelsParticipatingHandler;
 		m_RouterInfoHandlers["i2p.router.net.tunnels.successrate"] =
 &I2PControlService::TunnelsSuccessRateHandler;
+		m_RouterInfoHandlers["i2p.router.net.tunnels.buildtime"] = &I2PControlService::TunnelsBuildTimeHandler;
+		m_RouterInfoHandlers["i2p.router.client.leasesetrequesttime"] = &I2PControlService::LeaseSetRequestTimeHandler;
+		m_RouterInfoHandlers["i2p.router.client.streamfirstdatatime"] = &I2PControlService::StreamFirstDataTimeHandler;
 		m_RouterInfoHandlers["i2p.router.net.total.received.bytes"]  = &I2PControlService::NetTotalReceivedBytes;
 		m_RouterInfoHandlers["i2p.router.net.total.sent.bytes"]      = &I2PControlService::NetTotalSentBytes;
 
@@ -136,10 +142,11 @@ namespace client
 
 	void I2PControlService::Run ()
 	{
+		i2p::util::InitThread ("I2PControl");
 		while (m_IsRunning)
 		{
 			try {
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "I2PControl");
 			} catch (std::exception& ex) {
 				LogPrint (eLogError, "I2PControl: runtime exception: ", ex.what ());
 			}
@@ -185,6 +192,18 @@ namespace client
 	void I2PControlService::ReadRequest (std::shared_ptr<ssl_socket> socket)
 	{
 		auto request = std::make_shared<I2PControlBuffer>();
+		// persistent connection is closed if idle
+		auto idleTimer = std::make_shared<boost::asio::deadline_timer> (m_Service);
+		idleTimer->expires_from_now (boost::posix_time::seconds(I2P_CONTROL_KEEP_ALIVE_TIMEOUT));
+		idleTimer->async_wait (
+			[socket](const boost::system::error_code& ecode)
+			{
+				if (ecode != boost::asio::error::operation_aborted)
+				{
+					boost::system::error_code ec;
+					socket->lowest_layer ().close (ec);
+				}
+			});
 		socket->async_read_some (
 #if defined(BOOST_ASIO_HAS_STD_ARRAY)
 			boost::asio::buffer (*request),
@@ -192,90 +211,306 @@ namespace client
 			boost::asio::buffer (request->data (), request->size ()),
 #endif
 			std::bind(&I2PControlService::HandleRequestReceived, this,
-			std::placeholders::_1, std::placeholders::_2, socket, request));
+			std::placeholders::_1, std::placeholders::_2, socket, request, idleTimer));
 	}
 
-	void I2PControlService::HandleRequestReceived (const boost::system::error_code& ecode,
-		size_t bytes_transferred, std::shared_ptr<ssl_socket> socket,
-		std::shared_ptr<I2PControlBuffer> buf)
+	// minimal JSON-RPC reader, params are flat key/value as I2PControl API defines
+	class I2PControlRequestParser
 	{
-		if (ecode)
-		{
-			LogPrint (eLogError, "I2PControl: read error: ", ecode.message ());
-			return;
-		}
-		else
-		{
-			bool isHtml = !memcmp (buf->data (), "POST", 4);
-			try
+		public:
+
+			I2PControlRequestParser (const std::string& json): m_JSON (json), m_Pos (0) {};
+
+			bool Parse (std::vector<I2PControlRequest>& requests) // returns true if batch
 			{
-				std::stringstream ss;
-				ss.write (buf->data (), bytes_transferred);
-				if (isHtml)
+				bool isBatch = Peek () == '[';
+				if (isBatch)
 				{
-					std::string header;
-					size_t contentLength = 0;
-					while (!ss.eof () && header != "\r")
+					m_Pos++;
+					if (Peek () == ']') throw std::runtime_error ("empty batch");
+					do
 					{
-						std::getline(ss, header);
-						auto colon = header.find (':');
-						if (colon != std::string::npos && header.substr (0, colon) == "Content-Length")
-							contentLength = std::stoi (header.substr (colon + 1));
+						requests.emplace_back ();
+						ParseRequest (requests.back ());
 					}
-					if (ss.eof ())
+					while (Next (',', ']'));
+				}
+				else
+				{
+					requests.emplace_back ();
+					ParseRequest (requests.back ());
+				}
+				return isBatch;
+			}
+
+		private:
+
+			char Peek ()
+			{
+				while (m_Pos < m_JSON.length () && isspace (m_JSON[m_Pos])) m_Pos++;
+				if (m_Pos >= m_JSON.length ()) throw std::runtime_error ("unexpected end of JSON");
+				return m_JSON[m_Pos];
+			}
+
+			void Expect (char c)
+			{
+				if (Peek () != c) throw std::runtime_error (std::string ("expected '") + c + "' in JSON");
+				m_Pos++;
+			}
+
+			bool Next (char separator, char end) // true if separator
+			{
+				char c = Peek ();
+				if (c != separator && c != end) throw std::runtime_error ("unexpected character in JSON");
+				m_Pos++;
+				return c == separator;
+			}
+
+			std::string ParseString ()
+			{
+				Expect ('"');
+				std::string s;
+				while (m_Pos < m_JSON.length () && m_JSON[m_Pos] != '"')
+				{
+					char c = m_JSON[m_Pos++];
+					if (c == '\\' && m_Pos < m_JSON.length ())
 					{
-						LogPrint (eLogError, "I2PControl: malformed request, HTTP header expected");
-						return; // TODO:
+						c = m_JSON[m_Pos++];
+						switch (c)
+						{
+							case 'n': c = '\n'; break;
+							case 'r': c = '\r'; break;
+							case 't': c = '\t'; break;
+							case 'b': c = '\b'; break;
+							case 'f': c = '\f'; break;
+							case 'u': // only ASCII is expected
+								c = std::strtol (m_JSON.substr (m_Pos, 4).c_str (), nullptr, 16);
+								m_Pos += 4;
+							break;
+							default: ; // '"', '\\' and '/' as is
+						}
 					}
-					std::streamoff rem = contentLength + ss.tellg () - bytes_transferred; // more bytes to read
-					if (rem > 0)
+					s += c;
+				}
+				Expect ('"');
+				return s;
+			}
+
+			// returns scalar as text, nested objects and arrays are skipped
+			std::string ParseValue (bool& isString)
+			{
+				isString = false;
+				char c = Peek ();
+				if (c == '"')
+				{
+					isString = true;
+					return ParseString ();
+				}
+				if (c == '{' || c == '[')
+				{
+					char end = (c == '{') ? '}' : ']';
+					m_Pos++;
+					if (Peek () == end) { m_Pos++; return ""; }
+					do
 					{
-						bytes_transferred = boost::asio::read (*socket, boost::asio::buffer (buf->data (), rem));
-						ss.write (buf->data (), bytes_transferred);
+						if (c == '{') { ParseString (); Expect (':'); }
+						ParseValue (isString);
 					}
+					while (Next (',', end));
+					isString = false;
+					return "";
 				}
-				std::ostringstream response;
-#if GCC47_BOOST149
-				LogPrint (eLogError, "I2PControl: json_read is not supported due bug in boost 1.49 with gcc 4.7");
-				response << "{\"id\":null,\"error\":";
-				response << "{\"code\":-32603,\"message\":\"JSON requests is not supported with this version of boost\"},";
-				response << "\"jsonrpc\":\"2.0\"}";
-#else
-				boost::property_tree::ptree pt;
-				boost::property_tree::read_json (ss, pt);
+				auto start = m_Pos;
+				while (m_Pos < m_JSON.length () && !strchr (",}] \t\r\n", m_JSON[m_Pos])) m_Pos++;
+				if (start == m_Pos) throw std::runtime_error ("unexpected character in JSON");
+				return m_JSON.substr (start, m_Pos - start);
+			}
 
-				std::string id     = pt.get<std::string>("id");
-				std::string method = pt.get<std::string>("method");
-				auto it = m_MethodHandlers.find (method);
-				if (it != m_MethodHandlers.end ())
+			void ParseRequest (I2PControlRequest& request)
+			{
+				Expect ('{');
+				if (Peek () == '}') { m_Pos++; return; }
+				do
 				{
-					response << "{\"id\":" << id << ",\"result\":{";
-					(this->*(it->second))(pt.get_child ("params"), response);
-					response << "},\"jsonrpc\":\"2.0\"}";
+					auto key = ParseString ();
+					Expect (':');
+					bool isString;
+					if (key == "params" && Peek () == '{')
+					{
+						m_Pos++;
+						if (Peek () == '}') { m_Pos++; continue; }
+						do
+						{
+							auto name = ParseString ();
+							Expect (':');
+							request.params[name] = ParseValue (isString);
+						}
+						while (Next (',', '}'));
+					}
+					else
+					{
+						auto value = ParseValue (isString);
+						if (key == "id")
+							request.id = isString ? "\"" + value + "\"" : value;
+						else if (key == "method")
+							request.method = value;
+					}
 				}
-				else
+				while (Next (',', '}'));
+			}
+
+		private:
+
+			const std::string& m_JSON;
+			size_t m_Pos;
+	};
+
+	void I2PControlService::HandleRequestReceived (const boost::system::error_code& ecode,
+		size_t bytes_transferred, std::shared_ptr<ssl_socket> socket,
+		std::shared_ptr<I2PControlBuffer> buf, std::shared_ptr<boost::asio::deadline_timer> idleTimer)
+	{
+		if (ecode)
+		{
+			idleTimer->cancel ();
+			if (ecode == boost::asio::error::eof || ecode == boost::asio::error::operation_aborted)
+				LogPrint (eLogDebug, "I2PControl: connection closed: ", ecode.message ());
+			else
+				LogPrint (eLogError, "I2PControl: read error: ", ecode.message ());
+			return;
+		}
+		bool isHtml = !memcmp (buf->data (), "POST", 4), keepAlive = true;
+		auto json = std::make_shared<std::string> (buf->data (), bytes_transferred);
+		if (isHtml)
+		{
+			std::stringstream ss (*json);
+			std::string header;
+			size_t contentLength = 0;
+			try
+			{
+				while (!ss.eof () && header != "\r")
 				{
-					LogPrint (eLogWarning, "I2PControl: unknown method ", method);
-					response << "{\"id\":null,\"error\":";
-					response << "{\"code\":-32601,\"message\":\"Method not found\"},";
-					response << "\"jsonrpc\":\"2.0\"}";
+					std::getline(ss, header);
+					auto colon = header.find (':');
+					if (colon != std::string::npos)
+					{
+						auto name = header.substr (0, colon);
+						if (name == "Content-Length")
+							contentLength = std::stoul (header.substr (colon + 1));
+						else if (boost::iequals (name, "Connection"))
+							keepAlive = boost::to_lower_copy (header.substr (colon + 1)).find ("close") == std::string::npos;
+					}
 				}
-#endif
-				SendResponse (socket, buf, response, isHtml);
 			}
 			catch (std::exception& ex)
 			{
-				LogPrint (eLogError, "I2PControl: exception when handle request: ", ex.what ());
-				std::ostringstream response;
-				response << "{\"id\":null,\"error\":";
-				response << "{\"code\":-32700,\"message\":\"" << ex.what () << "\"},";
-				response << "\"jsonrpc\":\"2.0\"}";
-				SendResponse (socket, buf, response, isHtml);
+				idleTimer->cancel ();
+				SendError (socket, -32700, ex.what (), isHtml);
+				return;
 			}
-			catch (...)
+			if (ss.eof ())
+			{
+				idleTimer->cancel ();
+				LogPrint (eLogError, "I2PControl: malformed request, HTTP header expected");
+				return; // TODO:
+			}
+			if (contentLength > I2P_CONTROL_MAX_CONTENT_LENGTH)
+			{
+				idleTimer->cancel ();
+				LogPrint (eLogWarning, "I2PControl: request body of ", contentLength, " bytes is too large");
+				SendError (socket, -32600, "Request too large", isHtml);
+				return;
+			}
+			json->erase (0, ss.tellg ());
+			if (json->length () < contentLength) // more bytes to read, connection is still closed if idle
+			{
+				auto len = json->length ();
+				json->resize (contentLength);
+				boost::asio::async_read (*socket, boost::asio::buffer (&(*json)[len], contentLength - len),
+					std::bind (&I2PControlService::HandleRequestBodyReceived, this,
+						std::placeholders::_1, std::placeholders::_2, socket, json, idleTimer, keepAlive));
+				return;
+			}
+		}
+		idleTimer->cancel ();
+		ProcessRequest (socket, *json, isHtml, keepAlive);
+	}
+
+	void I2PControlService::HandleRequestBodyReceived (const boost::system::error_code& ecode, size_t bytes_transferred,
+		std::shared_ptr<ssl_socket> socket, std::shared_ptr<std::string> json,
+		std::shared_ptr<boost::asio::deadline_timer> idleTimer, bool keepAlive)
+	{
+		idleTimer->cancel ();
+		if (ecode)
+		{
+			if (ecode != boost::asio::error::operation_aborted)
+				LogPrint (eLogError, "I2PControl: read error: ", ecode.message ());
+			return;
+		}
+		ProcessRequest (socket, *json, true, keepAlive);
+	}
+
+	void I2PControlService::ProcessRequest (std::shared_ptr<ssl_socket> socket, const std::string& json, bool isHtml, bool keepAlive)
+	{
+		try
+		{
+			std::vector<I2PControlRequest> requests;
+			bool isBatch = I2PControlRequestParser (json).Parse (requests);
+			std::ostringstream response;
+			if (isBatch) response << "[";
+			for (size_t i = 0; i < requests.size (); i++)
 			{
-				LogPrint (eLogError, "I2PControl: handle request unknown exception");
+				if (i) response << ",";
+				HandleRequest (requests[i], response);
 			}
+			if (isBatch) response << "]";
+			SendResponse (socket, response, isHtml, keepAlive);
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "I2PControl: exception when handle request: ", ex.what ());
+			SendError (socket, -32700, ex.what (), isHtml);
+		}
+		catch (...)
+		{
+			LogPrint (eLogError, "I2PControl: handle request unknown exception");
+		}
+	}
+
+	void I2PControlService::SendError (std::shared_ptr<ssl_socket> socket, int code, const std::string& message, bool isHtml)
+	{
+		std::ostringstream response;
+		response << "{\"id\":null,\"error\":";
+		response << "{\"code\":" << code << ",\"message\":\"" << message << "\"},";
+		response << "\"jsonrpc\":\"2.0\"}";
+		SendResponse (socket, response, isHtml, false);
+	}
+
+	void I2PControlService::HandleRequest (const I2PControlRequest& request, std::ostringstream& response)
+	{
+		const std::string& id = request.id.empty () ? "null" : request.id;
+		auto it = m_MethodHandlers.find (request.method);
+		if (it != m_MethodHandlers.end ())
+		{
+			std::ostringstream results; // discarded if handler fails
+			try
+			{
+				(this->*(it->second))(request.params, results);
+				response << "{\"id\":" << id << ",\"result\":{" << results.str () << "},\"jsonrpc\":\"2.0\"}";
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "I2PControl: exception in method ", request.method, ": ", ex.what ());
+				response << "{\"id\":" << id << ",\"error\":";
+				response << "{\"code\":-32602,\"message\":\"Invalid params\"},";
+				response << "\"jsonrpc\":\"2.0\"}";
+			}
+		}
+		else
+		{
+			LogPrint (eLogWarning, "I2PControl: unknown method ", request.method);
+			response << "{\"id\":" << id << ",\"error\":";
+			response << "{\"code\":-32601,\"message\":\"Method not found\"},";
+			response << "\"jsonrpc\":\"2.0\"}";
 		}
 	}
 
@@ -288,7 +523,15 @@ namespace client
 	{
 		ss << "\"" << name << "\":";
 		if (value.length () > 0)
-			ss << "\"" << value << "\"";
+		{
+			ss << "\"";
+			for (auto c: value)
+			{
+				if (c == '"' || c == '\\') ss << '\\';
+				ss << c;
+			}
+			ss << "\"";
+		}
 		else
 			ss << "null";
 	}
@@ -305,46 +548,56 @@ namespace client
 		ss << "\"" << name << "\":" << buf.str();
 	}
 
+	void I2PControlService::InsertLatencyParam (std::ostringstream& ss, const std::string& name, const i2p::metrics::Histogram& histogram) const
+	{
+		// milliseconds
+		ss << "\"" << name << "\":{\"p50\":" << histogram.GetPercentile (0.5) << ",\"p99\":" << histogram.GetPercentile (0.99) << "}";
+	}
+
 	void I2PControlService::SendResponse (std::shared_ptr<ssl_socket> socket,
-		std::shared_ptr<I2PControlBuffer> buf, std::ostringstream& response, bool isHtml)
+		std::ostringstream& response, bool isHtml, bool keepAlive)
 	{
-		size_t len = response.str ().length (), offset = 0;
+		auto sendBuffer = std::make_shared<std::string> ();
+		std::string body = response.str ();
 		if (isHtml)
 		{
 			std::ostringstream header;
 			header << "HTTP/1.1 200 OK\r\n";
-			header << "Connection: close\r\n";
-			header << "Content-Length: " << boost::lexical_cast<std::string>(len) << "\r\n";
+			header << "Connection: " << (keepAlive ? "keep-alive" : "close") << "\r\n";
+			if (keepAlive)
+				header << "Keep-Alive: timeout=" << I2P_CONTROL_KEEP_ALIVE_TIMEOUT << "\r\n";
+			header << "Content-Length: " << boost::lexical_cast<std::string>(body.length ()) << "\r\n";
 			header << "Content-Type: application/json\r\n";
 			header << "Date: ";
 			auto facet = new boost::local_time::local_time_facet ("%a, %d %b %Y %H:%M:%S GMT");
 			header.imbue(std::locale (header.getloc(), facet));
 			header << boost::posix_time::second_clock::local_time() << "\r\n";
 			header << "\r\n";
-			offset = header.str ().size ();
-			memcpy (buf->data (), header.str ().c_str (), offset);
+			*sendBuffer = header.str ();
 		}
-		memcpy (buf->data () + offset, response.str ().c_str (), len);
-		boost::asio::async_write (*socket, boost::asio::buffer (buf->data (), offset + len),
+		*sendBuffer += body;
+		boost::asio::async_write (*socket, boost::asio::buffer (*sendBuffer),
 			boost::asio::transfer_all (),
 			std::bind(&I2PControlService::HandleResponseSent, this,
-				std::placeholders::_1, std::placeholders::_2, socket, buf));
+				std::placeholders::_1, std::placeholders::_2, socket, sendBuffer, keepAlive));
 	}
 
 	void I2PControlService::HandleResponseSent (const boost::system::error_code& ecode, std::size_t bytes_transferred,
-		std::shared_ptr<ssl_socket> socket, std::shared_ptr<I2PControlBuffer> buf)
+		std::shared_ptr<ssl_socket> socket, std::shared_ptr<std::string> sendBuffer, bool keepAlive)
 	{
 		if (ecode) {
 			LogPrint (eLogError, "I2PControl: write error: ", ecode.message ());
 		}
+		else if (keepAlive)
+			ReadRequest (socket); // next request over same TLS session
 	}
 
 // handlers
 
-	void I2PControlService::AuthenticateHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::AuthenticateHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
-		int api       = params.get<int> ("API");
-		auto password = params.get<std::string> ("Password");
+		int api       = std::stoi (params.at ("API"));
+		auto password = params.at ("Password");
 		LogPrint (eLogDebug, "I2PControl: Authenticate API=", api, " Password=", password);
 		if (password != m_Password) {
 			LogPrint (eLogError, "I2PControl: Authenticate - Invalid password: ", password);
@@ -357,9 +610,9 @@ namespace client
 		InsertParam (results, "Token", token);
 	}
 
-	void I2PControlService::EchoHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::EchoHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
-		auto echo = params.get<std::string> ("Echo");
+		auto echo = params.at ("Echo");
 		LogPrint (eLogDebug, "I2PControl Echo Echo=", echo);
 		InsertParam (results, "Result", echo);
 	}
@@ -367,7 +620,7 @@ namespace client
 
 // I2PControl
 
-	void I2PControlService::I2PControlHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::I2PControlHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
 		for (auto& it: params)
 		{
@@ -375,7 +628,7 @@ namespace client
 			auto it1 = m_I2PControlHandlers.find (it.first);
 			if (it1 != m_I2PControlHandlers.end ())
 			{
-				(this->*(it1->second))(it.second.data ());
+				(this->*(it1->second))(it.second);
 				InsertParam (results, it.first, "");
 			}
 			else
@@ -392,7 +645,7 @@ namespace client
 
 // RouterInfo
 
-	void I2PControlService::RouterInfoHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::RouterInfoHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
 		for (auto it = params.begin (); it != params.end (); it++)
 		{
@@ -441,7 +694,7 @@ namespace client
 
 	void I2PControlService::TunnelsParticipatingHandler (std::ostringstream& results)
 	{
-		int transit = i2p::tunnel::tunnels.GetTransitTunnels ().size ();
+		int transit = i2p::tunnel::tunnels.CountTransitTunnels ();
 		InsertParam (results, "i2p.router.net.tunnels.participating", transit);
 	}
 
@@ -451,6 +704,21 @@ namespace client
 		InsertParam (results, "i2p.router.net.tunnels.successrate", rate);
 	}
 
+	void I2PControlService::TunnelsBuildTimeHandler (std::ostringstream& results)
+	{
+		InsertLatencyParam (results, "i2p.router.net.tunnels.buildtime", i2p::metrics::tunnelBuildTime);
+	}
+
+	void I2PControlService::LeaseSetRequestTimeHandler (std::ostringstream& results)
+	{
+		InsertLatencyParam (results, "i2p.router.client.leasesetrequesttime", i2p::metrics::leaseSetRequestTime);
+	}
+
+	void I2PControlService::StreamFirstDataTimeHandler (std::ostringstream& results)
+	{
+		InsertLatencyParam (results, "i2p.router.client.streamfirstdatatime", i2p::metrics::streamFirstDataTime);
+	}
+
 	void I2PControlService::InboundBandwidth1S (std::ostringstream& results)
 	{
 		double bw = i2p::transport::transports.GetInBandwidth ();
@@ -476,7 +744,7 @@ namespace client
 
 // RouterManager
 
-	void I2PControlService::RouterManagerHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::RouterManagerHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
 		for (auto it = params.begin (); it != params.end (); it++)
 		{
@@ -525,7 +793,7 @@ namespace client
 	}
 
 // network setting
-	void I2PControlService::NetworkSettingHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::NetworkSettingHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
 		for (auto it = params.begin (); it != params.end (); it++)
 		{
@@ -533,7 +801,10 @@ namespace client
 			auto it1 = m_NetworkSettingHandlers.find (it->first);
 			if (it1 != m_NetworkSettingHandlers.end ()) {
 				if (it != params.begin ()) results << ",";
-				(this->*(it1->second))(it->second.data (), results);
+				(this->*(it1->second))(it->second, results);
+			} else if (!it->first.compare (0, strlen (I2P_CONTROL_LOG_LEVEL), I2P_CONTROL_LOG_LEVEL)) {
+				if (it != params.begin ()) results << ",";
+				LogLevelSetting (it->first, it->second, results);
 			} else
 				LogPrint (eLogError, "I2PControl: NetworkSetting unknown request: ", it->first);
 		}
@@ -555,6 +826,27 @@ namespace client
 		InsertParam (results, "i2p.router.net.bw.out", bw);
 	}
 
+	void I2PControlService::LogLevelSetting (const std::string& name, const std::string& value, std::ostringstream& results)
+	{
+		auto& logger = i2p::log::Logger ();
+		auto len = strlen (I2P_CONTROL_LOG_LEVEL);
+		if (name.length () == len)
+		{
+			if (value != "null") logger.SetLogLevel (value);
+			InsertParam (results, name, std::string (i2p::log::GetLogLevelName (logger.GetLogLevel ())));
+			return;
+		}
+		std::string category = name.substr (len + 1);
+		if (value != "null") logger.SetLogLevel (category, value);
+		for (int i = 0; i < eNumLogCategories; i++)
+			if (category == i2p::log::GetLogCategoryName ((LogCategory)i))
+			{
+				InsertParam (results, name, std::string (i2p::log::GetLogLevelName (logger.GetLogLevel ((LogCategory)i))));
+				return;
+			}
+		InsertParam (results, name, std::string ("null")); // unknown category
+	}
+
 	// certificate
 	void I2PControlService::CreateCertificate (const char *crt_path, const char *key_path)
 	{
@@ -606,7 +898,7 @@ namespace client
 
 // ClientServicesInfo
 
-	void I2PControlService::ClientServicesInfoHandler (const boost::property_tree::ptree& params, std::ostringstream& results)
+	void I2PControlService::ClientServicesInfoHandler (const I2PControlParams& params, std::ostringstream& results)
 	{
 		for (auto it = params.begin (); it != params.end (); it++)
 		{
@@ -9,9 +9,11 @@
 #include <sstream>
 #include <map>
 #include <set>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include "Metrics.h"
 
 namespace i2p
 {
@@ -19,10 +21,21 @@ namespace client
 {
 	const size_t I2P_CONTROL_MAX_REQUEST_SIZE = 1024;
 	typedef std::array<char, I2P_CONTROL_MAX_REQUEST_SIZE> I2PControlBuffer;
+	const int I2P_CONTROL_KEEP_ALIVE_TIMEOUT = 60; // in seconds
+	const size_t I2P_CONTROL_MAX_CONTENT_LENGTH = 65536; // larger HTTP body is rejected before authentication
+
+	typedef std::map<std::string, std::string> I2PControlParams; // flat as in API, null is "null"
+	struct I2PControlRequest
+	{
+		std::string id; // as JSON token, quoted if string
+		std::string method;
+		I2PControlParams params;
+	};
 
 	const long I2P_CONTROL_CERTIFICATE_VALIDITY = 365*10; // 10 years
 	const char I2P_CONTROL_CERTIFICATE_COMMON_NAME[] = "i2pd.i2pcontrol";
 	const char I2P_CONTROL_CERTIFICATE_ORGANIZATION[] = "Purple I2P";
+	const char I2P_CONTROL_LOG_LEVEL[] = "i2p.router.log.level"; // followed by .<category> for subsystem
 
 	class I2PControlService
 	{
@@ -44,11 +57,18 @@ namespace client
 			void HandleHandshake (const boost::system::error_code& ecode, std::shared_ptr<ssl_socket> socket);
 			void ReadRequest (std::shared_ptr<ssl_socket> socket);
 			void HandleRequestReceived (const boost::system::error_code& ecode, size_t bytes_transferred,
-				std::shared_ptr<ssl_socket> socket, std::shared_ptr<I2PControlBuffer> buf);
+				std::shared_ptr<ssl_socket> socket, std::shared_ptr<I2PControlBuffer> buf,
+				std::shared_ptr<boost::asio::deadline_timer> idleTimer);
+			void HandleRequestBodyReceived (const boost::system::error_code& ecode, size_t bytes_transferred,
+				std::shared_ptr<ssl_socket> socket, std::shared_ptr<std::string> json,
+				std::shared_ptr<boost::asio::deadline_timer> idleTimer, bool keepAlive);
+			void ProcessRequest (std::shared_ptr<ssl_socket> socket, const std::string& json, bool isHtml, bool keepAlive);
+			void SendError (std::shared_ptr<ssl_socket> socket, int code, const std::string& message, bool isHtml);
+			void HandleRequest (const I2PControlRequest& request, std::ostringstream& response);
 			void SendResponse (std::shared_ptr<ssl_socket> socket,
-				std::shared_ptr<I2PControlBuffer> buf, std::ostringstream& response, bool isHtml);
+				std::ostringstream& response, bool isHtml, bool keepAlive);
 			void HandleResponseSent (const boost::system::error_code& ecode, std::size_t bytes_transferred,
-				std::shared_ptr<ssl_socket> socket, std::shared_ptr<I2PControlBuffer> buf);
+				std::shared_ptr<ssl_socket> socket, std::shared_ptr<std::string> sendBuffer, bool keepAlive);
 
 			void CreateCertificate (const char *crt_path, const char *key_path);
 
@@ -58,17 +78,18 @@ namespace client
 			void InsertParam (std::ostringstream& ss, const std::string& name, double value) const;
 			void InsertParam (std::ostringstream& ss, const std::string& name, const std::string& value) const;
 			void InsertParam (std::ostringstream& ss, const std::string& name, const boost::property_tree::ptree& value) const;
+			void InsertLatencyParam (std::ostringstream& ss, const std::string& name, const i2p::metrics::Histogram& histogram) const;
 
 			// methods
-			typedef void (I2PControlService::*MethodHandler)(const boost::property_tree::ptree& params, std::ostringstream& results);
+			typedef void (I2PControlService::*MethodHandler)(const I2PControlParams& params, std::ostringstream& results);
 
-			void AuthenticateHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void EchoHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void I2PControlHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void RouterInfoHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void RouterManagerHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void NetworkSettingHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
-			void ClientServicesInfoHandler (const boost::property_tree::ptree& params, std::ostringstream& results);
+			void AuthenticateHandler (const I2PControlParams& params, std::ostringstream& results);
+			void EchoHandler (const I2PControlParams& params, std::ostringstream& results);
+			void I2PControlHandler (const I2PControlParams& params, std::ostringstream& results);
+			void RouterInfoHandler (const I2PControlParams& params, std::ostringstream& results);
+			void RouterManagerHandler (const I2PControlParams& params, std::ostringstream& results);
+			void NetworkSettingHandler (const I2PControlParams& params, std::ostringstream& results);
+			void ClientServicesInfoHandler (const I2PControlParams& params, std::ostringstream& results);
 
 			// I2PControl
 			typedef void (I2PControlService::*I2PControlRequestHandler)(const std::string& value);
@@ -84,6 +105,9 @@ namespace client
 			void NetStatusHandler (std::ostringstream& results);
 			void TunnelsParticipatingHandler (std::ostringstream& results);
 			void TunnelsSuccessRateHandler (std::ostringstream& results);
+			void TunnelsBuildTimeHandler (std::ostringstream& results);
+			void LeaseSetRequestTimeHandler (std::ostringstream& results);
+			void StreamFirstDataTimeHandler (std::ostringstream& results);
 			void InboundBandwidth1S (std::ostringstream& results);
 			void OutboundBandwidth1S (std::ostringstream& results);
 			void NetTotalReceivedBytes (std::ostringstream& results);
@@ -99,6 +123,7 @@ namespace client
 			typedef void (I2PControlService::*NetworkSettingRequestHandler)(const std::string& value, std::ostringstream& results);
 			void InboundBandwidthLimit  (const std::string& value, std::ostringstream& results);
 			void OutboundBandwidthLimit (const std::string& value, std::ostringstream& results);
+			void LogLevelSetting (const std::string& name, const std::string& value, std::ostringstream& results); // name is global or .<category>
 
 			// ClientServicesInfo
 			typedef void (I2PControlService::*ClientServicesInfoRequestHandler)(std::ostringstream& results);
@@ -61,11 +61,12 @@ namespace transport
 
 	void UPnP::Run ()
 	{
+		i2p::util::InitThread ("UPnP");
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "UPnP");
 				// Discover failed
 				break; // terminate the thread
 			}
@@ -1,5 +1,12 @@
 #include <stdlib.h>
 #include <string.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <tmmintrin.h>
+#define BASE64_SSSE3 1 // compiled for SSSE3 regardless of flags, chosen at runtime
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BASE64_NEON 1
+#endif
 
 #include "Base.h"
 
@@ -58,6 +65,122 @@ namespace data
 
 	static char P64 = '=';
 
+	/*
+	* Vectorized bulk of Base64 with I2P alphabet, return number of input bytes processed.
+	* Decoders stop at first block with a character out of alphabet, scalar code deals with the rest
+	*/
+
+#if BASE64_SSSE3
+	static bool IsSSSE3Supported ()
+	{
+		static bool supported = __builtin_cpu_supports ("ssse3");
+		return supported;
+	}
+
+	__attribute__((target("ssse3")))
+	static size_t Base64EncodeSSSE3 (const uint8_t * in, size_t len, char * out) // 12 bytes to 16 chars
+	{
+		const __m128i shuffle = _mm_setr_epi8 (1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+		const __m128i shiftLUT = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '-' - 62, '~' - 63, 'A', 0, 0);
+		size_t pos = 0;
+		for (; pos + 16 <= len; pos += 12, out += 16) // loads 16 bytes
+		{
+			__m128i v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(in + pos)), shuffle);
+			// split every 3 bytes to 4 6-bits indices
+			__m128i t0 = _mm_mulhi_epu16 (_mm_and_si128 (v, _mm_set1_epi32 (0x0fc0fc00)), _mm_set1_epi32 (0x04000040));
+			__m128i t1 = _mm_mullo_epi16 (_mm_and_si128 (v, _mm_set1_epi32 (0x003f03f0)), _mm_set1_epi32 (0x01000010));
+			__m128i indices = _mm_or_si128 (t0, t1);
+			// 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+			__m128i r = _mm_subs_epu8 (indices, _mm_set1_epi8 (51));
+			r = _mm_or_si128 (r, _mm_and_si128 (_mm_cmpgt_epi8 (_mm_set1_epi8 (26), indices), _mm_set1_epi8 (13)));
+			_mm_storeu_si128 ((__m128i *)out, _mm_add_epi8 (indices, _mm_shuffle_epi8 (shiftLUT, r)));
+		}
+		return pos;
+	}
+
+	__attribute__((target("ssse3")))
+	static size_t Base64DecodeSSSE3 (const char * in, size_t len, uint8_t * out) // 16 chars to 12 bytes
+	{
+		size_t pos = 0;
+		for (; pos + 16 <= len; pos += 16, out += 12)
+		{
+			__m128i c = _mm_loadu_si128 ((const __m128i *)(in + pos));
+			__m128i upper = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('A' - 1)), _mm_cmplt_epi8 (c, _mm_set1_epi8 ('Z' + 1)));
+			__m128i lower = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('a' - 1)), _mm_cmplt_epi8 (c, _mm_set1_epi8 ('z' + 1)));
+			__m128i digit = _mm_and_si128 (_mm_cmpgt_epi8 (c, _mm_set1_epi8 ('0' - 1)), _mm_cmplt_epi8 (c, _mm_set1_epi8 ('9' + 1)));
+			__m128i dash = _mm_cmpeq_epi8 (c, _mm_set1_epi8 ('-')), tilde = _mm_cmpeq_epi8 (c, _mm_set1_epi8 ('~'));
+			__m128i valid = _mm_or_si128 (_mm_or_si128 (_mm_or_si128 (upper, lower), _mm_or_si128 (digit, dash)), tilde);
+			if (_mm_movemask_epi8 (valid) != 0xFFFF) break;
+			__m128i shift = _mm_or_si128 (_mm_or_si128 (_mm_and_si128 (upper, _mm_set1_epi8 (-'A')),
+				_mm_and_si128 (lower, _mm_set1_epi8 (26 - 'a'))), _mm_or_si128 (_mm_or_si128 (_mm_and_si128 (digit, _mm_set1_epi8 (52 - '0')),
+				_mm_and_si128 (dash, _mm_set1_epi8 (62 - '-'))), _mm_and_si128 (tilde, _mm_set1_epi8 (63 - '~'))));
+			__m128i v = _mm_add_epi8 (c, shift);
+			// merge 4 6-bits values to 3 bytes
+			v = _mm_maddubs_epi16 (v, _mm_set1_epi32 (0x01400140));
+			v = _mm_madd_epi16 (v, _mm_set1_epi32 (0x00011000));
+			v = _mm_shuffle_epi8 (v, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+			uint8_t buf[16];
+			_mm_storeu_si128 ((__m128i *)buf, v);
+			memcpy (out, buf, 12);
+		}
+		return pos;
+	}
+#endif
+
+#if BASE64_NEON
+	static size_t Base64EncodeNEON (const uint8_t * in, size_t len, char * out) // 48 bytes to 64 chars
+	{
+		uint8x16x4_t table;
+		for (int i = 0; i < 4; i++) table.val[i] = vld1q_u8 ((const uint8_t *)T64 + 16*i);
+		const uint8x16_t mask = vdupq_n_u8 (0x3f);
+		size_t pos = 0;
+		for (; pos + 48 <= len; pos += 48, out += 64)
+		{
+			uint8x16x3_t v = vld3q_u8 (in + pos);
+			uint8x16x4_t r;
+			r.val[0] = vshrq_n_u8 (v.val[0], 2);
+			r.val[1] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (v.val[0], 4), vshrq_n_u8 (v.val[1], 4)), mask);
+			r.val[2] = vandq_u8 (vorrq_u8 (vshlq_n_u8 (v.val[1], 2), vshrq_n_u8 (v.val[2], 6)), mask);
+			r.val[3] = vandq_u8 (v.val[2], mask);
+			for (int i = 0; i < 4; i++) r.val[i] = vqtbl4q_u8 (table, r.val[i]);
+			vst4q_u8 ((uint8_t *)out, r);
+		}
+		return pos;
+	}
+
+	static inline uint8x16_t Base64DecodeNEON (uint8x16_t c, uint8x16_t& valid)
+	{
+		uint8x16_t upper = vandq_u8 (vcgeq_u8 (c, vdupq_n_u8 ('A')), vcleq_u8 (c, vdupq_n_u8 ('Z')));
+		uint8x16_t lower = vandq_u8 (vcgeq_u8 (c, vdupq_n_u8 ('a')), vcleq_u8 (c, vdupq_n_u8 ('z')));
+		uint8x16_t digit = vandq_u8 (vcgeq_u8 (c, vdupq_n_u8 ('0')), vcleq_u8 (c, vdupq_n_u8 ('9')));
+		uint8x16_t dash = vceqq_u8 (c, vdupq_n_u8 ('-')), tilde = vceqq_u8 (c, vdupq_n_u8 ('~'));
+		valid = vandq_u8 (valid, vorrq_u8 (vorrq_u8 (vorrq_u8 (upper, lower), vorrq_u8 (digit, dash)), tilde));
+		uint8x16_t shift = vorrq_u8 (vorrq_u8 (vandq_u8 (upper, vdupq_n_u8 ((uint8_t)-'A')),
+			vandq_u8 (lower, vdupq_n_u8 ((uint8_t)(26 - 'a')))), vorrq_u8 (vorrq_u8 (vandq_u8 (digit, vdupq_n_u8 (52 - '0')),
+			vandq_u8 (dash, vdupq_n_u8 (62 - '-'))), vandq_u8 (tilde, vdupq_n_u8 ((uint8_t)(63 - '~')))));
+		return vaddq_u8 (c, shift);
+	}
+
+	static size_t Base64DecodeNEON (const char * in, size_t len, uint8_t * out) // 64 chars to 48 bytes
+	{
+		size_t pos = 0;
+		for (; pos + 64 <= len; pos += 64, out += 48)
+		{
+			uint8x16x4_t c = vld4q_u8 ((const uint8_t *)in + pos);
+			uint8x16_t valid = vdupq_n_u8 (0xFF);
+			for (int i = 0; i < 4; i++) c.val[i] = Base64DecodeNEON (c.val[i], valid);
+			if (vminvq_u8 (valid) != 0xFF) break;
+			uint8x16x3_t r;
+			r.val[0] = vorrq_u8 (vshlq_n_u8 (c.val[0], 2), vshrq_n_u8 (c.val[1], 4));
+			r.val[1] = vorrq_u8 (vshlq_n_u8 (c.val[1], 4), vshrq_n_u8 (c.val[2], 2));
+			r.val[2] = vorrq_u8 (vshlq_n_u8 (c.val[2], 6), c.val[3]);
+			vst3q_u8 (out, r);
+		}
+		return pos;
+	}
+#endif
+
 	/*
 	*
 	* ByteStreamToBase64
@@ -94,7 +217,14 @@ namespace data
 		     outCount = 4*(n+1);
 		if (outCount > len) return 0;
 		pd = (unsigned char *)OutBuffer;
-		for ( i = 0; i<n; i++ ){
+		size_t processed = 0;
+#if BASE64_SSSE3
+		if (IsSSSE3Supported ()) processed = Base64EncodeSSSE3 (ps, InCount, (char *)pd);
+#elif BASE64_NEON
+		processed = Base64EncodeNEON (ps, InCount, (char *)pd);
+#endif
+		ps += processed; pd += processed/3*4;
+		for ( i = processed/3; i<n; i++ ){
 		     acc_1 = *ps++;
 		     acc_2 = (acc_1<<4)&0x30;
 		     acc_1 >>= 2;              /* base64 digit #1 */
@@ -181,7 +311,14 @@ namespace data
 		if (outCount > len) return -1;
 		pd = OutBuffer;
 		auto endOfOutBuffer = OutBuffer + outCount;
-		for ( i = 0; i < n; i++ ){
+		size_t processed = 0; // last group might be padded, always scalar
+#if BASE64_SSSE3
+		if (IsSSSE3Supported ()) processed = Base64DecodeSSSE3 ((const char *)ps, InCount - 4, pd);
+#elif BASE64_NEON
+		processed = Base64DecodeNEON ((const char *)ps, InCount - 4, pd);
+#endif
+		ps += processed; pd += processed/4*3;
+		for ( i = processed/4; i < n; i++ ){
 		     acc_1 = iT64[*ps++];
 		     acc_2 = iT64[*ps++];
 		     acc_1 <<= 2;
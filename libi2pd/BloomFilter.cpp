@@ -1,63 +1,130 @@
 #include "BloomFilter.h"
 #include "I2PEndian.h"
 #include <array>
+#include <utility>
+#include <string.h>
 #include <openssl/sha.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace i2p
 {
 namespace util
 {
+	const std::size_t BLOOM_FILTER_BLOCK_SIZE = 64; // one cache line
+	const int BLOOM_FILTER_BLOCK_NUM_WORDS = BLOOM_FILTER_BLOCK_SIZE/8;
+	const int BLOOM_FILTER_NUM_PROBES = 8; // k, 9 bits of digest per probe
 
-	/** @brief decaying bloom filter implementation */
+	/** @brief decaying bloom filter implementation, all probes of entry are in one cache line */
 	class DecayingBloomFilter : public IBloomFilter
 	{
+		typedef std::array<uint64_t, BLOOM_FILTER_BLOCK_NUM_WORDS> Mask;
+
 	public:
 
 		DecayingBloomFilter(const std::size_t size)
 		{
-			m_Size = size;
-			m_Data = new uint8_t[size];
+			m_NumBlocks = (size + BLOOM_FILTER_BLOCK_SIZE - 1)/BLOOM_FILTER_BLOCK_SIZE;
+			if (!m_NumBlocks) m_NumBlocks = 1;
+			// two generations, current and previous, aligned to cache line
+			m_Buffer = new uint8_t[2*m_NumBlocks*BLOOM_FILTER_BLOCK_SIZE + BLOOM_FILTER_BLOCK_SIZE];
+			auto aligned = (uint8_t *)(((uintptr_t)m_Buffer + BLOOM_FILTER_BLOCK_SIZE - 1) & ~(uintptr_t)(BLOOM_FILTER_BLOCK_SIZE - 1));
+			m_Current = (uint64_t *)aligned;
+			m_Previous = m_Current + m_NumBlocks*BLOOM_FILTER_BLOCK_NUM_WORDS;
+			memset(aligned, 0, 2*m_NumBlocks*BLOOM_FILTER_BLOCK_SIZE);
 		}
 
 		/** @brief implements IBloomFilter::~IBloomFilter */
 		~DecayingBloomFilter()
 		{
-			delete [] m_Data;
+			delete [] m_Buffer;
 		}
 
 		/** @brief implements IBloomFilter::Add */
 		bool Add(const uint8_t * data, std::size_t len)
 		{
 			std::size_t idx;
-			uint8_t mask;
+			Mask mask;
 			Get(data, len, idx, mask);
-			if(m_Data[idx] & mask) return false; // filter hit
-			m_Data[idx] |= mask;
-			return true;
+			return Insert(idx, mask);
+		}
+
+		/** @brief implements IBloomFilter::AddHash */
+		bool AddHash(const uint8_t * hash)
+		{
+			// 9 bits of first word for one probe, rest for block, 9 bits of second word per other probe
+			uint64_t h0 = buf64toh(hash), h1 = buf64toh(hash + 8);
+			Mask mask;
+			mask.fill(0);
+			SetBit(mask, h0 & 0x1FF);
+			for (int i = 1; i < BLOOM_FILTER_NUM_PROBES; i++, h1 >>= 9)
+				SetBit(mask, h1 & 0x1FF);
+			return Insert((h0 >> 9) % m_NumBlocks, mask);
 		}
 
 		/** @brief implements IBloomFilter::Decay */
 		void Decay()
 		{
-			// reset bloom filter buffer
-			memset(m_Data, 0, m_Size);
+			// current generation becomes previous, forget previous
+			std::swap(m_Current, m_Previous);
+			memset(m_Current, 0, m_NumBlocks*BLOOM_FILTER_BLOCK_SIZE);
 		}
 
 	private:
-		/** @brief get bit index for for data */
-		void Get(const uint8_t * data, std::size_t len, std::size_t & idx, uint8_t & bm)
+		/** @brief set bits of mask in block idx of current generation, return false if already in either generation */
+		bool Insert(std::size_t idx, const Mask & mask)
+		{
+			uint64_t * block = m_Current + idx*BLOOM_FILTER_BLOCK_NUM_WORDS;
+			if(Test(block, mask) || Test(m_Previous + idx*BLOOM_FILTER_BLOCK_NUM_WORDS, mask))
+				return false; // filter hit
+			for (int i = 0; i < BLOOM_FILTER_BLOCK_NUM_WORDS; i++)
+				block[i] |= mask[i];
+			return true;
+		}
+
+		static void SetBit(Mask & mask, int bit)
+		{
+			mask[bit >> 6] |= (uint64_t)1 << (bit & 0x3F);
+		}
+
+		/** @brief get block index and bits within block for data */
+		void Get(const uint8_t * data, std::size_t len, std::size_t & idx, Mask & mask)
 		{
-			bm = 1;
 			uint8_t digest[32];
 			// TODO: use blake2 because it's faster
 			SHA256(data, len, digest);
-			uint64_t i = buf64toh(digest);
-			idx = i % m_Size;
-			bm <<= (i % 8);
+			idx = buf64toh(digest) % m_NumBlocks;
+			mask.fill(0);
+			const uint8_t * bits = digest + 8;
+			for (int i = 0; i < BLOOM_FILTER_NUM_PROBES; i++)
+			{
+				SetBit(mask, bufbe16toh(bits + 2*i) & 0x1FF); // 0 - 511
+			}
+		}
+
+		/** @brief return true if all bits of mask are set in block */
+		static bool Test(const uint64_t * block, const Mask & mask)
+		{
+#if defined(__SSE2__)
+			__m128i res = _mm_set1_epi32(-1);
+			for (int i = 0; i < BLOOM_FILTER_BLOCK_NUM_WORDS; i += 2)
+			{
+				__m128i m = _mm_loadu_si128((const __m128i *)(mask.data() + i));
+				__m128i b = _mm_load_si128((const __m128i *)(block + i));
+				res = _mm_and_si128(res, _mm_cmpeq_epi32(_mm_and_si128(b, m), m));
+			}
+			return _mm_movemask_epi8(res) == 0xFFFF;
+#else
+			for (int i = 0; i < BLOOM_FILTER_BLOCK_NUM_WORDS; i++)
+				if ((block[i] & mask[i]) != mask[i]) return false;
+			return true;
+#endif
 		}
 
-		uint8_t * m_Data;
-		std::size_t m_Size;
+		uint8_t * m_Buffer;
+		uint64_t * m_Current, * m_Previous;
+		std::size_t m_NumBlocks;
 	};
 
 
@@ -16,6 +16,8 @@ namespace util
 		virtual ~IBloomFilter() {};
 		/** @brief add entry to bloom filter, return false if filter hit otherwise return true */
 		virtual bool Add(const uint8_t * data, std::size_t len) = 0;
+		/** @brief add entry by its 16 bytes keyed hash, e.g. calculated outside of lock, return false if filter hit */
+		virtual bool AddHash(const uint8_t * hash) = 0;
 		/** @brief optionally decay old entries */
 		virtual void Decay() = 0;
 	};
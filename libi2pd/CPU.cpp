@@ -2,6 +2,9 @@
 #if defined(__x86_64__) || defined(__i386__)
 #include <cpuid.h>
 #endif
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
 #include "Log.h"
 
 #ifndef bit_AES
@@ -10,6 +13,9 @@
 #ifndef bit_AVX
 #define bit_AVX (1 << 28)
 #endif
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
 
 
 namespace i2p
@@ -18,6 +24,7 @@ namespace cpu
 {
 	bool aesni = false;
 	bool avx = false;
+	bool armaes = false;
 
 	void Detect()
 	{
@@ -50,6 +57,16 @@ namespace cpu
 		}
 #endif  // __AVX__
 #endif  // defined(__AES__) || defined(__AVX__)
+
+#ifdef ARM64AES
+#if defined(__aarch64__) && defined(__linux__)
+		armaes = getauxval (AT_HWCAP) & HWCAP_AES;
+#endif
+		if(armaes)
+		{
+			LogPrint(eLogInfo, "ARMv8 AES enabled");
+		}
+#endif  // ARM64AES
 	}
 }
 }
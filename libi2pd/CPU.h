@@ -1,12 +1,18 @@
 #ifndef LIBI2PD_CPU_H
 #define LIBI2PD_CPU_H
 
+// ARMv8 AES instructions are available with -march=armv8-a+crypto on little-endian aarch64 only
+#if defined(ARM64AES) && !(defined(__aarch64__) && !defined(__AARCH64EB__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)))
+#undef ARM64AES
+#endif
+
 namespace i2p
 {
 namespace cpu
 {
   extern bool aesni;
   extern bool avx;
+  extern bool armaes; // ARMv8 crypto extensions
 
   void Detect();
 }
@@ -12,6 +12,10 @@
 #include "ChaCha20.h"
 
 #if !OPENSSL_AEAD_CHACHA20_POLY1305 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace i2p
 {
 namespace crypto
@@ -80,6 +84,54 @@ void block (Chacha20State &input, int rounds)
 
 }
 
+#if defined(__SSE2__)
+#define ROTL128(x, n) _mm_or_si128 (_mm_slli_epi32 (x, n), _mm_srli_epi32 (x, 32 - n))
+#define QUARTERROUND128(a, b, c, d) \
+	a = _mm_add_epi32 (a, b); d = ROTL128 (_mm_xor_si128 (d, a), 16); \
+	c = _mm_add_epi32 (c, d); b = ROTL128 (_mm_xor_si128 (b, c), 12); \
+	a = _mm_add_epi32 (a, b); d = ROTL128 (_mm_xor_si128 (d, a),  8); \
+	c = _mm_add_epi32 (c, d); b = ROTL128 (_mm_xor_si128 (b, c),  7);
+
+// 4 consecutive blocks at once, each register holds same word of 4 blocks
+void block4 (const Chacha20State &input, int rounds, uint8_t * buf) // xor 256 bytes of buf
+{
+	__m128i in[16], x[16];
+	for (int i = 0; i < 16; i++)
+		in[i] = _mm_set1_epi32 (input.data[i]);
+	in[12] = _mm_add_epi32 (in[12], _mm_set_epi32 (3, 2, 1, 0)); // counters
+	for (int i = 0; i < 16; i++) x[i] = in[i];
+
+	for (int i = rounds; i > 0; i -= 2)
+	{
+		QUARTERROUND128(x[0], x[4],  x[8], x[12]);
+		QUARTERROUND128(x[1], x[5],  x[9], x[13]);
+		QUARTERROUND128(x[2], x[6], x[10], x[14]);
+		QUARTERROUND128(x[3], x[7], x[11], x[15]);
+		QUARTERROUND128(x[0], x[5], x[10], x[15]);
+		QUARTERROUND128(x[1], x[6], x[11], x[12]);
+		QUARTERROUND128(x[2], x[7],  x[8], x[13]);
+		QUARTERROUND128(x[3], x[4],  x[9], x[14]);
+	}
+	for (int i = 0; i < 16; i++) x[i] = _mm_add_epi32 (x[i], in[i]);
+
+	// transpose every 4 words to get 16 bytes of each block
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128i t0 = _mm_unpacklo_epi32 (x[i], x[i + 1]), t1 = _mm_unpacklo_epi32 (x[i + 2], x[i + 3]);
+		__m128i t2 = _mm_unpackhi_epi32 (x[i], x[i + 1]), t3 = _mm_unpackhi_epi32 (x[i + 2], x[i + 3]);
+		__m128i b[4] = { _mm_unpacklo_epi64 (t0, t1), _mm_unpackhi_epi64 (t0, t1),
+			_mm_unpacklo_epi64 (t2, t3), _mm_unpackhi_epi64 (t2, t3) };
+		for (int j = 0; j < 4; j++)
+		{
+			__m128i * p = (__m128i *)(buf + j*blocksize + i*4);
+			_mm_storeu_si128 (p, _mm_xor_si128 (_mm_loadu_si128 (p), b[j]));
+		}
+	}
+}
+#undef QUARTERROUND128
+#undef ROTL128
+#endif
+
 void Chacha20Init (Chacha20State& state, const uint8_t * nonce, const uint8_t * key, uint32_t counter)
 {
 	state.data[0] = 0x61707865;
@@ -114,6 +166,15 @@ void Chacha20Encrypt (Chacha20State& state, uint8_t * buf, size_t sz)
 		state.offset += s;
 		if (state.offset >= chacha::blocksize) state.offset = 0;	
 	}
+#if defined(__SSE2__)
+	while (sz >= 4*chacha::blocksize)
+	{
+		chacha::block4 (state, chacha::rounds, buf);
+		state.data[12] += 4;
+		buf += 4*chacha::blocksize;
+		sz -= 4*chacha::blocksize;
+	}
+#endif
 	for (size_t i = 0; i < sz; i += chacha::blocksize) 
 	{
 	    chacha::block(state, chacha::rounds);
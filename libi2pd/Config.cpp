@@ -41,6 +41,7 @@ namespace config {
 			("logfile", value<std::string>()->default_value(""),              "Path to logfile (stdout if not set, autodetect if daemon)")
 			("loglevel", value<std::string>()->default_value("info"),         "Set the minimal level of log messages (debug, info, warn, error, none)")
 			("logclftime", bool_switch()->default_value(false),               "Write full CLF-formatted date and time to log (default: disabled, write only time)")
+			("logdeferred", bool_switch()->default_value(false),              "Format log messages in log thread instead of calling thread (default: disabled)")
 			("family", value<std::string>()->default_value(""),               "Specify a family, router belongs to")
 			("datadir", value<std::string>()->default_value(""),              "Path to storage of i2pd data (RI, keys, peer profiles, ...)")
 			("host", value<std::string>()->default_value("0.0.0.0"),          "External IP")
@@ -58,9 +59,18 @@ namespace config {
 			("floodfill", bool_switch()->default_value(false),                "Router will be floodfill (default: disabled)")
 			("bandwidth", value<std::string>()->default_value(""),            "Bandwidth limit: integer in KBps or letters: L (32), O (256), P (2048), X (>9000)")
 			("share", value<int>()->default_value(100),                       "Limit of transit traffic from max bandwidth in percents. (default: 100)")
+			("bandwidthshaping", value<bool>()->default_value(false),         "Queue outgoing messages over bandwidth limit, transit first to wait (default: disabled)")
 			("ntcp", value<bool>()->default_value(true),                      "Enable NTCP transport (default: enabled)")
 			("ssu", value<bool>()->default_value(true),                       "Enable SSU transport (default: enabled)")
+			("ssuthreads", value<uint16_t>()->default_value(1),               "Number of SSU session threads (default: 1, 0 - number of cores)")
+			("ssuiouring", value<bool>()->default_value(false),               "Receive SSU packets through io_uring if built with it (default: disabled)")
+			("destinationthreads", value<uint16_t>()->default_value(0),       "Number of threads shared by client destinations (default: 0 - number of cores)")
+			("lowmemory", bool_switch()->default_value(false),                "Size buffers, pools, netDb and threads for devices with little RAM (default: disabled)")
 			("ntcpproxy", value<std::string>()->default_value(""),            "Proxy URL for NTCP transport")
+			("netdbparallelism", value<uint16_t>()->default_value(2),         "Number of floodfills asked at once for RouterInfo (default: 2)")
+			("tracesamplerate", value<int>()->default_value(0),               "Trace 1 of N incoming I2NP messages through tunnels and transports (default: 0 - disabled)")
+			("iotrace", bool_switch()->default_value(false),                  "Measure io_service handlers and queue wait, exported as Chrome trace (default: disabled)")
+			("tunnelcapture", value<std::string>()->default_value(""),        "File to record anonymized tunnel message sizes to, for bench-tunnel replay (default: disabled)")
 #ifdef _WIN32
 			("svcctl", value<std::string>()->default_value(""),               "Windows service management ('install' or 'remove')")
 			("insomnia", bool_switch()->default_value(false),                 "Prevent system from sleeping (default: disabled)")
@@ -73,9 +83,13 @@ namespace config {
 			("limits.coresize", value<uint32_t>()->default_value(0),          "Maximum size of corefile in Kb (0 - use system limit)")
 			("limits.openfiles", value<uint16_t>()->default_value(0),         "Maximum number of open files (0 - use system default)")
 			("limits.transittunnels", value<uint16_t>()->default_value(2500), "Maximum active transit sessions (default:2500)")
+			("limits.routers", value<uint16_t>()->default_value(0),           "Target number of routers kept in netDb, expired earlier and explored slower above it (default: 0 - no limit)")
 			("limits.ntcpsoft", value<uint16_t>()->default_value(0),          "Threshold to start probabalistic backoff with ntcp sessions (default: use system limit)")
 			("limits.ntcphard", value<uint16_t>()->default_value(0),          "Maximum number of ntcp sessions (default: use system limit)")
 			("limits.ntcpthreads", value<uint16_t>()->default_value(1),       "Maximum number of threads used by NTCP DH worker (default: 1)")
+			("limits.ntcpoffload", value<bool>()->default_value(false),       "Run NTCP data phase encryption in DH worker threads (default: disabled)")
+			("limits.tunnelthreads", value<uint16_t>()->default_value(0),     "Number of threads processing tunnel data, sharded by tunnel ID (default: 0 - use tunnels thread)")
+			("limits.tunnelbuildthreads", value<uint16_t>()->default_value(1), "Number of threads decrypting transit tunnel build requests (default: 1, 0 - use tunnels thread)")
 		;
 
 		options_description httpserver("HTTP Server options");
@@ -176,6 +190,7 @@ namespace config {
 				value<bool>()->default_value(true),
 #endif
 				"Enable or disable elgamal precomputation table")
+			("precomputation.elgamalwindow", value<int>()->default_value(8), "Window size in bits of elgamal precomputation table, 1-10. Bigger is faster, but uses more memory")
 		;
 
 		options_description reseed("Reseed options");
@@ -239,6 +254,9 @@ namespace config {
 			("ntcp2.enabled", value<bool>()->default_value(true), "Enable NTCP2 (default: enabled)")
 			("ntcp2.published", value<bool>()->default_value(false), "Publish NTCP2 (default: disabled)")
 			("ntcp2.port", value<uint16_t>()->default_value(0), "Port to listen for incoming NTCP2 connections (default: auto)")
+			("ntcp2.threads", value<uint16_t>()->default_value(0), "Number of NTCP2 session threads (default: 0 - number of cores)")
+			("ntcp2.coalescedelay", value<int>()->default_value(0), "Microseconds to wait for more messages to the same frame (default: 0 - disabled)")
+			("ntcp2.coalescesize", value<int>()->default_value(8192), "Frame size in bytes sent without waiting (default: 8192)")
 		;
 
 		options_description nettime("Time sync options");
@@ -256,6 +274,17 @@ namespace config {
 		options_description persist("Network information persisting options");
 		persist.add_options()
 			("persist.profiles", value<bool>()->default_value(true), "Persist peer profiles (default: true)")
+			("persist.packednetdb", value<bool>()->default_value(false), "Save netDb to single file on shutdown for faster startup (default: false)")
+			("persist.fsync", value<bool>()->default_value(false), "Sync every saved RouterInfo file to disk (default: false)")
+			("persist.sharednetdb", value<std::string>()->default_value(""), "Data directory of co-located router whose netDb is used read-only instead of own (default: none)")
+		;
+
+		options_description cpuaffinity("CPU affinity options");
+		cpuaffinity.add_options()
+			("cpuaffinity.transports", value<std::string>()->default_value(""), "CPUs for NTCP, NTCP2 and SSU threads, like 0-3,6 or node0 (default: any)")
+			("cpuaffinity.tunnels", value<std::string>()->default_value(""), "CPUs for tunnels and tunnel data threads (default: any)")
+			("cpuaffinity.crypto", value<std::string>()->default_value(""), "CPUs for key generation and tunnel build request threads (default: any)")
+			("cpuaffinity.clients", value<std::string>()->default_value(""), "CPUs for client destinations threads (default: any)")
 		;
 
 		m_OptionsDesc
@@ -278,6 +307,7 @@ namespace config {
 			.add(ntcp2)
 			.add(nettime)
 			.add(persist)
+			.add(cpuaffinity)
 		;
 	}
 
@@ -347,9 +377,26 @@ namespace config {
 		};
 	}
 
+	template<typename T>
+	static void SetLowMemoryDefault (const char *name, const T& value)
+	{
+		if (IsDefault (name)) SetOption (name, value); // explicitly set options are kept
+	}
+
 	void Finalize()
 	{
 		notify(m_Options);
+		bool lowMemory = false; GetOption ("lowmemory", lowMemory);
+		if (lowMemory)
+		{
+			// sized together, buffers and pools are reduced by their owners
+			SetLowMemoryDefault ("limits.transittunnels", (uint16_t)500);
+			SetLowMemoryDefault ("limits.routers", (uint16_t)1500);
+			SetLowMemoryDefault ("limits.tunnelbuildthreads", (uint16_t)0);
+			SetLowMemoryDefault ("destinationthreads", (uint16_t)1);
+			SetLowMemoryDefault ("ntcp2.threads", (uint16_t)1);
+			SetLowMemoryDefault ("precomputation.elgamalwindow", 4); // 16 times smaller table
+		}
 	}
 
 	bool IsDefault(const char *name)
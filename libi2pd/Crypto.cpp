@@ -1,4 +1,5 @@
 #include <string.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <mutex>
@@ -9,6 +10,13 @@
 #include "TunnelBase.h"
 #include <openssl/ssl.h>
 #include "Crypto.h"
+#ifdef ARM64AES
+#include <arm_neon.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MULTI_BUFFER_AVX2 1 // compiled for AVX2 regardless of flags, chosen at runtime
+#endif
 #if !OPENSSL_AEAD_CHACHA20_POLY1305
 #include "ChaCha20.h"
 #include "Poly1305.h"
@@ -127,6 +135,19 @@ namespace crypto
 		return true;
 	}
 
+	struct ThreadBNCtx
+	{
+		BN_CTX * ctx;
+		ThreadBNCtx (): ctx (BN_CTX_new ()) {};
+		~ThreadBNCtx () { BN_CTX_free (ctx); };
+	};
+
+	BN_CTX * GetThreadBNCtx ()
+	{
+		static thread_local ThreadBNCtx threadBNCtx;
+		return threadBNCtx.ctx;
+	}
+
 // RSA
 	#define rsae GetCryptoConstants ().rsae
 	const BIGNUM * GetRSAE ()
@@ -156,78 +177,88 @@ namespace crypto
 	#define elgp GetCryptoConstants ().elgp
 	#define elgg GetCryptoConstants ().elgg
 
+	// fixed-base windowed table, row i contains g^(d*2^(i*windowSize)) for d = 1..2^windowSize-1 in Montgomery form
+	const int ELGAMAL_TABLE_ENTRY_SIZE = 256; // bytes, fixed width
 	static BN_MONT_CTX * g_MontCtx = nullptr;
-	static void PrecalculateElggTable (BIGNUM * table[][255], int len) // table is len's array of array of 255 bignums
+	static uint8_t * g_ElggTable = nullptr; // one contiguous block
+	static int g_ElggWindowSize = 0, g_ElggNumWindows = 0;
+
+	static void PrecalculateElggTable (int windowSize, int numBits)
 	{
-		if (len <= 0) return;
+		if (windowSize <= 0 || numBits <= 0) return;
+		g_ElggWindowSize = windowSize;
+		g_ElggNumWindows = (numBits + windowSize - 1)/windowSize;
+		int numEntries = (1 << windowSize) - 1;
+		g_ElggTable = new uint8_t[g_ElggNumWindows*numEntries*ELGAMAL_TABLE_ENTRY_SIZE];
 		BN_CTX * ctx = BN_CTX_new ();
 		g_MontCtx = BN_MONT_CTX_new ();
 		BN_MONT_CTX_set (g_MontCtx, elgp, ctx);
-		auto montCtx = BN_MONT_CTX_new ();
-		BN_MONT_CTX_copy (montCtx, g_MontCtx);
-		for (int i = 0; i < len; i++)
+		BIGNUM * base = BN_new (), * cur = BN_new ();
+		BN_to_montgomery (base, elgg, g_MontCtx, ctx);
+		auto entry = g_ElggTable;
+		for (int i = 0; i < g_ElggNumWindows; i++)
 		{
-			table[i][0] = BN_new ();
-			if (!i)
-				BN_to_montgomery (table[0][0], elgg, montCtx, ctx);
-			else
-				BN_mod_mul_montgomery (table[i][0], table[i-1][254], table[i-1][0], montCtx, ctx);
-			for (int j = 1; j < 255; j++)
+			BN_copy (cur, base);
+			for (int j = 0; j < numEntries; j++)
 			{
-				table[i][j] = BN_new ();
-				BN_mod_mul_montgomery (table[i][j], table[i][j-1], table[i][0], montCtx, ctx);
+				bn2buf (cur, entry, ELGAMAL_TABLE_ENTRY_SIZE);
+				entry += ELGAMAL_TABLE_ENTRY_SIZE;
+				BN_mod_mul_montgomery (cur, cur, base, g_MontCtx, ctx);
 			}
+			std::swap (base, cur); // base^(2^windowSize) for next row
 		}
-		BN_MONT_CTX_free (montCtx);
+		BN_free (base); BN_free (cur);
 		BN_CTX_free (ctx);
+		LogPrint (eLogInfo, "Crypto: ElGamal precomputation table of ", g_ElggNumWindows*numEntries*ELGAMAL_TABLE_ENTRY_SIZE/1024,
+			"K for window size ", windowSize, " created");
 	}
 
-	static void DestroyElggTable (BIGNUM * table[][255], int len)
+	static void DestroyElggTable ()
 	{
-		for (int i = 0; i < len; i++)
-			for (int j = 0; j < 255; j++)
-			{
-				BN_free (table[i][j]);
-				table[i][j] = nullptr;
-			}
-		BN_MONT_CTX_free (g_MontCtx);
+		delete[] g_ElggTable; g_ElggTable = nullptr;
+		g_ElggWindowSize = 0; g_ElggNumWindows = 0;
+		BN_MONT_CTX_free (g_MontCtx); g_MontCtx = nullptr;
 	}
 
-	static BIGNUM * ElggPow (const uint8_t * exp, int len, BIGNUM * table[][255], BN_CTX * ctx)
-	// exp is in Big Endian
+	static BIGNUM * ElggPow (const BIGNUM * exp, BN_CTX * ctx)
 	{
-		if (len <= 0) return nullptr;
-		auto montCtx = BN_MONT_CTX_new ();
-		BN_MONT_CTX_copy (montCtx, g_MontCtx);
+		int numBits = BN_num_bits (exp);
+		if (numBits > g_ElggNumWindows*g_ElggWindowSize)
+		{
+			// doesn't fit the table
+			BIGNUM * res = BN_new ();
+			BN_mod_exp (res, elgg, exp, elgp, ctx);
+			return res;
+		}
+		int numEntries = (1 << g_ElggWindowSize) - 1;
+		BN_CTX_start (ctx);
+		BIGNUM * entry = BN_CTX_get (ctx);
 		BIGNUM * res = nullptr;
-		for (int i = 0; i < len; i++)
+		for (int i = 0; i*g_ElggWindowSize < numBits; i++)
 		{
-			if (res)
+			int d = 0;
+			for (int j = g_ElggWindowSize - 1; j >= 0; j--)
+				d = (d << 1) | BN_is_bit_set (exp, i*g_ElggWindowSize + j);
+			if (d)
 			{
-				if (exp[i])
-					BN_mod_mul_montgomery (res, res, table[len-1-i][exp[i]-1], montCtx, ctx);
+				BN_bin2bn (g_ElggTable + (i*numEntries + d - 1)*ELGAMAL_TABLE_ENTRY_SIZE, ELGAMAL_TABLE_ENTRY_SIZE, entry);
+				if (res)
+					BN_mod_mul_montgomery (res, res, entry, g_MontCtx, ctx);
+				else
+					res = BN_dup (entry);
 			}
-			else if (exp[i])
-				res = BN_dup (table[len-i-1][exp[i]-1]);
 		}
 		if (res)
-			BN_from_montgomery (res, res, montCtx, ctx);
-		BN_MONT_CTX_free (montCtx);
+			BN_from_montgomery (res, res, g_MontCtx, ctx);
+		else
+		{
+			res = BN_new ();
+			BN_one (res);
+		}
+		BN_CTX_end (ctx);
 		return res;
 	}
 
-	static BIGNUM * ElggPow (const BIGNUM * exp, BIGNUM * table[][255], BN_CTX * ctx)
-	{
-		auto len = BN_num_bytes (exp);
-		uint8_t * buf = new uint8_t[len];
-		BN_bn2bin (exp, buf);
-		auto ret = ElggPow (buf, len, table, ctx);
-		delete[] buf;
-		return ret;
-	}
-
-	static BIGNUM * (* g_ElggTable)[255] = nullptr;
-
 // DH
 
 	DHKeys::DHKeys ()
@@ -256,7 +287,7 @@ namespace crypto
 			BN_rand (priv_key, ELGAMAL_FULL_EXPONENT_NUM_BITS, 0, 1);
 #endif
 			auto ctx = BN_CTX_new ();
-			pub_key = ElggPow (priv_key, g_ElggTable, ctx);
+			pub_key = ElggPow (priv_key, ctx);
 			DH_set0_key (m_DH, pub_key, priv_key);
 			BN_CTX_free (ctx);
 		}
@@ -331,6 +362,25 @@ namespace crypto
 #endif		
 	}	
 
+	void X25519Keys::GenerateKeys (size_t num, X25519Keys * const * keys)
+	{
+#if OPENSSL_X25519
+		for (size_t i = 0; i < num; i++)
+			keys[i]->GenerateKeys ();
+#else
+		if (!num) return;
+		std::vector<const uint8_t *> privateKeys (num);
+		std::vector<uint8_t *> publicKeys (num);
+		for (size_t i = 0; i < num; i++)
+		{
+			RAND_bytes (keys[i]->m_PrivateKey, 32);
+			privateKeys[i] = keys[i]->m_PrivateKey;
+			publicKeys[i] = keys[i]->m_PublicKey;
+		}
+		GetEd25519 ()->ScalarMulB (num, privateKeys.data (), publicKeys.data (), keys[0]->m_Ctx);
+#endif
+	}
+
 	void X25519Keys::Agree (const uint8_t * pub, uint8_t * shared)
 	{
 #if OPENSSL_X25519		
@@ -373,7 +423,7 @@ namespace crypto
 		// calculate a
 		BIGNUM * a;
 		if (g_ElggTable)
-			a = ElggPow (k, g_ElggTable, ctx);
+			a = ElggPow (k, ctx);
 		else
 		{
 			a = BN_new ();
@@ -657,13 +707,6 @@ namespace crypto
 
 // AES
 #ifdef __AES__
-        #ifdef ARM64AES
-                void init_aesenc(void){
-			// TODO: Implementation
-		}
-
-        #endif
-
 	#define KeyExpansion256(round0,round1) \
 		"pshufd	$0xff, %%xmm2, %%xmm2 \n" \
 		"movaps	%%xmm1, %%xmm4 \n" \
@@ -728,6 +771,52 @@ namespace crypto
 	}
 #endif
 
+#ifdef ARM64AES
+	static inline void LoadKeySchedule (const uint8_t * sched, uint8x16_t * rk)
+	{
+		for (int i = 0; i < 15; i++)
+			rk[i] = vld1q_u8 (sched + 16*i);
+	}
+
+	static inline uint8x16_t EncryptAES256ARM (uint8x16_t s, const uint8x16_t * rk)
+	{
+		for (int i = 0; i < 13; i++)
+			s = vaesmcq_u8 (vaeseq_u8 (s, rk[i]));
+		return veorq_u8 (vaeseq_u8 (s, rk[13]), rk[14]);
+	}
+
+	static inline uint8x16_t DecryptAES256ARM (uint8x16_t s, const uint8x16_t * rk) // rk[1]-rk[13] inverted by aesimc
+	{
+		for (int i = 14; i > 1; i--)
+			s = vaesimcq_u8 (vaesdq_u8 (s, rk[i]));
+		return veorq_u8 (vaesdq_u8 (s, rk[1]), rk[0]);
+	}
+
+	static inline uint32_t SubWordARM (uint32_t w)
+	{
+		// all columns are the same, ShiftRows doesn't change anything
+		uint8x16_t v = vaeseq_u8 (vreinterpretq_u8_u32 (vdupq_n_u32 (w)), vdupq_n_u8 (0));
+		return vgetq_lane_u32 (vreinterpretq_u32_u8 (v), 0);
+	}
+
+	void ECBCryptoAESNI::ExpandKey (const AESKey& key)
+	{
+		static const uint8_t rcon[7] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40 };
+		uint32_t w[60]; // little endian words
+		memcpy (w, key, 32);
+		for (int i = 8; i < 60; i++)
+		{
+			uint32_t t = w[i - 1];
+			if (!(i & 7))
+				t = SubWordARM ((t >> 8) | (t << 24)) ^ rcon[(i >> 3) - 1]; // RotWord
+			else if ((i & 7) == 4)
+				t = SubWordARM (t);
+			w[i] = w[i - 8] ^ t;
+		}
+		memcpy (GetKeySchedule (), w, 240);
+	}
+#endif
+
 
 #ifdef __AES__
 	#define EncryptAES256(sched) \
@@ -762,6 +851,14 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk[15];
+			LoadKeySchedule (GetKeySchedule (), rk);
+			vst1q_u8 (out->buf, EncryptAES256ARM (vld1q_u8 (in->buf), rk));
+		}
+		else
 #endif
 		{
 			AES_encrypt (in->buf, out->buf, &m_Key);
@@ -801,6 +898,14 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk[15];
+			LoadKeySchedule (GetKeySchedule (), rk);
+			vst1q_u8 (out->buf, DecryptAES256ARM (vld1q_u8 (in->buf), rk));
+		}
+		else
 #endif
 		{
 			AES_decrypt (in->buf, out->buf, &m_Key);
@@ -822,6 +927,12 @@ namespace crypto
 			ExpandKey (key);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			ExpandKey (key);
+		}
+		else
 #endif
 		{
 			AES_set_encrypt_key (key, 256, &m_Key);
@@ -854,6 +965,16 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			ExpandKey (key); // expand encryption key first
+			// then invert it using aesimc
+			uint8_t * sched = GetKeySchedule ();
+			for (int i = 1; i < 14; i++)
+				vst1q_u8 (sched + 16*i, vaesimcq_u8 (vld1q_u8 (sched + 16*i)));
+		}
+		else
 #endif
 		{
 			AES_set_decrypt_key (key, 256, &m_Key);
@@ -887,6 +1008,20 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk[15];
+			LoadKeySchedule (m_ECBEncryption.GetKeySchedule (), rk);
+			uint8x16_t iv = vld1q_u8 ((uint8_t *)m_LastBlock);
+			for (int i = 0; i < numBlocks; i++)
+			{
+				iv = EncryptAES256ARM (veorq_u8 (vld1q_u8 (in[i].buf), iv), rk);
+				vst1q_u8 (out[i].buf, iv);
+			}
+			vst1q_u8 ((uint8_t *)m_LastBlock, iv);
+		}
+		else
 #endif
 		{
 			for (int i = 0; i < numBlocks; i++)
@@ -930,31 +1065,130 @@ namespace crypto
 			Encrypt (1, (const ChipherBlock *)in, (ChipherBlock *)out);
 	}
 
+#if defined(__AES__) && defined(__x86_64__)
+	// 8 independent blocks in xmm0-xmm7, round key in xmm8
+	#define AESRound8(op, offset, sched) \
+		"movaps "#offset"(%["#sched"]), %%xmm8 \n" \
+		#op" %%xmm8, %%xmm0 \n" \
+		#op" %%xmm8, %%xmm1 \n" \
+		#op" %%xmm8, %%xmm2 \n" \
+		#op" %%xmm8, %%xmm3 \n" \
+		#op" %%xmm8, %%xmm4 \n" \
+		#op" %%xmm8, %%xmm5 \n" \
+		#op" %%xmm8, %%xmm6 \n" \
+		#op" %%xmm8, %%xmm7 \n"
+
+	#define DecryptAES256x8(sched) \
+		AESRound8(pxor, 224, sched) \
+		AESRound8(aesdec, 208, sched) \
+		AESRound8(aesdec, 192, sched) \
+		AESRound8(aesdec, 176, sched) \
+		AESRound8(aesdec, 160, sched) \
+		AESRound8(aesdec, 144, sched) \
+		AESRound8(aesdec, 128, sched) \
+		AESRound8(aesdec, 112, sched) \
+		AESRound8(aesdec, 96, sched) \
+		AESRound8(aesdec, 80, sched) \
+		AESRound8(aesdec, 64, sched) \
+		AESRound8(aesdec, 48, sched) \
+		AESRound8(aesdec, 32, sched) \
+		AESRound8(aesdec, 16, sched) \
+		AESRound8(aesdeclast, 0, sched)
+
+	// xor decrypted block with previous chipher block, IV is xmm9
+	#define XorPrevBlock(reg, offset) \
+		"movups "#offset"(%[in]), %%xmm9 \n" \
+		"pxor %%xmm9, %%"#reg" \n"
+#endif
+
 	void CBCDecryption::Decrypt (int numBlocks, const ChipherBlock * in, ChipherBlock * out)
 	{
 #ifdef __AES__
 		if(i2p::cpu::aesni)
 		{
-			__asm__
-				(
-					"movups	(%[iv]), %%xmm1 \n"
-					"1: \n"
-					"movups	(%[in]), %%xmm0 \n"
-					"movaps %%xmm0, %%xmm2 \n"
-					DecryptAES256(sched)
-					"pxor %%xmm1, %%xmm0 \n"
-					"movups	%%xmm0, (%[out]) \n"
-					"movaps %%xmm2, %%xmm1 \n"
-					"add $16, %[in] \n"
-					"add $16, %[out] \n"
-					"dec %[num] \n"
-					"jnz 1b \n"
-					"movups	%%xmm1, (%[iv]) \n"
-					:
-					: [iv]"r"((uint8_t *)m_IV), [sched]"r"(m_ECBDecryption.GetKeySchedule ()),
-						[in]"r"(in), [out]"r"(out), [num]"r"(numBlocks)
-					: "%xmm0", "%xmm1", "%xmm2", "cc", "memory"
+#if defined(__x86_64__)
+			if (numBlocks >= 8)
+			{
+				// CBC decryption is parallel, interleave 8 blocks
+				int numBlocks8 = numBlocks >> 3;
+				__asm__ __volatile__ // outputs are not used after
+					(
+						"movups	(%[iv]), %%xmm9 \n"
+						"1: \n"
+						"movups	(%[in]), %%xmm0 \n"
+						"movups	16(%[in]), %%xmm1 \n"
+						"movups	32(%[in]), %%xmm2 \n"
+						"movups	48(%[in]), %%xmm3 \n"
+						"movups	64(%[in]), %%xmm4 \n"
+						"movups	80(%[in]), %%xmm5 \n"
+						"movups	96(%[in]), %%xmm6 \n"
+						"movups	112(%[in]), %%xmm7 \n"
+						DecryptAES256x8(sched)
+						"pxor %%xmm9, %%xmm0 \n"
+						XorPrevBlock(xmm1, 0)
+						XorPrevBlock(xmm2, 16)
+						XorPrevBlock(xmm3, 32)
+						XorPrevBlock(xmm4, 48)
+						XorPrevBlock(xmm5, 64)
+						XorPrevBlock(xmm6, 80)
+						XorPrevBlock(xmm7, 96)
+						"movups	112(%[in]), %%xmm9 \n" // next IV, read before in-place store
+						"movups	%%xmm0, (%[out]) \n"
+						"movups	%%xmm1, 16(%[out]) \n"
+						"movups	%%xmm2, 32(%[out]) \n"
+						"movups	%%xmm3, 48(%[out]) \n"
+						"movups	%%xmm4, 64(%[out]) \n"
+						"movups	%%xmm5, 80(%[out]) \n"
+						"movups	%%xmm6, 96(%[out]) \n"
+						"movups	%%xmm7, 112(%[out]) \n"
+						"add $128, %[in] \n"
+						"add $128, %[out] \n"
+						"dec %[num] \n"
+						"jnz 1b \n"
+						"movups	%%xmm9, (%[iv]) \n"
+						: [in]"+r"(in), [out]"+r"(out), [num]"+r"(numBlocks8)
+						: [iv]"r"((uint8_t *)m_IV), [sched]"r"(m_ECBDecryption.GetKeySchedule ())
+						: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+							"%xmm8", "%xmm9", "cc", "memory"
 					);
+				numBlocks &= 7;
+			}
+#endif
+			if (numBlocks > 0)
+				__asm__ __volatile__
+					(
+						"movups	(%[iv]), %%xmm1 \n"
+						"1: \n"
+						"movups	(%[in]), %%xmm0 \n"
+						"movaps %%xmm0, %%xmm2 \n"
+						DecryptAES256(sched)
+						"pxor %%xmm1, %%xmm0 \n"
+						"movups	%%xmm0, (%[out]) \n"
+						"movaps %%xmm2, %%xmm1 \n"
+						"add $16, %[in] \n"
+						"add $16, %[out] \n"
+						"dec %[num] \n"
+						"jnz 1b \n"
+						"movups	%%xmm1, (%[iv]) \n"
+						: [in]"+r"(in), [out]"+r"(out), [num]"+r"(numBlocks)
+						: [iv]"r"((uint8_t *)m_IV), [sched]"r"(m_ECBDecryption.GetKeySchedule ())
+						: "%xmm0", "%xmm1", "%xmm2", "cc", "memory"
+					);
+		}
+		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk[15];
+			LoadKeySchedule (m_ECBDecryption.GetKeySchedule (), rk);
+			uint8x16_t iv = vld1q_u8 ((uint8_t *)m_IV);
+			for (int i = 0; i < numBlocks; i++)
+			{
+				uint8x16_t block = vld1q_u8 (in[i].buf);
+				vst1q_u8 (out[i].buf, veorq_u8 (DecryptAES256ARM (block, rk), iv));
+				iv = block;
+			}
+			vst1q_u8 ((uint8_t *)m_IV, iv);
 		}
 		else
 #endif
@@ -1032,6 +1266,21 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk_iv[15], rk_l[15];
+			LoadKeySchedule (m_IVEncryption.GetKeySchedule (), rk_iv);
+			LoadKeySchedule (m_LayerEncryption.ECB().GetKeySchedule (), rk_l);
+			uint8x16_t iv = EncryptAES256ARM (vld1q_u8 (in), rk_iv);
+			vst1q_u8 (out, EncryptAES256ARM (iv, rk_iv)); // double IV encryption
+			for (int i = 16; i < 1024; i += 16) // 63 blocks = 1008 bytes
+			{
+				iv = EncryptAES256ARM (veorq_u8 (vld1q_u8 (in + i), iv), rk_l);
+				vst1q_u8 (out + i, iv);
+			}
+		}
+		else
 #endif
 		{
 			m_IVEncryption.Encrypt ((const ChipherBlock *)in, (ChipherBlock *)out); // iv
@@ -1043,7 +1292,7 @@ namespace crypto
 
 	void TunnelDecryption::Decrypt (const uint8_t * in, uint8_t * out)
 	{
-#ifdef __AES__
+#if defined(__AES__) && !defined(__x86_64__) // x86_64 uses interleaved CBC decryption below
 		if(i2p::cpu::aesni)
 		{
 			__asm__
@@ -1074,6 +1323,22 @@ namespace crypto
 					);
 		}
 		else
+#elif defined(ARM64AES)
+		if(i2p::cpu::armaes)
+		{
+			uint8x16_t rk_iv[15], rk_l[15];
+			LoadKeySchedule (m_IVDecryption.GetKeySchedule (), rk_iv);
+			LoadKeySchedule (m_LayerDecryption.ECB().GetKeySchedule (), rk_l);
+			uint8x16_t iv = DecryptAES256ARM (vld1q_u8 (in), rk_iv);
+			vst1q_u8 (out, DecryptAES256ARM (iv, rk_iv)); // double IV decryption
+			for (int i = 16; i < 1024; i += 16) // 63 blocks = 1008 bytes
+			{
+				uint8x16_t block = vld1q_u8 (in + i);
+				vst1q_u8 (out + i, veorq_u8 (DecryptAES256ARM (block, rk_l), iv));
+				iv = block;
+			}
+		}
+		else
 #endif
 		{
 			m_IVDecryption.Decrypt ((const ChipherBlock *)in, (ChipherBlock *)out); // iv
@@ -1083,8 +1348,206 @@ namespace crypto
 		}
 	}
 
+#if defined(__AES__) && defined(__x86_64__)
+	// 4 independent blocks in xmm0-xmm3, round key in xmm8
+	#define AESRound4(op, offset, sched) \
+		"movaps "#offset"(%["#sched"]), %%xmm8 \n" \
+		#op" %%xmm8, %%xmm0 \n" \
+		#op" %%xmm8, %%xmm1 \n" \
+		#op" %%xmm8, %%xmm2 \n" \
+		#op" %%xmm8, %%xmm3 \n"
+
+	#define EncryptAES256x4(sched) \
+		AESRound4(pxor, 0, sched) \
+		AESRound4(aesenc, 16, sched) \
+		AESRound4(aesenc, 32, sched) \
+		AESRound4(aesenc, 48, sched) \
+		AESRound4(aesenc, 64, sched) \
+		AESRound4(aesenc, 80, sched) \
+		AESRound4(aesenc, 96, sched) \
+		AESRound4(aesenc, 112, sched) \
+		AESRound4(aesenc, 128, sched) \
+		AESRound4(aesenc, 144, sched) \
+		AESRound4(aesenc, 160, sched) \
+		AESRound4(aesenc, 176, sched) \
+		AESRound4(aesenc, 192, sched) \
+		AESRound4(aesenc, 208, sched) \
+		AESRound4(aesenclast, 224, sched)
+
+	#define DecryptAES256x4(sched) \
+		AESRound4(pxor, 224, sched) \
+		AESRound4(aesdec, 208, sched) \
+		AESRound4(aesdec, 192, sched) \
+		AESRound4(aesdec, 176, sched) \
+		AESRound4(aesdec, 160, sched) \
+		AESRound4(aesdec, 144, sched) \
+		AESRound4(aesdec, 128, sched) \
+		AESRound4(aesdec, 112, sched) \
+		AESRound4(aesdec, 96, sched) \
+		AESRound4(aesdec, 80, sched) \
+		AESRound4(aesdec, 64, sched) \
+		AESRound4(aesdec, 48, sched) \
+		AESRound4(aesdec, 32, sched) \
+		AESRound4(aesdec, 16, sched) \
+		AESRound4(aesdeclast, 0, sched)
+
+	#define LoadBlocks4(offset) \
+		"movups "#offset"(%[in0]), %%xmm0 \n" \
+		"movups "#offset"(%[in1]), %%xmm1 \n" \
+		"movups "#offset"(%[in2]), %%xmm2 \n" \
+		"movups "#offset"(%[in3]), %%xmm3 \n"
+
+	#define StoreBlocks4(offset) \
+		"movups %%xmm0, "#offset"(%[out0]) \n" \
+		"movups %%xmm1, "#offset"(%[out1]) \n" \
+		"movups %%xmm2, "#offset"(%[out2]) \n" \
+		"movups %%xmm3, "#offset"(%[out3]) \n"
+
+	#define AdvanceBlocks4 \
+		"add $16, %[in0] \n" \
+		"add $16, %[in1] \n" \
+		"add $16, %[in2] \n" \
+		"add $16, %[in3] \n" \
+		"add $16, %[out0] \n" \
+		"add $16, %[out1] \n" \
+		"add $16, %[out2] \n" \
+		"add $16, %[out3] \n"
+#endif
+
+	void TunnelEncryption::Encrypt (const uint8_t * const * in, uint8_t * const * out, size_t num)
+	{
+		size_t i = 0;
+#if defined(__AES__) && defined(__x86_64__)
+		if(i2p::cpu::aesni)
+		{
+			// CBC is sequential within a message, but 4 messages with same keys go in parallel
+			for (; i + 4 <= num; i += 4)
+			{
+				const uint8_t * in0 = in[i], * in1 = in[i + 1], * in2 = in[i + 2], * in3 = in[i + 3];
+				uint8_t * out0 = out[i], * out1 = out[i + 1], * out2 = out[i + 2], * out3 = out[i + 3];
+				int numBlocks = 63; // 63 blocks = 1008 bytes
+				__asm__ __volatile__ // outputs are not used after
+					(
+						// encrypt IVs
+						LoadBlocks4(0)
+						EncryptAES256x4(sched_iv)
+						"movaps %%xmm0, %%xmm4 \n"
+						"movaps %%xmm1, %%xmm5 \n"
+						"movaps %%xmm2, %%xmm6 \n"
+						"movaps %%xmm3, %%xmm7 \n"
+						// double IV encryption
+						EncryptAES256x4(sched_iv)
+						StoreBlocks4(0)
+						// encrypt data, IVs are xmm4-xmm7
+						"1: \n"
+						AdvanceBlocks4
+						LoadBlocks4(0)
+						"pxor %%xmm4, %%xmm0 \n"
+						"pxor %%xmm5, %%xmm1 \n"
+						"pxor %%xmm6, %%xmm2 \n"
+						"pxor %%xmm7, %%xmm3 \n"
+						EncryptAES256x4(sched_l)
+						"movaps %%xmm0, %%xmm4 \n"
+						"movaps %%xmm1, %%xmm5 \n"
+						"movaps %%xmm2, %%xmm6 \n"
+						"movaps %%xmm3, %%xmm7 \n"
+						StoreBlocks4(0)
+						"dec %[num] \n"
+						"jnz 1b \n"
+						: [in0]"+r"(in0), [in1]"+r"(in1), [in2]"+r"(in2), [in3]"+r"(in3),
+							[out0]"+r"(out0), [out1]"+r"(out1), [out2]"+r"(out2), [out3]"+r"(out3), [num]"+r"(numBlocks)
+						: [sched_iv]"r"(m_IVEncryption.GetKeySchedule ()), [sched_l]"r"(m_LayerEncryption.ECB().GetKeySchedule ())
+						: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7", "%xmm8", "cc", "memory"
+					);
+			}
+		}
+#endif
+		for (; i < num; i++)
+			Encrypt (in[i], out[i]);
+	}
+
+	void TunnelDecryption::Decrypt (const uint8_t * const * in, uint8_t * const * out, size_t num)
+	{
+		size_t i = 0;
+#if defined(__AES__) && defined(__x86_64__)
+		if(i2p::cpu::aesni)
+		{
+			for (; i + 4 <= num; i += 4)
+			{
+				const uint8_t * in0 = in[i], * in1 = in[i + 1], * in2 = in[i + 2], * in3 = in[i + 3];
+				uint8_t * out0 = out[i], * out1 = out[i + 1], * out2 = out[i + 2], * out3 = out[i + 3];
+				int numBlocks = 63; // 63 blocks = 1008 bytes
+				__asm__ __volatile__ // outputs are not used after
+					(
+						// decrypt IVs
+						LoadBlocks4(0)
+						DecryptAES256x4(sched_iv)
+						"movaps %%xmm0, %%xmm4 \n"
+						"movaps %%xmm1, %%xmm5 \n"
+						"movaps %%xmm2, %%xmm6 \n"
+						"movaps %%xmm3, %%xmm7 \n"
+						// double IV decryption
+						DecryptAES256x4(sched_iv)
+						StoreBlocks4(0)
+						// decrypt data, IVs are xmm4-xmm7
+						"1: \n"
+						AdvanceBlocks4
+						LoadBlocks4(0)
+						"movaps %%xmm0, %%xmm9 \n"
+						"movaps %%xmm1, %%xmm10 \n"
+						"movaps %%xmm2, %%xmm11 \n"
+						"movaps %%xmm3, %%xmm12 \n"
+						DecryptAES256x4(sched_l)
+						"pxor %%xmm4, %%xmm0 \n"
+						"pxor %%xmm5, %%xmm1 \n"
+						"pxor %%xmm6, %%xmm2 \n"
+						"pxor %%xmm7, %%xmm3 \n"
+						StoreBlocks4(0)
+						"movaps %%xmm9, %%xmm4 \n"
+						"movaps %%xmm10, %%xmm5 \n"
+						"movaps %%xmm11, %%xmm6 \n"
+						"movaps %%xmm12, %%xmm7 \n"
+						"dec %[num] \n"
+						"jnz 1b \n"
+						: [in0]"+r"(in0), [in1]"+r"(in1), [in2]"+r"(in2), [in3]"+r"(in3),
+							[out0]"+r"(out0), [out1]"+r"(out1), [out2]"+r"(out2), [out3]"+r"(out3), [num]"+r"(numBlocks)
+						: [sched_iv]"r"(m_IVDecryption.GetKeySchedule ()), [sched_l]"r"(m_LayerDecryption.ECB().GetKeySchedule ())
+						: "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+							"%xmm8", "%xmm9", "%xmm10", "%xmm11", "%xmm12", "cc", "memory"
+					);
+			}
+		}
+#endif
+		for (; i < num; i++)
+			Decrypt (in[i], out[i]);
+	}
+
 // AEAD/ChaCha20/Poly1305
 
+#if !OPENSSL_AEAD_CHACHA20_POLY1305
+	const size_t AEAD_CHACHA20_POLY1305_CHUNK_SIZE = 1024; // multiple of 64, stays in L1 between encryption and MAC
+
+	static void Chacha20Poly1305Update (chacha::Chacha20State& state, Poly1305& polyHash, uint8_t * buf, size_t len, bool encrypt)
+	{
+		// single pass, hash every chunk right after or before encryption
+		while (len > 0)
+		{
+			size_t l = len < AEAD_CHACHA20_POLY1305_CHUNK_SIZE ? len : AEAD_CHACHA20_POLY1305_CHUNK_SIZE;
+			if (encrypt)
+			{
+				chacha::Chacha20Encrypt (state, buf, l);
+				polyHash.Update (buf, l); // after encryption
+			}
+			else
+			{
+				polyHash.Update (buf, l); // before decryption
+				chacha::Chacha20Encrypt (state, buf, l);
+			}
+			buf += l; len -= l;
+		}
+	}
+#endif
+
 	bool AEADChaCha20Poly1305 (const uint8_t * msg, size_t msgLen, const uint8_t * ad, size_t adLen, const uint8_t * key, const uint8_t * nonce, uint8_t * buf, size_t len, bool encrypt)
 	{
 		if (len < msgLen) return false;
@@ -1141,16 +1604,7 @@ namespace crypto
 		Chacha20SetCounter (state, 1);
 		if (buf != msg)
 			memcpy (buf, msg, msgLen);
-		if (encrypt)
-		{
-			chacha::Chacha20Encrypt (state, buf, msgLen); // encrypt
-			polyHash.Update (buf, msgLen); // after encryption
-		}
-		else
-		{
-			polyHash.Update (buf, msgLen); // before decryption
-			chacha::Chacha20Encrypt (state, buf, msgLen); // decrypt
-		}	
+		Chacha20Poly1305Update (state, polyHash, buf, msgLen, encrypt);
 
 		auto rem = msgLen & 0x0F; // %16
 		if (rem)
@@ -1205,8 +1659,7 @@ namespace crypto
 		size_t size = 0;
 		for (const auto& it: bufs)
 		{
-			chacha::Chacha20Encrypt (state, it.first, it.second);
-			polyHash.Update (it.first, it.second); // after encryption
+			Chacha20Poly1305Update (state, polyHash, it.first, it.second, true);
 			size += it.second;
 		}
 		// padding
@@ -1228,6 +1681,364 @@ namespace crypto
 #endif		
 	}
 
+	void ChaCha20 (const uint8_t * msg, size_t msgLen, const uint8_t * key, const uint8_t * nonce, uint8_t * out)
+	{
+#if OPENSSL_AEAD_CHACHA20_POLY1305
+		uint8_t iv[16];
+		htole32buf (iv, 1); // counter
+		memcpy (iv + 4, nonce, 12);
+		int outlen = 0;
+		EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new ();
+		EVP_EncryptInit_ex(ctx, EVP_chacha20 (), NULL, key, iv);
+		EVP_EncryptUpdate(ctx, out, &outlen, msg, msgLen);
+		EVP_EncryptFinal_ex(ctx, NULL, &outlen);
+		EVP_CIPHER_CTX_free (ctx);
+#else
+		chacha::Chacha20State state;
+		chacha::Chacha20Init (state, nonce, key, 1);
+		if (out != msg) memcpy (out, msg, msgLen);
+		chacha::Chacha20Encrypt (state, out, msgLen);
+#endif
+	}
+
+// random
+
+	class ThreadRandom
+	{
+		public:
+
+			ThreadRandom (): m_Offset (RANDOM_BUFFER_SIZE), m_NumRefills (0) { Reseed (); };
+			~ThreadRandom () { memset (m_Key, 0, 32); memset (m_Buffer, 0, sizeof (m_Buffer)); };
+
+			void Get (uint8_t * buf, size_t len)
+			{
+				while (len > 0)
+				{
+					if (m_Offset >= RANDOM_BUFFER_SIZE) Refill ();
+					size_t l = std::min (len, RANDOM_BUFFER_SIZE - m_Offset);
+					memcpy (buf, m_Buffer + m_Offset, l);
+					memset (m_Buffer + m_Offset, 0, l); // never hand out the same bytes twice
+					m_Offset += l; buf += l; len -= l;
+				}
+			}
+
+		private:
+
+			void Reseed ()
+			{
+				RAND_bytes (m_Key, 32);
+				m_NumRefills = 0;
+			}
+
+			void Refill ()
+			{
+				if (m_NumRefills >= RANDOM_RESEED_INTERVAL) Reseed ();
+				uint8_t nonce[12];
+				memset (nonce, 0, 4);
+				htole64buf (nonce + 4, m_NumRefills);
+				uint8_t keystream[32 + RANDOM_BUFFER_SIZE];
+				memset (keystream, 0, sizeof (keystream));
+				ChaCha20 (keystream, sizeof (keystream), m_Key, nonce, keystream);
+				// first 32 bytes replace the key, previous output can't be recovered from the state
+				memcpy (m_Key, keystream, 32);
+				memcpy (m_Buffer, keystream + 32, RANDOM_BUFFER_SIZE);
+				memset (keystream, 0, 32);
+				m_Offset = 0;
+				m_NumRefills++;
+			}
+
+		private:
+
+			uint8_t m_Key[32], m_Buffer[RANDOM_BUFFER_SIZE];
+			size_t m_Offset;
+			int m_NumRefills;
+	};
+
+	void RandBytes (uint8_t * buf, size_t len)
+	{
+		static thread_local ThreadRandom random;
+		random.Get (buf, len);
+	}
+
+	uint32_t RandUint32 ()
+	{
+		uint32_t r;
+		RandBytes ((uint8_t *)&r, 4);
+		return r;
+	}
+
+// multi-buffer SHA256
+
+#if MULTI_BUFFER_AVX2
+	static const uint32_t SHA256_K[64] =
+	{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+
+	static const uint32_t SHA256_H0[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	static bool IsMultiBufferSupported ()
+	{
+		static bool supported = __builtin_cpu_supports ("avx2");
+		return supported;
+	}
+
+	__attribute__((target("avx2"), always_inline))
+	static inline __m256i Rotr32x8 (__m256i x, int n)
+	{
+		return _mm256_or_si256 (_mm256_srli_epi32 (x, n), _mm256_slli_epi32 (x, 32 - n));
+	}
+
+	__attribute__((target("avx2"), always_inline))
+	static inline void Transpose32x8 (__m256i * v) // 8x8 matrix of 32-bits words
+	{
+		__m256i t0 = _mm256_unpacklo_epi32 (v[0], v[1]), t1 = _mm256_unpackhi_epi32 (v[0], v[1]);
+		__m256i t2 = _mm256_unpacklo_epi32 (v[2], v[3]), t3 = _mm256_unpackhi_epi32 (v[2], v[3]);
+		__m256i t4 = _mm256_unpacklo_epi32 (v[4], v[5]), t5 = _mm256_unpackhi_epi32 (v[4], v[5]);
+		__m256i t6 = _mm256_unpacklo_epi32 (v[6], v[7]), t7 = _mm256_unpackhi_epi32 (v[6], v[7]);
+		__m256i u0 = _mm256_unpacklo_epi64 (t0, t2), u1 = _mm256_unpackhi_epi64 (t0, t2);
+		__m256i u2 = _mm256_unpacklo_epi64 (t1, t3), u3 = _mm256_unpackhi_epi64 (t1, t3);
+		__m256i u4 = _mm256_unpacklo_epi64 (t4, t6), u5 = _mm256_unpackhi_epi64 (t4, t6);
+		__m256i u6 = _mm256_unpacklo_epi64 (t5, t7), u7 = _mm256_unpackhi_epi64 (t5, t7);
+		v[0] = _mm256_permute2x128_si256 (u0, u4, 0x20); v[4] = _mm256_permute2x128_si256 (u0, u4, 0x31);
+		v[1] = _mm256_permute2x128_si256 (u1, u5, 0x20); v[5] = _mm256_permute2x128_si256 (u1, u5, 0x31);
+		v[2] = _mm256_permute2x128_si256 (u2, u6, 0x20); v[6] = _mm256_permute2x128_si256 (u2, u6, 0x31);
+		v[3] = _mm256_permute2x128_si256 (u3, u7, 0x20); v[7] = _mm256_permute2x128_si256 (u3, u7, 0x31);
+	}
+
+	__attribute__((target("avx2")))
+	static void SHA256Lanes (size_t num, const uint8_t * const * bufs, const size_t * lens, uint8_t * const * digests) // num <= 8
+	{
+		// lane i hashes numBlocks[i] blocks, last one or two of them padded in tails[i]
+		size_t numBlocks[8], numFullBlocks[8], maxNumBlocks = 0;
+		uint8_t tails[8][128];
+		uint32_t masks[8];
+		for (size_t i = 0; i < 8; i++)
+		{
+			numBlocks[i] = numFullBlocks[i] = 0;
+			if (i >= num) continue;
+			size_t len = lens[i];
+			numFullBlocks[i] = len >> 6;
+			numBlocks[i] = (len + 9 + 63) >> 6;
+			if (numBlocks[i] > maxNumBlocks) maxNumBlocks = numBlocks[i];
+			size_t rem = len & 63;
+			memset (tails[i], 0, 128);
+			memcpy (tails[i], bufs[i] + (len - rem), rem);
+			tails[i][rem] = 0x80;
+			htobe64buf (tails[i] + (numBlocks[i] - numFullBlocks[i])*64 - 8, (uint64_t)len << 3);
+		}
+		const __m256i bswap = _mm256_setr_epi8 (3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		__m256i state[8];
+		for (int j = 0; j < 8; j++) state[j] = _mm256_set1_epi32 (SHA256_H0[j]);
+		for (size_t b = 0; b < maxNumBlocks; b++)
+		{
+			const uint8_t * blocks[8];
+			for (size_t i = 0; i < 8; i++)
+			{
+				masks[i] = b < numBlocks[i] ? 0xFFFFFFFF : 0;
+				if (!masks[i])
+					blocks[i] = (const uint8_t *)SHA256_K; // any 64 readable bytes, result is dropped
+				else
+					blocks[i] = b < numFullBlocks[i] ? bufs[i] + b*64 : tails[i] + (b - numFullBlocks[i])*64;
+			}
+			__m256i w[16];
+			for (int h = 0; h < 2; h++) // words 0-7 and 8-15 of every lane
+			{
+				for (int i = 0; i < 8; i++)
+					w[h*8 + i] = _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *)(blocks[i] + h*32)), bswap);
+				Transpose32x8 (w + h*8);
+			}
+			__m256i a = state[0], bb = state[1], c = state[2], d = state[3],
+				e = state[4], f = state[5], g = state[6], hh = state[7];
+			for (int t = 0; t < 64; t++)
+			{
+				if (t >= 16)
+				{
+					__m256i w15 = w[(t - 15) & 15], w2 = w[(t - 2) & 15];
+					__m256i s0 = _mm256_xor_si256 (_mm256_xor_si256 (Rotr32x8 (w15, 7), Rotr32x8 (w15, 18)), _mm256_srli_epi32 (w15, 3));
+					__m256i s1 = _mm256_xor_si256 (_mm256_xor_si256 (Rotr32x8 (w2, 17), Rotr32x8 (w2, 19)), _mm256_srli_epi32 (w2, 10));
+					w[t & 15] = _mm256_add_epi32 (_mm256_add_epi32 (w[t & 15], s0), _mm256_add_epi32 (w[(t - 7) & 15], s1));
+				}
+				__m256i S1 = _mm256_xor_si256 (_mm256_xor_si256 (Rotr32x8 (e, 6), Rotr32x8 (e, 11)), Rotr32x8 (e, 25));
+				__m256i ch = _mm256_xor_si256 (_mm256_and_si256 (e, f), _mm256_andnot_si256 (e, g));
+				__m256i t1 = _mm256_add_epi32 (_mm256_add_epi32 (hh, S1), _mm256_add_epi32 (ch,
+					_mm256_add_epi32 (w[t & 15], _mm256_set1_epi32 (SHA256_K[t]))));
+				__m256i S0 = _mm256_xor_si256 (_mm256_xor_si256 (Rotr32x8 (a, 2), Rotr32x8 (a, 13)), Rotr32x8 (a, 22));
+				__m256i maj = _mm256_or_si256 (_mm256_and_si256 (a, bb), _mm256_and_si256 (c, _mm256_or_si256 (a, bb)));
+				hh = g; g = f; f = e; e = _mm256_add_epi32 (d, t1);
+				d = c; c = bb; bb = a; a = _mm256_add_epi32 (t1, _mm256_add_epi32 (S0, maj));
+			}
+			// lanes with no more blocks keep their states
+			__m256i mask = _mm256_loadu_si256 ((const __m256i *)masks);
+			__m256i vars[8] = { a, bb, c, d, e, f, g, hh };
+			for (int j = 0; j < 8; j++)
+				state[j] = _mm256_blendv_epi8 (state[j], _mm256_add_epi32 (state[j], vars[j]), mask);
+		}
+		Transpose32x8 (state); // state[i] is digest of lane i
+		for (size_t i = 0; i < num; i++)
+			_mm256_storeu_si256 ((__m256i *)digests[i], _mm256_shuffle_epi8 (state[i], bswap));
+	}
+#endif
+
+	void SHA256Multi (size_t num, const uint8_t * const * bufs, const size_t * lens, uint8_t * const * digests)
+	{
+#if MULTI_BUFFER_AVX2
+		if (IsMultiBufferSupported ())
+			for (; num >= SHA256_MIN_NUM_LANES; )
+			{
+				size_t n = std::min (num, (size_t)8);
+				SHA256Lanes (n, bufs, lens, digests);
+				bufs += n; lens += n; digests += n; num -= n;
+			}
+#endif
+		for (size_t i = 0; i < num; i++)
+			SHA256 (bufs[i], lens[i], digests[i]);
+	}
+
+// multi-buffer HMAC-MD5
+
+#if MULTI_BUFFER_AVX2
+	static const uint32_t MD5_K[64] =
+	{
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+
+	static const int MD5_S[4][4] = { { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 } };
+
+	__attribute__((target("avx2")))
+	static void MD5Lanes (size_t num, const uint8_t * const * prefixes, const uint8_t * const * bufs, const size_t * lens, uint8_t * const * digests) // num <= 8
+	{
+		// lane i hashes 64 bytes of prefixes[i] followed by bufs[i], last one or two blocks padded in tails[i]
+		size_t numBlocks[8], numFullBlocks[8], maxNumBlocks = 0;
+		uint8_t tails[8][128];
+		uint32_t masks[8];
+		for (size_t i = 0; i < 8; i++)
+		{
+			numBlocks[i] = numFullBlocks[i] = 0;
+			if (i >= num) continue;
+			size_t len = lens[i];
+			numFullBlocks[i] = len >> 6;
+			numBlocks[i] = 1 + ((len + 9 + 63) >> 6);
+			if (numBlocks[i] > maxNumBlocks) maxNumBlocks = numBlocks[i];
+			size_t rem = len & 63;
+			memset (tails[i], 0, 128);
+			memcpy (tails[i], bufs[i] + (len - rem), rem);
+			tails[i][rem] = 0x80;
+			htole64buf (tails[i] + (numBlocks[i] - 1 - numFullBlocks[i])*64 - 8, (uint64_t)(64 + len) << 3);
+		}
+		const __m256i ones = _mm256_set1_epi32 (-1);
+		__m256i state[4] = { _mm256_set1_epi32 (0x67452301), _mm256_set1_epi32 (0xefcdab89),
+			_mm256_set1_epi32 (0x98badcfe), _mm256_set1_epi32 (0x10325476) };
+		for (size_t b = 0; b < maxNumBlocks; b++)
+		{
+			const uint8_t * blocks[8];
+			for (size_t i = 0; i < 8; i++)
+			{
+				masks[i] = b < numBlocks[i] ? 0xFFFFFFFF : 0;
+				if (!masks[i])
+					blocks[i] = (const uint8_t *)MD5_K; // any 64 readable bytes, result is dropped
+				else if (!b)
+					blocks[i] = prefixes[i];
+				else
+					blocks[i] = b - 1 < numFullBlocks[i] ? bufs[i] + (b - 1)*64 : tails[i] + (b - 1 - numFullBlocks[i])*64;
+			}
+			__m256i w[16];
+			for (int h = 0; h < 2; h++) // words 0-7 and 8-15 of every lane
+			{
+				for (int i = 0; i < 8; i++)
+					w[h*8 + i] = _mm256_loadu_si256 ((const __m256i *)(blocks[i] + h*32));
+				Transpose32x8 (w + h*8);
+			}
+			__m256i a = state[0], bb = state[1], c = state[2], d = state[3];
+			for (int t = 0; t < 64; t++)
+			{
+				__m256i f; int g;
+				switch (t >> 4)
+				{
+					case 0:
+						f = _mm256_xor_si256 (d, _mm256_and_si256 (bb, _mm256_xor_si256 (c, d)));
+						g = t;
+					break;
+					case 1:
+						f = _mm256_xor_si256 (c, _mm256_and_si256 (d, _mm256_xor_si256 (bb, c)));
+						g = (5*t + 1) & 15;
+					break;
+					case 2:
+						f = _mm256_xor_si256 (_mm256_xor_si256 (bb, c), d);
+						g = (3*t + 5) & 15;
+					break;
+					default:
+						f = _mm256_xor_si256 (c, _mm256_or_si256 (bb, _mm256_xor_si256 (d, ones)));
+						g = (7*t) & 15;
+				}
+				f = _mm256_add_epi32 (_mm256_add_epi32 (a, f), _mm256_add_epi32 (w[g], _mm256_set1_epi32 (MD5_K[t])));
+				a = d; d = c; c = bb;
+				bb = _mm256_add_epi32 (bb, Rotr32x8 (f, 32 - MD5_S[t >> 4][t & 3]));
+			}
+			// lanes with no more blocks keep their states
+			__m256i mask = _mm256_loadu_si256 ((const __m256i *)masks);
+			__m256i vars[4] = { a, bb, c, d };
+			for (int j = 0; j < 4; j++)
+				state[j] = _mm256_blendv_epi8 (state[j], _mm256_add_epi32 (state[j], vars[j]), mask);
+		}
+		uint32_t words[4][8];
+		for (int j = 0; j < 4; j++)
+			_mm256_storeu_si256 ((__m256i *)words[j], state[j]);
+		for (size_t i = 0; i < num; i++)
+			for (int j = 0; j < 4; j++)
+				htole32buf (digests[i] + 4*j, words[j][i]);
+	}
+#endif
+
+	void HMACMD5DigestMulti (size_t num, uint8_t * const * msgs, const size_t * lens, const MACKey * const * keys, uint8_t * const * digests)
+	{
+#if MULTI_BUFFER_AVX2
+		if (IsMultiBufferSupported ())
+			for (; num >= HMAC_MD5_MIN_NUM_LANES; )
+			{
+				size_t n = std::min (num, (size_t)8);
+				uint64_t ipad[8][8], opad[8][8], hash[8][4]; // first hash size assumed 32 bytes in I2P
+				const uint8_t * ipads[8], * opads[8], * hashes[8];
+				size_t hashLens[8];
+				uint8_t * inner[8];
+				for (size_t i = 0; i < n; i++)
+				{
+					for (int j = 0; j < 4; j++)
+					{
+						ipad[i][j] = keys[i]->GetLL ()[j] ^ IPAD; ipad[i][j + 4] = IPAD;
+						opad[i][j] = keys[i]->GetLL ()[j] ^ OPAD; opad[i][j + 4] = OPAD;
+					}
+					hash[i][2] = hash[i][3] = 0;
+					ipads[i] = (const uint8_t *)ipad[i]; opads[i] = (const uint8_t *)opad[i];
+					inner[i] = (uint8_t *)hash[i]; hashes[i] = inner[i]; hashLens[i] = 32;
+				}
+				MD5Lanes (n, ipads, msgs, lens, inner);
+				MD5Lanes (n, opads, hashes, hashLens, digests);
+				msgs += n; lens += n; keys += n; digests += n; num -= n;
+			}
+#endif
+		for (size_t i = 0; i < num; i++)
+			HMACMD5Digest (msgs[i], lens[i], *keys[i], digests[i]);
+	}
+
 // init and terminate
 
 /*	std::vector <std::unique_ptr<std::mutex> >  m_OpenSSLMutexes;
@@ -1243,7 +2054,7 @@ namespace crypto
 	}*/
 
 	
-	void InitCrypto (bool precomputation)
+	void InitCrypto (bool precomputation, int elgamalWindowSize)
 	{
 		i2p::cpu::Detect ();	
 #if LEGACY_OPENSSL
@@ -1255,12 +2066,12 @@ namespace crypto
 		CRYPTO_set_locking_callback (OpensslLockingCallback);*/
 		if (precomputation)
 		{
+			if (elgamalWindowSize < 1) elgamalWindowSize = 1;
+			if (elgamalWindowSize > ELGAMAL_MAX_WINDOW_SIZE) elgamalWindowSize = ELGAMAL_MAX_WINDOW_SIZE;
 #if defined(__x86_64__)
-			g_ElggTable = new BIGNUM * [ELGAMAL_FULL_EXPONENT_NUM_BYTES][255];
-			PrecalculateElggTable (g_ElggTable, ELGAMAL_FULL_EXPONENT_NUM_BYTES);
+			PrecalculateElggTable (elgamalWindowSize, ELGAMAL_FULL_EXPONENT_NUM_BITS);
 #else
-			g_ElggTable = new BIGNUM * [ELGAMAL_SHORT_EXPONENT_NUM_BYTES][255];
-			PrecalculateElggTable (g_ElggTable, ELGAMAL_SHORT_EXPONENT_NUM_BYTES);
+			PrecalculateElggTable (elgamalWindowSize, ELGAMAL_SHORT_EXPONENT_NUM_BITS);
 #endif
 		}
 	}
@@ -1268,16 +2079,7 @@ namespace crypto
 	void TerminateCrypto ()
 	{
 		if (g_ElggTable)
-		{
-			DestroyElggTable (g_ElggTable,
-#if defined(__x86_64__)
-				ELGAMAL_FULL_EXPONENT_NUM_BYTES
-#else
-				ELGAMAL_SHORT_EXPONENT_NUM_BYTES
-#endif
-			);
-			delete[] g_ElggTable; g_ElggTable = nullptr;
-		}
+			DestroyElggTable ();
 /*		CRYPTO_set_locking_callback (nullptr);
 		m_OpenSSLMutexes.clear ();*/
 	}
@@ -42,6 +42,7 @@ namespace i2p
 namespace crypto
 {
 	bool bn2buf (const BIGNUM * bn, uint8_t * buf, size_t len);
+	BN_CTX * GetThreadBNCtx (); // per-thread scratch context, must not be freed by caller
 
 	// DSA
 	DSA * CreateDSA ();
@@ -77,6 +78,7 @@ namespace crypto
 			~X25519Keys ();
 
 			void GenerateKeys ();
+			static void GenerateKeys (size_t num, X25519Keys * const * keys); // batch
 			const uint8_t * GetPublicKey () const { return m_PublicKey; };
 			void GetPrivateKey (uint8_t * priv) const;
 			void Agree (const uint8_t * pub, uint8_t * shared);			
@@ -106,6 +108,9 @@ namespace crypto
 	// HMAC
 	typedef i2p::data::Tag<32> MACKey;
 	void HMACMD5Digest (uint8_t * msg, size_t len, const MACKey& key, uint8_t * digest);
+	// multi-buffer, messages with different keys are hashed in 8 AVX2 lanes at once if supported
+	const size_t HMAC_MD5_MIN_NUM_LANES = 3; // fewer messages are hashed one by one
+	void HMACMD5DigestMulti (size_t num, uint8_t * const * msgs, const size_t * lens, const MACKey * const * keys, uint8_t * const * digests);
 
 	// AES
 	struct ChipherBlock
@@ -154,11 +159,8 @@ namespace crypto
 	};
 
 
-#ifdef __AES__
-	#ifdef ARM64AES
-		void init_aesenc(void) __attribute__((constructor));
-	#endif
-	class ECBCryptoAESNI
+#if defined(__AES__) || defined(ARM64AES)
+	class ECBCryptoAESNI // AES-NI or ARMv8 AES
 	{
 		public:
 
@@ -174,7 +176,7 @@ namespace crypto
 	};
 #endif
 
-#ifdef __AES__
+#if defined(__AES__) || defined(ARM64AES)
 	class ECBEncryption: public ECBCryptoAESNI
 #else
 	class ECBEncryption
@@ -190,7 +192,7 @@ namespace crypto
 		AES_KEY m_Key;
 	};
 
-#ifdef __AES__
+#if defined(__AES__) || defined(ARM64AES)
 	class ECBDecryption: public ECBCryptoAESNI
 #else
 	class ECBDecryption
@@ -260,6 +262,7 @@ namespace crypto
 			}
 
 			void Encrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			void Encrypt (const uint8_t * const * in, uint8_t * const * out, size_t num); // num messages of 1024 bytes, interleaved
 
 		private:
 
@@ -278,6 +281,7 @@ namespace crypto
 			}
 
 			void Decrypt (const uint8_t * in, uint8_t * out); // 1024 bytes (16 IV + 1008 data)
+			void Decrypt (const uint8_t * const * in, uint8_t * const * out, size_t num); // num messages of 1024 bytes, interleaved
 
 		private:
 
@@ -290,8 +294,22 @@ namespace crypto
 
 	void AEADChaCha20Poly1305Encrypt (const std::vector<std::pair<uint8_t *, size_t> >& bufs, const uint8_t * key, const uint8_t * nonce, uint8_t * mac); // encrypt multiple buffers with zero ad
 
+	void ChaCha20 (const uint8_t * msg, size_t msgLen, const uint8_t * key, const uint8_t * nonce, uint8_t * out); // keystream from counter 1, no MAC
+
+// per thread buffered random, ChaCha20 keystream with key erasure, seeded from RAND_bytes
+	const size_t RANDOM_BUFFER_SIZE = 1024; // keystream bytes per refill
+	const int RANDOM_RESEED_INTERVAL = 1024; // in refills
+	void RandBytes (uint8_t * buf, size_t len); // IDs, IVs and padding, RAND_bytes for long term keys
+	uint32_t RandUint32 ();
+
+// multi-buffer SHA256, independent messages hashed in 8 AVX2 lanes at once if supported
+	const size_t SHA256_MIN_NUM_LANES = 3; // fewer messages are hashed one by one
+	void SHA256Multi (size_t num, const uint8_t * const * bufs, const size_t * lens, uint8_t * const * digests);
+
 // init and terminate
-	void InitCrypto (bool precomputation);
+	const int ELGAMAL_DEFAULT_WINDOW_SIZE = 8; // bits, precomputation table grows as 2^windowSize/windowSize
+	const int ELGAMAL_MAX_WINDOW_SIZE = 10;
+	void InitCrypto (bool precomputation, int elgamalWindowSize = ELGAMAL_DEFAULT_WINDOW_SIZE);
 	void TerminateCrypto ();
 }
 }
@@ -5,74 +5,163 @@
 #include <mutex>
 #include <deque>
 #include <thread>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include "Metrics.h"
 
 namespace i2p
 {
 namespace worker
 {
+	const size_t THREAD_POOL_NUM_SLOTS = 256; // preallocated jobs per worker, overflow goes to deque
+
+	/** @brief work-stealing pool, every worker has own ring of jobs and takes from others if empty.
+	 *  Result of a job is posted to caller's service */
 	template<typename Caller>
-	struct ThreadPool
+	class ThreadPool
 	{
-		typedef std::function<void(void)> ResultFunc;
-		typedef std::function<ResultFunc(void)> WorkFunc;
-		typedef std::pair<std::shared_ptr<Caller>, WorkFunc> Job;
-		typedef std::mutex mtx_t;
-		typedef std::unique_lock<mtx_t> lock_t;
-		typedef std::condition_variable cond_t;
-		ThreadPool(int workers)
-		{
-			stop = false;
-			if(workers > 0)
+		public:
+
+			typedef std::function<void(void)> ResultFunc;
+			typedef std::function<ResultFunc(void)> WorkFunc;
+			typedef std::pair<std::shared_ptr<Caller>, WorkFunc> Job;
+
+			ThreadPool (int workers):
+				m_NextWorker (0), m_NumJobs (0), m_NumSleeping (0), m_IsStopped (false)
+			{
+				if (workers <= 0) return;
+				for (int i = 0; i < workers; i++)
+					m_Workers.emplace_back (new Worker ());
+				for (int i = 0; i < workers; i++)
+					m_Threads.emplace_back (std::bind (&ThreadPool::Run, this, i));
+			}
+
+			~ThreadPool ()
 			{
-				while(workers--)
 				{
-					threads.emplace_back([this] {
-							for (;;)
-							{
-								Job job;
-								{
-									lock_t lock(this->queue_mutex);
-									this->condition.wait(
-										lock, [this] { return this->stop || !this->jobs.empty(); });
-									if (this->stop && this->jobs.empty()) return;
-									job = std::move(this->jobs.front());
-									this->jobs.pop_front();
-								}
-								ResultFunc result = job.second();
-								job.first->GetService().post(result);
-							}
-					});
+					std::unique_lock<std::mutex> l(m_SleepMutex);
+					m_IsStopped = true;
 				}
+				m_Wakeup.notify_all ();
+				for (auto& it: m_Threads) it.join ();
 			}
-		};
 
-		void Offer(const Job & job)
-		{
+			void Offer (const Job& job)
 			{
-				lock_t lock(queue_mutex);
-				if (stop) return;
-				jobs.emplace_back(job);
+				if (m_IsStopped || m_Workers.empty ()) return;
+				auto& worker = *m_Workers[m_NextWorker++ % m_Workers.size ()];
+				{
+					std::unique_lock<std::mutex> l(worker.mutex);
+					if (worker.size < THREAD_POOL_NUM_SLOTS && worker.overflow.empty ())
+					{
+						worker.slots[(worker.head + worker.size) % THREAD_POOL_NUM_SLOTS] = job;
+						worker.size++;
+					}
+					else
+						worker.overflow.push_back (job);
+				}
+				i2p::metrics::workerPoolQueueSize.Observe (++m_NumJobs);
+				if (m_NumSleeping > 0)
+				{
+					std::unique_lock<std::mutex> l(m_SleepMutex); // sleeping worker is either in wait or sees m_NumJobs
+					m_Wakeup.notify_one ();
+				}
 			}
-			condition.notify_one();
-		}
 
-		~ThreadPool()
-		{
+			int GetQueueSize () const { return m_NumJobs; };
+
+		private:
+
+			struct Worker
+			{
+				Worker (): slots (THREAD_POOL_NUM_SLOTS), head (0), size (0) {};
+
+				std::mutex mutex;
+				std::vector<Job> slots; // ring
+				size_t head, size;
+				std::deque<Job> overflow; // after slots
+			};
+
+			bool Pop (Worker& worker, Job& job) // oldest
 			{
-				lock_t lock(queue_mutex);
-				stop = true;
+				std::unique_lock<std::mutex> l(worker.mutex);
+				if (worker.size)
+				{
+					auto& slot = worker.slots[worker.head];
+					job.first.swap (slot.first); job.second.swap (slot.second);
+					slot.second = nullptr;
+					worker.head = (worker.head + 1) % THREAD_POOL_NUM_SLOTS;
+					worker.size--;
+				}
+				else if (!worker.overflow.empty ())
+				{
+					job = std::move (worker.overflow.front ());
+					worker.overflow.pop_front ();
+				}
+				else
+					return false;
+				return true;
+			}
+
+			bool Steal (Worker& worker, Job& job) // newest, owner keeps order of the rest
+			{
+				std::unique_lock<std::mutex> l(worker.mutex);
+				if (!worker.overflow.empty ())
+				{
+					job = std::move (worker.overflow.back ());
+					worker.overflow.pop_back ();
+				}
+				else if (worker.size)
+				{
+					auto& slot = worker.slots[(worker.head + worker.size - 1) % THREAD_POOL_NUM_SLOTS];
+					job.first.swap (slot.first); job.second.swap (slot.second);
+					slot.second = nullptr;
+					worker.size--;
+				}
+				else
+					return false;
+				return true;
+			}
+
+			void Run (size_t index)
+			{
+				auto num = m_Workers.size ();
+				for (;;)
+				{
+					Job job;
+					bool found = Pop (*m_Workers[index], job);
+					for (size_t i = 1; !found && i < num; i++)
+						if (Steal (*m_Workers[(index + i) % num], job))
+						{
+							found = true;
+							i2p::metrics::workerPoolSteals.Inc ();
+						}
+					if (found)
+					{
+						m_NumJobs--;
+						ResultFunc result = job.second ();
+						job.first->GetService ().post (result);
+						continue;
+					}
+					std::unique_lock<std::mutex> l(m_SleepMutex);
+					m_NumSleeping++;
+					m_Wakeup.wait (l, [this] { return m_IsStopped || m_NumJobs > 0; });
+					m_NumSleeping--;
+					if (m_IsStopped && m_NumJobs <= 0) return;
+				}
 			}
-			condition.notify_all();
-			for(auto &t: threads) t.join();
-		}
-
-		std::vector<std::thread> threads;
-		std::deque<Job> jobs;
-		mtx_t queue_mutex;
-		cond_t condition;
-		bool stop;
+
+		private:
+
+			std::vector<std::unique_ptr<Worker> > m_Workers;
+			std::vector<std::thread> m_Threads;
+			std::atomic<size_t> m_NextWorker;
+			std::atomic<int> m_NumJobs, m_NumSleeping;
+			std::atomic<bool> m_IsStopped;
+			std::mutex m_SleepMutex;
+			std::condition_variable m_Wakeup;
 	};
 }
 }
@@ -16,6 +16,7 @@ namespace datagram
 		m_Receiver (nullptr)
 	{
 		m_Identity.FromBase64 (owner->GetIdentity()->ToBase64());
+		m_StoreDeflator.SetCompressionLevel (0);
 	}
 
 	DatagramDestination::~DatagramDestination ()
@@ -24,6 +25,30 @@ namespace datagram
 	}
 
 	void DatagramDestination::SendDatagramTo(const uint8_t * payload, size_t len, const i2p::data::IdentHash & identity, uint16_t fromPort, uint16_t toPort)
+	{
+		auto msg = CreateSignedDatagram (payload, len, fromPort, toPort);
+		auto session = ObtainSession(identity);
+		session->SendMsg(msg);
+	}
+
+	void DatagramDestination::SendDatagramsTo(const std::vector<std::pair<const uint8_t *, size_t> >& payloads, const i2p::data::IdentHash & identity, uint16_t fromPort, uint16_t toPort)
+	{
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		msgs.reserve (payloads.size ());
+		for (const auto& it: payloads)
+			msgs.push_back (CreateSignedDatagram (it.first, it.second, fromPort, toPort));
+		auto session = ObtainSession(identity);
+		session->SendMsgs(msgs);
+	}
+
+	void DatagramDestination::SendRawDatagramTo(const uint8_t * payload, size_t len, const i2p::data::IdentHash & identity, uint16_t fromPort, uint16_t toPort)
+	{
+		auto msg = CreateDataMessage (payload, len, fromPort, toPort, true);
+		auto session = ObtainSession(identity);
+		session->SendMsg(msg);
+	}
+
+	std::shared_ptr<I2NPMessage> DatagramDestination::CreateSignedDatagram (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort)
 	{
 		auto owner = m_Owner;
 		std::vector<uint8_t> v(MAX_DATAGRAM_SIZE);
@@ -44,37 +69,43 @@ namespace datagram
 		else
 			owner->Sign (buf1, len, signature);
 
-		auto msg = CreateDataMessage (buf, len + headerLen, fromPort, toPort);
-		auto session = ObtainSession(identity);
-		session->SendMsg(msg);
+		return CreateDataMessage (buf, len + headerLen, fromPort, toPort);
 	}
 
 
 	void DatagramDestination::HandleDatagram (uint16_t fromPort, uint16_t toPort,uint8_t * const &buf, size_t len)
 	{
-		i2p::data::IdentityEx identity;
-		size_t identityLen = identity.FromBuffer (buf, len);
+		auto identity = std::make_shared<i2p::data::IdentityEx>();
+		size_t identityLen = identity->FromBuffer (buf, len);
+		if (!identityLen) return;
+		// same sender again, reuse its verifier
+		auto it = m_Identities.find (identity->GetIdentHash ());
+		if (it != m_Identities.end ())
+			identity = it->second;
 		const uint8_t * signature = buf + identityLen;
-		size_t headerLen = identityLen + identity.GetSignatureLen ();
+		size_t headerLen = identityLen + identity->GetSignatureLen ();
+		if (headerLen > len) return;
 
 		bool verified = false;
-		if (identity.GetSigningKeyType () == i2p::data::SIGNING_KEY_TYPE_DSA_SHA1)
+		if (identity->GetSigningKeyType () == i2p::data::SIGNING_KEY_TYPE_DSA_SHA1)
 		{
 			uint8_t hash[32];
 			SHA256(buf + headerLen, len - headerLen, hash);
-			verified = identity.Verify (hash, 32, signature);
+			verified = identity->Verify (hash, 32, signature);
 		}
 		else
-			verified = identity.Verify (buf + headerLen, len - headerLen, signature);
+			verified = identity->Verify (buf + headerLen, len - headerLen, signature);
 
 		if (verified)
 		{
-			auto h = identity.GetIdentHash();
+			auto h = identity->GetIdentHash();
+			if (it == m_Identities.end () && m_Identities.size () < DATAGRAM_MAX_NUM_CACHED_IDENTITIES)
+				m_Identities.emplace (h, identity);
 			auto session = ObtainSession(h);
 			session->Ack();
 			auto r = FindReceiver(toPort);
 			if(r)
-				r(identity, fromPort, toPort, buf + headerLen, len -headerLen);
+				r(*identity, fromPort, toPort, buf + headerLen, len -headerLen);
 			else
 				LogPrint (eLogWarning, "DatagramDestination: no receiver for port ", toPort);
 		}
@@ -92,29 +123,60 @@ namespace datagram
 		return r;
 	}
 
-	void DatagramDestination::HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
+	DatagramDestination::RawReceiver DatagramDestination::FindRawReceiver(uint16_t port)
+	{
+		std::lock_guard<std::mutex> lock(m_ReceiversMutex);
+		RawReceiver r = m_RawReceiver;
+		auto itr = m_RawReceiversByPorts.find(port);
+		if (itr != m_RawReceiversByPorts.end())
+			r = itr->second;
+		return r;
+	}
+
+	void DatagramDestination::HandleRawDatagram (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
+	{
+		auto r = FindRawReceiver(toPort);
+		if (r)
+			r (fromPort, toPort, buf, len);
+		else
+			LogPrint (eLogWarning, "DatagramDestination: no receiver for raw datagram");
+	}
+
+	void DatagramDestination::HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len, bool isRaw)
 	{
 		// unzip it
 		uint8_t uncompressed[MAX_DATAGRAM_SIZE];
 		size_t uncompressedLen = m_Inflator.Inflate (buf, len, uncompressed, MAX_DATAGRAM_SIZE);
 		if (uncompressedLen)
-			HandleDatagram (fromPort, toPort, uncompressed, uncompressedLen);
+		{
+			if (isRaw)
+				HandleRawDatagram (fromPort, toPort, uncompressed, uncompressedLen);
+			else
+				HandleDatagram (fromPort, toPort, uncompressed, uncompressedLen);
+		}
 		else
 			LogPrint (eLogWarning, "Datagram: decompression failed");
 	}
 
-	std::shared_ptr<I2NPMessage> DatagramDestination::CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort)
+	std::shared_ptr<I2NPMessage> DatagramDestination::CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort, bool isRaw)
 	{
 		auto msg = NewI2NPMessage ();
 		uint8_t * buf = msg->GetPayload ();
 		buf += 4; // reserve for length
-		size_t size = m_Deflator.Deflate (payload, len, buf, msg->maxLen - msg->len);
+		size_t size = 0;
+		if (len < DATAGRAM_MIN_COMPRESSION_SIZE || m_IncompressibleSkipper.Skip ())
+			size = m_StoreDeflator.Deflate (payload, len, buf, msg->maxLen - msg->len);
+		else
+		{
+			size = m_Deflator.Deflate (payload, len, buf, msg->maxLen - msg->len);
+			if (size) m_IncompressibleSkipper.Compressed (len, size);
+		}
 		if (size)
 		{
 			htobe32buf (msg->GetPayload (), size); // length
 			htobe16buf (buf + 4, fromPort); // source port
 			htobe16buf (buf + 6, toPort); // destination port
-			buf[9] = i2p::client::PROTOCOL_TYPE_DATAGRAM; // datagram protocol
+			buf[9] = isRaw ? i2p::client::PROTOCOL_TYPE_RAW : i2p::client::PROTOCOL_TYPE_DATAGRAM; // datagram protocol
 			msg->len += size + 4;
 			msg->FillI2NPMessageHeader (eI2NPData);
 		}
@@ -137,6 +199,7 @@ namespace datagram
 			{
 				LogPrint(eLogInfo, "DatagramDestination: expiring idle session with ", it->first.ToBase32());
 				it->second->Stop ();
+				m_Identities.erase (it->first);
 				it = m_Sessions.erase (it); // we are expired
 			}
 			else
@@ -199,6 +262,14 @@ namespace datagram
 		m_LocalDestination->GetService().post(std::bind(&DatagramSession::HandleSend, self, msg));
 	}
 
+	void DatagramSession::SendMsgs(const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		m_LastUse = i2p::util::GetMillisecondsSinceEpoch();
+		// one post for all messages
+		auto self = shared_from_this();
+		m_LocalDestination->GetService().post(std::bind(&DatagramSession::HandleSendMsgs, self, msgs));
+	}
+
 	DatagramSession::Info DatagramSession::GetSessionInfo() const
 	{
 		if(!m_RoutingSession)
@@ -227,7 +298,7 @@ namespace datagram
 		m_LastUse = i2p::util::GetMillisecondsSinceEpoch();
 		auto path = GetSharedRoutingPath();
 		if(path)
-			path->updateTime = i2p::util::GetSecondsSinceEpoch ();
+			m_RoutingSession->ConfirmSharedRoutingPath (path->outboundTunnel, path->remoteLease);
 	}
 
 	std::shared_ptr<i2p::garlic::GarlicRoutingPath> DatagramSession::GetSharedRoutingPath ()
@@ -248,6 +319,9 @@ namespace datagram
 		}
 		auto path = m_RoutingSession->GetSharedRoutingPath();
 		if(path) {
+			// path might be chosen by stream to the same destination
+			m_CurrentOutboundTunnel = path->outboundTunnel;
+			m_CurrentRemoteLease = path->remoteLease;
 			if (m_CurrentOutboundTunnel && !m_CurrentOutboundTunnel->IsEstablished()) {
 				// bad outbound tunnel, switch outbound tunnel
 				m_CurrentOutboundTunnel = m_LocalDestination->GetTunnelPool()->GetNextOutboundTunnel(m_CurrentOutboundTunnel);
@@ -338,20 +412,55 @@ namespace datagram
 		if(m_SendQueue.size() >= DATAGRAM_SEND_QUEUE_MAX_SIZE) FlushSendQueue();
 	}
 
+	void DatagramSession::HandleSendMsgs(const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
+	{
+		for (const auto & msg : msgs)
+		{
+			m_SendQueue.push_back(msg);
+			if(m_SendQueue.size() >= DATAGRAM_SEND_QUEUE_MAX_SIZE) FlushSendQueue();
+		}
+	}
+
 	void DatagramSession::FlushSendQueue ()
 	{
 
+		auto loopback = m_LocalDestination->GetLoopbackDestination (m_RemoteIdent);
+		if (loopback) // in-process, bypass garlic and tunnels
+		{
+			for (const auto & msg : m_SendQueue)
+				if (msg) loopback->SendLoopbackMessage (msg);
+			m_SendQueue.clear();
+			ScheduleFlushSendQueue();
+			return;
+		}
 		std::vector<i2p::tunnel::TunnelMessageBlock> send;
 		auto routingPath = GetSharedRoutingPath();
 		// if we don't have a routing path we will drop all queued messages
 		if(routingPath && routingPath->outboundTunnel && routingPath->remoteLease)
 		{
+			// pack small datagrams into one garlic message, a clove per datagram
+			std::vector<std::shared_ptr<const I2NPMessage> > cloves;
+			size_t size = 0;
+			auto wrap = [&]()
+			{
+				if (cloves.empty ()) return;
+				auto m = m_RoutingSession->WrapMessages(cloves);
+				if (m)
+					send.push_back(i2p::tunnel::TunnelMessageBlock{i2p::tunnel::eDeliveryTypeTunnel,routingPath->remoteLease->tunnelGateway, routingPath->remoteLease->tunnelID, m});
+				cloves.clear ();
+				size = 0;
+			};
 			for (const auto & msg : m_SendQueue)
 			{
-				auto m = m_RoutingSession->WrapSingleMessage(msg);
-				send.push_back(i2p::tunnel::TunnelMessageBlock{i2p::tunnel::eDeliveryTypeTunnel,routingPath->remoteLease->tunnelGateway, routingPath->remoteLease->tunnelID, m});
+				if (!msg) continue;
+				size_t len = msg->GetLength () + DATAGRAM_GARLIC_CLOVE_OVERHEAD;
+				if (size + len > DATAGRAM_GARLIC_MAX_PAYLOAD_SIZE) wrap ();
+				cloves.push_back (msg);
+				size += len;
 			}
-			routingPath->outboundTunnel->SendTunnelDataMsg(send);
+			wrap ();
+			if (!send.empty ())
+				routingPath->outboundTunnel->SendTunnelDataMsg(send);
 		}
 		m_SendQueue.clear();
 		ScheduleFlushSendQueue();
@@ -10,6 +10,7 @@
 #include "LeaseSet.h"
 #include "I2NPProtocol.h"
 #include "Garlic.h"
+#include "Gzip.h"
 
 namespace i2p
 {
@@ -33,6 +34,11 @@ namespace datagram
 	const uint64_t DATAGRAM_SESSION_PATH_MIN_LIFETIME = 5 * 1000;
   // max 64 messages buffered in send queue for each datagram session
   const size_t DATAGRAM_SEND_QUEUE_MAX_SIZE = 64;
+	// bytes of datagrams packed as cloves into one garlic message
+	const size_t DATAGRAM_GARLIC_MAX_PAYLOAD_SIZE = 8192;
+	const size_t DATAGRAM_GARLIC_CLOVE_OVERHEAD = 64; // delivery instructions, clove header and certificate
+	// payloads shorter than this are stored without compression
+	const size_t DATAGRAM_MIN_COMPRESSION_SIZE = 128;
 
 	class DatagramSession : public std::enable_shared_from_this<DatagramSession>
 	{
@@ -48,6 +54,8 @@ namespace datagram
 
 		/** send an i2np message to remote endpoint for this session */
 		void SendMsg(std::shared_ptr<I2NPMessage> msg);
+		/** send several i2np messages at once */
+		void SendMsgs(const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
 		/** get the last time in milliseconds for when we used this datagram session */
 		uint64_t LastActivity() const { return m_LastUse; }
 
@@ -75,6 +83,7 @@ namespace datagram
     void ScheduleFlushSendQueue();
 
     void HandleSend(std::shared_ptr<I2NPMessage> msg);
+    void HandleSendMsgs(const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
 
     std::shared_ptr<i2p::garlic::GarlicRoutingPath> GetSharedRoutingPath();
 
@@ -96,9 +105,11 @@ namespace datagram
 	typedef std::shared_ptr<DatagramSession> DatagramSession_ptr;
 
 	const size_t MAX_DATAGRAM_SIZE = 32768;
+	const size_t DATAGRAM_MAX_NUM_CACHED_IDENTITIES = 1024; // senders with ready verifiers
 	class DatagramDestination
 	{
 		typedef std::function<void (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)> Receiver;
+		typedef std::function<void (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)> RawReceiver;
 
 		public:
 
@@ -107,14 +118,24 @@ namespace datagram
 			~DatagramDestination ();
 
 	void SendDatagramTo (const uint8_t * payload, size_t len, const i2p::data::IdentHash & ident, uint16_t fromPort = 0, uint16_t toPort = 0);
-			void HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
+			/** send several datagrams to the same remote, session is looked up once */
+			void SendDatagramsTo (const std::vector<std::pair<const uint8_t *, size_t> >& payloads, const i2p::data::IdentHash & ident, uint16_t fromPort = 0, uint16_t toPort = 0);
+			/** send unsigned datagram without sender's identity, for apps authenticating on their own */
+			void SendRawDatagramTo (const uint8_t * payload, size_t len, const i2p::data::IdentHash & ident, uint16_t fromPort = 0, uint16_t toPort = 0);
+			void HandleDataMessagePayload (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len, bool isRaw = false);
 
 			void SetReceiver (const Receiver& receiver) { m_Receiver = receiver; };
 			void ResetReceiver () { m_Receiver = nullptr; };
 
+			void SetRawReceiver (const RawReceiver& receiver) { m_RawReceiver = receiver; };
+			void ResetRawReceiver () { m_RawReceiver = nullptr; };
+
 			void SetReceiver (const Receiver& receiver, uint16_t port) { std::lock_guard<std::mutex> lock(m_ReceiversMutex); m_ReceiversByPorts[port] = receiver; };
 			void ResetReceiver (uint16_t port) { std::lock_guard<std::mutex> lock(m_ReceiversMutex); m_ReceiversByPorts.erase (port); };
 
+			void SetRawReceiver (const RawReceiver& receiver, uint16_t port) { std::lock_guard<std::mutex> lock(m_ReceiversMutex); m_RawReceiversByPorts[port] = receiver; };
+			void ResetRawReceiver (uint16_t port) { std::lock_guard<std::mutex> lock(m_ReceiversMutex); m_RawReceiversByPorts.erase (port); };
+
 			std::shared_ptr<DatagramSession::Info> GetInfoForRemote(const i2p::data::IdentHash & remote);
 
 			// clean up stale sessions
@@ -124,24 +145,31 @@ namespace datagram
 
     std::shared_ptr<DatagramSession> ObtainSession(const i2p::data::IdentHash & ident);
 
-			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort);
+			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort, bool isRaw = false);
+			std::shared_ptr<I2NPMessage> CreateSignedDatagram (const uint8_t * payload, size_t len, uint16_t fromPort, uint16_t toPort);
 
 			void HandleDatagram (uint16_t fromPort, uint16_t toPort, uint8_t *const& buf, size_t len);
+			void HandleRawDatagram (uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 
 			/** find a receiver by port, if none by port is found try default receiever, otherwise returns nullptr */
 			Receiver FindReceiver(uint16_t port);
+			RawReceiver FindRawReceiver(uint16_t port);
 
 		private:
 			i2p::client::ClientDestination * m_Owner;
 			i2p::data::IdentityEx m_Identity;
 			Receiver m_Receiver; // default
+			RawReceiver m_RawReceiver;
+			std::map<i2p::data::IdentHash, std::shared_ptr<i2p::data::IdentityEx> > m_Identities; // verifier is created once per sender
 			std::mutex m_SessionsMutex;
 			std::map<i2p::data::IdentHash, DatagramSession_ptr > m_Sessions;
 			std::mutex m_ReceiversMutex;
 			std::map<uint16_t, Receiver> m_ReceiversByPorts;
+			std::map<uint16_t, RawReceiver> m_RawReceiversByPorts;
 
 			i2p::data::GzipInflator m_Inflator;
-			i2p::data::GzipDeflator m_Deflator;
+			i2p::data::GzipDeflator m_Deflator, m_StoreDeflator; // level 0 for tiny or incompressible payloads
+			i2p::data::IncompressibleSkipper m_IncompressibleSkipper;
 	};
 }
 }
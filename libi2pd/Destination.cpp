@@ -1,28 +1,174 @@
 #include <algorithm>
 #include <cassert>
+#include <future>
 #include <string>
+#include <unordered_map>
 #include "Crypto.h"
 #include "Log.h"
 #include "FS.h"
 #include "Timestamp.h"
 #include "NetDb.hpp"
 #include "Destination.h"
+#include "CryptoWorker.h"
 #include "util.h"
+#include "Metrics.h"
+#include "Config.h"
 
 namespace i2p
 {
 namespace client
 {
+	typedef i2p::worker::ThreadPool<LeaseSetDestination> ElGamalDecryptionPool;
+	static ElGamalDecryptionPool& GetElGamalDecryptionPool ()
+	{
+		static ElGamalDecryptionPool pool (DESTINATION_NUM_ELGAMAL_DECRYPTION_WORKERS);
+		return pool;
+	}
+
+	static thread_local boost::asio::io_service * currentService = nullptr; // destination's service this thread runs
+
+	static DestinationsServices& GetDestinationsServices ()
+	{
+		static DestinationsServices services ([]()
+			{
+				uint16_t numThreads = 0; i2p::config::GetOption("destinationthreads", numThreads);
+				if (!numThreads) numThreads = std::thread::hardware_concurrency ();
+				return numThreads ? numThreads : 1;
+			}());
+		return services;
+	}
+
+	DestinationsServices::DestinationsServices (int numThreads):
+		m_IsRunning (true), m_NextService (0)
+	{
+		for (int i = 0; i < numThreads; i++)
+		{
+			m_Services.emplace_back (new boost::asio::io_service ());
+			m_Works.emplace_back (new boost::asio::io_service::work (*m_Services.back ()));
+			m_Threads.emplace_back (new std::thread (std::bind (&DestinationsServices::Run, this, std::ref (*m_Services.back ()))));
+		}
+		LogPrint (eLogInfo, "Destination: ", numThreads, " shared destinations threads started");
+	}
+
+	DestinationsServices::~DestinationsServices ()
+	{
+		m_IsRunning = false;
+		for (auto& it: m_Services)
+			it->stop ();
+		for (auto& it: m_Threads)
+			it->join ();
+	}
+
+	boost::asio::io_service& DestinationsServices::GetNextService ()
+	{
+		return *m_Services[m_NextService.fetch_add (1, std::memory_order_relaxed) % m_Services.size ()];
+	}
+
+	void DestinationsServices::Run (boost::asio::io_service& service)
+	{
+		i2p::util::InitThread ("Destinations", i2p::util::eThreadGroupClients);
+		currentService = &service;
+		while (m_IsRunning)
+		{
+			try
+			{
+				i2p::util::RunService (service, "Destinations");
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Destination: shared thread runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	static bool IsDedicatedThreadRequested (const std::map<std::string, std::string> * params)
+	{
+		if (!params) return DEFAULT_DEDICATED_THREAD;
+		auto it = params->find (I2CP_PARAM_DEDICATED_THREAD);
+		if (it == params->end ()) return DEFAULT_DEDICATED_THREAD;
+		return it->second == "true" || it->second == "1";
+	}
+
+	static SharedLeaseSetsCache& GetSharedLeaseSets ()
+	{
+		static SharedLeaseSetsCache cache (SHARED_LEASESETS_CACHE_SIZE);
+		return cache;
+	}
+
+	struct LocalDestinations // running client destinations of this router, for loopback
+	{
+		std::mutex mutex;
+		std::unordered_map<i2p::data::IdentHash, std::weak_ptr<ClientDestination> > destinations;
+	};
+
+	static LocalDestinations& GetLocalDestinations ()
+	{
+		static LocalDestinations local;
+		return local;
+	}
+
+	std::shared_ptr<i2p::data::LeaseSet> SharedLeaseSetsCache::Get (const i2p::data::IdentHash& ident)
+	{
+		std::lock_guard<std::mutex> l(m_Mutex);
+		auto it = m_Index.find (ident);
+		if (it == m_Index.end ()) return nullptr;
+		auto leaseSet = it->second->second;
+		if (leaseSet->IsExpired ())
+		{
+			m_LeaseSets.erase (it->second);
+			m_Index.erase (it);
+			return nullptr;
+		}
+		m_LeaseSets.splice (m_LeaseSets.begin (), m_LeaseSets, it->second); // move to front
+		return leaseSet;
+	}
+
+	void SharedLeaseSetsCache::Put (const i2p::data::IdentHash& ident, std::shared_ptr<i2p::data::LeaseSet> leaseSet)
+	{
+		std::lock_guard<std::mutex> l(m_Mutex);
+		auto it = m_Index.find (ident);
+		if (it != m_Index.end ())
+		{
+			it->second->second = leaseSet;
+			m_LeaseSets.splice (m_LeaseSets.begin (), m_LeaseSets, it->second);
+			return;
+		}
+		m_LeaseSets.push_front (std::make_pair (ident, leaseSet));
+		m_Index[ident] = m_LeaseSets.begin ();
+		while (m_LeaseSets.size () > m_MaxSize)
+		{
+			m_Index.erase (m_LeaseSets.back ().first);
+			m_LeaseSets.pop_back ();
+		}
+	}
+
+	void SharedLeaseSetsCache::Remove (const i2p::data::IdentHash& ident)
+	{
+		std::lock_guard<std::mutex> l(m_Mutex);
+		auto it = m_Index.find (ident);
+		if (it != m_Index.end ())
+		{
+			m_LeaseSets.erase (it->second);
+			m_Index.erase (it);
+		}
+	}
+
 	LeaseSetDestination::LeaseSetDestination (bool isPublic, const std::map<std::string, std::string> * params):
-		m_IsRunning (false), m_Thread (nullptr), m_IsPublic (isPublic),
-		m_PublishReplyToken (0), m_LastSubmissionTime (0), m_PublishConfirmationTimer (m_Service),
+		m_IsRunning (false), m_Thread (nullptr),
+		m_DedicatedService (IsDedicatedThreadRequested (params) ? new boost::asio::io_service () : nullptr),
+		m_Service (m_DedicatedService ? *m_DedicatedService : GetDestinationsServices ().GetNextService ()), m_TimeWheel (m_Service), m_IsPublic (isPublic), m_IsSharingLeaseSets (DEFAULT_SHARE_LEASESETS),
+		m_PublishReplyToken (0), m_LastSubmissionTime (0), m_IsMultihome (DEFAULT_MULTIHOME), m_PublishConfirmationTimer (m_Service),
 		m_PublishVerificationTimer (m_Service), m_PublishDelayTimer (m_Service), m_CleanupTimer (m_Service)
 	{
 		int inLen   = DEFAULT_INBOUND_TUNNEL_LENGTH;
 		int inQty   = DEFAULT_INBOUND_TUNNELS_QUANTITY;
 		int outLen  = DEFAULT_OUTBOUND_TUNNEL_LENGTH;
 		int outQty  = DEFAULT_OUTBOUND_TUNNELS_QUANTITY;
+		int inMaxQty = DEFAULT_TUNNELS_MAX_QUANTITY;
+		int outMaxQty = DEFAULT_TUNNELS_MAX_QUANTITY;
 		int numTags = DEFAULT_TAGS_TO_SEND;
+		bool isCritical = DEFAULT_CRITICAL;
+		bool isMeasuredPeers = DEFAULT_MEASURED_PEERS;
 		std::shared_ptr<std::vector<i2p::data::IdentHash> > explicitPeers;
 		try
 		{
@@ -40,6 +186,12 @@ namespace client
 				it = params->find (I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY);
 				if (it != params->end ())
 					outQty = std::stoi(it->second);
+				it = params->find (I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY);
+				if (it != params->end ())
+					inMaxQty = std::stoi(it->second);
+				it = params->find (I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY);
+				if (it != params->end ())
+					outMaxQty = std::stoi(it->second);
 				it = params->find (I2CP_PARAM_TAGS_TO_SEND);
 				if (it != params->end ())
 					numTags = std::stoi(it->second);
@@ -66,6 +218,26 @@ namespace client
 					if (it != params->end ()) m_Nickname = it->second;
 					// otherwise we set default nickname in Start when we know local address
 				}
+				it = params->find (I2CP_PARAM_SHARE_LEASESETS);
+				if (it != params->end ())
+				{
+					m_IsSharingLeaseSets = std::stoi (it->second);
+					if (!m_IsSharingLeaseSets)
+						LogPrint (eLogInfo, "Destination: remote LeaseSets are not shared");
+				}
+				it = params->find (I2CP_PARAM_CRITICAL);
+				if (it != params->end ())
+					isCritical = (it->second == "true" || it->second == "1");
+				it = params->find (I2CP_PARAM_MEASURED_PEERS);
+				if (it != params->end ())
+					isMeasuredPeers = (it->second == "true" || it->second == "1");
+				it = params->find (I2CP_PARAM_MULTIHOME);
+				if (it != params->end ())
+				{
+					m_IsMultihome = (it->second == "true" || it->second == "1");
+					if (m_IsMultihome)
+						LogPrint (eLogInfo, "Destination: multihome, leases of other routers are merged to LeaseSet");
+				}
 			}
 		}
 		catch (std::exception & ex)
@@ -74,8 +246,15 @@ namespace client
 		}
 		SetNumTags (numTags);
 		m_Pool = i2p::tunnel::tunnels.CreateTunnelPool (inLen, outLen, inQty, outQty);
+		if (inMaxQty > inQty || outMaxQty > outQty)
+		{
+			LogPrint (eLogInfo, "Destination: tunnels auto-scaling up to ", inMaxQty, " inbound, ", outMaxQty, " outbound");
+			m_Pool->SetMaxNumTunnels (inMaxQty, outMaxQty);
+		}
 		if (explicitPeers)
 			m_Pool->SetExplicitPeers (explicitPeers);
+		m_Pool->SetCritical (isCritical);
+		m_Pool->SetMeasuredPeers (isMeasuredPeers);
 		if(params)
 		{
 			auto itr = params->find(I2CP_PARAM_MAX_TUNNEL_LATENCY);
@@ -106,11 +285,13 @@ namespace client
 
 	void LeaseSetDestination::Run ()
 	{
+		i2p::util::InitThread ("Destination", i2p::util::eThreadGroupClients);
+		currentService = &m_Service;
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "Destination");
 			}
 			catch (std::exception& ex)
 			{
@@ -126,13 +307,15 @@ namespace client
 			if (m_Nickname.empty ())
 				m_Nickname = i2p::data::GetIdentHashAbbreviation (GetIdentHash ()); // set default nickname
 			LoadTags ();
+			m_TimeWheel.Start ();
 			m_IsRunning = true;
 			m_Pool->SetLocalDestination (shared_from_this ());
 			m_Pool->SetActive (true);
 			m_CleanupTimer.expires_from_now (boost::posix_time::minutes (DESTINATION_CLEANUP_TIMEOUT));
 			m_CleanupTimer.async_wait (std::bind (&LeaseSetDestination::HandleCleanupTimer,
 				shared_from_this (), std::placeholders::_1));
-			m_Thread = new std::thread (std::bind (&LeaseSetDestination::Run, shared_from_this ()));
+			if (m_DedicatedService)
+				m_Thread = new std::thread (std::bind (&LeaseSetDestination::Run, shared_from_this ()));
 
 			return true;
 		}
@@ -142,6 +325,8 @@ namespace client
 
 	bool LeaseSetDestination::Stop ()
 	{
+		if (!IsDedicatedThread () && !IsServiceThread ()) // stop between shared thread's handlers
+			return RunInServiceThread (std::bind (&LeaseSetDestination::Stop, this));
 		if (m_IsRunning)
 		{
 			m_CleanupTimer.cancel ();
@@ -154,13 +339,19 @@ namespace client
 				m_Pool->SetLocalDestination (nullptr);
 				i2p::tunnel::tunnels.StopTunnelPool (m_Pool);
 			}
-			m_Service.stop ();
-			if (m_Thread)
+			if (m_DedicatedService)
 			{
-				m_Thread->join ();
-				delete m_Thread;
-				m_Thread = 0;
+				m_Service.stop ();
+				if (m_Thread)
+				{
+					m_Thread->join ();
+					delete m_Thread;
+					m_Thread = 0;
+				}
 			}
+			for (auto& it: m_LeaseSetRequests)
+				it.second->CancelTimeout (); // release references to us
+			m_TimeWheel.Stop ();
 			SaveTags ();
 			CleanUp (); // GarlicDestination
 			return true;
@@ -169,6 +360,20 @@ namespace client
 			return false;
 	}
 
+	bool LeaseSetDestination::IsServiceThread () const
+	{
+		return currentService == &m_Service;
+	}
+
+	bool LeaseSetDestination::RunInServiceThread (std::function<bool ()> f)
+	{
+		// nobody would run posted handler then
+		if (IsServiceThread () || m_Service.stopped () || !GetDestinationsServices ().IsRunning ()) return f ();
+		std::promise<bool> result;
+		m_Service.post ([&result, &f]() { result.set_value (f ()); });
+		return result.get_future ().get ();
+	}
+
 	bool LeaseSetDestination::Reconfigure(std::map<std::string, std::string> params)
 	{
 		
@@ -178,12 +383,14 @@ namespace client
 			m_IsPublic = itr->second != "true";
 		}
 		
-		int inLen, outLen, inQuant, outQuant, numTags, minLatency, maxLatency;
+		int inLen, outLen, inQuant, outQuant, inMaxQuant, outMaxQuant, numTags, minLatency, maxLatency;
 		std::map<std::string, int&> intOpts = {
 			{I2CP_PARAM_INBOUND_TUNNEL_LENGTH, inLen},
 			{I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH, outLen},
 			{I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, inQuant},
 			{I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, outQuant},
+			{I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY, inMaxQuant},
+			{I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY, outMaxQuant},
 			{I2CP_PARAM_TAGS_TO_SEND, numTags},
 			{I2CP_PARAM_MIN_TUNNEL_LATENCY, minLatency},
 			{I2CP_PARAM_MAX_TUNNEL_LATENCY, maxLatency}
@@ -194,6 +401,8 @@ namespace client
 		outLen = pool->GetNumOutboundHops();
 		inQuant = pool->GetNumInboundTunnels();
 		outQuant = pool->GetNumOutboundTunnels();
+		inMaxQuant = DEFAULT_TUNNELS_MAX_QUANTITY;
+		outMaxQuant = DEFAULT_TUNNELS_MAX_QUANTITY;
 		minLatency = 0;
 		maxLatency = 0;
 		
@@ -206,7 +415,9 @@ namespace client
 			}
 		}
 		pool->RequireLatency(minLatency, maxLatency);
-		return pool->Reconfigure(inLen, outLen, inQuant, outQuant);
+		if (!pool->Reconfigure(inLen, outLen, inQuant, outQuant)) return false;
+		pool->SetMaxNumTunnels (inMaxQuant, outMaxQuant);
+		return true;
 	}
 	
 	std::shared_ptr<const i2p::data::LeaseSet> LeaseSetDestination::FindLeaseSet (const i2p::data::IdentHash& ident)
@@ -251,6 +462,23 @@ namespace client
 		}
 		else
 		{
+			auto loopbackLS = GetLoopbackLeaseSet (ident);
+			if (loopbackLS)
+			{
+				std::lock_guard<std::mutex> _lock(m_RemoteLeaseSetsMutex);
+				m_RemoteLeaseSets[ident] = loopbackLS;
+				return loopbackLS;
+			}
+			if (m_IsSharingLeaseSets)
+			{
+				auto ls = GetSharedLeaseSets ().Get (ident);
+				if (ls)
+				{
+					std::lock_guard<std::mutex> _lock(m_RemoteLeaseSetsMutex);
+					m_RemoteLeaseSets[ident] = ls;
+					return ls;
+				}
+			}
 			auto ls = i2p::data::netdb.FindLeaseSet (ident);
 			if (ls && !ls->IsExpired ())
 			{
@@ -284,6 +512,7 @@ namespace client
 			auto s = shared_from_this ();
 			m_Service.post ([s](void)
 			{
+				if (!s->IsRunning ()) return;
 				s->m_PublishVerificationTimer.cancel ();
 				s->Publish ();
 			});	
@@ -292,7 +521,7 @@ namespace client
 
 	void LeaseSetDestination::UpdateLeaseSet ()
 	{
-		int numTunnels = m_Pool->GetNumInboundTunnels () + 2; // 2 backup tunnels
+		int numTunnels = m_Pool->GetCurrentNumInboundTunnels () + 2; // 2 backup tunnels
 		if (numTunnels > i2p::data::MAX_NUM_LEASES) numTunnels = i2p::data::MAX_NUM_LEASES; // 16 tunnels maximum
 		CreateNewLeaseSet (m_Pool->GetInboundTunnels (numTunnels));
 	}
@@ -308,19 +537,51 @@ namespace client
 		auto s = shared_from_this ();
 		m_Service.post ([s,data](void)
 			{
-				s->AddSessionKey (data.k, data.t);
+				if (s->IsRunning ()) s->AddSessionKey (data.k, data.t);
 			});
 		return true;
 	}
 
 	void LeaseSetDestination::ProcessGarlicMessage (std::shared_ptr<I2NPMessage> msg)
 	{
-		m_Service.post (std::bind (&LeaseSetDestination::HandleGarlicMessage, shared_from_this (), msg));
+		auto s = shared_from_this ();
+		m_Service.post ([s, msg](void)
+			{
+				if (s->IsRunning ()) s->HandleGarlicMessage (msg);
+			});
 	}
 
 	void LeaseSetDestination::ProcessDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg)
 	{
-		m_Service.post (std::bind (&LeaseSetDestination::HandleDeliveryStatusMessage, shared_from_this (), msg));
+		uint32_t msgID = bufbe32toh (msg->GetPayload () + DELIVERY_STATUS_MSGID_OFFSET);
+		auto s = shared_from_this ();
+		m_Service.post ([s, msgID](void)
+			{
+				if (s->IsRunning ()) s->HandleDeliveryStatusMessage (msgID);
+			});
+	}
+
+	bool LeaseSetDestination::SubmitElGamalDecryption (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (!m_IsRunning) return false;
+		auto s = shared_from_this ();
+		GetElGamalDecryptionPool ().Offer ({s, [s, msg]()
+			{
+				// worker thread, must not touch destination's state
+				auto elGamal = std::make_shared<i2p::garlic::ElGamalBlock> ();
+				BN_CTX * ctx = BN_CTX_new ();
+				bool isDecrypted;
+				{
+					i2p::metrics::ScopedTimer timer (i2p::metrics::garlicElGamalDecryptionTime);
+					isDecrypted = s->Decrypt (msg->GetPayload () + 4, (uint8_t *)elGamal.get (), ctx);
+				}
+				BN_CTX_free (ctx);
+				return ElGamalDecryptionPool::ResultFunc ([s, msg, elGamal, isDecrypted]()
+					{
+						s->HandleElGamalBlock (msg, *elGamal, isDecrypted);
+					});
+			}});
+		return true;
 	}
 
 	void LeaseSetDestination::HandleI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from)
@@ -332,8 +593,8 @@ namespace client
 				HandleDataMessage (buf + I2NP_HEADER_SIZE, GetI2NPMessageLength(buf, len) - I2NP_HEADER_SIZE);
 			break;
 			case eI2NPDeliveryStatus:
-				// we assume tunnel tests non-encrypted
-				HandleDeliveryStatusMessage (CreateI2NPMessage (buf, GetI2NPMessageLength (buf, len), from));
+				// we assume tunnel tests non-encrypted, only msgID is needed
+				HandleDeliveryStatusMessage (bufbe32toh (buf + I2NP_HEADER_SIZE + DELIVERY_STATUS_MSGID_OFFSET));
 			break;
 			case eI2NPDatabaseStore:
 				HandleDatabaseStoreMessage (buf + I2NP_HEADER_SIZE, GetI2NPMessageLength(buf, len) - I2NP_HEADER_SIZE);
@@ -363,6 +624,14 @@ namespace client
 			LogPrint (eLogDebug, "Destination: Remote LeaseSet");
 			std::lock_guard<std::mutex> lock(m_RemoteLeaseSetsMutex);
 			auto it = m_RemoteLeaseSets.find (key);
+			if (it != m_RemoteLeaseSets.end () && (buf[DATABASE_STORE_TYPE_OFFSET] != i2p::data::NETDB_STORE_TYPE_LEASESET ||
+				(m_IsSharingLeaseSets && it->second->IsNewer (buf + offset, len - offset))))
+			{
+				// shared LeaseSet might be in use by other destinations, replace instead of update
+				// LeaseSet2 can't be updated in place
+				m_RemoteLeaseSets.erase (it);
+				it = m_RemoteLeaseSets.end ();
+			}
 			if (it != m_RemoteLeaseSets.end ())
 			{
 				leaseSet = it->second;
@@ -393,6 +662,9 @@ namespace client
 					{
 						LogPrint (eLogDebug, "Destination: New remote LeaseSet added");
 						m_RemoteLeaseSets[key] = leaseSet;
+						// only replies to our own lookups, unsolicited store would link destinations
+						if (m_IsSharingLeaseSets && m_LeaseSetRequests.count (key))
+							GetSharedLeaseSets ().Put (key, leaseSet);
 					}
 					else
 						LogPrint (eLogDebug, "Destination: Own remote LeaseSet dropped");
@@ -410,7 +682,15 @@ namespace client
 		auto it1 = m_LeaseSetRequests.find (key);
 		if (it1 != m_LeaseSetRequests.end ())
 		{
-			it1->second->requestTimeoutTimer.cancel ();
+			it1->second->CancelTimeout ();
+			if (leaseSet)
+			{
+				auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+				i2p::metrics::leaseSetRequestTime.Observe (ts - it1->second->startTime);
+				auto& pending = it1->second->pending;
+				if (pending.size () == 1) // otherwise we don't know who replied
+					i2p::data::GetRouterProfile (pending.begin ()->first)->LookupReplied (ts - pending.begin ()->second);
+			}
 			if (it1->second) it1->second->Complete (leaseSet);
 			m_LeaseSetRequests.erase (it1);
 		}
@@ -425,6 +705,15 @@ namespace client
 		if (it != m_LeaseSetRequests.end ())
 		{
 			auto request = it->second;
+			if (len >= 65 + (size_t)num*32)
+			{
+				auto it1 = request->pending.find (i2p::data::IdentHash (buf + 33 + num*32)); // from
+				if (it1 != request->pending.end ())
+				{
+					i2p::data::GetRouterProfile (it1->first)->LookupReplied (i2p::util::GetMillisecondsSinceEpoch () - it1->second);
+					request->pending.erase (it1);
+				}
+			}
 			bool found = false;
 			if (request->excluded.size () < MAX_NUM_FLOODFILLS_PER_REQUEST)
 			{
@@ -446,20 +735,18 @@ namespace client
 						found = true;
 				}
 			}
-			if (!found)
+			if (!found && request->pending.empty ()) // other floodfills might still reply
 			{
-				LogPrint (eLogInfo, "Destination: ", key.ToBase64 (), " was not found on ", MAX_NUM_FLOODFILLS_PER_REQUEST, " floodfills");
-				request->Complete (nullptr);
-				m_LeaseSetRequests.erase (key);
+				LogPrint (eLogInfo, "Destination: ", key.ToBase64 (), " was not found on ", request->excluded.size (), " floodfills");
+				CompleteNotFound (key);
 			}
 		}
 		else
 			LogPrint (eLogWarning, "Destination: Request for ", key.ToBase64 (), " not found");
 	}
 
-	void LeaseSetDestination::HandleDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg)
+	void LeaseSetDestination::HandleDeliveryStatusMessage (uint32_t msgID)
 	{
-		uint32_t msgID = bufbe32toh (msg->GetPayload () + DELIVERY_STATUS_MSGID_OFFSET);
 		if (msgID == m_PublishReplyToken)
 		{
 			LogPrint (eLogDebug, "Destination: Publishing LeaseSet confirmed for ", GetIdentHash().ToBase32());
@@ -471,7 +758,7 @@ namespace client
 			shared_from_this (), std::placeholders::_1));
 		}
 		else
-			i2p::garlic::GarlicDestination::HandleDeliveryStatusMessage (msg);
+			i2p::garlic::GarlicDestination::HandleDeliveryStatusMessage (msgID);
 	}
 
 	void LeaseSetDestination::SetLeaseSetUpdated ()
@@ -522,7 +809,7 @@ namespace client
 		}
 		m_ExcludedFloodfills.insert (floodfill->GetIdentHash ());
 		LogPrint (eLogDebug, "Destination: Publish LeaseSet of ", GetIdentHash ().ToBase32 ());
-		RAND_bytes ((uint8_t *)&m_PublishReplyToken, 4);
+		m_PublishReplyToken = i2p::crypto::RandUint32 ();
 		auto msg = WrapMessage (floodfill, i2p::CreateDatabaseStoreMsg (m_LeaseSet, m_PublishReplyToken, inbound));
 		m_PublishConfirmationTimer.expires_from_now (boost::posix_time::seconds(PUBLISH_CONFIRMATION_TIMEOUT));
 		m_PublishConfirmationTimer.async_wait (std::bind (&LeaseSetDestination::HandlePublishConfirmationTimer,
@@ -576,6 +863,22 @@ namespace client
 							s->m_PublishVerificationTimer.async_wait (std::bind (&LeaseSetDestination::HandlePublishVerificationTimer, s, std::placeholders::_1));
 							return;
 						}
+						else if (s->m_IsMultihome)
+						{
+							// published by other router of this destination
+							if (s->UpdateOtherLeases (leaseSet))
+							{
+								LogPrint (eLogDebug, "Destination: merging leases of other routers for ", GetIdentHash().ToBase32());
+								s->UpdateLeaseSet (); // publishes merged LeaseSet
+							}
+							else
+							{
+								LogPrint (eLogDebug, "Destination: LeaseSet merged by other router verified for ", GetIdentHash().ToBase32());
+								s->m_PublishVerificationTimer.expires_from_now (boost::posix_time::seconds(PUBLISH_REGULAR_VERIFICATION_INTERNAL));
+								s->m_PublishVerificationTimer.async_wait (std::bind (&LeaseSetDestination::HandlePublishVerificationTimer, s, std::placeholders::_1));
+							}
+							return;
+						}
 						else
 							LogPrint (eLogDebug, "Destination: LeaseSet is different than just published for ", GetIdentHash().ToBase32());
 					}
@@ -593,6 +896,58 @@ namespace client
 			Publish ();
 	}
 
+	bool LeaseSetDestination::UpdateOtherLeases (std::shared_ptr<const i2p::data::LeaseSet> leaseSet)
+	{
+		std::set<std::shared_ptr<const i2p::data::Lease>, i2p::data::LeaseCmp> leases, otherLeases;
+		std::lock_guard<std::mutex> l(m_OtherLeasesMutex);
+		for (const auto& it: leaseSet->GetNonExpiredLeases (false))
+		{
+			leases.insert (it);
+			if (!m_OwnLeases.count (it)) otherLeases.insert (it);
+		}
+		bool isOwnMissing = false; // other router doesn't know our current tunnels yet
+		for (const auto& it: m_CurrentOwnLeases)
+			if (!leases.count (it))
+			{
+				isOwnMissing = true;
+				break;
+			}
+		bool isChanged = otherLeases.size () != m_OtherLeases.size () ||
+			!std::equal (otherLeases.begin (), otherLeases.end (), m_OtherLeases.begin (),
+				[](std::shared_ptr<const i2p::data::Lease> l1, std::shared_ptr<const i2p::data::Lease> l2)
+				{ return l1->tunnelID == l2->tunnelID && l1->tunnelGateway == l2->tunnelGateway; });
+		m_OtherLeases = otherLeases;
+		return isChanged || isOwnMissing;
+	}
+
+	std::vector<std::shared_ptr<const i2p::data::Lease> > LeaseSetDestination::GetOtherLeases (const std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> >& tunnels)
+	{
+		std::vector<std::shared_ptr<const i2p::data::Lease> > otherLeases;
+		if (!m_IsMultihome) return otherLeases;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		std::lock_guard<std::mutex> l(m_OtherLeasesMutex);
+		// remember own leases until they expire, other routers might publish them meanwhile
+		m_CurrentOwnLeases.clear ();
+		for (const auto& it: tunnels)
+		{
+			auto lease = std::make_shared<i2p::data::Lease> ();
+			lease->tunnelGateway = it->GetNextIdentHash ();
+			lease->tunnelID = it->GetNextTunnelID ();
+			lease->endDate = (it->GetCreationTime () + i2p::tunnel::TUNNEL_EXPIRATION_TIMEOUT)*1000LL;
+			m_CurrentOwnLeases.insert (lease);
+			m_OwnLeases.insert (lease);
+		}
+		for (auto it = m_OwnLeases.begin (); it != m_OwnLeases.end ();)
+			if (ts > (*it)->endDate)
+				it = m_OwnLeases.erase (it);
+			else
+				++it;
+		for (const auto& it: m_OtherLeases)
+			if (ts + i2p::data::LEASE_ENDDATE_THRESHOLD < it->endDate && !m_OwnLeases.count (it))
+				otherLeases.push_back (it);
+		return otherLeases;
+	}
+
 	bool LeaseSetDestination::RequestDestination (const i2p::data::IdentHash& dest, RequestComplete requestComplete)
 	{
 		if (!m_Pool || !IsReady ())
@@ -601,7 +956,14 @@ namespace client
 				m_Service.post ([requestComplete](void){requestComplete (nullptr);});
 			return false;
 		}
-		m_Service.post (std::bind (&LeaseSetDestination::RequestLeaseSet, shared_from_this (), dest, requestComplete));
+		auto s = shared_from_this ();
+		m_Service.post ([s, dest, requestComplete](void)
+			{
+				if (s->IsRunning ())
+					s->RequestLeaseSet (dest, requestComplete);
+				else if (requestComplete)
+					requestComplete (nullptr);
+			});
 		return true;
 	}
 
@@ -622,11 +984,37 @@ namespace client
 
 	void LeaseSetDestination::RequestLeaseSet (const i2p::data::IdentHash& dest, RequestComplete requestComplete)
 	{
+		auto it = m_NotFoundLeaseSets.find (dest);
+		if (it != m_NotFoundLeaseSets.end ())
+		{
+			if (i2p::util::GetSecondsSinceEpoch () < it->second)
+			{
+				LogPrint (eLogDebug, "Destination: LeaseSet ", dest.ToBase32 (), " was not found recently");
+				if (requestComplete) requestComplete (nullptr);
+				return;
+			}
+			m_NotFoundLeaseSets.erase (it);
+		}
+		if (m_IsSharingLeaseSets)
+		{
+			// other destination might have requested it already
+			auto ls = GetSharedLeaseSets ().Get (dest);
+			if (ls && !ls->ExpiresSoon ())
+			{
+				LogPrint (eLogDebug, "Destination: LeaseSet ", dest.ToBase32 (), " found in shared cache");
+				{
+					std::lock_guard<std::mutex> lock(m_RemoteLeaseSetsMutex);
+					m_RemoteLeaseSets[dest] = ls;
+				}
+				if (requestComplete) requestComplete (ls);
+				return;
+			}
+		}
 		std::set<i2p::data::IdentHash> excluded;
 		auto floodfill = i2p::data::netdb.GetClosestFloodfill (dest, excluded);
 		if (floodfill)
 		{
-			auto request = std::make_shared<LeaseSetRequest> (m_Service);
+			auto request = std::make_shared<LeaseSetRequest> (m_TimeWheel);
 			if (requestComplete)
 				request->requestComplete.push_back (requestComplete);
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
@@ -634,24 +1022,34 @@ namespace client
 			if (ret.second) // inserted
 			{
 				request->requestTime = ts;
+				request->startTime = i2p::util::GetMillisecondsSinceEpoch ();
 				if (!SendLeaseSetRequest (dest, floodfill, request))
 				{
 					// request failed
 					m_LeaseSetRequests.erase (ret.first);
 					if (requestComplete) requestComplete (nullptr);
+					return;
+				}
+				// ask more floodfills in parallel, first reply completes the request
+				for (int i = 1; i < LEASESET_REQUEST_PARALLELISM; i++)
+				{
+					floodfill = i2p::data::netdb.GetClosestFloodfill (dest, request->excluded);
+					if (!floodfill || !SendLeaseSetRequest (dest, floodfill, request)) break;
 				}
 			}
-			else // duplicate
+			else // duplicate, completed together with pending one
 			{
 				LogPrint (eLogInfo, "Destination: Request of LeaseSet ", dest.ToBase64 (), " is pending already");
-				if (ts > ret.first->second->requestTime + MAX_LEASESET_REQUEST_TIMEOUT)
+				auto pending = ret.first->second;
+				if (ts > pending->requestTime + MAX_LEASESET_REQUEST_TIMEOUT)
 				{
 					// something went wrong
 					m_LeaseSetRequests.erase (ret.first);
+					pending->Complete (nullptr);
 					if (requestComplete) requestComplete (nullptr);
 				}
 				else if (requestComplete)
-					ret.first->second->requestComplete.push_back (requestComplete);
+					pending->requestComplete.push_back (requestComplete);
 			}
 		}
 		else
@@ -674,7 +1072,8 @@ namespace client
 		if (request->replyTunnel && request->outboundTunnel)
 		{
 			request->excluded.insert (nextFloodfill->GetIdentHash ());
-			request->requestTimeoutTimer.cancel ();
+			request->pending[nextFloodfill->GetIdentHash ()] = i2p::util::GetMillisecondsSinceEpoch ();
+			request->CancelTimeout ();
 
 			uint8_t replyKey[32], replyTag[32];
 			RAND_bytes (replyKey, 32); // random session key
@@ -692,50 +1091,58 @@ namespace client
 						nextFloodfill->GetIdentHash (), 0, msg
 					}
 				});
-			request->requestTimeoutTimer.expires_from_now (boost::posix_time::seconds(LEASESET_REQUEST_TIMEOUT));
-			request->requestTimeoutTimer.async_wait (std::bind (&LeaseSetDestination::HandleRequestTimoutTimer,
-				shared_from_this (), std::placeholders::_1, dest));
+			request->requestTimeoutTimer = m_TimeWheel.Schedule (LEASESET_REQUEST_TIMEOUT*1000,
+				std::bind (&LeaseSetDestination::HandleRequestTimoutTimer, shared_from_this (), dest));
 		}
 		else
 			return false;
 		return true;
 	}
 
-	void LeaseSetDestination::HandleRequestTimoutTimer (const boost::system::error_code& ecode, const i2p::data::IdentHash& dest)
+	void LeaseSetDestination::HandleRequestTimoutTimer (const i2p::data::IdentHash& dest)
 	{
-		if (ecode != boost::asio::error::operation_aborted)
+		auto it = m_LeaseSetRequests.find (dest);
+		if (it != m_LeaseSetRequests.end ())
 		{
-			auto it = m_LeaseSetRequests.find (dest);
-			if (it != m_LeaseSetRequests.end ())
+			it->second->requestTimeoutTimer = 0; // expired
+			bool done = false;
+			uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+			if (ts < it->second->requestTime + MAX_LEASESET_REQUEST_TIMEOUT)
 			{
-				bool done = false;
-				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
-				if (ts < it->second->requestTime + MAX_LEASESET_REQUEST_TIMEOUT)
+				auto floodfill = i2p::data::netdb.GetClosestFloodfill (dest, it->second->excluded);
+				if (floodfill)
 				{
-					auto floodfill = i2p::data::netdb.GetClosestFloodfill (dest, it->second->excluded);
-					if (floodfill)
-					{
-						// reset tunnels, because one them might fail
-						it->second->outboundTunnel = nullptr;
-						it->second->replyTunnel = nullptr;
-						done = !SendLeaseSetRequest (dest, floodfill, it->second);
-					}
-					else
-						done = true;
+					// reset tunnels, because one them might fail
+					it->second->outboundTunnel = nullptr;
+					it->second->replyTunnel = nullptr;
+					for (auto& it1: it->second->pending) // don't wait for lost replies
+						i2p::data::GetRouterProfile (it1.first)->LookupNonReplied ();
+					it->second->pending.clear ();
+					done = !SendLeaseSetRequest (dest, floodfill, it->second);
 				}
 				else
-				{
-					LogPrint (eLogWarning, "Destination: ", dest.ToBase64 (), " was not found within ",  MAX_LEASESET_REQUEST_TIMEOUT, " seconds");
 					done = true;
-				}
-
-				if (done)
-				{
-					auto requestComplete = it->second;
-					m_LeaseSetRequests.erase (it);
-					if (requestComplete) requestComplete->Complete (nullptr);
-				}
 			}
+			else
+			{
+				LogPrint (eLogWarning, "Destination: ", dest.ToBase64 (), " was not found within ",  MAX_LEASESET_REQUEST_TIMEOUT, " seconds");
+				done = true;
+			}
+
+			if (done)
+				CompleteNotFound (dest);
+		}
+	}
+
+	void LeaseSetDestination::CompleteNotFound (const i2p::data::IdentHash& dest)
+	{
+		m_NotFoundLeaseSets[dest] = i2p::util::GetSecondsSinceEpoch () + LEASESET_NOT_FOUND_CACHE_TIMEOUT;
+		auto it = m_LeaseSetRequests.find (dest);
+		if (it != m_LeaseSetRequests.end ())
+		{
+			auto request = it->second;
+			m_LeaseSetRequests.erase (it);
+			if (request) request->Complete (nullptr);
 		}
 	}
 
@@ -754,6 +1161,14 @@ namespace client
 
 	void LeaseSetDestination::CleanupRemoteLeaseSets ()
 	{
+		auto seconds = i2p::util::GetSecondsSinceEpoch ();
+		for (auto it = m_NotFoundLeaseSets.begin (); it != m_NotFoundLeaseSets.end ();)
+		{
+			if (seconds >= it->second)
+				it = m_NotFoundLeaseSets.erase (it);
+			else
+				++it;
+		}
 		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
 		std::lock_guard<std::mutex> lock(m_RemoteLeaseSetsMutex);
 		for (auto it = m_RemoteLeaseSets.begin (); it != m_RemoteLeaseSets.end ();)
@@ -770,6 +1185,10 @@ namespace client
 
 	ClientDestination::ClientDestination (const i2p::data::PrivateKeys& keys, bool isPublic, const std::map<std::string, std::string> * params):
 		LeaseSetDestination (isPublic, params), m_Keys (keys), m_StreamingAckDelay (DEFAULT_INITIAL_ACK_DELAY),
+		m_StreamingCongestionControl (i2p::stream::eStreamingCongestionControlReno),
+		m_IsStreamingCoalescing (DEFAULT_STREAMING_COALESCE_PACKETS),
+		m_StreamingCompression (i2p::stream::eStreamingCompressionAuto),
+		m_StreamingNumPaths (DEFAULT_STREAMING_MULTIPATH), m_IsLoopback (DEFAULT_LOOPBACK),
 		m_DatagramDestination (nullptr), m_RefCounter (0),
 		m_ReadyChecker(GetService())
 	{
@@ -788,6 +1207,37 @@ namespace client
 			auto it = params->find (I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY);
 			if (it != params->end ())
 				m_StreamingAckDelay = std::stoi(it->second);
+			it = params->find (I2CP_PARAM_STREAMING_CONGESTION_CONTROL);
+			if (it != params->end ())
+			{
+				if (it->second == "cubic")
+					m_StreamingCongestionControl = i2p::stream::eStreamingCongestionControlCubic;
+				else if (it->second != "reno")
+					LogPrint (eLogWarning, "Destination: Unknown streaming congestion control ", it->second, ", reno is used");
+			}
+			it = params->find (I2CP_PARAM_STREAMING_COALESCE_PACKETS);
+			if (it != params->end ())
+				m_IsStreamingCoalescing = (it->second == "true" || it->second == "1");
+			it = params->find (I2CP_PARAM_STREAMING_COMPRESSION);
+			if (it != params->end ())
+			{
+				if (it->second == "off")
+					m_StreamingCompression = i2p::stream::eStreamingCompressionOff;
+				else if (it->second == "on")
+					m_StreamingCompression = i2p::stream::eStreamingCompressionOn;
+				else if (it->second != "auto")
+					LogPrint (eLogWarning, "Destination: Unknown streaming compression ", it->second, ", auto is used");
+			}
+			it = params->find (I2CP_PARAM_STREAMING_MULTIPATH);
+			if (it != params->end ())
+			{
+				m_StreamingNumPaths = std::stoi(it->second);
+				if (m_StreamingNumPaths < 1) m_StreamingNumPaths = 1;
+				if (m_StreamingNumPaths > i2p::stream::MAX_STREAMING_PATHS) m_StreamingNumPaths = i2p::stream::MAX_STREAMING_PATHS;
+			}
+			it = params->find (I2CP_PARAM_LOOPBACK);
+			if (it != params->end ())
+				m_IsLoopback = (it->second == "true" || it->second == "1");
 		}
 	}
 
@@ -801,8 +1251,16 @@ namespace client
 		{
 			m_StreamingDestination = std::make_shared<i2p::stream::StreamingDestination> (GetSharedFromThis ()); // TODO:
 			m_StreamingDestination->Start ();
-			for (auto& it: m_StreamingDestinationsByPorts)
-				it.second->Start ();
+			{
+				std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
+				for (auto& it: m_StreamingDestinationsByPorts)
+					it.second->Start ();
+			}
+			{
+				auto& local = GetLocalDestinations ();
+				std::lock_guard<std::mutex> l(local.mutex);
+				local.destinations[GetIdentHash ()] = GetSharedFromThis ();
+			}
 			return true;
 		}
 		else
@@ -811,18 +1269,30 @@ namespace client
 
 	bool ClientDestination::Stop ()
 	{
+		if (!IsDedicatedThread () && !IsServiceThread ()) // stop between shared thread's handlers
+			return RunInServiceThread (std::bind (&ClientDestination::Stop, this));
 		if (LeaseSetDestination::Stop ())
 		{
+			{
+				auto& local = GetLocalDestinations ();
+				std::lock_guard<std::mutex> l(local.mutex);
+				auto it = local.destinations.find (GetIdentHash ());
+				if (it != local.destinations.end () && it->second.lock ().get () == this)
+					local.destinations.erase (it);
+			}
 			m_ReadyChecker.cancel();
 			m_StreamingDestination->Stop ();
 			//m_StreamingDestination->SetOwner (nullptr);
 			m_StreamingDestination = nullptr;
-			for (auto& it: m_StreamingDestinationsByPorts)
 			{
-				it.second->Stop ();
-				//it.second->SetOwner (nullptr);
+				std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
+				for (auto& it: m_StreamingDestinationsByPorts)
+				{
+					it.second->Stop ();
+					//it.second->SetOwner (nullptr);
+				}
+				m_StreamingDestinationsByPorts.clear ();
 			}
-			m_StreamingDestinationsByPorts.clear ();
 			if (m_DatagramDestination)
 			{
 				delete m_DatagramDestination;
@@ -891,11 +1361,58 @@ namespace client
 				else
 					LogPrint (eLogError, "Destination: Missing datagram destination");
 			break;
+			case PROTOCOL_TYPE_RAW:
+				if (m_DatagramDestination)
+					m_DatagramDestination->HandleDataMessagePayload (fromPort, toPort, buf, length, true);
+				else
+					LogPrint (eLogError, "Destination: Missing datagram destination");
+			break;
 			default:
 				LogPrint (eLogError, "Destination: Data: unexpected protocol ", buf[9]);
 		}
 	}
 
+	std::shared_ptr<ClientDestination> ClientDestination::GetLoopbackDestination (const i2p::data::IdentHash& ident) const
+	{
+		if (!m_IsLoopback) return nullptr;
+		auto& local = GetLocalDestinations ();
+		std::lock_guard<std::mutex> l(local.mutex);
+		auto it = local.destinations.find (ident);
+		if (it != local.destinations.end ())
+		{
+			auto dest = it->second.lock ();
+			if (dest && dest->IsRunning ()) return dest;
+		}
+		return nullptr;
+	}
+
+	std::shared_ptr<i2p::data::LeaseSet> ClientDestination::GetLoopbackLeaseSet (const i2p::data::IdentHash& ident)
+	{
+		auto dest = GetLoopbackDestination (ident);
+		if (!dest || !dest->IsReady ()) return nullptr; // its LeaseSet is created already
+		auto ls = dest->GetLeaseSet ();
+		if (!ls) return nullptr;
+		std::shared_ptr<i2p::data::LeaseSet> leaseSet;
+		auto storeType = ls->GetStoreType ();
+		if (storeType == i2p::data::NETDB_STORE_TYPE_LEASESET)
+			leaseSet = std::make_shared<i2p::data::LeaseSet> (ls->GetBuffer (), ls->GetBufferLen ());
+		else if (storeType == i2p::data::NETDB_STORE_TYPE_STANDARD_LEASESET2)
+			leaseSet = std::make_shared<i2p::data::LeaseSet2> (storeType, ls->GetBuffer (), ls->GetBufferLen ());
+		if (!leaseSet || !leaseSet->IsValid ()) return nullptr;
+		LogPrint (eLogDebug, "Destination: Loopback LeaseSet of ", ident.ToBase32 ());
+		return leaseSet;
+	}
+
+	void ClientDestination::SendLoopbackMessage (std::shared_ptr<I2NPMessage> msg)
+	{
+		auto s = GetSharedFromThis ();
+		GetService ().post ([s, msg]()
+			{
+				if (s->IsRunning ())
+					s->HandleDataMessage (msg->GetPayload (), msg->GetPayloadLength ());
+			});
+	}
+
 	void ClientDestination::CreateStream (StreamRequestComplete streamRequestComplete, const i2p::data::IdentHash& dest, int port)
 	{
 		if (!streamRequestComplete)
@@ -932,6 +1449,7 @@ namespace client
 	{
 		if (port)
 		{
+			std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
 			auto it = m_StreamingDestinationsByPorts.find (port);
 			if (it != m_StreamingDestinationsByPorts.end ())
 				return it->second;
@@ -940,6 +1458,21 @@ namespace client
 		return m_StreamingDestination;
 	}
 
+	void ClientDestination::DeleteStreamingDestination (int port)
+	{
+		if (!port) return;
+		std::shared_ptr<i2p::stream::StreamingDestination> dest;
+		{
+			std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
+			auto it = m_StreamingDestinationsByPorts.find (port);
+			if (it == m_StreamingDestinationsByPorts.end ()) return;
+			dest = it->second;
+			m_StreamingDestinationsByPorts.erase (it);
+		}
+		// streams are handled in destination's thread
+		GetService ().post ([dest]() { dest->Stop (); });
+	}
+
 	void ClientDestination::AcceptStreams (const i2p::stream::StreamingDestination::Acceptor& acceptor)
 	{
 		if (m_StreamingDestination)
@@ -969,7 +1502,10 @@ namespace client
 	{
 		auto dest = std::make_shared<i2p::stream::StreamingDestination> (GetSharedFromThis (), port, gzip);
 		if (port)
+		{
+			std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
 			m_StreamingDestinationsByPorts[port] = dest;
+		}
 		else // update default
 			m_StreamingDestination = dest;
 		return dest;
@@ -986,13 +1522,13 @@ namespace client
 	{
 		std::vector<std::shared_ptr<const i2p::stream::Stream> > ret;
 		if (m_StreamingDestination)
+			ret = m_StreamingDestination->GetStreams ();
+		std::lock_guard<std::mutex> l(m_StreamingDestinationsMutex);
+		for (auto& it: m_StreamingDestinationsByPorts)
 		{
-			for (auto& it: m_StreamingDestination->GetStreams ())
-				ret.push_back (it.second);
+			auto streams = it.second->GetStreams ();
+			ret.insert (ret.end (), streams.begin (), streams.end ());
 		}
-		for (auto& it: m_StreamingDestinationsByPorts)
-			for (auto& it1: it.second->GetStreams ())
-				ret.push_back (it1.second);
 		return ret;
 	}
 
@@ -1023,7 +1559,7 @@ namespace client
 
 	void ClientDestination::CreateNewLeaseSet (std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels)
 	{
-		auto leaseSet = new i2p::data::LocalLeaseSet (GetIdentity (), m_EncryptionPublicKey, tunnels);
+		auto leaseSet = new i2p::data::LocalLeaseSet (GetIdentity (), m_EncryptionPublicKey, tunnels, GetOtherLeases (tunnels));
 		// sign
 		Sign (leaseSet->GetBuffer (), leaseSet->GetBufferLen () - leaseSet->GetSignatureLen (), leaseSet->GetSignature ()); // TODO
 		SetLeaseSet (leaseSet);
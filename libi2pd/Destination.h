@@ -6,8 +6,11 @@
 #include <memory>
 #include <map>
 #include <set>
+#include <list>
+#include <vector>
 #include <string>
 #include <functional>
+#include <atomic>
 #ifdef I2LUA
 #include <future>
 #endif
@@ -20,6 +23,7 @@
 #include "NetDb.hpp"
 #include "Streaming.h"
 #include "Datagram.h"
+#include "TimeWheel.h"
 
 namespace i2p
 {
@@ -36,6 +40,10 @@ namespace client
 	const int MAX_LEASESET_REQUEST_TIMEOUT = 40; // in seconds
 	const int DESTINATION_CLEANUP_TIMEOUT = 3; // in minutes
 	const unsigned int MAX_NUM_FLOODFILLS_PER_REQUEST = 7;
+	const int LEASESET_REQUEST_PARALLELISM = 3; // floodfills asked at once
+	const int LEASESET_NOT_FOUND_CACHE_TIMEOUT = 10; // in seconds, requests fail immediately meanwhile
+	const int DESTINATION_NUM_ELGAMAL_DECRYPTION_WORKERS = 2; // shared by all destinations
+	const size_t SHARED_LEASESETS_CACHE_SIZE = 512; // remote LeaseSets shared by all destinations
 
 	// I2CP
 	const char I2CP_PARAM_INBOUND_TUNNEL_LENGTH[] = "inbound.length";
@@ -46,12 +54,27 @@ namespace client
 	const int DEFAULT_INBOUND_TUNNELS_QUANTITY = 5;
 	const char I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY[] = "outbound.quantity";
 	const int DEFAULT_OUTBOUND_TUNNELS_QUANTITY = 5;
+	const char I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY[] = "inbound.quantityMax";
+	const char I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY[] = "outbound.quantityMax";
+	const int DEFAULT_TUNNELS_MAX_QUANTITY = 0; // no auto-scaling
 	const char I2CP_PARAM_EXPLICIT_PEERS[] = "explicitPeers";
 	const int STREAM_REQUEST_TIMEOUT = 60; //in seconds
 	const char I2CP_PARAM_TAGS_TO_SEND[] = "crypto.tagsToSend";
 	const int DEFAULT_TAGS_TO_SEND = 40;
 	const char I2CP_PARAM_INBOUND_NICKNAME[] = "inbound.nickname";
 	const char I2CP_PARAM_OUTBOUND_NICKNAME[] = "outbound.nickname";
+	const char I2CP_PARAM_SHARE_LEASESETS[] = "i2cp.shareLeaseSets";
+	const int DEFAULT_SHARE_LEASESETS = 0; // use and fill router-wide cache of remote LeaseSets, links destinations of the router
+	const char I2CP_PARAM_DEDICATED_THREAD[] = "i2cp.dedicatedThread";
+	const int DEFAULT_DEDICATED_THREAD = 0; // run on one of shared destinations' threads
+	const char I2CP_PARAM_LOOPBACK[] = "i2cp.loopback";
+	const int DEFAULT_LOOPBACK = 0; // deliver to destinations of this router in-process instead of through tunnels
+	const char I2CP_PARAM_CRITICAL[] = "i2cp.critical";
+	const int DEFAULT_CRITICAL = 0; // critical pools get all their tunnels first, others ramp up gradually
+	const char I2CP_PARAM_MEASURED_PEERS[] = "i2cp.measuredPeers";
+	const int DEFAULT_MEASURED_PEERS = 0; // prefer hops with higher bandwidth and lower RTT measured by transports
+	const char I2CP_PARAM_MULTIHOME[] = "i2cp.multihome";
+	const int DEFAULT_MULTIHOME = 0; // same keys on several routers, each publishes LeaseSet with leases of all of them
 
 	// latency
 	const char I2CP_PARAM_MIN_TUNNEL_LATENCY[] = "latency.min";
@@ -62,9 +85,61 @@ namespace client
 	// streaming
 	const char I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY[] = "i2p.streaming.initialAckDelay";
 	const int DEFAULT_INITIAL_ACK_DELAY = 200; // milliseconds
+	const char I2CP_PARAM_STREAMING_CONGESTION_CONTROL[] = "i2p.streaming.congestionControl";
+	const char DEFAULT_STREAMING_CONGESTION_CONTROL[] = "reno"; // reno or cubic
+	const char I2CP_PARAM_STREAMING_COALESCE_PACKETS[] = "i2p.streaming.coalescePackets";
+	const int DEFAULT_STREAMING_COALESCE_PACKETS = 1; // several packets in one garlic message
+	const char I2CP_PARAM_STREAMING_COMPRESSION[] = "i2p.streaming.compression";
+	const char DEFAULT_STREAMING_COMPRESSION[] = "auto"; // off, auto or on
+	const char I2CP_PARAM_STREAMING_MULTIPATH[] = "i2p.streaming.multipath";
+	const int DEFAULT_STREAMING_MULTIPATH = 1; // number of outbound tunnel and remote lease pairs packets are striped across
 
 	typedef std::function<void (std::shared_ptr<i2p::stream::Stream> stream)> StreamRequestComplete;
 
+	class SharedLeaseSetsCache // verified remote LeaseSets, least recently used are dropped
+	{
+		public:
+
+			SharedLeaseSetsCache (size_t maxSize): m_MaxSize (maxSize) {};
+
+			std::shared_ptr<i2p::data::LeaseSet> Get (const i2p::data::IdentHash& ident); // nullptr if not found or expired
+			void Put (const i2p::data::IdentHash& ident, std::shared_ptr<i2p::data::LeaseSet> leaseSet);
+			void Remove (const i2p::data::IdentHash& ident);
+			size_t GetSize () const { return m_LeaseSets.size (); };
+
+		private:
+
+			size_t m_MaxSize;
+			std::mutex m_Mutex;
+			std::list<std::pair<i2p::data::IdentHash, std::shared_ptr<i2p::data::LeaseSet> > > m_LeaseSets; // most recently used first
+			std::map<i2p::data::IdentHash, decltype(m_LeaseSets)::iterator> m_Index;
+	};
+
+	/** @brief single threaded services shared by destinations,
+	 *  a destination sticks to one service, so its handlers stay serialized */
+	class DestinationsServices
+	{
+		public:
+
+			DestinationsServices (int numThreads);
+			~DestinationsServices ();
+
+			boost::asio::io_service& GetNextService (); // round robin
+			bool IsRunning () const { return m_IsRunning; };
+
+		private:
+
+			void Run (boost::asio::io_service& service);
+
+		private:
+
+			volatile bool m_IsRunning;
+			std::vector<std::unique_ptr<boost::asio::io_service> > m_Services;
+			std::vector<std::unique_ptr<boost::asio::io_service::work> > m_Works;
+			std::vector<std::unique_ptr<std::thread> > m_Threads;
+			std::atomic<size_t> m_NextService;
+	};
+
 	class LeaseSetDestination: public i2p::garlic::GarlicDestination,
 		public std::enable_shared_from_this<LeaseSetDestination>
 	{
@@ -72,14 +147,27 @@ namespace client
 		// leaseSet = nullptr means not found
 		struct LeaseSetRequest
 		{
-			LeaseSetRequest (boost::asio::io_service& service): requestTime (0), requestTimeoutTimer (service) {};
+			LeaseSetRequest (i2p::util::TimeWheel& wheel): requestTime (0), startTime (0), timeWheel (wheel), requestTimeoutTimer (0) {};
+			~LeaseSetRequest () { CancelTimeout (); };
 			std::set<i2p::data::IdentHash> excluded;
 			uint64_t requestTime;
-			boost::asio::deadline_timer requestTimeoutTimer;
+			uint64_t startTime; // in milliseconds
+			std::map<i2p::data::IdentHash, uint64_t> pending; // floodfills not replied yet -> time sent in milliseconds
+			i2p::util::TimeWheel& timeWheel;
+			i2p::util::TimeWheel::TimerID requestTimeoutTimer;
 			std::list<RequestComplete> requestComplete;
 			std::shared_ptr<i2p::tunnel::OutboundTunnel> outboundTunnel;
 			std::shared_ptr<i2p::tunnel::InboundTunnel> replyTunnel;
 
+			void CancelTimeout ()
+			{
+				if (requestTimeoutTimer)
+				{
+					timeWheel.Cancel (requestTimeoutTimer);
+					requestTimeoutTimer = 0;
+				}
+			}
+
 			void Complete (std::shared_ptr<i2p::data::LeaseSet> ls)
 			{
 				for (auto& it: requestComplete) it (ls);
@@ -102,6 +190,7 @@ namespace client
 		
 			bool IsRunning () const { return m_IsRunning; };
 			boost::asio::io_service& GetService () { return m_Service; };
+			bool IsDedicatedThread () const { return (bool)m_DedicatedService; };
 			std::shared_ptr<i2p::tunnel::TunnelPool> GetTunnelPool () { return m_Pool; };
 			bool IsReady () const { return m_LeaseSet && !m_LeaseSet->IsExpired () && m_Pool->GetOutboundTunnels ().size () > 0; };
 			std::shared_ptr<const i2p::data::LeaseSet> FindLeaseSet (const i2p::data::IdentHash& ident);
@@ -121,11 +210,18 @@ namespace client
 
 		protected:
 
+			// override GarlicDestination
+			bool SubmitElGamalDecryption (std::shared_ptr<I2NPMessage> msg);
+
 			void SetLeaseSet (i2p::data::LocalLeaseSet * newLeaseSet);
+			bool IsServiceThread () const; // called from thread running m_Service
+			bool RunInServiceThread (std::function<bool ()> f); // posts to m_Service and waits for result
 			virtual void CleanupDestination () {}; // additional clean up in derived classes
+			virtual std::shared_ptr<i2p::data::LeaseSet> GetLoopbackLeaseSet (const i2p::data::IdentHash& ident) { return nullptr; };
 			// I2CP
 			virtual void HandleDataMessage (const uint8_t * buf, size_t len) = 0;
 			virtual void CreateNewLeaseSet (std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels) = 0;
+			std::vector<std::shared_ptr<const i2p::data::Lease> > GetOtherLeases (const std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> >& tunnels); // multihome, tunnels are own leases
 
 		private:
 
@@ -135,32 +231,41 @@ namespace client
 			void HandlePublishConfirmationTimer (const boost::system::error_code& ecode);
 			void HandlePublishVerificationTimer (const boost::system::error_code& ecode);
 			void HandlePublishDelayTimer (const boost::system::error_code& ecode);
+			bool UpdateOtherLeases (std::shared_ptr<const i2p::data::LeaseSet> leaseSet); // true if our LeaseSet must be updated
 			void HandleDatabaseStoreMessage (const uint8_t * buf, size_t len);
 			void HandleDatabaseSearchReplyMessage (const uint8_t * buf, size_t len);
-			void HandleDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg);
+			void HandleDeliveryStatusMessage (uint32_t msgID);
 
 			void RequestLeaseSet (const i2p::data::IdentHash& dest, RequestComplete requestComplete);
 			bool SendLeaseSetRequest (const i2p::data::IdentHash& dest, std::shared_ptr<const i2p::data::RouterInfo>  nextFloodfill, std::shared_ptr<LeaseSetRequest> request);
-			void HandleRequestTimoutTimer (const boost::system::error_code& ecode, const i2p::data::IdentHash& dest);
+			void HandleRequestTimoutTimer (const i2p::data::IdentHash& dest);
+			void CompleteNotFound (const i2p::data::IdentHash& dest); // removes request
 			void HandleCleanupTimer (const boost::system::error_code& ecode);
 			void CleanupRemoteLeaseSets ();
 
 		private:
 
 			volatile bool m_IsRunning;
-			std::thread * m_Thread;
-			boost::asio::io_service m_Service;
+			std::thread * m_Thread; // dedicated thread only
+			std::unique_ptr<boost::asio::io_service> m_DedicatedService;
+			boost::asio::io_service& m_Service; // dedicated or shared
+			i2p::util::TimeWheel m_TimeWheel; // LeaseSet requests' timers
 			mutable std::mutex m_RemoteLeaseSetsMutex;
 			std::map<i2p::data::IdentHash, std::shared_ptr<i2p::data::LeaseSet> > m_RemoteLeaseSets;
 			std::map<i2p::data::IdentHash, std::shared_ptr<LeaseSetRequest> > m_LeaseSetRequests;
+			std::map<i2p::data::IdentHash, uint64_t> m_NotFoundLeaseSets; // expiration in seconds
 
 			std::shared_ptr<i2p::tunnel::TunnelPool> m_Pool;
 			std::mutex m_LeaseSetMutex;
 			std::shared_ptr<i2p::data::LocalLeaseSet> m_LeaseSet;
-			bool m_IsPublic;
+			bool m_IsPublic, m_IsSharingLeaseSets;
 			uint32_t m_PublishReplyToken;
 			uint64_t m_LastSubmissionTime; // in seconds
 			std::set<i2p::data::IdentHash> m_ExcludedFloodfills; // for publishing
+			// multihome
+			bool m_IsMultihome;
+			std::mutex m_OtherLeasesMutex;
+			std::set<std::shared_ptr<const i2p::data::Lease>, i2p::data::LeaseCmp> m_OwnLeases, m_CurrentOwnLeases, m_OtherLeases; // own leases until expiration
 
 			boost::asio::deadline_timer m_PublishConfirmationTimer, m_PublishVerificationTimer,
 				m_PublishDelayTimer, m_CleanupTimer;
@@ -201,6 +306,7 @@ namespace client
 			// streaming
 			std::shared_ptr<i2p::stream::StreamingDestination> CreateStreamingDestination (int port, bool gzip = true); // additional
 			std::shared_ptr<i2p::stream::StreamingDestination> GetStreamingDestination (int port = 0) const;
+			void DeleteStreamingDestination (int port); // additional only, its streams are closed
 			// following methods operate with default streaming destination
 			void CreateStream (StreamRequestComplete streamRequestComplete, const i2p::data::IdentHash& dest, int port = 0);
 			std::shared_ptr<i2p::stream::Stream> CreateStream (std::shared_ptr<const i2p::data::LeaseSet> remote, int port = 0);
@@ -209,6 +315,15 @@ namespace client
 			bool IsAcceptingStreams () const;
 			void AcceptOnce (const i2p::stream::StreamingDestination::Acceptor& acceptor);
 			int GetStreamingAckDelay () const { return m_StreamingAckDelay; }
+			i2p::stream::StreamingCongestionControl GetStreamingCongestionControl () const { return m_StreamingCongestionControl; }
+			bool IsStreamingCoalescing () const { return m_IsStreamingCoalescing; }
+			i2p::stream::StreamingCompression GetStreamingCompression () const { return m_StreamingCompression; }
+			int GetStreamingNumPaths () const { return m_StreamingNumPaths; }
+
+			// loopback
+			bool IsLoopback () const { return m_IsLoopback; };
+			std::shared_ptr<ClientDestination> GetLoopbackDestination (const i2p::data::IdentHash& ident) const; // nullptr if not enabled or not local
+			void SendLoopbackMessage (std::shared_ptr<I2NPMessage> msg); // Data message to this destination, from any thread
 
 			// datagram
       i2p::datagram::DatagramDestination * GetDatagramDestination () const { return m_DatagramDestination; };
@@ -224,6 +339,7 @@ namespace client
 			// I2CP
 			void HandleDataMessage (const uint8_t * buf, size_t len);
 			void CreateNewLeaseSet (std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels);
+			std::shared_ptr<i2p::data::LeaseSet> GetLoopbackLeaseSet (const i2p::data::IdentHash& ident);
 
 		private:
 
@@ -241,7 +357,13 @@ namespace client
 			std::shared_ptr<i2p::crypto::CryptoKeyDecryptor> m_Decryptor;
 
 			int m_StreamingAckDelay;
+			i2p::stream::StreamingCongestionControl m_StreamingCongestionControl;
+			bool m_IsStreamingCoalescing;
+			i2p::stream::StreamingCompression m_StreamingCompression;
+			int m_StreamingNumPaths;
+			bool m_IsLoopback;
 			std::shared_ptr<i2p::stream::StreamingDestination> m_StreamingDestination; // default
+			mutable std::mutex m_StreamingDestinationsMutex; // additional are added and removed by clients at runtime
 			std::map<uint16_t, std::shared_ptr<i2p::stream::StreamingDestination> > m_StreamingDestinationsByPorts;
 			i2p::datagram::DatagramDestination * m_DatagramDestination;
 			int m_RefCounter; // how many clients(tunnels) use this destination
@@ -1,5 +1,8 @@
+#include <vector>
 #include <openssl/sha.h>
+#include <openssl/rand.h>
 #include "Log.h"
+#include "I2PEndian.h"
 #include "Crypto.h"
 #include "Ed25519.h"
 
@@ -7,6 +10,228 @@ namespace i2p
 {
 namespace crypto
 {
+#if ED25519_NATIVE_FIELD
+	// radix 2^51 field arithmetic modulo 2^255-19
+	__extension__ typedef unsigned __int128 uint128_t;
+	const uint64_t FE25519_MASK = 0x7ffffffffffffULL; // 2^51-1
+
+	static inline void FeCarry (Fe25519 h)
+	{
+		h[1] += h[0] >> 51; h[0] &= FE25519_MASK;
+		h[2] += h[1] >> 51; h[1] &= FE25519_MASK;
+		h[3] += h[2] >> 51; h[2] &= FE25519_MASK;
+		h[4] += h[3] >> 51; h[3] &= FE25519_MASK;
+		h[0] += 19*(h[4] >> 51); h[4] &= FE25519_MASK;
+	}
+
+	static inline void FeZero (Fe25519 h)
+	{
+		h[0] = 0; h[1] = 0; h[2] = 0; h[3] = 0; h[4] = 0;
+	}
+
+	static inline void FeOne (Fe25519 h)
+	{
+		h[0] = 1; h[1] = 0; h[2] = 0; h[3] = 0; h[4] = 0;
+	}
+
+	static inline void FeCopy (Fe25519 h, const Fe25519 f)
+	{
+		for (int i = 0; i < 5; i++) h[i] = f[i];
+	}
+
+	static inline void FeAdd (Fe25519 h, const Fe25519 f, const Fe25519 g)
+	{
+		for (int i = 0; i < 5; i++) h[i] = f[i] + g[i];
+		FeCarry (h);
+	}
+
+	static inline void FeSub (Fe25519 h, const Fe25519 f, const Fe25519 g)
+	{
+		// add 2*p to avoid underflow
+		h[0] = f[0] + 0xfffffffffffdaULL - g[0];
+		for (int i = 1; i < 5; i++) h[i] = f[i] + 0xffffffffffffeULL - g[i];
+		FeCarry (h);
+	}
+
+	static inline void FeMul (Fe25519 h, const Fe25519 f, const Fe25519 g)
+	{
+		uint64_t g1_19 = 19*g[1], g2_19 = 19*g[2], g3_19 = 19*g[3], g4_19 = 19*g[4];
+		uint128_t r0 = (uint128_t)f[0]*g[0] + (uint128_t)f[1]*g4_19 + (uint128_t)f[2]*g3_19 + (uint128_t)f[3]*g2_19 + (uint128_t)f[4]*g1_19;
+		uint128_t r1 = (uint128_t)f[0]*g[1] + (uint128_t)f[1]*g[0] + (uint128_t)f[2]*g4_19 + (uint128_t)f[3]*g3_19 + (uint128_t)f[4]*g2_19;
+		uint128_t r2 = (uint128_t)f[0]*g[2] + (uint128_t)f[1]*g[1] + (uint128_t)f[2]*g[0] + (uint128_t)f[3]*g4_19 + (uint128_t)f[4]*g3_19;
+		uint128_t r3 = (uint128_t)f[0]*g[3] + (uint128_t)f[1]*g[2] + (uint128_t)f[2]*g[1] + (uint128_t)f[3]*g[0] + (uint128_t)f[4]*g4_19;
+		uint128_t r4 = (uint128_t)f[0]*g[4] + (uint128_t)f[1]*g[3] + (uint128_t)f[2]*g[2] + (uint128_t)f[3]*g[1] + (uint128_t)f[4]*g[0];
+		r1 += (uint64_t)(r0 >> 51); h[0] = (uint64_t)r0 & FE25519_MASK;
+		r2 += (uint64_t)(r1 >> 51); h[1] = (uint64_t)r1 & FE25519_MASK;
+		r3 += (uint64_t)(r2 >> 51); h[2] = (uint64_t)r2 & FE25519_MASK;
+		r4 += (uint64_t)(r3 >> 51); h[3] = (uint64_t)r3 & FE25519_MASK;
+		h[0] += 19*(uint64_t)(r4 >> 51); h[4] = (uint64_t)r4 & FE25519_MASK;
+		h[1] += h[0] >> 51; h[0] &= FE25519_MASK;
+	}
+
+	static inline void FeSqr (Fe25519 h, const Fe25519 f)
+	{
+		uint64_t f0_2 = 2*f[0], f1_2 = 2*f[1], f1_38 = 38*f[1], f2_38 = 38*f[2], f3_19 = 19*f[3], f3_38 = 38*f[3], f4_19 = 19*f[4];
+		uint128_t r0 = (uint128_t)f[0]*f[0] + (uint128_t)f1_38*f[4] + (uint128_t)f2_38*f[3];
+		uint128_t r1 = (uint128_t)f0_2*f[1] + (uint128_t)f2_38*f[4] + (uint128_t)f3_19*f[3];
+		uint128_t r2 = (uint128_t)f0_2*f[2] + (uint128_t)f[1]*f[1] + (uint128_t)f3_38*f[4];
+		uint128_t r3 = (uint128_t)f0_2*f[3] + (uint128_t)f1_2*f[2] + (uint128_t)f4_19*f[4];
+		uint128_t r4 = (uint128_t)f0_2*f[4] + (uint128_t)f1_2*f[3] + (uint128_t)f[2]*f[2];
+		r1 += (uint64_t)(r0 >> 51); h[0] = (uint64_t)r0 & FE25519_MASK;
+		r2 += (uint64_t)(r1 >> 51); h[1] = (uint64_t)r1 & FE25519_MASK;
+		r3 += (uint64_t)(r2 >> 51); h[2] = (uint64_t)r2 & FE25519_MASK;
+		r4 += (uint64_t)(r3 >> 51); h[3] = (uint64_t)r3 & FE25519_MASK;
+		h[0] += 19*(uint64_t)(r4 >> 51); h[4] = (uint64_t)r4 & FE25519_MASK;
+		h[1] += h[0] >> 51; h[0] &= FE25519_MASK;
+	}
+
+	static inline void FeSqrN (Fe25519 h, const Fe25519 f, int n)
+	{
+		FeSqr (h, f);
+		for (int i = 1; i < n; i++) FeSqr (h, h);
+	}
+
+	static void FeInvert (Fe25519 out, const Fe25519 z)
+	{
+		// z^(p-2)
+		Fe25519 t0, t1, t2, t3;
+		FeSqr (t0, z);
+		FeSqrN (t1, t0, 2);
+		FeMul (t1, z, t1);
+		FeMul (t0, t0, t1);
+		FeSqr (t2, t0);
+		FeMul (t1, t1, t2);
+		FeSqrN (t2, t1, 5);
+		FeMul (t1, t2, t1);
+		FeSqrN (t2, t1, 10);
+		FeMul (t2, t2, t1);
+		FeSqrN (t3, t2, 20);
+		FeMul (t2, t3, t2);
+		FeSqrN (t2, t2, 10);
+		FeMul (t1, t2, t1);
+		FeSqrN (t2, t1, 50);
+		FeMul (t2, t2, t1);
+		FeSqrN (t3, t2, 100);
+		FeMul (t2, t3, t2);
+		FeSqrN (t2, t2, 50);
+		FeMul (t1, t2, t1);
+		FeSqrN (t1, t1, 5);
+		FeMul (out, t1, t0);
+	}
+
+	static void FeFromBytes (Fe25519 h, const uint8_t * s) // 32 bytes Little Endian, highest bit ignored
+	{
+		h[0] = bufle64toh (s) & FE25519_MASK;
+		h[1] = (bufle64toh (s + 6) >> 3) & FE25519_MASK;
+		h[2] = (bufle64toh (s + 12) >> 6) & FE25519_MASK;
+		h[3] = (bufle64toh (s + 19) >> 1) & FE25519_MASK;
+		h[4] = (bufle64toh (s + 24) >> 12) & FE25519_MASK;
+	}
+
+	static void FeToBytes (uint8_t * s, const Fe25519 f) // fully reduced, 32 bytes Little Endian
+	{
+		Fe25519 t;
+		FeCopy (t, f);
+		FeCarry (t); FeCarry (t);
+		// t < 2^255 + small, subtract p if t >= p
+		t[0] += 19; FeCarry (t);
+		t[0] += 0x8000000000000ULL - 19;
+		for (int i = 1; i < 5; i++) t[i] += 0x8000000000000ULL - 1;
+		t[1] += t[0] >> 51; t[0] &= FE25519_MASK;
+		t[2] += t[1] >> 51; t[1] &= FE25519_MASK;
+		t[3] += t[2] >> 51; t[2] &= FE25519_MASK;
+		t[4] += t[3] >> 51; t[3] &= FE25519_MASK;
+		t[4] &= FE25519_MASK; // drop 2^255
+		htole64buf (s, t[0] | (t[1] << 51));
+		htole64buf (s + 8, (t[1] >> 13) | (t[2] << 38));
+		htole64buf (s + 16, (t[2] >> 26) | (t[3] << 25));
+		htole64buf (s + 24, (t[3] >> 39) | (t[4] << 12));
+	}
+
+	static inline void FeCMov (Fe25519 f, const Fe25519 g, uint64_t b) // f = b ? g : f, b is 0 or 1
+	{
+		uint64_t mask = -b;
+		for (int i = 0; i < 5; i++) f[i] ^= mask & (f[i] ^ g[i]);
+	}
+
+	static inline void FeCSwap (Fe25519 f, Fe25519 g, uint64_t b) // swap if b is 1, b is 0 or 1
+	{
+		uint64_t mask = -b;
+		for (int i = 0; i < 5; i++)
+		{
+			uint64_t x = mask & (f[i] ^ g[i]);
+			f[i] ^= x; g[i] ^= x;
+		}
+	}
+
+	static void GeZero (Ge25519& p)
+	{
+		FeZero (p.x); FeOne (p.y); FeOne (p.z); FeZero (p.t);
+	}
+
+	static void GeDouble (Ge25519& p) // dbl-2008-hwcd with a = -1
+	{
+		Fe25519 a, b, c, e, f, g, h;
+		FeSqr (a, p.x);
+		FeSqr (b, p.y);
+		FeSqr (c, p.z); FeAdd (c, c, c); // 2*z^2
+		FeAdd (h, a, b); // A + B
+		FeAdd (e, p.x, p.y); FeSqr (e, e); FeSub (e, h, e); // A + B - (x+y)^2
+		FeSub (g, a, b); // A - B
+		FeAdd (f, c, g); // C + A - B
+		FeMul (p.x, e, f);
+		FeMul (p.y, g, h);
+		FeMul (p.t, e, h);
+		FeMul (p.z, f, g);
+	}
+
+	static void GeMAdd (Ge25519& p, const Ge25519Precomp& q) // madd-2008-hwcd-3
+	{
+		Fe25519 a, b, c, d, e, f, g, h;
+		FeSub (a, p.y, p.x); FeMul (a, a, q.ymx);
+		FeAdd (b, p.y, p.x); FeMul (b, b, q.ypx);
+		FeMul (c, p.t, q.xy2d);
+		FeAdd (d, p.z, p.z);
+		FeSub (e, b, a);
+		FeSub (f, d, c);
+		FeAdd (g, d, c);
+		FeAdd (h, b, a);
+		FeMul (p.x, e, f);
+		FeMul (p.y, g, h);
+		FeMul (p.t, e, h);
+		FeMul (p.z, f, g);
+	}
+
+	static void GeSelect (Ge25519Precomp& t, const Ge25519Precomp * row, int8_t b) // t = b*row[0], constant time
+	{
+		uint64_t negative = (uint8_t)b >> 7;
+		uint8_t babs = b - (((-negative) & b) << 1);
+		FeOne (t.ypx); FeOne (t.ymx); FeZero (t.xy2d);
+		for (int j = 0; j < 8; j++)
+		{
+			uint64_t eq = (uint8_t)((babs ^ (j + 1)) - 1) >> 7; // babs == j + 1
+			FeCMov (t.ypx, row[j].ypx, eq);
+			FeCMov (t.ymx, row[j].ymx, eq);
+			FeCMov (t.xy2d, row[j].xy2d, eq);
+		}
+		Ge25519Precomp minus;
+		FeCopy (minus.ypx, t.ymx);
+		FeCopy (minus.ymx, t.ypx);
+		Fe25519 zero; FeZero (zero);
+		FeSub (minus.xy2d, zero, t.xy2d);
+		FeCMov (t.ypx, minus.ypx, negative);
+		FeCMov (t.ymx, minus.ymx, negative);
+		FeCMov (t.xy2d, minus.xy2d, negative);
+	}
+
+#if !OPENSSL_X25519
+	struct X25519BatchPoint // (z+y, z-y) of k*B and prefix product of z-y
+	{
+		Fe25519 n, d, prefix;
+	};
+#endif
+#endif
+
 	Ed25519::Ed25519 ()
 	{
 		BN_CTX * ctx = BN_CTX_new ();
@@ -64,6 +289,27 @@ namespace crypto
 				Bi256Carry = Sum (Bi256Carry, Bi256[i][0], ctx);
 		}
 
+#if ED25519_NATIVE_FIELD
+		// native comb table from first 8 points of Bi256 rows
+		Fe25519 d2;
+		tmp = BN_new ();
+		BN_mod_lshift1 (tmp, d, q, ctx); // 2*d % q
+		uint8_t buf[32];
+		EncodeBN (tmp, buf, 32); FeFromBytes (d2, buf);
+		BN_free (tmp);
+		for (int i = 0; i < 32; i++)
+			for (int j = 0; j < 8; j++)
+			{
+				auto p = Normalize (Bi256[i][j], ctx);
+				Fe25519 x, y;
+				EncodeBN (p.x, buf, 32); FeFromBytes (x, buf);
+				EncodeBN (p.y, buf, 32); FeFromBytes (y, buf);
+				auto& c = BComb[i][j];
+				FeAdd (c.ypx, y, x);
+				FeSub (c.ymx, y, x);
+				FeMul (c.xy2d, x, y); FeMul (c.xy2d, c.xy2d, d2);
+			}
+#endif
 		BN_CTX_free (ctx);
 	}
 
@@ -74,6 +320,9 @@ namespace crypto
 		for (int i = 0; i < 32; i++)
 			for (int j = 0; j < 128; j++)
 				Bi256[i][j] = other.Bi256[i][j];
+#if ED25519_NATIVE_FIELD
+		memcpy (BComb, other.BComb, sizeof (BComb));
+#endif
 	}
 
 	Ed25519::~Ed25519 ()
@@ -88,7 +337,14 @@ namespace crypto
 
 	EDDSAPoint Ed25519::GeneratePublicKey (const uint8_t * expandedPrivateKey, BN_CTX * ctx) const
 	{
+#if ED25519_NATIVE_FIELD
+		(void)ctx;
+		Ge25519 p;
+		MulBNative (expandedPrivateKey, p); // clamped, less than 2^255
+		return ToEDDSAPoint (p);
+#else
 		return MulB (expandedPrivateKey, ctx); // left half of expanded key, considered as Little Endian
+#endif
 	}
 
 	EDDSAPoint Ed25519::DecodePublicKey (const uint8_t * buf, BN_CTX * ctx) const
@@ -103,28 +359,118 @@ namespace crypto
 
 	bool Ed25519::Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const
 	{
-		BN_CTX * ctx = BN_CTX_new ();
-		BIGNUM * h = DecodeBN<64> (digest);
-		// signature 0..31 - R, 32..63 - S
-		// B*S = R + PK*h => R = B*S - PK*h
-		// we don't decode R, but encode (B*S - PK*h)
-		auto Bs = MulB (signature + EDDSA25519_SIGNATURE_LENGTH/2, ctx); // B*S;
-		BN_mod (h, h, l, ctx); // public key is multiple of B, but B%l = 0
-		auto PKh = Mul (publicKey, h, ctx); // PK*h
-		uint8_t diff[32];
-		EncodePoint (Normalize (Sum (Bs, -PKh, ctx), ctx), diff); // Bs - PKh encoded
-		bool passed = !memcmp (signature, diff, 32); // R
-		BN_free (h);
-		BN_CTX_free (ctx);
+		return VerifyNegated (-publicKey, digest, signature);
+	}
+
+	bool Ed25519::VerifyNegated (const EDDSAPoint& negPublicKey, const uint8_t * digest, const uint8_t * signature) const
+	{
+		BN_CTX * ctx = GetThreadBNCtx ();
+		// S >= l is malleable, rejected by batch verification too
+		bool passed = IsCanonicalS (signature + EDDSA25519_SIGNATURE_LENGTH/2);
+		if (passed)
+		{
+			BIGNUM * h = DecodeBN<64> (digest);
+			// signature 0..31 - R, 32..63 - S
+			// B*S = R + PK*h => R = B*S - PK*h = B*S + (-PK)*h
+			// we don't decode R, but encode (B*S - PK*h)
+			auto Bs = MulB (signature + EDDSA25519_SIGNATURE_LENGTH/2, ctx); // B*S;
+			BN_mod (h, h, l, ctx); // public key is multiple of B, but B%l = 0
+			auto PKh = Mul (negPublicKey, h, ctx); // -PK*h
+			uint8_t diff[32];
+			EncodePoint (Normalize (Sum (Bs, PKh, ctx), ctx), diff); // Bs - PKh encoded
+			passed = !memcmp (signature, diff, 32); // R
+			BN_free (h);
+		}
 		if (!passed)
 			LogPrint (eLogError, "25519 signature verification failed");
 		return passed;
 	}
 
+	bool Ed25519::IsCanonicalS (const uint8_t * s) const
+	{
+		BIGNUM * S = DecodeBN<32> (s);
+		bool ret = BN_cmp (S, l) < 0; // S >= l is malleable
+		BN_free (S);
+		return ret;
+	}
+
+	void Ed25519::Verify (size_t num, const EDDSAPoint * const * publicKeys, const uint8_t * const * digests,
+		const uint8_t * const * signatures, bool * results) const
+	{
+		if (num > 1)
+		{
+			bool passed = VerifyBatch (num, publicKeys, digests, signatures, GetThreadBNCtx ());
+			if (passed)
+			{
+				for (size_t i = 0; i < num; i++) results[i] = true;
+				return;
+			}
+			LogPrint (eLogDebug, "25519 batch verification of ", num, " signatures failed. Verify one by one");
+		}
+		for (size_t i = 0; i < num; i++)
+			results[i] = Verify (*publicKeys[i], digests[i], signatures[i]);
+	}
+
+	bool Ed25519::VerifyBatch (size_t num, const EDDSAPoint * const * publicKeys, const uint8_t * const * digests,
+		const uint8_t * const * signatures, BN_CTX * ctx) const
+	{
+		// random z[i] of 128 bits, S = sum(z[i]*S[i]) % l
+		// check 8*B*S = 8*(sum(z[i]*R[i]) + sum(z[i]*h[i] % l)*PK[i])
+		// cofactored, otherwise small order components of R or PK multiplied by random z[i] make result random.
+		// Single verification compares encoded R and is cheaper, it accepts the same honest signatures,
+		// only signer's own crafted R or PK with small order component can pass batch but not single
+		std::vector<EDDSAPoint> points; points.reserve (2*num);
+		std::vector<BIGNUM *> scalars; scalars.reserve (2*num);
+		BIGNUM * s = BN_new (), * tmp = BN_new ();
+		BN_zero (s);
+		uint8_t rnd[16];
+		int numBits = 0;
+		bool ret = true;
+		for (size_t i = 0; i < num; i++)
+		{
+			if (!IsCanonicalS (signatures[i] + EDDSA25519_SIGNATURE_LENGTH/2)) { ret = false; break; }
+			auto R = DecodePoint (signatures[i], ctx);
+			if (!IsOnCurve (R, ctx)) { ret = false; break; }
+			RAND_bytes (rnd, 16);
+			BIGNUM * z = BN_bin2bn (rnd, 16, NULL);
+			BIGNUM * S = DecodeBN<32> (signatures[i] + EDDSA25519_SIGNATURE_LENGTH/2);
+			BN_mod_mul (tmp, z, S, l, ctx);
+			BN_mod_add (s, s, tmp, l, ctx);
+			BN_free (S);
+			BIGNUM * h = DecodeBN<64> (digests[i]);
+			BN_mod_mul (h, h, z, l, ctx); // z*h % l
+			points.push_back (std::move (R)); scalars.push_back (z);
+			points.push_back (*publicKeys[i]); scalars.push_back (h);
+			if (BN_num_bits (h) > numBits) numBits = BN_num_bits (h);
+		}
+		if (ret)
+		{
+			// sum of all z*P with shared doublings
+			BIGNUM * zero = BN_new (), * one = BN_new ();
+			BN_zero (zero); BN_one (one);
+			EDDSAPoint sum {zero, one};
+			for (int bit = numBits - 1; bit >= 0; bit--)
+			{
+				Double (sum, ctx);
+				for (size_t j = 0; j < points.size (); j++)
+					if (BN_is_bit_set (scalars[j], bit)) sum = Sum (sum, points[j], ctx);
+			}
+			uint8_t encoded[32];
+			EncodeBN (s, encoded, 32);
+			auto diff = Sum (MulB (encoded, ctx), -sum, ctx);
+			for (int i = 0; i < 3; i++) Double (diff, ctx); // multiply by cofactor
+			auto p = Normalize (diff, ctx);
+			ret = BN_is_zero (p.x) && BN_is_one (p.y); // identity
+		}
+		for (auto it: scalars) BN_free (it);
+		BN_free (s); BN_free (tmp);
+		return ret;
+	}
+
 	void Ed25519::Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len,
 		uint8_t * signature) const
 	{
-		BN_CTX * bnCtx = BN_CTX_new ();
+		BN_CTX * bnCtx = GetThreadBNCtx ();
 		// calculate r
 		SHA512_CTX ctx;
 		SHA512_Init (&ctx);
@@ -135,7 +481,15 @@ namespace crypto
 		BIGNUM * r = DecodeBN<32> (digest); // DecodeBN<64> (digest); // for test vectors
 		// calculate R
 		uint8_t R[EDDSA25519_SIGNATURE_LENGTH/2]; // we must use separate buffer because signature might be inside buf
+#if ED25519_NATIVE_FIELD
+		BN_mod (r, r, l, bnCtx); // r*B = (r%l)*B, and r%l < 2^253 fits signed radix 16
+		EncodeBN (r, R, EDDSA25519_SIGNATURE_LENGTH/2);
+		Ge25519 Rp;
+		MulBNative (R, Rp);
+		EncodePointNative (Rp, R);
+#else
 		EncodePoint (Normalize (MulB (digest, bnCtx), bnCtx), R); // EncodePoint (Mul (B, r, bnCtx), R); // for test vectors
+#endif
 		// calculate S
 		SHA512_Init (&ctx);
 		SHA512_Update (&ctx, R, EDDSA25519_SIGNATURE_LENGTH/2); // R
@@ -150,7 +504,6 @@ namespace crypto
 		memcpy (signature, R, EDDSA25519_SIGNATURE_LENGTH/2);
 		EncodeBN (h, signature + EDDSA25519_SIGNATURE_LENGTH/2, EDDSA25519_SIGNATURE_LENGTH/2); // S
 		BN_free (r); BN_free (h); BN_free (a);
-		BN_CTX_free (bnCtx);
 	}
 
 	EDDSAPoint Ed25519::Sum (const EDDSAPoint& p1, const EDDSAPoint& p2, BN_CTX * ctx) const
@@ -295,6 +648,67 @@ namespace crypto
 		return res;
 	}
 
+#if ED25519_NATIVE_FIELD
+	void Ed25519::MulBNative (const uint8_t * e, Ge25519& res) const
+	{
+		// signed radix 16 digits, -8 <= digits[i] <= 8
+		int8_t digits[64];
+		for (int i = 0; i < 32; i++)
+		{
+			digits[2*i] = e[i] & 0x0F;
+			digits[2*i + 1] = (e[i] >> 4) & 0x0F;
+		}
+		int8_t carry = 0;
+		for (int i = 0; i < 63; i++)
+		{
+			digits[i] += carry;
+			carry = (digits[i] + 8) >> 4;
+			digits[i] -= carry << 4;
+		}
+		digits[63] += carry;
+		// sum of odd digits, multiply by 16, add even digits
+		GeZero (res);
+		Ge25519Precomp t;
+		for (int i = 1; i < 64; i += 2)
+		{
+			GeSelect (t, BComb[i/2], digits[i]);
+			GeMAdd (res, t);
+		}
+		for (int i = 0; i < 4; i++) GeDouble (res);
+		for (int i = 0; i < 64; i += 2)
+		{
+			GeSelect (t, BComb[i/2], digits[i]);
+			GeMAdd (res, t);
+		}
+	}
+
+	void Ed25519::EncodePointNative (const Ge25519& p, uint8_t * buf) const
+	{
+		Fe25519 zi, x, y;
+		FeInvert (zi, p.z);
+		FeMul (x, p.x, zi);
+		FeMul (y, p.y, zi);
+		uint8_t xb[32];
+		FeToBytes (xb, x);
+		FeToBytes (buf, y);
+		buf[EDDSA25519_PUBLIC_KEY_LENGTH - 1] |= (xb[0] & 0x01) << 7; // highest bit is lowest bit of x
+	}
+
+	EDDSAPoint Ed25519::ToEDDSAPoint (const Ge25519& p) const
+	{
+		Fe25519 zi, x, y;
+		FeInvert (zi, p.z);
+		FeMul (x, p.x, zi);
+		FeMul (y, p.y, zi);
+		uint8_t buf[32];
+		FeToBytes (buf, x);
+		BIGNUM * x1 = DecodeBN<32> (buf);
+		FeToBytes (buf, y);
+		BIGNUM * y1 = DecodeBN<32> (buf);
+		return EDDSAPoint {x1, y1};
+	}
+#endif
+
 	EDDSAPoint Ed25519::Normalize (const EDDSAPoint& p, BN_CTX * ctx) const
 	{
 		if (p.z)
@@ -468,26 +882,106 @@ namespace crypto
 
 	void Ed25519::ScalarMul (const uint8_t * p, const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const
 	{
-		BIGNUM * p1 = DecodeBN<32> (p);
 		uint8_t k[32];
 		memcpy (k, e, 32);
 		k[0] &= 248; k[31] &= 127; k[31] |= 64;
+#if ED25519_NATIVE_FIELD
+		// constant time Montgomery ladder, RFC 7748
+		Fe25519 x1, x2, z2, x3, z3, a, aa, b, bb, c, d, da, cb, a24;
+		FeFromBytes (x1, p);
+		FeOne (x2); FeZero (z2);
+		FeCopy (x3, x1); FeOne (z3);
+		FeZero (a24); a24[0] = 121665;
+		uint64_t swap = 0;
+		for (int t = 254; t >= 0; t--)
+		{
+			uint64_t kt = (k[t >> 3] >> (t & 7)) & 1;
+			swap ^= kt;
+			FeCSwap (x2, x3, swap);
+			FeCSwap (z2, z3, swap);
+			swap = kt;
+			FeAdd (a, x2, z2); FeSqr (aa, a);
+			FeSub (b, x2, z2); FeSqr (bb, b);
+			FeAdd (c, x3, z3);
+			FeSub (d, x3, z3);
+			FeMul (da, d, a);
+			FeMul (cb, c, b);
+			FeAdd (x3, da, cb); FeSqr (x3, x3);
+			FeSub (z3, da, cb); FeSqr (z3, z3); FeMul (z3, z3, x1);
+			FeMul (x2, aa, bb);
+			FeSub (c, aa, bb); // E = AA - BB
+			FeMul (z2, c, a24); FeAdd (z2, z2, aa); FeMul (z2, z2, c);
+		}
+		FeCSwap (x2, x3, swap);
+		FeCSwap (z2, z3, swap);
+		FeInvert (z2, z2);
+		FeMul (x2, x2, z2);
+		FeToBytes (buf, x2);
+#else
+		BIGNUM * p1 = DecodeBN<32> (p);
 		BIGNUM * n = DecodeBN<32> (k);
 		BIGNUM * q1 = ScalarMul (p1, n, ctx);
 		EncodeBN (q1, buf, 32);
 		BN_free (p1); BN_free (n); BN_free (q1);
+#endif
 	}
 
 	void Ed25519::ScalarMulB (const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const
 	{
-		BIGNUM *p1 = BN_new (); BN_set_word (p1, 9);
 		uint8_t k[32];
 		memcpy (k, e, 32);
 		k[0] &= 248; k[31] &= 127; k[31] |= 64;
+#if ED25519_NATIVE_FIELD
+		// u = (1 + y)/(1 - y) = (z + y)/(z - y) of Edwards point k*B
+		Ge25519 p;
+		MulBNative (k, p);
+		Fe25519 n, d;
+		FeAdd (n, p.z, p.y);
+		FeSub (d, p.z, p.y);
+		FeInvert (d, d);
+		FeMul (n, n, d);
+		FeToBytes (buf, n);
+#else
+		BIGNUM *p1 = BN_new (); BN_set_word (p1, 9);
 		BIGNUM * n = DecodeBN<32> (k);
 		BIGNUM * q1 = ScalarMul (p1, n, ctx);
 		EncodeBN (q1, buf, 32);
 		BN_free (p1); BN_free (n); BN_free (q1);
+#endif
+	}
+
+	void Ed25519::ScalarMulB (size_t num, const uint8_t * const * e, uint8_t * const * bufs, BN_CTX * ctx) const
+	{
+#if ED25519_NATIVE_FIELD
+		// u[i] = n[i]/d[i], all d[i] inverted with one inversion
+		std::vector<X25519BatchPoint> points (num);
+		Fe25519 acc;
+		FeOne (acc);
+		for (size_t i = 0; i < num; i++)
+		{
+			uint8_t k[32];
+			memcpy (k, e[i], 32);
+			k[0] &= 248; k[31] &= 127; k[31] |= 64;
+			Ge25519 p;
+			MulBNative (k, p);
+			FeAdd (points[i].n, p.z, p.y);
+			FeSub (points[i].d, p.z, p.y);
+			FeCopy (points[i].prefix, acc); // d[0]*...*d[i-1]
+			FeMul (acc, acc, points[i].d);
+		}
+		FeInvert (acc, acc); // 1/(d[0]*...*d[num-1])
+		for (size_t i = num; i-- > 0;)
+		{
+			Fe25519 inv;
+			FeMul (inv, acc, points[i].prefix); // 1/d[i]
+			FeMul (acc, acc, points[i].d);
+			FeMul (inv, inv, points[i].n);
+			FeToBytes (bufs[i], inv);
+		}
+#else
+		for (size_t i = 0; i < num; i++)
+			ScalarMulB (e[i], bufs[i], ctx);
+#endif
 	}
 #endif
 
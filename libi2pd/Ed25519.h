@@ -62,6 +62,22 @@ namespace crypto
 		}
 	};
 
+#if defined(__SIZEOF_INT128__)
+#	define ED25519_NATIVE_FIELD 1
+	// native fixed-width arithmetic for fixed-base multiplication
+	typedef uint64_t Fe25519[5]; // field element, 5 limbs of 51 bits
+
+	struct Ge25519 // extended coordinates
+	{
+		Fe25519 x, y, z, t;
+	};
+
+	struct Ge25519Precomp // affine point as (y+x, y-x, 2*d*x*y)
+	{
+		Fe25519 ypx, ymx, xy2d;
+	};
+#endif
+
 	const size_t EDDSA25519_PUBLIC_KEY_LENGTH = 32;
 	const size_t EDDSA25519_SIGNATURE_LENGTH = 64;
 	const size_t EDDSA25519_PRIVATE_KEY_LENGTH = 32;
@@ -79,9 +95,13 @@ namespace crypto
 #if !OPENSSL_X25519
 			void ScalarMul (const uint8_t * p, const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const; // p is point, e is number for x25519
 			void ScalarMulB (const  uint8_t * e, uint8_t * buf, BN_CTX * ctx) const;
+			void ScalarMulB (size_t num, const uint8_t * const * e, uint8_t * const * bufs, BN_CTX * ctx) const; // batch, one inversion for all
 #endif
 
 			bool Verify (const EDDSAPoint& publicKey, const uint8_t * digest, const uint8_t * signature) const;
+			bool VerifyNegated (const EDDSAPoint& negPublicKey, const uint8_t * digest, const uint8_t * signature) const; // negPublicKey is precalculated -A
+			void Verify (size_t num, const EDDSAPoint * const * publicKeys, const uint8_t * const * digests,
+				const uint8_t * const * signatures, bool * results) const; // batch, falls back to one by one if batch fails
 			void Sign (const uint8_t * expandedPrivateKey, const uint8_t * publicKeyEncoded, const uint8_t * buf, size_t len, uint8_t * signature) const;
 
 			static void ExpandPrivateKey (const uint8_t * key, uint8_t * expandedKey); // key - 32 bytes, expandedKey - 64 bytes
@@ -90,8 +110,16 @@ namespace crypto
 
 			EDDSAPoint Sum (const EDDSAPoint& p1, const EDDSAPoint& p2, BN_CTX * ctx) const;
 			void Double (EDDSAPoint& p, BN_CTX * ctx) const;
+			bool VerifyBatch (size_t num, const EDDSAPoint * const * publicKeys, const uint8_t * const * digests,
+				const uint8_t * const * signatures, BN_CTX * ctx) const;
+			bool IsCanonicalS (const uint8_t * s) const; // S < l, 32 bytes Little Endian
 			EDDSAPoint Mul (const EDDSAPoint& p, const BIGNUM * e, BN_CTX * ctx) const;
 			EDDSAPoint MulB (const uint8_t * e, BN_CTX * ctx) const; // B*e, e is 32 bytes Little Endian
+#if ED25519_NATIVE_FIELD
+			void MulBNative (const uint8_t * e, Ge25519& res) const; // e < 2^255, 32 bytes Little Endian
+			void EncodePointNative (const Ge25519& p, uint8_t * buf) const;
+			EDDSAPoint ToEDDSAPoint (const Ge25519& p) const;
+#endif
 			EDDSAPoint Normalize (const EDDSAPoint& p, BN_CTX * ctx) const;
 			
 			bool IsOnCurve (const EDDSAPoint& p, BN_CTX * ctx) const;	
@@ -117,6 +145,9 @@ namespace crypto
 			// if j > 128 we use 256 - j and carry 1 to next byte
 			// Bi256[0][0] = B, base point
 			EDDSAPoint Bi256Carry; // Bi256[32][0]
+#if ED25519_NATIVE_FIELD
+			Ge25519Precomp BComb[32][8]; // BComb[i][j] = (j+1)*256^i*B, for signed radix 16 digits
+#endif
 	};		
 
 	std::unique_ptr<Ed25519>& GetEd25519 ();
@@ -1,3 +1,4 @@
+#include <thread>
 #include "Event.h"
 #include "Log.h"
 
@@ -9,6 +10,17 @@ namespace i2p
 		EventCore core;
 #endif
 
+		EventCore::Collector::Collector (): current (0)
+		{
+			for (int i = 0; i < 2; i++)
+			{
+				inUse[i] = 0;
+				tables[i].resize (EVENT_COLLECTOR_NUM_SLOTS);
+				for (auto& it: tables[i]) it.used = false;
+				for (auto& it: overflow[i]) it = 0;
+			}
+		}
+
 		void EventCore::SetListener(EventListener * l)
 		{
 			m_listener = l;
@@ -20,32 +32,89 @@ namespace i2p
 			if(m_listener) m_listener->HandleEvent(ev);
 		}
 
-		void EventCore::CollectEvent(const std::string & type, const std::string & ident, uint64_t val)
+		EventCore::Collector * EventCore::GetThreadCollector ()
 		{
-			std::unique_lock<std::mutex> lock(m_collect_mutex);
-			std::string key = type + "." + ident;
-			if (m_collected.find(key) == m_collected.end())
+			static thread_local Collector * collector = nullptr;
+			if (!collector)
 			{
-				m_collected[key] = {type, key, 0};
+				// once per thread, collector lives as long as core
+				collector = new Collector ();
+				std::unique_lock<std::mutex> lock(m_collect_mutex);
+				m_collectors.emplace_back (collector);
 			}
-		  m_collected[key].Val += val;
+			return collector;
+		}
+
+		void EventCore::CollectEvent(CollectedEventType type, const i2p::data::Tag<32> & ident, uint64_t val)
+		{
+			auto collector = GetThreadCollector ();
+			int ind;
+			for (;;)
+			{
+				ind = collector->current;
+				collector->inUse[ind]++;
+				if (collector->current == ind) break;
+				collector->inUse[ind]--; // pump has just switched tables
+			}
+			auto& table = collector->tables[ind];
+			size_t slot = (ident.GetLL ()[0] ^ type) % EVENT_COLLECTOR_NUM_SLOTS;
+			bool found = false;
+			for (size_t i = 0; i < EVENT_COLLECTOR_MAX_PROBES; i++)
+			{
+				auto& s = table[(slot + i) % EVENT_COLLECTOR_NUM_SLOTS];
+				if (!s.used)
+				{
+					s.ident = ident; s.type = type; s.val = 0; s.used = true;
+				}
+				else if (s.type != type || s.ident != ident)
+					continue;
+				s.val += val;
+				found = true;
+				break;
+			}
+			if (!found) collector->overflow[ind][type] += val;
+			collector->inUse[ind]--;
 		}
 
 		void EventCore::PumpCollected(EventListener * listener)
 		{
-			std::unique_lock<std::mutex> lock(m_collect_mutex);
+			std::map<std::pair<int, i2p::data::Tag<32> >, uint64_t> collected; // summed across threads
+			uint64_t overflow[eNumCollectedEventTypes] = {0};
+			{
+				std::unique_lock<std::mutex> lock(m_collect_mutex);
+				for (auto& collector: m_collectors)
+				{
+					int ind = collector->current;
+					collector->current = 1 - ind;
+					while (collector->inUse[ind] > 0) std::this_thread::yield (); // writer is in the middle of update
+					for (auto& s: collector->tables[ind])
+						if (s.used)
+						{
+							collected[std::make_pair (s.type, s.ident)] += s.val;
+							s.used = false;
+						}
+					for (int i = 0; i < eNumCollectedEventTypes; i++)
+					{
+						overflow[i] += collector->overflow[ind][i];
+						collector->overflow[ind][i] = 0;
+					}
+				}
+			}
 			if(listener)
 			{
-				for(const auto & ev : m_collected) {
-					listener->HandlePumpEvent({{"type", ev.second.Key}, {"ident", ev.second.Ident}}, ev.second.Val);
+				for(const auto & ev : collected) {
+					std::string type = COLLECTED_EVENT_NAMES[ev.first.first];
+					listener->HandlePumpEvent({{"type", type}, {"ident", type + "." + ev.first.second.ToBase64 ()}}, ev.second);
 				}
+				for (int i = 0; i < eNumCollectedEventTypes; i++)
+					if (overflow[i])
+						listener->HandlePumpEvent({{"type", COLLECTED_EVENT_NAMES[i]}, {"ident", std::string (COLLECTED_EVENT_NAMES[i]) + ".other"}}, overflow[i]);
 			}
-			m_collected.clear();
 		}
 	}
 }
 
-void QueueIntEvent(const std::string & type, const std::string & ident, uint64_t val)
+void QueueIntEvent(i2p::event::CollectedEventType type, const i2p::data::Tag<32> & ident, uint64_t val)
 {
 #ifdef WITH_EVENTS
 	i2p::event::core.CollectEvent(type, ident, val);
@@ -58,4 +127,3 @@ void EmitEvent(const EventType & e)
 	i2p::event::core.QueueEvent(e);
 #endif
 }
-
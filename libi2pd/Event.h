@@ -5,8 +5,11 @@
 #include <memory>
 #include <mutex>
 #include <tuple>
+#include <vector>
+#include <atomic>
 
 #include <boost/asio.hpp>
+#include "Tag.h"
 
 typedef std::map<std::string, std::string> EventType;
 
@@ -14,6 +17,18 @@ namespace i2p
 {
 	namespace event
 	{
+		// collected events are summed per ident between pumps
+		enum CollectedEventType
+		{
+			eCollectedTransportSend = 0,
+			eCollectedTransportRecvMsg,
+			eNumCollectedEventTypes
+		};
+		const char * const COLLECTED_EVENT_NAMES[eNumCollectedEventTypes] = { "transport.send", "transport.recvmsg" };
+
+		const size_t EVENT_COLLECTOR_NUM_SLOTS = 1024; // distinct idents per thread between pumps
+		const size_t EVENT_COLLECTOR_MAX_PROBES = 32; // sum goes to overflow if no free slot found
+
 		class EventListener	 {
 		public:
 			virtual ~EventListener() {};
@@ -26,19 +41,35 @@ namespace i2p
 		{
 		public:
 			void QueueEvent(const EventType & ev);
-      void CollectEvent(const std::string & type, const std::string & ident, uint64_t val);
+      /** @brief called for every packet, no locks and no allocations after thread's first call */
+      void CollectEvent(CollectedEventType type, const i2p::data::Tag<32> & ident, uint64_t val);
 			void SetListener(EventListener * l);
       void PumpCollected(EventListener * l);
 
 		private:
-      std::mutex m_collect_mutex;
-      struct CollectedEvent
+
+      struct CollectedSlot
       {
-        std::string Key;
-        std::string Ident;
-        uint64_t Val;
+        i2p::data::Tag<32> ident;
+        uint64_t val;
+        int type;
+        bool used;
       };
-      std::map<std::string, CollectedEvent> m_collected;
+
+      /** @brief owned by one thread, pump switches it to other table and waits for writer to leave */
+      struct Collector
+      {
+        Collector ();
+
+        std::atomic<int> current, inUse[2];
+        std::vector<CollectedSlot> tables[2];
+        uint64_t overflow[2][eNumCollectedEventTypes];
+      };
+
+      Collector * GetThreadCollector ();
+
+      std::mutex m_collect_mutex; // collectors list
+      std::vector<std::unique_ptr<Collector> > m_collectors;
 			EventListener * m_listener = nullptr;
 		};
 #ifdef WITH_EVENTS
@@ -47,7 +78,7 @@ namespace i2p
 	}
 }
 
-void QueueIntEvent(const std::string & type, const std::string & ident, uint64_t val);
+void QueueIntEvent(i2p::event::CollectedEventType type, const i2p::data::Tag<32> & ident, uint64_t val);
 void EmitEvent(const EventType & ev);
 
 #endif
@@ -2,6 +2,7 @@
 #include "I2PEndian.h"
 #include <map>
 #include <string>
+#include <algorithm>
 #include "Crypto.h"
 #include "RouterContext.h"
 #include "I2NPProtocol.h"
@@ -11,6 +12,7 @@
 #include "Timestamp.h"
 #include "Log.h"
 #include "FS.h"
+#include "Metrics.h"
 #include "Garlic.h"
 
 namespace i2p
@@ -45,10 +47,13 @@ namespace garlic
 	{
 		if (!m_SharedRoutingPath) return nullptr;
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+		// confirmations keep path alive, up to max expiration timeout
+		uint32_t lastTime = std::max (m_SharedRoutingPath->updateTime, m_SharedRoutingPath->confirmationTime);
 		if (m_SharedRoutingPath->numTimesUsed >= ROUTING_PATH_MAX_NUM_TIMES_USED ||
 		    !m_SharedRoutingPath->outboundTunnel->IsEstablished () ||
 			ts*1000LL > m_SharedRoutingPath->remoteLease->endDate ||
-		    ts > m_SharedRoutingPath->updateTime + ROUTING_PATH_EXPIRATION_TIMEOUT)
+		    ts > lastTime + ROUTING_PATH_EXPIRATION_TIMEOUT ||
+			ts > m_SharedRoutingPath->updateTime + ROUTING_PATH_MAX_EXPIRATION_TIMEOUT)
 				m_SharedRoutingPath = nullptr;
 		if (m_SharedRoutingPath) m_SharedRoutingPath->numTimesUsed++;
 		return m_SharedRoutingPath;
@@ -60,12 +65,23 @@ namespace garlic
 		{
 			path->updateTime = i2p::util::GetSecondsSinceEpoch ();
 			path->numTimesUsed = 0;
+			path->confirmationTime = 0;
 		}
 		else
 			path = nullptr;
 		m_SharedRoutingPath = path;
 	}
 
+	void GarlicRoutingSession::ConfirmSharedRoutingPath (std::shared_ptr<const i2p::tunnel::OutboundTunnel> outboundTunnel,
+		std::shared_ptr<const i2p::data::Lease> remoteLease, int rtt)
+	{
+		auto path = m_SharedRoutingPath;
+		if (!path || path->outboundTunnel != outboundTunnel || path->remoteLease != remoteLease) return; // replaced already
+		path->confirmationTime = i2p::util::GetSecondsSinceEpoch ();
+		path->numTimesUsed = 0;
+		if (rtt > 0) path->rtt = path->rtt > 0 ? (path->rtt*7 + rtt)/8 : rtt;
+	}
+
 	GarlicRoutingSession::UnconfirmedTags * GarlicRoutingSession::GenerateSessionTags ()
 	{
 		auto tags = new UnconfirmedTags (m_NumTags);
@@ -78,6 +94,14 @@ namespace garlic
 		return tags;
 	}
 
+	bool GarlicRoutingSession::IsTagsConfirmationPending (uint32_t ts) const
+	{
+		for (const auto& it: m_UnconfirmedTagsMsgs)
+			if (ts < it.second->tagsCreationTime + OUTGOING_TAGS_CONFIRMATION_TIMEOUT)
+				return true;
+		return false;
+	}
+
 	void GarlicRoutingSession::MessageConfirmed (uint32_t msgID)
 	{
 		TagsConfirmed (msgID);
@@ -148,6 +172,11 @@ namespace garlic
 	}
 
 	std::shared_ptr<I2NPMessage> GarlicRoutingSession::WrapSingleMessage (std::shared_ptr<const I2NPMessage> msg)
+	{
+		return WrapMessages (std::vector<std::shared_ptr<const I2NPMessage> > { msg });
+	}
+
+	std::shared_ptr<I2NPMessage> GarlicRoutingSession::WrapMessages (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs)
 	{
 		auto m = NewI2NPMessage ();
 		m->Align (12); // in order to get buf aligned to 16 (12 + 4)
@@ -206,17 +235,22 @@ namespace garlic
 			len += 32;
 		}
 		// AES block
-		len += CreateAESBlock (buf, msg);
+		len += CreateAESBlock (buf, msgs);
 		htobe32buf (m->GetPayload (), len);
 		m->len += len + 4;
 		m->FillI2NPMessageHeader (eI2NPGarlic);
 		return m;
 	}
 
-	size_t GarlicRoutingSession::CreateAESBlock (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg)
+	size_t GarlicRoutingSession::CreateAESBlock (uint8_t * buf, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs)
 	{
 		size_t blockSize = 0;
-		bool createNewTags = m_Owner && m_NumTags && ((int)m_SessionTags.size () <= m_NumTags*2/3);
+		// one batch of new tags at time, otherwise every message until DeliveryStatus comes back would carry tags and DeliveryStatus clove.
+		// refill earlier if LeaseSet goes with this message, since its DeliveryStatus confirms both
+		int numSessionTags = m_SessionTags.size ();
+		bool createNewTags = m_Owner && m_NumTags &&
+			(numSessionTags <= m_NumTags*2/3 || (m_LeaseSetUpdateStatus == eLeaseSetUpdated && numSessionTags < m_NumTags)) &&
+			!IsTagsConfirmationPending (i2p::util::GetSecondsSinceEpoch ());
 		UnconfirmedTags * newTags = createNewTags ? GenerateSessionTags () : nullptr;
 		htobuf16 (buf, newTags ? htobe16 (newTags->numTags) : 0); // tag count
 		blockSize += 2;
@@ -234,7 +268,7 @@ namespace garlic
 		blockSize += 32;
 		buf[blockSize] = 0; // flag
 		blockSize++;
-		size_t len = CreateGarlicPayload (buf + blockSize, msg, newTags);
+		size_t len = CreateGarlicPayload (buf + blockSize, msgs, newTags);
 		htobe32buf (payloadSize, len);
 		SHA256(buf + blockSize, len, payloadHash);
 		blockSize += len;
@@ -245,11 +279,11 @@ namespace garlic
 		return blockSize;
 	}
 
-	size_t GarlicRoutingSession::CreateGarlicPayload (uint8_t * payload, std::shared_ptr<const I2NPMessage> msg, UnconfirmedTags * newTags)
+	size_t GarlicRoutingSession::CreateGarlicPayload (uint8_t * payload, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, UnconfirmedTags * newTags)
 	{
 		uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
 		uint32_t msgID;
-		RAND_bytes ((uint8_t *)&msgID, 4);
+		msgID = i2p::crypto::RandUint32 ();
 		size_t size = 0;
 		uint8_t * numCloves = payload + size;
 		*numCloves = 0;
@@ -297,11 +331,12 @@ namespace garlic
 				(*numCloves)++;
 			}
 		}
-		if (msg) // clove message ifself if presented
-		{
-			size += CreateGarlicClove (payload + size, msg, m_Destination ? m_Destination->IsDestination () : false);
-			(*numCloves)++;
-		}
+		for (const auto& msg: msgs)
+			if (msg) // clove message ifself if presented
+			{
+				size += CreateGarlicClove (payload + size, msg, m_Destination ? m_Destination->IsDestination () : false);
+				(*numCloves)++;
+			}
 		memset (payload + size, 0, 3); // certificate of message
 		size += 3;
 		htobe32buf (payload + size, msgID); // MessageID
@@ -333,7 +368,7 @@ namespace garlic
 		memcpy (buf + size, msg->GetBuffer (), msg->GetLength ());
 		size += msg->GetLength ();
 		uint32_t cloveID;
-		RAND_bytes ((uint8_t *)&cloveID, 4);
+		cloveID = i2p::crypto::RandUint32 ();
 		htobe32buf (buf + size, cloveID); // CloveID
 		size += 4;
 		htobe64buf (buf + size, ts); // Expiration of clove
@@ -375,7 +410,7 @@ namespace garlic
 				// fill clove
 				uint64_t ts = i2p::util::GetMillisecondsSinceEpoch () + 8000; // 8 sec
 				uint32_t cloveID;
-				RAND_bytes ((uint8_t *)&cloveID, 4);
+				cloveID = i2p::crypto::RandUint32 ();
 				htobe32buf (buf + size, cloveID); // CloveID
 				size += 4;
 				htobe64buf (buf + size, ts); // Expiration of clove
@@ -407,13 +442,63 @@ namespace garlic
 		m_Sessions.clear ();
 		m_DeliveryStatusSessions.clear ();
 		m_Tags.clear ();
+		m_TagsExpirationBuckets.clear ();
+		m_IncomingKeys.clear ();
+		m_IncomingKeysNumRefs.clear ();
+		m_FreeIncomingKeys.clear ();
+	}
+
+	uint32_t GarlicDestination::CreateIncomingKey (const uint8_t * key)
+	{
+		uint32_t keyIndex;
+		if (!m_FreeIncomingKeys.empty ())
+		{
+			keyIndex = m_FreeIncomingKeys.back ();
+			m_FreeIncomingKeys.pop_back ();
+			m_IncomingKeys[keyIndex].reset (new AESDecryption (key));
+			m_IncomingKeysNumRefs[keyIndex] = 1;
+		}
+		else
+		{
+			keyIndex = m_IncomingKeys.size ();
+			m_IncomingKeys.emplace_back (new AESDecryption (key));
+			m_IncomingKeysNumRefs.push_back (1);
+		}
+		return keyIndex;
+	}
+
+	void GarlicDestination::ReleaseIncomingKey (uint32_t keyIndex)
+	{
+		if (keyIndex >= m_IncomingKeysNumRefs.size () || !m_IncomingKeysNumRefs[keyIndex]) return;
+		if (!--m_IncomingKeysNumRefs[keyIndex])
+		{
+			m_IncomingKeys[keyIndex] = nullptr;
+			m_FreeIncomingKeys.push_back (keyIndex);
+		}
 	}
+
+	void GarlicDestination::AddIncomingTag (const SessionTag& tag, uint32_t keyIndex)
+	{
+		m_IncomingKeysNumRefs[keyIndex]++;
+		auto ret = m_Tags.insert (std::make_pair (tag, keyIndex));
+		if (ret.second)
+			m_TagsExpirationBuckets[tag.creationTime/INCOMING_TAGS_EXPIRATION_BUCKET_DURATION].push_back (tag);
+		else
+		{
+			// keep original creation time
+			ReleaseIncomingKey (ret.first->second);
+			ret.first->second = keyIndex;
+		}
+	}
+
 	void GarlicDestination::AddSessionKey (const uint8_t * key, const uint8_t * tag)
 	{
 		if (key)
 		{
 			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-			m_Tags[SessionTag(tag, ts)] = std::make_shared<AESDecryption>(key);
+			auto keyIndex = CreateIncomingKey (key);
+			AddIncomingTag (SessionTag(tag, ts), keyIndex);
+			ReleaseIncomingKey (keyIndex);
 		}
 	}
 
@@ -433,42 +518,72 @@ namespace garlic
 			return;
 		}
 		buf += 4; // length
-		auto it = m_Tags.find (SessionTag(buf));
-		if (it != m_Tags.end ())
+		if (!HandleTaggedGarlicMessage (buf, length, msg->from))
 		{
-			// tag found. Use AES
-			auto decryption = it->second;
-			m_Tags.erase (it); // tag might be used only once
-			if (length >= 32)
+			// tag not found. Use ElGamal
+			i2p::metrics::garlicTagsMisses.Inc ();
+			if (length < 514)
 			{
-				uint8_t iv[32]; // IV is first 16 bytes
-				SHA256(buf, 32, iv);
-				decryption->SetIV (iv);
-				decryption->Decrypt (buf + 32, length - 32, buf + 32);
-				HandleAESBlock (buf + 32, length - 32, decryption, msg->from);
+				LogPrint (eLogError, "Garlic: Failed to decrypt message");
+				return;
 			}
-			else
-				LogPrint (eLogWarning, "Garlic: message length ", length, " is less than 32 bytes");
+			if (!SubmitElGamalDecryption (msg))
+			{
+				ElGamalBlock elGamal;
+				bool isDecrypted;
+				{
+					i2p::metrics::ScopedTimer timer (i2p::metrics::garlicElGamalDecryptionTime);
+					isDecrypted = Decrypt (buf, (uint8_t *)&elGamal, m_Ctx);
+				}
+				HandleElGamalBlock (msg, elGamal, isDecrypted);
+			}
+		}
+	}
+
+	bool GarlicDestination::HandleTaggedGarlicMessage (uint8_t * buf, uint32_t length, std::shared_ptr<i2p::tunnel::InboundTunnel> from)
+	{
+		auto it = m_Tags.find (SessionTag(buf));
+		if (it == m_Tags.end ()) return false;
+		// tag found. Use AES
+		i2p::metrics::garlicTagsHits.Inc ();
+		auto keyIndex = it->second; // tag's reference is held until the block is handled
+		m_Tags.erase (it); // tag might be used only once
+		if (length >= 32)
+		{
+			uint8_t iv[32]; // IV is first 16 bytes
+			SHA256(buf, 32, iv);
+			auto& decryption = m_IncomingKeys[keyIndex];
+			decryption->SetIV (iv);
+			decryption->Decrypt (buf + 32, length - 32, buf + 32);
+			HandleAESBlock (buf + 32, length - 32, keyIndex, from);
 		}
 		else
+			LogPrint (eLogWarning, "Garlic: message length ", length, " is less than 32 bytes");
+		ReleaseIncomingKey (keyIndex);
+		return true;
+	}
+
+	void GarlicDestination::HandleElGamalBlock (std::shared_ptr<I2NPMessage> msg, const ElGamalBlock& elGamal, bool isDecrypted)
+	{
+		uint8_t * buf = msg->GetPayload ();
+		uint32_t length = bufbe32toh (buf);
+		buf += 4; // length
+		if (isDecrypted)
 		{
-			// tag not found. Use ElGamal
-			ElGamalBlock elGamal;
-			if (length >= 514 && Decrypt (buf, (uint8_t *)&elGamal, m_Ctx))
-			{
-				auto decryption = std::make_shared<AESDecryption>(elGamal.sessionKey);
-				uint8_t iv[32]; // IV is first 16 bytes
-				SHA256(elGamal.preIV, 32, iv);
-				decryption->SetIV (iv);
-				decryption->Decrypt(buf + 514, length - 514, buf + 514);
-				HandleAESBlock (buf + 514, length - 514, decryption, msg->from);
-			}
-			else
-				LogPrint (eLogError, "Garlic: Failed to decrypt message");
+			auto keyIndex = CreateIncomingKey (elGamal.sessionKey);
+			uint8_t iv[32]; // IV is first 16 bytes
+			SHA256(elGamal.preIV, 32, iv);
+			auto& decryption = m_IncomingKeys[keyIndex];
+			decryption->SetIV (iv);
+			decryption->Decrypt(buf + 514, length - 514, buf + 514);
+			HandleAESBlock (buf + 514, length - 514, keyIndex, msg->from);
+			ReleaseIncomingKey (keyIndex);
 		}
+		else if (!HandleTaggedGarlicMessage (buf, length, msg->from)) // tag might have arrived during decryption
+			LogPrint (eLogError, "Garlic: Failed to decrypt message");
 	}
 
-	void GarlicDestination::HandleAESBlock (uint8_t * buf, size_t len, std::shared_ptr<AESDecryption> decryption,
+	void GarlicDestination::HandleAESBlock (uint8_t * buf, size_t len, uint32_t keyIndex,
 		std::shared_ptr<i2p::tunnel::InboundTunnel> from)
 	{
 		uint16_t tagCount = bufbe16toh (buf);
@@ -482,7 +597,7 @@ namespace garlic
 			}
 			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
 			for (int i = 0; i < tagCount; i++)
-				m_Tags[SessionTag(buf + i*32, ts)] = decryption;
+				AddIncomingTag (SessionTag(buf + i*32, ts), keyIndex);
 		}
 		buf += tagCount*32;
 		len -= tagCount*32;
@@ -640,7 +755,7 @@ namespace garlic
 	{
 		GarlicRoutingSessionPtr session;
 		{
-			std::unique_lock<std::mutex> l(m_SessionsMutex);
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
 			auto it = m_Sessions.find (destination->GetIdentHash ());
 			if (it != m_Sessions.end ())
 				session = it->second;
@@ -649,7 +764,7 @@ namespace garlic
 		{
 			session = std::make_shared<GarlicRoutingSession> (this, destination,
 				attachLeaseSet ? m_NumTags : 4, attachLeaseSet); // specified num tags for connections and 4 for LS requests
-			std::unique_lock<std::mutex> l(m_SessionsMutex);
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
 			m_Sessions[destination->GetIdentHash ()] = session;
 		}
 		return session;
@@ -660,22 +775,32 @@ namespace garlic
 		// incoming
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
 		int numExpiredTags = 0;
-		for (auto it = m_Tags.begin (); it != m_Tags.end ();)
+		// drop whole buckets, tags used already are not in m_Tags anymore
+		for (auto it = m_TagsExpirationBuckets.begin (); it != m_TagsExpirationBuckets.end ();)
 		{
-			if (ts > it->first.creationTime + INCOMING_TAGS_EXPIRATION_TIMEOUT)
+			if (ts > (it->first + 1)*INCOMING_TAGS_EXPIRATION_BUCKET_DURATION + INCOMING_TAGS_EXPIRATION_TIMEOUT)
 			{
-				numExpiredTags++;
-				it = m_Tags.erase (it);
+				for (const auto& tag: it->second)
+				{
+					auto it1 = m_Tags.find (tag);
+					if (it1 != m_Tags.end () && it1->first.creationTime == tag.creationTime)
+					{
+						numExpiredTags++;
+						ReleaseIncomingKey (it1->second);
+						m_Tags.erase (it1);
+					}
+				}
+				it = m_TagsExpirationBuckets.erase (it);
 			}
 			else
-				++it;
+				break; // sorted by time
 		}
 		if (numExpiredTags > 0)
 			LogPrint (eLogDebug, "Garlic: ", numExpiredTags, " tags expired for ", GetIdentHash().ToBase64 ());
 
 		// outgoing
 		{
-			std::unique_lock<std::mutex> l(m_SessionsMutex);
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
 			for (auto it = m_Sessions.begin (); it != m_Sessions.end ();)
 			{
 				it->second->GetSharedRoutingPath (); // delete shared path if necessary
@@ -714,9 +839,8 @@ namespace garlic
 		m_DeliveryStatusSessions[msgID] = session;
 	}
 
-	void GarlicDestination::HandleDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg)
+	void GarlicDestination::HandleDeliveryStatusMessage (uint32_t msgID)
 	{
-		uint32_t msgID = bufbe32toh (msg->GetPayload ());
 		GarlicRoutingSessionPtr session;
 		{
 			std::unique_lock<std::mutex> l(m_DeliveryStatusSessionsMutex);
@@ -736,7 +860,7 @@ namespace garlic
 
 	void GarlicDestination::SetLeaseSetUpdated ()
 	{
-		std::unique_lock<std::mutex> l(m_SessionsMutex);
+		i2p::metrics::ProfiledLock l(m_SessionsMutex);
 		for (auto& it: m_Sessions)
 			it.second->SetLeaseSetUpdated ();
 	}
@@ -748,7 +872,7 @@ namespace garlic
 
 	void GarlicDestination::ProcessDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg)
 	{
-		HandleDeliveryStatusMessage (msg);
+		HandleDeliveryStatusMessage (bufbe32toh (msg->GetPayload () + DELIVERY_STATUS_MSGID_OFFSET));
 	}
 
 	void GarlicDestination::SaveTags ()
@@ -759,13 +883,13 @@ namespace garlic
 		std::ofstream f (path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
 		// 4 bytes timestamp, 32 bytes tag, 32 bytes key
-		for (auto it: m_Tags)
+		for (const auto& it: m_Tags)
 		{
 			if (ts < it.first.creationTime + INCOMING_TAGS_EXPIRATION_TIMEOUT)
 			{
 				f.write ((char *)&it.first.creationTime, 4);
 				f.write ((char *)it.first.data (), 32);
-				f.write ((char *)it.second->GetKey ().data (), 32);
+				f.write ((char *)m_IncomingKeys[it.second]->GetKey ().data (), 32);
 			}
 		}
 	}
@@ -781,7 +905,7 @@ namespace garlic
 			std::ifstream f (path, std::ifstream::binary);
 			if (f)
 			{
-				std::map<i2p::crypto::AESKey, std::shared_ptr<AESDecryption> > keys;
+				std::map<i2p::crypto::AESKey, uint32_t> keys; // key -> index
 				// 4 bytes timestamp, 32 bytes tag, 32 bytes key
 				while (!f.eof ())
 				{
@@ -797,14 +921,19 @@ namespace garlic
 						f.seekg (64, std::ios::cur); // skip
 					if (f.eof ()) break;
 
-					std::shared_ptr<AESDecryption> decryption;
+					uint32_t keyIndex;
 					auto it = keys.find (key);
 					if (it != keys.end ())
-						decryption = it->second;
+						keyIndex = it->second;
 					else
-						decryption = std::make_shared<AESDecryption>(key);
-					m_Tags.insert (std::make_pair (SessionTag (tag, ts), decryption));
+					{
+						keyIndex = CreateIncomingKey (key);
+						keys.emplace (key, keyIndex);
+					}
+					AddIncomingTag (SessionTag (tag, ts), keyIndex);
 				}
+				for (auto& it: keys)
+					ReleaseIncomingKey (it.second);
 				if (!m_Tags.empty ())
 					LogPrint (eLogInfo, m_Tags.size (), " loaded for ", ident);
 			}
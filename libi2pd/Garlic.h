@@ -3,6 +3,8 @@
 
 #include <inttypes.h>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <list>
 #include <string>
 #include <thread>
@@ -13,6 +15,7 @@
 #include "LeaseSet.h"
 #include "Queue.h"
 #include "Identity.h"
+#include "Metrics.h"
 
 namespace i2p
 {
@@ -40,11 +43,13 @@ namespace garlic
 	};
 
 	const int INCOMING_TAGS_EXPIRATION_TIMEOUT = 960; // 16 minutes
+	const int INCOMING_TAGS_EXPIRATION_BUCKET_DURATION = 60; // 1 minute
 	const int OUTGOING_TAGS_EXPIRATION_TIMEOUT = 720; // 12 minutes
 	const int OUTGOING_TAGS_CONFIRMATION_TIMEOUT = 10; // 10 seconds
 	const int LEASET_CONFIRMATION_TIMEOUT = 4000; // in milliseconds
-	const int ROUTING_PATH_EXPIRATION_TIMEOUT = 30; // 30 seconds
-	const int ROUTING_PATH_MAX_NUM_TIMES_USED = 100; // how many times might be used
+	const int ROUTING_PATH_EXPIRATION_TIMEOUT = 30; // 30 seconds since set or last confirmed
+	const int ROUTING_PATH_MAX_EXPIRATION_TIMEOUT = 300; // 5 minutes, for path confirmed all the time
+	const int ROUTING_PATH_MAX_NUM_TIMES_USED = 100; // how many times might be used without confirmation
 
 	struct SessionTag: public i2p::data::Tag<32>
 	{
@@ -59,6 +64,11 @@ namespace garlic
 		uint32_t creationTime; // seconds since epoch
 	};
 
+	struct SessionTagHash
+	{
+		size_t operator() (const SessionTag& tag) const { return tag.GetLL ()[0]; }; // tags are random
+	};
+
 	// AESDecryption is associated with session tags and store key
 	class AESDecryption: public i2p::crypto::CBCDecryption
 	{
@@ -81,7 +91,8 @@ namespace garlic
 		std::shared_ptr<const i2p::data::Lease> remoteLease;
 		int rtt; // RTT
 		uint32_t updateTime; // seconds since epoch
-		int numTimesUsed;
+		int numTimesUsed; // since last confirmation
+		uint32_t confirmationTime; // seconds since epoch, 0 if never confirmed
 	};
 
 	class GarlicDestination;
@@ -112,6 +123,7 @@ namespace garlic
 			GarlicRoutingSession (const uint8_t * sessionKey, const SessionTag& sessionTag); // one time encryption
 			~GarlicRoutingSession ();
 			std::shared_ptr<I2NPMessage> WrapSingleMessage (std::shared_ptr<const I2NPMessage> msg);
+			std::shared_ptr<I2NPMessage> WrapMessages (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs); // clove per message
 			void MessageConfirmed (uint32_t msgID);
 			bool CleanupExpiredTags (); // returns true if something left
 			bool CleanupUnconfirmedTags (); // returns true if something has been deleted
@@ -126,19 +138,22 @@ namespace garlic
 
 			std::shared_ptr<GarlicRoutingPath> GetSharedRoutingPath ();
 			void SetSharedRoutingPath (std::shared_ptr<GarlicRoutingPath> path);
+			void ConfirmSharedRoutingPath (std::shared_ptr<const i2p::tunnel::OutboundTunnel> outboundTunnel,
+				std::shared_ptr<const i2p::data::Lease> remoteLease, int rtt = 0); // extends path if it's still shared, rtt 0 if unknown
 
 			const GarlicDestination * GetOwner () const { return m_Owner; }
 			void SetOwner (GarlicDestination * owner) { m_Owner = owner; }
 
 		private:
 
-			size_t CreateAESBlock (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg);
-			size_t CreateGarlicPayload (uint8_t * payload, std::shared_ptr<const I2NPMessage> msg, UnconfirmedTags * newTags);
+			size_t CreateAESBlock (uint8_t * buf, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs);
+			size_t CreateGarlicPayload (uint8_t * payload, const std::vector<std::shared_ptr<const I2NPMessage> >& msgs, UnconfirmedTags * newTags);
 			size_t CreateGarlicClove (uint8_t * buf, std::shared_ptr<const I2NPMessage> msg, bool isDestination);
 			size_t CreateDeliveryStatusClove (uint8_t * buf, uint32_t msgID);
 
 			void TagsConfirmed (uint32_t msgID);
 			UnconfirmedTags * GenerateSessionTags ();
+			bool IsTagsConfirmationPending (uint32_t ts) const; // new tags were sent and not expected to be lost yet
 
 		private:
 
@@ -195,26 +210,36 @@ namespace garlic
 		protected:
 
 			void HandleGarlicMessage (std::shared_ptr<I2NPMessage> msg);
-			void HandleDeliveryStatusMessage (std::shared_ptr<I2NPMessage> msg);
+			void HandleDeliveryStatusMessage (uint32_t msgID);
+			// ElGamal block of a message without known tag
+			virtual bool SubmitElGamalDecryption (std::shared_ptr<I2NPMessage> msg) { return false; }; // false if must be decrypted in place
+			void HandleElGamalBlock (std::shared_ptr<I2NPMessage> msg, const ElGamalBlock& elGamal, bool isDecrypted);
 
 			void SaveTags ();
 			void LoadTags ();
 
 		private:
 
-			void HandleAESBlock (uint8_t * buf, size_t len, std::shared_ptr<AESDecryption> decryption,
+			bool HandleTaggedGarlicMessage (uint8_t * buf, uint32_t length, std::shared_ptr<i2p::tunnel::InboundTunnel> from); // false if tag not found
+			void HandleAESBlock (uint8_t * buf, size_t len, uint32_t keyIndex,
 				std::shared_ptr<i2p::tunnel::InboundTunnel> from);
 			void HandleGarlicPayload (uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from);
+			uint32_t CreateIncomingKey (const uint8_t * key); // returns index with one reference
+			void ReleaseIncomingKey (uint32_t keyIndex);
+			void AddIncomingTag (const SessionTag& tag, uint32_t keyIndex);
 
 		private:
 
 			BN_CTX * m_Ctx; // incoming
 			// outgoing sessions
 			int m_NumTags;
-			std::mutex m_SessionsMutex;
-			std::map<i2p::data::IdentHash, GarlicRoutingSessionPtr> m_Sessions;
+			i2p::metrics::ProfiledMutex m_SessionsMutex { "garlic.sessions" };
+			std::unordered_map<i2p::data::IdentHash, GarlicRoutingSessionPtr> m_Sessions;
 			// incoming
-			std::map<SessionTag, std::shared_ptr<AESDecryption> > m_Tags;
+			std::vector<std::unique_ptr<AESDecryption> > m_IncomingKeys; // shared by tags of the same session
+			std::vector<uint32_t> m_IncomingKeysNumRefs, m_FreeIncomingKeys;
+			std::unordered_map<SessionTag, uint32_t, SessionTagHash> m_Tags; // tag -> index in m_IncomingKeys
+			std::map<uint32_t, std::vector<SessionTag> > m_TagsExpirationBuckets; // creation time/bucket duration -> tags
 			// DeliveryStatus
 			std::mutex m_DeliveryStatusSessionsMutex;
 			std::map<uint32_t, GarlicRoutingSessionPtr> m_DeliveryStatusSessions; // msgID -> session
@@ -22,6 +22,7 @@ namespace crypto
 		EC_POINT_set_affine_coordinates_GFp (m_Group, P, x, y, ctx);
 		EC_GROUP_set_generator (m_Group, P, q, nullptr);
 		EC_GROUP_set_curve_name (m_Group, NID_id_GostR3410_2001);
+		EC_GROUP_precompute_mult (m_Group, ctx); // wNAF table of P for z1*P + z2*pub
 		EC_POINT_free(P);
 		BN_CTX_free (ctx);
 	}
@@ -9,6 +9,10 @@
 #include <inttypes.h>
 #include <string.h> /* memset */
 #include <iostream>
+#include <memory>
+#ifdef USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
 #include "Log.h"
 #include "Gzip.h"
 
@@ -31,6 +35,9 @@ namespace data
 
 	size_t GzipInflator::Inflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
 	{
+#ifdef USE_LIBDEFLATE
+		return GzipInflate (in, inLen, out, outLen);
+#else
 		if (m_IsDirty) inflateReset (&m_Inflator);
 		m_IsDirty = true;
 		m_Inflator.next_in = const_cast<uint8_t *>(in);
@@ -43,6 +50,7 @@ namespace data
 		// else
 		LogPrint (eLogError, "Gzip: Inflate error ", err);
 		return 0;
+#endif
 	}
 
 	void GzipInflator::Inflate (const uint8_t * in, size_t inLen, std::ostream& os)
@@ -80,26 +88,74 @@ namespace data
 		delete[] buf;
 	}
 
-	GzipDeflator::GzipDeflator (): m_IsDirty (false)
+#ifdef USE_LIBDEFLATE
+	GzipDeflator::GzipDeflator (): m_Level (Z_DEFAULT_COMPRESSION)
 	{
-		memset (&m_Deflator, 0, sizeof (m_Deflator));
-		deflateInit2 (&m_Deflator, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // 15 + 16 sets gzip
 	}
 
 	GzipDeflator::~GzipDeflator ()
 	{
-		deflateEnd (&m_Deflator);
 	}
 
-	void GzipDeflator::SetCompressionLevel (int level)
+	size_t GzipDeflator::Deflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
+	{
+		return GzipDeflate (in, inLen, out, outLen, m_Level);
+	}
+
+	struct LibdeflateDeleter
+	{
+		void operator()(libdeflate_compressor * c) const { libdeflate_free_compressor (c); };
+		void operator()(libdeflate_decompressor * d) const { libdeflate_free_decompressor (d); };
+	};
+
+	size_t GzipDeflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen, int level)
+	{
+		if (level == Z_DEFAULT_COMPRESSION) level = 6; // same as zlib
+		if (level < 0 || level > 9) level = 6;
+		static thread_local std::unique_ptr<libdeflate_compressor, LibdeflateDeleter> compressors[10];
+		auto& compressor = compressors[level];
+		if (!compressor) compressor.reset (libdeflate_alloc_compressor (level));
+		if (!compressor) return 0;
+		size_t size = libdeflate_gzip_compress (compressor.get (), in, inLen, out, outLen);
+		if (!size)
+			LogPrint (eLogError, "Gzip: Deflate error, no room for ", inLen, " bytes");
+		return size;
+	}
+
+	size_t GzipInflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
+	{
+		static thread_local std::unique_ptr<libdeflate_decompressor, LibdeflateDeleter> decompressor;
+		if (!decompressor) decompressor.reset (libdeflate_alloc_decompressor ());
+		if (!decompressor) return 0;
+		size_t size = 0;
+		auto err = libdeflate_gzip_decompress (decompressor.get (), in, inLen, out, outLen, &size);
+		if (err == LIBDEFLATE_SUCCESS)
+			return size;
+		LogPrint (eLogError, "Gzip: Inflate error ", (int)err);
+		return 0;
+	}
+#else
+	GzipDeflator::GzipDeflator (): m_IsDirty (false), m_StreamLevel (Z_DEFAULT_COMPRESSION), m_Level (Z_DEFAULT_COMPRESSION)
+	{
+		memset (&m_Deflator, 0, sizeof (m_Deflator));
+		deflateInit2 (&m_Deflator, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // 15 + 16 sets gzip
+	}
+
+	GzipDeflator::~GzipDeflator ()
 	{
-		deflateParams (&m_Deflator, level, Z_DEFAULT_STRATEGY);
+		deflateEnd (&m_Deflator);
 	}
 
 	size_t GzipDeflator::Deflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
 	{
 		if (m_IsDirty) deflateReset (&m_Deflator);
 		m_IsDirty = true;
+		if (m_Level != m_StreamLevel)
+		{
+			// stream is fresh, nothing to flush
+			deflateParams (&m_Deflator, m_Level, Z_DEFAULT_STRATEGY);
+			m_StreamLevel = m_Level;
+		}
 		m_Deflator.next_in = const_cast<uint8_t *>(in);
 		m_Deflator.avail_in = inLen;
 		m_Deflator.next_out = out;
@@ -111,5 +167,19 @@ namespace data
 		LogPrint (eLogError, "Gzip: Deflate error ", err);
 		return 0;
 	}
+
+	size_t GzipDeflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen, int level)
+	{
+		static thread_local GzipDeflator deflator;
+		deflator.SetCompressionLevel (level);
+		return deflator.Deflate (in, inLen, out, outLen);
+	}
+
+	size_t GzipInflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen)
+	{
+		static thread_local GzipInflator inflator;
+		return inflator.Inflate (in, inLen, out, outLen);
+	}
+#endif
 } // data
 } // i2p
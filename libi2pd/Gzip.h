@@ -30,13 +30,46 @@ namespace data {
 			GzipDeflator ();
 			~GzipDeflator ();
 
-			void SetCompressionLevel (int level);
+			void SetCompressionLevel (int level) { m_Level = level; }; // applied at next Deflate
 			size_t Deflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen);
 
 		private:
 
+#ifndef USE_LIBDEFLATE
 			z_stream m_Deflator;
 			bool m_IsDirty;
+			int m_StreamLevel;
+#endif
+			int m_Level;
+	};
+
+	/** @brief whole buffer with state kept per thread and reset between calls,
+	 *  through libdeflate if built with USE_LIBDEFLATE. Return 0 on error */
+	size_t GzipDeflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen, int level = Z_DEFAULT_COMPRESSION);
+	size_t GzipInflate (const uint8_t * in, size_t inLen, uint8_t * out, size_t outLen);
+
+	const int GZIP_INCOMPRESSIBLE_SKIP_COUNT = 64; // payloads stored after one compressed less than 10%
+
+	/** @brief skips compression of a run of payloads after one didn't compress, encrypted or media flows mostly */
+	class IncompressibleSkipper
+	{
+		public:
+
+			IncompressibleSkipper (): m_NumToSkip (0) {};
+			bool Skip () // true if next payload should be stored
+			{
+				if (m_NumToSkip <= 0) return false;
+				m_NumToSkip--;
+				return true;
+			};
+			void Compressed (size_t len, size_t compressedLen) // after compression was tried
+			{
+				if (compressedLen*10 > len*9) m_NumToSkip = GZIP_INCOMPRESSIBLE_SKIP_COUNT;
+			};
+
+		private:
+
+			int m_NumToSkip;
 	};
 } // data
 } // i2p
@@ -231,55 +231,53 @@ namespace http {
     headers.erase(name);
   }
 
-  int HTTPReq::parse(const char *buf, size_t len) {
-    std::string str(buf, len);
-    return parse(str);
+  std::size_t find_eoh(const char *buf, std::size_t len, std::size_t from) {
+    const char * end = buf + len;
+    const char * eoh = std::search(buf + std::min (from, len), end, HTTP_EOH, HTTP_EOH + strlen(HTTP_EOH));
+    return eoh != end ? eoh - buf : std::string::npos;
   }
 
-  int HTTPReq::parse(const std::string& str) {
-    enum { REQ_LINE, HEADER_LINE } expect = REQ_LINE;
-    std::size_t eoh = str.find(HTTP_EOH); /* request head size */
-    std::size_t eol = 0, pos = 0;
-    URL url;
-
+  int HTTPReq::parse(const char *buf, size_t len) {
+    /* works on buf in place, only resulting fields are copied */
+    std::size_t eoh = find_eoh(buf, len); /* request head size */
     if (eoh == std::string::npos)
-      return 0; /* str not contains complete request */
-
-    while ((eol = str.find(CRLF, pos)) != std::string::npos) {
-      if (expect == REQ_LINE) {
-        std::string line = str.substr(pos, eol - pos);
-        std::vector<std::string> tokens;
-        strsplit(line, tokens, ' ');
-        if (tokens.size() != 3)
-          return -1;
-        if (!is_http_method(tokens[0]))
-          return -1;
-        if (!is_http_version(tokens[2]))
-          return -1;
-        if (!url.parse(tokens[1]))
-          return -1;
-        /* all ok */
-        method  = tokens[0];
-        uri     = tokens[1];
-        version = tokens[2];
-        expect = HEADER_LINE;
-      }
-	  else
-	  {
-        std::string line = str.substr(pos, eol - pos);
-        auto p = parse_header_line(line);
-		if (p.first.length () > 0)
-			headers.push_back (p);
-		else
-            return -1;
-      }
+      return 0; /* buf not contains complete request */
+
+    const char * end = buf + eoh + strlen(CRLF); /* including last CRLF */
+    const char * eol = std::search(buf, end, CRLF, CRLF + strlen(CRLF));
+    /* request line: method, uri and version separated by single space */
+    const char * sp1 = std::find(buf, eol, ' ');
+    const char * sp2 = sp1 != eol ? std::find(sp1 + 1, eol, ' ') : eol;
+    if (sp2 == eol || std::find(sp2 + 1, eol, ' ') != eol)
+      return -1;
+    std::string m(buf, sp1), u(sp1 + 1, sp2), v(sp2 + 1, eol);
+    URL url;
+    if (!is_http_method(m) || !is_http_version(v) || !url.parse(u))
+      return -1;
+    /* all ok */
+    method  = std::move(m);
+    uri     = std::move(u);
+    version = std::move(v);
+
+    const char * pos = eol + strlen(CRLF);
+    while (pos < end) {
+      eol = std::search(pos, end, CRLF, CRLF + strlen(CRLF));
+      const char * colon = std::search(pos, eol, HTTP_HDR_SEP, HTTP_HDR_SEP + strlen(HTTP_HDR_SEP));
+      if (colon == eol || colon == pos)
+        return -1;
+      const char * value = colon + strlen(HTTP_HDR_SEP);
+      while (value < eol && isspace(*value))
+        value++;
+      headers.push_back (std::make_pair(std::string(pos, colon), std::string(value, eol)));
       pos = eol + strlen(CRLF);
-      if (pos >= eoh)
-        break;
     }
     return eoh + strlen(HTTP_EOH);
   }
 
+  int HTTPReq::parse(const std::string& str) {
+    return parse(str.data(), str.length());
+  }
+
   void HTTPReq::write(std::ostream & o)
   {
 	  o << method << " " << uri << " " << version << CRLF;
@@ -288,11 +286,23 @@ namespace http {
 	  o << CRLF;
   }
 
+	void HTTPReq::write(std::string & out)
+	{
+		std::size_t len = method.length() + uri.length() + version.length() + 4;
+		for (auto & h : headers)
+			len += h.first.length() + h.second.length() + 4;
+		out.reserve(out.length() + len + 2);
+		out.append(method).append(" ").append(uri).append(" ").append(version).append(CRLF);
+		for (auto & h : headers)
+			out.append(h.first).append(": ").append(h.second).append(CRLF);
+		out.append(CRLF);
+	}
+
 	std::string HTTPReq::to_string()
 	{
-		std::stringstream ss;
-		write(ss);
-		return ss.str();
+		std::string s;
+		write(s);
+		return s;
 	}
 
 	void HTTPReq::AddHeader (const std::string& name, const std::string& value)
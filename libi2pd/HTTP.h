@@ -22,6 +22,7 @@ namespace http
 {
   const char CRLF[] = "\r\n";         /**< HTTP line terminator */
   const char HTTP_EOH[] = "\r\n\r\n"; /**< HTTP end-of-headers mark */
+  const char HTTP_HDR_SEP[] = ": ";    /**< HTTP header name/value separator */
   extern const std::vector<std::string> HTTP_METHODS;  /**< list of valid HTTP methods */
   extern const std::vector<std::string> HTTP_VERSIONS; /**< list of valid HTTP versions */
 
@@ -95,6 +96,7 @@ namespace http
     /** @brief Serialize HTTP request to string */
     std::string to_string();
 		void write(std::ostream & o);
+		void write(std::string & out); // appends to out
 
 	void AddHeader (const std::string& name, const std::string& value);
 	void UpdateHeader (const std::string& name, const std::string& value);
@@ -159,6 +161,15 @@ namespace http
    */
   std::string UrlDecode(const std::string& data, bool null = false);
 
+  /**
+   * @brief Looks for end of headers in buffer without copying it
+   * @param buf Buffer with received data
+   * @param len Length of data in buffer
+   * @param from Offset to start search from, data before it was checked already
+   * @return Offset of end-of-headers mark or std::string::npos if not found
+   */
+  std::size_t find_eoh(const char *buf, std::size_t len, std::size_t from = 0);
+
   /**
    * @brief Merge HTTP response content with Transfer-Encoding: chunked
    * @param in  Input stream
@@ -1,5 +1,6 @@
 #include <string.h>
 #include <atomic>
+#include <mutex>
 #include "Base.h"
 #include "Log.h"
 #include "Crypto.h"
@@ -10,6 +11,9 @@
 #include "Tunnel.h"
 #include "Transports.h"
 #include "Garlic.h"
+#include "BloomFilter.h"
+#include "Siphash.h"
+#include "Metrics.h"
 #include "I2NPProtocol.h"
 #include "version.h"
 
@@ -17,34 +21,146 @@ using namespace i2p::transport;
 
 namespace i2p
 {
+	static int g_PoolsMaxFreeShift = 0;
+
+	// thread local free lists of message buffers of the same size
+	// buffers return to the pool of the thread releasing them, up to maxFree >> g_PoolsMaxFreeShift per thread
+	template<int sz, size_t maxFree>
+	class I2NPMessageBuffersPool
+	{
+		typedef I2NPMessageBuffer<sz> Buffer;
+
+		struct FreeList
+		{
+			std::vector<Buffer *> buffers;
+
+			FreeList () { buffers.reserve (maxFree); };
+			~FreeList ()
+			{
+				s_IsDestroyed = true;
+				for (auto it: buffers) delete it;
+				s_NumResident -= buffers.size ();
+			}
+		};
+
+		public:
+
+			static std::shared_ptr<I2NPMessage> Acquire ()
+			{
+				s_NumRequests++;
+				Buffer * b = nullptr;
+				auto freeList = GetFreeList ();
+				if (freeList && !freeList->buffers.empty ())
+				{
+					b = freeList->buffers.back ();
+					freeList->buffers.pop_back ();
+					s_NumResident--; s_NumHits++;
+					b->len = I2NP_HEADER_SIZE + 2; b->offset = 2; // same as I2NPMessage ()
+				}
+				else
+					b = new Buffer ();
+				return std::shared_ptr<I2NPMessage>(b, &Release);
+			}
+
+			static I2NPMessagePoolStats GetStats ()
+			{
+				return I2NPMessagePoolStats { sz, s_NumRequests, s_NumHits, s_NumResident };
+			}
+
+		private:
+
+			static void Release (I2NPMessage * msg)
+			{
+				auto b = static_cast<Buffer *>(msg);
+				b->from = nullptr;
+				b->traceTime = 0;
+				b->isTransit = false;
+				auto freeList = GetFreeList ();
+				if (freeList && freeList->buffers.size () < (maxFree >> g_PoolsMaxFreeShift))
+				{
+					freeList->buffers.push_back (b);
+					s_NumResident++;
+				}
+				else
+					delete b;
+			}
+
+			static FreeList * GetFreeList ()
+			{
+				if (s_IsDestroyed) return nullptr; // thread is exiting
+				static thread_local FreeList freeList;
+				return &freeList;
+			}
+
+		private:
+
+			static thread_local bool s_IsDestroyed;
+			static std::atomic<uint64_t> s_NumRequests, s_NumHits;
+			static std::atomic<int64_t> s_NumResident;
+	};
+
+	template<int sz, size_t maxFree>
+	thread_local bool I2NPMessageBuffersPool<sz, maxFree>::s_IsDestroyed = false;
+	template<int sz, size_t maxFree>
+	std::atomic<uint64_t> I2NPMessageBuffersPool<sz, maxFree>::s_NumRequests (0);
+	template<int sz, size_t maxFree>
+	std::atomic<uint64_t> I2NPMessageBuffersPool<sz, maxFree>::s_NumHits (0);
+	template<int sz, size_t maxFree>
+	std::atomic<int64_t> I2NPMessageBuffersPool<sz, maxFree>::s_NumResident (0);
+
+	typedef I2NPMessageBuffersPool<I2NP_MAX_MESSAGE_SIZE, 16> I2NPMessagesPool;
+	typedef I2NPMessageBuffersPool<I2NP_MAX_SHORT_MESSAGE_SIZE, 64> I2NPShortMessagesPool;
+	typedef I2NPMessageBuffersPool<I2NP_MAX_MEDIUM_MESSAGE_SIZE/4, 32> I2NP8KMessagesPool;
+	typedef I2NPMessageBuffersPool<I2NP_MAX_MEDIUM_MESSAGE_SIZE/2, 16> I2NP16KMessagesPool;
+	typedef I2NPMessageBuffersPool<I2NP_MAX_MEDIUM_MESSAGE_SIZE, 16> I2NP32KMessagesPool;
+	typedef I2NPMessageBuffersPool<i2p::tunnel::TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + 34, 256> I2NPTunnelMessagesPool; // reserved for alignment and NTCP 16 + 6 + 12
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_MESSAGE_SIZE> >();
+		return I2NPMessagesPool::Acquire ();
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ()
 	{
-		return std::make_shared<I2NPMessageBuffer<I2NP_MAX_SHORT_MESSAGE_SIZE> >();
+		return I2NPShortMessagesPool::Acquire ();
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage ()
 	{
-		auto msg = new I2NPMessageBuffer<i2p::tunnel::TUNNEL_DATA_MSG_SIZE + I2NP_HEADER_SIZE + 34>(); // reserved for alignment and NTCP 16 + 6 + 12
+		auto msg = I2NPTunnelMessagesPool::Acquire ();
 		msg->Align (12);
-		return std::shared_ptr<I2NPMessage>(msg);
+		return msg;
+	}
+
+	std::vector<I2NPMessagePoolStats> GetI2NPMessagePoolsStats ()
+	{
+		return { I2NPTunnelMessagesPool::GetStats (), I2NPShortMessagesPool::GetStats (),
+			I2NP8KMessagesPool::GetStats (), I2NP16KMessagesPool::GetStats (), I2NP32KMessagesPool::GetStats (),
+			I2NPMessagesPool::GetStats () };
+	}
+
+	void SetI2NPMessagePoolsLowMemory (bool lowMemory)
+	{
+		g_PoolsMaxFreeShift = lowMemory ? I2NP_LOW_MEMORY_POOLS_MAX_FREE_SHIFT : 0;
 	}
 
 	std::shared_ptr<I2NPMessage> NewI2NPMessage (size_t len)
 	{
-		return (len < I2NP_MAX_SHORT_MESSAGE_SIZE - I2NP_HEADER_SIZE - 2) ? NewI2NPShortMessage () : NewI2NPMessage ();
+		if (len < I2NP_MAX_SHORT_MESSAGE_SIZE - I2NP_HEADER_SIZE - 2) return NewI2NPShortMessage ();
+		// pick smallest class fitting len, so queued messages don't pin full size buffers
+		len += I2NP_MESSAGE_SIZE_RESERVE;
+		if (len <= I2NP_MAX_MEDIUM_MESSAGE_SIZE/4) return I2NP8KMessagesPool::Acquire ();
+		if (len <= I2NP_MAX_MEDIUM_MESSAGE_SIZE/2) return I2NP16KMessagesPool::Acquire ();
+		if (len <= I2NP_MAX_MEDIUM_MESSAGE_SIZE) return I2NP32KMessagesPool::Acquire ();
+		return NewI2NPMessage ();
 	}
 
 	void I2NPMessage::FillI2NPMessageHeader (I2NPMessageType msgType, uint32_t replyMsgID)
 	{
 		SetTypeID (msgType);
-		if (!replyMsgID) RAND_bytes ((uint8_t *)&replyMsgID, 4);
+		if (!replyMsgID) replyMsgID = i2p::crypto::RandUint32 ();
 		SetMsgID (replyMsgID);
-		SetExpiration (i2p::util::GetMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
+		SetExpiration (i2p::util::GetCoarseMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
 		UpdateSize ();
 		UpdateChks ();
 	}
@@ -52,14 +168,14 @@ namespace i2p
 	void I2NPMessage::RenewI2NPMessageHeader ()
 	{
 		uint32_t msgID;
-		RAND_bytes ((uint8_t *)&msgID, 4);
+		msgID = i2p::crypto::RandUint32 ();
 		SetMsgID (msgID);
-		SetExpiration (i2p::util::GetMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
+		SetExpiration (i2p::util::GetCoarseMillisecondsSinceEpoch () + I2NP_MESSAGE_EXPIRATION_TIMEOUT);
 	}
 
 	bool I2NPMessage::IsExpired () const
 	{
-		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
 		auto exp = GetExpiration ();
 		return (ts > exp + I2NP_MESSAGE_CLOCK_SKEW) || (ts < exp - 3*I2NP_MESSAGE_CLOCK_SKEW); // check if expired or too far in future
 	}
@@ -107,7 +223,7 @@ namespace i2p
 		}
 		else // for SSU establishment
 		{
-			RAND_bytes ((uint8_t *)&msgID, 4);
+			msgID = i2p::crypto::RandUint32 ();
 			htobe32buf (buf + DELIVERY_STATUS_MSGID_OFFSET, msgID);
 			htobe64buf (buf + DELIVERY_STATUS_TIMESTAMP_OFFSET, i2p::context.GetNetID ());
 		}
@@ -226,8 +342,19 @@ namespace i2p
 		if (!router) // we send own RouterInfo
 			router = context.GetSharedRouterInfo ();
 
+		std::shared_ptr<const std::vector<uint8_t> > ownPayload;
+		if (router.get () == &context.GetRouterInfo ())
+			ownPayload = context.GetDatabaseStorePayload ();
 		auto m = NewI2NPShortMessage ();
 		uint8_t * payload = m->GetPayload ();
+		if (ownPayload && !replyToken)
+		{
+			// cloned, only I2NP header is new
+			memcpy (payload, ownPayload->data (), ownPayload->size ());
+			m->len += ownPayload->size ();
+			m->FillI2NPMessageHeader (eI2NPDatabaseStore);
+			return m;
+		}
 
 		memcpy (payload + DATABASE_STORE_KEY_OFFSET, router->GetIdentHash (), 32);
 		payload[DATABASE_STORE_TYPE_OFFSET] = 0; // RouterInfo
@@ -244,8 +371,17 @@ namespace i2p
 		uint8_t * sizePtr = buf;
 		buf += 2;
 		m->len += (buf - payload); // payload size
-		i2p::data::GzipDeflator deflator;
-		size_t size = deflator.Deflate (router->GetBuffer (), router->GetBufferLen (), buf, m->maxLen -m->len);
+		size_t size = 0;
+		if (ownPayload) // gzipped RouterInfo after size
+		{
+			size = ownPayload->size () - DATABASE_STORE_HEADER_SIZE - 2;
+			if (size <= m->maxLen - m->len)
+				memcpy (buf, ownPayload->data () + DATABASE_STORE_HEADER_SIZE + 2, size);
+			else
+				size = 0;
+		}
+		else
+			size = i2p::data::GzipDeflate (router->GetBuffer (), router->GetBufferLen (), buf, m->maxLen -m->len);
 		if (size)
 		{
 			htobe16buf (sizePtr, size); // size
@@ -261,14 +397,19 @@ namespace i2p
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::LeaseSet> leaseSet)
 	{
 		if (!leaseSet) return nullptr;
+		return CreateDatabaseStoreMsg (leaseSet->GetIdentHash (), leaseSet->GetStoreType (), leaseSet->GetBuffer (), leaseSet->GetBufferLen ());
+	}
+
+	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (const i2p::data::IdentHash& ident, uint8_t storeType, const uint8_t * buf, size_t len)
+	{
 		auto m = NewI2NPShortMessage ();
 		uint8_t * payload = m->GetPayload ();
-		memcpy (payload + DATABASE_STORE_KEY_OFFSET, leaseSet->GetIdentHash (), 32);
-		payload[DATABASE_STORE_TYPE_OFFSET] = leaseSet->GetStoreType (); //  1 for LeaseSet
+		memcpy (payload + DATABASE_STORE_KEY_OFFSET, ident, 32);
+		payload[DATABASE_STORE_TYPE_OFFSET] = storeType; //  1 for LeaseSet
 		htobe32buf (payload + DATABASE_STORE_REPLY_TOKEN_OFFSET, 0);
 		size_t size = DATABASE_STORE_HEADER_SIZE;
-		memcpy (payload + size, leaseSet->GetBuffer (), leaseSet->GetBufferLen ());
-		size += leaseSet->GetBufferLen ();
+		memcpy (payload + size, buf, len);
+		size += len;
 		m->len += size;
 		m->FillI2NPMessageHeader (eI2NPDatabaseStore);
 		return m;
@@ -318,7 +459,7 @@ namespace i2p
 		}
 	}
 
-	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText)
+	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText, bool isOverloaded)
 	{
 		for (int i = 0; i < num; i++)
 		{
@@ -327,13 +468,18 @@ namespace i2p
 			{
 				LogPrint (eLogDebug, "I2NP: Build request record ", i, " is ours");
 				BN_CTX * ctx = BN_CTX_new ();
-				i2p::context.DecryptTunnelBuildRecord (record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, ctx);
+				{
+					i2p::metrics::ScopedTimer timer (i2p::metrics::buildRecordDecryptionTime);
+					i2p::context.DecryptTunnelBuildRecord (record + BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, ctx);
+				}
 				BN_CTX_free (ctx);
 				// replace record to reply
-				if (i2p::context.AcceptsTunnels () &&
-					i2p::tunnel::tunnels.GetTransitTunnels ().size () <= g_MaxNumTransitTunnels &&
+				if (!isOverloaded && i2p::context.AcceptsTunnels () &&
+					i2p::tunnel::tunnels.CountTransitTunnels () <= g_MaxNumTransitTunnels &&
 					!i2p::transport::transports.IsBandwidthExceeded () &&
-					!i2p::transport::transports.IsTransitBandwidthExceeded ())
+					!i2p::transport::transports.IsTransitBandwidthExceeded () &&
+					!i2p::transport::transports.IsSendOverloaded () &&
+					!i2p::tunnel::tunnels.IsOverloaded ())
 				{
 					auto transitTunnel = i2p::tunnel::CreateTransitTunnel (
 							bufbe32toh (clearText + BUILD_REQUEST_RECORD_RECEIVE_TUNNEL_OFFSET),
@@ -345,9 +491,13 @@ namespace i2p
 						    clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET ] & 0x40);
 					i2p::tunnel::tunnels.AddTransitTunnel (transitTunnel);
 					record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 0;
+					i2p::metrics::tunnelBuildsAccepted.Inc ();
 				}
 				else
+				{
 					record[BUILD_RESPONSE_RECORD_RET_OFFSET] = 30; // always reject with bandwidth reason (30)
+					i2p::metrics::tunnelBuildsRejected.Inc ();
+				}
 
 				//TODO: fill filler
 				SHA256 (record + BUILD_RESPONSE_RECORD_PADDING_OFFSET, BUILD_RESPONSE_RECORD_PADDING_SIZE + 1, // + 1 byte of ret
@@ -393,29 +543,39 @@ namespace i2p
 				LogPrint (eLogInfo, "I2NP: Inbound tunnel ", tunnel->GetTunnelID (), " has been declined");
 				tunnel->SetState (i2p::tunnel::eTunnelStateBuildFailed);
 			}
+			i2p::tunnel::tunnels.PendingTunnelCompleted (replyMsgID, true);
 		}
 		else
+			HandleVariableTunnelBuildRequestMsg (buf, len);
+	}
+
+	void HandleVariableTunnelBuildRequestMsg (uint8_t * buf, size_t len, bool isOverloaded)
+	{
+		int num = buf[0];
+		if (len < num*BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE + 1)
 		{
-			uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
-			if (HandleBuildRequestRecords (num, buf + 1, clearText))
+			LogPrint (eLogError, "VaribleTunnelBuild message of ", num, " records is too short ", len);
+			return;
+		}
+		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
+		if (HandleBuildRequestRecords (num, buf + 1, clearText, isOverloaded))
+		{
+			if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
 			{
-				if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outboud tunnel
-				{
-					// so we send it to reply tunnel
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
-							eI2NPVariableTunnelBuildReply, buf, len,
-						    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
-				}
-				else
-					transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
-						CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len,
-							bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
+				// so we send it to reply tunnel
+				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+					CreateTunnelGatewayMsg (bufbe32toh (clearText + BUILD_REQUEST_RECORD_NEXT_TUNNEL_OFFSET),
+						eI2NPVariableTunnelBuildReply, buf, len,
+					    bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
 			}
+			else
+				transports.SendMessage (clearText + BUILD_REQUEST_RECORD_NEXT_IDENT_OFFSET,
+					CreateI2NPMessage (eI2NPVariableTunnelBuild, buf, len,
+						bufbe32toh (clearText + BUILD_REQUEST_RECORD_SEND_MSG_ID_OFFSET)));
 		}
 	}
 
-	void HandleTunnelBuildMsg (uint8_t * buf, size_t len)
+	void HandleTunnelBuildMsg (uint8_t * buf, size_t len, bool isOverloaded)
 	{
 		if (len < NUM_TUNNEL_BUILD_RECORDS*BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE)
 		{
@@ -423,7 +583,7 @@ namespace i2p
 			return;
 		}
 		uint8_t clearText[BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
-		if (HandleBuildRequestRecords (NUM_TUNNEL_BUILD_RECORDS, buf, clearText))
+		if (HandleBuildRequestRecords (NUM_TUNNEL_BUILD_RECORDS, buf, clearText, isOverloaded))
 		{
 			if (clearText[BUILD_REQUEST_RECORD_FLAG_OFFSET] & 0x40) // we are endpoint of outbound tunnel
 			{
@@ -465,6 +625,7 @@ namespace i2p
 				LogPrint (eLogInfo, "I2NP: Outbound tunnel ", tunnel->GetTunnelID (), " has been declined");
 				tunnel->SetState (i2p::tunnel::eTunnelStateBuildFailed);
 			}
+			i2p::tunnel::tunnels.PendingTunnelCompleted (replyMsgID, false);
 		}
 		else
 			LogPrint (eLogWarning, "I2NP: Pending tunnel for message ", replyMsgID, " not found");
@@ -599,12 +760,61 @@ namespace i2p
 		}
 	}
 
+	// router-wide, messages we receive have unique msgID and expiration
+	class DuplicateMessagesFilter
+	{
+		public:
+
+			DuplicateMessagesFilter (): m_Filter (i2p::util::BloomFilter (I2NP_DUPLICATE_FILTER_SIZE)), m_LastDecayTime (0)
+			{
+				i2p::crypto::RandBytes (m_HashKey, 16); // msgIDs are chosen by senders
+			}
+
+			bool IsDuplicate (std::shared_ptr<const I2NPMessage> msg)
+			{
+				uint8_t key[12], hash[16];
+				memcpy (key, msg->GetHeader () + I2NP_HEADER_MSGID_OFFSET, 4);
+				memcpy (key + 4, msg->GetHeader () + I2NP_HEADER_EXPIRATION_OFFSET, 8);
+				i2p::crypto::Siphash<16> (hash, key, 12, m_HashKey); // outside of lock
+				auto ts = i2p::util::GetSecondsSinceEpoch ();
+				std::unique_lock<std::mutex> l(m_FilterMutex);
+				if (ts > m_LastDecayTime + I2NP_DUPLICATE_FILTER_DECAY_INTERVAL)
+				{
+					m_Filter->Decay ();
+					m_LastDecayTime = ts;
+				}
+				return !m_Filter->AddHash (hash);
+			}
+
+		private:
+
+			std::mutex m_FilterMutex;
+			i2p::util::BloomFilterPtr m_Filter;
+			uint64_t m_LastDecayTime;
+			uint8_t m_HashKey[16];
+	};
+	static DuplicateMessagesFilter g_DuplicateMessagesFilter;
+
+	static bool AcceptIncomingMessage (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (!msg->traceTime) msg->traceTime = i2p::metrics::tracer.Sample ();
+		uint8_t typeID = msg->GetTypeID ();
+		// tunnel data is not checked, it's too much of it and tunnel msgIDs are per hop
+		if (typeID != eI2NPTunnelData && typeID != eI2NPTunnelGateway && g_DuplicateMessagesFilter.IsDuplicate (msg))
+		{
+			LogPrint (eLogInfo, "I2NP: Duplicate message ", msg->GetMsgID (), " of type ", (int)typeID, " dropped");
+			return false;
+		}
+		return true;
+	}
+
 	void HandleI2NPMessage (std::shared_ptr<I2NPMessage> msg)
 	{
 		if (msg)
 		{
 			uint8_t typeID = msg->GetTypeID ();
 			LogPrint (eLogDebug, "I2NP: Handling message with type ", (int)typeID);
+			if (!AcceptIncomingMessage (msg)) return;
 			switch (typeID)
 			{
 				case eI2NPTunnelData:
@@ -665,12 +875,25 @@ namespace i2p
 			switch (msg->GetTypeID ())
 			{
 				case eI2NPTunnelData:
+					msg->traceTime = i2p::metrics::tracer.Sample ();
 					m_TunnelMsgs.push_back (msg);
 				break;
 				case eI2NPTunnelGateway:
+					msg->traceTime = i2p::metrics::tracer.Sample ();
 					m_TunnelGatewayMsgs.push_back (msg);
 				break;
-				default:
+				case eI2NPVariableTunnelBuild:
+				case eI2NPVariableTunnelBuildReply:
+				case eI2NPTunnelBuild:
+				case eI2NPTunnelBuildReply:
+					if (AcceptIncomingMessage (msg)) m_TunnelMsgs.push_back (msg);
+				break;
+				case eI2NPDatabaseStore:
+				case eI2NPDatabaseSearchReply:
+				case eI2NPDatabaseLookup:
+					if (AcceptIncomingMessage (msg)) m_NetDbMsgs.push_back (msg);
+				break;
+				default: // garlic and delivery status go to different destinations
 					HandleI2NPMessage (msg);
 			}
 		}
@@ -688,5 +911,10 @@ namespace i2p
 			i2p::tunnel::tunnels.PostTunnelData (m_TunnelGatewayMsgs);
 			m_TunnelGatewayMsgs.clear ();
 		}
+		if (!m_NetDbMsgs.empty ())
+		{
+			i2p::data::netdb.PostI2NPMsgs (m_NetDbMsgs);
+			m_NetDbMsgs.clear ();
+		}
 	}
 }
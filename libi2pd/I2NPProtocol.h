@@ -5,6 +5,7 @@
 #include <string.h>
 #include <set>
 #include <memory>
+#include <algorithm>
 #include "Crypto.h"
 #include "I2PEndian.h"
 #include "Identity.h"
@@ -109,17 +110,26 @@ namespace tunnel
 
 	const size_t I2NP_MAX_MESSAGE_SIZE = 62708;
 	const size_t I2NP_MAX_SHORT_MESSAGE_SIZE = 4096;
+	const size_t I2NP_MAX_MEDIUM_MESSAGE_SIZE = 32768; // 8K, 16K and 32K classes between short and max
+	const size_t I2NP_MESSAGE_SIZE_RESERVE = 64; // headers and alignment on top of requested length
 	const unsigned int I2NP_MESSAGE_EXPIRATION_TIMEOUT = 8000; // in milliseconds (as initial RTT)
 	const unsigned int I2NP_MESSAGE_CLOCK_SKEW = 60*1000; // 1 minute in milliseconds
+	const int I2NP_DUPLICATE_FILTER_DECAY_INTERVAL = 120; // in seconds, messages are remembered for 2-4 minutes
+	const size_t I2NP_DUPLICATE_FILTER_MAX_RATE = 2000; // messages per second
+	const size_t I2NP_DUPLICATE_FILTER_BITS_PER_MESSAGE = 64; // about 1e-7 false positives with 8 probes per cache line
+	const size_t I2NP_DUPLICATE_FILTER_SIZE = I2NP_DUPLICATE_FILTER_MAX_RATE*I2NP_DUPLICATE_FILTER_DECAY_INTERVAL*
+		I2NP_DUPLICATE_FILTER_BITS_PER_MESSAGE/8; // in bytes per generation, ~1.9M
 
 	struct I2NPMessage
 	{
 		uint8_t * buf;
 		size_t len, offset, maxLen;
 		std::shared_ptr<i2p::tunnel::InboundTunnel> from;
+		uint64_t traceTime; // ingress time in microseconds if sampled by tracer, 0 otherwise
+		bool isTransit; // relayed for other routers, shaped by transit bandwidth
 
 		I2NPMessage (): buf (nullptr),len (I2NP_HEADER_SIZE + 2),
-			offset(2), maxLen (0), from (nullptr) {};  // reserve 2 bytes for NTCP header
+			offset(2), maxLen (0), from (nullptr), traceTime (0), isTransit (false) {};  // reserve 2 bytes for NTCP header
 
 		// header accessors
 		uint8_t * GetHeader () { return GetBuffer (); };
@@ -174,6 +184,8 @@ namespace tunnel
 			memcpy (buf + offset, other.buf + other.offset, other.GetLength ());
 			len = offset + other.GetLength ();
 			from = other.from;
+			traceTime = other.traceTime;
+			isTransit = other.isTransit;
 			return *this;
 		}
 
@@ -190,13 +202,17 @@ namespace tunnel
 		}
 		uint32_t ToSSU () // return msgID
 		{
-			uint8_t header[I2NP_HEADER_SIZE];
-			memcpy (header, GetHeader (), I2NP_HEADER_SIZE);
+			// short header overlaps end of full header, fields are read before it's written
+			const uint8_t * header = GetHeader ();
+			uint8_t typeID = header[I2NP_HEADER_TYPEID_OFFSET];
+			uint32_t msgID = bufbe32toh (header + I2NP_HEADER_MSGID_OFFSET);
+			uint32_t expiration = bufbe64toh (header + I2NP_HEADER_EXPIRATION_OFFSET)/1000LL;
+			uint16_t size = bufbe16toh (header + I2NP_HEADER_SIZE_OFFSET);
 			uint8_t * ssu = GetSSUHeader ();
-			ssu[I2NP_SHORT_HEADER_TYPEID_OFFSET] = header[I2NP_HEADER_TYPEID_OFFSET]; // typeid
-			htobe32buf (ssu + I2NP_SHORT_HEADER_EXPIRATION_OFFSET, bufbe64toh (header + I2NP_HEADER_EXPIRATION_OFFSET)/1000LL);
-			len = offset + I2NP_SHORT_HEADER_SIZE + bufbe16toh (header + I2NP_HEADER_SIZE_OFFSET);
-			return bufbe32toh (header + I2NP_HEADER_MSGID_OFFSET);
+			ssu[I2NP_SHORT_HEADER_TYPEID_OFFSET] = typeID;
+			htobe32buf (ssu + I2NP_SHORT_HEADER_EXPIRATION_OFFSET, expiration);
+			len = offset + I2NP_SHORT_HEADER_SIZE + size;
+			return msgID;
 		}
 		// for NTCP2 only
 		uint8_t * GetNTCP2Header () { return GetPayload () - I2NP_NTCP2_HEADER_SIZE; };
@@ -220,6 +236,7 @@ namespace tunnel
 		void FillI2NPMessageHeader (I2NPMessageType msgType, uint32_t replyMsgID = 0);
 		void RenewI2NPMessageHeader ();
 		bool IsExpired () const;
+		bool IsExpired (uint64_t ts, uint64_t skew) const { return GetExpiration () + skew < ts; }; // ts in milliseconds
 	};
 
 	template<int sz>
@@ -229,11 +246,31 @@ namespace tunnel
 		uint8_t m_Buffer[sz + 32]; // 16 alignment + 16 padding
 	};
 
+	// removes messages expired at ts with skew from queue, returns number of removed messages
+	template<typename Queue>
+	size_t DropExpiredI2NPMessages (Queue& queue, uint64_t ts, uint64_t skew = 0)
+	{
+		auto size = queue.size ();
+		queue.erase (std::remove_if (queue.begin (), queue.end (),
+			[ts, skew](const std::shared_ptr<I2NPMessage>& msg) { return msg && msg->IsExpired (ts, skew); }), queue.end ());
+		return size - queue.size ();
+	}
+
 	std::shared_ptr<I2NPMessage> NewI2NPMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPShortMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPTunnelMessage ();
 	std::shared_ptr<I2NPMessage> NewI2NPMessage (size_t len);
 
+	struct I2NPMessagePoolStats
+	{
+		size_t bufferSize;
+		uint64_t numRequests, numHits; // hit means buffer was taken from pool
+		int64_t numResident; // free buffers in all threads' pools
+	};
+	std::vector<I2NPMessagePoolStats> GetI2NPMessagePoolsStats ();
+	const int I2NP_LOW_MEMORY_POOLS_MAX_FREE_SHIFT = 3; // keep 1/8 of free buffers per thread
+	void SetI2NPMessagePoolsLowMemory (bool lowMemory); // before threads start
+
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (I2NPMessageType msgType, const uint8_t * buf, size_t len, uint32_t replyMsgID = 0);
 	std::shared_ptr<I2NPMessage> CreateI2NPMessage (const uint8_t * buf, size_t len, std::shared_ptr<i2p::tunnel::InboundTunnel> from = nullptr);
 	std::shared_ptr<I2NPMessage> CopyI2NPMessage (std::shared_ptr<I2NPMessage> msg);
@@ -248,13 +285,15 @@ namespace tunnel
 
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::RouterInfo> router = nullptr, uint32_t replyToken = 0);
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::LeaseSet> leaseSet); // for floodfill only
+	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (const i2p::data::IdentHash& ident, uint8_t storeType, const uint8_t * buf, size_t len); // serialized LeaseSet, for floodfill only
 	std::shared_ptr<I2NPMessage> CreateDatabaseStoreMsg (std::shared_ptr<const i2p::data::LocalLeaseSet> leaseSet, uint32_t replyToken = 0, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel = nullptr);
 	bool IsRouterInfoMsg (std::shared_ptr<I2NPMessage> msg);
 
-	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText);
+	bool HandleBuildRequestRecords (int num, uint8_t * records, uint8_t * clearText, bool isOverloaded = false);
 	void HandleVariableTunnelBuildMsg (uint32_t replyMsgID, uint8_t * buf, size_t len);
+	void HandleVariableTunnelBuildRequestMsg (uint8_t * buf, size_t len, bool isOverloaded = false); // not a reply for our tunnel
 	void HandleVariableTunnelBuildReplyMsg (uint32_t replyMsgID, uint8_t * buf, size_t len);
-	void HandleTunnelBuildMsg (uint8_t * buf, size_t len);
+	void HandleTunnelBuildMsg (uint8_t * buf, size_t len, bool isOverloaded = false);
 
 	std::shared_ptr<I2NPMessage> CreateTunnelDataMsg (const uint8_t * buf);
 	std::shared_ptr<I2NPMessage> CreateTunnelDataMsg (uint32_t tunnelID, const uint8_t * payload);
@@ -279,7 +318,8 @@ namespace tunnel
 
 		private:
 
-			std::vector<std::shared_ptr<I2NPMessage> > m_TunnelMsgs, m_TunnelGatewayMsgs;
+			std::vector<std::shared_ptr<I2NPMessage> > m_TunnelMsgs, m_TunnelGatewayMsgs; // build messages go with tunnel data
+			std::vector<std::shared_ptr<const I2NPMessage> > m_NetDbMsgs;
 	};
 
 	const uint16_t DEFAULT_MAX_NUM_TRANSIT_TUNNELS = 2500;
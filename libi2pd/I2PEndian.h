@@ -83,6 +83,11 @@ inline uint64_t bufbe64toh(const void *buf)
 	return be64toh(buf64toh(buf));
 }
 
+inline uint64_t bufle64toh(const void *buf)
+{
+	return le64toh(buf64toh(buf));
+}
+
 inline void htobuf16(void *buf, uint16_t b16)
 {
 	memcpy(buf, &b16, sizeof(uint16_t));
@@ -0,0 +1,131 @@
+#if defined(__linux__) && defined(USE_IO_URING)
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include "IOUring.h"
+
+namespace i2p
+{
+namespace util
+{
+	IOUring::IOUring ():
+		m_Fd (-1), m_WakeupFd (-1), m_WakeupBuf (0), m_SQRing (MAP_FAILED), m_CQRing (MAP_FAILED), m_SQRingSize (0), m_CQRingSize (0), m_SQEsSize (0),
+		m_SQHead (nullptr), m_SQTail (nullptr), m_SQMask (nullptr), m_SQArray (nullptr),
+		m_CQHead (nullptr), m_CQTail (nullptr), m_CQMask (nullptr), m_SQEs ((struct io_uring_sqe *)MAP_FAILED),
+		m_CQEs (nullptr), m_NumPrepared (0)
+	{
+	}
+
+	IOUring::~IOUring ()
+	{
+		Close ();
+	}
+
+	bool IOUring::Init (unsigned entries)
+	{
+		struct io_uring_params params;
+		memset (&params, 0, sizeof (params));
+		m_Fd = syscall (__NR_io_uring_setup, entries, &params);
+		if (m_Fd < 0) return false;
+		m_SQRingSize = params.sq_off.array + params.sq_entries*sizeof (unsigned);
+		m_CQRingSize = params.cq_off.cqes + params.cq_entries*sizeof (struct io_uring_cqe);
+		bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMap && m_CQRingSize > m_SQRingSize) m_SQRingSize = m_CQRingSize;
+		m_SQRing = mmap (nullptr, m_SQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQ_RING);
+		if (m_SQRing == MAP_FAILED)
+		{
+			Close ();
+			return false;
+		}
+		if (!singleMap)
+		{
+			m_CQRing = mmap (nullptr, m_CQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_CQ_RING);
+			if (m_CQRing == MAP_FAILED)
+			{
+				Close ();
+				return false;
+			}
+		}
+		uint8_t * sq = (uint8_t *)m_SQRing, * cq = singleMap ? sq : (uint8_t *)m_CQRing;
+		m_SQEsSize = params.sq_entries*sizeof (struct io_uring_sqe);
+		m_SQEs = (struct io_uring_sqe *)mmap (nullptr, m_SQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_Fd, IORING_OFF_SQES);
+		if (m_SQEs == MAP_FAILED)
+		{
+			Close ();
+			return false;
+		}
+		m_SQHead = (unsigned *)(sq + params.sq_off.head);
+		m_SQTail = (unsigned *)(sq + params.sq_off.tail);
+		m_SQMask = (unsigned *)(sq + params.sq_off.ring_mask);
+		m_SQArray = (unsigned *)(sq + params.sq_off.array);
+		m_CQHead = (unsigned *)(cq + params.cq_off.head);
+		m_CQTail = (unsigned *)(cq + params.cq_off.tail);
+		m_CQMask = (unsigned *)(cq + params.cq_off.ring_mask);
+		m_CQEs = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+		m_WakeupFd = eventfd (0, EFD_CLOEXEC);
+		if (m_WakeupFd < 0)
+		{
+			Close ();
+			return false;
+		}
+		return true;
+	}
+
+	void IOUring::Close ()
+	{
+		if (m_SQEs != MAP_FAILED) munmap (m_SQEs, m_SQEsSize);
+		if (m_CQRing != MAP_FAILED) munmap (m_CQRing, m_CQRingSize);
+		if (m_SQRing != MAP_FAILED) munmap (m_SQRing, m_SQRingSize);
+		m_SQEs = (struct io_uring_sqe *)MAP_FAILED; m_CQRing = MAP_FAILED; m_SQRing = MAP_FAILED;
+		if (m_Fd >= 0) close (m_Fd);
+		m_Fd = -1;
+		if (m_WakeupFd >= 0) close (m_WakeupFd);
+		m_WakeupFd = -1;
+	}
+
+	struct io_uring_sqe * IOUring::GetSQE ()
+	{
+		unsigned tail = *m_SQTail, head = __atomic_load_n (m_SQHead, __ATOMIC_ACQUIRE);
+		if (tail - head > *m_SQMask) return nullptr; // full
+		unsigned index = tail & *m_SQMask;
+		struct io_uring_sqe * sqe = m_SQEs + index;
+		memset (sqe, 0, sizeof (struct io_uring_sqe));
+		m_SQArray[index] = index;
+		// kernel reads entries in io_uring_enter only, so tail can be published before sqe is filled
+		__atomic_store_n (m_SQTail, tail + 1, __ATOMIC_RELEASE);
+		m_NumPrepared++;
+		return sqe;
+	}
+
+	int IOUring::Submit (unsigned minComplete)
+	{
+		int ret = syscall (__NR_io_uring_enter, m_Fd, m_NumPrepared, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (ret < 0) return errno == EINTR ? 0 : -errno;
+		m_NumPrepared -= ret; // number of consumed entries
+		return ret;
+	}
+
+	bool IOUring::PrepareWakeup (uint64_t userData)
+	{
+		auto sqe = GetSQE ();
+		if (!sqe) return false;
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = m_WakeupFd;
+		sqe->addr = (uint64_t)&m_WakeupBuf;
+		sqe->len = sizeof (m_WakeupBuf);
+		sqe->user_data = userData;
+		return true;
+	}
+
+	void IOUring::Wakeup ()
+	{
+		eventfd_write (m_WakeupFd, 1);
+	}
+}
+}
+
+#endif
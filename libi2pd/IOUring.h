@@ -0,0 +1,63 @@
+#ifndef IO_URING_H__
+#define IO_URING_H__
+
+#if defined(__linux__) && defined(USE_IO_URING)
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+namespace i2p
+{
+namespace util
+{
+	/** @brief minimal io_uring wrapper over raw syscalls, no liburing dependency.
+	 *  One thread prepares, submits and reaps, Wakeup may be called from any thread */
+	class IOUring
+	{
+		public:
+
+			IOUring ();
+			~IOUring ();
+
+			bool Init (unsigned entries); // false if not supported by kernel
+			void Close ();
+
+			struct io_uring_sqe * GetSQE (); // zeroed, nullptr if submission queue is full
+			int Submit (unsigned minComplete); // submits prepared entries and waits for completions, -errno on error
+			bool PrepareWakeup (uint64_t userData); // completion with userData arrives after Wakeup
+			void Wakeup ();
+
+			template<typename Handler>
+			size_t ReapCompletions (Handler handler) // handler (userData, res)
+			{
+				unsigned head = *m_CQHead, num = 0;
+				for (;;)
+				{
+					unsigned tail = __atomic_load_n (m_CQTail, __ATOMIC_ACQUIRE);
+					if (head == tail) break;
+					const struct io_uring_cqe& cqe = m_CQEs[head & *m_CQMask];
+					handler (cqe.user_data, cqe.res);
+					head++; num++;
+				}
+				__atomic_store_n (m_CQHead, head, __ATOMIC_RELEASE);
+				return num;
+			}
+
+		private:
+
+			int m_Fd, m_WakeupFd;
+			uint64_t m_WakeupBuf;
+			void * m_SQRing, * m_CQRing;
+			size_t m_SQRingSize, m_CQRingSize, m_SQEsSize;
+			unsigned * m_SQHead, * m_SQTail, * m_SQMask, * m_SQArray;
+			unsigned * m_CQHead, * m_CQTail, * m_CQMask;
+			struct io_uring_sqe * m_SQEs;
+			struct io_uring_cqe * m_CQEs;
+			unsigned m_NumPrepared; // not submitted yet
+	};
+}
+}
+
+#endif
+#endif
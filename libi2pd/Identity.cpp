@@ -1,5 +1,12 @@
 #include <time.h>
 #include <stdio.h>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <memory>
 #include "Crypto.h"
 #include "I2PEndian.h"
 #include "Log.h"
@@ -35,12 +42,12 @@ namespace data
 	}
 
 	IdentityEx::IdentityEx ():
-		m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
+		m_Verifier (nullptr), m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
 	{
 	}
 
 	IdentityEx::IdentityEx(const uint8_t * publicKey, const uint8_t * signingKey, SigningKeyType type, CryptoKeyType cryptoType):
-		m_IsVerifierCreated (false)
+		m_Verifier (nullptr), m_IsVerifierCreated (false)
 	{
 		memcpy (m_StandardIdentity.publicKey, publicKey, 256); // publicKey in awlays assumed 256 regardless actual size, padding must be taken care of
 		if (type != SIGNING_KEY_TYPE_DSA_SHA1)
@@ -141,19 +148,19 @@ namespace data
 	}
 
 	IdentityEx::IdentityEx (const uint8_t * buf, size_t len):
-		m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
+		m_Verifier (nullptr), m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
 	{
 		FromBuffer (buf, len);
 	}
 
 	IdentityEx::IdentityEx (const IdentityEx& other):
-		m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
+		m_Verifier (nullptr), m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
 	{
 		*this = other;
 	}
 
 	IdentityEx::IdentityEx (const Identity& standard):
-		m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
+		m_Verifier (nullptr), m_IsVerifierCreated (false), m_ExtendedLen (0), m_ExtendedBuffer (nullptr)
 	{
 		*this = standard;
 	}
@@ -161,6 +168,7 @@ namespace data
 	IdentityEx::~IdentityEx ()
 	{
 		delete[] m_ExtendedBuffer;
+		ResetVerifier ();
 	}
 
 	IdentityEx& IdentityEx::operator=(const IdentityEx& other)
@@ -178,8 +186,7 @@ namespace data
 		else
 			m_ExtendedBuffer = nullptr;
 
-		m_Verifier = nullptr;
-		m_IsVerifierCreated = false;
+		ResetVerifier ();
 
 		return *this;
 	}
@@ -193,8 +200,7 @@ namespace data
 		m_ExtendedBuffer = nullptr;
 		m_ExtendedLen = 0;
 
-		m_Verifier = nullptr;
-		m_IsVerifierCreated = false;
+		ResetVerifier ();
 
 		return *this;
 	}
@@ -233,7 +239,7 @@ namespace data
 		}
 		SHA256(buf, GetFullLen (), m_IdentHash);
 
-		m_Verifier = nullptr;
+		ResetVerifier ();
 
 		return GetFullLen ();
 	}
@@ -271,7 +277,7 @@ namespace data
 	{
 		if (!m_Verifier) CreateVerifier ();
 		if (m_Verifier)
-			return m_Verifier->GetPublicKeyLen ();
+			return m_Verifier.load ()->GetPublicKeyLen ();
 		return 128;
 	}
 
@@ -279,7 +285,7 @@ namespace data
 	{
 		if (!m_Verifier) CreateVerifier ();
 		if (m_Verifier)
-			return m_Verifier->GetPrivateKeyLen ();
+			return m_Verifier.load ()->GetPrivateKeyLen ();
 		return GetSignatureLen ()/2;
 	}
 
@@ -287,17 +293,54 @@ namespace data
 	{
 		if (!m_Verifier) CreateVerifier ();
 		if (m_Verifier)
-			return m_Verifier->GetSignatureLen ();
+			return m_Verifier.load ()->GetSignatureLen ();
 		return i2p::crypto::DSA_SIGNATURE_LENGTH;
 	}
 	bool IdentityEx::Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const
 	{
 		if (!m_Verifier) CreateVerifier ();
-		if (m_Verifier)
-			return m_Verifier->Verify (buf, len, signature);
+		i2p::crypto::Verifier * verifier = m_Verifier;
+		if (verifier == GetEdDSAVerifier ()) // call EdDSA directly
+			return GetEdDSAVerifier ()->i2p::crypto::EDDSA25519Verifier::Verify (buf, len, signature);
+		if (verifier)
+			return verifier->Verify (buf, len, signature);
 		return false;
 	}
 
+	void IdentityEx::Verify (size_t num, const IdentityEx * const * identities, const uint8_t * const * bufs,
+		const size_t * lens, const uint8_t * const * signatures, bool * results)
+	{
+		std::vector<size_t> indices; // of EdDSA
+		std::vector<const i2p::crypto::EDDSA25519Verifier *> verifiers;
+		for (size_t i = 0; i < num; i++)
+		{
+			auto identity = identities[i];
+			if (!identity->m_Verifier) identity->CreateVerifier ();
+			if (identity->m_Verifier == identity->GetEdDSAVerifier ())
+			{
+				indices.push_back (i);
+				verifiers.push_back (identity->GetEdDSAVerifier ());
+			}
+			else
+				results[i] = identity->Verify (bufs[i], lens[i], signatures[i]);
+		}
+		if (indices.empty ()) return;
+		size_t numEdDSA = indices.size ();
+		std::vector<const uint8_t *> edDSABufs (numEdDSA), edDSASignatures (numEdDSA);
+		std::vector<size_t> edDSALens (numEdDSA);
+		std::unique_ptr<bool[]> edDSAResults (new bool[numEdDSA]);
+		for (size_t i = 0; i < numEdDSA; i++)
+		{
+			edDSABufs[i] = bufs[indices[i]];
+			edDSALens[i] = lens[indices[i]];
+			edDSASignatures[i] = signatures[indices[i]];
+		}
+		i2p::crypto::EDDSA25519Verifier::Verify (numEdDSA, verifiers.data (), edDSABufs.data (),
+			edDSALens.data (), edDSASignatures.data (), edDSAResults.get ());
+		for (size_t i = 0; i < numEdDSA; i++)
+			results[indices[i]] = edDSAResults[i];
+	}
+
 	SigningKeyType IdentityEx::GetSigningKeyType () const
 	{
 		if (m_StandardIdentity.certificate[0] == CERTIFICATE_TYPE_KEY && m_ExtendedLen >= 2)
@@ -350,6 +393,18 @@ namespace data
 	void IdentityEx::CreateVerifier () const
 	{
 		if (m_Verifier) return; // don't create again
+		if (GetSigningKeyType () == SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519)
+		{
+			if (!m_IsVerifierCreated.exchange (true))
+			{
+				auto verifier = new (GetEdDSAVerifier ()) i2p::crypto::EDDSA25519Verifier ();
+				verifier->SetPublicKey (m_StandardIdentity.signingKey + 128 - i2p::crypto::EDDSA25519_PUBLIC_KEY_LENGTH);
+				m_Verifier = verifier;
+			}
+			else
+				WaitForVerifier ();
+			return;
+		}
 		auto verifier = CreateVerifier (GetSigningKeyType ());
 		if (verifier)
 		{
@@ -376,29 +431,43 @@ namespace data
 		{
 			auto created = m_IsVerifierCreated.exchange (true);
 			if (!created)
-				m_Verifier.reset (verifier);
+				m_Verifier = verifier;
 			else
 			{
 				delete verifier;
-				int count = 0;
-				while (!m_Verifier && count < 500) // 5 seconds
-				{
-					std::this_thread::sleep_for (std::chrono::milliseconds(10));
-					count++;
-				}
-				if (!m_Verifier)
-					LogPrint (eLogError, "Identity: couldn't get verifier in 5 seconds");
+				WaitForVerifier ();
 			}
 		}
 		else
 			delete verifier;
 	}
 
+	void IdentityEx::WaitForVerifier () const
+	{
+		int count = 0;
+		while (!m_Verifier && count < 500) // 5 seconds
+		{
+			std::this_thread::sleep_for (std::chrono::milliseconds(10));
+			count++;
+		}
+		if (!m_Verifier)
+			LogPrint (eLogError, "Identity: couldn't get verifier in 5 seconds");
+	}
+
+	void IdentityEx::ResetVerifier () const
+	{
+		auto verifier = m_Verifier.exchange (nullptr);
+		if (verifier == GetEdDSAVerifier ())
+			GetEdDSAVerifier ()->~EDDSA25519Verifier ();
+		else
+			delete verifier;
+		m_IsVerifierCreated = false;
+	}
+
 	void IdentityEx::DropVerifier () const
 	{
 		// TODO: potential race condition with Verify
-		m_IsVerifierCreated = false;
-		m_Verifier = nullptr;
+		ResetVerifier ();
 	}
 
 	std::shared_ptr<i2p::crypto::CryptoKeyEncryptor> IdentityEx::CreateEncryptor (CryptoKeyType keyType, const uint8_t * key)
@@ -597,7 +666,7 @@ namespace data
 				case SIGNING_KEY_TYPE_RSA_SHA384_3072:
 				case SIGNING_KEY_TYPE_RSA_SHA512_4096:
 					LogPrint (eLogWarning, "Identity: RSA signature type is not supported. Creating EdDSA");
-				// no break here
+				// fall through
 				case SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519:
 					i2p::crypto::CreateEDDSA25519RandomKeys (keys.m_SigningPrivateKey, signingPublicKey);
 				break;
@@ -652,24 +721,166 @@ namespace data
 		return keys;
 	}
 
-	IdentHash CreateRoutingKey (const IdentHash& ident)
+	static std::mutex g_RoutingKeysMutex;
+	static std::unordered_map<IdentHash, IdentHash> g_RoutingKeys; // for g_RoutingKeysDay
+	static time_t g_RoutingKeysDay = 0; // days since epoch, UTC
+
+	static void GetRoutingKeyDate (time_t day, char * date) // yyyymmdd
 	{
-		uint8_t buf[41]; // ident + yyyymmdd
-		memcpy (buf, (const uint8_t *)ident, 32);
-		time_t t = time (nullptr);
+		time_t t = day*86400;
 		struct tm tm;
 #ifdef _WIN32
 		gmtime_s(&tm, &t);
-		sprintf_s((char *)(buf + 32), 9, "%04i%02i%02i", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+		sprintf_s(date, 9, "%04i%02i%02i", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
 #else
 		gmtime_r(&t, &tm);
-		sprintf((char *)(buf + 32), "%04i%02i%02i", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+		if (snprintf(date, 9, "%04i%02i%02i", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) != 8)
+			LogPrint (eLogError, "Identity: routing key date is truncated for day ", day);
 #endif
+	}
+
+	static IdentHash CalculateRoutingKey (const IdentHash& ident, const char * date)
+	{
+		uint8_t buf[40]; // ident + yyyymmdd
+		memcpy (buf, (const uint8_t *)ident, 32);
+		memcpy (buf + 32, date, 8);
 		IdentHash key;
 		SHA256(buf, 40, key);
 		return key;
 	}
 
+	IdentHash CreateRoutingKey (const IdentHash& ident)
+	{
+		time_t day = time (nullptr)/86400;
+		{
+			std::lock_guard<std::mutex> l(g_RoutingKeysMutex);
+			if (day == g_RoutingKeysDay)
+			{
+				auto it = g_RoutingKeys.find (ident);
+				if (it != g_RoutingKeys.end ()) return it->second;
+			}
+		}
+		char date[9];
+		GetRoutingKeyDate (day, date);
+		auto key = CalculateRoutingKey (ident, date);
+		std::lock_guard<std::mutex> l(g_RoutingKeysMutex);
+		if (day > g_RoutingKeysDay)
+		{
+			g_RoutingKeys.clear ();
+			g_RoutingKeysDay = day;
+		}
+		if (day == g_RoutingKeysDay && g_RoutingKeys.size () < ROUTING_KEYS_CACHE_MAX_SIZE)
+			g_RoutingKeys.emplace (ident, key);
+		return key;
+	}
+
+	void UpdateRoutingKeys (const std::vector<IdentHash>& idents)
+	{
+		time_t day = time (nullptr)/86400;
+		char date[9];
+		GetRoutingKeyDate (day, date);
+		size_t num = std::min (idents.size (), ROUTING_KEYS_CACHE_MAX_SIZE);
+		std::unordered_map<IdentHash, IdentHash> keys;
+		keys.reserve (num);
+		// hash 40 bytes of ident + yyyymmdd for batches of idents at once
+		const size_t batchSize = 64;
+		uint8_t bufs[batchSize][40];
+		const uint8_t * in[batchSize];
+		size_t lens[batchSize];
+		IdentHash hashes[batchSize];
+		uint8_t * out[batchSize];
+		for (size_t i = 0; i < batchSize; i++)
+		{
+			memcpy (bufs[i] + 32, date, 8);
+			in[i] = bufs[i]; lens[i] = 40; out[i] = hashes[i];
+		}
+		for (size_t i = 0; i < num; i += batchSize)
+		{
+			size_t n = std::min (batchSize, num - i);
+			for (size_t j = 0; j < n; j++)
+				memcpy (bufs[j], (const uint8_t *)idents[i + j], 32);
+			i2p::crypto::SHA256Multi (n, in, lens, out);
+			for (size_t j = 0; j < n; j++)
+				keys.emplace (idents[i + j], hashes[j]);
+		}
+		std::lock_guard<std::mutex> l(g_RoutingKeysMutex);
+		if (day < g_RoutingKeysDay) return;
+		if (day == g_RoutingKeysDay) // keep keys created meanwhile
+			for (const auto& it: g_RoutingKeys)
+				if (keys.size () < ROUTING_KEYS_CACHE_MAX_SIZE) keys.insert (it);
+		g_RoutingKeys.swap (keys);
+		g_RoutingKeysDay = day;
+	}
+
+	static std::mutex g_VerifiedSignaturesMutex;
+	static std::unordered_set<IdentHash> g_VerifiedSignatures;
+	static std::deque<IdentHash> g_VerifiedSignaturesQueue; // in order of adding
+
+	IdentHash CalculateSignedDataHash (const uint8_t * key, size_t keyLen, const uint8_t * buf, size_t len,
+		const uint8_t * signature, size_t signatureLen)
+	{
+		IdentHash hash;
+		SHA256_CTX ctx;
+		SHA256_Init (&ctx);
+		SHA256_Update (&ctx, key, keyLen);
+		SHA256_Update (&ctx, buf, len);
+		SHA256_Update (&ctx, signature, signatureLen);
+		SHA256_Final (hash, &ctx);
+		return hash;
+	}
+
+	bool IsSignatureVerified (const IdentHash& hash)
+	{
+		std::lock_guard<std::mutex> l(g_VerifiedSignaturesMutex);
+		return g_VerifiedSignatures.count (hash) > 0;
+	}
+
+	void AddVerifiedSignature (const IdentHash& hash)
+	{
+		std::lock_guard<std::mutex> l(g_VerifiedSignaturesMutex);
+		if (!g_VerifiedSignatures.insert (hash).second) return;
+		g_VerifiedSignaturesQueue.push_back (hash);
+		if (g_VerifiedSignaturesQueue.size () > VERIFIED_SIGNATURES_CACHE_MAX_SIZE)
+		{
+			g_VerifiedSignatures.erase (g_VerifiedSignaturesQueue.front ());
+			g_VerifiedSignaturesQueue.pop_front ();
+		}
+	}
+
+	void VerifyCached (size_t num, const IdentityEx * const * identities, const uint8_t * const * bufs,
+		const size_t * lens, const uint8_t * const * signatures, bool * results)
+	{
+		std::vector<IdentHash> hashes (num);
+		std::vector<size_t> indices; // not in cache
+		for (size_t i = 0; i < num; i++)
+		{
+			hashes[i] = CalculateSignedDataHash (identities[i]->GetIdentHash (), 32, bufs[i], lens[i],
+				signatures[i], identities[i]->GetSignatureLen ());
+			results[i] = IsSignatureVerified (hashes[i]);
+			if (!results[i]) indices.push_back (i);
+		}
+		if (indices.empty ()) return;
+		size_t numToVerify = indices.size ();
+		std::vector<const IdentityEx *> toVerify (numToVerify);
+		std::vector<const uint8_t *> verifyBufs (numToVerify), verifySignatures (numToVerify);
+		std::vector<size_t> verifyLens (numToVerify);
+		std::unique_ptr<bool[]> verifyResults (new bool[numToVerify]);
+		for (size_t i = 0; i < numToVerify; i++)
+		{
+			toVerify[i] = identities[indices[i]];
+			verifyBufs[i] = bufs[indices[i]];
+			verifyLens[i] = lens[indices[i]];
+			verifySignatures[i] = signatures[indices[i]];
+		}
+		IdentityEx::Verify (numToVerify, toVerify.data (), verifyBufs.data (), verifyLens.data (),
+			verifySignatures.data (), verifyResults.get ());
+		for (size_t i = 0; i < numToVerify; i++)
+		{
+			results[indices[i]] = verifyResults[i];
+			if (verifyResults[i]) AddVerifiedSignature (hashes[indices[i]]);
+		}
+	}
+
 	XORMetric operator^(const IdentHash& key1, const IdentHash& key2)
 	{
 		XORMetric m;
@@ -5,7 +5,9 @@
 #include <string.h>
 #include <string>
 #include <memory>
+#include <vector>
 #include <atomic>
+#include <type_traits>
 #include "Base.h"
 #include "Signature.h"
 #include "CryptoKey.h"
@@ -112,18 +114,28 @@ namespace data
 
 			static i2p::crypto::Verifier * CreateVerifier (SigningKeyType keyType);
 			static std::shared_ptr<i2p::crypto::CryptoKeyEncryptor> CreateEncryptor (CryptoKeyType keyType, const uint8_t * key);			
+			static void Verify (size_t num, const IdentityEx * const * identities, const uint8_t * const * bufs,
+				const size_t * lens, const uint8_t * const * signatures, bool * results); // EdDSA in batch
 
 		private:
 
 			void CreateVerifier () const;
 			void UpdateVerifier (i2p::crypto::Verifier * verifier) const;
+			void WaitForVerifier () const;
+			void ResetVerifier () const;
+			i2p::crypto::EDDSA25519Verifier * GetEdDSAVerifier () const
+			{
+				return reinterpret_cast<i2p::crypto::EDDSA25519Verifier *>(&m_EdDSAVerifier);
+			};
 
 		private:
 
 			Identity m_StandardIdentity;
 			IdentHash m_IdentHash;
-			mutable std::unique_ptr<i2p::crypto::Verifier> m_Verifier;
+			mutable std::atomic<i2p::crypto::Verifier *> m_Verifier; // in m_EdDSAVerifier or allocated for other types
 			mutable std::atomic_bool m_IsVerifierCreated; // make sure we don't create twice
+			mutable std::aligned_storage<sizeof (i2p::crypto::EDDSA25519Verifier),
+				alignof (i2p::crypto::EDDSA25519Verifier)>::type m_EdDSAVerifier; // most common type, without allocation
 			size_t m_ExtendedLen;
 			uint8_t * m_ExtendedBuffer;
 	};
@@ -185,9 +197,36 @@ namespace data
 		bool operator< (const XORMetric& other) const { return memcmp (metric, other.metric, 32) < 0; };
 	};
 
-	IdentHash CreateRoutingKey (const IdentHash& ident);
+	const size_t ROUTING_KEYS_CACHE_MAX_SIZE = 32768;
+	IdentHash CreateRoutingKey (const IdentHash& ident); // cached for current UTC day
+	void UpdateRoutingKeys (const std::vector<IdentHash>& idents); // calculate keys for a new day at once
 	XORMetric operator^(const IdentHash& key1, const IdentHash& key2);
 
+	// hashes of signer's key, signed data and signature, to skip verification of the same RouterInfo or LeaseSet again
+	const size_t VERIFIED_SIGNATURES_CACHE_MAX_SIZE = 8192;
+	IdentHash CalculateSignedDataHash (const uint8_t * key, size_t keyLen, const uint8_t * buf, size_t len,
+		const uint8_t * signature, size_t signatureLen);
+	bool IsSignatureVerified (const IdentHash& hash);
+	void AddVerifiedSignature (const IdentHash& hash); // oldest are dropped
+
+	template<typename Verifier>
+	bool VerifyCached (const Verifier& verifier, const uint8_t * key, size_t keyLen,
+		const uint8_t * buf, size_t len, const uint8_t * signature)
+	{
+		auto hash = CalculateSignedDataHash (key, keyLen, buf, len, signature, verifier->GetSignatureLen ());
+		if (IsSignatureVerified (hash)) return true;
+		if (!verifier->Verify (buf, len, signature)) return false;
+		AddVerifiedSignature (hash);
+		return true;
+	}
+
+	inline bool VerifyCached (const std::shared_ptr<const IdentityEx>& identity, const uint8_t * buf, size_t len, const uint8_t * signature)
+	{
+		return VerifyCached (identity, identity->GetIdentHash (), 32, buf, len, signature);
+	}
+	void VerifyCached (size_t num, const IdentityEx * const * identities, const uint8_t * const * bufs,
+		const size_t * lens, const uint8_t * const * signatures, bool * results); // verified are added to cache
+
 	// destination for delivery instuctions
 	class RoutingDestination
 	{
@@ -17,13 +17,13 @@ namespace data
 	{
 	}
 
-	LeaseSet::LeaseSet (const uint8_t * buf, size_t len, bool storeLeases):
-		m_IsValid (true), m_StoreLeases (storeLeases), m_ExpirationTime (0)
+	LeaseSet::LeaseSet (const uint8_t * buf, size_t len, bool storeLeases, std::shared_ptr<const IdentityEx> identity):
+		m_IsValid (true), m_StoreLeases (storeLeases), m_ExpirationTime (0), m_Identity (identity)
 	{
 		m_Buffer = new uint8_t[len];
 		memcpy (m_Buffer, buf, len);
 		m_BufferLen = len;
-		ReadFromBuffer ();
+		ReadFromBuffer (!identity);
 	}
 
 	void LeaseSet::Update (const uint8_t * buf, size_t len, bool verifySignature)
@@ -97,7 +97,7 @@ namespace data
 		UpdateLeasesEnd ();
 
 		// verify
-		if (verifySignature && !m_Identity->Verify (m_Buffer, leases - m_Buffer, leases))
+		if (verifySignature && !VerifyCached (m_Identity, m_Buffer, leases - m_Buffer, leases))
 		{
 			LogPrint (eLogWarning, "LeaseSet: verification failed");
 			m_IsValid = false;
@@ -266,6 +266,7 @@ namespace data
 		SetExpirationTime ((timestamp + expires)*1000LL); // in milliseconds
 		uint16_t flags = bufbe16toh (buf + offset); offset += 2; // flags
 		std::unique_ptr<i2p::crypto::Verifier> offlineVerifier;
+		const uint8_t * offlineKey = nullptr;
 		if (flags & 0x0001)
 		{
 			// offline key
@@ -277,7 +278,8 @@ namespace data
 			if (!offlineVerifier) return;
 			auto keyLen = offlineVerifier->GetPublicKeyLen ();
 			if (offset + keyLen >= len) return;
-			offlineVerifier->SetPublicKey (buf + offset); offset += keyLen;
+			offlineKey = buf + offset;
+			offlineVerifier->SetPublicKey (offlineKey); offset += keyLen;
 			if (offset + identity->GetSignatureLen () >= len) return;
 			if (!identity->Verify (signedData, keyLen + 6, buf + offset)) return;
 			offset += identity->GetSignatureLen ();
@@ -298,20 +300,22 @@ namespace data
 		if (!s) return;
 		offset += s;
 		// verify signature
-		bool verified = offlineVerifier ? VerifySignature (offlineVerifier, buf, len, offset) :
-			VerifySignature (identity, buf, len, offset);	
+		bool verified = offlineVerifier ?
+			VerifySignature (offlineVerifier, offlineKey, offlineVerifier->GetPublicKeyLen (), buf, len, offset) :
+			VerifySignature (identity, identity->GetIdentHash (), 32, buf, len, offset);	
 		SetIsValid (verified);	
 	}
 
 	template<typename Verifier>
-	bool LeaseSet2::VerifySignature (Verifier& verifier, const uint8_t * buf, size_t len, size_t signatureOffset)
+	bool LeaseSet2::VerifySignature (Verifier& verifier, const uint8_t * key, size_t keyLen,
+		const uint8_t * buf, size_t len, size_t signatureOffset)
 	{
 		if (signatureOffset + verifier->GetSignatureLen () > len) return false;
 		// we assume buf inside DatabaseStore message, so buf[-1] is valid memory
 		// change it for signature verification, and restore back	
 		uint8_t c = buf[-1];
 		const_cast<uint8_t *>(buf)[-1] = m_StoreType;
-		bool verified = verifier->Verify (buf - 1, signatureOffset + 1, buf + signatureOffset); 
+		bool verified = VerifyCached (verifier, key, keyLen, buf - 1, signatureOffset + 1, buf + signatureOffset);
 		const_cast<uint8_t *>(buf)[-1] = c;
 		if (!verified)
 			LogPrint (eLogWarning, "LeaseSet2: verification failed");
@@ -400,7 +404,8 @@ namespace data
 		if (!blindedVerifier) return;
 		auto blindedKeyLen = blindedVerifier->GetPublicKeyLen ();			
 		if (offset + blindedKeyLen >= len) return;
-		blindedVerifier->SetPublicKey (buf + offset); offset += blindedKeyLen;
+		const uint8_t * blindedKey = buf + offset;
+		blindedVerifier->SetPublicKey (blindedKey); offset += blindedKeyLen;
 		// expiration
 		if (offset + 8 >= len) return;
 		uint32_t timestamp = bufbe32toh (buf + offset); offset += 4; // published timestamp (seconds)
@@ -408,6 +413,7 @@ namespace data
 		SetExpirationTime ((timestamp + expires)*1000LL); // in milliseconds
 		uint16_t flags = bufbe16toh (buf + offset); offset += 2; // flags
 		std::unique_ptr<i2p::crypto::Verifier> offlineVerifier;
+		const uint8_t * offlineKey = nullptr;
 		if (flags & 0x0001)
 		{
 			// offline key
@@ -419,7 +425,8 @@ namespace data
 			if (!offlineVerifier) return;
 			auto keyLen = offlineVerifier->GetPublicKeyLen ();
 			if (offset + keyLen >= len) return;
-			offlineVerifier->SetPublicKey (buf + offset); offset += keyLen;
+			offlineKey = buf + offset;
+			offlineVerifier->SetPublicKey (offlineKey); offset += keyLen;
 			if (offset + blindedVerifier->GetSignatureLen () >= len) return;
 			if (!blindedVerifier->Verify (signedData, keyLen + 6, buf + offset)) return;
 			offset += blindedVerifier->GetSignatureLen ();
@@ -428,8 +435,9 @@ namespace data
 		if (offset + 2 > len) return;
 		uint16_t lenOuterCiphertext = bufbe16toh (buf + offset); offset += 2 + lenOuterCiphertext;		
 		// verify signature
-		bool verified = offlineVerifier ? VerifySignature (offlineVerifier, buf, len, offset) :
-			VerifySignature (blindedVerifier, buf, len, offset);	
+		bool verified = offlineVerifier ?
+			VerifySignature (offlineVerifier, offlineKey, offlineVerifier->GetPublicKeyLen (), buf, len, offset) :
+			VerifySignature (blindedVerifier, blindedKey, blindedKeyLen, buf, len, offset);	
 		SetIsValid (verified);	
 	}
 
@@ -440,10 +448,13 @@ namespace data
 			encryptor->Encrypt (data, encrypted, ctx, true);	
 	}
 
-	LocalLeaseSet::LocalLeaseSet (std::shared_ptr<const IdentityEx> identity, const uint8_t * encryptionPublicKey, std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels):
+	LocalLeaseSet::LocalLeaseSet (std::shared_ptr<const IdentityEx> identity, const uint8_t * encryptionPublicKey, std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels,
+		const std::vector<std::shared_ptr<const Lease> >& otherLeases):
 		m_ExpirationTime (0), m_Identity (identity)
 	{
-		int num = tunnels.size ();
+		int numTunnels = tunnels.size ();
+		if (numTunnels > MAX_NUM_LEASES) numTunnels = MAX_NUM_LEASES;
+		int num = numTunnels + otherLeases.size ();
 		if (num > MAX_NUM_LEASES) num = MAX_NUM_LEASES;
 		// identity
 		auto signingKeyLen = m_Identity->GetSigningPublicKeyLen ();
@@ -460,7 +471,7 @@ namespace data
 		// leases
 		m_Leases = m_Buffer + offset;
 		auto currentTime = i2p::util::GetMillisecondsSinceEpoch ();
-		for (int i = 0; i < num; i++)
+		for (int i = 0; i < numTunnels; i++)
 		{
 			memcpy (m_Buffer + offset, tunnels[i]->GetNextIdentHash (), 32);
 			offset += 32; // gateway id
@@ -474,6 +485,17 @@ namespace data
 			htobe64buf (m_Buffer + offset, ts);
 			offset += 8; // end date
 		}
+		for (int i = 0; i < num - numTunnels; i++)
+		{
+			const auto& lease = otherLeases[i];
+			memcpy (m_Buffer + offset, lease->tunnelGateway, 32);
+			offset += 32; // gateway id
+			htobe32buf (m_Buffer + offset, lease->tunnelID);
+			offset += 4; // tunnel id
+			if (lease->endDate > m_ExpirationTime) m_ExpirationTime = lease->endDate;
+			htobe64buf (m_Buffer + offset, lease->endDate);
+			offset += 8; // end date
+		}
 		//  we don't sign it yet. must be signed later on
 	}
 
@@ -499,10 +521,10 @@ namespace data
 		return ts > m_ExpirationTime;
 	}
 
-	bool LeaseSetBufferValidate(const uint8_t * ptr, size_t sz, uint64_t & expires)
+	bool LeaseSetBufferValidate(const uint8_t * ptr, size_t sz, uint64_t & expires, std::shared_ptr<const IdentityEx> identity)
 	{
-		IdentityEx ident(ptr, sz);
-		size_t size = ident.GetFullLen ();
+		if (!identity) identity = std::make_shared<IdentityEx>(ptr, sz);
+		size_t size = identity->GetFullLen ();
 		if (size > sz)
 		{
 			LogPrint (eLogError, "LeaseSet: identity length ", size, " exceeds buffer size ", sz);
@@ -511,7 +533,7 @@ namespace data
 		// encryption key
 		size += 256;
 		// signing key (unused)
-		size += ident.GetSigningPublicKeyLen ();
+		size += identity->GetSigningPublicKeyLen ();
 		uint8_t numLeases = ptr[size];
 		++size;
 		if (!numLeases || numLeases > MAX_NUM_LEASES)
@@ -530,7 +552,7 @@ namespace data
 			if(endDate > expires)
 				expires = endDate;
 		}
-		return ident.Verify(ptr, leases - ptr, leases);
+		return VerifyCached (identity, ptr, leases - ptr, leases); // might be verified in batch
 	}
 
 	LocalLeaseSet2::LocalLeaseSet2 (uint8_t storeType, std::shared_ptr<const IdentityEx> identity, 
@@ -58,7 +58,8 @@ namespace data
 	{
 		public:
 
-			LeaseSet (const uint8_t * buf, size_t len, bool storeLeases = true);
+			LeaseSet (const uint8_t * buf, size_t len, bool storeLeases = true,
+				std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from buf already
 			virtual ~LeaseSet () { delete[] m_Buffer; };
 			void Update (const uint8_t * buf, size_t len, bool verifySignature = true);
 			bool IsNewer (const uint8_t * buf, size_t len) const;
@@ -117,7 +118,8 @@ namespace data
 			validate lease set buffer signature and extract expiration timestamp
 			@returns true if the leaseset is well formed and signature is valid
 	 */
-	bool LeaseSetBufferValidate(const uint8_t * ptr, size_t sz, uint64_t & expires);
+	bool LeaseSetBufferValidate(const uint8_t * ptr, size_t sz, uint64_t & expires,
+		std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from ptr already
 
 	const uint8_t NETDB_STORE_TYPE_STANDARD_LEASESET2 = 3;
 	const uint8_t NETDB_STORE_TYPE_ENCRYPTED_LEASESET2 = 5;
@@ -140,7 +142,8 @@ namespace data
 			size_t ReadMetaLS2TypeSpecificPart (const uint8_t * buf, size_t len);
 
 			template<typename Verifier>
-			bool VerifySignature (Verifier& verifier, const uint8_t * buf, size_t len, size_t signatureOffset);
+			bool VerifySignature (Verifier& verifier, const uint8_t * key, size_t keyLen, // key identifies signer for cache
+				const uint8_t * buf, size_t len, size_t signatureOffset);
 
 		private:
 
@@ -152,7 +155,8 @@ namespace data
 	{
 		public:
 
-			LocalLeaseSet (std::shared_ptr<const IdentityEx> identity, const uint8_t * encryptionPublicKey, std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels);
+			LocalLeaseSet (std::shared_ptr<const IdentityEx> identity, const uint8_t * encryptionPublicKey, std::vector<std::shared_ptr<i2p::tunnel::InboundTunnel> > tunnels,
+				const std::vector<std::shared_ptr<const Lease> >& otherLeases = {}); // other leases of multihomed destination follow own tunnels
 			LocalLeaseSet (std::shared_ptr<const IdentityEx> identity, const uint8_t * buf, size_t len);
 			virtual ~LocalLeaseSet () { delete[] m_Buffer; };
 
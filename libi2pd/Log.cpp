@@ -7,9 +7,11 @@
 */
 
 #include "Log.h"
+#include "util.h"
 
 //for std::transform
 #include <algorithm>
+#include <vector>
 
 namespace i2p {
 namespace log {
@@ -62,11 +64,27 @@ namespace log {
 	}
 #endif
 
+	/**
+	 * @brief Maps log categories to their names
+	 */
+	static const char * g_LogCategoryStr[eNumLogCategories] =
+	{
+		"general",    // eLogGeneral
+		"transports", // eLogTransports
+		"tunnels",    // eLogTunnels
+		"netdb",      // eLogNetDb
+		"streaming",  // eLogStreaming
+		"garlic",     // eLogGarlic
+		"client"      // eLogClient
+	};
+
 	Log::Log():
 	m_Destination(eLogStdout), m_MinLevel(eLogInfo),
 	m_LogStream (nullptr), m_Logfile(""), m_HasColors(true), m_TimeFormat("%H:%M:%S"),
-	m_IsRunning (false), m_Thread (nullptr)
+	m_IsRunning (false), m_Thread (nullptr), m_IsDeferred (false)
 	{
+		for (auto& it: m_CategoryLevels)
+			it = m_MinLevel;
 	}
 
 	Log::~Log ()
@@ -108,6 +126,8 @@ namespace log {
 			delete m_Thread;
 			m_Thread = nullptr;
 		}
+		m_IsDeferred = false; // messages are formatted in place from now
+		ProcessRingBuffers (); // what is left
 	}
 
     std::string str_tolower(std::string s) {
@@ -131,9 +151,34 @@ namespace log {
 			LogPrint(eLogError, "Log: unknown loglevel: ", level);
 			return;
 		}
+		for (auto& it: m_CategoryLevels)
+			it = m_MinLevel;
 		LogPrint(eLogInfo, "Log: min messages level set to ", level);
 	}
 
+	bool Log::SetLogLevel (const std::string& category, const std::string& level)
+	{
+		int c = 0;
+		while (c < eNumLogCategories && category != g_LogCategoryStr[c]) c++;
+		int l = 0;
+		while (l < eNumLogLevels && str_tolower (level) != g_LogLevelStr[l]) l++;
+		if (c == eNumLogCategories || l == eNumLogLevels)
+		{
+			LogPrint(eLogError, "Log: unknown log category ", category, " or level ", level);
+			return false;
+		}
+		m_CategoryLevels[c] = l;
+		LogPrint(eLogInfo, "Log: min messages level of ", category, " set to ", g_LogLevelStr[l]);
+		return true;
+	}
+
+	bool Log::IsDisabled () const
+	{
+		for (auto& it: m_CategoryLevels)
+			if (it != eLogNone) return false;
+		return true;
+	}
+
 	const char * Log::TimeAsString(std::time_t t) {
 		if (t != m_LastTimestamp) {
 			strftime(m_LastDateTime, sizeof(m_LastDateTime), m_TimeFormat.c_str(), localtime(&t));
@@ -150,44 +195,117 @@ namespace log {
 	void Log::Process(std::shared_ptr<LogMsg> msg)
 	{
 		if (!msg) return;
+		Process (msg->level, msg->timestamp, msg->tid, msg->text);
+	}
+
+	void Log::Process (LogLevel level, std::time_t timestamp, std::thread::id tid, const std::string& text)
+	{
 		std::hash<std::thread::id> hasher;
 		unsigned short short_tid;
-		short_tid = (short) (hasher(msg->tid) % 1000);
+		short_tid = (short) (hasher(tid) % 1000);
 		switch (m_Destination) {
 #ifndef _WIN32
 			case eLogSyslog:
-				syslog(GetSyslogPrio(msg->level), "[%03u] %s", short_tid, msg->text.c_str());
+				syslog(GetSyslogPrio(level), "[%03u] %s", short_tid, text.c_str());
 				break;
 #endif
 			case eLogFile:
 			case eLogStream:
 				if (m_LogStream)
-					*m_LogStream << TimeAsString(msg->timestamp)
+					*m_LogStream << TimeAsString(timestamp)
 						<< "@" << short_tid
-						<< "/" << g_LogLevelStr[msg->level]
-						<< " - " << msg->text << std::endl;
+						<< "/" << g_LogLevelStr[level]
+						<< " - " << text << std::endl;
 				break;
 			case eLogStdout:
 			default:
-				std::cout    << TimeAsString(msg->timestamp)
+				std::cout    << TimeAsString(timestamp)
 					<< "@" << short_tid
-					<< "/" << LogMsgColors[msg->level] << g_LogLevelStr[msg->level] << LogMsgColors[eNumLogLevels]
-					<< " - " << msg->text << std::endl;
+					<< "/" << LogMsgColors[level] << g_LogLevelStr[level] << LogMsgColors[eNumLogLevels]
+					<< " - " << text << std::endl;
 				break;
 		} // switch
 	}
 
+	void Log::ProcessRingBuffers ()
+	{
+		std::unique_lock<std::mutex> l(m_RingBuffersMutex);
+		for (auto it = m_RingBuffers.begin (); it != m_RingBuffers.end ();)
+		{
+			bool isAbandoned = (*it)->IsAbandoned (); // check before last records are taken
+			while (auto slot = (*it)->Peek ())
+			{
+				std::stringstream ss;
+				slot->GetRecord ()->Format (ss);
+				Process (slot->level, slot->timestamp, (*it)->GetThreadID (), ss.str ());
+				(*it)->Pop ();
+			}
+			if (isAbandoned)
+				it = m_RingBuffers.erase (it);
+			else
+				it++;
+		}
+	}
+
+	struct ThreadRingBuffer
+	{
+		std::shared_ptr<LogRingBuffer> buffer;
+		~ThreadRingBuffer () { if (buffer) buffer->Abandon (); };
+	};
+	static thread_local ThreadRingBuffer g_ThreadRingBuffer;
+
+	LogRingBuffer * Log::GetThreadRingBuffer ()
+	{
+		if (!g_ThreadRingBuffer.buffer)
+		{
+			g_ThreadRingBuffer.buffer = std::make_shared<LogRingBuffer> ();
+			std::unique_lock<std::mutex> l(m_RingBuffersMutex);
+			m_RingBuffers.push_back (g_ThreadRingBuffer.buffer);
+		}
+		return g_ThreadRingBuffer.buffer.get ();
+	}
+
+	LogRingBuffer::~LogRingBuffer ()
+	{
+		while (Peek ()) Pop ();
+	}
+
+	LogSlot * LogRingBuffer::Peek ()
+	{
+		auto tail = m_Tail.load (std::memory_order_relaxed);
+		if (tail == m_Head.load (std::memory_order_acquire)) return nullptr;
+		return &m_Slots[tail & (LOG_RING_BUFFER_SIZE - 1)];
+	}
+
+	void LogRingBuffer::Pop ()
+	{
+		auto tail = m_Tail.load (std::memory_order_relaxed);
+		m_Slots[tail & (LOG_RING_BUFFER_SIZE - 1)].GetRecord ()->~LogRecord ();
+		m_Tail.store (tail + 1, std::memory_order_release);
+	}
+
 	void Log::Run ()
 	{
+		i2p::util::InitThread ("Log");
 		Reopen ();
+		std::vector<std::shared_ptr<LogMsg> > msgs;
 		while (m_IsRunning)
 		{
-			std::shared_ptr<LogMsg> msg;
-			while ((msg = m_Queue.Get ()))
-				Process (msg);
+			if (m_Queue.GetAll (msgs))
+			{
+				for (auto& it: msgs)
+					Process (it);
+				msgs.clear ();
+			}
+			ProcessRingBuffers ();
 			if (m_LogStream) m_LogStream->flush();
 			if (m_IsRunning)
-				m_Queue.Wait ();
+			{
+				if (m_IsDeferred)
+					m_Queue.Wait (0, LOG_DEFERRED_FLUSH_INTERVAL); // ring buffers don't wake us up
+				else
+					m_Queue.Wait (1, 0);
+			}
 		}
 	}
 
@@ -199,7 +317,7 @@ namespace log {
 	void Log::SendTo (const std::string& path)
 	{
 		if (m_LogStream) m_LogStream = nullptr; // close previous
-		if (m_MinLevel == eLogNone) return;
+		if (IsDisabled ()) return;
 		auto flags = std::ofstream::out | std::ofstream::app;
 		auto os = std::make_shared<std::ofstream> (path, flags);
 		if (os->is_open ())
@@ -221,7 +339,7 @@ namespace log {
 
 #ifndef _WIN32
 	void Log::SendTo(const char *name, int facility) {
-		if (m_MinLevel == eLogNone) return;
+		if (IsDisabled ()) return;
 		m_HasColors = false;
 		m_Destination = eLogSyslog;
 		m_LogStream = nullptr;
@@ -237,5 +355,15 @@ namespace log {
 	Log & Logger() {
 		return logger;
 	}
+
+	const char * GetLogLevelName (LogLevel level)
+	{
+		return level < eNumLogLevels ? g_LogLevelStr[level] : "";
+	}
+
+	const char * GetLogCategoryName (LogCategory category)
+	{
+		return category < eNumLogCategories ? g_LogCategoryStr[category] : "";
+	}
 } // log
 } // i2p
@@ -17,6 +17,12 @@
 #include <chrono>
 #include <memory>
 #include <thread>
+#include <tuple>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
 #include "Queue.h"
 
 #ifndef _WIN32
@@ -33,6 +39,24 @@ enum LogLevel
 	eNumLogLevels
 };
 
+/** @brief subsystems with own runtime log level */
+enum LogCategory
+{
+	eLogGeneral = 0,
+	eLogTransports,
+	eLogTunnels,
+	eLogNetDb,
+	eLogStreaming,
+	eLogGarlic,
+	eLogClient,
+	eNumLogCategories
+};
+
+/** messages less important than this level are compiled out */
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL eLogDebug
+#endif
+
 enum LogType {
 	eLogStdout = 0,
 	eLogStream,
@@ -45,7 +69,12 @@ enum LogType {
 namespace i2p {
 namespace log {
 
+	const uint32_t LOG_RING_BUFFER_SIZE = 512; // deferred messages per thread, must be power of 2
+	const size_t LOG_RECORD_MAX_SIZE = 192; // bigger deferred records are formatted by calling thread
+	const int LOG_DEFERRED_FLUSH_INTERVAL = 100; // in milliseconds
+
 	struct LogMsg; /* forward declaration */
+	class LogRingBuffer;
 
 	class Log
 	{
@@ -53,15 +82,19 @@ namespace log {
 
 			enum LogType  m_Destination;
 			enum LogLevel m_MinLevel;
+			std::atomic<int> m_CategoryLevels[eNumLogCategories];
 			std::shared_ptr<std::ostream> m_LogStream;
 			std::string m_Logfile;
 			std::time_t m_LastTimestamp;
 			char m_LastDateTime[64];
-			i2p::util::Queue<std::shared_ptr<LogMsg> > m_Queue;
+			i2p::util::MPSCQueue<std::shared_ptr<LogMsg> > m_Queue;
 			bool m_HasColors;
 			std::string m_TimeFormat;
 			volatile bool m_IsRunning;
 			std::thread * m_Thread;
+			bool m_IsDeferred;
+			std::mutex m_RingBuffersMutex;
+			std::list<std::shared_ptr<LogRingBuffer> > m_RingBuffers;
 
 		private:
 
@@ -71,6 +104,9 @@ namespace log {
 
 			void Run ();
 			void Process (std::shared_ptr<LogMsg> msg);
+			void Process (LogLevel level, std::time_t timestamp, std::thread::id tid, const std::string& text);
+			void ProcessRingBuffers ();
+			bool IsDisabled () const; // none for all categories
 
 			/**
 			 * @brief Makes formatted string from unix timestamp
@@ -87,6 +123,7 @@ namespace log {
 
 			LogType  GetLogType  () { return m_Destination; };
 			LogLevel GetLogLevel () { return m_MinLevel; };
+			LogLevel GetLogLevel (LogCategory category) const { return (LogLevel)m_CategoryLevels[category].load (std::memory_order_relaxed); };
 
 			void Start ();
 			void Stop ();
@@ -97,6 +134,14 @@ namespace log {
 			 */
 			void     SetLogLevel (const std::string& level);
 
+			/**
+			 * @brief  Sets minimal allowed level for log messages of one subsystem
+			 * @param  category  Subsystem name (transports, tunnels, netdb, ...)
+			 * @param  level  String with wanted minimal msg level
+			 * @return false if category or level is unknown
+			 */
+			bool     SetLogLevel (const std::string& category, const std::string& level);
+
 			/**
 			 * @brief Sets log destination to logfile
 			 * @param path  Path to logfile
@@ -115,6 +160,18 @@ namespace log {
 			 */
 			void SetTimeFormat (std::string format) { m_TimeFormat = format; };
 
+			/**
+			 * @brief  Enables deferred formatting, arguments are copied to per-thread ring buffer
+			 * and formatted by log thread
+			 * @param  deferred  Enable or disable
+			 */
+			void SetDeferred (bool deferred) { m_IsDeferred = deferred; };
+			bool IsDeferred () const { return m_IsDeferred; };
+
+			/** @brief  Ring buffer of calling thread, created at first call */
+			LogRingBuffer * GetThreadRingBuffer ();
+			void WakeUp () { m_Queue.WakeUp (); };
+
 	#ifndef _WIN32
 			/**
 			 * @brief Sets log destination to syslog
@@ -150,45 +207,200 @@ namespace log {
 		LogMsg (LogLevel lvl, std::time_t ts, const std::string & txt): timestamp(ts), text(txt), level(lvl) {};
 	};
 
+	/** @brief arguments of deferred message */
+	struct LogRecord
+	{
+		virtual ~LogRecord () {};
+		virtual void Format (std::ostream& s) const = 0;
+	};
+
+	/**
+	 * @brief type an argument is stored as until formatted
+	 *
+	 * Const char arrays are string literals and stored as pointers,
+	 * other C strings might be temporary and are copied.
+	 */
+	template<typename T> struct LogArgType { typedef typename std::decay<T>::type type; };
+	template<size_t N> struct LogArgType<const char[N]> { typedef const char * type; };
+	template<size_t N> struct LogArgType<char[N]> { typedef std::string type; };
+	template<> struct LogArgType<char *> { typedef std::string type; };
+	template<> struct LogArgType<char * const> { typedef std::string type; };
+	template<> struct LogArgType<const char *> { typedef std::string type; };
+	template<> struct LogArgType<const char * const> { typedef std::string type; };
+	template<typename T> struct LogArgType<std::atomic<T> > { typedef T type; };
+	template<typename T> struct LogArgType<const std::atomic<T> > { typedef T type; };
+
+	/** @brief true if all arguments can be stored, otherwise message is formatted in place */
+	template<typename... TArgs> struct LogArgsStorable: std::true_type {};
+	template<typename T, typename... TArgs> struct LogArgsStorable<T, TArgs...>:
+		std::integral_constant<bool, std::is_constructible<typename LogArgType<typename std::remove_reference<T>::type>::type, T&&>::value &&
+			LogArgsStorable<TArgs...>::value> {};
+
+	template<size_t I, size_t N>
+	struct LogArgsFormatter
+	{
+		template<typename Tuple>
+		static void Format (std::ostream& s, const Tuple& args)
+		{
+			s << std::get<I>(args);
+			LogArgsFormatter<I + 1, N>::Format (s, args);
+		}
+	};
+
+	template<size_t N>
+	struct LogArgsFormatter<N, N>
+	{
+		template<typename Tuple>
+		static void Format (std::ostream&, const Tuple&) {}
+	};
+
+	template<typename... TArgs>
+	struct DeferredLogRecord: public LogRecord
+	{
+		std::tuple<TArgs...> args;
+
+		template<typename... TValues>
+		DeferredLogRecord (TValues&&... values): args (std::forward<TValues>(values)...) {}
+		void Format (std::ostream& s) const { LogArgsFormatter<0, sizeof...(TArgs)>::Format (s, args); };
+	};
+
+	struct LogSlot
+	{
+		LogLevel level;
+		std::time_t timestamp;
+		typename std::aligned_storage<LOG_RECORD_MAX_SIZE, alignof(std::max_align_t)>::type storage;
+
+		LogRecord * GetRecord () { return reinterpret_cast<LogRecord *>(&storage); };
+	};
+
+	/** @brief deferred messages of one thread, single producer and single consumer (log thread) */
+	class LogRingBuffer
+	{
+		public:
+
+			LogRingBuffer (): m_Head (0), m_Tail (0), m_IsAbandoned (false), m_ThreadID (std::this_thread::get_id ()) {};
+			~LogRingBuffer ();
+
+			template<typename TRecord, typename... TArgs>
+			bool Put (LogLevel level, TArgs&&... args) // false if full
+			{
+				auto head = m_Head.load (std::memory_order_relaxed);
+				if (head - m_Tail.load (std::memory_order_acquire) >= LOG_RING_BUFFER_SIZE) return false;
+				auto& slot = m_Slots[head & (LOG_RING_BUFFER_SIZE - 1)];
+				slot.level = level;
+				slot.timestamp = std::time (nullptr);
+				new (&slot.storage) TRecord (std::forward<TArgs>(args)...);
+				m_Head.store (head + 1, std::memory_order_release);
+				return true;
+			}
+
+			uint32_t GetSize () const { return m_Head.load (std::memory_order_relaxed) - m_Tail.load (std::memory_order_relaxed); };
+			LogSlot * Peek (); // by log thread, nullptr if empty
+			void Pop (); // destroys record of peeked slot
+			std::thread::id GetThreadID () const { return m_ThreadID; };
+			void Abandon () { m_IsAbandoned = true; }; // thread finished
+			bool IsAbandoned () const { return m_IsAbandoned; };
+
+		private:
+
+			LogSlot m_Slots[LOG_RING_BUFFER_SIZE];
+			std::atomic<uint32_t> m_Head, m_Tail;
+			std::atomic<bool> m_IsAbandoned;
+			std::thread::id m_ThreadID;
+	};
+
 	Log & Logger();
+	const char * GetLogLevelName (LogLevel level);
+	const char * GetLogCategoryName (LogCategory category);
+
+	template<typename... TArgs>
+	bool DeferLogPrint (std::false_type, Log& log, LogLevel level, TArgs&&... args) noexcept
+	{
+		return false;
+	}
+
+	template<typename... TArgs>
+	bool DeferLogPrint (std::true_type, Log& log, LogLevel level, TArgs&&... args) noexcept
+	{
+		typedef DeferredLogRecord<typename LogArgType<typename std::remove_reference<TArgs>::type>::type...> Record;
+		if (sizeof (Record) > LOG_RECORD_MAX_SIZE) return false;
+		auto buffer = log.GetThreadRingBuffer ();
+		if (!buffer || !buffer->Put<Record> (level, std::forward<TArgs>(args)...)) return false;
+		if (buffer->GetSize () == LOG_RING_BUFFER_SIZE/2) log.WakeUp (); // don't wait for flush interval
+		return true;
+	}
 } // log
 }
 
+/**
+ * @brief category of LogPrint call, found by lookup from namespace of the call
+ *
+ * Fallback for calls outside of i2p namespaces, subsystem namespaces have own.
+ */
+template<typename T = void>
+LogCategory GetLogCategory () { return eLogGeneral; }
+
+namespace i2p
+{
+	inline LogCategory GetLogCategory () { return eLogGeneral; }
+	namespace transport { inline LogCategory GetLogCategory () { return eLogTransports; } }
+	namespace tunnel { inline LogCategory GetLogCategory () { return eLogTunnels; } }
+	namespace data { inline LogCategory GetLogCategory () { return eLogNetDb; } }
+	namespace stream { inline LogCategory GetLogCategory () { return eLogStreaming; } }
+	namespace garlic { inline LogCategory GetLogCategory () { return eLogGarlic; } }
+	namespace client { inline LogCategory GetLogCategory () { return eLogClient; } }
+	namespace datagram { inline LogCategory GetLogCategory () { return eLogClient; } }
+	namespace proxy { inline LogCategory GetLogCategory () { return eLogClient; } }
+}
+
 /** internal usage only -- folding args array to single string */
 template<typename TValue>
-void LogPrint (std::stringstream& s, TValue&& arg) noexcept
+void LogFormat (std::stringstream& s, TValue&& arg) noexcept
 {
 	s << std::forward<TValue>(arg);
 }
 
 /** internal usage only -- folding args array to single string */
 template<typename TValue, typename... TArgs>
-void LogPrint (std::stringstream& s, TValue&& arg, TArgs&&... args) noexcept
+void LogFormat (std::stringstream& s, TValue&& arg, TArgs&&... args) noexcept
 {
-	LogPrint (s, std::forward<TValue>(arg));
-	LogPrint (s, std::forward<TArgs>(args)...);
+	LogFormat (s, std::forward<TValue>(arg));
+	LogFormat (s, std::forward<TArgs>(args)...);
 }
 
 /**
  * @brief Create log message and send it to queue
+ * @param category Subsystem of message
  * @param level Message level (eLogError, eLogInfo, ...)
  * @param args Array of message parts
  */
 template<typename... TArgs>
-void LogPrint (LogLevel level, TArgs&&... args) noexcept
+void LogPrintCategory (LogCategory category, LogLevel level, TArgs&&... args) noexcept
 {
 	i2p::log::Log &log = i2p::log::Logger();
-	if (level > log.GetLogLevel ())
+	if (level > log.GetLogLevel (category))
+		return;
+
+	// copy arguments, log thread formats them
+	if (log.IsDeferred () && i2p::log::DeferLogPrint (i2p::log::LogArgsStorable<TArgs...> (), log, level, std::forward<TArgs>(args)...))
 		return;
 
 	// fold message to single string
 	std::stringstream ss("");
 
-	LogPrint (ss, std::forward<TArgs>(args)...);
+	LogFormat (ss, std::forward<TArgs>(args)...);
 
 	auto msg = std::make_shared<i2p::log::LogMsg>(level, std::time(nullptr), ss.str());
 	msg->tid = std::this_thread::get_id();
 	log.Append(msg);
 }
 
+/**
+ * @brief Create log message of subsystem of calling code and send it to queue
+ * @param level Message level (eLogError, eLogInfo, ...), calls above LOG_MAX_LEVEL are compiled out
+ * @param ... Array of message parts
+ */
+#define LogPrint(level, ...) \
+	((level) <= LOG_MAX_LEVEL ? LogPrintCategory (GetLogCategory (), (level), __VA_ARGS__) : (void)0)
+
 #endif // LOG_H__
@@ -0,0 +1,285 @@
+#include <string.h>
+#include <list>
+#include "Metrics.h"
+
+namespace i2p
+{
+namespace metrics
+{
+	static std::vector<const Metric *>& GetMetrics ()
+	{
+		static std::vector<const Metric *> metrics; // filled during static initialization, read only later
+		return metrics;
+	}
+
+	int GetShardIndex ()
+	{
+		static std::atomic<int> numThreads (0);
+		thread_local int index = numThreads.fetch_add (1, std::memory_order_relaxed) & (METRICS_NUM_SHARDS - 1);
+		return index;
+	}
+
+	Metric::Metric (const char * name, const char * help):
+		m_Name (name), m_Help (help)
+	{
+		GetMetrics ().push_back (this);
+	}
+
+	void Metric::WriteHeader (std::stringstream& s, const char * type) const
+	{
+		s << "# HELP " << m_Name << " " << m_Help << "\n";
+		s << "# TYPE " << m_Name << " " << type << "\n";
+	}
+
+	Counter::Counter (const char * name, const char * help):
+		Metric (name, help)
+	{
+		for (auto& it: m_Shards)
+			it.value.store (0, std::memory_order_relaxed);
+	}
+
+	uint64_t Counter::Get () const
+	{
+		uint64_t value = 0;
+		for (const auto& it: m_Shards)
+			value += it.value.load (std::memory_order_relaxed);
+		return value;
+	}
+
+	void Counter::Write (std::stringstream& s) const
+	{
+		WriteHeader (s, "counter");
+		s << GetName () << " " << Get () << "\n";
+	}
+
+	Histogram::Histogram (const char * name, const char * help, std::vector<uint64_t> bounds, double scale):
+		Metric (name, help), m_Bounds (bounds), m_Scale (scale)
+	{
+		if (m_Bounds.size () > METRICS_MAX_NUM_BUCKETS)
+			m_Bounds.resize (METRICS_MAX_NUM_BUCKETS);
+		for (auto& it: m_Shards)
+		{
+			for (auto& bucket: it.buckets)
+				bucket.store (0, std::memory_order_relaxed);
+			it.sum.store (0, std::memory_order_relaxed);
+		}
+	}
+
+	void Histogram::Observe (uint64_t sample)
+	{
+		size_t i = 0;
+		while (i < m_Bounds.size () && sample > m_Bounds[i]) i++;
+		auto& shard = m_Shards[GetShardIndex ()];
+		shard.buckets[i].fetch_add (1, std::memory_order_relaxed);
+		shard.sum.fetch_add (sample, std::memory_order_relaxed);
+	}
+
+	uint64_t Histogram::CollectBuckets (uint64_t * buckets) const
+	{
+		uint64_t sum = 0;
+		for (size_t i = 0; i <= m_Bounds.size (); i++) buckets[i] = 0;
+		for (const auto& it: m_Shards)
+		{
+			for (size_t i = 0; i <= m_Bounds.size (); i++)
+				buckets[i] += it.buckets[i].load (std::memory_order_relaxed);
+			sum += it.sum.load (std::memory_order_relaxed);
+		}
+		return sum;
+	}
+
+	uint64_t Histogram::GetPercentile (double q) const
+	{
+		uint64_t buckets[METRICS_MAX_NUM_BUCKETS + 1], count = 0;
+		CollectBuckets (buckets);
+		for (size_t i = 0; i <= m_Bounds.size (); i++) count += buckets[i];
+		if (!count || m_Bounds.empty ()) return 0;
+		double target = q*count, cumulative = 0;
+		for (size_t i = 0; i < m_Bounds.size (); i++)
+		{
+			if (buckets[i] && cumulative + buckets[i] >= target)
+			{
+				uint64_t lower = i > 0 ? m_Bounds[i - 1] : 0;
+				return lower + (m_Bounds[i] - lower)*(target - cumulative)/buckets[i];
+			}
+			cumulative += buckets[i];
+		}
+		return m_Bounds.back (); // in +Inf bucket
+	}
+
+	void Histogram::Write (std::stringstream& s) const
+	{
+		uint64_t buckets[METRICS_MAX_NUM_BUCKETS + 1];
+		uint64_t sum = CollectBuckets (buckets);
+		WriteHeader (s, "histogram");
+		uint64_t count = 0; // buckets are cumulative
+		for (size_t i = 0; i < m_Bounds.size (); i++)
+		{
+			count += buckets[i];
+			s << GetName () << "_bucket{le=\"" << m_Bounds[i]*m_Scale << "\"} " << count << "\n";
+		}
+		count += buckets[m_Bounds.size ()];
+		s << GetName () << "_bucket{le=\"+Inf\"} " << count << "\n";
+		s << GetName () << "_sum " << sum*m_Scale << "\n";
+		s << GetName () << "_count " << count << "\n";
+	}
+
+	void WritePrometheus (std::stringstream& s)
+	{
+		for (const auto& it: GetMetrics ())
+			it->Write (s);
+	}
+
+	static const std::vector<uint64_t> TRACE_BOUNDS { 10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000 }; // in microseconds
+	static Histogram g_TraceStages[eNumTraceStages] =
+	{
+		{ "i2pd_trace_tunnels_seconds", "Time from ingress to tunnels thread of sampled messages", TRACE_BOUNDS, 1e-6 },
+		{ "i2pd_trace_gateway_seconds", "Time from ingress to tunnel gateway send of sampled messages", TRACE_BOUNDS, 1e-6 },
+		{ "i2pd_trace_transports_seconds", "Time from ingress to transports of sampled messages", TRACE_BOUNDS, 1e-6 },
+		{ "i2pd_trace_write_seconds", "Time from ingress to socket write of sampled messages", TRACE_BOUNDS, 1e-6 }
+	};
+
+	uint64_t Tracer::Sample ()
+	{
+		if (!m_SampleRate) return 0;
+		static thread_local int counter = 0;
+		if (++counter < m_SampleRate) return 0;
+		counter = 0;
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now ().time_since_epoch ()).count () + 1; // never 0
+	}
+
+	void Tracer::Record (TraceStage stage, uint64_t ingressTime) const
+	{
+		if (!ingressTime || stage >= eNumTraceStages) return;
+		uint64_t ts = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now ().time_since_epoch ()).count () + 1;
+		g_TraceStages[stage].Observe (ts > ingressTime ? ts - ingressTime : 0);
+	}
+
+	const Histogram& Tracer::GetStageHistogram (TraceStage stage) const
+	{
+		return g_TraceStages[stage < eNumTraceStages ? stage : 0];
+	}
+
+	Tracer tracer;
+
+	bool TunnelCapture::Start (const std::string& path)
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		if (m_IsEnabled) return false;
+		m_File.open (path, std::ofstream::out | std::ofstream::trunc);
+		if (!m_File.is_open ()) return false;
+		m_StartTime = std::chrono::steady_clock::now ();
+		m_TunnelIndexes.clear ();
+		m_NumRecords = 0;
+		m_IsEnabled = true;
+		return true;
+	}
+
+	void TunnelCapture::Stop ()
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		m_IsEnabled = false;
+		if (m_File.is_open ()) m_File.close ();
+		m_TunnelIndexes.clear ();
+	}
+
+	void TunnelCapture::Record (bool isGateway, uint32_t tunnelID, size_t len)
+	{
+		if (!m_IsEnabled) return;
+		auto ts = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now () - m_StartTime).count ();
+		std::unique_lock<std::mutex> l(m_Mutex);
+		if (!m_IsEnabled) return;
+		auto index = m_TunnelIndexes.emplace (tunnelID, m_TunnelIndexes.size ()).first->second;
+		m_File << ts << (isGateway ? " G " : " D ") << index << " " << len << "\n";
+		if (++m_NumRecords >= TUNNEL_CAPTURE_MAX_RECORDS)
+		{
+			m_IsEnabled = false;
+			m_File.close ();
+			m_TunnelIndexes.clear ();
+		}
+	}
+
+	TunnelCapture tunnelCapture;
+
+	static void UpdateMax (std::atomic<uint64_t>& max, uint64_t value)
+	{
+		auto current = max.load (std::memory_order_relaxed);
+		while (value > current && !max.compare_exchange_weak (current, value, std::memory_order_relaxed));
+	}
+
+	LockStats::LockStats (const char * n):
+		name (n), numAcquires (0), numContended (0), waitTime (0), maxWaitTime (0), holdTime (0), maxHoldTime (0)
+	{
+	}
+
+	void LockStats::AddWait (uint64_t wait)
+	{
+		numAcquires.fetch_add (1, std::memory_order_relaxed);
+		if (!wait) return;
+		numContended.fetch_add (1, std::memory_order_relaxed);
+		waitTime.fetch_add (wait, std::memory_order_relaxed);
+		UpdateMax (maxWaitTime, wait);
+	}
+
+	void LockStats::AddHold (uint64_t hold)
+	{
+		holdTime.fetch_add (hold, std::memory_order_relaxed);
+		UpdateMax (maxHoldTime, hold);
+	}
+
+	static std::mutex g_LockStatsMutex;
+	static std::list<LockStats> g_LockStats; // never shrinks, references stay valid
+
+	LockStats& GetLockStats (const char * name)
+	{
+		std::unique_lock<std::mutex> l(g_LockStatsMutex);
+		for (auto& it: g_LockStats)
+			if (!strcmp (it.name, name)) return it;
+		g_LockStats.emplace_back (name);
+		return g_LockStats.back ();
+	}
+
+	void WriteLockStats (std::stringstream& s)
+	{
+		std::unique_lock<std::mutex> l(g_LockStatsMutex);
+		s << "<table>\r\n<tr><th>Mutex</th><th>Acquires</th><th>Contended</th><th>Wait, ms</th><th>Max wait, us</th>"
+			"<th>Hold, ms</th><th>Max hold, us</th></tr>\r\n";
+		for (const auto& it: g_LockStats)
+		{
+			s << "<tr><td>" << it.name << "</td><td>" << it.numAcquires << "</td><td>" << it.numContended
+				<< "</td><td>" << it.waitTime/1000 << "</td><td>" << it.maxWaitTime
+				<< "</td><td>" << it.holdTime/1000 << "</td><td>" << it.maxHoldTime << "</td></tr>\r\n";
+		}
+		s << "</table>\r\n";
+	}
+
+	static const std::vector<uint64_t> QUEUE_SIZE_BOUNDS { 0, 1, 4, 16, 64, 256, 1024, 4096, 16384 };
+	static const std::vector<uint64_t> DURATION_BOUNDS { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000 }; // in microseconds
+	static const std::vector<uint64_t> LATENCY_BOUNDS { 50, 100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 7500, 10000, 20000, 60000 }; // in milliseconds
+
+	Histogram tunnelsQueueSize ("i2pd_tunnels_queue_size", "Number of messages waiting in tunnels queue", QUEUE_SIZE_BOUNDS);
+	Counter ntcp2ReceivedFrames ("i2pd_ntcp2_received_frames_total", "NTCP2 data phase frames received");
+	Counter ntcp2SentFrames ("i2pd_ntcp2_sent_frames_total", "NTCP2 data phase frames sent");
+	Counter ssuReceivedPackets ("i2pd_ssu_received_packets_total", "SSU packets received by sessions");
+	Counter ssuSentPackets ("i2pd_ssu_sent_packets_total", "SSU packets sent by sessions");
+	Counter garlicTagsHits ("i2pd_garlic_tags_hits_total", "Garlic messages decrypted by session tag");
+	Counter garlicTagsMisses ("i2pd_garlic_tags_misses_total", "Garlic messages without known session tag");
+	Counter tunnelBuildsAccepted ("i2pd_tunnel_builds_accepted_total", "Transit tunnel build requests accepted");
+	Counter tunnelBuildsRejected ("i2pd_tunnel_builds_rejected_total", "Transit tunnel build requests rejected");
+	Counter shaperQueuedMessages ("i2pd_shaper_queued_messages_total", "Outgoing messages delayed by bandwidth shaper");
+	Counter shaperDroppedMessages ("i2pd_shaper_dropped_messages_total", "Outgoing messages dropped by bandwidth shaper");
+	Counter ntcp2DroppedMessages ("i2pd_ntcp2_dropped_messages_total", "Messages dropped from full or expired NTCP2 send queues");
+	Counter congestedDroppedMessages ("i2pd_congested_dropped_messages_total", "Transit messages dropped for congested peers");
+	Counter tunnelsExpiredMessages ("i2pd_tunnels_expired_messages_total", "Expired tunnel messages dropped before processing");
+	Counter delayedExpiredMessages ("i2pd_transports_delayed_expired_messages_total", "Expired messages dropped while waiting for connection to peer");
+	Counter gatewayExpiredMessages ("i2pd_tunnel_gateway_expired_messages_total", "Expired messages dropped by tunnel gateways before fragmentation");
+	Counter ssuExpiredMessages ("i2pd_ssu_expired_messages_total", "Expired messages dropped while waiting for SSU window");
+	Counter handshakesRejected ("i2pd_transport_handshakes_rejected_total", "Incoming NTCP2 and SSU handshakes rejected before key agreement");
+	Histogram workerPoolQueueSize ("i2pd_worker_pool_queue_size", "Number of jobs waiting in crypto worker pools", QUEUE_SIZE_BOUNDS);
+	Counter workerPoolSteals ("i2pd_worker_pool_steals_total", "Jobs taken by crypto worker from another worker's queue");
+	Histogram buildRecordDecryptionTime ("i2pd_crypto_build_record_decryption_seconds", "ElGamal decryption of tunnel build record", DURATION_BOUNDS, 1e-6);
+	Histogram garlicElGamalDecryptionTime ("i2pd_crypto_garlic_decryption_seconds", "ElGamal decryption of garlic message", DURATION_BOUNDS, 1e-6);
+	Histogram tunnelBuildTime ("i2pd_tunnel_build_seconds", "Round trip of successful tunnel build", LATENCY_BOUNDS, 1e-3);
+	Histogram leaseSetRequestTime ("i2pd_leaseset_request_seconds", "Time to successful remote LeaseSet request result", LATENCY_BOUNDS, 1e-3);
+	Histogram streamFirstDataTime ("i2pd_stream_first_data_seconds", "Time from outgoing stream SYN to first received data", LATENCY_BOUNDS, 1e-3);
+}
+}
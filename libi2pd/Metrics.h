@@ -0,0 +1,253 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+#include <inttypes.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+
+namespace i2p
+{
+namespace metrics
+{
+	const int METRICS_NUM_SHARDS = 16; // must be power of 2
+	const int METRICS_MAX_NUM_BUCKETS = 16;
+
+	int GetShardIndex (); // of calling thread
+
+	/** @brief named metric, registered at construction, exported in Prometheus text format */
+	class Metric
+	{
+		public:
+
+			Metric (const char * name, const char * help);
+			virtual ~Metric () {};
+
+			const char * GetName () const { return m_Name; };
+			virtual void Write (std::stringstream& s) const = 0;
+
+		protected:
+
+			void WriteHeader (std::stringstream& s, const char * type) const;
+
+		private:
+
+			const char * m_Name, * m_Help;
+	};
+
+	/** @brief monotonic counter, every thread increments its own cache line with relaxed atomics */
+	class Counter: public Metric
+	{
+		struct alignas(64) Shard
+		{
+			std::atomic<uint64_t> value;
+		};
+
+		public:
+
+			Counter (const char * name, const char * help);
+
+			void Inc (uint64_t n = 1) { m_Shards[GetShardIndex ()].value.fetch_add (n, std::memory_order_relaxed); };
+			uint64_t Get () const;
+			void Write (std::stringstream& s) const;
+
+		private:
+
+			Shard m_Shards[METRICS_NUM_SHARDS];
+	};
+
+	/** @brief histogram of integer samples, upper bounds ascending, scale converts sample to exported unit */
+	class Histogram: public Metric
+	{
+		struct alignas(64) Shard
+		{
+			std::atomic<uint64_t> buckets[METRICS_MAX_NUM_BUCKETS + 1]; // last is +Inf
+			std::atomic<uint64_t> sum;
+		};
+
+		public:
+
+			Histogram (const char * name, const char * help, std::vector<uint64_t> bounds, double scale = 1.0);
+
+			void Observe (uint64_t sample);
+			uint64_t GetPercentile (double q) const; // q in [0, 1], interpolated within bucket, in sample units
+			void Write (std::stringstream& s) const;
+
+		private:
+
+			uint64_t CollectBuckets (uint64_t * buckets) const; // returns sum
+
+			std::vector<uint64_t> m_Bounds;
+			double m_Scale;
+			Shard m_Shards[METRICS_NUM_SHARDS];
+	};
+
+	/** @brief observes duration of scope in microseconds */
+	class ScopedTimer
+	{
+		public:
+
+			ScopedTimer (Histogram& histogram): m_Histogram (histogram), m_Start (std::chrono::steady_clock::now ()) {};
+			~ScopedTimer ()
+			{
+				m_Histogram.Observe (std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - m_Start).count ());
+			}
+
+		private:
+
+			Histogram& m_Histogram;
+			std::chrono::steady_clock::time_point m_Start;
+	};
+
+	void WritePrometheus (std::stringstream& s); // all registered metrics
+
+	enum TraceStage
+	{
+		eTraceStageTunnels = 0, // taken from tunnels queue
+		eTraceStageGateway, // sent by tunnel gateway
+		eTraceStageTransports, // passed to transports
+		eTraceStageWrite, // written to NTCP2 or SSU socket
+		eNumTraceStages
+	};
+
+	/** @brief samples incoming messages and records time from ingress to pipeline stages */
+	class Tracer
+	{
+		public:
+
+			Tracer (): m_SampleRate (0) {};
+
+			void SetSampleRate (int rate) { m_SampleRate = rate > 0 ? rate : 0; }; // 1 of rate messages, 0 - disabled
+			bool IsEnabled () const { return m_SampleRate > 0; };
+			uint64_t Sample (); // ingress time in microseconds if message is sampled, 0 otherwise
+			void Record (TraceStage stage, uint64_t ingressTime) const;
+			const Histogram& GetStageHistogram (TraceStage stage) const;
+
+		private:
+
+			int m_SampleRate;
+	};
+	extern Tracer tracer;
+
+	const size_t TUNNEL_CAPTURE_MAX_RECORDS = 1000000; // file is closed after
+	/** @brief records sizes of tunnel messages, for replay by bench-tunnel
+	 *  line per message: milliseconds since start, D(ata) or G(ateway), tunnel index, payload length.
+	 *  Tunnel IDs are replaced by index in order of appearance, nothing else is written */
+	class TunnelCapture
+	{
+		public:
+
+			TunnelCapture (): m_IsEnabled (false), m_NumRecords (0) {};
+
+			bool Start (const std::string& path);
+			void Stop ();
+			bool IsEnabled () const { return m_IsEnabled; };
+			void Record (bool isGateway, uint32_t tunnelID, size_t len);
+
+		private:
+
+			std::atomic<bool> m_IsEnabled;
+			std::mutex m_Mutex;
+			std::ofstream m_File;
+			std::chrono::steady_clock::time_point m_StartTime;
+			std::unordered_map<uint32_t, uint32_t> m_TunnelIndexes;
+			size_t m_NumRecords;
+	};
+	extern TunnelCapture tunnelCapture;
+
+	/** @brief acquire wait and hold time of all mutexes with same name, in microseconds */
+	struct LockStats
+	{
+		LockStats (const char * n);
+
+		void AddWait (uint64_t wait);
+		void AddHold (uint64_t hold);
+
+		const char * name;
+		std::atomic<uint64_t> numAcquires, numContended, waitTime, maxWaitTime, holdTime, maxHoldTime;
+	};
+	LockStats& GetLockStats (const char * name); // created on first use
+	void WriteLockStats (std::stringstream& s); // html table
+
+#ifdef WITH_LOCK_PROFILING
+	/** @brief std::mutex recording acquire wait and hold time */
+	class ProfiledMutex
+	{
+		public:
+
+			ProfiledMutex (const char * name): m_Stats (GetLockStats (name)) {};
+			ProfiledMutex (const ProfiledMutex&) = delete;
+			ProfiledMutex& operator= (const ProfiledMutex&) = delete;
+
+			void lock ()
+			{
+				if (!m_Mutex.try_lock ())
+				{
+					auto start = std::chrono::steady_clock::now ();
+					m_Mutex.lock ();
+					m_Acquired = std::chrono::steady_clock::now ();
+					m_Stats.AddWait (std::chrono::duration_cast<std::chrono::microseconds>(m_Acquired - start).count ());
+				}
+				else
+				{
+					m_Acquired = std::chrono::steady_clock::now ();
+					m_Stats.AddWait (0);
+				}
+			}
+
+			bool try_lock ()
+			{
+				if (!m_Mutex.try_lock ()) return false;
+				m_Acquired = std::chrono::steady_clock::now ();
+				m_Stats.AddWait (0);
+				return true;
+			}
+
+			void unlock ()
+			{
+				auto hold = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - m_Acquired).count ();
+				m_Mutex.unlock ();
+				m_Stats.AddHold (hold);
+			}
+
+		private:
+
+			std::mutex m_Mutex;
+			LockStats& m_Stats;
+			std::chrono::steady_clock::time_point m_Acquired; // written by owner only
+	};
+#else
+	/** @brief plain std::mutex, name is used with WITH_LOCK_PROFILING only */
+	class ProfiledMutex: public std::mutex
+	{
+		public:
+
+			ProfiledMutex (const char *) {};
+	};
+#endif
+	typedef std::unique_lock<ProfiledMutex> ProfiledLock;
+
+	// hot path metrics
+	extern Histogram tunnelsQueueSize;
+	extern Counter ntcp2ReceivedFrames, ntcp2SentFrames;
+	extern Counter ssuReceivedPackets, ssuSentPackets;
+	extern Counter garlicTagsHits, garlicTagsMisses;
+	extern Counter tunnelBuildsAccepted, tunnelBuildsRejected;
+	extern Counter shaperQueuedMessages, shaperDroppedMessages;
+	extern Counter ntcp2DroppedMessages, congestedDroppedMessages;
+	extern Counter tunnelsExpiredMessages, delayedExpiredMessages, gatewayExpiredMessages, ssuExpiredMessages;
+	extern Counter handshakesRejected;
+	extern Histogram workerPoolQueueSize;
+	extern Counter workerPoolSteals;
+	extern Histogram buildRecordDecryptionTime, garlicElGamalDecryptionTime;
+	// milliseconds
+	extern Histogram tunnelBuildTime, leaseSetRequestTime, streamFirstDataTime;
+}
+}
+
+#endif
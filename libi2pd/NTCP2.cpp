@@ -17,26 +17,45 @@
 #include "Log.h"
 #include "I2PEndian.h"
 #include "Crypto.h"
-#include "Siphash.h"
 #include "RouterContext.h"
 #include "Transports.h"
 #include "NetDb.hpp"
+#include "Config.h"
+#include "Metrics.h"
+#include "util.h"
 #include "NTCP2.h"
 
 namespace i2p
 {
 namespace transport
 {
+	static i2p::util::MemoryPoolMt<NTCP2HandshakeBuffers>& GetHandshakeBuffersPool ()
+	{
+		static i2p::util::MemoryPoolMt<NTCP2HandshakeBuffers> pool;
+		return pool;
+	}
+
 	NTCP2Establisher::NTCP2Establisher ():
-		m_SessionRequestBuffer (nullptr), m_SessionCreatedBuffer (nullptr), m_SessionConfirmedBuffer (nullptr) 
-	{ 
+		m_Buffers (GetHandshakeBuffersPool ().AcquireMt ()), m_SessionConfirmedBuffer (nullptr),
+		m_SessionRequestBufferLen (0), m_SessionCreatedBufferLen (0), m_IsSessionConfirmedBufferAllocated (false)
+	{
+		m_SessionRequestBuffer = m_Buffers->sessionRequest;
+		m_SessionCreatedBuffer = m_Buffers->sessionCreated;
+	}
+
+	NTCP2Establisher::~NTCP2Establisher ()
+	{
+		if (m_IsSessionConfirmedBufferAllocated)
+			delete[] m_SessionConfirmedBuffer;
+		GetHandshakeBuffersPool ().ReleaseMt (m_Buffers);
 	}
 
-	NTCP2Establisher::~NTCP2Establisher () 
-	{ 
-		delete[] m_SessionRequestBuffer; 
-		delete[] m_SessionCreatedBuffer;
-		delete[] m_SessionConfirmedBuffer;
+	void NTCP2Establisher::CreateSessionConfirmedBuffer ()
+	{
+		if (m_IsSessionConfirmedBufferAllocated)
+			delete[] m_SessionConfirmedBuffer;
+		m_IsSessionConfirmedBufferAllocated = (size_t)m3p2Len + 48 > NTCP2_SESSION_CONFIRMED_POOLED_SIZE;
+		m_SessionConfirmedBuffer = m_IsSessionConfirmedBufferAllocated ? new uint8_t[m3p2Len + 48] : m_Buffers->sessionConfirmed;
 	}
 
 	void NTCP2Establisher::MixKey (const uint8_t * inputKeyMaterial)
@@ -90,7 +109,7 @@ namespace transport
 
 	void NTCP2Establisher::KDF1Alice ()
 	{
-		KeyDerivationFunction1 (m_RemoteStaticKey, m_EphemeralKeys, m_RemoteStaticKey, GetPub ());
+		KeyDerivationFunction1 (m_RemoteStaticKey, *m_EphemeralKeys, m_RemoteStaticKey, GetPub ());
 	}
 	
 	void NTCP2Establisher::KDF1Bob ()
@@ -109,7 +128,7 @@ namespace transport
 
 		// x25519 between remote pub and ephemaral priv
 		uint8_t inputKeyMaterial[32];
-		m_EphemeralKeys.Agree (GetRemotePub (), inputKeyMaterial);
+		m_EphemeralKeys->Agree (GetRemotePub (), inputKeyMaterial);
 		
 		MixKey (inputKeyMaterial);
 	}
@@ -134,22 +153,21 @@ namespace transport
 	void NTCP2Establisher::KDF3Bob ()
 	{
 		uint8_t inputKeyMaterial[32];
-		m_EphemeralKeys.Agree (m_RemoteStaticKey, inputKeyMaterial); 
+		m_EphemeralKeys->Agree (m_RemoteStaticKey, inputKeyMaterial); 
 		MixKey (inputKeyMaterial);
 	}
 
 	void NTCP2Establisher::CreateEphemeralKey ()
 	{
-		m_EphemeralKeys.GenerateKeys ();
+		m_EphemeralKeys = transports.GetNextX25519KeysPair ();
 	}
 
 	void NTCP2Establisher::CreateSessionRequestMessage ()
 	{
 		// create buffer and fill padding
-		auto paddingLength = rand () % (287 - 64); // message length doesn't exceed 287 bytes
+		auto paddingLength = i2p::crypto::RandUint32 () % (NTCP2_SESSION_REQUEST_MAX_SIZE - 64); // message length doesn't exceed 287 bytes
 		m_SessionRequestBufferLen = paddingLength + 64;
-		m_SessionRequestBuffer = new uint8_t[m_SessionRequestBufferLen];
-		RAND_bytes (m_SessionRequestBuffer + 64, paddingLength);
+		i2p::crypto::RandBytes (m_SessionRequestBuffer + 64, paddingLength);
 		// encrypt X
 		i2p::crypto::CBCEncryption encryption;
 		encryption.SetKey (m_RemoteIdentHash);
@@ -168,7 +186,7 @@ namespace transport
 		m3p2Len = bufLen + 4 + 16; // (RI header + RI + MAC for now) TODO: implement options	
 		htobe16buf (options + 4,  m3p2Len);
 		// fill m3p2 payload (RouterInfo block)	
-		m_SessionConfirmedBuffer = new uint8_t[m3p2Len + 48]; // m3p1 is 48 bytes
+		CreateSessionConfirmedBuffer (); // m3p1 is 48 bytes
 		uint8_t * m3p2 = m_SessionConfirmedBuffer + 48;
 		m3p2[0] = eNTCP2BlkRouterInfo; // block
 		htobe16buf (m3p2 + 1, bufLen + 1); // flag + RI
@@ -185,10 +203,9 @@ namespace transport
 
 	void NTCP2Establisher::CreateSessionCreatedMessage ()
 	{
-		auto paddingLen = rand () % (287 - 64);
+		auto paddingLen = i2p::crypto::RandUint32 () % (NTCP2_SESSION_CREATED_MAX_SIZE - 64);
 		m_SessionCreatedBufferLen = paddingLen + 64;
-		m_SessionCreatedBuffer = new uint8_t[m_SessionCreatedBufferLen]; 
-		RAND_bytes (m_SessionCreatedBuffer + 64, paddingLen);
+		i2p::crypto::RandBytes (m_SessionCreatedBuffer + 64, paddingLen);
 		// encrypt Y
 		i2p::crypto::CBCEncryption encryption;
 		encryption.SetKey (i2p::context.GetIdentHash ());
@@ -240,6 +257,11 @@ namespace transport
 		decryption.SetIV (i2p::context.GetNTCP2IV ());
 		decryption.Decrypt (m_SessionRequestBuffer, 32, GetRemotePub ());
 		decryption.GetIV (m_IV); // save IV for SessionCreated	
+		if (transports.GetHandshakesFilter ().IsReplay (GetRemotePub (), 32))
+		{
+			LogPrint (eLogWarning, "NTCP2: SessionRequest replay detected");
+			return false;
+		}
 		// decryption key for next block
 		KDF1Bob ();
 		// verify MAC and decrypt options block (32 bytes), use m_H as AD
@@ -352,17 +374,88 @@ namespace transport
 		return true;
 	}
 
+	bool NTCP2SendQueue::Put (std::shared_ptr<I2NPMessage> msg)
+	{
+		bool dropped = false;
+		if (m_Size >= NTCP2_MAX_OUTGOING_QUEUE_SIZE && !DropExpired ())
+		{
+			dropped = true;
+			i2p::metrics::ntcp2DroppedMessages.Inc ();
+			// the oldest of the lowest priority class, the new one if everything queued is more important
+			int c = GetTrafficClass (msg), i = eNumTrafficClasses - 1;
+			while (i > c && m_Queues[i].empty ()) i--;
+			if (m_Queues[i].empty ()) return false;
+			m_Queues[i].pop_front ();
+			m_Size--;
+		}
+		m_Queues[GetTrafficClass (msg)].push_back (msg);
+		m_Size++;
+		return !dropped;
+	}
+
+	std::shared_ptr<I2NPMessage> NTCP2SendQueue::Front () const
+	{
+		for (const auto& it: m_Queues)
+			if (!it.empty ()) return it.front ();
+		return nullptr;
+	}
+
+	void NTCP2SendQueue::Pop ()
+	{
+		for (auto& it: m_Queues)
+			if (!it.empty ())
+			{
+				it.pop_front ();
+				m_Size--;
+				return;
+			}
+	}
+
+	void NTCP2SendQueue::Clear ()
+	{
+		for (auto& it: m_Queues)
+			it.clear ();
+		m_Size = 0;
+	}
+
+	size_t NTCP2SendQueue::GetLength () const
+	{
+		size_t len = 0;
+		for (const auto& it: m_Queues)
+			for (const auto& it1: it)
+				len += it1->GetNTCP2Length () + 3; // 3 bytes block header
+		return len;
+	}
+
+	size_t NTCP2SendQueue::DropExpired ()
+	{
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		size_t num = 0;
+		for (auto& it: m_Queues)
+			for (auto it1 = it.begin (); it1 != it.end ();)
+			{
+				if ((*it1)->GetExpiration () < ts)
+				{
+					it1 = it.erase (it1);
+					num++;
+				}
+				else
+					++it1;
+			}
+		m_Size -= num;
+		if (num) i2p::metrics::ntcp2DroppedMessages.Inc (num);
+		return num;
+	}
+
 	NTCP2Session::NTCP2Session (NTCP2Server& server, std::shared_ptr<const i2p::data::RouterInfo> in_RemoteRouter):
 		TransportSession (in_RemoteRouter, NTCP2_ESTABLISH_TIMEOUT), 
-		m_Server (server), m_Socket (m_Server.GetService ()), 
-		m_IsEstablished (false), m_IsTerminated (false),
+		m_Server (server), m_Service (m_Server.GetNextSessionService ()), m_Socket (m_Service), 
+		m_IsEstablished (false), m_IsTerminated (false), m_HandshakeSentTime (0), m_RTT (0),
 		m_Establisher (new NTCP2Establisher),
-		m_SendSipKey (nullptr), m_ReceiveSipKey (nullptr),
-#if OPENSSL_SIPHASH
-		m_SendMDCtx(nullptr), m_ReceiveMDCtx (nullptr),
-#endif
+		m_SendKey (nullptr), m_ReceiveKey (nullptr),
 		m_NextReceivedLen (0), m_NextReceivedBuffer (nullptr), m_NextSendBuffer (nullptr),
-		m_ReceiveSequenceNumber (0), m_SendSequenceNumber (0), m_IsSending (false)
+		m_ReceiveSequenceNumber (0), m_SendSequenceNumber (0), m_IsSending (false), m_IsCoalescing (false),
+		m_CoalesceTimer (m_Service)
 	{
 		if (in_RemoteRouter) // Alice
 		{
@@ -380,14 +473,8 @@ namespace transport
 
 	NTCP2Session::~NTCP2Session ()
 	{
-		delete[] m_NextReceivedBuffer;
+		DeleteNextReceivedBuffer ();
 		delete[] m_NextSendBuffer;
-#if OPENSSL_SIPHASH
-		if (m_SendSipKey) EVP_PKEY_free (m_SendSipKey);
-		if (m_ReceiveSipKey) EVP_PKEY_free (m_ReceiveSipKey);
-		if (m_SendMDCtx) EVP_MD_CTX_destroy (m_SendMDCtx);
-		if (m_ReceiveMDCtx) EVP_MD_CTX_destroy (m_ReceiveMDCtx);
-#endif
 	}
 
 	void NTCP2Session::Terminate ()
@@ -397,9 +484,11 @@ namespace transport
 			m_IsTerminated = true;
 			m_IsEstablished = false;
 			m_Socket.close ();
+			m_CoalesceTimer.cancel ();
 			transports.PeerDisconnected (shared_from_this ());
 			m_Server.RemoveNTCP2Session (shared_from_this ());
-			m_SendQueue.clear ();
+			m_SendQueue.Clear ();
+			UpdateCongestion ();
 			LogPrint (eLogDebug, "NTCP2: session terminated");
 		}
 	}
@@ -411,7 +500,7 @@ namespace transport
 
 	void NTCP2Session::Done ()
 	{
-		m_Server.GetService ().post (std::bind (&NTCP2Session::Terminate, shared_from_this ()));
+		m_Service.post (std::bind (&NTCP2Session::Terminate, shared_from_this ()));
 	}
 
 	void NTCP2Session::Established ()
@@ -469,7 +558,7 @@ namespace transport
 		}
 		else
 		{
-			m_Establisher->m_SessionCreatedBuffer = new uint8_t[287]; // TODO: determine actual max size
+			m_HandshakeSentTime = i2p::util::GetMillisecondsSinceEpoch ();
 			// we receive first 64 bytes (32 Y, and 32 ChaCha/Poly frame) first
 			boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionCreatedBuffer, 64), boost::asio::transfer_all (),
 				std::bind(&NTCP2Session::HandleSessionCreatedReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
@@ -492,7 +581,7 @@ namespace transport
 			{
 				if (paddingLen > 0)
 				{
-					if (paddingLen <= 287 - 64) // session request is 287 bytes max
+					if (paddingLen <= NTCP2_SESSION_REQUEST_MAX_SIZE - 64) // session request is 287 bytes max
 					{
 						boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionRequestBuffer + 64, paddingLen), boost::asio::transfer_all (),
 							std::bind(&NTCP2Session::HandleSessionRequestPaddingReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
@@ -524,6 +613,7 @@ namespace transport
 
 	void NTCP2Session::SendSessionCreated ()
 	{
+		m_Establisher->CreateEphemeralKey (); // SessionRequest is valid
 		m_Establisher->CreateSessionCreatedMessage ();
 		// send message		
 		boost::asio::async_write (m_Socket, boost::asio::buffer (m_Establisher->m_SessionCreatedBuffer, m_Establisher->m_SessionCreatedBufferLen), boost::asio::transfer_all (),
@@ -540,12 +630,13 @@ namespace transport
 		else
 		{
 			LogPrint (eLogDebug, "NTCP2: SessionCreated received ", bytes_transferred);
+			m_RTT = i2p::util::GetMillisecondsSinceEpoch () - m_HandshakeSentTime;
 			uint16_t paddingLen = 0;
 			if (m_Establisher->ProcessSessionCreatedMessage (paddingLen))
 			{
 				if (paddingLen > 0)
 				{
-					if (paddingLen <= 287 - 64) // session created is 287 bytes max
+					if (paddingLen <= NTCP2_SESSION_CREATED_MAX_SIZE - 64) // session created is 287 bytes max
 					{
 						boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionCreatedBuffer + 64, paddingLen), boost::asio::transfer_all (),
 							std::bind(&NTCP2Session::HandleSessionCreatedPaddingReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
@@ -598,8 +689,6 @@ namespace transport
 		m_SendKey = m_Kab;
 		m_ReceiveKey = m_Kba; 
 		SetSipKeys (m_Sipkeysab, m_Sipkeysba);
-		memcpy (m_ReceiveIV.buf, m_Sipkeysba + 16, 8);
-		memcpy (m_SendIV.buf, m_Sipkeysab + 16, 8);
 		Established ();
 		ReceiveLength ();
 
@@ -619,7 +708,8 @@ namespace transport
 		else
 		{
 			LogPrint (eLogDebug, "NTCP2: SessionCreated sent");
-			m_Establisher->m_SessionConfirmedBuffer = new uint8_t[m_Establisher->m3p2Len + 48]; 
+			m_HandshakeSentTime = i2p::util::GetMillisecondsSinceEpoch ();
+			m_Establisher->CreateSessionConfirmedBuffer ();
 			boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionConfirmedBuffer, m_Establisher->m3p2Len + 48), boost::asio::transfer_all (),
 				std::bind(&NTCP2Session::HandleSessionConfirmedReceived , shared_from_this (), std::placeholders::_1, std::placeholders::_2));
 		}
@@ -635,6 +725,7 @@ namespace transport
 		else
 		{
 			LogPrint (eLogDebug, "NTCP2: SessionConfirmed received");
+			m_RTT = i2p::util::GetMillisecondsSinceEpoch () - m_HandshakeSentTime; // includes Alice's processing
 			// part 1
 			uint8_t nonce[12];
 			CreateNonce (1, nonce);
@@ -650,8 +741,6 @@ namespace transport
 					m_SendKey = m_Kba;
 					m_ReceiveKey = m_Kab; 
 					SetSipKeys (m_Sipkeysba, m_Sipkeysab);
-					memcpy (m_ReceiveIV.buf, m_Sipkeysab + 16, 8);
-					memcpy (m_SendIV.buf, m_Sipkeysba + 16, 8);
 					// payload
 					// process RI
 					if (buf[0] != eNTCP2BlkRouterInfo)
@@ -714,22 +803,9 @@ namespace transport
 
 	void NTCP2Session::SetSipKeys (const uint8_t * sendSipKey, const uint8_t * receiveSipKey)
 	{
-#if OPENSSL_SIPHASH
-		m_SendSipKey = EVP_PKEY_new_raw_private_key (EVP_PKEY_SIPHASH, nullptr, sendSipKey, 16);
-		m_SendMDCtx = EVP_MD_CTX_create ();	
-		EVP_PKEY_CTX *ctx = nullptr;
-		EVP_DigestSignInit (m_SendMDCtx, &ctx, nullptr, nullptr, m_SendSipKey);
-		EVP_PKEY_CTX_ctrl (ctx, -1, EVP_PKEY_OP_SIGNCTX, EVP_PKEY_CTRL_SET_DIGEST_SIZE, 8, nullptr);	
-
-		m_ReceiveSipKey = EVP_PKEY_new_raw_private_key (EVP_PKEY_SIPHASH, nullptr, receiveSipKey, 16);
-		m_ReceiveMDCtx = EVP_MD_CTX_create ();	
-		ctx = nullptr;
-		EVP_DigestSignInit (m_ReceiveMDCtx, &ctx, NULL, NULL, m_ReceiveSipKey);
-		EVP_PKEY_CTX_ctrl (ctx, -1, EVP_PKEY_OP_SIGNCTX, EVP_PKEY_CTRL_SET_DIGEST_SIZE, 8, nullptr);
-#else
-		m_SendSipKey = sendSipKey;
-		m_ReceiveSipKey = receiveSipKey;
-#endif
+		// 16 bytes key followed by 8 bytes IV
+		m_SendLengthMasks.Init (sendSipKey, sendSipKey + 16);
+		m_ReceiveLengthMasks.Init (receiveSipKey, receiveSipKey + 16);
 	}
 
 	void NTCP2Session::ClientLogin ()
@@ -740,8 +816,6 @@ namespace transport
 
 	void NTCP2Session::ServerLogin ()
 	{
-		m_Establisher->CreateEphemeralKey ();
-		m_Establisher->m_SessionRequestBuffer = new uint8_t[287]; // 287 bytes max for now
 		boost::asio::async_read (m_Socket, boost::asio::buffer(m_Establisher->m_SessionRequestBuffer, 64), boost::asio::transfer_all (),
 			std::bind(&NTCP2Session::HandleSessionRequestReceived, shared_from_this (),
 				std::placeholders::_1, std::placeholders::_2));
@@ -764,21 +838,12 @@ namespace transport
 		}
 		else
 		{
-#if OPENSSL_SIPHASH
-			EVP_DigestSignInit (m_ReceiveMDCtx, nullptr, nullptr, nullptr, nullptr);
-			EVP_DigestSignUpdate (m_ReceiveMDCtx, m_ReceiveIV.buf, 8); 
-			size_t l = 8;    
-			EVP_DigestSignFinal (m_ReceiveMDCtx, m_ReceiveIV.buf, &l);   
-#else
-			i2p::crypto::Siphash<8> (m_ReceiveIV.buf, m_ReceiveIV.buf, 8, m_ReceiveSipKey);
-#endif
 			// m_NextReceivedLen comes from the network in BigEndian
-			m_NextReceivedLen = be16toh (m_NextReceivedLen) ^ le16toh (m_ReceiveIV.key);
+			m_NextReceivedLen = be16toh (m_NextReceivedLen) ^ m_ReceiveLengthMasks.GetNext ();
 			LogPrint (eLogDebug, "NTCP2: received length ", m_NextReceivedLen);
 			if (m_NextReceivedLen >= 16)
 			{	
-				if (m_NextReceivedBuffer) delete[] m_NextReceivedBuffer;
-				m_NextReceivedBuffer = new uint8_t[m_NextReceivedLen];
+				CreateNextReceivedBuffer ();
 				boost::system::error_code ec;
 				size_t moreBytes = m_Socket.available(ec);
 				if (!ec && moreBytes >= m_NextReceivedLen)
@@ -823,8 +888,9 @@ namespace transport
 			if (i2p::crypto::AEADChaCha20Poly1305 (m_NextReceivedBuffer, m_NextReceivedLen-16, nullptr, 0, m_ReceiveKey, nonce, m_NextReceivedBuffer, m_NextReceivedLen, false))
 			{	
 				LogPrint (eLogDebug, "NTCP2: received message decrypted");
-				ProcessNextFrame (m_NextReceivedBuffer, m_NextReceivedLen-16);
-				delete[] m_NextReceivedBuffer; m_NextReceivedBuffer = nullptr; // we don't need received buffer anymore
+				if (!ProcessNextFrameInPlace ())
+					ProcessNextFrame (m_NextReceivedBuffer, m_NextReceivedLen-16);
+				DeleteNextReceivedBuffer (); // we don't need received buffer anymore
 				ReceiveLength ();
 			}
 			else
@@ -835,8 +901,65 @@ namespace transport
 		}
 	}
 
+	void NTCP2Session::CreateNextReceivedBuffer ()
+	{
+		DeleteNextReceivedBuffer ();
+		if (m_NextReceivedLen <= I2NP_MAX_MEDIUM_MESSAGE_SIZE)
+		{
+			// most frames fit to I2NP message buffers, take one from thread's pool
+			m_NextReceivedFrame = NewI2NPMessage (m_NextReceivedLen + 16);
+			// leave 4 bytes in front for full I2NP header and align it as for tunnel msg
+			size_t frameOffset = 4 + (12 - ((size_t)m_NextReceivedFrame->buf) % 12) % 12;
+			if (m_NextReceivedFrame->maxLen >= frameOffset + m_NextReceivedLen)
+			{
+				m_NextReceivedBuffer = m_NextReceivedFrame->buf + frameOffset;
+				return;
+			}
+			m_NextReceivedFrame = nullptr;
+		}
+		m_NextReceivedBuffer = new uint8_t[m_NextReceivedLen];
+	}
+
+	void NTCP2Session::DeleteNextReceivedBuffer ()
+	{
+		if (m_NextReceivedFrame)
+			m_NextReceivedFrame = nullptr; // back to pool
+		else
+			delete[] m_NextReceivedBuffer;
+		m_NextReceivedBuffer = nullptr;
+	}
+
+	bool NTCP2Session::ProcessNextFrameInPlace ()
+	{
+		if (!m_NextReceivedFrame) return false;
+		const uint8_t * frame = m_NextReceivedBuffer;
+		size_t len = m_NextReceivedLen - 16;
+		if (len < 3 || frame[0] != eNTCP2BlkI2NPMessage) return false;
+		size_t size = bufbe16toh (frame + 1);
+		if (size < I2NP_NTCP2_HEADER_SIZE || size + 3 > len) return false;
+		// the rest must be padding
+		for (size_t offset = size + 3; offset < len;)
+		{
+			if (offset + 3 > len || frame[offset] != eNTCP2BlkPadding) return false;
+			offset += bufbe16toh (frame + offset + 1) + 3;
+			if (offset > len) return false;
+		}
+		i2p::metrics::ntcp2ReceivedFrames.Inc ();
+		LogPrint (eLogDebug, "NTCP2: I2NP");
+		// NTCP2 header of I2NP block is followed by payload, so full header fits in front of it
+		auto msg = m_NextReceivedFrame;
+		m_NextReceivedFrame = nullptr; m_NextReceivedBuffer = nullptr; // owned by message now
+		msg->offset = frame + 3 + I2NP_NTCP2_HEADER_SIZE - I2NP_HEADER_SIZE - msg->buf;
+		msg->len = msg->offset + size + 7; // 7 more bytes for full I2NP header
+		msg->FromNTCP2 ();
+		m_Handler.PutNextMessage (msg);
+		m_Handler.Flush ();
+		return true;
+	}
+
 	void NTCP2Session::ProcessNextFrame (const uint8_t * frame, size_t len)
 	{
+		i2p::metrics::ntcp2ReceivedFrames.Inc ();
 		size_t offset = 0;
 		while (offset < len)
 		{
@@ -902,16 +1025,8 @@ namespace transport
 
 	void NTCP2Session::SetNextSentFrameLength (size_t frameLen, uint8_t * lengthBuf)
 	{
-		#if OPENSSL_SIPHASH
-		EVP_DigestSignInit (m_SendMDCtx, nullptr, nullptr, nullptr, nullptr);
-		EVP_DigestSignUpdate (m_SendMDCtx, m_SendIV.buf, 8); 
-		size_t l = 8;    
-		EVP_DigestSignFinal (m_SendMDCtx, m_SendIV.buf, &l);   
-#else
-		i2p::crypto::Siphash<8> (m_SendIV.buf, m_SendIV.buf, 8, m_SendSipKey);
-#endif
 		// length must be in BigEndian
-		htobe16buf (lengthBuf, frameLen ^ le16toh (m_SendIV.key));
+		htobe16buf (lengthBuf, frameLen ^ m_SendLengthMasks.GetNext ());
 		LogPrint (eLogDebug, "NTCP2: sent length ", frameLen);
 	}	
 
@@ -920,12 +1035,13 @@ namespace transport
 		if (msgs.empty () || IsTerminated ()) return;
 		
 		size_t totalLen = 0;
-		std::vector<std::pair<uint8_t *, size_t> > encryptBufs;
+		auto& encryptBufs = m_EncryptBufs; encryptBufs.clear (); // keep capacity between sends
 		std::vector<boost::asio::const_buffer> bufs; 
 		std::shared_ptr<I2NPMessage> first;
 		uint8_t * macBuf = nullptr;
 		for (auto& it: msgs) 
 		{	
+			if (it->traceTime) i2p::metrics::tracer.Record (i2p::metrics::eTraceStageWrite, it->traceTime);
 			it->ToNTCP2 ();
 			auto buf = it->GetNTCP2Header ();
 			auto len = it->GetNTCP2Length ();
@@ -981,6 +1097,7 @@ namespace transport
 			
 		// send buffers
 		m_IsSending = true;	
+		i2p::metrics::ntcp2SentFrames.Inc ();
 		boost::asio::async_write (m_Socket, bufs, boost::asio::transfer_all (),
 			std::bind(&NTCP2Session::HandleI2NPMsgsSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
 	}	
@@ -1005,6 +1122,7 @@ namespace transport
 		SetNextSentFrameLength (payloadLen + 16, m_NextSendBuffer);
 		// send
 		m_IsSending = true;	
+		i2p::metrics::ntcp2SentFrames.Inc ();
 		boost::asio::async_write (m_Socket, boost::asio::buffer (m_NextSendBuffer, payloadLen + 16 + 2), boost::asio::transfer_all (),
 			std::bind(&NTCP2Session::HandleNextFrameSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
 	}
@@ -1030,29 +1148,42 @@ namespace transport
 	
 	void NTCP2Session::SendQueue ()
 	{
-		if (!m_SendQueue.empty ())
+		// pick up messages pushed since, they go to the same frame
+		std::vector<std::shared_ptr<I2NPMessage> > pending;
+		GetOutgoingMessages (pending);
+		for (auto& it: pending)
+			m_SendQueue.Put (it);
+		if (!m_SendQueue.IsEmpty ())
 		{
+			auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
 			std::vector<std::shared_ptr<I2NPMessage> > msgs;
 			size_t s = 0;
-			while (!m_SendQueue.empty ())
+			while (!m_SendQueue.IsEmpty ())
 			{
-				auto msg = m_SendQueue.front ();
+				auto msg = m_SendQueue.Front ();
 				size_t len = msg->GetNTCP2Length (); 
-				if (s + len + 3 <= NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) // 3 bytes block header
+				if (msg->GetExpiration () < ts)
+				{
+					LogPrint (eLogDebug, "NTCP2: I2NP message expired in queue. Dropped");
+					i2p::metrics::ntcp2DroppedMessages.Inc ();
+					m_SendQueue.Pop ();
+				}
+				else if (s + len + 3 <= NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) // 3 bytes block header
 				{
 					msgs.push_back (msg);
 					s += (len + 3);
-					m_SendQueue.pop_front ();
+					m_SendQueue.Pop ();
 				}
 				else if (len + 3 > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE)
 				{
 					LogPrint (eLogError, "NTCP2: I2NP message of size ", len, " can't be sent. Dropped");
-					m_SendQueue.pop_front ();
+					m_SendQueue.Pop ();
 				}
 				else
 					break;
 			}
-			SendI2NPMsgs (msgs);
+			UpdateCongestion ();
+			if (!msgs.empty ()) SendI2NPMsgs (msgs);
 		} 
 	}
 
@@ -1064,7 +1195,7 @@ namespace transport
 		size_t paddingSize = (msgLen*NTCP2_MAX_PADDING_RATIO)/100;
 		if (msgLen + paddingSize + 3 > NTCP2_UNENCRYPTED_FRAME_MAX_SIZE) paddingSize = NTCP2_UNENCRYPTED_FRAME_MAX_SIZE - msgLen -3;
 		if (paddingSize > len) paddingSize = len;
-		if (paddingSize) paddingSize = rand () % paddingSize;
+		if (paddingSize) paddingSize = i2p::crypto::RandUint32 () % paddingSize;
 		buf[0] = eNTCP2BlkPadding; // blk
 		htobe16buf (buf + 1, paddingSize); // size
 		memset (buf + 3, 0, paddingSize);			
@@ -1090,7 +1221,7 @@ namespace transport
 
 	void NTCP2Session::SendTermination (NTCP2TerminationReason reason)
 	{
-		if (!m_SendKey || !m_SendSipKey) return;
+		if (!m_SendKey) return; // data phase keys are set together with sip keys
 		m_NextSendBuffer = new uint8_t[49]; // 49 = 12 bytes message + 16 bytes MAC + 2 bytes size + up to 19 padding block 		
 		// termination block
 		m_NextSendBuffer[2] = eNTCP2BlkTermination;
@@ -1106,37 +1237,78 @@ namespace transport
 	void NTCP2Session::SendTerminationAndTerminate (NTCP2TerminationReason reason)
 	{
 		SendTermination (reason);
-		m_Server.GetService ().post (std::bind (&NTCP2Session::Terminate, shared_from_this ())); // let termination message go
+		m_Service.post (std::bind (&NTCP2Session::Terminate, shared_from_this ())); // let termination message go
 	}
 
 	void NTCP2Session::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Server.GetService ().post (std::bind (&NTCP2Session::PostI2NPMessages, shared_from_this (), msgs));
+		if (PutOutgoingMessages (msgs))
+			m_Service.post (std::bind (&NTCP2Session::PostI2NPMessages, shared_from_this ()));
 	}
 
-	void NTCP2Session::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	void NTCP2Session::PostI2NPMessages ()
 	{
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		GetOutgoingMessages (msgs);
 		if (m_IsTerminated) return;
+		bool dropped = false;
 		for (auto it: msgs)
-			m_SendQueue.push_back (it);
-		if (!m_IsSending) 
-			SendQueue ();	
-		else if (m_SendQueue.size () > NTCP2_MAX_OUTGOING_QUEUE_SIZE)
+			if (!m_SendQueue.Put (it)) dropped = true;
+		if (dropped)
+			LogPrint (eLogDebug, "NTCP2: outgoing messages queue is full. Dropped");
+		UpdateCongestion ();
+		if (!m_IsSending)
 		{
-			LogPrint (eLogWarning, "NTCP2: outgoing messages queue size exceeds ", NTCP2_MAX_OUTGOING_QUEUE_SIZE);
-			Terminate ();
-		}	
+			auto delay = m_Server.GetCoalesceDelay ();
+			if (delay > 0 && m_SendQueue.GetLength () < m_Server.GetCoalesceSize ())
+			{
+				// wait a little for more messages, small ones would take a frame each otherwise
+				if (!m_IsCoalescing)
+				{
+					m_IsCoalescing = true;
+					m_CoalesceTimer.expires_from_now (boost::posix_time::microseconds (delay));
+					m_CoalesceTimer.async_wait (std::bind (&NTCP2Session::HandleCoalesceTimer,
+						shared_from_this (), std::placeholders::_1));
+				}
+			}
+			else
+			{
+				if (m_IsCoalescing)
+				{
+					m_IsCoalescing = false;
+					m_CoalesceTimer.cancel ();
+				}
+				SendQueue ();
+			}
+		}
+	}
+
+	void NTCP2Session::UpdateCongestion ()
+	{
+		auto size = m_SendQueue.GetSize ();
+		bool congested = m_IsCongested ? size >= NTCP2_CONGESTION_LOW_QUEUE_SIZE : size > NTCP2_CONGESTION_HIGH_QUEUE_SIZE;
+		if (SetCongested (congested) && m_RemoteIdentity)
+			transports.SetPeerCongested (m_RemoteIdentity->GetIdentHash (), congested);
+	}
+
+	void NTCP2Session::HandleCoalesceTimer (const boost::system::error_code& ecode)
+	{
+		if (ecode == boost::asio::error::operation_aborted || !m_IsCoalescing) return;
+		m_IsCoalescing = false;
+		if (!m_IsSending && !m_IsTerminated)
+			SendQueue ();
 	}
 
 	void NTCP2Session::SendLocalRouterInfo ()
 	{
 		if (!IsOutgoing ()) // we send it in SessionConfirmed
-			m_Server.GetService ().post (std::bind (&NTCP2Session::SendRouterInfo, shared_from_this ()));
+			m_Service.post (std::bind (&NTCP2Session::SendRouterInfo, shared_from_this ()));
 	}
 
 	NTCP2Server::NTCP2Server ():
 		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),
-		m_TerminationTimer (m_Service)
+		m_TerminationTimer (m_Service), m_NextSessionService (0),
+		m_CoalesceDelay (0), m_CoalesceSize (0)
 	{
 	}
 
@@ -1150,7 +1322,24 @@ namespace transport
 		if (!m_IsRunning)
 		{
 			m_IsRunning = true;
-			m_Thread = new std::thread (std::bind (&NTCP2Server::Run, this));
+			m_Thread = new std::thread (std::bind (&NTCP2Server::Run, this, std::ref (m_Service)));
+			uint16_t numThreads; i2p::config::GetOption("ntcp2.threads", numThreads);
+			if (!numThreads) numThreads = std::thread::hardware_concurrency ();
+			int coalesceDelay; i2p::config::GetOption("ntcp2.coalescedelay", coalesceDelay);
+			m_CoalesceDelay = coalesceDelay > 0 ? coalesceDelay : 0;
+			int coalesceSize; i2p::config::GetOption("ntcp2.coalescesize", coalesceSize);
+			m_CoalesceSize = coalesceSize > 0 ? coalesceSize : 0;
+			if (numThreads > 1)
+			{
+				// sessions are spread across own loops, m_Service accepts and runs termination timer
+				for (int i = 0; i < numThreads; i++)
+				{
+					m_SessionServices.emplace_back (new boost::asio::io_service ());
+					m_SessionWorks.emplace_back (new boost::asio::io_service::work (*m_SessionServices.back ()));
+					m_SessionThreads.emplace_back (new std::thread (std::bind (&NTCP2Server::Run, this, std::ref (*m_SessionServices.back ()))));
+				}
+				LogPrint (eLogInfo, "NTCP2: ", numThreads, " session threads started");
+			}
 			auto& addresses = context.GetRouterInfo ().GetAddresses ();
 			for (const auto& address: addresses)
 			{
@@ -1201,35 +1390,50 @@ namespace transport
 	{
 		{
 			// we have to copy it because Terminate changes m_NTCP2Sessions
-			auto ntcpSessions = m_NTCP2Sessions;
+			decltype(m_NTCP2Sessions) ntcpSessions;
+			{
+				std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+				ntcpSessions = m_NTCP2Sessions;
+			}
 			for (auto& it: ntcpSessions)
 				it.second->Terminate ();
 			for (auto& it: m_PendingIncomingSessions)
 				it->Terminate ();
 		}
-		m_NTCP2Sessions.clear ();
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			m_NTCP2Sessions.clear ();
+		}
 
 		if (m_IsRunning)
 		{
 			m_IsRunning = false;
 			m_TerminationTimer.cancel ();
 			m_Service.stop ();
+			for (auto& it: m_SessionServices)
+				it->stop ();
 			if (m_Thread)
 			{
 				m_Thread->join ();
 				delete m_Thread;
 				m_Thread = nullptr;
 			}
+			for (auto& it: m_SessionThreads)
+				it->join ();
+			m_SessionThreads.clear ();
+			m_SessionWorks.clear ();
+			m_SessionServices.clear ();
 		}
 	}
 
-	void NTCP2Server::Run ()
+	void NTCP2Server::Run (boost::asio::io_service& service)
 	{
+		i2p::util::InitThread ("NTCP2", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (service, "NTCP2");
 			}
 			catch (std::exception& ex)
 			{
@@ -1242,25 +1446,40 @@ namespace transport
 	{
 		if (!session || !session->GetRemoteIdentity ()) return false;
 		auto& ident = session->GetRemoteIdentity ()->GetIdentHash ();
-		auto it = m_NTCP2Sessions.find (ident);
-		if (it != m_NTCP2Sessions.end ())
+		bool inserted = false;
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			inserted = m_NTCP2Sessions.insert (std::make_pair (ident, session)).second;
+		}
+		if (!inserted)
 		{
 			LogPrint (eLogWarning, "NTCP2: session to ", ident.ToBase64 (), " already exists");
 			session->Terminate();
 			return false;
 		}
-		m_NTCP2Sessions.insert (std::make_pair (ident, session));
 		return true;
 	}
 
 	void NTCP2Server::RemoveNTCP2Session (std::shared_ptr<NTCP2Session> session)
 	{
 		if (session && session->GetRemoteIdentity ())
-			m_NTCP2Sessions.erase (session->GetRemoteIdentity ()->GetIdentHash ());
+		{
+			std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+			auto it = m_NTCP2Sessions.find (session->GetRemoteIdentity ()->GetIdentHash ());
+			if (it != m_NTCP2Sessions.end () && it->second == session) // don't remove other session to same router
+				m_NTCP2Sessions.erase (it);
+		}
+	}
+
+	boost::asio::io_service& NTCP2Server::GetNextSessionService ()
+	{
+		if (m_SessionServices.empty ()) return m_Service;
+		return *m_SessionServices[m_NextSessionService++ % m_SessionServices.size ()];
 	}
 
 	std::shared_ptr<NTCP2Session> NTCP2Server::FindNTCP2Session (const i2p::data::IdentHash& ident)
 	{
+		std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
 		auto it = m_NTCP2Sessions.find (ident);
 		if (it != m_NTCP2Sessions.end ())
 			return it->second;
@@ -1270,11 +1489,11 @@ namespace transport
 	void NTCP2Server::Connect(const boost::asio::ip::address & address, uint16_t port, std::shared_ptr<NTCP2Session> conn)
 	{
 		LogPrint (eLogDebug, "NTCP2: Connecting to ", address ,":",  port);
-		m_Service.post([this, address, port, conn]() 
+		conn->GetService ().post([this, address, port, conn]() 
 			{
 				if (this->AddNTCP2Session (conn))
 				{
-					auto timer = std::make_shared<boost::asio::deadline_timer>(m_Service);
+					auto timer = std::make_shared<boost::asio::deadline_timer>(conn->GetService ());
 					auto timeout = NTCP2_CONNECT_TIMEOUT * 5;
 					conn->SetTerminationTimeout(timeout * 2);
 					timer->expires_from_now (boost::posix_time::seconds(timeout));
@@ -1311,16 +1530,21 @@ namespace transport
 
 	void NTCP2Server::HandleAccept (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error)
 	{
-		if (!error)
+		if (!error && conn)
 		{
 			boost::system::error_code ec;
 			auto ep = conn->GetSocket ().remote_endpoint(ec);
 			if (!ec)
 			{
 				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
-				if (conn)
+				if (!transports.GetHandshakesFilter ().Accept (ep.address ()))
+				{
+					LogPrint (eLogInfo, "NTCP2: Too many connections from ", ep.address ());
+					conn->GetSocket ().close ();
+				}
+				else
 				{
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCP2Session::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}
 			}
@@ -1338,16 +1562,21 @@ namespace transport
 
 	void NTCP2Server::HandleAcceptV6 (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error)
 	{
-		if (!error)
+		if (!error && conn)
 		{
 			boost::system::error_code ec;
 			auto ep = conn->GetSocket ().remote_endpoint(ec);
 			if (!ec)
 			{
 				LogPrint (eLogDebug, "NTCP2: Connected from ", ep);
-				if (conn)
+				if (!transports.GetHandshakesFilter ().Accept (ep.address ()))
+				{
+					LogPrint (eLogInfo, "NTCP2: Too many connections from ", ep.address ());
+					conn->GetSocket ().close ();
+				}
+				else
 				{
-					conn->ServerLogin ();
+					conn->GetService ().post (std::bind (&NTCP2Session::ServerLogin, conn));
 					m_PendingIncomingSessions.push_back (conn);
 				}
 			}
@@ -1376,13 +1605,16 @@ namespace transport
 		{
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
 			// established
-			for (auto& it: m_NTCP2Sessions)
-				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					LogPrint (eLogDebug, "NTCP2: No activity for ", session->GetTerminationTimeout (), " seconds");
-					session->TerminateByTimeout (); // it doesn't change m_NTCP2Session right a way
-				}
+			{
+				std::unique_lock<std::mutex> l(m_NTCP2SessionsMutex);
+				for (auto& it: m_NTCP2Sessions)
+					if (it.second->IsTerminationTimeoutExpired (ts))
+					{
+						auto session = it.second;
+						LogPrint (eLogDebug, "NTCP2: No activity for ", session->GetTerminationTimeout (), " seconds");
+						session->GetService ().post (std::bind (&NTCP2Session::TerminateByTimeout, session)); // in session's thread
+					}
+			}
 			// pending
 			for (auto it = m_PendingIncomingSessions.begin (); it != m_PendingIncomingSessions.end ();)
 			{
@@ -1390,7 +1622,7 @@ namespace transport
 					it = m_PendingIncomingSessions.erase (it); // established or terminated
 				else if ((*it)->IsTerminationTimeoutExpired (ts))
 				{
-					(*it)->Terminate ();
+					(*it)->GetService ().post (std::bind (&NTCP2Session::Terminate, *it));
 					it = m_PendingIncomingSessions.erase (it); // expired
 				}
 				else
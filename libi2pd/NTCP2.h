@@ -14,13 +14,19 @@
 #include <inttypes.h>
 #include <memory>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
 #include <list>
+#include <deque>
 #include <map>
+#include <unordered_map>
 #include <array>
 #include <openssl/bn.h>
 #include <openssl/evp.h>
 #include <boost/asio.hpp>
 #include "Crypto.h"
+#include "Siphash.h"
 #include "util.h"
 #include "RouterInfo.h"
 #include "TransportSession.h"
@@ -39,7 +45,9 @@ namespace transport
 	const int NTCP2_TERMINATION_CHECK_TIMEOUT = 30; // 30 seconds
 
 	const int NTCP2_CLOCK_SKEW = 60; // in seconds	
-	const int NTCP2_MAX_OUTGOING_QUEUE_SIZE = 500; // how many messages we can queue up
+	const size_t NTCP2_MAX_OUTGOING_QUEUE_SIZE = 500; // how many messages we can queue up
+	const size_t NTCP2_CONGESTION_HIGH_QUEUE_SIZE = 375; // peer becomes congested if more messages queued
+	const size_t NTCP2_CONGESTION_LOW_QUEUE_SIZE = 125; // and stays congested until less
 
 	enum NTCP2BlockType
 	{
@@ -76,12 +84,48 @@ namespace transport
 	// RouterInfo flags
 	const uint8_t NTCP2_ROUTER_INFO_FLAG_REQUEST_FLOOD = 0x01;	
 
+	/** @brief bounded outgoing queue, one ring per traffic class, higher priority class goes first.
+	 *  If full expired messages are dropped, then the oldest of the lowest priority class */
+	class NTCP2SendQueue
+	{
+		public:
+
+			NTCP2SendQueue (): m_Size (0) {};
+
+			bool Put (std::shared_ptr<I2NPMessage> msg); // false if a message was dropped
+			std::shared_ptr<I2NPMessage> Front () const; // highest priority, nullptr if empty
+			void Pop ();
+			void Clear ();
+			size_t GetSize () const { return m_Size; };
+			bool IsEmpty () const { return !m_Size; };
+			size_t GetLength () const; // in bytes, with block headers
+
+		private:
+
+			size_t DropExpired ();
+
+		private:
+
+			std::deque<std::shared_ptr<I2NPMessage> > m_Queues[eNumTrafficClasses];
+			size_t m_Size;
+	};
+
+	const size_t NTCP2_SESSION_REQUEST_MAX_SIZE = 287;
+	const size_t NTCP2_SESSION_CREATED_MAX_SIZE = 287;
+	const size_t NTCP2_SESSION_CONFIRMED_POOLED_SIZE = 2048; // m3p1 and m3p2 with usual RouterInfo, larger is allocated
+	struct NTCP2HandshakeBuffers // taken from pool for establisher's lifetime
+	{
+		uint8_t sessionRequest[NTCP2_SESSION_REQUEST_MAX_SIZE];
+		uint8_t sessionCreated[NTCP2_SESSION_CREATED_MAX_SIZE];
+		uint8_t sessionConfirmed[NTCP2_SESSION_CONFIRMED_POOLED_SIZE];
+	};
+
 	struct NTCP2Establisher
 	{
 		NTCP2Establisher ();
 		~NTCP2Establisher ();
 		
-		const uint8_t * GetPub () const { return m_EphemeralKeys.GetPublicKey (); };
+		const uint8_t * GetPub () const { return m_EphemeralKeys->GetPublicKey (); };
 		const uint8_t * GetRemotePub () const { return m_RemoteEphemeralPublicKey; }; // Y for Alice and X for Bob
 		uint8_t * GetRemotePub () { return m_RemoteEphemeralPublicKey; }; // to set
 
@@ -101,6 +145,7 @@ namespace transport
 		void KeyDerivationFunction1 (const uint8_t * pub, i2p::crypto::X25519Keys& priv, const uint8_t * rs, const uint8_t * epub); // for SessionRequest, (pub, priv) for DH
 		void KeyDerivationFunction2 (const uint8_t * sessionRequest, size_t sessionRequestLen, const uint8_t * epub); // for SessionCreate
 		void CreateEphemeralKey ();
+		void CreateSessionConfirmedBuffer (); // for m3p2Len
 
 		void CreateSessionRequestMessage ();
 		void CreateSessionCreatedMessage ();
@@ -112,14 +157,16 @@ namespace transport
 		bool ProcessSessionConfirmedMessagePart1 (const uint8_t * nonce);
 		bool ProcessSessionConfirmedMessagePart2 (const uint8_t * nonce, uint8_t * m3p2Buf);
 
-		i2p::crypto::X25519Keys m_EphemeralKeys;
+		std::shared_ptr<i2p::crypto::X25519Keys> m_EphemeralKeys;
 		uint8_t m_RemoteEphemeralPublicKey[32]; // x25519
 		uint8_t m_RemoteStaticKey[32], m_IV[16], m_H[32] /*h*/, m_CK[33] /*ck*/, m_K[32] /*k*/;
 		i2p::data::IdentHash m_RemoteIdentHash;
 		uint16_t m3p2Len; 
 
+		NTCP2HandshakeBuffers * m_Buffers;
 		uint8_t * m_SessionRequestBuffer, * m_SessionCreatedBuffer, * m_SessionConfirmedBuffer;
 		size_t m_SessionRequestBufferLen, m_SessionCreatedBufferLen;
+		bool m_IsSessionConfirmedBufferAllocated;
 
 	};		
 
@@ -135,9 +182,11 @@ namespace transport
 			void Done ();
 
 			boost::asio::ip::tcp::socket& GetSocket () { return m_Socket; };
+			boost::asio::io_service& GetService () { return m_Service; };
 
 			bool IsEstablished () const { return m_IsEstablished; };
 			bool IsTerminated () const { return m_IsTerminated; };
+			int GetRTT () const { return m_RTT; };
 
 			void ClientLogin (); // Alice 
 			void ServerLogin (); // Bob
@@ -173,6 +222,9 @@ namespace transport
 			void Receive ();
 			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			void ProcessNextFrame (const uint8_t * frame, size_t len);
+			bool ProcessNextFrameInPlace (); // single I2NP block becomes message without copy
+			void CreateNextReceivedBuffer ();
+			void DeleteNextReceivedBuffer ();
 
 			void SetNextSentFrameLength (size_t frameLen, uint8_t * lengthBuf);
 			void SendI2NPMsgs (std::vector<std::shared_ptr<I2NPMessage> >& msgs);
@@ -184,37 +236,35 @@ namespace transport
 			void SendRouterInfo ();
 			void SendTermination (NTCP2TerminationReason reason);
 			void SendTerminationAndTerminate (NTCP2TerminationReason reason);
-			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			void PostI2NPMessages ();
+			void UpdateCongestion ();
+			void HandleCoalesceTimer (const boost::system::error_code& ecode);
 
 		private:
 
 			NTCP2Server& m_Server;
+			boost::asio::io_service& m_Service; // session's loop
 			boost::asio::ip::tcp::socket m_Socket;
 			bool m_IsEstablished, m_IsTerminated;
+			uint64_t m_HandshakeSentTime; // SessionRequest or SessionCreated, in milliseconds
+			int m_RTT; // from handshake, in milliseconds
 
 			std::unique_ptr<NTCP2Establisher> m_Establisher;
 			// data phase
 			uint8_t m_Kab[33], m_Kba[32], m_Sipkeysab[33], m_Sipkeysba[32]; 
 			const uint8_t * m_SendKey, * m_ReceiveKey;
-#if OPENSSL_SIPHASH 
-			EVP_PKEY * m_SendSipKey, * m_ReceiveSipKey;
-			EVP_MD_CTX * m_SendMDCtx, * m_ReceiveMDCtx;
-#else
-			const uint8_t * m_SendSipKey, * m_ReceiveSipKey;
-#endif
+			i2p::crypto::SiphashLengthMasks m_SendLengthMasks, m_ReceiveLengthMasks;
 			uint16_t m_NextReceivedLen; 
 			uint8_t * m_NextReceivedBuffer, * m_NextSendBuffer;
-			union
-			{
-				uint8_t buf[8];
-				uint16_t key;
-			} m_ReceiveIV, m_SendIV;
+			std::shared_ptr<I2NPMessage> m_NextReceivedFrame; // pooled buffer for m_NextReceivedBuffer, null if allocated
 			uint64_t m_ReceiveSequenceNumber, m_SendSequenceNumber;
 
 			i2p::I2NPMessagesHandler m_Handler;
 
-			bool m_IsSending;
-			std::list<std::shared_ptr<I2NPMessage> > m_SendQueue;
+			bool m_IsSending, m_IsCoalescing;
+			NTCP2SendQueue m_SendQueue;
+			boost::asio::deadline_timer m_CoalesceTimer; // waits for more messages to the same frame
+			std::vector<std::pair<uint8_t *, size_t> > m_EncryptBufs; // for SendI2NPMsgs
 	};
 
 	class NTCP2Server
@@ -232,12 +282,15 @@ namespace transport
 			std::shared_ptr<NTCP2Session> FindNTCP2Session (const i2p::data::IdentHash& ident);
 
 			boost::asio::io_service& GetService () { return m_Service; };
+			boost::asio::io_service& GetNextSessionService (); // round-robin
+			int GetCoalesceDelay () const { return m_CoalesceDelay; }; // in microseconds
+			size_t GetCoalesceSize () const { return m_CoalesceSize; };
 		
 			void Connect(const boost::asio::ip::address & address, uint16_t port, std::shared_ptr<NTCP2Session> conn);
 
 		private:
 
-			void Run ();
+			void Run (boost::asio::io_service& service);
 			void HandleAccept (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
 			void HandleAcceptV6 (std::shared_ptr<NTCP2Session> conn, const boost::system::error_code& error);
 
@@ -255,7 +308,15 @@ namespace transport
 			boost::asio::io_service::work m_Work;
 			boost::asio::deadline_timer m_TerminationTimer;
 			std::unique_ptr<boost::asio::ip::tcp::acceptor> m_NTCP2Acceptor, m_NTCP2V6Acceptor;
-			std::map<i2p::data::IdentHash, std::shared_ptr<NTCP2Session> > m_NTCP2Sessions; 
+			// sessions' loops, m_Service is used if we don't have them
+			std::vector<std::unique_ptr<boost::asio::io_service> > m_SessionServices;
+			std::vector<std::unique_ptr<boost::asio::io_service::work> > m_SessionWorks;
+			std::vector<std::unique_ptr<std::thread> > m_SessionThreads;
+			std::atomic<size_t> m_NextSessionService;
+			int m_CoalesceDelay;
+			size_t m_CoalesceSize;
+			mutable std::mutex m_NTCP2SessionsMutex;
+			std::unordered_map<i2p::data::IdentHash, std::shared_ptr<NTCP2Session> > m_NTCP2Sessions; 
 			std::list<std::shared_ptr<NTCP2Session> > m_PendingIncomingSessions;
 
 		public:
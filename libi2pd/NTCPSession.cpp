@@ -14,6 +14,7 @@
 #include "NTCPSession.h"
 #include "HTTP.h"
 #include "util.h"
+#include "Config.h"
 #ifdef WITH_EVENTS
 #include "Event.h"
 #endif
@@ -92,7 +93,8 @@ namespace transport
 			transports.PeerDisconnected (shared_from_this ());
 			m_Server.RemoveNTCPSession (shared_from_this ());
 			m_SendQueue.clear ();
-			m_NextMessage = nullptr;
+			if (!m_Server.IsDataPhaseOffloaded ()) // might be in use by worker otherwise
+				m_NextMessage = nullptr;
 			LogPrint (eLogDebug, "NTCP: session terminated");
 		}
 	}
@@ -205,7 +207,7 @@ namespace transport
 		SHA256(xy, 512, m_Establisher->phase2.encrypted.hxy);
 		uint32_t tsB = htobe32 (i2p::util::GetSecondsSinceEpoch ());
 		memcpy (m_Establisher->phase2.encrypted.timestamp, &tsB, 4);
-		RAND_bytes (m_Establisher->phase2.encrypted.filler, 12);
+		i2p::crypto::RandBytes (m_Establisher->phase2.encrypted.filler, 12);
 
 		m_Encryption.SetIV (y + 240);
 		m_Decryption.SetIV (m_Establisher->phase1.HXxorHI + 16);
@@ -298,7 +300,7 @@ namespace transport
 		{
 			paddingSize = 16 - paddingSize;
 			// fill padding with random data
-			RAND_bytes(buf, paddingSize);
+			i2p::crypto::RandBytes (buf, paddingSize);
 			buf += paddingSize;
 			len += paddingSize;
 		}
@@ -535,22 +537,22 @@ namespace transport
 			i2p::transport::transports.UpdateReceivedBytes (bytes_transferred);
 			m_ReceiveBufferOffset += bytes_transferred;
 
-			if (m_ReceiveBufferOffset >= 16)
+			if (m_Server.IsDataPhaseOffloaded ())
 			{
-				// process received data
-				uint8_t * nextBlock = m_ReceiveBuffer;
-				while (m_ReceiveBufferOffset >= 16)
-				{
-					if (!DecryptNextBlock (nextBlock)) // 16 bytes
+				// next read is issued after decryption, socket is not touched by worker
+				auto s = shared_from_this ();
+				m_Server.Work (s, [s]() -> NTCPServer::Pool::ResultFunc
 					{
-						Terminate ();
-						return;
-					}
-					nextBlock += 16;
-					m_ReceiveBufferOffset -= 16;
-				}
-				if (m_ReceiveBufferOffset > 0)
-					memcpy (m_ReceiveBuffer, nextBlock, m_ReceiveBufferOffset);
+						bool success = s->DecryptReceivedBlocks ();
+						if (success) s->m_Handler.Flush ();
+						return std::bind (&NTCPSession::HandleReceivedDecrypted, s, success);
+					});
+				return;
+			}
+			if (!DecryptReceivedBlocks ())
+			{
+				Terminate ();
+				return;
 			}
 
 			// read and process more is available
@@ -603,6 +605,34 @@ namespace transport
 		}
 	}
 
+	bool NTCPSession::DecryptReceivedBlocks ()
+	{
+		if (m_ReceiveBufferOffset < 16) return true;
+		uint8_t * nextBlock = m_ReceiveBuffer;
+		while (m_ReceiveBufferOffset >= 16)
+		{
+			if (!DecryptNextBlock (nextBlock)) // 16 bytes
+				return false;
+			nextBlock += 16;
+			m_ReceiveBufferOffset -= 16;
+		}
+		if (m_ReceiveBufferOffset > 0)
+			memcpy (m_ReceiveBuffer, nextBlock, m_ReceiveBufferOffset);
+		return true;
+	}
+
+	void NTCPSession::HandleReceivedDecrypted (bool success)
+	{
+		if (!success)
+		{
+			Terminate ();
+			return;
+		}
+		if (m_IsTerminated) return;
+		m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
+		Receive ();
+	}
+
 	bool NTCPSession::DecryptNextBlock (const uint8_t * encrypted) // 16 bytes
 	{
 		if (!m_NextMessage) // new message, header expected
@@ -619,7 +649,7 @@ namespace transport
 					LogPrint (eLogError, "NTCP: data size ", dataSize, " exceeds max size");
 					return false;
 				}
-				m_NextMessage = (dataSize + 16U + 15U) <= I2NP_MAX_SHORT_MESSAGE_SIZE - 2 ? NewI2NPShortMessage () : NewI2NPMessage ();
+				m_NextMessage = NewI2NPMessage (dataSize + 16U + 15U); // + 6 + padding
 				m_NextMessage->Align (16);
 				m_NextMessage->offset += 2; // size field
 				m_NextMessage->len = m_NextMessage->offset + dataSize;
@@ -650,7 +680,7 @@ namespace transport
 				if (!m_NextMessage->IsExpired ())
 				{
 #ifdef WITH_EVENTS
-					QueueIntEvent("transport.recvmsg", GetIdentHashBase64(), 1);
+					if (m_RemoteIdentity) QueueIntEvent(i2p::event::eCollectedTransportRecvMsg, m_RemoteIdentity->GetIdentHash(), 1);
 #endif
 					m_Handler.PutNextMessage (m_NextMessage);
 				}
@@ -666,9 +696,7 @@ namespace transport
 
 	void NTCPSession::Send (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
-		m_IsSending = true;
-		boost::asio::async_write (m_Socket, CreateMsgBuffer (msg), boost::asio::transfer_all (),
-			std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, std::vector<std::shared_ptr<I2NPMessage> >{ msg }));
+		Send (std::vector<std::shared_ptr<I2NPMessage> >{ msg });
 	}
 
 	boost::asio::const_buffers_1 NTCPSession::CreateMsgBuffer (std::shared_ptr<I2NPMessage> msg)
@@ -698,7 +726,7 @@ namespace transport
 		if (rem > 0) {
 			padding = 16 - rem;
 			// fill with random padding
-			RAND_bytes(sendBuffer + len + 2, padding);
+			i2p::crypto::RandBytes (sendBuffer + len + 2, padding);
 		}
 		htobe32buf (sendBuffer + len + 2 + padding, adler32 (adler32 (0, Z_NULL, 0), sendBuffer, len + 2+ padding));
 
@@ -710,11 +738,34 @@ namespace transport
 
 	void NTCPSession::Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_IsSending = true;
-		std::vector<boost::asio::const_buffer> bufs;
-		for (const auto& it: msgs)
-			bufs.push_back (CreateMsgBuffer (it));
-		boost::asio::async_write (m_Socket, bufs, boost::asio::transfer_all (),
+		m_IsSending = true; // next Send after HandleSent only, so encryption order is kept
+		auto bufs = std::make_shared<std::vector<boost::asio::const_buffer> >();
+		if (m_Server.IsDataPhaseOffloaded ())
+		{
+			auto s = shared_from_this ();
+			m_Server.Work (s, [s, bufs, msgs]() -> NTCPServer::Pool::ResultFunc
+				{
+					for (const auto& it: msgs)
+						bufs->push_back (s->CreateMsgBuffer (it));
+					return std::bind (&NTCPSession::WriteMsgs, s, bufs, msgs);
+				});
+		}
+		else
+		{
+			for (const auto& it: msgs)
+				bufs->push_back (CreateMsgBuffer (it));
+			WriteMsgs (bufs, msgs);
+		}
+	}
+
+	void NTCPSession::WriteMsgs (std::shared_ptr<std::vector<boost::asio::const_buffer> > bufs, std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	{
+		if (m_IsTerminated)
+		{
+			m_IsSending = false;
+			return;
+		}
+		boost::asio::async_write (m_Socket, *bufs, boost::asio::transfer_all (),
 			std::bind(&NTCPSession::HandleSent, shared_from_this (), std::placeholders::_1, std::placeholders::_2, msgs));
 	}
 
@@ -751,12 +802,15 @@ namespace transport
 
 	void NTCPSession::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Server.GetService ().post (std::bind (&NTCPSession::PostI2NPMessages, shared_from_this (), msgs));
+		if (PutOutgoingMessages (msgs))
+			m_Server.GetService ().post (std::bind (&NTCPSession::PostI2NPMessages, shared_from_this ()));
 	}
 
-	void NTCPSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	void NTCPSession::PostI2NPMessages ()
 	{
-		if (m_IsTerminated) return;
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		GetOutgoingMessages (msgs);
+		if (m_IsTerminated || msgs.empty ()) return;
 		if (m_IsSending)
 		{
 			if (m_SendQueue.size () < NTCP_MAX_OUTGOING_QUEUE_SIZE)
@@ -779,7 +833,7 @@ namespace transport
 		m_IsRunning (false), m_Thread (nullptr), m_Work (m_Service),
 		m_TerminationTimer (m_Service), m_NTCPAcceptor (nullptr), m_NTCPV6Acceptor (nullptr),
 		m_ProxyType(eNoProxy), m_Resolver(m_Service), m_ProxyEndpoint(nullptr),
-		m_SoftLimit(0), m_HardLimit(0)
+		m_SoftLimit(0), m_HardLimit(0), m_IsDataPhaseOffloaded (false)
 	{
 		if(workers <= 0) workers = 1;
 		m_CryptoPool = std::make_shared<Pool>(workers);
@@ -795,6 +849,7 @@ namespace transport
 		if (!m_IsRunning)
 		{
 			m_IsRunning = true;
+			i2p::config::GetOption("limits.ntcpoffload", m_IsDataPhaseOffloaded);
 			m_Thread = new std::thread (std::bind (&NTCPServer::Run, this));
 			// we are using a proxy, don't create any acceptors
 			if(UsingProxy())
@@ -905,11 +960,12 @@ namespace transport
 
 	void NTCPServer::Run ()
 	{
+		i2p::util::InitThread ("NTCP", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "NTCP");
 			}
 			catch (std::exception& ex)
 			{
@@ -68,7 +68,7 @@ namespace transport
 
 		private:
 
-			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			void PostI2NPMessages ();
 			void Connected ();
 			void SendTimeSyncMessage ();
 			void SetIsEstablished (bool isEstablished) { m_IsEstablished = isEstablished; }
@@ -96,11 +96,14 @@ namespace transport
 			// common
 			void Receive ();
 			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			bool DecryptReceivedBlocks (); // whole blocks of m_ReceiveBuffer, remainder is moved to beginning
+			void HandleReceivedDecrypted (bool success); // after worker
 			bool DecryptNextBlock (const uint8_t * encrypted);
 
 			void Send (std::shared_ptr<i2p::I2NPMessage> msg);
 			boost::asio::const_buffers_1 CreateMsgBuffer (std::shared_ptr<I2NPMessage> msg);
 			void Send (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
+			void WriteMsgs (std::shared_ptr<std::vector<boost::asio::const_buffer> > bufs, std::vector<std::shared_ptr<I2NPMessage> > msgs);
 			void HandleSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, std::vector<std::shared_ptr<I2NPMessage> > msgs);
 
 		private:
@@ -179,6 +182,7 @@ namespace transport
 			{
 				m_CryptoPool->Offer({conn, work});
 			}
+			bool IsDataPhaseOffloaded () const { return m_IsDataPhaseOffloaded; }; // data encryption in crypto pool
 		private:
 
 			/** @brief return true for hard limit */
@@ -223,6 +227,7 @@ namespace transport
 			std::shared_ptr<Pool> m_CryptoPool;
 
 			uint16_t m_SoftLimit, m_HardLimit;
+			bool m_IsDataPhaseOffloaded;
 		public:
 
 			// for HTTP/I2PControl
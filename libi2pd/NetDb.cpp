@@ -1,8 +1,13 @@
 #include <string.h>
+#include <stdio.h>
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <stdexcept>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "I2PEndian.h"
 #include "Base.h"
@@ -26,7 +31,7 @@ namespace data
 {
 	NetDb netdb;
 
-	NetDb::NetDb (): m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_HiddenMode(false)
+	NetDb::NetDb (): m_NumLeaseSets (0), m_LeaseSetsWheelTick (0), m_NumRouterInfos (0), m_IsRunning (false), m_Thread (nullptr), m_Reseeder (nullptr), m_Storage("netDb", "r", "routerInfo-", "dat"), m_PersistProfiles (true), m_PackedNetDb (false), m_Parallelism (2), m_MaxNumRouters (0), m_WriterThread (nullptr), m_IsWriterRunning (false), m_IsWriting (false), m_IsFsync (false), m_HiddenMode(false)
 	{
 	}
 
@@ -38,14 +43,29 @@ namespace data
 
 	void NetDb::Start ()
 	{
-		m_Storage.SetPlace(i2p::fs::GetDataDir());
+		i2p::config::GetOption("persist.sharednetdb", m_SharedNetDb);
+		m_Storage.SetPlace(IsShared () ? m_SharedNetDb : i2p::fs::GetDataDir());
 		m_Storage.Init(i2p::data::GetBase64SubstitutionTable(), 64);
 		InitProfilesStorage ();
 		m_Families.LoadCertificates ();
+		i2p::config::GetOption("persist.packednetdb", m_PackedNetDb);
+		if (IsShared ())
+		{
+			// RouterInfo files belong to another instance, we never write or delete them
+			LogPrint (eLogInfo, "NetDb: using shared netDb of ", m_SharedNetDb);
+			m_PackedNetDb = false;
+		}
+		uint16_t parallelism; i2p::config::GetOption("netdbparallelism", parallelism);
+		m_Parallelism = parallelism > 0 ? parallelism : 1;
+		uint16_t maxNumRouters; i2p::config::GetOption("limits.routers", maxNumRouters);
+		m_MaxNumRouters = maxNumRouters;
+		i2p::config::GetOption("persist.fsync", m_IsFsync);
+		m_IsWriterRunning = true;
+		m_WriterThread = new std::thread (std::bind (&NetDb::RunWriter, this));
 		Load ();
 
 		uint16_t threshold; i2p::config::GetOption("reseed.threshold", threshold);
-		if (m_RouterInfos.size () < threshold) // reseed if # of router less than threshold
+		if (m_NumRouterInfos < threshold && !IsShared ()) // reseed if # of router less than threshold, owner of shared netDb does it
 			Reseed ();
 
 		i2p::config::GetOption("persist.profiles", m_PersistProfiles);
@@ -58,12 +78,9 @@ namespace data
 	{
 		if (m_IsRunning)
 		{
-			if (m_PersistProfiles)
-				for (auto& it: m_RouterInfos)
-					it.second->SaveProfile ();
 			DeleteObsoleteProfiles ();
-			m_RouterInfos.clear ();
-			m_Floodfills.clear ();
+			if (m_PersistProfiles)
+				SaveProfiles ();
 			if (m_Thread)
 			{
 				m_IsRunning = false;
@@ -72,29 +89,68 @@ namespace data
 				delete m_Thread;
 				m_Thread = 0;
 			}
-			m_LeaseSets.clear();
+			if (m_PackedNetDb)
+				SaveUpdated (); // make sure every RI has a file
+			if (m_WriterThread)
+			{
+				FlushWriter ();
+				{
+					std::unique_lock<std::mutex> l(m_WriterMutex);
+					m_IsWriterRunning = false;
+				}
+				m_WriterCondition.notify_one ();
+				m_WriterThread->join ();
+				delete m_WriterThread;
+				m_WriterThread = nullptr;
+			}
+			m_WrittenRouters.clear ();
+			if (m_PackedNetDb)
+				SavePacked ();
+			ClearRouterInfos ();
+			m_Floodfills.clear ();
+			{
+				i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
+				m_LeaseSets.clear ();
+				for (auto& it: m_LeaseSetsWheel) it.clear ();
+				m_NumLeaseSets = 0;
+			}
 			m_Requests.Stop ();
 		}
 	}
 
 	void NetDb::Run ()
 	{
-		uint32_t lastSave = 0, lastPublish = 0, lastExploratory = 0, lastManageRequest = 0, lastDestinationCleanup = 0;
+		i2p::util::InitThread ("NetDb");
+		uint32_t lastSave = 0, lastProfilesSave = 0, lastPublish = 0, lastExploratory = 0, lastManageRequest = 0, lastDestinationCleanup = 0,
+			lastTargetExploratory = 0, routingKeysDay = 0;
 		while (m_IsRunning)
 		{
 			try
 			{
-				auto msg = m_Queue.GetNextWithTimeout (15000); // 15 sec
+				// sleep until messages or requests managing is due, the most frequent of periodic tasks
+				int64_t timeout = (lastManageRequest + NETDB_MANAGE_REQUESTS_INTERVAL)*1000LL - (int64_t)i2p::util::GetMillisecondsSinceEpoch ();
+				auto msg = timeout > 0 ? m_Queue.GetNextWithTimeout (timeout) : m_Queue.Get ();
 				if (msg)
 				{
-					int numMsgs = 0;
+					std::vector<std::shared_ptr<const I2NPMessage> > msgs;
 					while (msg)
 					{
+						msgs.push_back (msg);
+						if (msgs.size () > 100) break;
+						msg = m_Queue.Get ();
+					}
+					std::vector<ParsedDatabaseStore> parsed;
+					if (i2p::crypto::EDDSA25519_BATCH_VERIFICATION)
+						PreverifyDatabaseStores (msgs, parsed); // handlers below hit the verified signatures cache
+					i2p::transport::SendBatch batch (transports); // floods and replies of all messages go to transports at once
+					for (size_t i = 0; i < msgs.size (); i++)
+					{
+						auto& msg = msgs[i];
 						LogPrint(eLogDebug, "NetDb: got request with type ", (int) msg->GetTypeID ());
 						switch (msg->GetTypeID ())
 						{
 							case eI2NPDatabaseStore:
-								HandleDatabaseStoreMsg (msg);
+								HandleDatabaseStoreMsg (msg, parsed.empty () ? nullptr : &parsed[i]);
 							break;
 							case eI2NPDatabaseSearchReply:
 								HandleDatabaseSearchReplyMsg (msg);
@@ -110,15 +166,12 @@ namespace data
 								LogPrint (eLogError, "NetDb: unexpected message type ", (int) msg->GetTypeID ());
 								//i2p::HandleI2NPMessage (msg);
 						}
-						if (numMsgs > 100) break;
-						msg = m_Queue.Get ();
-						numMsgs++;
 					}
 				}
 				if (!m_IsRunning) break;
 
 				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
-				if (ts - lastManageRequest >= 15) // manage requests every 15 seconds
+				if (ts - lastManageRequest >= NETDB_MANAGE_REQUESTS_INTERVAL)
 				{
 					m_Requests.ManageRequests ();
 					lastManageRequest = ts;
@@ -128,10 +181,26 @@ namespace data
 					if (lastSave)
 					{
 						SaveUpdated ();
+						RefreshRandomRoutersRecords ();
 						ManageLeaseSets ();
+						CleanupLookupReplies ();
 					}
 					lastSave = ts;
 				}
+				if (ts - lastProfilesSave >= PEER_PROFILES_SAVE_INTERVAL) // save profiles in one batch
+				{
+					if (lastProfilesSave)
+					{
+						DeleteObsoleteProfiles ();
+						if (m_PersistProfiles) SaveProfiles ();
+					}
+					lastProfilesSave = ts;
+				}
+				if (ts/86400 != routingKeysDay) // UTC midnight, keys of known routers and destinations change
+				{
+					UpdateRoutingKeys ();
+					routingKeysDay = ts/86400;
+				}
 				if (ts - lastDestinationCleanup >= i2p::garlic::INCOMING_TAGS_EXPIRATION_TIMEOUT)
 				{
 					i2p::context.CleanupDestination ();
@@ -144,9 +213,18 @@ namespace data
 					if (!m_HiddenMode) Publish ();
 					lastPublish = ts;
 				}
-				if (ts - lastExploratory >= 30) // exploratory every 30 seconds
+				if (IsShared ())
 				{
-					auto numRouters = m_RouterInfos.size ();
+					// owner of shared netDb explores and reseeds, we pick up its files
+					if (ts - lastExploratory >= NETDB_SHARED_RELOAD_INTERVAL)
+					{
+						ReloadShared ();
+						lastExploratory = ts;
+					}
+				}
+				else if (ts - lastExploratory >= 30) // exploratory every 30 seconds
+				{
+					int numRouters = m_NumRouterInfos;
 					if (!numRouters)
                     	throw std::runtime_error("No known routers, reseed seems to be totally failed");
 					else // we have peers now
@@ -157,7 +235,17 @@ namespace data
 						if (numRouters < 1) numRouters = 1;
 						if (numRouters > 9) numRouters = 9;
 						m_Requests.ManageRequests ();
-						if(!m_HiddenMode)
+						if (m_MaxNumRouters && m_NumRouterInfos >= m_MaxNumRouters)
+						{
+							// target reached, explore just enough to replace expired routers
+							if (ts - lastTargetExploratory < NETDB_TARGET_EXPLORATORY_INTERVAL) numRouters = 0;
+							else
+							{
+								numRouters = 1;
+								lastTargetExploratory = ts;
+							}
+						}
+						if (!m_HiddenMode && numRouters > 0)
 							Explore (numRouters);
 						lastExploratory = ts;
 					}
@@ -176,10 +264,13 @@ namespace data
     	m_HiddenMode = hide;
   	}
 
-	bool NetDb::AddRouterInfo (const uint8_t * buf, int len)
+	bool NetDb::AddRouterInfo (const uint8_t * buf, int len, std::shared_ptr<const IdentityEx> identity)
 	{
 		bool updated;
-		AddRouterInfo (buf, len, updated);
+		if (identity)
+			AddRouterInfo (identity->GetIdentHash (), buf, len, updated, identity);
+		else
+			AddRouterInfo (buf, len, updated);
 		return updated;	
 	}
 
@@ -199,7 +290,8 @@ namespace data
 		return updated;	
 	}
 
-	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated)
+	std::shared_ptr<const RouterInfo> NetDb::AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated,
+		std::shared_ptr<const IdentityEx> identity)
 	{
 		updated = true;
 		auto r = FindRouter (ident);
@@ -207,7 +299,13 @@ namespace data
 		{
 			if (r->IsNewer (buf, len))
 			{
-				r->Update (buf, len);
+				if (!r->Update (buf, len))
+				{
+					updated = false;
+					return r;
+				}
+				InvalidateLookupReplies (ident);
+				UpdateRandomRouters (r); // caps might change
 				LogPrint (eLogInfo, "NetDb: RouterInfo updated: ", ident.ToBase64());
 				// TODO: check if floodfill has been changed
 			}
@@ -219,22 +317,23 @@ namespace data
 		}
 		else
 		{
-			r = std::make_shared<RouterInfo> (buf, len);
+			r = std::make_shared<RouterInfo> (buf, len, identity);
 			if (!r->IsUnreachable ())
 			{
 				bool inserted = false;
 				{
-					std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-					inserted = m_RouterInfos.insert ({r->GetIdentHash (), r}).second;
+					auto& shard = GetRouterInfosShard (r->GetIdentHash ());
+					i2p::metrics::ProfiledLock l(shard.mutex);
+					inserted = shard.routerInfos.insert ({r->GetIdentHash (), r}).second;
 				}
+				if (inserted) m_NumRouterInfos++;
 				if (inserted)
 				{
+					InvalidateLookupReplies (ident);
+					UpdateRandomRouters (r);
 					LogPrint (eLogInfo, "NetDb: RouterInfo added: ", ident.ToBase64());
 					if (r->IsFloodfill () && r->IsReachable ()) // floodfill must be reachable
-					{
-						std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-						m_Floodfills.push_back (r);
-					}
+						AddFloodfill (r);
 				}
 				else
 				{
@@ -251,21 +350,23 @@ namespace data
 	}
 
 	bool NetDb::AddLeaseSet (const IdentHash& ident, const uint8_t * buf, int len,
-		std::shared_ptr<i2p::tunnel::InboundTunnel> from)
+		std::shared_ptr<i2p::tunnel::InboundTunnel> from, std::shared_ptr<const IdentityEx> identity)
 	{
-		std::unique_lock<std::mutex> lock(m_LeaseSetsMutex);
 		bool updated = false;
 		if (!from) // unsolicited LS must be received directly
 		{
+			i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
 			auto it = m_LeaseSets.find(ident);
 			if (it != m_LeaseSets.end ())
 			{
 				uint64_t expires;
-				if(LeaseSetBufferValidate(buf, len, expires))
+				if(LeaseSetBufferValidate(buf, len, expires, identity))
 				{
-					if(it->second->GetExpirationTime() < expires)
+					if(it->second.expirationTime < expires)
 					{
-						it->second->Update (buf, len, false); // signature is verified already
+						it->second.Set (NETDB_STORE_TYPE_LEASESET, buf, len, expires); // signature is verified already
+						ScheduleLeaseSetExpiration (ident, expires);
+						InvalidateLookupReplies (ident);
 						LogPrint (eLogInfo, "NetDb: LeaseSet updated: ", ident.ToBase32());
 						updated = true;
 					}
@@ -277,11 +378,14 @@ namespace data
 			}
 			else
 			{
-				auto leaseSet = std::make_shared<LeaseSet> (buf, len, false); // we don't need leases in netdb
-				if (leaseSet->IsValid ())
+				LeaseSet leaseSet (buf, len, false, identity); // we don't need leases in netdb
+				if (leaseSet.IsValid ())
 				{
 					LogPrint (eLogInfo, "NetDb: LeaseSet added: ", ident.ToBase32());
-					m_LeaseSets[ident] = leaseSet;
+					m_LeaseSets[ident].Set (NETDB_STORE_TYPE_LEASESET, buf, len, leaseSet.GetExpirationTime ());
+					m_NumLeaseSets = m_LeaseSets.size ();
+					ScheduleLeaseSetExpiration (ident, leaseSet.GetExpirationTime ());
+					InvalidateLookupReplies (ident);
 					updated = true;
 				}
 				else
@@ -293,22 +397,65 @@ namespace data
 
 	bool NetDb::AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType)
 	{
-		std::unique_lock<std::mutex> lock(m_LeaseSetsMutex);
+		i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
 		auto it = m_LeaseSets.find(ident);
 		if (it == m_LeaseSets.end ())
 		{
-			auto leaseSet = std::make_shared<LeaseSet2> (storeType, buf, len, false); // we don't need leases in netdb
-			m_LeaseSets[ident] = leaseSet;
-			return true; 
+			LeaseSet2 leaseSet (storeType, buf, len, false); // we don't need leases in netdb
+			if (!leaseSet.IsValid ())
+			{
+				LogPrint (eLogError, "NetDb: new LeaseSet2 validation failed: ", ident.ToBase32());
+				return false;
+			}
+			m_LeaseSets[ident].Set (storeType, buf, len, leaseSet.GetExpirationTime ());
+			m_NumLeaseSets = m_LeaseSets.size ();
+			ScheduleLeaseSetExpiration (ident, leaseSet.GetExpirationTime ());
+			InvalidateLookupReplies (ident);
+			return true;
 		}
 		return false;
 	}
 
+	void NetDb::StoredLeaseSet::Set (uint8_t type, const uint8_t * buf, size_t l, uint64_t expires)
+	{
+		if (!buffer || l > len)
+			buffer.reset (new uint8_t[l]);
+		memcpy (buffer.get (), buf, l);
+		len = l;
+		storeType = type;
+		expirationTime = expires;
+	}
+
+	std::shared_ptr<LeaseSet> NetDb::StoredLeaseSet::Parse () const
+	{
+		if (storeType == NETDB_STORE_TYPE_LEASESET)
+			return std::make_shared<LeaseSet> (buffer.get (), len, false);
+		return std::make_shared<LeaseSet2> (storeType, buffer.get (), len, false);
+	}
+
+	void NetDb::ScheduleLeaseSetExpiration (const IdentHash& ident, uint64_t expirationTime)
+	{
+		uint64_t due = expirationTime > LEASE_ENDDATE_THRESHOLD ? expirationTime - LEASE_ENDDATE_THRESHOLD : 0;
+		uint64_t tick = due/(NETDB_LEASESETS_WHEEL_TICK*1000LL);
+		if (tick <= m_LeaseSetsWheelTick) tick = m_LeaseSetsWheelTick + 1; // already due, next time
+		m_LeaseSetsWheel[tick % NETDB_LEASESETS_WHEEL_NUM_SLOTS].emplace_back (ident, expirationTime);
+	}
+
+	std::shared_ptr<I2NPMessage> NetDb::CreateLeaseSetStoreMsg (const IdentHash& ident) const
+	{
+		i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
+		auto it = m_LeaseSets.find (ident);
+		if (it == m_LeaseSets.end () || i2p::util::GetMillisecondsSinceEpoch () > it->second.expirationTime)
+			return nullptr;
+		return CreateDatabaseStoreMsg (ident, it->second.storeType, it->second.buffer.get (), it->second.len);
+	}
+
 	std::shared_ptr<RouterInfo> NetDb::FindRouter (const IdentHash& ident) const
 	{
-		std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-		auto it = m_RouterInfos.find (ident);
-		if (it != m_RouterInfos.end ())
+		auto& shard = GetRouterInfosShard (ident);
+		i2p::metrics::ProfiledLock l(shard.mutex);
+		auto it = shard.routerInfos.find (ident);
+		if (it != shard.routerInfos.end ())
 			return it->second;
 		else
 			return nullptr;
@@ -316,10 +463,10 @@ namespace data
 
 	std::shared_ptr<LeaseSet> NetDb::FindLeaseSet (const IdentHash& destination) const
 	{
-		std::unique_lock<std::mutex> lock(m_LeaseSetsMutex);
+		i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
 		auto it = m_LeaseSets.find (destination);
 		if (it != m_LeaseSets.end ())
-			return it->second;
+			return it->second.Parse ();
 		else
 			return nullptr;
 	}
@@ -332,9 +479,16 @@ namespace data
 
 	void NetDb::SetUnreachable (const IdentHash& ident, bool unreachable)
 	{
-		auto it = m_RouterInfos.find (ident);
-		if (it != m_RouterInfos.end ())
-			return it->second->SetUnreachable (unreachable);
+		auto r = FindRouter (ident);
+		if (r)
+		{
+			r->SetUnreachable (unreachable);
+			i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+			m_AllRouters.SetFlag (ident, NETDB_SELECTION_UNREACHABLE, unreachable);
+			m_HighBandwidthRouters.SetFlag (ident, NETDB_SELECTION_UNREACHABLE, unreachable);
+			m_IntroducerRouters.SetFlag (ident, NETDB_SELECTION_UNREACHABLE, unreachable);
+			m_PeerTestRouters.SetFlag (ident, NETDB_SELECTION_UNREACHABLE, unreachable);
+		}
 	}
 
 	void NetDb::Reseed ()
@@ -399,27 +553,159 @@ namespace data
 	bool NetDb::LoadRouterInfo (const std::string & path)
 	{
 		auto r = std::make_shared<RouterInfo>(path);
+		if (!AddLoadedRouterInfo (r) && !IsShared ())
+		{
+			LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid. Delete");
+			i2p::fs::Remove(path);
+		}
+		return true;
+	}
+
+	bool NetDb::AddLoadedRouterInfo (std::shared_ptr<RouterInfo> r)
+	{
 		if (r->GetRouterIdentity () && !r->IsUnreachable () &&
 				(!r->UsesIntroducer () || m_LastLoad < r->GetTimestamp () + NETDB_INTRODUCEE_EXPIRATION_TIMEOUT*1000LL)) // 1 hour
 		{
 			r->DeleteBuffer ();
 			r->ClearProperties (); // properties are not used for regular routers
-			m_RouterInfos[r->GetIdentHash ()] = r;
+			auto& shard = GetRouterInfosShard (r->GetIdentHash ());
+			i2p::metrics::ProfiledLock l(shard.mutex);
+			auto it = shard.routerInfos.find (r->GetIdentHash ());
+			if (it != shard.routerInfos.end ())
+				it->second = r;
+			else
+			{
+				shard.routerInfos.insert ({r->GetIdentHash (), r});
+				m_NumRouterInfos++;
+			}
+			UpdateRandomRouters (r);
 			if (r->IsFloodfill () && r->IsReachable ()) // floodfill must be reachable
-				m_Floodfills.push_back (r);
+				AddFloodfill (r);
+			return true;
 		}
-		else
+		return false;
+	}
+
+	template<typename Func>
+	static void LoadInParallel (size_t num, Func f)
+	{
+		// calls f(i) for every i in [0, num), split across threads for large netDbs
+		size_t numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > (size_t)NETDB_MAX_NUM_LOAD_THREADS) numThreads = NETDB_MAX_NUM_LOAD_THREADS;
+		if (numThreads > num/NETDB_MIN_NUM_ROUTERS_PER_LOAD_THREAD) numThreads = num/NETDB_MIN_NUM_ROUTERS_PER_LOAD_THREAD;
+		if (numThreads < 2)
 		{
-			LogPrint(eLogWarning, "NetDb: RI from ", path, " is invalid. Delete");
-			i2p::fs::Remove(path);
+			for (size_t i = 0; i < num; i++) f (i);
+			return;
+		}
+		std::atomic<size_t> next (0);
+		auto run = [&next, num, &f]()
+			{
+				for (size_t i = next++; i < num; i = next++)
+					f (i);
+			};
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; i++)
+			threads.emplace_back (run);
+		run (); // current thread does its share too
+		for (auto& it: threads) it.join ();
+	}
+
+	bool NetDb::LoadPacked ()
+	{
+		// sequence of ident (32 bytes), length (2 bytes), RouterInfo
+		std::string path = i2p::fs::DataDirPath (NETDB_PACKED_FILENAME);
+		std::ifstream f(path, std::ifstream::binary);
+		if (!f.is_open ()) return false;
+		f.seekg (0, std::ios::end);
+		size_t len = f.tellg ();
+		f.seekg (0, std::ios::beg);
+		std::vector<uint8_t> buf (len);
+		f.read ((char *)buf.data (), len);
+		if (!f)
+		{
+			LogPrint (eLogError, "NetDb: Can't read ", path);
+			return false;
 		}
+		f.close ();
+		// snapshot is valid for one startup only, RI files are used if we don't shut down properly
+		i2p::fs::Remove (path);
+
+		std::vector<size_t> offsets; // of RouterInfo's header
+		size_t offset = 0;
+		while (offset + 34 <= len)
+		{
+			size_t riLen = bufbe16toh (buf.data () + offset + 32);
+			if (offset + 34 + riLen > len) break;
+			offsets.push_back (offset);
+			offset += 34 + riLen;
+		}
+		if (offset != len)
+		{
+			LogPrint (eLogError, "NetDb: ", path, " is truncated. Load from files");
+			return false;
+		}
+
+		LoadInParallel (offsets.size (), [this, &buf, &offsets, &path](size_t i)
+			{
+				const uint8_t * entry = buf.data () + offsets[i];
+				IdentHash ident (entry);
+				auto r = std::make_shared<RouterInfo>(m_Storage.Path (ident.ToBase64 ()), entry + 34, bufbe16toh (entry + 32));
+				if (!r->GetRouterIdentity () || r->GetIdentHash () != ident || !AddLoadedRouterInfo (r))
+					LogPrint (eLogWarning, "NetDb: Invalid RI ", ident.ToBase64 (), " in ", path);
+			});
 		return true;
 	}
 
+	void NetDb::SavePacked ()
+	{
+		std::string path = i2p::fs::DataDirPath (NETDB_PACKED_FILENAME);
+		std::ofstream f(path, std::ofstream::binary | std::ofstream::out);
+		if (!f.is_open ())
+		{
+			LogPrint (eLogError, "NetDb: Can't create ", path);
+			return;
+		}
+		int numSaved = 0;
+		uint8_t header[34];
+		for (auto& shard: m_RouterInfos)
+		{
+			i2p::metrics::ProfiledLock l(shard.mutex);
+			for (auto& it: shard.routerInfos)
+			{
+				auto& r = it.second;
+				if (r->IsUnreachable ()) continue;
+				bool hasBuffer = r->GetBuffer ();
+				auto ri = r->LoadBuffer ();
+				if (!ri) continue;
+				memcpy (header, r->GetIdentHash (), 32);
+				htobe16buf (header + 32, r->GetBufferLen ());
+				f.write ((char *)header, 34);
+				f.write ((const char *)ri, r->GetBufferLen ());
+				if (!hasBuffer) r->DeleteBuffer ();
+				numSaved++;
+			}
+		}
+		if (!f)
+		{
+			LogPrint (eLogError, "NetDb: Can't write ", path);
+			f.close ();
+			i2p::fs::Remove (path);
+			return;
+		}
+		LogPrint (eLogInfo, "NetDb: ", numSaved, " routers saved to ", path);
+	}
+
 	void NetDb::VisitLeaseSets(LeaseSetVisitor v)
 	{
-		std::unique_lock<std::mutex> lock(m_LeaseSetsMutex);
-		for ( auto & entry : m_LeaseSets)
+		std::vector<std::pair<IdentHash, std::shared_ptr<LeaseSet> > > leaseSets;
+		{
+			i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
+			leaseSets.reserve (m_LeaseSets.size ());
+			for ( auto & entry : m_LeaseSets)
+				leaseSets.emplace_back (entry.first, entry.second.Parse ());
+		}
+		for ( auto & entry : leaseSets)
 			v(entry.first, entry.second);
 	}
 
@@ -433,9 +719,122 @@ namespace data
 
 	void NetDb::VisitRouterInfos(RouterInfoVisitor v)
 	{
-		std::unique_lock<std::mutex> lock(m_RouterInfosMutex);
-		for ( const auto & item : m_RouterInfos )
-			v(item.second);
+		for (const auto& shard: m_RouterInfos)
+		{
+			i2p::metrics::ProfiledLock lock(shard.mutex);
+			for ( const auto & item : shard.routerInfos )
+				v(item.second);
+		}
+	}
+
+	void NetDb::ClearRouterInfos ()
+	{
+		for (auto& shard: m_RouterInfos)
+		{
+			i2p::metrics::ProfiledLock lock(shard.mutex);
+			shard.routerInfos.clear ();
+		}
+		m_NumRouterInfos = 0;
+		i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+		m_AllRouters.Clear ();
+		m_HighBandwidthRouters.Clear ();
+		m_IntroducerRouters.Clear ();
+		m_PeerTestRouters.Clear ();
+	}
+
+	uint32_t NetDb::CreateSelectionRecord (const RouterInfo& r, bool isBad)
+	{
+		uint32_t record = (r.GetSupportedTransports () & NETDB_SELECTION_TRANSPORTS_MASK) |
+			((uint32_t)r.GetCaps () << NETDB_SELECTION_CAPS_SHIFT);
+		if (r.IsUnreachable ()) record |= NETDB_SELECTION_UNREACHABLE;
+		if (isBad) record |= NETDB_SELECTION_BAD_PROFILE;
+		return record;
+	}
+
+	void NetDb::RandomRouters::Set (std::shared_ptr<RouterInfo> r, bool isCandidate, bool isBad)
+	{
+		auto it = positions.find (r->GetIdentHash ());
+		if (isCandidate)
+		{
+			if (it != positions.end ())
+			{
+				routers[it->second] = r; // might be new object
+				records[it->second] = CreateSelectionRecord (*r, records[it->second] & NETDB_SELECTION_BAD_PROFILE);
+			}
+			else
+			{
+				positions.emplace (r->GetIdentHash (), routers.size ());
+				routers.push_back (r);
+				records.push_back (CreateSelectionRecord (*r, isBad));
+			}
+		}
+		else if (it != positions.end ())
+		{
+			// move last to the place of removed
+			size_t pos = it->second;
+			positions.erase (it);
+			if (pos + 1 < routers.size ())
+			{
+				routers[pos] = routers.back ();
+				records[pos] = records.back ();
+				positions[routers[pos]->GetIdentHash ()] = pos;
+			}
+			routers.pop_back ();
+			records.pop_back ();
+		}
+	}
+
+	void NetDb::RandomRouters::SetRecord (const RouterInfo& r, bool isBad)
+	{
+		auto it = positions.find (r.GetIdentHash ());
+		if (it != positions.end () && routers[it->second].get () == &r) // not replaced since
+			records[it->second] = CreateSelectionRecord (r, isBad);
+	}
+
+	void NetDb::RandomRouters::SetFlag (const IdentHash& ident, uint32_t flag, bool set)
+	{
+		auto it = positions.find (ident);
+		if (it != positions.end ())
+		{
+			if (set)
+				records[it->second] |= flag;
+			else
+				records[it->second] &= ~flag;
+		}
+	}
+
+	void NetDb::UpdateRandomRouters (std::shared_ptr<RouterInfo> r, bool remove)
+	{
+		i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+		m_AllRouters.Set (r, !remove);
+		m_HighBandwidthRouters.Set (r, !remove && (r->GetCaps () & RouterInfo::eHighBandwidth));
+		m_IntroducerRouters.Set (r, !remove && r->IsIntroducer ());
+		m_PeerTestRouters.Set (r, !remove && r->IsPeerTesting ());
+	}
+
+	void NetDb::RefreshRandomRoutersRecords ()
+	{
+		std::vector<std::shared_ptr<RouterInfo> > routers;
+		{
+			i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+			routers = m_AllRouters.routers;
+		}
+		// profiles lookup might load them from disk, don't hold the lock
+		std::vector<bool> bad (routers.size ());
+		for (size_t i = 0; i < routers.size (); i++)
+		{
+			auto profile = FindRouterProfile (routers[i]->GetIdentHash ());
+			bad[i] = profile && profile->IsUnreliable ();
+		}
+		i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+		for (size_t i = 0; i < routers.size (); i++)
+		{
+			auto& r = *routers[i];
+			m_AllRouters.SetRecord (r, bad[i]);
+			m_HighBandwidthRouters.SetRecord (r, bad[i]);
+			m_IntroducerRouters.SetRecord (r, bad[i]);
+			m_PeerTestRouters.SetRecord (r, bad[i]);
+		}
 	}
 
 	size_t NetDb::VisitRandomRouterInfos(RouterInfoFilter filter, RouterInfoVisitor v, size_t n)
@@ -445,25 +844,15 @@ namespace data
 		size_t iters = max_iters_per_cyle;
 		while(n > 0)
 		{
-			std::unique_lock<std::mutex> lock(m_RouterInfosMutex);
-			uint32_t idx = rand () % m_RouterInfos.size ();
-			uint32_t i = 0;
-			for (const auto & it : m_RouterInfos) {
-				if(i >= idx) // are we at the random start point?
-				{
-					// yes, check if we want this one
-					if(filter(it.second))
-					{
-						// we have a match
-						--n;
-						found.push_back(it.second);
-						// reset max iterations per cycle
-						iters = max_iters_per_cyle;
-						break;
-					}
-				}
-				else // not there yet
-					++i;
+			if (!m_NumRouterInfos) break;
+			auto r = GetRandomRouter (m_AllRouters, 0, 0, filter);
+			if (r)
+			{
+				// we have a match
+				--n;
+				found.push_back(r);
+				// reset max iterations per cycle
+				iters = max_iters_per_cyle;
 			}
 			// we have enough
 			if(n == 0) break;
@@ -487,22 +876,115 @@ namespace data
 	void NetDb::Load ()
 	{
 		// make sure we cleanup netDb from previous attempts
-		m_RouterInfos.clear ();
+		ClearRouterInfos ();
 		m_Floodfills.clear ();
 
 		m_LastLoad = i2p::util::GetSecondsSinceEpoch();
+		if (!m_PackedNetDb || !LoadPacked ())
+		{
+			std::vector<std::string> files;
+			m_Storage.Traverse(files);
+			LoadInParallel (files.size (), [this, &files](size_t i) { LoadRouterInfo (files[i]); });
+		}
+
+		LogPrint (eLogInfo, "NetDb: ", m_NumRouterInfos, " routers loaded (", m_Floodfills.size (), " floodfils)");
+	}
+
+	void NetDb::ReloadShared ()
+	{
+		// files written since previous load, with a minute of overlap for files being written then
+		auto lastLoad = m_LastLoad;
+		m_LastLoad = i2p::util::GetSecondsSinceEpoch ();
 		std::vector<std::string> files;
-		m_Storage.Traverse(files);
-		for (const auto& path : files)
-			LoadRouterInfo(path);
+		m_Storage.Traverse (files);
+		int numLoaded = 0;
+		for (const auto& path: files)
+		{
+			if (i2p::fs::GetLastUpdateTime (path) + 60 < lastLoad) continue;
+			auto r = std::make_shared<RouterInfo>(path);
+			if (!r->GetRouterIdentity () || r->IsUnreachable ()) continue; // owner will delete or rewrite it
+			auto existing = FindRouter (r->GetIdentHash ());
+			if (existing && existing->GetTimestamp () >= r->GetTimestamp ()) continue;
+			if (AddLoadedRouterInfo (r))
+			{
+				InvalidateLookupReplies (r->GetIdentHash ());
+				numLoaded++;
+			}
+		}
+		if (numLoaded > 0)
+			LogPrint (eLogInfo, "NetDb: ", numLoaded, " new/updated routers loaded from shared netDb");
+	}
 
-		LogPrint (eLogInfo, "NetDb: ", m_RouterInfos.size(), " routers loaded (", m_Floodfills.size (), " floodfils)");
+	void NetDb::RunWriter ()
+	{
+		i2p::util::InitThread ("NetDbWriter");
+		decltype(m_PendingWrites) writes;
+		std::unique_lock<std::mutex> l(m_WriterMutex);
+		while (m_IsWriterRunning || !m_PendingWrites.empty ())
+		{
+			if (m_PendingWrites.empty ())
+			{
+				m_WriterCondition.wait (l);
+				continue;
+			}
+			writes.swap (m_PendingWrites); // whole batch
+			m_IsWriting = true;
+			l.unlock ();
+			for (auto& it: writes)
+			{
+				if (!it.second)
+				{
+					i2p::fs::Remove (it.first);
+					continue;
+				}
+				FILE * f = fopen (it.first.c_str (), "wb");
+				if (!f)
+				{
+					LogPrint (eLogError, "NetDb: Can't save to ", it.first);
+					continue;
+				}
+				if (fwrite (it.second->data (), 1, it.second->size (), f) != it.second->size ())
+					LogPrint (eLogError, "NetDb: Can't write ", it.first);
+#ifndef _WIN32
+				else if (m_IsFsync)
+				{
+					fflush (f);
+					fsync (fileno (f));
+				}
+#endif
+				fclose (f);
+			}
+			writes.clear ();
+			l.lock ();
+			m_IsWriting = false;
+			m_WriterDoneCondition.notify_all ();
+		}
+	}
+
+	void NetDb::FlushWriter ()
+	{
+		std::unique_lock<std::mutex> l(m_WriterMutex);
+		while (m_IsWriting || !m_PendingWrites.empty ())
+			m_WriterDoneCondition.wait (l);
+	}
+
+	bool NetDb::IsWriterIdle ()
+	{
+		std::unique_lock<std::mutex> l(m_WriterMutex);
+		return !m_IsWriting && m_PendingWrites.empty ();
+	}
+
+	bool NetDb::IsPreferredToKeep (std::shared_ptr<const RouterInfo> r) const
+	{
+		if (r->IsFloodfill () || r->IsHighBandwidth ()) return true;
+		auto profile = FindRouterProfile (r->GetIdentHash ());
+		return profile && profile->IsUsedRecently ();
 	}
 
 	void NetDb::SaveUpdated ()
 	{
 		int updatedCount = 0, deletedCount = 0;
-		auto total = m_RouterInfos.size ();
+		int total = m_NumRouterInfos;
 		uint64_t expirationTimeout = NETDB_MAX_EXPIRATION_TIMEOUT*1000LL;
 		uint64_t ts = i2p::util::GetMillisecondsSinceEpoch();
 		// routers don't expire if less than 90 or uptime is less than 1 hour
@@ -510,38 +992,82 @@ namespace data
 		if (checkForExpiration && ts > (i2p::context.GetStartupTime () + 3600)*1000LL) // 1 hour
 			expirationTimeout = i2p::context.IsFloodfill () ? NETDB_FLOODFILL_EXPIRATION_TIMEOUT*1000LL :
 					NETDB_MIN_EXPIRATION_TIMEOUT*1000LL + (NETDB_MAX_EXPIRATION_TIMEOUT - NETDB_MIN_EXPIRATION_TIMEOUT)*1000LL*NETDB_MIN_ROUTERS/total;
+		// over the target floodfills, high bandwidth and recently used routers expire after minimal timeout, others earlier as it grows
+		bool isOverTarget = m_MaxNumRouters && total > m_MaxNumRouters;
+		uint64_t overTargetExpirationTimeout = expirationTimeout;
+		if (isOverTarget)
+		{
+			expirationTimeout = std::min<uint64_t> (expirationTimeout, NETDB_MIN_EXPIRATION_TIMEOUT*1000ULL);
+			overTargetExpirationTimeout = std::min<uint64_t> (expirationTimeout, NETDB_MIN_EXPIRATION_TIMEOUT*1000ULL*m_MaxNumRouters/total);
+		}
 
-		for (auto& it: m_RouterInfos)
+		if (!m_WrittenRouters.empty () && IsWriterIdle ())
+		{
+			// files of previous save are on disk, buffers can be loaded from there
+			for (auto& r: m_WrittenRouters)
+				if (!r->IsUpdated ()) r->DeleteBuffer ();
+			m_WrittenRouters.clear ();
+		}
+
+		std::vector<std::shared_ptr<RouterInfo> > routers;
+		routers.reserve (total);
+		for (const auto& shard: m_RouterInfos)
+		{
+			i2p::metrics::ProfiledLock l(shard.mutex);
+			for (const auto& it: shard.routerInfos)
+				routers.push_back (it.second);
+		}
+		decltype(m_PendingWrites) writes;
+		for (auto& r: routers)
 		{
-			std::string ident = it.second->GetIdentHashBase64();
+			std::string ident = r->GetIdentHashBase64();
 			std::string path  = m_Storage.Path(ident);
-			if (it.second->IsUpdated ())
+			if (r->IsUpdated ())
 			{
-				it.second->SaveToFile (path);
-				it.second->SetUpdated (false);
-				it.second->SetUnreachable (false);
-				it.second->DeleteBuffer ();
+				auto buf = r->GetBuffer ();
+				if (buf && !IsShared ()) // otherwise buffer stays in memory until owner's file is newer
+				{
+					r->SetFullPath (path);
+					writes.emplace_back (path, std::make_shared<std::vector<uint8_t> >(buf, buf + r->GetBufferLen ()));
+					m_WrittenRouters.push_back (r);
+				}
+				r->SetUpdated (false);
+				r->SetUnreachable (false);
 				updatedCount++;
 				continue;
 			}
 			// find & mark expired routers
-			if (it.second->UsesIntroducer ())
+			if (r->UsesIntroducer ())
 			{
-				 if (ts > it.second->GetTimestamp () + NETDB_INTRODUCEE_EXPIRATION_TIMEOUT*1000LL)
+				 if (ts > r->GetTimestamp () + NETDB_INTRODUCEE_EXPIRATION_TIMEOUT*1000LL)
 				// RouterInfo expires after 1 hour if uses introducer
-					it.second->SetUnreachable (true);
+					r->SetUnreachable (true);
+			}
+			else if (checkForExpiration && ts > r->GetTimestamp () + overTargetExpirationTimeout)
+			{
+				if (!isOverTarget || ts > r->GetTimestamp () + expirationTimeout || !IsPreferredToKeep (r))
+					r->SetUnreachable (true);
 			}
-			else if (checkForExpiration && ts > it.second->GetTimestamp () + expirationTimeout)
-					it.second->SetUnreachable (true);
 
-			if (it.second->IsUnreachable ())
+			if (r->IsUnreachable ())
 			{
 				// delete RI file
-				m_Storage.Remove(ident);
+				if (!IsShared ()) writes.emplace_back (path, nullptr);
 				deletedCount++;
 				if (total - deletedCount < NETDB_MIN_ROUTERS) checkForExpiration = false;
 			}
-		} // m_RouterInfos iteration
+		} // routers iteration
+		if (!writes.empty ())
+		{
+			{
+				std::unique_lock<std::mutex> l(m_WriterMutex);
+				if (m_PendingWrites.empty ())
+					m_PendingWrites.swap (writes);
+				else
+					m_PendingWrites.insert (m_PendingWrites.end (), writes.begin (), writes.end ());
+			}
+			m_WriterCondition.notify_one ();
+		}
 
 		if (updatedCount > 0)
 			LogPrint (eLogInfo, "NetDb: saved ", updatedCount, " new/updated routers");
@@ -550,26 +1076,28 @@ namespace data
 			LogPrint (eLogInfo, "NetDb: deleting ", deletedCount, " unreachable routers");
 			// clean up RouterInfos table
 			{
-				std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-				for (auto it = m_RouterInfos.begin (); it != m_RouterInfos.end ();)
+				for (auto& shard: m_RouterInfos)
 				{
-					if (it->second->IsUnreachable ())
+					i2p::metrics::ProfiledLock l(shard.mutex);
+					for (auto it = shard.routerInfos.begin (); it != shard.routerInfos.end ();)
 					{
-						if (m_PersistProfiles) it->second->SaveProfile ();
-						it = m_RouterInfos.erase (it);
-						continue;
+						if (it->second->IsUnreachable ())
+						{
+							UpdateRandomRouters (it->second, true);
+							it = shard.routerInfos.erase (it);
+							m_NumRouterInfos--;
+							continue;
+						}
+						++it;
 					}
-					++it;
 				}
 			}
 			// clean up expired floodfiils
 			{
-				std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-				for (auto it = m_Floodfills.begin (); it != m_Floodfills.end ();)
-					if ((*it)->IsUnreachable ())
-						it = m_Floodfills.erase (it);
-					else
-						++it;
+				i2p::metrics::ProfiledLock l(m_FloodfillsMutex);
+				m_Floodfills.erase (std::remove_if (m_Floodfills.begin (), m_Floodfills.end (),
+					[](const std::shared_ptr<RouterInfo>& r) { return r->IsUnreachable (); }),
+					m_Floodfills.end ());
 			}
 		}
 	}
@@ -585,7 +1113,16 @@ namespace data
 
 		auto floodfill = GetClosestFloodfill (destination, dest->GetExcludedPeers ());
 		if (floodfill)
+		{
+			// first reply wins, later ones find no request
 			transports.SendMessage (floodfill->GetIdentHash (), dest->CreateRequestMessage (floodfill->GetIdentHash ()));
+			for (int i = 1; i < m_Parallelism; i++)
+			{
+				floodfill = GetClosestFloodfill (destination, dest->GetExcludedPeers ());
+				if (!floodfill) break;
+				transports.SendMessage (floodfill->GetIdentHash (), dest->CreateRequestMessage (floodfill->GetIdentHash ()));
+			}
+		}
 		else
 		{
 			LogPrint (eLogError, "NetDb: ", destination.ToBase64(), " destination requested, but no floodfills found");
@@ -619,7 +1156,91 @@ namespace data
 		}
 	}
 
+	void NetDb::PreverifyDatabaseStores (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs,
+		std::vector<ParsedDatabaseStore>& parsed)
+	{
+		// RouterInfos and LeaseSets signed by EdDSA identities, LeaseSet2 might be signed by offline or blinded keys
+		parsed.resize (msgs.size ());
+		std::vector<std::shared_ptr<const IdentityEx> > signers;
+		std::vector<const uint8_t *> bufs, signatures;
+		std::vector<size_t> lens;
+		for (size_t i = 0; i < msgs.size (); i++)
+		{
+			const auto& m = msgs[i];
+			if (m->GetTypeID () != eI2NPDatabaseStore || m->GetSize () < DATABASE_STORE_HEADER_SIZE) continue;
+			const uint8_t * buf = m->GetPayload ();
+			size_t len = m->GetSize ();
+			size_t offset = DATABASE_STORE_HEADER_SIZE;
+			if (bufbe32toh (buf + DATABASE_STORE_REPLY_TOKEN_OFFSET)) offset += 36; // tunnelID and gateway
+			uint8_t storeType = buf[DATABASE_STORE_TYPE_OFFSET];
+			std::shared_ptr<const IdentityEx> identity;
+			if (!storeType) // RouterInfo
+			{
+				if (offset + 2 > len) continue;
+				size_t size = bufbe16toh (buf + offset);
+				offset += 2;
+				if (size > 2048 || size > len - offset) continue;
+				auto& ri = parsed[i].routerInfo;
+				ri.resize (2048);
+				size_t uncompressedSize = m_Inflator.Inflate (buf + offset, size, ri.data (), 2048);
+				if (!uncompressedSize || uncompressedSize >= 2048)
+				{
+					ri.clear ();
+					continue;
+				}
+				ri.resize (uncompressedSize);
+				buf = ri.data ();
+				len = uncompressedSize;
+				auto r = FindRouter (IdentHash (m->GetPayload () + DATABASE_STORE_KEY_OFFSET));
+				if (r)
+				{
+					if (!r->IsNewer (buf, len)) continue; // handler drops it
+					identity = r->GetRouterIdentity (); // update is verified with known identity
+				}
+			}
+			else if (storeType == NETDB_STORE_TYPE_LEASESET && offset < len && !m->from) // LeaseSet through tunnel is dropped
+			{
+				buf += offset;
+				len -= offset;
+			}
+			else
+				continue;
+			if (!identity)
+			{
+				auto newIdentity = std::make_shared<IdentityEx> ();
+				if (!newIdentity->FromBuffer (buf, len)) continue;
+				parsed[i].identity = newIdentity;
+				identity = newIdentity;
+			}
+			if (identity->GetSigningKeyType () != SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519) continue;
+			size_t signedLen = identity->GetFullLen ();
+			if (storeType == NETDB_STORE_TYPE_LEASESET)
+			{
+				signedLen += 256 + identity->GetSigningPublicKeyLen (); // encryption and unused signing keys
+				if (signedLen >= len) continue;
+				signedLen += 1 + buf[signedLen]*LEASE_SIZE; // num and leases
+			}
+			else
+				signedLen = len - identity->GetSignatureLen ();
+			if (signedLen + identity->GetSignatureLen () > len) continue;
+			signers.push_back (identity);
+			bufs.push_back (buf);
+			lens.push_back (signedLen);
+			signatures.push_back (buf + signedLen);
+		}
+		if (signers.size () < 2) return; // nothing to batch
+		std::vector<const IdentityEx *> identities (signers.size ());
+		for (size_t i = 0; i < signers.size (); i++) identities[i] = signers[i].get ();
+		std::unique_ptr<bool[]> results (new bool[signers.size ()]);
+		VerifyCached (signers.size (), identities.data (), bufs.data (), lens.data (), signatures.data (), results.get ());
+	}
+
 	void NetDb::HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> m)
+	{
+		HandleDatabaseStoreMsg (m, nullptr);
+	}
+
+	void NetDb::HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> m, const ParsedDatabaseStore * parsed)
 	{
 		const uint8_t * buf = m->GetPayload ();
 		size_t len = m->GetSize ();
@@ -664,7 +1285,7 @@ namespace data
 			if (storeType == NETDB_STORE_TYPE_LEASESET) // 1
 			{
 				LogPrint (eLogDebug, "NetDb: store request: LeaseSet for ", ident.ToBase32());
-				updated = AddLeaseSet (ident, buf + offset, len - offset, m->from);
+				updated = AddLeaseSet (ident, buf + offset, len - offset, m->from, parsed ? parsed->identity : nullptr);
 			}
 			else // all others are considered as LeaseSet2 
 			{
@@ -675,21 +1296,26 @@ namespace data
 		else // RouterInfo
 		{
 			LogPrint (eLogDebug, "NetDb: store request: RouterInfo");
-			size_t size = bufbe16toh (buf + offset);
-			offset += 2;
-			if (size > 2048 || size > len - offset)
-			{
-				LogPrint (eLogError, "NetDb: invalid RouterInfo length ", (int)size);
-				return;
-			}
-			uint8_t uncompressed[2048];
-			size_t uncompressedSize = m_Inflator.Inflate (buf + offset, size, uncompressed, 2048);
-			if (uncompressedSize && uncompressedSize < 2048)
-				updated = AddRouterInfo (ident, uncompressed, uncompressedSize);
+			if (parsed && !parsed->routerInfo.empty ()) // inflated already
+				AddRouterInfo (ident, parsed->routerInfo.data (), parsed->routerInfo.size (), updated, parsed->identity);
 			else
 			{
-				LogPrint (eLogInfo, "NetDb: decompression failed ", uncompressedSize);
-				return;
+				size_t size = bufbe16toh (buf + offset);
+				offset += 2;
+				if (size > 2048 || size > len - offset)
+				{
+					LogPrint (eLogError, "NetDb: invalid RouterInfo length ", (int)size);
+					return;
+				}
+				uint8_t uncompressed[2048];
+				size_t uncompressedSize = m_Inflator.Inflate (buf + offset, size, uncompressed, 2048);
+				if (uncompressedSize && uncompressedSize < 2048)
+					updated = AddRouterInfo (ident, uncompressed, uncompressedSize);
+				else
+				{
+					LogPrint (eLogInfo, "NetDb: decompression failed ", uncompressedSize);
+					return;
+				}
 			}
 		}
 
@@ -725,7 +1351,9 @@ namespace data
 		auto dest = m_Requests.FindRequest (ident);
 		if (dest)
 		{
-			bool deleteDest = true;
+			if (msg->GetPayloadLength () >= 65 + (size_t)num*32)
+				dest->ReplyReceived (buf + 33 + num*32); // from
+			bool deleteDest = !dest->HasPending (); // wait for other floodfills
 			if (num > 0)
 			{
 				auto pool = i2p::tunnel::tunnels.GetExploratoryPool ();
@@ -762,7 +1390,7 @@ namespace data
 								deleteDest = false;
 							}
 						}
-						else
+						else if (deleteDest)
 							LogPrint (eLogWarning, "NetDb: ", key, " was not found on ", count, " floodfills");
 
 						if (msgs.size () > 0)
@@ -774,12 +1402,12 @@ namespace data
 					// no more requests for the destinationation. delete it
 					m_Requests.RequestComplete (ident, nullptr);
 			}
-			else
+			else if (deleteDest)
 				// no more requests for destination possible. delete it
 				m_Requests.RequestComplete (ident, nullptr);
 		}
 		else if(!m_FloodfillBootstrap)
-			LogPrint (eLogWarning, "NetDb: requested destination for ", key, " not found");
+			LogPrint (eLogDebug, "NetDb: requested destination for ", key, " not found or completed already");
 
 		// try responses
 		for (int i = 0; i < num; i++)
@@ -839,8 +1467,11 @@ namespace data
 			return;
 		}
 
-		std::shared_ptr<I2NPMessage> replyMsg;
-		if (lookupType == DATABASE_LOOKUP_TYPE_EXPLORATORY_LOOKUP)
+		// search replies depend on excluded peers, cached for lookups without them only
+		std::shared_ptr<I2NPMessage> replyMsg = GetCachedLookupReply (ident, lookupType, numExcluded > 0);
+		if (replyMsg)
+			LogPrint (eLogDebug, "NetDb: DatabaseLookup for ", key, " answered from cache");
+		else if (lookupType == DATABASE_LOOKUP_TYPE_EXPLORATORY_LOOKUP)
 		{
 			LogPrint (eLogInfo, "NetDb: exploratory close to  ", key, " ", numExcluded, " excluded");
 			std::set<IdentHash> excludedRouters;
@@ -860,6 +1491,7 @@ namespace data
 				}
 			}
 			replyMsg = CreateDatabaseSearchReply (ident, routers);
+			if (!numExcluded) CacheLookupReply (ident, lookupType, replyMsg);
 		}
 		else
 		{
@@ -872,23 +1504,27 @@ namespace data
 					LogPrint (eLogDebug, "NetDb: requested RouterInfo ", key, " found");
 					router->LoadBuffer ();
 					if (router->GetBuffer ())
+					{
 						replyMsg = CreateDatabaseStoreMsg (router);
+						CacheLookupReply (ident, lookupType, replyMsg);
+					}
 				}
 			}
 
 			if (!replyMsg && (lookupType == DATABASE_LOOKUP_TYPE_LEASESET_LOOKUP  ||
 			    lookupType == DATABASE_LOOKUP_TYPE_NORMAL_LOOKUP))
 			{
-				auto leaseSet = FindLeaseSet (ident);
-				if (!leaseSet)
+				auto leaseSetMsg = CreateLeaseSetStoreMsg (ident); // we don't send back our LeaseSets
+				if (!leaseSetMsg)
 				{
 					// no lease set found
 					LogPrint(eLogDebug, "NetDb: requested LeaseSet not found for ", ident.ToBase32());
 				}
-				else if (!leaseSet->IsExpired ()) // we don't send back our LeaseSets
+				else
 				{
 					LogPrint (eLogDebug, "NetDb: requested LeaseSet ", key, " found");
-					replyMsg = CreateDatabaseStoreMsg (leaseSet);
+					replyMsg = leaseSetMsg;
+					CacheLookupReply (ident, lookupType, replyMsg);
 				}
 			}
 
@@ -905,6 +1541,7 @@ namespace data
 				if (closestFloodfills.empty ())
 					LogPrint (eLogWarning, "NetDb: Requested ", key, " not found, ", numExcluded, " peers excluded");
 				replyMsg = CreateDatabaseSearchReply (ident, closestFloodfills);
+				if (!numExcluded) CacheLookupReply (ident, lookupType, replyMsg);
 		}
 		}
 		excluded += numExcluded * 32;
@@ -939,6 +1576,54 @@ namespace data
 		}
 	}
 
+	std::shared_ptr<I2NPMessage> NetDb::GetCachedLookupReply (const IdentHash& ident, uint8_t lookupType, bool storeOnly)
+	{
+		std::unique_lock<std::mutex> l(m_LookupRepliesMutex);
+		auto it = m_LookupReplies.find (std::make_pair (ident, lookupType));
+		if (it == m_LookupReplies.end ()) return nullptr;
+		if (i2p::util::GetSecondsSinceEpoch () > it->second.timestamp + NETDB_LOOKUP_REPLY_CACHE_TIMEOUT)
+		{
+			m_LookupReplies.erase (it);
+			return nullptr;
+		}
+		if (storeOnly && it->second.typeID != eI2NPDatabaseStore) return nullptr;
+		// new message ID and expiration
+		return CreateI2NPMessage ((I2NPMessageType)it->second.typeID, it->second.payload.data (), it->second.payload.size ());
+	}
+
+	void NetDb::CacheLookupReply (const IdentHash& ident, uint8_t lookupType, std::shared_ptr<const I2NPMessage> reply)
+	{
+		if (!reply) return;
+		std::unique_lock<std::mutex> l(m_LookupRepliesMutex);
+		if (m_LookupReplies.size () >= NETDB_LOOKUP_REPLY_CACHE_MAX_SIZE)
+			m_LookupReplies.clear (); // cheaper than eviction, popular keys come back soon
+		auto& r = m_LookupReplies[std::make_pair (ident, lookupType)];
+		r.typeID = reply->GetTypeID ();
+		r.payload.assign (reply->GetPayload (), reply->GetPayload () + reply->GetPayloadLength ());
+		r.timestamp = i2p::util::GetSecondsSinceEpoch ();
+	}
+
+	void NetDb::InvalidateLookupReplies (const IdentHash& ident)
+	{
+		std::unique_lock<std::mutex> l(m_LookupRepliesMutex);
+		auto it = m_LookupReplies.lower_bound (std::make_pair (ident, (uint8_t)0));
+		while (it != m_LookupReplies.end () && it->first.first == ident)
+			it = m_LookupReplies.erase (it);
+	}
+
+	void NetDb::CleanupLookupReplies ()
+	{
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(m_LookupRepliesMutex);
+		for (auto it = m_LookupReplies.begin (); it != m_LookupReplies.end ();)
+		{
+			if (ts > it->second.timestamp + NETDB_LOOKUP_REPLY_CACHE_TIMEOUT)
+				it = m_LookupReplies.erase (it);
+			else
+				++it;
+		}
+	}
+
 	void NetDb::Explore (int numDestinations)
 	{
 		// new requests
@@ -952,7 +1637,7 @@ namespace data
 		LogPrint (eLogInfo, "NetDb: exploring new ", numDestinations, " routers ...");
 		for (int i = 0; i < numDestinations; i++)
 		{
-			RAND_bytes (randomHash, 32);
+			i2p::crypto::RandBytes (randomHash, 32);
 			auto dest = m_Requests.CreateRequest (randomHash, true); // exploratory
 			if (!dest)
 			{
@@ -999,7 +1684,7 @@ namespace data
 			if (floodfill)
 			{
 				uint32_t replyToken;
-				RAND_bytes ((uint8_t *)&replyToken, 4);
+				replyToken = i2p::crypto::RandUint32 ();
 				LogPrint (eLogInfo, "NetDb: Publishing our RouterInfo to ", i2p::data::GetIdentHashAbbreviation(floodfill->GetIdentHash ()), ". reply token=", replyToken);
 				transports.SendMessage (floodfill->GetIdentHash (), CreateDatabaseStoreMsg (i2p::context.GetSharedRouterInfo (), replyToken));
 				excluded.insert (floodfill->GetIdentHash ());
@@ -1012,91 +1697,95 @@ namespace data
 		std::set<IdentHash> excluded;
 		excluded.insert (i2p::context.GetIdentHash ()); // don't flood to itself
 		excluded.insert (ident); // don't flood back
-		for (int i = 0; i < 3; i++)
+		// excluded are counted against num, one pass over floodfills instead of one per recipient
+		auto floodfills = GetClosestFloodfills (ident, 3 + excluded.size (), excluded);
+		if (floodfills.size () > 3) floodfills.resize (3);
+		for (size_t i = 0; i < floodfills.size (); i++)
 		{
-			auto floodfill = GetClosestFloodfill (ident, excluded);
-			if (floodfill)
-			{
-				auto h = floodfill->GetIdentHash();
-				LogPrint(eLogDebug, "NetDb: Flood lease set for ", ident.ToBase32(), " to ", h.ToBase64());
-				transports.SendMessage (h, CopyI2NPMessage(floodMsg));
-				excluded.insert (h);
-			}
-			else
-				break;
+			LogPrint(eLogDebug, "NetDb: Flood lease set for ", ident.ToBase32(), " to ", floodfills[i].ToBase64());
+			// transports write own headers to the buffer, last recipient takes the original
+			transports.SendMessage (floodfills[i], i + 1 < floodfills.size () ? CopyI2NPMessage (floodMsg) : floodMsg);
 		}
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter () const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (m_AllRouters, 0, NETDB_SELECTION_HIDDEN,
 			[](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden ();
+				return true;
 			});
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const
 	{
-		return GetRandomRouter (
+		return GetRandomRouter (m_AllRouters, compatibleWith->GetSupportedTransports (), NETDB_SELECTION_HIDDEN,
 			[compatibleWith](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router != compatibleWith &&
-					router->IsCompatible (*compatibleWith);
+				return router != compatibleWith;
 			});
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomPeerTestRouter (bool v4only) const
 	{
-		return GetRandomRouter (
-			[v4only](std::shared_ptr<const RouterInfo> router)->bool
+		// peer testing cap is guaranteed by candidates
+		return GetRandomRouter (m_PeerTestRouters, v4only ? RouterInfo::eSSUV4 : (RouterInfo::eSSUV4 | RouterInfo::eSSUV6),
+			NETDB_SELECTION_HIDDEN,
+			[](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router->IsPeerTesting () && router->IsSSU (v4only);
+				return true;
 			});
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetRandomIntroducer () const
 	{
-		return GetRandomRouter (
+		// introducer cap is guaranteed by candidates
+		return GetRandomRouter (m_IntroducerRouters, 0, NETDB_SELECTION_HIDDEN,
 			[](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router->IsIntroducer ();
+				return true;
 			});
 	}
 
 	std::shared_ptr<const RouterInfo> NetDb::GetHighBandwidthRandomRouter (std::shared_ptr<const RouterInfo> compatibleWith) const
 	{
-		return GetRandomRouter (
+		// high bandwidth cap is guaranteed by candidates, bad profiles are skipped
+		return GetRandomRouter (m_HighBandwidthRouters, compatibleWith->GetSupportedTransports (),
+			NETDB_SELECTION_HIDDEN | NETDB_SELECTION_BAD_PROFILE,
 			[compatibleWith](std::shared_ptr<const RouterInfo> router)->bool
 			{
-				return !router->IsHidden () && router != compatibleWith &&
-					router->IsCompatible (*compatibleWith) &&
-					(router->GetCaps () & RouterInfo::eHighBandwidth);
+				return router != compatibleWith;
 			});
 	}
 
 	template<typename Filter>
-	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (Filter filter) const
+	std::shared_ptr<const RouterInfo> NetDb::GetRandomRouter (const RandomRouters& candidates,
+		uint32_t transports, uint32_t excluded, Filter filter) const
 	{
-		if (m_RouterInfos.empty())
-			return 0;
-		uint32_t ind = rand () % m_RouterInfos.size ();
-		for (int j = 0; j < 2; j++)
-		{
-			uint32_t i = 0;
-			std::unique_lock<std::mutex> l(m_RouterInfosMutex);
-			for (const auto& it: m_RouterInfos)
+		// candidate must share one of transports if specified and have none of excluded flags
+		excluded |= NETDB_SELECTION_UNREACHABLE;
+		i2p::metrics::ProfiledLock l(m_RandomRoutersMutex);
+		size_t numRouters = candidates.routers.size ();
+		if (!numRouters)
+			return nullptr;
+		auto records = candidates.records.data ();
+		auto matches = [records, transports, excluded](size_t ind)->bool
 			{
-				if (i >= ind)
-				{
-					if (!it.second->IsUnreachable () && filter (it.second))
-						return it.second;
-				}
-				else
-					i++;
-			}
-			// we couldn't find anything, try second pass
-			ind = 0;
+				auto record = records[ind];
+				return !(record & excluded) && (!transports || (record & transports));
+			};
+		// most of candidates pass filter, try random ones first
+		for (int i = 0; i < NETDB_NUM_RANDOM_ROUTER_PROBES; i++)
+		{
+			size_t ind = i2p::crypto::RandUint32 () % numRouters;
+			if (matches (ind) && filter (candidates.routers[ind])) return candidates.routers[ind];
+		}
+		// then check all from random position
+		size_t start = i2p::crypto::RandUint32 () % numRouters;
+		for (size_t i = 0; i < numRouters; i++)
+		{
+			size_t ind = (start + i) % numRouters;
+			if (matches (ind) && filter (candidates.routers[ind])) return candidates.routers[ind];
 		}
 		return nullptr; // seems we have too few routers
 	}
@@ -1106,86 +1795,114 @@ namespace data
 		if (msg) m_Queue.Put (msg);
 	}
 
-	std::shared_ptr<const RouterInfo> NetDb::GetClosestFloodfill (const IdentHash& destination,
-		const std::set<IdentHash>& excluded, bool closeThanUsOnly) const
+	void NetDb::PostI2NPMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs)
 	{
-		std::shared_ptr<const RouterInfo> r;
-		XORMetric minMetric;
-		IdentHash destKey = CreateRoutingKey (destination);
-		if (closeThanUsOnly)
-			minMetric = destKey ^ i2p::context.GetIdentHash ();
+		m_Queue.Put (msgs); // one wakeup
+	}
+
+	void NetDb::AddFloodfill (std::shared_ptr<RouterInfo> r)
+	{
+		i2p::metrics::ProfiledLock l(m_FloodfillsMutex);
+		auto it = std::lower_bound (m_Floodfills.begin (), m_Floodfills.end (), r,
+			[](const std::shared_ptr<RouterInfo>& r1, const std::shared_ptr<RouterInfo>& r2)
+			{
+				return r1->GetIdentHash () < r2->GetIdentHash ();
+			});
+		if (it != m_Floodfills.end () && (*it)->GetIdentHash () == r->GetIdentHash ())
+			*it = r; // replace
 		else
-			minMetric.SetMax ();
-		std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-		for (const auto& it: m_Floodfills)
+			m_Floodfills.insert (it, r);
+	}
+
+	template<typename Iterator, typename Visitor>
+	static bool VisitByXORDistance (Iterator begin, Iterator end, const IdentHash& key, int bit, Visitor& v)
+	{
+		// all routers in [begin, end) have the same first 'bit' bits, descend to the half matching key first
+		if (begin == end) return true;
+		if (end - begin == 1 || bit >= 256)
 		{
-			if (!it->IsUnreachable ())
-			{
-				XORMetric m = destKey ^ it->GetIdentHash ();
-				if (m < minMetric && !excluded.count (it->GetIdentHash ()))
-				{
-					minMetric = m;
-					r = it;
-				}
-			}
+			for (auto it = begin; it != end; ++it)
+				if (!v (*it)) return false;
+			return true;
 		}
-		return r;
+		uint8_t mask = 0x80 >> (bit & 0x07);
+		auto mid = std::partition_point (begin, end,
+			[bit, mask](const std::shared_ptr<RouterInfo>& r) { return !(r->GetIdentHash ()[bit >> 3] & mask); });
+		if (key[bit >> 3] & mask)
+			return VisitByXORDistance (mid, end, key, bit + 1, v) && VisitByXORDistance (begin, mid, key, bit + 1, v);
+		else
+			return VisitByXORDistance (begin, mid, key, bit + 1, v) && VisitByXORDistance (mid, end, key, bit + 1, v);
 	}
 
-	std::vector<IdentHash> NetDb::GetClosestFloodfills (const IdentHash& destination, size_t num,
-		std::set<IdentHash>& excluded, bool closeThanUsOnly) const
+	template<typename Visitor>
+	bool NetDb::VisitClosestFloodfills (const IdentHash& destKey, Visitor& v) const
 	{
-		struct Sorted
-		{
-			std::shared_ptr<const RouterInfo> r;
-			XORMetric metric;
-			bool operator< (const Sorted& other) const { return metric < other.metric; };
-		};
+		// floodfills are visited in order of increasing XOR distance until visitor returns false
+		return VisitByXORDistance (m_Floodfills.begin (), m_Floodfills.end (), destKey, 0, v);
+	}
 
-		std::set<Sorted> sorted;
+	std::shared_ptr<const RouterInfo> NetDb::GetClosestFloodfill (const IdentHash& destination,
+		const std::set<IdentHash>& excluded, bool closeThanUsOnly) const
+	{
+		std::shared_ptr<const RouterInfo> r;
 		IdentHash destKey = CreateRoutingKey (destination);
 		XORMetric ourMetric;
 		if (closeThanUsOnly) ourMetric = destKey ^ i2p::context.GetIdentHash ();
-		{
-			std::unique_lock<std::mutex> l(m_FloodfillsMutex);
-			for (const auto& it: m_Floodfills)
+		int numCandidates = 0, bestScore = 0;
+		auto visitor = [&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				if (!it->IsUnreachable ())
+				if (closeThanUsOnly && !((destKey ^ it->GetIdentHash ()) < ourMetric))
+					return false; // the rest are even further
+				if (!it->IsUnreachable () && !excluded.count (it->GetIdentHash ()))
 				{
-					XORMetric m = destKey ^ it->GetIdentHash ();
-					if (closeThanUsOnly && ourMetric < m) continue;
-					if (sorted.size () < num)
-						sorted.insert ({it, m});
-					else if (m < sorted.rbegin ()->metric)
+					if (closeThanUsOnly) // must be closest
+					{
+						r = it;
+						return false;
+					}
+					int score = it->GetProfile ()->GetLookupScore ();
+					if (!r || score < bestScore)
 					{
-						sorted.insert ({it, m});
-						sorted.erase (std::prev (sorted.end ()));
+						r = it;
+						bestScore = score;
 					}
+					return ++numCandidates < NETDB_NUM_FLOODFILL_CANDIDATES;
 				}
-			}
-		}
+				return true;
+			};
+		i2p::metrics::ProfiledLock l(m_FloodfillsMutex);
+		VisitClosestFloodfills (destKey, visitor);
+		return r;
+	}
 
+	std::vector<IdentHash> NetDb::GetClosestFloodfills (const IdentHash& destination, size_t num,
+		std::set<IdentHash>& excluded, bool closeThanUsOnly) const
+	{
 		std::vector<IdentHash> res;
-		size_t i = 0;
-		for (const auto& it: sorted)
-		{
-			if (i < num)
+		if (!num) return res;
+		IdentHash destKey = CreateRoutingKey (destination);
+		XORMetric ourMetric;
+		if (closeThanUsOnly) ourMetric = destKey ^ i2p::context.GetIdentHash ();
+		size_t numReachable = 0; // excluded floodfills are counted against num
+		auto visitor = [&](const std::shared_ptr<RouterInfo>& it)->bool
 			{
-				const auto& ident = it.r->GetIdentHash ();
-				if (!excluded.count (ident))
+				if (closeThanUsOnly && ourMetric < (destKey ^ it->GetIdentHash ()))
+					return false; // the rest are even further
+				if (!it->IsUnreachable ())
 				{
-					res.push_back (ident);
-					i++;
+					numReachable++;
+					if (!excluded.count (it->GetIdentHash ()))
+						res.push_back (it->GetIdentHash ());
 				}
-			}
-			else
-				break;
-		}
+				return numReachable < num;
+			};
+		i2p::metrics::ProfiledLock l(m_FloodfillsMutex);
+		VisitClosestFloodfills (destKey, visitor);
 		return res;
 	}
 
   std::shared_ptr<const RouterInfo> NetDb::GetRandomRouterInFamily(const std::string & fam) const {
-    return GetRandomRouter(
+    return GetRandomRouter(m_AllRouters, 0, 0,
       [fam](std::shared_ptr<const RouterInfo> router)->bool
       {
         return router->IsFamily(fam);
@@ -1200,34 +1917,76 @@ namespace data
 		IdentHash destKey = CreateRoutingKey (destination);
 		minMetric.SetMax ();
 		// must be called from NetDb thread only
-		for (const auto& it: m_RouterInfos)
+		for (const auto& shard: m_RouterInfos)
 		{
-			if (!it.second->IsFloodfill ())
+			i2p::metrics::ProfiledLock l(shard.mutex);
+			for (const auto& it: shard.routerInfos)
 			{
-				XORMetric m = destKey ^ it.first;
-				if (m < minMetric && !excluded.count (it.first))
+				if (!it.second->IsFloodfill ())
 				{
-					minMetric = m;
-					r = it.second;
+					XORMetric m = destKey ^ it.first;
+					if (m < minMetric && !excluded.count (it.first))
+					{
+						minMetric = m;
+						r = it.second;
+					}
 				}
 			}
 		}
 		return r;
 	}
 
+	void NetDb::UpdateRoutingKeys ()
+	{
+		std::vector<IdentHash> idents;
+		idents.reserve (m_NumRouterInfos + 1);
+		idents.push_back (i2p::context.GetIdentHash ());
+		for (const auto& shard: m_RouterInfos)
+		{
+			i2p::metrics::ProfiledLock l(shard.mutex);
+			for (const auto& it: shard.routerInfos)
+				idents.push_back (it.first);
+		}
+		{
+			i2p::metrics::ProfiledLock l(m_LeaseSetsMutex);
+			for (const auto& it: m_LeaseSets)
+				idents.push_back (it.first);
+		}
+		i2p::data::UpdateRoutingKeys (idents);
+		LogPrint (eLogDebug, "NetDb: routing keys updated for ", idents.size (), " idents");
+	}
+
 	void NetDb::ManageLeaseSets ()
 	{
 		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
-		for (auto it = m_LeaseSets.begin (); it != m_LeaseSets.end ();)
+		uint64_t tick = ts/(NETDB_LEASESETS_WHEEL_TICK*1000LL);
+		i2p::metrics::ProfiledLock lock(m_LeaseSetsMutex);
+		// slots of past ticks only, all due times in them have passed
+		uint64_t start = m_LeaseSetsWheelTick + 1;
+		if (!m_LeaseSetsWheelTick || tick > start + NETDB_LEASESETS_WHEEL_NUM_SLOTS)
+			start = tick - NETDB_LEASESETS_WHEEL_NUM_SLOTS; // first time or too long ago, whole wheel
+		for (uint64_t t = start; t < tick; t++)
 		{
-			if (ts > it->second->GetExpirationTime () - LEASE_ENDDATE_THRESHOLD)
+			auto& slot = m_LeaseSetsWheel[t % NETDB_LEASESETS_WHEEL_NUM_SLOTS];
+			size_t numKept = 0;
+			for (auto& it: slot)
 			{
-				LogPrint (eLogInfo, "NetDb: LeaseSet ", it->second->GetIdentHash ().ToBase64 (), " expired");
-				it = m_LeaseSets.erase (it);
+				auto ls = m_LeaseSets.find (it.first);
+				if (ls == m_LeaseSets.end () || ls->second.expirationTime != it.second)
+					continue; // removed or updated and rescheduled
+				if (ts + LEASE_ENDDATE_THRESHOLD > it.second)
+				{
+					LogPrint (eLogInfo, "NetDb: LeaseSet ", it.first.ToBase64 (), " expired");
+					InvalidateLookupReplies (it.first);
+					m_LeaseSets.erase (ls);
+				}
+				else
+					slot[numKept++] = it; // due after wrap around
 			}
-			else
-				++it;
+			slot.resize (numKept);
 		}
+		m_LeaseSetsWheelTick = tick - 1;
+		m_NumLeaseSets = m_LeaseSets.size ();
 	}
 }
 }
@@ -4,10 +4,13 @@
 #include <inttypes.h>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <list>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 
 #include "Base.h"
 #include "Gzip.h"
@@ -21,6 +24,7 @@
 #include "Reseed.h"
 #include "NetDbRequests.h"
 #include "Family.h"
+#include "Metrics.h"
 
 namespace i2p
 {
@@ -32,6 +36,25 @@ namespace data
 	const int NETDB_MIN_EXPIRATION_TIMEOUT = 90*60; // 1.5 hours
 	const int NETDB_MAX_EXPIRATION_TIMEOUT = 27*60*60; // 27 hours
 	const int NETDB_PUBLISH_INTERVAL = 60*40;
+	const int NETDB_TARGET_EXPLORATORY_INTERVAL = 5*60; // in seconds, once number of routers reached limits.routers
+	const int NETDB_MANAGE_REQUESTS_INTERVAL = 15; // in seconds, other periodic tasks are less frequent
+	const int NETDB_NUM_ROUTER_INFOS_SHARDS = 16; // power of 2
+	const char NETDB_PACKED_FILENAME[] = "netDb.pack";
+	const int NETDB_SHARED_RELOAD_INTERVAL = 5*60; // in seconds, files of shared netDb updated by its owner
+	const int NETDB_MAX_NUM_LOAD_THREADS = 8;
+	const size_t NETDB_MIN_NUM_ROUTERS_PER_LOAD_THREAD = 256;
+	const int NETDB_NUM_RANDOM_ROUTER_PROBES = 8; // before scan of candidates
+	// packed selection record of random routers candidate: transports, caps and flags
+	const uint32_t NETDB_SELECTION_TRANSPORTS_MASK = 0xFF; // RouterInfo::SupportedTranports
+	const int NETDB_SELECTION_CAPS_SHIFT = 8; // RouterInfo::Caps
+	const uint32_t NETDB_SELECTION_HIDDEN = RouterInfo::eHidden << NETDB_SELECTION_CAPS_SHIFT;
+	const uint32_t NETDB_SELECTION_UNREACHABLE = 0x10000;
+	const uint32_t NETDB_SELECTION_BAD_PROFILE = 0x20000; // refreshed by NetDb thread
+	const int NETDB_NUM_FLOODFILL_CANDIDATES = 3; // nearest floodfills, fastest by lookup score is taken
+	const int NETDB_LOOKUP_REPLY_CACHE_TIMEOUT = 10; // in seconds
+	const size_t NETDB_LOOKUP_REPLY_CACHE_MAX_SIZE = 1024;
+	const int NETDB_LEASESETS_WHEEL_TICK = 60; // in seconds, as ManageLeaseSets is called
+	const int NETDB_LEASESETS_WHEEL_NUM_SLOTS = 64; // later expirations stay in slot until wrap around
 
 	/** function for visiting a leaseset stored in a floodfill */
 	typedef std::function<void(const IdentHash, std::shared_ptr<LeaseSet>)> LeaseSetVisitor;
@@ -52,9 +75,10 @@ namespace data
 			void Start ();
 			void Stop ();
 
-			bool AddRouterInfo (const uint8_t * buf, int len);
+			bool AddRouterInfo (const uint8_t * buf, int len, std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from buf already
 			bool AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len);
-			bool AddLeaseSet (const IdentHash& ident, const uint8_t * buf, int len, std::shared_ptr<i2p::tunnel::InboundTunnel> from);
+			bool AddLeaseSet (const IdentHash& ident, const uint8_t * buf, int len, std::shared_ptr<i2p::tunnel::InboundTunnel> from,
+				std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from buf already
 			bool AddLeaseSet2 (const IdentHash& ident, const uint8_t * buf, int len, uint8_t storeType);
 			std::shared_ptr<RouterInfo> FindRouter (const IdentHash& ident) const;
 			std::shared_ptr<LeaseSet> FindLeaseSet (const IdentHash& destination) const;
@@ -81,6 +105,7 @@ namespace data
 			void SetUnreachable (const IdentHash& ident, bool unreachable);
 
 			void PostI2NPMsg (std::shared_ptr<const I2NPMessage> msg);
+			void PostI2NPMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs);
 
       /** set hidden mode, aka don't publish our RI to netdb and don't explore */
       void SetHidden(bool hide);
@@ -89,9 +114,10 @@ namespace data
 			Families& GetFamilies () { return m_Families; };
 
 			// for web interface
-			int GetNumRouters () const { return m_RouterInfos.size (); };
+			int GetNumRouters () const { return m_NumRouterInfos; };
 			int GetNumFloodfills () const { return m_Floodfills.size (); };
-			int GetNumLeaseSets () const { return m_LeaseSets.size (); };
+			int GetNumLeaseSets () const { return m_NumLeaseSets; };
+			int GetMaxNumRouters () const { return m_MaxNumRouters; };
 
 			/** visit all lease sets we currently store */
 			void VisitLeaseSets(LeaseSetVisitor v);
@@ -102,35 +128,112 @@ namespace data
 			/** visit N random router that match using filter, then visit them with a visitor, return number of RouterInfos that were visited */
 			size_t VisitRandomRouterInfos(RouterInfoFilter f, RouterInfoVisitor v, size_t n);
 
-			void ClearRouterInfos () { m_RouterInfos.clear (); };
+			void ClearRouterInfos ();
 
 		private:
 
 			void Load ();
 			bool LoadRouterInfo (const std::string & path);
+			bool AddLoadedRouterInfo (std::shared_ptr<RouterInfo> r);
+			bool LoadPacked ();
+			void SavePacked ();
 			void SaveUpdated ();
+			void ReloadShared ();
+			bool IsShared () const { return !m_SharedNetDb.empty (); } // read-only netDb of another instance
+			bool IsPreferredToKeep (std::shared_ptr<const RouterInfo> r) const; // above limits.routers
 			void Run (); // exploratory thread
+			struct ParsedDatabaseStore // inflated and parsed once, for batch verification and handler
+			{
+				std::vector<uint8_t> routerInfo; // inflated
+				std::shared_ptr<const IdentityEx> identity; // of new RouterInfo or LeaseSet
+			};
+			void PreverifyDatabaseStores (const std::vector<std::shared_ptr<const I2NPMessage> >& msgs,
+				std::vector<ParsedDatabaseStore>& parsed); // EdDSA signatures in batch
+			void HandleDatabaseStoreMsg (std::shared_ptr<const I2NPMessage> msg, const ParsedDatabaseStore * parsed);
+			void RunWriter (); // RouterInfo files
+			void FlushWriter (); // waits for queued writes
+			bool IsWriterIdle ();
 			void Explore (int numDestinations);
 			void Publish ();
 			void Flood (const IdentHash& ident, std::shared_ptr<I2NPMessage> floodMsg);
 			void ManageLeaseSets ();
+			void UpdateRoutingKeys (); // for all known routers and destinations
 			void ManageRequests ();
 
 			void ReseedFromFloodfill(const RouterInfo & ri, int numRouters=40, int numFloodfills=20);
 
 			std::shared_ptr<const RouterInfo> AddRouterInfo (const uint8_t * buf, int len, bool& updated);
-			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated);
-    		template<typename Filter>
-        	std::shared_ptr<const RouterInfo> GetRandomRouter (Filter filter) const;
+			std::shared_ptr<const RouterInfo> AddRouterInfo (const IdentHash& ident, const uint8_t * buf, int len, bool& updated,
+				std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from buf already
+			struct RandomRouters;
+			template<typename Filter>
+			std::shared_ptr<const RouterInfo> GetRandomRouter (const RandomRouters& candidates,
+				uint32_t transports, uint32_t excluded, Filter filter) const;
+			void UpdateRandomRouters (std::shared_ptr<RouterInfo> r, bool remove = false);
+			void RefreshRandomRoutersRecords (); // profiles badness and reachability
+			void AddFloodfill (std::shared_ptr<RouterInfo> r);
+			template<typename Visitor>
+			bool VisitClosestFloodfills (const IdentHash& destKey, Visitor& v) const; // called with m_FloodfillsMutex locked
+
+			std::shared_ptr<I2NPMessage> GetCachedLookupReply (const IdentHash& ident, uint8_t lookupType, bool storeOnly);
+			void CacheLookupReply (const IdentHash& ident, uint8_t lookupType, std::shared_ptr<const I2NPMessage> reply);
+			void InvalidateLookupReplies (const IdentHash& ident);
+			void CleanupLookupReplies ();
+
+			void ScheduleLeaseSetExpiration (const IdentHash& ident, uint64_t expirationTime); // m_LeaseSetsMutex locked
+			std::shared_ptr<I2NPMessage> CreateLeaseSetStoreMsg (const IdentHash& ident) const; // nullptr if not found or expired
 
 		private:
 
-			mutable std::mutex m_LeaseSetsMutex;
-			std::map<IdentHash, std::shared_ptr<LeaseSet> > m_LeaseSets;
-			mutable std::mutex m_RouterInfosMutex;
-			std::map<IdentHash, std::shared_ptr<RouterInfo> > m_RouterInfos;
-			mutable std::mutex m_FloodfillsMutex;
-			std::list<std::shared_ptr<RouterInfo> > m_Floodfills;
+			struct StoredLeaseSet // serialized as received, parsed on demand only
+			{
+				std::unique_ptr<uint8_t[]> buffer;
+				uint64_t expirationTime; // in milliseconds
+				uint32_t len;
+				uint8_t storeType;
+
+				void Set (uint8_t type, const uint8_t * buf, size_t l, uint64_t expires);
+				std::shared_ptr<LeaseSet> Parse () const;
+			};
+			mutable i2p::metrics::ProfiledMutex m_LeaseSetsMutex { "netdb.leasesets" };
+			std::unordered_map<IdentHash, StoredLeaseSet> m_LeaseSets;
+			std::atomic<int> m_NumLeaseSets;
+			std::vector<std::pair<IdentHash, uint64_t> > m_LeaseSetsWheel[NETDB_LEASESETS_WHEEL_NUM_SLOTS]; // ident and expiration time by due tick
+			uint64_t m_LeaseSetsWheelTick; // last processed
+			struct RouterInfosShard
+			{
+				mutable i2p::metrics::ProfiledMutex mutex { "netdb.routerinfos" };
+				std::unordered_map<IdentHash, std::shared_ptr<RouterInfo> > routerInfos;
+			};
+			RouterInfosShard& GetRouterInfosShard (const IdentHash& ident) { return m_RouterInfos[ident[0] & (NETDB_NUM_ROUTER_INFOS_SHARDS - 1)]; };
+			const RouterInfosShard& GetRouterInfosShard (const IdentHash& ident) const { return m_RouterInfos[ident[0] & (NETDB_NUM_ROUTER_INFOS_SHARDS - 1)]; };
+
+			RouterInfosShard m_RouterInfos[NETDB_NUM_ROUTER_INFOS_SHARDS]; // sharded by first byte of ident
+			std::atomic<int> m_NumRouterInfos;
+			struct RandomRouters // dense array for O(1) random pick
+			{
+				std::vector<std::shared_ptr<RouterInfo> > routers;
+				std::vector<uint32_t> records; // selection records, same positions as routers
+				std::unordered_map<IdentHash, size_t> positions; // in routers
+
+				void Set (std::shared_ptr<RouterInfo> r, bool isCandidate, bool isBad = false); // add, replace or swap-remove
+				void SetRecord (const RouterInfo& r, bool isBad);
+				void SetFlag (const IdentHash& ident, uint32_t flag, bool set);
+				void Clear () { routers.clear (); records.clear (); positions.clear (); };
+			};
+			static uint32_t CreateSelectionRecord (const RouterInfo& r, bool isBad);
+			mutable i2p::metrics::ProfiledMutex m_RandomRoutersMutex { "netdb.randomrouters" };
+			RandomRouters m_AllRouters, m_HighBandwidthRouters, m_IntroducerRouters, m_PeerTestRouters;
+			mutable i2p::metrics::ProfiledMutex m_FloodfillsMutex { "netdb.floodfills" };
+			std::vector<std::shared_ptr<RouterInfo> > m_Floodfills; // sorted by ident hash
+			struct LookupReply
+			{
+				uint8_t typeID; // DatabaseStore or DatabaseSearchReply
+				std::vector<uint8_t> payload;
+				uint64_t timestamp; // in seconds
+			};
+			std::mutex m_LookupRepliesMutex;
+			std::map<std::pair<IdentHash, uint8_t>, LookupReply> m_LookupReplies; // by key and lookup type
 
 			bool m_IsRunning;
 			uint64_t m_LastLoad;
@@ -145,7 +248,18 @@ namespace data
 			friend class NetDbRequests;
 			NetDbRequests m_Requests;
 
-			bool m_PersistProfiles;
+			bool m_PersistProfiles, m_PackedNetDb;
+			std::string m_SharedNetDb; // data directory of the instance owning netDb files
+			int m_Parallelism; // floodfills asked at once
+			int m_MaxNumRouters; // 0 means no limit
+
+			// write-behind of RouterInfo files, NetDb thread doesn't touch disk
+			std::thread * m_WriterThread;
+			std::mutex m_WriterMutex;
+			std::condition_variable m_WriterCondition, m_WriterDoneCondition;
+			std::vector<std::pair<std::string, std::shared_ptr<std::vector<uint8_t> > > > m_PendingWrites; // nullptr means remove
+			bool m_IsWriterRunning, m_IsWriting, m_IsFsync;
+			std::vector<std::shared_ptr<RouterInfo> > m_WrittenRouters; // buffers are kept until files are written
 
 		/** router info we are bootstrapping from or nullptr if we are not currently doing that*/
 		std::shared_ptr<RouterInfo> m_FloodfillBootstrap;
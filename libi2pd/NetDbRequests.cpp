@@ -19,7 +19,10 @@ namespace data
 		else
 			msg = i2p::CreateRouterInfoDatabaseLookupMsg(m_Destination, i2p::context.GetIdentHash(), 0, m_IsExploratory, &m_ExcludedPeers);
 		if(router)
+		{
 			m_ExcludedPeers.insert (router->GetIdentHash ());
+			m_Pending[router->GetIdentHash ()] = i2p::util::GetMillisecondsSinceEpoch ();
+		}
 		m_CreationTime = i2p::util::GetSecondsSinceEpoch ();
 		return msg;
 	}
@@ -29,10 +32,28 @@ namespace data
 		auto msg = i2p::CreateRouterInfoDatabaseLookupMsg (m_Destination,
 			i2p::context.GetRouterInfo ().GetIdentHash () , 0, false, &m_ExcludedPeers);
 		m_ExcludedPeers.insert (floodfill);
+		m_Pending[floodfill] = i2p::util::GetMillisecondsSinceEpoch ();
 		m_CreationTime = i2p::util::GetSecondsSinceEpoch ();
 		return msg;
 	}
 
+	void RequestedDestination::ReplyReceived (const IdentHash& floodfill)
+	{
+		auto it = m_Pending.find (floodfill);
+		if (it != m_Pending.end ())
+		{
+			GetRouterProfile (floodfill)->LookupReplied (i2p::util::GetMillisecondsSinceEpoch () - it->second);
+			m_Pending.erase (it);
+		}
+	}
+
+	void RequestedDestination::ClearPending ()
+	{
+		for (auto& it: m_Pending)
+			GetRouterProfile (it.first)->LookupNonReplied ();
+		m_Pending.clear ();
+	}
+
 	void RequestedDestination::ClearExcludedPeers ()
 	{
 		m_ExcludedPeers.clear ();
@@ -40,6 +61,8 @@ namespace data
 
 	void RequestedDestination::Success (std::shared_ptr<RouterInfo> r)
 	{
+		if (m_Pending.size () == 1) // otherwise we don't know who replied
+			ReplyReceived (m_Pending.begin ()->first);
 		if (m_RequestComplete)
 		{
 			m_RequestComplete (r);
@@ -121,6 +144,7 @@ namespace data
 			{
 				if (ts > dest->GetCreationTime () + 5) // no response for 5 seconds
 				{
+					dest->ClearPending ();
 					auto count = dest->GetExcludedPeers ().size ();
 					if (!dest->IsExploratory () && count < 7)
 					{
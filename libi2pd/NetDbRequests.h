@@ -31,6 +31,10 @@ namespace data
 			std::shared_ptr<I2NPMessage> CreateRequestMessage (std::shared_ptr<const RouterInfo>, std::shared_ptr<const i2p::tunnel::InboundTunnel> replyTunnel);
 			std::shared_ptr<I2NPMessage> CreateRequestMessage (const IdentHash& floodfill);
 
+			void ReplyReceived (const IdentHash& floodfill); // DatabaseSearchReply, updates floodfill's response time
+			void ClearPending (); // floodfills not replied in time
+			bool HasPending () const { return !m_Pending.empty (); };
+
 			void SetRequestComplete (const RequestComplete& requestComplete) { m_RequestComplete = requestComplete; };
 			bool IsRequestComplete () const { return m_RequestComplete != nullptr; };
 			void Success (std::shared_ptr<RouterInfo> r);
@@ -42,6 +46,7 @@ namespace data
 			bool m_IsExploratory;
 			std::set<IdentHash> m_ExcludedPeers;
 			uint64_t m_CreationTime;
+			std::map<IdentHash, uint64_t> m_Pending; // floodfill -> time sent in milliseconds
 			RequestComplete m_RequestComplete;
 	};
 
@@ -9,6 +9,7 @@
 #define LIBI2PD_POLY1305_H
 #include <cstdint>
 #include <cstring>
+#include "I2PEndian.h"
 #include "Crypto.h"
 
 #if !OPENSSL_AEAD_CHACHA20_POLY1305 
@@ -192,6 +193,44 @@ namespace crypto
 			}
 		}
 
+#if defined(__SIZEOF_INT128__)
+		// 44/44/42 bits limbs and 128 bits products, h and r are kept in bytes between calls
+		void Blocks(const uint8_t * buf, size_t sz)
+		{
+			typedef unsigned __int128 uint128_t;
+			const uint64_t mask44 = 0xfffffffffff, mask42 = 0x3ffffffffff;
+			const uint64_t hibit = m_Final ? 0 : ((uint64_t)1 << 40); // 1 << 128
+			uint64_t t0 = le64toh (buf64toh (m_R.data)), t1 = le64toh (buf64toh (m_R.data + 8));
+			const uint64_t r0 = t0 & mask44, r1 = ((t0 >> 44) | (t1 << 20)) & mask44, r2 = (t1 >> 24) & mask42;
+			const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+			t0 = le64toh (buf64toh (m_H.data)); t1 = le64toh (buf64toh (m_H.data + 8));
+			uint64_t h0 = t0 & mask44, h1 = ((t0 >> 44) | (t1 << 20)) & mask44, h2 = (t1 >> 24) | ((uint64_t)m_H.data[16] << 40);
+			while (sz >= POLY1305_BLOCK_BYTES)
+			{
+				/* h += m */
+				t0 = le64toh (buf64toh (buf)); t1 = le64toh (buf64toh (buf + 8));
+				h0 += t0 & mask44;
+				h1 += ((t0 >> 44) | (t1 << 20)) & mask44;
+				h2 += ((t1 >> 24) & mask42) | hibit;
+				/* h *= r */
+				uint128_t d0 = (uint128_t)h0*r0 + (uint128_t)h1*s2 + (uint128_t)h2*s1;
+				uint128_t d1 = (uint128_t)h0*r1 + (uint128_t)h1*r0 + (uint128_t)h2*s2;
+				uint128_t d2 = (uint128_t)h0*r2 + (uint128_t)h1*r1 + (uint128_t)h2*r0;
+				/* (partial) h %= p */
+				uint64_t c = (uint64_t)(d0 >> 44); h0 = (uint64_t)d0 & mask44;
+				d1 += c; c = (uint64_t)(d1 >> 44); h1 = (uint64_t)d1 & mask44;
+				d2 += c; c = (uint64_t)(d2 >> 42); h2 = (uint64_t)d2 & mask42;
+				h0 += c*5; c = h0 >> 44; h0 &= mask44;
+				h1 += c;
+				buf += POLY1305_BLOCK_BYTES;
+				sz -= POLY1305_BLOCK_BYTES;
+			}
+			uint64_t c = h1 >> 44; h1 &= mask44; h2 += c;
+			htole64buf (m_H.data, h0 | (h1 << 44));
+			htole64buf (m_H.data + 8, (h1 >> 20) | (h2 << 24));
+			m_H.data[16] = h2 >> 40;
+		}
+#else
 		void Blocks(const uint8_t * buf, size_t sz)
 		{
 			const unsigned char hi = m_Final ^ 1;
@@ -221,6 +260,7 @@ namespace crypto
 				sz -= POLY1305_BLOCK_BYTES;
 			}
 		}
+#endif
 
 		void Finish(uint64_t * out)
 		{
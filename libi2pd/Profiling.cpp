@@ -1,21 +1,31 @@
-#include <sys/stat.h>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include "Base.h"
 #include "FS.h"
 #include "Log.h"
+#include "I2PEndian.h"
 #include "Profiling.h"
 
 namespace i2p
 {
 namespace data
 {
-	i2p::fs::HashedStorage m_ProfilesStorage("peerProfiles", "p", "profile-", "txt");
+	i2p::fs::HashedStorage m_ProfilesStorage("peerProfiles", "p", "profile-", "txt"); // old per-router files
+	static std::mutex g_ProfilesMutex;
+	static std::unordered_map<IdentHash, std::shared_ptr<RouterProfile> > g_Profiles;
+	static bool g_IsProfilesLoaded = false, g_IsOldProfilesImported = false;
+	static const boost::posix_time::ptime g_ProfilesEpoch (boost::gregorian::date (1970, 1, 1));
 
 	RouterProfile::RouterProfile ():
 		m_LastUpdateTime (boost::posix_time::second_clock::local_time()),
 		m_NumTunnelsAgreed (0), m_NumTunnelsDeclined (0), m_NumTunnelsNonReplied (0),
-		m_NumTimesTaken (0), m_NumTimesRejected (0)
+		m_NumTunnelsDeclinedByReason {}, m_NumTimesTaken (0), m_NumTimesRejected (0),
+		m_LookupResponseTime (0), m_NumLookupsReplied (0), m_NumLookupsNonReplied (0),
+		m_TransportRTT (0), m_TransportBandwidth (0)
 	{
 	}
 
@@ -29,32 +39,34 @@ namespace data
 		m_LastUpdateTime = GetTime ();
 	}
 
-	void RouterProfile::Save (const IdentHash& identHash)
+	void RouterProfile::ToBuffer (uint8_t * buf) const
 	{
-		// fill sections
-		boost::property_tree::ptree participation;
-		participation.put (PEER_PROFILE_PARTICIPATION_AGREED, m_NumTunnelsAgreed);
-		participation.put (PEER_PROFILE_PARTICIPATION_DECLINED, m_NumTunnelsDeclined);
-		participation.put (PEER_PROFILE_PARTICIPATION_NON_REPLIED, m_NumTunnelsNonReplied);
-		boost::property_tree::ptree usage;
-		usage.put (PEER_PROFILE_USAGE_TAKEN, m_NumTimesTaken);
-		usage.put (PEER_PROFILE_USAGE_REJECTED, m_NumTimesRejected);
-		// fill property tree
-		boost::property_tree::ptree pt;
-		pt.put (PEER_PROFILE_LAST_UPDATE_TIME, boost::posix_time::to_simple_string (m_LastUpdateTime));
-		pt.put_child (PEER_PROFILE_SECTION_PARTICIPATION, participation);
-		pt.put_child (PEER_PROFILE_SECTION_USAGE, usage);
+		htobe64buf (buf, (m_LastUpdateTime - g_ProfilesEpoch).total_seconds ());
+		htobe32buf (buf + 8, m_NumTunnelsAgreed);
+		htobe32buf (buf + 12, m_NumTunnelsDeclined);
+		htobe32buf (buf + 16, m_NumTunnelsNonReplied);
+		htobe32buf (buf + 20, m_NumTimesTaken);
+		htobe32buf (buf + 24, m_NumTimesRejected);
+	}
 
-		// save to file
-		std::string ident = identHash.ToBase64 ();
-		std::string path = m_ProfilesStorage.Path(ident);
+	void RouterProfile::FromBuffer (const uint8_t * buf)
+	{
+		m_LastUpdateTime = g_ProfilesEpoch + boost::posix_time::seconds (bufbe64toh (buf));
+		m_NumTunnelsAgreed = bufbe32toh (buf + 8);
+		m_NumTunnelsDeclined = bufbe32toh (buf + 12);
+		m_NumTunnelsNonReplied = bufbe32toh (buf + 16);
+		m_NumTimesTaken = bufbe32toh (buf + 20);
+		m_NumTimesRejected = bufbe32toh (buf + 24);
+	}
 
-		try {
-			boost::property_tree::write_ini (path, pt);
-		} catch (std::exception& ex) {
-			/* boost exception verbose enough */
-			LogPrint (eLogError, "Profiling: ", ex.what ());
-		}
+	bool RouterProfile::IsExpired () const
+	{
+		return (GetTime () - m_LastUpdateTime).hours () >= PEER_PROFILE_EXPIRATION_TIMEOUT;
+	}
+
+	bool RouterProfile::IsUsedRecently () const
+	{
+		return (GetTime () - m_LastUpdateTime).hours () < PEER_PROFILE_RECENT_USE_TIMEOUT;
 	}
 
 	void RouterProfile::Load (const IdentHash& identHash)
@@ -63,12 +75,6 @@ namespace data
 		std::string path = m_ProfilesStorage.Path(ident);
 		boost::property_tree::ptree pt;
 
-		if (!i2p::fs::Exists(path))
-		{
-			LogPrint(eLogWarning, "Profiling: no profile yet for ", ident);
-			return;
-		}
-
 		try
 		{
 			boost::property_tree::read_ini (path, pt);
@@ -119,21 +125,82 @@ namespace data
 		}
 	}
 
+	static int GetDeclineReasonIndex (uint8_t ret)
+	{
+		// 10 probabilistic, 20 transient overload, 30 bandwidth, 50 critical or unknown
+		return ret < 20 ? 0 : ret < 30 ? 1 : ret < 50 ? 2 : 3;
+	}
+
 	void RouterProfile::TunnelBuildResponse (uint8_t ret)
 	{
 		UpdateTime ();
 		if (ret > 0)
+		{
 			m_NumTunnelsDeclined++;
+			m_NumTunnelsDeclinedByReason[GetDeclineReasonIndex (ret)]++;
+		}
 		else
 			m_NumTunnelsAgreed++;
 	}
 
+	uint32_t RouterProfile::GetNumTunnelsDeclined (uint8_t ret) const
+	{
+		return m_NumTunnelsDeclinedByReason[GetDeclineReasonIndex (ret)];
+	}
+
 	void RouterProfile::TunnelNonReplied ()
 	{
 		m_NumTunnelsNonReplied++;
 		UpdateTime ();
 	}
 
+	void RouterProfile::LookupReplied (int responseTime)
+	{
+		m_LookupResponseTime = m_LookupResponseTime ? (3*m_LookupResponseTime + responseTime)/4 : responseTime;
+		if (++m_NumLookupsReplied + m_NumLookupsNonReplied > PEER_PROFILE_MAX_NUM_LOOKUPS)
+		{
+			// recent behaviour matters more
+			m_NumLookupsReplied /= 2;
+			m_NumLookupsNonReplied /= 2;
+		}
+	}
+
+	void RouterProfile::LookupNonReplied ()
+	{
+		if (m_NumLookupsReplied + ++m_NumLookupsNonReplied > PEER_PROFILE_MAX_NUM_LOOKUPS)
+		{
+			m_NumLookupsReplied /= 2;
+			m_NumLookupsNonReplied /= 2;
+		}
+	}
+
+	int RouterProfile::GetLookupScore () const
+	{
+		int score = m_LookupResponseTime ? m_LookupResponseTime : PEER_PROFILE_DEFAULT_LOOKUP_RESPONSE_TIME;
+		auto total = m_NumLookupsReplied + m_NumLookupsNonReplied;
+		if (total)
+			score += PEER_PROFILE_LOOKUP_NON_REPLIED_PENALTY*m_NumLookupsNonReplied/total;
+		return score;
+	}
+
+	void RouterProfile::TransportMeasured (int rtt, uint32_t bandwidth)
+	{
+		if (rtt > 0)
+			m_TransportRTT = m_TransportRTT ? (3*m_TransportRTT + rtt)/4 : rtt;
+		// sustained throughput, decays while peer is idle or slower
+		if (bandwidth > m_TransportBandwidth)
+			m_TransportBandwidth = bandwidth;
+		else
+			m_TransportBandwidth = (7*(uint64_t)m_TransportBandwidth + bandwidth)/8;
+	}
+
+	uint64_t RouterProfile::GetCapacityScore () const
+	{
+		if (!m_TransportBandwidth) return 0;
+		int rtt = m_TransportRTT ? m_TransportRTT : PEER_PROFILE_DEFAULT_TRANSPORT_RTT;
+		return (uint64_t)m_TransportBandwidth*PEER_PROFILE_CAPACITY_RTT_OFFSET/(rtt + PEER_PROFILE_CAPACITY_RTT_OFFSET);
+	}
+
 	bool RouterProfile::IsLowPartcipationRate () const
 	{
 		return 4*m_NumTunnelsAgreed < m_NumTunnelsDeclined; // < 20% rate
@@ -160,13 +227,116 @@ namespace data
 		return isBad;
 	}
 
+	bool RouterProfile::IsUnreliable () const
+	{
+		return (IsAlwaysDeclining () || IsLowPartcipationRate ()) && m_NumTimesRejected <= 10*(m_NumTimesTaken + 1);
+	}
+
+	static void LoadProfiles () // called with g_ProfilesMutex locked
+	{
+		g_IsProfilesLoaded = true;
+		std::string path = i2p::fs::DataDirPath (PEER_PROFILES_FILENAME);
+		std::ifstream f (path, std::ifstream::binary);
+		if (f.is_open ())
+		{
+			uint8_t buf[PEER_PROFILE_RECORD_SIZE];
+			while (f.read ((char *)buf, PEER_PROFILE_RECORD_SIZE))
+			{
+				auto profile = std::make_shared<RouterProfile> ();
+				profile->FromBuffer (buf + 32);
+				if (!profile->IsExpired ())
+					g_Profiles[IdentHash (buf)] = profile;
+			}
+			LogPrint (eLogInfo, "Profiling: ", g_Profiles.size (), " profiles loaded from ", path);
+			return;
+		}
+		// import old profile files once
+		std::vector<std::string> files;
+		m_ProfilesStorage.Traverse (files);
+		for (const auto& it: files)
+		{
+			auto pos1 = it.rfind ("profile-");
+			auto pos2 = it.rfind (".txt");
+			if (pos1 == std::string::npos || pos2 == std::string::npos || pos2 != pos1 + 8 + 44) continue;
+			IdentHash ident;
+			ident.FromBase64 (it.substr (pos1 + 8, 44));
+			auto profile = std::make_shared<RouterProfile> ();
+			profile->Load (ident);
+			g_Profiles[ident] = profile;
+		}
+		if (!files.empty ())
+		{
+			g_IsOldProfilesImported = true;
+			LogPrint (eLogInfo, "Profiling: ", g_Profiles.size (), " profiles imported from ", m_ProfilesStorage.GetRoot ());
+		}
+	}
+
 	std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash)
 	{
-		auto profile = std::make_shared<RouterProfile> ();
-		profile->Load (identHash); // if possible
+		std::unique_lock<std::mutex> l(g_ProfilesMutex);
+		if (!g_IsProfilesLoaded) LoadProfiles ();
+		auto& profile = g_Profiles[identHash];
+		if (!profile)
+			profile = std::make_shared<RouterProfile> ();
 		return profile;
 	}
 
+	std::shared_ptr<RouterProfile> FindRouterProfile (const IdentHash& identHash)
+	{
+		std::unique_lock<std::mutex> l(g_ProfilesMutex);
+		if (!g_IsProfilesLoaded) LoadProfiles ();
+		auto it = g_Profiles.find (identHash);
+		return it != g_Profiles.end () ? it->second : nullptr;
+	}
+
+	void SaveProfiles ()
+	{
+		std::vector<uint8_t> buf;
+		{
+			std::unique_lock<std::mutex> l(g_ProfilesMutex);
+			if (!g_IsProfilesLoaded) return; // nothing to save
+			buf.resize (g_Profiles.size ()*PEER_PROFILE_RECORD_SIZE);
+			auto p = buf.data ();
+			for (const auto& it: g_Profiles)
+			{
+				memcpy (p, it.first, 32);
+				it.second->ToBuffer (p + 32);
+				p += PEER_PROFILE_RECORD_SIZE;
+			}
+		}
+		std::string path = i2p::fs::DataDirPath (PEER_PROFILES_FILENAME);
+		std::string tmpPath = path + ".tmp";
+		std::ofstream f (tmpPath, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+		if (!f.is_open ())
+		{
+			LogPrint (eLogError, "Profiling: Can't open ", tmpPath);
+			return;
+		}
+		f.write ((const char *)buf.data (), buf.size ());
+		f.close ();
+		if (f.fail ())
+		{
+			LogPrint (eLogError, "Profiling: Can't write ", tmpPath);
+			return;
+		}
+		i2p::fs::Remove (path);
+		if (std::rename (tmpPath.c_str (), path.c_str ()))
+		{
+			LogPrint (eLogError, "Profiling: Can't rename ", tmpPath, " to ", path);
+			return;
+		}
+		LogPrint (eLogDebug, "Profiling: ", buf.size ()/PEER_PROFILE_RECORD_SIZE, " profiles saved");
+		if (g_IsOldProfilesImported)
+		{
+			// old files are not needed anymore
+			std::vector<std::string> files;
+			m_ProfilesStorage.Traverse (files);
+			for (const auto& it: files)
+				i2p::fs::Remove (it);
+			g_IsOldProfilesImported = false;
+		}
+	}
+
 	void InitProfilesStorage ()
 	{
 		m_ProfilesStorage.SetPlace(i2p::fs::GetDataDir());
@@ -175,20 +345,13 @@ namespace data
 
 	void DeleteObsoleteProfiles ()
 	{
-		struct stat st;
-		std::time_t now = std::time(nullptr);
-
-		std::vector<std::string> files;
-		m_ProfilesStorage.Traverse(files);
-		for (const auto& path: files) {
-			if (stat(path.c_str(), &st) != 0) {
-				LogPrint(eLogWarning, "Profiling: Can't stat(): ", path);
-				continue;
-			}
-			if (((now - st.st_mtime) / 3600) >= PEER_PROFILE_EXPIRATION_TIMEOUT) {
-				LogPrint(eLogDebug, "Profiling: removing expired peer profile: ", path);
-				i2p::fs::Remove(path);
-			}
+		std::unique_lock<std::mutex> l(g_ProfilesMutex);
+		for (auto it = g_Profiles.begin (); it != g_Profiles.end ();)
+		{
+			if (it->second->IsExpired ())
+				it = g_Profiles.erase (it); // still used by RouterInfo if any
+			else
+				++it;
 		}
 	}
 }
@@ -21,6 +21,16 @@ namespace data
 	const char PEER_PROFILE_USAGE_REJECTED[] = "rejected";
 
 	const int PEER_PROFILE_EXPIRATION_TIMEOUT = 72; // in hours (3 days)
+	const int PEER_PROFILE_RECENT_USE_TIMEOUT = 3; // in hours
+	const char PEER_PROFILES_FILENAME[] = "peerProfiles.dat"; // all profiles in one file
+	const size_t PEER_PROFILE_RECORD_SIZE = 60; // ident hash, last update time, 5 counters
+	const int PEER_PROFILES_SAVE_INTERVAL = 30*60; // in seconds
+	const int PEER_PROFILE_DEFAULT_LOOKUP_RESPONSE_TIME = 1000; // in milliseconds, for unknown floodfill
+	const int PEER_PROFILE_LOOKUP_NON_REPLIED_PENALTY = 5000; // in milliseconds, times non-replied rate
+	const uint32_t PEER_PROFILE_MAX_NUM_LOOKUPS = 64; // counters are halved after
+	const int PEER_PROFILE_NUM_DECLINE_REASONS = 4; // probabilistic, transient, bandwidth, critical reject codes
+	const int PEER_PROFILE_CAPACITY_RTT_OFFSET = 100; // in milliseconds, capacity is bandwidth*offset/(rtt + offset)
+	const int PEER_PROFILE_DEFAULT_TRANSPORT_RTT = 500; // in milliseconds, for bandwidth measured without RTT
 
 	class RouterProfile
 	{
@@ -29,13 +39,32 @@ namespace data
 			RouterProfile ();
 			RouterProfile& operator= (const RouterProfile& ) = default;
 
-			void Save (const IdentHash& identHash);
-			void Load (const IdentHash& identHash);
+			void Load (const IdentHash& identHash); // from old profile file
+			void ToBuffer (uint8_t * buf) const; // PEER_PROFILE_RECORD_SIZE - 32 bytes
+			void FromBuffer (const uint8_t * buf);
+			bool IsExpired () const;
+			bool IsUsedRecently () const; // took part in tunnel builds lately
 
 			bool IsBad ();
+			bool IsUnreliable () const; // as IsBad, without usage accounting
 
 			void TunnelBuildResponse (uint8_t ret);
 			void TunnelNonReplied ();
+			uint32_t GetNumTunnelsAgreed () const { return m_NumTunnelsAgreed; };
+			uint32_t GetNumTunnelsDeclined (uint8_t ret) const; // by reject code, not saved
+			uint32_t GetNumTunnelsNonReplied () const { return m_NumTunnelsNonReplied; };
+
+			// floodfill lookups, not saved
+			void LookupReplied (int responseTime); // in milliseconds
+			void LookupNonReplied ();
+			int GetLookupScore () const; // expected response time in milliseconds, lower is better
+			int GetLookupResponseTime () const { return m_LookupResponseTime; };
+
+			// measured by transport sessions, not saved
+			void TransportMeasured (int rtt, uint32_t bandwidth); // rtt in milliseconds, bandwidth in bytes per second, 0 if unknown
+			int GetTransportRTT () const { return m_TransportRTT; };
+			uint32_t GetTransportBandwidth () const { return m_TransportBandwidth; };
+			uint64_t GetCapacityScore () const; // higher is better, 0 if not measured
 
 		private:
 
@@ -53,13 +82,22 @@ namespace data
 			uint32_t m_NumTunnelsAgreed;
 			uint32_t m_NumTunnelsDeclined;
 			uint32_t m_NumTunnelsNonReplied;
+			uint32_t m_NumTunnelsDeclinedByReason[PEER_PROFILE_NUM_DECLINE_REASONS];
 			// usage
 			uint32_t m_NumTimesTaken;
 			uint32_t m_NumTimesRejected;
+			// floodfill lookups
+			int m_LookupResponseTime; // moving average, 0 if unknown
+			uint32_t m_NumLookupsReplied, m_NumLookupsNonReplied;
+			// transport
+			int m_TransportRTT; // moving average in milliseconds, 0 if unknown
+			uint32_t m_TransportBandwidth; // highest recent throughput in bytes per second
 	};
 
 	std::shared_ptr<RouterProfile> GetRouterProfile (const IdentHash& identHash);
+	std::shared_ptr<RouterProfile> FindRouterProfile (const IdentHash& identHash); // nullptr if not known
 	void InitProfilesStorage ();
+	void SaveProfiles (); // writes all profiles to one file
 	void DeleteObsoleteProfiles ();
 }
 }
@@ -8,6 +8,8 @@
 #include <condition_variable>
 #include <functional>
 #include <utility>
+#include <atomic>
+#include <chrono>
 
 namespace i2p
 {
@@ -53,11 +55,12 @@ namespace util
 			{
 				std::unique_lock<std::mutex> l(m_QueueMutex);
 				auto el = GetNonThreadSafe ();
-				if (!el)
+				if (!el && !m_IsWoken)
 				{
 					m_NonEmpty.wait_for (l, std::chrono::milliseconds (usec));
 					el = GetNonThreadSafe ();
 				}
+				m_IsWoken = false;
 				return el;
 			}
 
@@ -85,7 +88,12 @@ namespace util
 				return m_Queue.size ();
 			}
 
-			void WakeUp () { m_NonEmpty.notify_all (); };
+			void WakeUp () // GetNextWithTimeout returns even if called after
+			{
+				std::unique_lock<std::mutex> l(m_QueueMutex);
+				m_IsWoken = true;
+				m_NonEmpty.notify_all ();
+			}
 
 			Element Get ()
 			{
@@ -118,6 +126,216 @@ namespace util
 			std::queue<Element> m_Queue;
 			std::mutex m_QueueMutex;
 			std::condition_variable m_NonEmpty;
+			bool m_IsWoken = false;
+	};
+	const int MPSC_QUEUE_MIN_SPIN_COUNT = 16;
+	const int MPSC_QUEUE_MAX_SPIN_COUNT = 1024;
+
+	/**
+	 * @brief lock-free queue for multiple producers and single consumer
+	 *
+	 * Producers push to atomic stack, consumer takes whole stack at once and reverses it.
+	 * Consumer spins for a while before parking on condition variable,
+	 * spin count adapts to whether spinning was successful recently.
+	 * Only one thread may call Get* and Wait methods.
+	 */
+	template<typename Element>
+	class MPSCQueue
+	{
+		struct Node
+		{
+			Element element;
+			Node * next;
+		};
+
+		public:
+
+			MPSCQueue (): m_Head (nullptr), m_Pending (nullptr), m_Size (0),
+				m_IsParked (false), m_SpinCount (MPSC_QUEUE_MIN_SPIN_COUNT), m_IsWoken (false) {};
+			~MPSCQueue ()
+			{
+				DeleteNodes (m_Head.exchange (nullptr));
+				DeleteNodes (m_Pending);
+			}
+
+			void Put (Element e)
+			{
+				auto node = new Node { std::move (e), nullptr };
+				Push (node, node, 1);
+			}
+
+			template<template<typename, typename...>class Container, typename... R>
+			void Put (const Container<Element, R...>& vec)
+			{
+				// build chain and push it with single CAS, last element on top
+				Node * first = nullptr, * last = nullptr;
+				int num = 0;
+				for (const auto& it: vec)
+				{
+					auto node = new Node { it, last };
+					if (!first) first = node;
+					last = node;
+					num++;
+				}
+				if (num) Push (last, first, num);
+			}
+
+			Element Get ()
+			{
+				if (!m_Pending) TakeAll ();
+				if (!m_Pending) return nullptr;
+				auto node = m_Pending;
+				m_Pending = node->next;
+				auto el = std::move (node->element);
+				delete node;
+				m_Size--;
+				return el;
+			}
+
+			template<template<typename, typename...>class Container, typename... R>
+			int GetAll (Container<Element, R...>& vec) // append all available elements, return number
+			{
+				int num = 0;
+				TakeAll ();
+				while (m_Pending)
+				{
+					auto node = m_Pending;
+					m_Pending = node->next;
+					vec.push_back (std::move (node->element));
+					delete node;
+					num++;
+				}
+				m_Size -= num;
+				return num;
+			}
+
+			Element GetNext ()
+			{
+				Element el;
+				while (!(el = Spin ()))
+					Park (std::chrono::milliseconds::max ());
+				return el;
+			}
+
+			Element GetNextWithTimeout (int usec)
+			{
+				auto el = Spin ();
+				if (!el)
+				{
+					Park (std::chrono::milliseconds (usec));
+					el = Get ();
+				}
+				return el;
+			}
+
+			bool Wait (int sec, int usec)
+			{
+				if (!IsEmpty ()) return true;
+				return Park (std::chrono::seconds (sec) + std::chrono::milliseconds (usec));
+			}
+
+			bool IsEmpty () const { return !m_Size; };
+			int GetSize () const { return m_Size; };
+
+			void WakeUp () // next or current Park returns, even if consumer isn't parked yet
+			{
+				std::unique_lock<std::mutex> l(m_ParkMutex);
+				m_IsWoken = true;
+				m_NonEmpty.notify_all ();
+			}
+
+		private:
+
+			void Push (Node * top, Node * bottom, int num)
+			{
+				bottom->next = m_Head.load (std::memory_order_relaxed);
+				while (!m_Head.compare_exchange_weak (bottom->next, top)); // seq_cst, pairs with m_IsParked
+				m_Size += num;
+				if (m_IsParked.load ())
+				{
+					std::unique_lock<std::mutex> l(m_ParkMutex);
+					m_NonEmpty.notify_one ();
+				}
+			}
+
+			void TakeAll ()
+			{
+				auto node = m_Head.exchange (nullptr, std::memory_order_acquire);
+				if (!node) return;
+				// reverse to FIFO and append to pending
+				Node * reversed = nullptr;
+				while (node)
+				{
+					auto next = node->next;
+					node->next = reversed;
+					reversed = node;
+					node = next;
+				}
+				if (m_Pending)
+				{
+					auto last = m_Pending;
+					while (last->next) last = last->next;
+					last->next = reversed;
+				}
+				else
+					m_Pending = reversed;
+			}
+
+			Element Spin ()
+			{
+				auto el = Get ();
+				if (el) return el;
+				for (int i = 0; i < m_SpinCount; i++)
+				{
+					std::this_thread::yield ();
+					if ((el = Get ()))
+					{
+						if (m_SpinCount < MPSC_QUEUE_MAX_SPIN_COUNT) m_SpinCount <<= 1;
+						return el;
+					}
+				}
+				if (m_SpinCount > MPSC_QUEUE_MIN_SPIN_COUNT) m_SpinCount >>= 1;
+				return el;
+			}
+
+			template<typename Duration>
+			bool Park (const Duration& timeout) // returns false if timeout expired
+			{
+				bool ret = true;
+				std::unique_lock<std::mutex> l(m_ParkMutex);
+				m_IsParked.store (true);
+				if (!m_Pending && !m_Head.load () && !m_IsWoken)
+				{
+					if (timeout == Duration::max ())
+						m_NonEmpty.wait (l);
+					else
+						ret = m_NonEmpty.wait_for (l, timeout) != std::cv_status::timeout;
+				}
+				m_IsWoken = false;
+				m_IsParked.store (false);
+				return ret;
+			}
+
+			static void DeleteNodes (Node * node)
+			{
+				while (node)
+				{
+					auto next = node->next;
+					delete node;
+					node = next;
+				}
+			}
+
+		private:
+
+			std::atomic<Node *> m_Head; // producers side, LIFO
+			Node * m_Pending; // consumer side, FIFO
+			std::atomic<int> m_Size;
+			std::atomic<bool> m_IsParked;
+			int m_SpinCount;
+			bool m_IsWoken; // by WakeUp, guarded by m_ParkMutex
+			std::mutex m_ParkMutex;
+			std::condition_variable m_NonEmpty;
 	};
 }
 }
@@ -1,6 +1,14 @@
 #include <string.h>
 #include <fstream>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <memory>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/algorithm/string.hpp>
@@ -30,6 +38,8 @@ namespace data
 
 	Reseeder::~Reseeder()
 	{
+		for (auto& it: m_Downloads)
+			if (it.valid ()) it.wait ();
 	}
 
         /** @brief tries to bootstrap into I2P network (from local files and servers, with respect of options)
@@ -67,32 +77,64 @@ namespace data
             }
         }
 
-        /** @brief bootstrap from random server, retry 10 times
+        /** @brief bootstrap from random servers, several downloads in parallel, 10 attempts total
          *  @return number of entries added to netDb
          */
 	int Reseeder::ReseedFromServers ()
 	{
 		std::string reseedURLs; i2p::config::GetOption("reseed.urls", reseedURLs);
-                std::vector<std::string> httpsReseedHostList;
-                boost::split(httpsReseedHostList, reseedURLs, boost::is_any_of(","), boost::token_compress_on);
+		std::vector<std::string> httpsReseedHostList;
+		boost::split(httpsReseedHostList, reseedURLs, boost::is_any_of(","), boost::token_compress_on);
 
-                if (reseedURLs.length () == 0)
-                {
-                    LogPrint (eLogWarning, "Reseed: No reseed servers specified");
-                    return 0;
-                }
+		if (reseedURLs.length () == 0)
+		{
+			LogPrint (eLogWarning, "Reseed: No reseed servers specified");
+			return 0;
+		}
 
-                int reseedRetries = 0;
-                while (reseedRetries < 10)
-                {
-                    auto ind = rand () % httpsReseedHostList.size ();
-                    std::string reseedUrl = httpsReseedHostList[ind] + "i2pseeds.su3";
-                    auto num = ReseedFromSU3Url (reseedUrl);
-                    if (num > 0) return num; // success
-                    reseedRetries++;
-                }
-                LogPrint (eLogWarning, "Reseed: failed to reseed from servers after 10 attempts");
-                return 0;
+		// downloads from several servers at the time, first good SU3 wins
+		std::shuffle (httpsReseedHostList.begin (), httpsReseedHostList.end (), std::mt19937 (rand ()));
+		m_Downloads.clear (); // left from previous reseed, waits for them
+		int numAttempts = 0;
+		while (numAttempts < RESEED_MAX_NUM_ATTEMPTS)
+		{
+			std::vector<std::future<std::string> > downloads;
+			for (int i = 0; i < RESEED_NUM_PARALLEL_DOWNLOADS && numAttempts < RESEED_MAX_NUM_ATTEMPTS; i++)
+			{
+				std::string reseedUrl = httpsReseedHostList[numAttempts % httpsReseedHostList.size ()] + "i2pseeds.su3";
+				LogPrint (eLogInfo, "Reseed: Downloading SU3 from ", reseedUrl);
+				downloads.push_back (std::async (std::launch::async, &Reseeder::HttpsRequest, this, reseedUrl));
+				numAttempts++;
+			}
+			while (!downloads.empty ())
+			{
+				for (auto it = downloads.begin (); it != downloads.end ();)
+				{
+					if (it->wait_for (std::chrono::milliseconds (100)) == std::future_status::ready)
+					{
+						std::string su3 = it->get ();
+						it = downloads.erase (it);
+						if (su3.length () > 0)
+						{
+							std::stringstream s(su3);
+							auto num = ProcessSU3Stream (s);
+							if (num > 0)
+							{
+								// don't wait for the rest
+								for (auto& d: downloads) m_Downloads.push_back (std::move (d));
+								return num; // success
+							}
+						}
+						else
+							LogPrint (eLogWarning, "Reseed: SU3 download failed");
+					}
+					else
+						it++;
+				}
+			}
+		}
+		LogPrint (eLogWarning, "Reseed: failed to reseed from servers after ", RESEED_MAX_NUM_ATTEMPTS, " attempts");
+		return 0;
 	}
 
         /** @brief bootstrap from HTTPS URL with SU3 file
@@ -255,6 +297,113 @@ namespace data
 		return ProcessZIPStream (s, contentLength);
 	}
 
+	/** @brief adds inflated RouterInfos to netDb from several threads while next entries are being inflated
+	 */
+	class ReseedRouterInfosAdder
+	{
+		public:
+
+			ReseedRouterInfosAdder (): m_IsFinished (false)
+			{
+				int numThreads = std::thread::hardware_concurrency ();
+				if (numThreads > RESEED_MAX_NUM_THREADS) numThreads = RESEED_MAX_NUM_THREADS;
+				if (numThreads < 1) numThreads = 1;
+				for (int i = 0; i < numThreads; i++)
+					m_Threads.emplace_back (&ReseedRouterInfosAdder::Run, this);
+			}
+
+			~ReseedRouterInfosAdder ()
+			{
+				Finish ();
+			}
+
+			void Add (std::vector<uint8_t>&& buf)
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				while (m_Queue.size () >= RESEED_MAX_QUEUE_SIZE)
+					m_Dequeued.wait (l);
+				m_Queue.push_back (std::move (buf));
+				m_Enqueued.notify_one ();
+			}
+
+			void Finish ()
+			{
+				{
+					std::unique_lock<std::mutex> l(m_Mutex);
+					m_IsFinished = true;
+					m_Enqueued.notify_all ();
+				}
+				for (auto& it: m_Threads)
+					if (it.joinable ()) it.join ();
+			}
+
+		private:
+
+			void Run ()
+			{
+				std::unique_lock<std::mutex> l(m_Mutex);
+				while (true)
+				{
+					if (!m_Queue.empty ())
+					{
+						std::vector<std::vector<uint8_t> > bufs;
+						while (!m_Queue.empty () && bufs.size () < RESEED_VERIFY_BATCH_SIZE)
+						{
+							bufs.push_back (std::move (m_Queue.front ()));
+							m_Queue.pop_front ();
+						}
+						m_Dequeued.notify_all ();
+						l.unlock ();
+						std::vector<std::shared_ptr<const i2p::data::IdentityEx> > identities (bufs.size ());
+						if (i2p::crypto::EDDSA25519_BATCH_VERIFICATION)
+							Preverify (bufs, identities);
+						for (size_t i = 0; i < bufs.size (); i++) // verifies signature or finds it in cache
+							i2p::data::netdb.AddRouterInfo (bufs[i].data (), bufs[i].size (), identities[i]);
+						l.lock ();
+					}
+					else if (m_IsFinished)
+						break;
+					else
+						m_Enqueued.wait (l);
+				}
+			}
+
+			void Preverify (const std::vector<std::vector<uint8_t> >& bufs,
+				std::vector<std::shared_ptr<const i2p::data::IdentityEx> >& identities)
+			{
+				// EdDSA signatures in batch, verified are added to cache, parsed identities are reused by netdb
+				std::vector<const i2p::data::IdentityEx *> signers;
+				std::vector<const uint8_t *> signedBufs, signatures;
+				std::vector<size_t> signedLens;
+				for (size_t i = 0; i < bufs.size (); i++)
+				{
+					const auto& buf = bufs[i];
+					auto identity = std::make_shared<i2p::data::IdentityEx> ();
+					if (!identity->FromBuffer (buf.data (), buf.size ())) continue;
+					identities[i] = identity;
+					if (identity->GetSigningKeyType () != i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519 ||
+						buf.size () < identity->GetFullLen () + identity->GetSignatureLen ()) continue;
+					size_t signedLen = buf.size () - identity->GetSignatureLen ();
+					signers.push_back (identity.get ());
+					signedBufs.push_back (buf.data ());
+					signedLens.push_back (signedLen);
+					signatures.push_back (buf.data () + signedLen);
+				}
+				if (signers.size () < 2) return;
+				std::unique_ptr<bool[]> results (new bool[signers.size ()]);
+				i2p::data::VerifyCached (signers.size (), signers.data (), signedBufs.data (), signedLens.data (),
+					signatures.data (), results.get ());
+			}
+
+		private:
+
+			bool m_IsFinished;
+			std::deque<std::vector<uint8_t> > m_Queue;
+			std::mutex m_Mutex;
+			std::condition_variable m_Enqueued, m_Dequeued;
+			std::vector<std::thread> m_Threads;
+	};
+
 	const uint32_t ZIP_HEADER_SIGNATURE = 0x04034B50;
 	const uint32_t ZIP_CENTRAL_DIRECTORY_HEADER_SIGNATURE = 0x02014B50;
 	const uint16_t ZIP_BIT_FLAG_DATA_DESCRIPTOR = 0x0008;
@@ -262,6 +411,7 @@ namespace data
 	{
 		int numFiles = 0;
 		size_t contentPos = s.tellg ();
+		ReseedRouterInfosAdder adder;
 		while (!s.eof ())
 		{
 			uint32_t signature;
@@ -334,18 +484,19 @@ namespace data
 					z_stream inflator;
 					memset (&inflator, 0, sizeof (inflator));
 					inflateInit2 (&inflator, -MAX_WBITS); // no zlib header
-					uint8_t * uncompressed = new uint8_t[uncompressedSize];
+					std::vector<uint8_t> uncompressed (uncompressedSize);
 					inflator.next_in = compressed;
 					inflator.avail_in = compressedSize;
-					inflator.next_out = uncompressed;
+					inflator.next_out = uncompressed.data ();
 					inflator.avail_out = uncompressedSize;
 					int err;
 					if ((err = inflate (&inflator, Z_SYNC_FLUSH)) >= 0)
 					{
 						uncompressedSize -= inflator.avail_out;
-						if (crc32 (0, uncompressed, uncompressedSize) == crc_32)
+						if (crc32 (0, uncompressed.data (), uncompressedSize) == crc_32)
 						{
-							i2p::data::netdb.AddRouterInfo (uncompressed, uncompressedSize);
+							uncompressed.resize (uncompressedSize);
+							adder.Add (std::move (uncompressed));
 							numFiles++;
 						}
 						else
@@ -353,12 +504,11 @@ namespace data
 					}
 					else
 						LogPrint (eLogError, "Reseed: SU3 decompression error ", err);
-					delete[] uncompressed;
 					inflateEnd (&inflator);
 				}
 				else // no compression
 				{
-					i2p::data::netdb.AddRouterInfo (compressed, compressedSize);
+					adder.Add (std::vector<uint8_t>(compressed, compressed + compressedSize));
 					numFiles++;
 				}
 				delete[] compressed;
@@ -375,6 +525,7 @@ namespace data
 			if (end - contentPos >= contentLength)
 				break; // we are beyond contentLength
 		}
+		adder.Finish (); // wait until all RouterInfos are added
 		if (numFiles) // check if  routers are not outdated
 		{
 			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
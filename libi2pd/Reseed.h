@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <future>
 #include "Identity.h"
 #include "Crypto.h"
 
@@ -13,6 +14,12 @@ namespace i2p
 namespace data
 {
 
+	const int RESEED_NUM_PARALLEL_DOWNLOADS = 3;
+	const int RESEED_MAX_NUM_ATTEMPTS = 10;
+	const int RESEED_MAX_NUM_THREADS = 4; // to verify RouterInfos
+	const size_t RESEED_MAX_QUEUE_SIZE = 64; // inflated RouterInfos waiting for verification
+	const size_t RESEED_VERIFY_BATCH_SIZE = 16; // RouterInfos verified at once by one thread
+
 	class Reseeder
 	{
 		typedef Tag<512> PublicKey;
@@ -43,6 +50,7 @@ namespace data
 		private:
 
 			std::map<std::string, PublicKey> m_SigningKeys;
+			std::vector<std::future<std::string> > m_Downloads; // still running after successful reseed
 	};
 }
 }
@@ -4,6 +4,7 @@
 #include "Crypto.h"
 #include "Ed25519.h"
 #include "Timestamp.h"
+#include "Gzip.h"
 #include "I2NPProtocol.h"
 #include "NetDb.hpp"
 #include "FS.h"
@@ -110,10 +111,36 @@ namespace i2p
 	void RouterContext::UpdateRouterInfo ()
 	{
 		m_RouterInfo.CreateBuffer (m_Keys);
+		{
+			std::unique_lock<std::mutex> l(m_DatabaseStorePayloadMutex);
+			m_DatabaseStorePayload = nullptr;
+		}
 		m_RouterInfo.SaveToFile (i2p::fs::DataDirPath (ROUTER_INFO));
 		m_LastUpdateTime = i2p::util::GetSecondsSinceEpoch ();
 	}
 
+	std::shared_ptr<const std::vector<uint8_t> > RouterContext::GetDatabaseStorePayload ()
+	{
+		std::unique_lock<std::mutex> l(m_DatabaseStorePayloadMutex);
+		if (!m_DatabaseStorePayload)
+		{
+			// key, type, zero reply token, size and gzipped RouterInfo
+			auto payload = std::make_shared<std::vector<uint8_t> > (I2NP_MAX_SHORT_MESSAGE_SIZE - I2NP_HEADER_SIZE);
+			uint8_t * buf = payload->data ();
+			memcpy (buf + DATABASE_STORE_KEY_OFFSET, m_RouterInfo.GetIdentHash (), 32);
+			buf[DATABASE_STORE_TYPE_OFFSET] = 0; // RouterInfo
+			htobe32buf (buf + DATABASE_STORE_REPLY_TOKEN_OFFSET, 0);
+			size_t size = i2p::data::GzipDeflate (m_RouterInfo.GetBuffer (), m_RouterInfo.GetBufferLen (),
+				buf + DATABASE_STORE_HEADER_SIZE + 2, payload->size () - DATABASE_STORE_HEADER_SIZE - 2);
+			if (!size) return nullptr;
+			htobe16buf (buf + DATABASE_STORE_HEADER_SIZE, size);
+			payload->resize (DATABASE_STORE_HEADER_SIZE + 2 + size);
+			payload->shrink_to_fit ();
+			m_DatabaseStorePayload = payload;
+		}
+		return m_DatabaseStorePayload;
+	}
+
 	void RouterContext::NewNTCP2Keys ()
 	{
 		m_StaticKeys.reset (new i2p::crypto::X25519Keys ());
@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include <string>
 #include <memory>
+#include <vector>
 #include <mutex>
 #include <boost/asio.hpp>
 #include "Identity.h"
@@ -54,6 +55,7 @@ namespace i2p
 				return std::shared_ptr<const i2p::data::RouterInfo> (&m_RouterInfo,
 					[](const i2p::data::RouterInfo *) {});
 			}
+			std::shared_ptr<const std::vector<uint8_t> > GetDatabaseStorePayload (); // our RouterInfo without reply token, gzipped once per change
 			std::shared_ptr<i2p::garlic::GarlicDestination> GetSharedDestination ()
 			{
 				return std::shared_ptr<i2p::garlic::GarlicDestination> (this,
@@ -144,6 +146,8 @@ namespace i2p
 			RouterError m_Error;
 			int m_NetID;
 			std::mutex m_GarlicMutex;
+			std::mutex m_DatabaseStorePayloadMutex;
+			std::shared_ptr<const std::vector<uint8_t> > m_DatabaseStorePayload; // reset by UpdateRouterInfo
 			std::unique_ptr<NTCP2PrivateKeys> m_NTCP2Keys;
 			std::unique_ptr<i2p::crypto::X25519Keys> m_StaticKeys;
 	};
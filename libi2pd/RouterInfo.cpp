@@ -2,6 +2,9 @@
 #include <string.h>
 #include "I2PEndian.h"
 #include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
 #if (BOOST_VERSION >= 105300)
@@ -20,28 +23,113 @@ namespace i2p
 {
 namespace data
 {
-	RouterInfo::RouterInfo (): m_Buffer (nullptr)
+	static std::mutex g_InternedStringsMutex;
+	static std::unordered_map<std::string, std::weak_ptr<const std::string> > g_InternedStrings;
+	static size_t g_InternedStringsCleanupSize = ROUTER_INFO_MIN_INTERNED_STRINGS_CLEANUP_SIZE;
+
+	InternedString InternString (const char * str)
+	{
+		std::unique_lock<std::mutex> l(g_InternedStringsMutex);
+		auto& weak = g_InternedStrings[str];
+		auto s = weak.lock ();
+		if (!s)
+		{
+			s = std::make_shared<const std::string> (str);
+			weak = s;
+			if (g_InternedStrings.size () > g_InternedStringsCleanupSize)
+			{
+				// drop strings of deleted RouterInfos, amortized by doubling threshold
+				for (auto it = g_InternedStrings.begin (); it != g_InternedStrings.end ();)
+				{
+					if (it->second.expired ())
+						it = g_InternedStrings.erase (it);
+					else
+						++it;
+				}
+				g_InternedStringsCleanupSize = std::max (ROUTER_INFO_MIN_INTERNED_STRINGS_CLEANUP_SIZE, 2*g_InternedStrings.size ());
+			}
+		}
+		return s;
+	}
+
+	/** @brief subset of std::istream used by parser, over buffer without copy */
+	class RouterInfo::BufferStream
+	{
+		public:
+
+			BufferStream (const uint8_t * buf, size_t len): m_Buf (buf), m_Len (len), m_Offset (0), m_IsGood (true) {};
+
+			BufferStream& read (char * out, size_t n)
+			{
+				if (m_IsGood && m_Offset + n <= m_Len)
+				{
+					memcpy (out, m_Buf + m_Offset, n);
+					m_Offset += n;
+				}
+				else
+					m_IsGood = false;
+				return *this;
+			}
+
+			BufferStream& seekg (size_t off, std::ios_base::seekdir) // from current position only
+			{
+				if (m_IsGood && m_Offset + off <= m_Len)
+					m_Offset += off;
+				else
+					m_IsGood = false;
+				return *this;
+			}
+
+			explicit operator bool () const { return m_IsGood; };
+			bool operator! () const { return !m_IsGood; };
+
+		private:
+
+			const uint8_t * m_Buf;
+			size_t m_Len, m_Offset;
+			bool m_IsGood;
+	};
+
+	RouterInfo::RouterInfo (): m_Buffer (nullptr), m_BandwidthCap (0), m_Version (0)
 	{
 		m_Addresses = boost::make_shared<Addresses>(); // create empty list
 	}
 
 	RouterInfo::RouterInfo (const std::string& fullPath):
 		m_FullPath (fullPath), m_IsUpdated (false), m_IsUnreachable (false),
-		m_SupportedTransports (0), m_Caps (0)
+		m_SupportedTransports (0), m_Caps (0), m_BandwidthCap (0), m_Version (0)
 	{
 		m_Addresses = boost::make_shared<Addresses>(); // create empty list
 		m_Buffer = new uint8_t[MAX_RI_BUFFER_SIZE];
 		ReadFromFile ();
 	}
 
-	RouterInfo::RouterInfo (const uint8_t * buf, int len):
-		m_IsUpdated (true), m_IsUnreachable (false), m_SupportedTransports (0), m_Caps (0)
+	RouterInfo::RouterInfo (const uint8_t * buf, int len, std::shared_ptr<const IdentityEx> identity):
+		m_RouterIdentity (identity), m_IsUpdated (true), m_IsUnreachable (false), m_SupportedTransports (0), m_Caps (0), m_BandwidthCap (0), m_Version (0)
 	{
 		m_Addresses = boost::make_shared<Addresses>(); // create empty list
 		m_Buffer = new uint8_t[MAX_RI_BUFFER_SIZE];
 		memcpy (m_Buffer, buf, len);
 		m_BufferLen = len;
-		ReadFromBuffer (true);
+		ReadFromBuffer (true, !identity);
+	}
+
+	RouterInfo::RouterInfo (const std::string& fullPath, const uint8_t * buf, int len):
+		m_FullPath (fullPath), m_IsUpdated (false), m_IsUnreachable (false),
+		m_SupportedTransports (0), m_Caps (0), m_BandwidthCap (0), m_Version (0)
+	{
+		m_Addresses = boost::make_shared<Addresses>(); // create empty list
+		if (len < 40 || len > (int)MAX_RI_BUFFER_SIZE)
+		{
+			LogPrint (eLogError, "RouterInfo: Buffer for ", m_FullPath, " is malformed");
+			m_Buffer = nullptr;
+			m_IsUnreachable = true;
+			return;
+		}
+		m_Buffer = new uint8_t[MAX_RI_BUFFER_SIZE];
+		memcpy (m_Buffer, buf, len);
+		m_BufferLen = len;
+		ReadFromBuffer (false);
 	}
 
 	RouterInfo::~RouterInfo ()
@@ -49,17 +137,26 @@ namespace data
 		delete[] m_Buffer;
 	}
 
-	void RouterInfo::Update (const uint8_t * buf, int len)
+	bool RouterInfo::Update (const uint8_t * buf, int len)
 	{
+		// new RouterInfo must have the same identity
+		IdentityEx identity;
+		if (!identity.FromBuffer (buf, len) || identity.GetIdentHash () != m_RouterIdentity->GetIdentHash ())
+		{
+			LogPrint (eLogError, "RouterInfo: Update identity mismatch");
+			return false;
+		}
 		// verify signature since we have indentity already
 		int l = len - m_RouterIdentity->GetSignatureLen ();
-		if (m_RouterIdentity->Verify (buf, l, buf + l))
+		if (l > 0 && VerifyCached (m_RouterIdentity, buf, l, buf + l))
 		{
 			// clean up
 			m_IsUpdated = true;
 			m_IsUnreachable = false;
 			m_SupportedTransports = 0;
 			m_Caps = 0;
+			m_BandwidthCap = 0;
+			m_Version = 0;
 			// don't clean up m_Addresses, it will be replaced in ReadFromStream
 			m_Properties.clear ();
 			// copy buffer
@@ -70,15 +167,17 @@ namespace data
 			// skip identity
 			size_t identityLen = m_RouterIdentity->GetFullLen ();
 			// read new RI
-			std::stringstream str (std::string ((char *)m_Buffer + identityLen, m_BufferLen - identityLen));
+			BufferStream str (m_Buffer + identityLen, m_BufferLen - identityLen);
 			ReadFromStream (str);
 			// don't delete buffer until saved to the file
+			return true;
 		}
 		else
 		{
 			LogPrint (eLogError, "RouterInfo: signature verification failed");
 			m_IsUnreachable = true;
 		}
+		return false;
 	}
 
 	void RouterInfo::SetRouterIdentity (std::shared_ptr<const IdentityEx> identity)
@@ -120,9 +219,10 @@ namespace data
 			m_IsUnreachable = true;
 	}
 
-	void RouterInfo::ReadFromBuffer (bool verifySignature)
+	void RouterInfo::ReadFromBuffer (bool verifySignature, bool readIdentity)
 	{
-		m_RouterIdentity = std::make_shared<IdentityEx>(m_Buffer, m_BufferLen);
+		if (readIdentity || !m_RouterIdentity)
+			m_RouterIdentity = std::make_shared<IdentityEx>(m_Buffer, m_BufferLen);
 		size_t identityLen = m_RouterIdentity->GetFullLen ();
 		if (identityLen >= m_BufferLen)
 		{
@@ -141,7 +241,7 @@ namespace data
 			}
 			// verify signature
 			int l = m_BufferLen - m_RouterIdentity->GetSignatureLen ();
-			if (l < 0 || !m_RouterIdentity->Verify ((uint8_t *)m_Buffer, l, (uint8_t *)m_Buffer + l))
+			if (l < 0 || !VerifyCached (m_RouterIdentity, (uint8_t *)m_Buffer, l, (uint8_t *)m_Buffer + l))
 			{
 				LogPrint (eLogError, "RouterInfo: signature verification failed");
 				m_IsUnreachable = true;
@@ -150,8 +250,7 @@ namespace data
 			m_RouterIdentity->DropVerifier ();
 		}
 		// parse RI
-		std::stringstream str;
-		str.write ((const char *)m_Buffer + identityLen, m_BufferLen - identityLen);
+		BufferStream str (m_Buffer + identityLen, m_BufferLen - identityLen);
 		ReadFromStream (str);
 		if (!str)
 		{
@@ -161,7 +260,7 @@ namespace data
 
 	}
 
-	void RouterInfo::ReadFromStream (std::istream& s)
+	void RouterInfo::ReadFromStream (BufferStream& s)
 	{
 		s.read ((char *)&m_Timestamp, sizeof (m_Timestamp));
 		m_Timestamp = be64toh (m_Timestamp);
@@ -169,6 +268,7 @@ namespace data
 		auto addresses = boost::make_shared<Addresses>();
 		uint8_t numAddresses;
 		s.read ((char *)&numAddresses, sizeof (numAddresses)); if (!s) return;
+		addresses->reserve (numAddresses);
 		bool introducers = false;
 		for (int i = 0; i < numAddresses; i++)
 		{
@@ -321,11 +421,16 @@ namespace data
 			r += ReadString (value, 255, s);
 			s.seekg (1, std::ios_base::cur); r++; // ;
 			if (!s) return;
-			m_Properties[key] = value;
+			if (m_Properties.empty () || *m_Properties.back ().first < key)
+				m_Properties.emplace_back (InternString (key), InternString (value)); // sorted already
+			else
+				SetProperty (key, value);
 
 			// extract caps
 			if (!strcmp (key, "caps"))
 				ExtractCaps (value);
+			else if (!strcmp (key, ROUTER_INFO_PROPERTY_VERSION))
+				ExtractVersion (value);
 			// check netId
 			else if (!strcmp (key, ROUTER_INFO_PROPERTY_NETID) && atoi (value) != i2p::context.GetNetID ())
 			{
@@ -368,14 +473,20 @@ namespace data
 				case CAPS_FLAG_FLOODFILL:
 					m_Caps |= Caps::eFloodfill;
 				break;
+				case CAPS_FLAG_LOW_BANDWIDTH1:
+				case CAPS_FLAG_LOW_BANDWIDTH2:
+					m_BandwidthCap = *cap;
+				break;
 				case CAPS_FLAG_HIGH_BANDWIDTH1:
 				case CAPS_FLAG_HIGH_BANDWIDTH2:
 				case CAPS_FLAG_HIGH_BANDWIDTH3:
 					m_Caps |= Caps::eHighBandwidth;
+					m_BandwidthCap = *cap;
 				break;
 				case CAPS_FLAG_EXTRA_BANDWIDTH1:
 				case CAPS_FLAG_EXTRA_BANDWIDTH2:
 					m_Caps |= Caps::eExtraBandwidth | Caps::eHighBandwidth;
+					m_BandwidthCap = *cap;
 				break;
 				case CAPS_FLAG_HIDDEN:
 					m_Caps |= Caps::eHidden;
@@ -398,6 +509,16 @@ namespace data
 		}
 	}
 
+	void RouterInfo::ExtractVersion (const char * value)
+	{
+		// major.minor.patch, each fits byte
+		unsigned int major = 0, minor = 0, patch = 0;
+		if (sscanf (value, "%u.%u.%u", &major, &minor, &patch) >= 2 && major < 256 && minor < 256 && patch < 256)
+			m_Version = (major << 16) | (minor << 8) | patch;
+		else
+			m_Version = 0;
+	}
+
 	void RouterInfo::UpdateCapsProperty ()
 	{
 		std::string caps;
@@ -573,9 +694,9 @@ namespace data
 		std::stringstream properties;
 		for (const auto& p : m_Properties)
 		{
-			WriteString (p.first, properties);
+			WriteString (*p.first, properties);
 			properties << '=';
-			WriteString (p.second, properties);
+			WriteString (*p.second, properties);
 			properties << ';';
 		}
 		uint16_t size = htobe16 (properties.str ().size ());
@@ -634,9 +755,9 @@ namespace data
 		return true;
 	}
 
-	size_t RouterInfo::ReadString (char * str, size_t len, std::istream& s) const
+	size_t RouterInfo::ReadString (char * str, size_t len, BufferStream& s) const
 	{
-		uint8_t l;
+		uint8_t l = 0;
 		s.read ((char *)&l, 1);
 		if (l < len)
 		{
@@ -671,7 +792,7 @@ namespace data
 		for (const auto& it: *m_Addresses) // don't insert same address twice
 			if (*it == *addr) return;
 		m_SupportedTransports |= addr->host.is_v6 () ? eNTCPV6 : eNTCPV4;
-		m_Addresses->push_front(std::move(addr)); // always make NTCP first
+		m_Addresses->insert (m_Addresses->begin (), std::move(addr)); // always make NTCP first
 	}
 
 	void RouterInfo::AddSSUAddress (const char * host, int port, const uint8_t * key, int mtu)
@@ -755,21 +876,34 @@ namespace data
 		ExtractCaps (caps);
 	}
 
+	template<typename Properties>
+	static auto FindProperty (Properties& properties, const std::string& key) -> decltype (properties.begin ())
+	{
+		return std::lower_bound (properties.begin (), properties.end (), key,
+			[](const RouterInfo::Properties::value_type& p, const std::string& k) { return *p.first < k; });
+	}
+
 	void RouterInfo::SetProperty (const std::string& key, const std::string& value)
 	{
-		m_Properties[key] = value;
+		auto it = FindProperty (m_Properties, key);
+		if (it != m_Properties.end () && *it->first == key)
+			it->second = InternString (value.c_str ());
+		else
+			m_Properties.emplace (it, InternString (key.c_str ()), InternString (value.c_str ()));
 	}
 
 	void RouterInfo::DeleteProperty (const std::string& key)
 	{
-		m_Properties.erase (key);
+		auto it = FindProperty (m_Properties, key);
+		if (it != m_Properties.end () && *it->first == key)
+			m_Properties.erase (it);
 	}
 
 	std::string RouterInfo::GetProperty (const std::string& key) const
 	{
-		auto it = m_Properties.find (key);
-		if (it != m_Properties.end ())
-			return it->second;
+		auto it = FindProperty (m_Properties, key);
+		if (it != m_Properties.end () && *it->first == key)
+			return *it->second;
 		return "";
 	}
 
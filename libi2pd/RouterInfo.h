@@ -5,7 +5,6 @@
 #include <string>
 #include <map>
 #include <vector>
-#include <list>
 #include <iostream>
 #include <boost/asio.hpp>
 #include <boost/shared_ptr.hpp>
@@ -21,6 +20,7 @@ namespace data
 	const char ROUTER_INFO_PROPERTY_NETID[] = "netId";
 	const char ROUTER_INFO_PROPERTY_FAMILY[] = "family";
 	const char ROUTER_INFO_PROPERTY_FAMILY_SIG[] = "family.sig";
+	const char ROUTER_INFO_PROPERTY_VERSION[] = "router.version";
 
 	const char CAPS_FLAG_FLOODFILL = 'f';
 	const char CAPS_FLAG_HIDDEN = 'H';
@@ -39,6 +39,12 @@ namespace data
 	const char CAPS_FLAG_SSU_INTRODUCER = 'C';
 
 	const int MAX_RI_BUFFER_SIZE = 2048;
+	const size_t ROUTER_INFO_MIN_INTERNED_STRINGS_CLEANUP_SIZE = 4096;
+
+	/** @brief property keys and values repeat across routers, equal strings share one copy */
+	typedef std::shared_ptr<const std::string> InternedString;
+	InternedString InternString (const char * str);
+
 	class RouterInfo: public RoutingDestination
 	{
 		public:
@@ -130,13 +136,15 @@ namespace data
 				bool IsPublishedNTCP2 () const { return IsNTCP2 () && ntcp2->isPublished; };
 				bool IsNTCP2Only () const { return ntcp2 && ntcp2->isNTCP2Only; };
 			};
-			typedef std::list<std::shared_ptr<Address> > Addresses;
+			typedef std::vector<std::shared_ptr<Address> > Addresses;
+			typedef std::vector<std::pair<InternedString, InternedString> > Properties; // sorted by key
 
 			RouterInfo ();
 			RouterInfo (const std::string& fullPath);
 			RouterInfo (const RouterInfo& ) = default;
 			RouterInfo& operator=(const RouterInfo& ) = default;
-			RouterInfo (const uint8_t * buf, int len);
+			RouterInfo (const uint8_t * buf, int len, std::shared_ptr<const IdentityEx> identity = nullptr); // identity parsed from buf already
+			RouterInfo (const std::string& fullPath, const uint8_t * buf, int len); // from buffer previously saved to fullPath
 			~RouterInfo ();
 
 			std::shared_ptr<const IdentityEx> GetRouterIdentity () const { return m_RouterIdentity; };
@@ -157,7 +165,7 @@ namespace data
 			void SetProperty (const std::string& key, const std::string& value); // called from RouterContext only
 			void DeleteProperty (const std::string& key); // called from RouterContext only
 			std::string GetProperty (const std::string& key) const; // called from RouterContext only
-			void ClearProperties () { m_Properties.clear (); };
+			void ClearProperties () { m_Properties.clear (); m_Properties.shrink_to_fit (); };
 			bool IsFloodfill () const { return m_Caps & Caps::eFloodfill; };
 			bool IsReachable () const { return m_Caps & Caps::eReachable; };
 			bool IsNTCP (bool v4only = true) const;
@@ -170,6 +178,7 @@ namespace data
 			void EnableV4 ();
 			void DisableV4 ();
 			bool IsCompatible (const RouterInfo& other) const { return m_SupportedTransports & other.m_SupportedTransports; };
+			uint8_t GetSupportedTransports () const { return m_SupportedTransports; };
 			bool UsesIntroducer () const;
 			bool IsIntroducer () const { return m_Caps & eSSUIntroducer; };
 			bool IsPeerTesting () const { return m_Caps & eSSUTesting; };
@@ -178,6 +187,8 @@ namespace data
 			bool IsExtraBandwidth () const { return m_Caps & RouterInfo::eExtraBandwidth; };
 
 			uint8_t GetCaps () const { return m_Caps; };
+			char GetBandwidthCap () const { return m_BandwidthCap; }; // 'K'-'X', 0 if unknown
+			uint32_t GetVersion () const { return m_Version; }; // router.version as 0x00MMmmpp, 0 if unknown
 			void SetCaps (uint8_t caps);
 			void SetCaps (const char * caps);
 
@@ -192,11 +203,11 @@ namespace data
 			bool IsUpdated () const { return m_IsUpdated; };
 			void SetUpdated (bool updated) { m_IsUpdated = updated; };
 			bool SaveToFile (const std::string& fullPath);
+			void SetFullPath (const std::string& fullPath) { m_FullPath = fullPath; }; // file is written by someone else
 
 			std::shared_ptr<RouterProfile> GetProfile () const;
-			void SaveProfile () { if (m_Profile) m_Profile->Save (GetIdentHash ()); };
 
-			void Update (const uint8_t * buf, int len);
+			bool Update (const uint8_t * buf, int len); // false if rejected
 			void DeleteBuffer () { delete[] m_Buffer; m_Buffer = nullptr; };
 			bool IsNewer (const uint8_t * buf, size_t len) const;
 
@@ -211,17 +222,20 @@ namespace data
 
 		private:
 
+			class BufferStream; // reads m_Buffer in place
+
 			bool LoadFile ();
 			void ReadFromFile ();
-			void ReadFromStream (std::istream& s);
-			void ReadFromBuffer (bool verifySignature);
+			void ReadFromStream (BufferStream& s);
+			void ReadFromBuffer (bool verifySignature, bool readIdentity = true);
 			void WriteToStream (std::ostream& s) const;
-			size_t ReadString (char* str, size_t len, std::istream& s) const;
+			size_t ReadString (char* str, size_t len, BufferStream& s) const;
 			void WriteString (const std::string& str, std::ostream& s) const;
 			void ExtractCaps (const char * value);
 			template<typename Filter>
 			std::shared_ptr<const Address> GetAddress (Filter filter) const;
 			void UpdateCapsProperty ();
+			void ExtractVersion (const char * value);
 
 		private:
 
@@ -231,9 +245,11 @@ namespace data
 			size_t m_BufferLen;
 			uint64_t m_Timestamp;
 			boost::shared_ptr<Addresses> m_Addresses; // TODO: use std::shared_ptr and std::atomic_store for gcc >= 4.9
-			std::map<std::string, std::string> m_Properties;
+			Properties m_Properties;
 			bool m_IsUpdated, m_IsUnreachable;
 			uint8_t m_SupportedTransports, m_Caps;
+			char m_BandwidthCap;
+			uint32_t m_Version;
 			mutable std::shared_ptr<RouterProfile> m_Profile;
 	};
 }
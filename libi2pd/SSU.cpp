@@ -1,9 +1,15 @@
 #include <string.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/socket.h>
+#endif
 #include <boost/bind.hpp>
 #include "Log.h"
+#include "Config.h"
 #include "Timestamp.h"
 #include "RouterContext.h"
 #include "NetDb.hpp"
+#include "util.h"
 #include "SSU.h"
 
 namespace i2p
@@ -16,7 +22,7 @@ namespace transport
 		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr),
 		m_ReceiversThreadV6 (nullptr), m_Work (m_Service), m_WorkV6 (m_ServiceV6),
 		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
-		m_EndpointV6 (addr, port), m_Socket (m_ReceiversService, m_Endpoint),
+		m_TimeWheel (m_Service), m_TimeWheelV6 (m_ServiceV6), m_EndpointV6 (addr, port), m_Socket (m_ReceiversService, m_Endpoint),
 		m_SocketV6 (m_ReceiversServiceV6), m_IntroducersUpdateTimer (m_Service),
 		m_PeerTestsCleanupTimer (m_Service), m_TerminationTimer (m_Service),
 		m_TerminationTimerV6 (m_ServiceV6)
@@ -29,6 +35,7 @@ namespace transport
 		m_Thread (nullptr), m_ThreadV6 (nullptr), m_ReceiversThread (nullptr),
 		m_ReceiversThreadV6 (nullptr), 	m_Work (m_Service), m_WorkV6 (m_ServiceV6),
 		m_ReceiversWork (m_ReceiversService), m_ReceiversWorkV6 (m_ReceiversServiceV6),
+		m_TimeWheel (m_Service), m_TimeWheelV6 (m_ServiceV6),
 		m_Endpoint (boost::asio::ip::udp::v4 (), port), m_EndpointV6 (boost::asio::ip::udp::v6 (), port),
 		m_Socket (m_ReceiversService), m_SocketV6 (m_ReceiversServiceV6),
 		m_IntroducersUpdateTimer (m_Service), m_PeerTestsCleanupTimer (m_Service),
@@ -62,21 +69,45 @@ namespace transport
 
 	void SSUServer::Start ()
 	{
+		bool lowMemory = false; i2p::config::GetOption("lowmemory", lowMemory);
+		if (lowMemory) m_PacketsPool.SetMaxNumFree (SSU_LOW_MEMORY_MAX_NUM_FREE_PACKETS);
 		m_IsRunning = true;
+		m_TimeWheel.Start ();
+		m_TimeWheelV6.Start ();
 		if (!m_OnlyV6)
 		{
-			m_ReceiversThread = new std::thread (std::bind (&SSUServer::RunReceivers, this));
+			if (!StartRingReceivers (false))
+			{
+				m_ReceiversThread = new std::thread (std::bind (&SSUServer::RunReceivers, this));
+				m_ReceiversService.post (std::bind (&SSUServer::Receive, this));
+			}
 			m_Thread = new std::thread (std::bind (&SSUServer::Run, this));
-			m_ReceiversService.post (std::bind (&SSUServer::Receive, this));
 			ScheduleTermination ();
 		}
 		if (context.SupportsV6 ())
 		{
-			m_ReceiversThreadV6 = new std::thread (std::bind (&SSUServer::RunReceiversV6, this));
+			if (!StartRingReceivers (true))
+			{
+				m_ReceiversThreadV6 = new std::thread (std::bind (&SSUServer::RunReceiversV6, this));
+				m_ReceiversServiceV6.post (std::bind (&SSUServer::ReceiveV6, this));
+			}
 			m_ThreadV6 = new std::thread (std::bind (&SSUServer::RunV6, this));
-			m_ReceiversServiceV6.post (std::bind (&SSUServer::ReceiveV6, this));
 			ScheduleTerminationV6 ();
 		}
+		uint16_t numThreads = 1; i2p::config::GetOption("ssuthreads", numThreads);
+		if (!numThreads) numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > 1)
+		{
+			// sessions are sharded by remote endpoint, m_Service and m_ServiceV6 run server's timers
+			for (int i = 0; i < numThreads; i++)
+			{
+				m_SessionServices.emplace_back (new boost::asio::io_service ());
+				m_SessionWorks.emplace_back (new boost::asio::io_service::work (*m_SessionServices.back ()));
+				m_SessionTimeWheels.emplace_back (new i2p::util::TimeWheel (*m_SessionServices.back ()));
+				m_SessionThreads.emplace_back (new std::thread (std::bind (&SSUServer::RunSessions, this, std::ref (*m_SessionServices.back ()))));
+			}
+			LogPrint (eLogInfo, "SSU: ", numThreads, " session threads started");
+		}
 		SchedulePeerTestsCleanupTimer ();
 		ScheduleIntroducersUpdateTimer (); // wait for 30 seconds and decide if we need introducers
 	}
@@ -93,6 +124,12 @@ namespace transport
 		m_SocketV6.close ();
 		m_ReceiversService.stop ();
 		m_ReceiversServiceV6.stop ();
+#if defined(__linux__) && defined(USE_IO_URING)
+		if (m_Ring) m_Ring->Wakeup ();
+		if (m_RingV6) m_RingV6->Wakeup ();
+#endif
+		for (auto& it: m_SessionServices)
+			it->stop ();
 		if (m_ReceiversThread)
 		{
 			m_ReceiversThread->join ();
@@ -117,15 +154,28 @@ namespace transport
 			delete m_ThreadV6;
 			m_ThreadV6 = nullptr;
 		}
+		for (auto& it: m_SessionThreads)
+			it->join ();
+		m_SessionThreads.clear ();
+#if defined(__linux__) && defined(USE_IO_URING)
+		m_Ring = nullptr;
+		m_RingV6 = nullptr;
+#endif
+		m_TimeWheel.Stop ();
+		m_TimeWheelV6.Stop ();
+		m_SessionTimeWheels.clear ();
+		m_SessionWorks.clear ();
+		m_SessionServices.clear ();
 	}
 
 	void SSUServer::Run ()
 	{
+		i2p::util::InitThread ("SSU", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "SSU");
 			}
 			catch (std::exception& ex)
 			{
@@ -136,11 +186,12 @@ namespace transport
 
 	void SSUServer::RunV6 ()
 	{
+		i2p::util::InitThread ("SSUv6", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_ServiceV6.run ();
+				i2p::util::RunService (m_ServiceV6, "SSUv6");
 			}
 			catch (std::exception& ex)
 			{
@@ -151,11 +202,12 @@ namespace transport
 
 	void SSUServer::RunReceivers ()
 	{
+		i2p::util::InitThread ("SSUReceivers", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_ReceiversService.run ();
+				i2p::util::RunService (m_ReceiversService, "SSU receivers");
 			}
 			catch (std::exception& ex)
 			{
@@ -166,11 +218,12 @@ namespace transport
 
 	void SSUServer::RunReceiversV6 ()
 	{
+		i2p::util::InitThread ("SSUv6Receivers", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_ReceiversServiceV6.run ();
+				i2p::util::RunService (m_ReceiversServiceV6, "SSUv6 receivers");
 			}
 			catch (std::exception& ex)
 			{
@@ -179,18 +232,192 @@ namespace transport
 		}
 	}
 
+	bool SSUServer::StartRingReceivers (bool v6)
+	{
+#if defined(__linux__) && defined(USE_IO_URING)
+		bool enabled; i2p::config::GetOption("ssuiouring", enabled);
+		if (!enabled) return false;
+		std::unique_ptr<i2p::util::IOUring> ring (new i2p::util::IOUring ());
+		if (!ring->Init (SSU_IO_URING_NUM_ENTRIES))
+		{
+			LogPrint (eLogWarning, "SSU: io_uring is not supported: ", strerror (errno), ". Using default receivers");
+			return false;
+		}
+		if (v6)
+		{
+			m_RingV6 = std::move (ring);
+			m_ReceiversThreadV6 = new std::thread (std::bind (&SSUServer::RunRingReceivers, this,
+				std::ref (m_SocketV6), std::ref (*m_RingV6), SSU_MTU_V6, &m_SessionsV6));
+		}
+		else
+		{
+			m_Ring = std::move (ring);
+			m_ReceiversThread = new std::thread (std::bind (&SSUServer::RunRingReceivers, this,
+				std::ref (m_Socket), std::ref (*m_Ring), SSU_MTU_V4, &m_Sessions));
+		}
+		LogPrint (eLogInfo, "SSU: ", v6 ? "v6 " : "", "receivers use io_uring");
+		return true;
+#else
+		return false;
+#endif
+	}
+
+#if defined(__linux__) && defined(USE_IO_URING)
+	void SSUServer::RunRingReceivers (boost::asio::ip::udp::socket& socket, i2p::util::IOUring& ring, size_t mtu,
+		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions)
+	{
+		i2p::util::InitThread ("SSUReceivers", i2p::util::eThreadGroupTransports);
+		// recvmsg requests are kept in flight, one io_uring_enter submits new ones and waits for completions
+		const uint64_t wakeupTag = SSU_MAX_NUM_RECEIVED_PACKETS, cancelTag = SSU_MAX_NUM_RECEIVED_PACKETS + 1;
+		struct Slot
+		{
+			SSUPacket * packet;
+			struct msghdr msg;
+			struct iovec iov;
+		};
+		Slot slots[SSU_MAX_NUM_RECEIVED_PACKETS];
+		for (auto& it: slots) it.packet = nullptr;
+		size_t numPending = 0;
+		auto receive = [&](size_t i)->bool
+			{
+				auto sqe = ring.GetSQE ();
+				if (!sqe) return false;
+				auto& slot = slots[i];
+				slot.packet = m_PacketsPool.AcquireMt ();
+				slot.iov.iov_base = slot.packet->buf;
+				slot.iov.iov_len = mtu;
+				memset (&slot.msg, 0, sizeof (slot.msg));
+				slot.msg.msg_iov = &slot.iov;
+				slot.msg.msg_iovlen = 1;
+				slot.msg.msg_name = slot.packet->from.data ();
+				slot.msg.msg_namelen = slot.packet->from.capacity ();
+				sqe->opcode = IORING_OP_RECVMSG;
+				sqe->fd = socket.native_handle ();
+				sqe->addr = (uint64_t)&slot.msg;
+				sqe->len = 1;
+				sqe->user_data = i;
+				numPending++;
+				return true;
+			};
+		for (size_t i = 0; i < SSU_MAX_NUM_RECEIVED_PACKETS; i++)
+			receive (i);
+		ring.PrepareWakeup (wakeupTag);
+		std::vector<SSUPacket *> packets;
+		packets.reserve (SSU_MAX_NUM_RECEIVED_PACKETS);
+		while (m_IsRunning)
+		{
+			int ret = ring.Submit (1);
+			if (ret < 0)
+			{
+				LogPrint (eLogError, "SSU: io_uring_enter error: ", strerror (-ret));
+				break;
+			}
+			ring.ReapCompletions ([&](uint64_t userData, int res)
+				{
+					if (userData >= SSU_MAX_NUM_RECEIVED_PACKETS) return; // wakeup
+					auto& slot = slots[userData];
+					numPending--;
+					if (res > 0)
+					{
+						slot.packet->len = res;
+						slot.packet->from.resize (slot.msg.msg_namelen);
+						packets.push_back (slot.packet);
+					}
+					else
+					{
+						if (res < 0 && res != -ECANCELED)
+							LogPrint (eLogError, "SSU: io_uring receive error: ", strerror (-res));
+						m_PacketsPool.ReleaseMt (slot.packet);
+					}
+					slot.packet = nullptr;
+					if (m_IsRunning) receive (userData);
+				});
+			if (!packets.empty ())
+			{
+				PostReceivedPackets (packets, sessions);
+				packets.clear ();
+			}
+		}
+		// cancel requests in flight before their buffers are returned to the pool
+		for (size_t i = 0; i < SSU_MAX_NUM_RECEIVED_PACKETS; i++)
+		{
+			if (!slots[i].packet) continue;
+			auto sqe = ring.GetSQE ();
+			if (!sqe) break;
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = i;
+			sqe->user_data = cancelTag;
+		}
+		while (numPending > 0 && ring.Submit (1) >= 0)
+			ring.ReapCompletions ([&](uint64_t userData, int res)
+				{
+					if (userData >= SSU_MAX_NUM_RECEIVED_PACKETS) return;
+					numPending--;
+					m_PacketsPool.ReleaseMt (slots[userData].packet);
+					slots[userData].packet = nullptr;
+				});
+	}
+#endif
+
+	void SSUServer::RunSessions (boost::asio::io_service& service)
+	{
+		i2p::util::InitThread ("SSUSessions", i2p::util::eThreadGroupTransports);
+		while (m_IsRunning)
+		{
+			try
+			{
+				i2p::util::RunService (service, "SSU sessions");
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "SSU: session runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	boost::asio::io_service& SSUServer::GetSessionService (const boost::asio::ip::udp::endpoint& ep)
+	{
+		if (m_SessionServices.empty ())
+			return ep.address ().is_v6 () ? m_ServiceV6 : m_Service;
+		return *m_SessionServices[GetSessionServiceIndex (ep)];
+	}
+
+	i2p::util::TimeWheel& SSUServer::GetSessionTimeWheel (const boost::asio::ip::udp::endpoint& ep)
+	{
+		if (m_SessionTimeWheels.empty ())
+			return ep.address ().is_v6 () ? m_TimeWheelV6 : m_TimeWheel;
+		return *m_SessionTimeWheels[GetSessionServiceIndex (ep)];
+	}
+
+	size_t SSUServer::GetSessionServiceIndex (const boost::asio::ip::udp::endpoint& ep) const
+	{
+		uint64_t h = ep.port ();
+		if (ep.address ().is_v6 ())
+		{
+			auto bytes = ep.address ().to_v6 ().to_bytes ();
+			for (auto b: bytes) h = h*31 + b;
+		}
+		else
+			h = h*31 + ep.address ().to_v4 ().to_ulong ();
+		h ^= h >> 17; h *= 0x9E3779B97F4A7C15ULL; h ^= h >> 29; // mix
+		return h % m_SessionServices.size ();
+	}
+
 	void SSUServer::AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		m_Relays[tag] = relay;
 	}
 
 	void SSUServer::RemoveRelay (uint32_t tag)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		m_Relays.erase (tag);
 	}
 
 	std::shared_ptr<SSUSession> SSUServer::FindRelaySession (uint32_t tag)
 	{
+		std::unique_lock<std::mutex> l(m_RelaysMutex);
 		auto it = m_Relays.find (tag);
 		if (it != m_Relays.end ())
 		{
@@ -210,57 +437,141 @@ namespace transport
 			m_SocketV6.send_to (boost::asio::buffer (buf, len), to);
 	}
 
+	void SSUServer::Send (const std::vector<std::pair<const uint8_t *, size_t> >& bufs, const boost::asio::ip::udp::endpoint& to)
+	{
+		auto& socket = (to.protocol () == boost::asio::ip::udp::v4()) ? m_Socket : m_SocketV6;
+#ifdef __linux__
+		const size_t maxNumMsgs = 64;
+		struct mmsghdr msgs[maxNumMsgs];
+		struct iovec iovs[maxNumMsgs];
+		size_t offset = 0;
+		while (offset < bufs.size ())
+		{
+			size_t num = bufs.size () - offset;
+			if (num > maxNumMsgs) num = maxNumMsgs;
+			memset (msgs, 0, num*sizeof (struct mmsghdr));
+			for (size_t i = 0; i < num; i++)
+			{
+				iovs[i].iov_base = const_cast<uint8_t *>(bufs[offset + i].first);
+				iovs[i].iov_len = bufs[offset + i].second;
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = const_cast<boost::asio::ip::udp::endpoint::data_type *>(to.data ());
+				msgs[i].msg_hdr.msg_namelen = to.size ();
+			}
+			int sent = sendmmsg (socket.native_handle (), msgs, num, 0);
+			if (sent <= 0)
+			{
+				// first one failed, send it alone and try the rest again
+				boost::system::error_code ec;
+				socket.send_to (boost::asio::buffer (bufs[offset].first, bufs[offset].second), to, 0, ec);
+				if (ec)
+					LogPrint (eLogError, "SSU: send to ", to, " error: ", ec.message ());
+				sent = 1;
+			}
+			offset += sent;
+		}
+#else
+		for (const auto& it: bufs)
+		{
+			boost::system::error_code ec;
+			socket.send_to (boost::asio::buffer (it.first, it.second), to, 0, ec);
+			if (ec)
+				LogPrint (eLogError, "SSU: send to ", to, " error: ", ec.message ());
+		}
+#endif
+	}
+
 	void SSUServer::Receive ()
 	{
-		SSUPacket * packet = new SSUPacket ();
+		SSUPacket * packet = m_PacketsPool.AcquireMt ();
 		m_Socket.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from,
 			std::bind (&SSUServer::HandleReceivedFrom, this, std::placeholders::_1, std::placeholders::_2, packet));
 	}
 
 	void SSUServer::ReceiveV6 ()
 	{
-		SSUPacket * packet = new SSUPacket ();
+		SSUPacket * packet = m_PacketsPool.AcquireMt ();
 		m_SocketV6.async_receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from,
 			std::bind (&SSUServer::HandleReceivedFromV6, this, std::placeholders::_1, std::placeholders::_2, packet));
 	}
 
+	void SSUServer::ReceiveMore (boost::asio::ip::udp::socket& socket, size_t mtu, std::vector<SSUPacket *>& packets)
+	{
+#ifdef __linux__
+		// pick up everything available with one syscall
+		size_t num = SSU_MAX_NUM_RECEIVED_PACKETS - packets.size ();
+		SSUPacket * batch[SSU_MAX_NUM_RECEIVED_PACKETS];
+		struct mmsghdr msgs[SSU_MAX_NUM_RECEIVED_PACKETS];
+		struct iovec iovs[SSU_MAX_NUM_RECEIVED_PACKETS];
+		memset (msgs, 0, num*sizeof (struct mmsghdr));
+		for (size_t i = 0; i < num; i++)
+		{
+			batch[i] = m_PacketsPool.AcquireMt ();
+			iovs[i].iov_base = batch[i]->buf;
+			iovs[i].iov_len = mtu;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = batch[i]->from.data ();
+			msgs[i].msg_hdr.msg_namelen = batch[i]->from.capacity ();
+		}
+		int received = recvmmsg (socket.native_handle (), msgs, num, MSG_DONTWAIT, nullptr);
+		if (received < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LogPrint (eLogError, "SSU: recvmmsg error: ", strerror (errno));
+			received = 0;
+		}
+		for (size_t i = 0; i < (size_t)received; i++)
+		{
+			batch[i]->len = msgs[i].msg_len;
+			batch[i]->from.resize (msgs[i].msg_hdr.msg_namelen);
+			packets.push_back (batch[i]);
+		}
+		for (size_t i = received; i < num; i++)
+			m_PacketsPool.ReleaseMt (batch[i]);
+#else
+		boost::system::error_code ec;
+		size_t moreBytes = socket.available (ec);
+		if (!ec)
+		{
+			while (moreBytes && packets.size () < SSU_MAX_NUM_RECEIVED_PACKETS)
+			{
+				SSUPacket * packet = m_PacketsPool.AcquireMt ();
+				packet->len = socket.receive_from (boost::asio::buffer (packet->buf, mtu), packet->from, 0, ec);
+				if (!ec)
+				{
+					packets.push_back (packet);
+					moreBytes = socket.available (ec);
+					if (ec) break;
+				}
+				else
+				{
+					LogPrint (eLogError, "SSU: receive_from error: ", ec.message ());
+					m_PacketsPool.ReleaseMt (packet);
+					break;
+				}
+			}
+		}
+#endif
+	}
+
 	void SSUServer::HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet)
 	{
 		if (!ecode)
 		{
 			packet->len = bytes_transferred;
 			std::vector<SSUPacket *> packets;
+			packets.reserve (SSU_MAX_NUM_RECEIVED_PACKETS);
 			packets.push_back (packet);
+			ReceiveMore (m_Socket, SSU_MTU_V4, packets);
 
-			boost::system::error_code ec;
-			size_t moreBytes = m_Socket.available(ec);
-			if (!ec)
-			{
-				while (moreBytes && packets.size () < 25)
-				{
-					packet = new SSUPacket ();
-					packet->len = m_Socket.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V4), packet->from, 0, ec);
-					if (!ec)
-					{
-						packets.push_back (packet);
-						moreBytes = m_Socket.available(ec);
-						if (ec) break;
-					}
-					else
-					{
-						LogPrint (eLogError, "SSU: receive_from error: ", ec.message ());
-						delete packet;
-						break;
-					}
-				}
-			}
-
-			m_Service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_Sessions));
+			PostReceivedPackets (packets, &m_Sessions);
 			Receive ();
 		}
 		else
 		{
-			delete packet;
+			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
 				LogPrint (eLogError, "SSU: receive error: ", ecode.message ());
@@ -277,37 +588,16 @@ namespace transport
 		{
 			packet->len = bytes_transferred;
 			std::vector<SSUPacket *> packets;
+			packets.reserve (SSU_MAX_NUM_RECEIVED_PACKETS);
 			packets.push_back (packet);
+			ReceiveMore (m_SocketV6, SSU_MTU_V6, packets);
 
-			boost::system::error_code ec;
-			size_t moreBytes = m_SocketV6.available (ec);
-			if (!ec)
-			{
-				while (moreBytes && packets.size () < 25)
-				{
-					packet = new SSUPacket ();
-					packet->len = m_SocketV6.receive_from (boost::asio::buffer (packet->buf, SSU_MTU_V6), packet->from, 0, ec);
-					if (!ec)
-					{
-						packets.push_back (packet);
-						moreBytes = m_SocketV6.available(ec);
-						if (ec) break;
-					}
-					else
-					{
-						LogPrint (eLogError, "SSU: v6 receive_from error: ", ec.message ());
-						delete packet;
-						break;
-					}
-				}
-			}
-
-			m_ServiceV6.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, &m_SessionsV6));
+			PostReceivedPackets (packets, &m_SessionsV6);
 			ReceiveV6 ();
 		}
 		else
 		{
-			delete packet;
+			m_PacketsPool.ReleaseMt (packet);
 			if (ecode != boost::asio::error::operation_aborted)
 			{
 				LogPrint (eLogError, "SSU: v6 receive error: ", ecode.message ());
@@ -318,9 +608,27 @@ namespace transport
 		}
 	}
 
+	void SSUServer::PostReceivedPackets (const std::vector<SSUPacket *>& packets,
+		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > * sessions)
+	{
+		if (m_SessionServices.empty ())
+		{
+			auto& service = (sessions == &m_SessionsV6) ? m_ServiceV6 : m_Service;
+			service.post (std::bind (&SSUServer::HandleReceivedPackets, this, packets, sessions));
+			return;
+		}
+		// split by session's thread, order of packets within a session is preserved
+		std::map<boost::asio::io_service *, std::vector<SSUPacket *> > shards;
+		for (auto& it: packets)
+			shards[&GetSessionService (it->from)].push_back (it);
+		for (auto& it: shards)
+			it.first->post (std::bind (&SSUServer::HandleReceivedPackets, this, it.second, sessions));
+	}
+
 	void SSUServer::HandleReceivedPackets (std::vector<SSUPacket *> packets,
 		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > * sessions)
 	{
+		ValidatePackets (packets, sessions);
 		std::shared_ptr<SSUSession> session;
 		for (auto& packet: packets)
 		{
@@ -329,18 +637,27 @@ namespace transport
 				if (!session || session->GetRemoteEndpoint () != packet->from) // we received packet for other session than previous
 				{
 					if (session) session->FlushData ();
-					auto it = sessions->find (packet->from);
-					if (it != sessions->end ())
-						session = it->second;
-					if (!session)
+					session = nullptr;
+					bool isNew = false;
+					{
+						i2p::metrics::ProfiledLock l(m_SessionsMutex);
+						auto it = sessions->find (packet->from);
+						if (it != sessions->end ())
+							session = it->second;
+						if (!session)
+						{
+							session = std::make_shared<SSUSession> (*this, packet->from);
+							(*sessions)[packet->from] = session;
+							isNew = true;
+						}
+					}
+					if (isNew)
 					{
-						session = std::make_shared<SSUSession> (*this, packet->from);
 						session->WaitForConnect ();
-						(*sessions)[packet->from] = session;
 						LogPrint (eLogDebug, "SSU: new session from ", packet->from.address ().to_string (), ":", packet->from.port (), " created");
 					}
 				}
-				session->ProcessNextMessage (packet->buf, packet->len, packet->from);
+				session->ProcessNextMessage (packet->buf, packet->len, packet->from, packet->isValidated ? &packet->macKey : nullptr);
 			}
 			catch (std::exception& ex)
 			{
@@ -348,11 +665,52 @@ namespace transport
 				if (session) session->FlushData ();
 				session = nullptr;
 			}
-			delete packet;
 		}
+		m_PacketsPool.ReleaseMt (packets);
 		if (session) session->FlushData ();
 	}
 
+	void SSUServer::ValidatePackets (const std::vector<SSUPacket *>& packets,
+		std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > * sessions)
+	{
+		for (auto& packet: packets) packet->isValidated = false;
+		if (packets.size () < i2p::crypto::HMAC_MD5_MIN_NUM_LANES) return;
+		// packets of established sessions with AES and HMAC-MD5 keys, other keys are tried by session
+		std::vector<SSUPacket *> batch;
+		batch.reserve (packets.size ());
+		{
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
+			for (auto& packet: packets)
+			{
+				if (packet->len < sizeof (SSUHeader)) continue;
+				auto it = sessions->find (packet->from);
+				if (it == sessions->end ()) continue;
+				auto macKey = it->second->GetDataMACKey ();
+				if (macKey)
+				{
+					packet->macKey = *macKey;
+					batch.push_back (packet);
+				}
+			}
+		}
+		size_t num = batch.size ();
+		if (num < i2p::crypto::HMAC_MD5_MIN_NUM_LANES) return;
+		std::vector<uint8_t *> msgs (num), digests (num);
+		std::vector<size_t> lens (num);
+		std::vector<const i2p::crypto::MACKey *> keys (num);
+		std::vector<uint8_t> buf (num*16);
+		for (size_t i = 0; i < num; i++)
+		{
+			msgs[i] = &((SSUHeader *)(uint8_t *)batch[i]->buf)->flag;
+			lens[i] = SSUSession::PrepareMACData (batch[i]->buf, batch[i]->len);
+			keys[i] = &batch[i]->macKey;
+			digests[i] = buf.data () + i*16;
+		}
+		i2p::crypto::HMACMD5DigestMulti (num, msgs.data (), lens.data (), keys.data (), digests.data ());
+		for (size_t i = 0; i < num; i++)
+			batch[i]->isValidated = !memcmp (((SSUHeader *)(uint8_t *)batch[i]->buf)->mac, digests[i], 16);
+	}
+
 	std::shared_ptr<SSUSession> SSUServer::FindSession (std::shared_ptr<const i2p::data::RouterInfo> router) const
 	{
 		if (!router) return nullptr;
@@ -369,6 +727,7 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::FindSession (const boost::asio::ip::udp::endpoint& e) const
 	{
+		i2p::metrics::ProfiledLock l(m_SessionsMutex);
 		auto& sessions = e.address ().is_v6 () ?  m_SessionsV6 : m_Sessions;
 		auto it = sessions.find (e);
 		if (it != sessions.end ())
@@ -396,27 +755,37 @@ namespace transport
 			else
 			{
 				boost::asio::ip::udp::endpoint remoteEndpoint (addr, port);
-				auto& s = addr.is_v6 () ? m_ServiceV6 : m_Service;
-				s.post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
+				GetSessionService (remoteEndpoint).post (std::bind (&SSUServer::CreateDirectSession, this, router, remoteEndpoint, peerTest));
 			}
 		}
 	}
 
 	void SSUServer::CreateDirectSession (std::shared_ptr<const i2p::data::RouterInfo> router, boost::asio::ip::udp::endpoint remoteEndpoint, bool peerTest)
 	{
+		// called from session's thread
 		auto& sessions = remoteEndpoint.address ().is_v6 () ? m_SessionsV6 : m_Sessions;
-		auto it = sessions.find (remoteEndpoint);
-		if (it != sessions.end ())
+		std::shared_ptr<SSUSession> session;
+		bool isNew = false;
+		{
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
+			auto it = sessions.find (remoteEndpoint);
+			if (it != sessions.end ())
+				session = it->second;
+			else
+			{
+				// otherwise create new session
+				session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
+				sessions[remoteEndpoint] = session;
+				isNew = true;
+			}
+		}
+		if (!isNew)
 		{
-			auto session = it->second;
 			if (peerTest && session->GetState () == eSessionStateEstablished)
 				session->SendPeerTest ();
 		}
 		else
 		{
-			// otherwise create new session
-			auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-			sessions[remoteEndpoint] = session;
 			// connect
 			LogPrint (eLogDebug, "SSU: Creating new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()), "] ",
 				remoteEndpoint.address ().to_string (), ":", remoteEndpoint.port ());
@@ -432,13 +801,12 @@ namespace transport
 			if (address)
 			{
 				boost::asio::ip::udp::endpoint remoteEndpoint (address->host, address->port);
-				auto it = m_Sessions.find (remoteEndpoint);
 				// check if session is presented already
-				if (it != m_Sessions.end ())
+				auto session = FindSession (remoteEndpoint);
+				if (session)
 				{
-					auto session = it->second;
 					if (peerTest && session->GetState () == eSessionStateEstablished)
-						session->SendPeerTest ();
+						session->GetService ().post ([session]{ session->SendPeerTest (); });
 					return;
 				}
 				// create new session
@@ -457,12 +825,8 @@ namespace transport
 						if (ep.address ().is_v4 ()) // ipv4 only
 						{
 							if (!introducer) introducer = intr; // we pick first one for now
-							it = m_Sessions.find (ep);
-							if (it != m_Sessions.end ())
-							{
-								introducerSession = it->second;
-								break;
-							}
+							introducerSession = FindSession (ep);
+							if (introducerSession) break;
 						}
 					}
 					if (!introducer)
@@ -478,6 +842,7 @@ namespace transport
 						LogPrint (eLogDebug, "SSU: Creating new session to introducer ", introducer->iHost);
 						boost::asio::ip::udp::endpoint introducerEndpoint (introducer->iHost, introducer->iPort);
 						introducerSession = std::make_shared<SSUSession> (*this, introducerEndpoint, router);
+						i2p::metrics::ProfiledLock l(m_SessionsMutex);
 						m_Sessions[introducerEndpoint] = introducerSession;
 					}
 #if BOOST_VERSION >= 104900
@@ -485,20 +850,22 @@ namespace transport
 #endif
 					{
 						// create session
-						auto session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
-						m_Sessions[remoteEndpoint] = session;
-
+						session = std::make_shared<SSUSession> (*this, remoteEndpoint, router, peerTest);
 						// introduce
 						LogPrint (eLogInfo, "SSU: Introduce new session to [", i2p::data::GetIdentHashAbbreviation (router->GetIdentHash ()),
 								"] through introducer ", introducer->iHost, ":", introducer->iPort);
-						session->WaitForIntroduction ();
+						session->WaitForIntroduction (); // before it becomes visible to other threads
+						{
+							i2p::metrics::ProfiledLock l(m_SessionsMutex);
+							m_Sessions[remoteEndpoint] = session;
+						}
 						if (i2p::context.GetRouterInfo ().UsesIntroducer ()) // if we are unreachable
 						{
 							uint8_t buf[1];
 							Send (buf, 0, remoteEndpoint); // send HolePunch
 						}
 					}
-					introducerSession->Introduce (*introducer, router);
+					introducerSession->GetService ().post (std::bind (&SSUSession::Introduce, introducerSession, *introducer, router));
 				}
 				else
 					LogPrint (eLogWarning, "SSU: Can't connect to unreachable router and no introducers present");
@@ -514,6 +881,7 @@ namespace transport
 		{
 			session->Close ();
 			auto& ep = session->GetRemoteEndpoint ();
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
 			if (ep.address ().is_v6 ())
 				m_SessionsV6.erase (ep);
 			else
@@ -523,24 +891,30 @@ namespace transport
 
 	void SSUServer::DeleteAllSessions ()
 	{
-		for (auto& it: m_Sessions)
+		decltype(m_Sessions) sessions, sessionsV6;
+		{
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
+			m_Sessions.swap (sessions);
+			m_SessionsV6.swap (sessionsV6);
+		}
+		for (auto& it: sessions)
 			it.second->Close ();
-		m_Sessions.clear ();
-
-		for (auto& it: m_SessionsV6)
+		for (auto& it: sessionsV6)
 			it.second->Close ();
-		m_SessionsV6.clear ();
 	}
 
 	template<typename Filter>
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV4Session (Filter filter) // v4 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_Sessions)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
+		{
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
+			for (const auto& s :m_Sessions)
+				if (filter (s.second)) filteredSessions.push_back (s.second);
+		}
 		if (filteredSessions.size () > 0)
 		{
-			auto ind = rand () % filteredSessions.size ();
+			auto ind = i2p::crypto::RandUint32 () % filteredSessions.size ();
 			return filteredSessions[ind];
 		}
 		return nullptr;
@@ -560,11 +934,14 @@ namespace transport
 	std::shared_ptr<SSUSession> SSUServer::GetRandomV6Session (Filter filter) // v6 only
 	{
 		std::vector<std::shared_ptr<SSUSession> > filteredSessions;
-		for (const auto& s :m_SessionsV6)
-			if (filter (s.second)) filteredSessions.push_back (s.second);
+		{
+			i2p::metrics::ProfiledLock l(m_SessionsMutex);
+			for (const auto& s :m_SessionsV6)
+				if (filter (s.second)) filteredSessions.push_back (s.second);
+		}
 		if (filteredSessions.size () > 0)
 		{
-			auto ind = rand () % filteredSessions.size ();
+			auto ind = i2p::crypto::RandUint32 () % filteredSessions.size ();
 			return filteredSessions[ind];
 		}
 		return nullptr;
@@ -632,7 +1009,7 @@ namespace transport
 				auto session = FindSession (it);
 				if (session && ts < session->GetCreationTime () + SSU_TO_INTRODUCER_SESSION_DURATION)
 				{
-					session->SendKeepAlive ();
+					session->GetService ().post (std::bind (&SSUSession::SendKeepAlive, session));
 					newList.push_back (it);
 					numIntroducers++;
 				}
@@ -672,11 +1049,13 @@ namespace transport
 
 	void SSUServer::NewPeerTest (uint32_t nonce, PeerTestParticipant role, std::shared_ptr<SSUSession> session)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests[nonce] = { i2p::util::GetMillisecondsSinceEpoch (), role, session };
 	}
 
 	PeerTestParticipant SSUServer::GetPeerTestParticipant (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.role;
@@ -686,6 +1065,7 @@ namespace transport
 
 	std::shared_ptr<SSUSession> SSUServer::GetPeerTestSession (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			return it->second.session;
@@ -695,6 +1075,7 @@ namespace transport
 
 	void SSUServer::UpdatePeerTest (uint32_t nonce, PeerTestParticipant role)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		auto it = m_PeerTests.find (nonce);
 		if (it != m_PeerTests.end ())
 			it->second.role = role;
@@ -702,6 +1083,7 @@ namespace transport
 
 	void SSUServer::RemovePeerTest (uint32_t nonce)
 	{
+		std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 		m_PeerTests.erase (nonce);
 	}
 
@@ -718,6 +1100,7 @@ namespace transport
 		{
 			int numDeleted = 0;
 			uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
+			std::unique_lock<std::mutex> l(m_PeerTestsMutex);
 			for (auto it = m_PeerTests.begin (); it != m_PeerTests.end ();)
 			{
 				if (ts > it->second.creationTime + SSU_PEER_TEST_TIMEOUT*1000LL)
@@ -746,16 +1129,19 @@ namespace transport
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_Sessions)
-				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					m_Service.post ([session]
-						{
-							LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
-							session->Failed ();
-						});
-				}
+			std::vector<std::shared_ptr<SSUSession> > expired;
+			{
+				i2p::metrics::ProfiledLock l(m_SessionsMutex);
+				for (auto& it: m_Sessions)
+					if (it.second->IsTerminationTimeoutExpired (ts))
+						expired.push_back (it.second);
+			}
+			for (auto& session: expired)
+				session->GetService ().post ([session]
+					{
+						LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
+						session->Failed ();
+					});
 			ScheduleTermination ();
 		}
 	}
@@ -772,16 +1158,19 @@ namespace transport
 		if (ecode != boost::asio::error::operation_aborted)
 		{
 			auto ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto& it: m_SessionsV6)
-				if (it.second->IsTerminationTimeoutExpired (ts))
-				{
-					auto session = it.second;
-					m_ServiceV6.post ([session]
-						{
-							LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
-							session->Failed ();
-						});
-				}
+			std::vector<std::shared_ptr<SSUSession> > expired;
+			{
+				i2p::metrics::ProfiledLock l(m_SessionsMutex);
+				for (auto& it: m_SessionsV6)
+					if (it.second->IsTerminationTimeoutExpired (ts))
+						expired.push_back (it.second);
+			}
+			for (auto& session: expired)
+				session->GetService ().post ([session]
+					{
+						LogPrint (eLogWarning, "SSU: no activity with ", session->GetRemoteEndpoint (), " for ", session->GetTerminationTimeout (), " seconds");
+						session->Failed ();
+					});
 			ScheduleTerminationV6 ();
 		}
 	}
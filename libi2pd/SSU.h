@@ -6,15 +6,21 @@
 #include <map>
 #include <list>
 #include <set>
+#include <vector>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <boost/asio.hpp>
 #include "Crypto.h"
+#include "util.h"
 #include "I2PEndian.h"
 #include "Identity.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "SSUSession.h"
+#include "Metrics.h"
+#include "TimeWheel.h"
+#include "IOUring.h"
 
 namespace i2p
 {
@@ -27,12 +33,17 @@ namespace transport
 	const size_t SSU_MAX_NUM_INTRODUCERS = 3;
 	const size_t SSU_SOCKET_RECEIVE_BUFFER_SIZE = 0x1FFFF; // 128K
 	const size_t SSU_SOCKET_SEND_BUFFER_SIZE = 0x1FFFF; // 128K
+	const size_t SSU_MAX_NUM_RECEIVED_PACKETS = 64; // per one batch
+	const size_t SSU_LOW_MEMORY_MAX_NUM_FREE_PACKETS = 128; // default is 1024
+	const unsigned SSU_IO_URING_NUM_ENTRIES = 256; // must be power of 2
 
 	struct SSUPacket
 	{
 		i2p::crypto::AESAlignedBuffer<SSU_MTU_V6 + 18> buf; // max MTU + iv + size
 		boost::asio::ip::udp::endpoint from;
 		size_t len;
+		bool isValidated; // MAC verified with macKey in a batch
+		i2p::crypto::MACKey macKey;
 	};
 
 	class SSUServer
@@ -57,8 +68,11 @@ namespace transport
 
 			boost::asio::io_service& GetService () { return m_Service; };
 			boost::asio::io_service& GetServiceV6 () { return m_ServiceV6; };
+			boost::asio::io_service& GetSessionService (const boost::asio::ip::udp::endpoint& ep); // by endpoint hash
+			i2p::util::TimeWheel& GetSessionTimeWheel (const boost::asio::ip::udp::endpoint& ep); // of session's service
 			const boost::asio::ip::udp::endpoint& GetEndpoint () const { return m_Endpoint; };
 			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& to);
+			void Send (const std::vector<std::pair<const uint8_t *, size_t> >& bufs, const boost::asio::ip::udp::endpoint& to); // as few syscalls as possible
 			void AddRelay (uint32_t tag, std::shared_ptr<SSUSession> relay);
 			void RemoveRelay (uint32_t tag);
 			std::shared_ptr<SSUSession> FindRelaySession (uint32_t tag);
@@ -77,13 +91,25 @@ namespace transport
 			void RunV6 ();
 			void RunReceivers ();
 			void RunReceiversV6 ();
+			bool StartRingReceivers (bool v6); // false if io_uring is disabled or not supported
+#if defined(__linux__) && defined(USE_IO_URING)
+			void RunRingReceivers (boost::asio::ip::udp::socket& socket, i2p::util::IOUring& ring, size_t mtu,
+				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions);
+#endif
+			void RunSessions (boost::asio::io_service& service);
 			void Receive ();
 			void ReceiveV6 ();
+			void ReceiveMore (boost::asio::ip::udp::socket& socket, size_t mtu, std::vector<SSUPacket *>& packets); // without blocking
 			void HandleReceivedFrom (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
 			void HandleReceivedFromV6 (const boost::system::error_code& ecode, std::size_t bytes_transferred, SSUPacket * packet);
+			void PostReceivedPackets (const std::vector<SSUPacket *>& packets,
+				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions); // to sessions' threads
 			void HandleReceivedPackets (std::vector<SSUPacket *> packets,
 				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions);
+			void ValidatePackets (const std::vector<SSUPacket *>& packets,
+				std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> >* sessions); // HMAC-MD5 of data packets at once
 
+			size_t GetSessionServiceIndex (const boost::asio::ip::udp::endpoint& ep) const;
 			void CreateSessionThroughIntroducer (std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest = false);
 			template<typename Filter>
 			std::shared_ptr<SSUSession> GetRandomV4Session (Filter filter);
@@ -117,18 +143,31 @@ namespace transport
 			std::thread * m_Thread, * m_ThreadV6, * m_ReceiversThread, * m_ReceiversThreadV6;
 			boost::asio::io_service m_Service, m_ServiceV6, m_ReceiversService, m_ReceiversServiceV6;
 			boost::asio::io_service::work m_Work, m_WorkV6, m_ReceiversWork, m_ReceiversWorkV6;
+			i2p::util::TimeWheel m_TimeWheel, m_TimeWheelV6; // sessions' timers
+			std::vector<std::unique_ptr<boost::asio::io_service> > m_SessionServices; // empty if sessions run on m_Service and m_ServiceV6
+			std::vector<std::unique_ptr<boost::asio::io_service::work> > m_SessionWorks;
+			std::vector<std::unique_ptr<i2p::util::TimeWheel> > m_SessionTimeWheels; // one per session service
+			std::vector<std::unique_ptr<std::thread> > m_SessionThreads;
 			boost::asio::ip::udp::endpoint m_Endpoint, m_EndpointV6;
 			boost::asio::ip::udp::socket m_Socket, m_SocketV6;
 			boost::asio::deadline_timer m_IntroducersUpdateTimer, m_PeerTestsCleanupTimer,
 				m_TerminationTimer, m_TerminationTimerV6;
 			std::list<boost::asio::ip::udp::endpoint> m_Introducers; // introducers we are connected to
+			mutable i2p::metrics::ProfiledMutex m_SessionsMutex { "ssu.sessions" };
 			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<SSUSession> > m_Sessions, m_SessionsV6;
+			std::mutex m_RelaysMutex;
 			std::map<uint32_t, std::shared_ptr<SSUSession> > m_Relays; // we are introducer
+			std::mutex m_PeerTestsMutex;
 			std::map<uint32_t, PeerTest> m_PeerTests; // nonce -> creation time in milliseconds
+			i2p::util::MemoryPoolMt<SSUPacket> m_PacketsPool; // acquired by receivers, released by processing threads
+#if defined(__linux__) && defined(USE_IO_URING)
+			std::unique_ptr<i2p::util::IOUring> m_Ring, m_RingV6; // receivers use io_uring instead of m_ReceiversService if set
+#endif
 
 		public:
 			// for HTTP only
 			const decltype(m_Sessions)& GetSessions () const { return m_Sessions; };
+			const i2p::util::MemoryPoolMt<SSUPacket>& GetPacketsPool () const { return m_PacketsPool; };
 			const decltype(m_SessionsV6)& GetSessionsV6 () const { return m_SessionsV6; };
 	};
 }
@@ -5,6 +5,7 @@
 #include "NetDb.hpp"
 #include "SSU.h"
 #include "SSUData.h"
+#include "Metrics.h"
 #ifdef WITH_EVENTS
 #include "Event.h"
 #endif
@@ -24,14 +25,47 @@ namespace transport
 		}
 		if (msg->Concat (fragment, fragmentSize) < fragmentSize)
 			LogPrint (eLogError, "SSU: I2NP buffer overflow ", msg->maxLen);
+		SetFragmentReceived (nextFragmentNum);
 		nextFragmentNum++;
 	}
 
+	bool ReceivedMessagesWindow::Contains (uint32_t msgID) const
+	{
+		if (!m_Filter[GetFilterIndex (msgID)]) return false; // most likely
+		for (size_t i = 0; i < m_Size; i++)
+			if (m_MsgIDs[i] == msgID) return true;
+		return false;
+	}
+
+	void ReceivedMessagesWindow::Insert (uint32_t msgID)
+	{
+		if (m_Size == MAX_NUM_RECEIVED_MESSAGES)
+		{
+			// evict oldest
+			auto& counter = m_Filter[GetFilterIndex (m_MsgIDs[m_Next])];
+			if (counter < 255) counter--; // saturated counter stays until Clear
+		}
+		else
+			m_Size++;
+		m_MsgIDs[m_Next] = msgID;
+		m_Next = (m_Next + 1) % MAX_NUM_RECEIVED_MESSAGES;
+		auto& counter = m_Filter[GetFilterIndex (msgID)];
+		if (counter < 255) counter++;
+	}
+
+	void ReceivedMessagesWindow::Clear ()
+	{
+		m_Size = 0; m_Next = 0;
+		memset (m_Filter, 0, sizeof (m_Filter));
+	}
+
 	SSUData::SSUData (SSUSession& session):
 		m_Session (session), m_ResendTimer (session.GetService ()),
-		m_IncompleteMessagesCleanupTimer (session.GetService ()),
+		m_IncompleteMessagesCleanupTimer (0),
 		m_MaxPacketSize (session.IsV6 () ? SSU_V6_MAX_PACKET_SIZE : SSU_V4_MAX_PACKET_SIZE),
-		m_PacketSize (m_MaxPacketSize), m_LastMessageReceivedTime (0)
+		m_PacketSize (m_MaxPacketSize), m_WindowSize (SSU_INITIAL_WINDOW_SIZE),
+		m_SlowStartThreshold (SSU_MAX_WINDOW_SIZE), m_RTT (0), m_RTTVar (0), m_RTO (SSU_INITIAL_RTO),
+		m_LastWindowSizeIncreaseTime (0), m_LastMessageReceivedTime (0)
 	{
 	}
 
@@ -47,10 +81,15 @@ namespace transport
 	void SSUData::Stop ()
 	{
 		m_ResendTimer.cancel ();
-		m_IncompleteMessagesCleanupTimer.cancel ();
+		if (m_IncompleteMessagesCleanupTimer)
+		{
+			m_Session.GetTimeWheel ().Cancel (m_IncompleteMessagesCleanupTimer);
+			m_IncompleteMessagesCleanupTimer = 0;
+		}
 		m_IncompleteMessages.clear ();
 		m_SentMessages.clear ();
-		m_ReceivedMessages.clear ();
+		m_PendingMessages.clear ();
+		m_ReceivedMessages.Clear ();
 	}
 
 	void SSUData::AdjustPacketSize (std::shared_ptr<const i2p::data::RouterInfo> remoteRouter)
@@ -91,12 +130,71 @@ namespace transport
 		auto it = m_SentMessages.find (msgID);
 		if (it != m_SentMessages.end ())
 		{
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			if (!it->second->numResends && !it->second->numFastResends) // Karn's algorithm, sample not retransmitted only
+				UpdateRTT (ts - it->second->sendTime);
+			// grow window
+			int numFragments = it->second->fragments.size ();
+			if (m_WindowSize < m_SlowStartThreshold)
+				m_WindowSize += numFragments; // slow start
+			else if (ts > m_LastWindowSizeIncreaseTime + m_RTT)
+			{
+				m_WindowSize++; // congestion avoidance
+				m_LastWindowSizeIncreaseTime = ts;
+			}
+			if (m_WindowSize > SSU_MAX_WINDOW_SIZE) m_WindowSize = SSU_MAX_WINDOW_SIZE;
 			m_SentMessages.erase (it);
 			if (m_SentMessages.empty ())
 				m_ResendTimer.cancel ();
 		}
 	}
 
+	void SSUData::UpdateRTT (int rtt)
+	{
+		if (rtt < 0) return;
+		if (!m_RTT)
+		{
+			// first sample
+			m_RTT = rtt ? rtt : 1;
+			m_RTTVar = rtt/2;
+		}
+		else
+		{
+			int delta = m_RTT > rtt ? m_RTT - rtt : rtt - m_RTT;
+			m_RTTVar = (3*m_RTTVar + delta)/4;
+			m_RTT = (7*m_RTT + rtt)/8;
+			if (!m_RTT) m_RTT = 1;
+		}
+		m_RTO = m_RTT + 4*m_RTTVar;
+		if (m_RTO < SSU_MIN_RTO) m_RTO = SSU_MIN_RTO;
+		if (m_RTO > SSU_MAX_RTO) m_RTO = SSU_MAX_RTO;
+	}
+
+	void SSUData::FastResend (SentMessage& msg, int highestAckedFragment, uint64_t ts)
+	{
+		// fragments far enough behind highest ACKed one are considered lost
+		if (ts < msg.lastFastResendTime + (m_RTT ? m_RTT : SSU_MIN_RTO)) return; // once per RTT
+		std::vector<std::pair<const uint8_t *, size_t> > bufs;
+		int numFragments = msg.fragments.size ();
+		for (int i = 0; i <= highestAckedFragment - SSU_FAST_RESEND_THRESHOLD && i < numFragments; i++)
+			if (msg.fragments[i]) bufs.push_back (std::make_pair (msg.fragments[i]->buf, msg.fragments[i]->len));
+		if (bufs.empty ()) return;
+		LogPrint (eLogDebug, "SSU: fast resend of ", bufs.size (), " fragments");
+		try
+		{
+			m_Session.Send (bufs);
+		}
+		catch (boost::system::system_error& ec)
+		{
+			LogPrint (eLogWarning, "SSU: Can't resend data fragment ", ec.what ());
+		}
+		msg.lastFastResendTime = ts;
+		msg.numFastResends++; // don't sample RTT anymore
+		m_SlowStartThreshold = m_WindowSize/2;
+		if (m_SlowStartThreshold < SSU_MIN_WINDOW_SIZE) m_SlowStartThreshold = SSU_MIN_WINDOW_SIZE;
+		m_WindowSize = m_SlowStartThreshold;
+	}
+
 	void SSUData::ProcessAcks (uint8_t *& buf, uint8_t flag)
 	{
 		if (flag & DATA_FLAG_EXPLICIT_ACKS_INCLUDED)
@@ -113,6 +211,7 @@ namespace transport
 			// explicit ACK bitfields
 			uint8_t numBitfields =*buf;
 			buf++;
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
 			for (int i = 0; i < numBitfields; i++)
 			{
 				uint32_t msgID = bufbe32toh (buf);
@@ -120,7 +219,7 @@ namespace transport
 				auto it = m_SentMessages.find (msgID);
 				// process individual Ack bitfields
 				bool isNonLast = false;
-				int fragment = 0;
+				int fragment = 0, highestAckedFragment = -1;
 				do
 				{
 					uint8_t bitfield = *buf;
@@ -137,6 +236,7 @@ namespace transport
 							{
 								if (fragment < numSentFragments)
 									it->second->fragments[fragment].reset (nullptr);
+								highestAckedFragment = fragment;
 							}
 							fragment++;
 							mask <<= 1;
@@ -145,6 +245,16 @@ namespace transport
 					buf++;
 				}
 				while (isNonLast);
+				if (it != m_SentMessages.end () && highestAckedFragment >= 0)
+				{
+					bool isAcked = true;
+					for (const auto& f: it->second->fragments)
+						if (f) { isAcked = false; break; }
+					if (isAcked) // all fragments ACKed
+						ProcessSentMessageAck (msgID);
+					else
+						FastResend (*it->second, highestAckedFragment, ts);
+				}
 			}
 		}
 	}
@@ -211,15 +321,15 @@ namespace transport
 				if (fragmentNum < incompleteMessage->nextFragmentNum)
 					// duplicate fragment
 					LogPrint (eLogWarning, "SSU: Duplicate fragment ", (int)fragmentNum, " of message ", msgID, ", ignored");
+				else if (incompleteMessage->IsFragmentReceived (fragmentNum))
+					LogPrint (eLogWarning, "SSU: Fragment ", (int)fragmentNum, " of message ", msgID, " already saved");
 				else
 				{
 					// missing fragment
 					LogPrint (eLogWarning, "SSU: Missing fragments from ", (int)incompleteMessage->nextFragmentNum, " to ", fragmentNum - 1, " of message ", msgID);
-					auto savedFragment = new Fragment (fragmentNum, buf, fragmentSize, isLast);
-					if (incompleteMessage->savedFragments.insert (std::unique_ptr<Fragment>(savedFragment)).second)
-						incompleteMessage->lastFragmentInsertTime = i2p::util::GetSecondsSinceEpoch ();
-					else
-						LogPrint (eLogWarning, "SSU: Fragment ", (int)fragmentNum, " of message ", msgID, " already saved");
+					incompleteMessage->savedFragments.insert (std::unique_ptr<Fragment>(new Fragment (fragmentNum, buf, fragmentSize, isLast)));
+					incompleteMessage->SetFragmentReceived (fragmentNum);
+					incompleteMessage->lastFragmentInsertTime = i2p::util::GetSecondsSinceEpoch ();
 				}
 				isLast = false;
 			}
@@ -235,14 +345,15 @@ namespace transport
 				msg->FromSSU (msgID);
 				if (m_Session.GetState () == eSessionStateEstablished)
 				{
-					if (!m_ReceivedMessages.count (msgID))
+					if (!m_ReceivedMessages.Contains (msgID))
 					{
-						m_ReceivedMessages.insert (msgID);
+						m_ReceivedMessages.Insert (msgID);
 						m_LastMessageReceivedTime = i2p::util::GetSecondsSinceEpoch ();
 						if (!msg->IsExpired ())
 						{
 #ifdef WITH_EVENTS
-							QueueIntEvent("transport.recvmsg", m_Session.GetIdentHashBase64(), 1);
+							auto ident = m_Session.GetRemoteIdentity ();
+							if (ident) QueueIntEvent(i2p::event::eCollectedTransportRecvMsg, ident->GetIdentHash(), 1);
 #endif
 							m_Handler.PutNextMessage (msg);
 						}
@@ -265,7 +376,7 @@ namespace transport
 				}
 			}
 			else
-				SendFragmentAck (msgID, fragmentNum);
+				SendFragmentAck (msgID, *incompleteMessage);
 			buf += fragmentSize;
 		}
 	}
@@ -283,7 +394,10 @@ namespace transport
 		LogPrint (eLogDebug, "SSU: Process data, flags=", (int)flag, ", len=", len);
 		// process acks if presented
 		if (flag & (DATA_FLAG_ACK_BITFIELDS_INCLUDED | DATA_FLAG_EXPLICIT_ACKS_INCLUDED))
+		{
 			ProcessAcks (buf, flag);
+			SendPendingMessages (); // window might be released
+		}
 		// extended data if presented
 		if (flag & DATA_FLAG_EXTENDED_DATA_INCLUDED)
 		{
@@ -298,27 +412,90 @@ namespace transport
 
 	void SSUData::Send (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
+		auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
+		if (msg->IsExpired (ts, 0))
+		{
+			i2p::metrics::ssuExpiredMessages.Inc ();
+			return;
+		}
+		if (m_PendingMessages.empty () && CanSend (msg))
+			SendMessage (msg);
+		else
+		{
+			if (m_PendingMessages.size () >= SSU_MAX_NUM_PENDING_MESSAGES)
+			{
+				auto num = DropExpiredI2NPMessages (m_PendingMessages, ts);
+				if (num) i2p::metrics::ssuExpiredMessages.Inc (num);
+			}
+			if (m_PendingMessages.size () < SSU_MAX_NUM_PENDING_MESSAGES)
+				m_PendingMessages.push_back (msg);
+			else
+				LogPrint (eLogWarning, "SSU: too many messages waiting for window, dropped");
+		}
+	}
+
+	void SSUData::SendPendingMessages ()
+	{
+		auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
+		while (!m_PendingMessages.empty () && CanSend (m_PendingMessages.front ()))
+		{
+			if (m_PendingMessages.front ()->IsExpired (ts, 0))
+			{
+				// expired while waiting for window
+				i2p::metrics::ssuExpiredMessages.Inc ();
+				m_PendingMessages.pop_front ();
+				continue;
+			}
+			SendMessage (m_PendingMessages.front ());
+			m_PendingMessages.pop_front ();
+		}
+	}
+
+	bool SSUData::CanSend (std::shared_ptr<i2p::I2NPMessage> msg) const
+	{
+		int numUnacked = GetNumUnackedFragments ();
+		if (!numUnacked) return true; // always send at least one message
+		size_t payloadSize = m_PacketSize - sizeof (SSUHeader) - 9;
+		int numFragments = (msg->GetLength () + payloadSize - 1)/payloadSize;
+		return numUnacked + numFragments <= m_WindowSize;
+	}
+
+	int SSUData::GetNumUnackedFragments () const
+	{
+		int num = 0;
+		for (const auto& it: m_SentMessages)
+			for (const auto& f: it.second->fragments)
+				if (f) num++;
+		return num;
+	}
+
+	void SSUData::SendMessage (std::shared_ptr<i2p::I2NPMessage> msg)
+	{
+		if (msg->traceTime) i2p::metrics::tracer.Record (i2p::metrics::eTraceStageWrite, msg->traceTime);
 		uint32_t msgID = msg->ToSSU ();
 		if (m_SentMessages.count (msgID) > 0)
 		{
 			LogPrint (eLogWarning, "SSU: message ", msgID, " already sent");
 			return;
 		}
-		if (m_SentMessages.empty ()) // schedule resend at first message only
-			ScheduleResend ();
+		bool scheduleResend = m_SentMessages.empty (); // schedule resend at first message only
 
 		auto ret = m_SentMessages.insert (std::make_pair (msgID, std::unique_ptr<SentMessage>(new SentMessage)));
 		std::unique_ptr<SentMessage>& sentMessage = ret.first->second;
 		if (ret.second)
 		{
-			sentMessage->nextResendTime = i2p::util::GetSecondsSinceEpoch () + RESEND_INTERVAL;
+			sentMessage->sendTime = i2p::util::GetMillisecondsSinceEpoch ();
+			sentMessage->nextResendTime = sentMessage->sendTime + m_RTO;
+			sentMessage->lastFastResendTime = 0;
 			sentMessage->numResends = 0;
+			sentMessage->numFastResends = 0;
 		}
 		auto& fragments = sentMessage->fragments;
 		size_t payloadSize = m_PacketSize - sizeof (SSUHeader) - 9; // 9  =  flag + #frg(1) + messageID(4) + frag info (3)
 		size_t len = msg->GetLength ();
 		uint8_t * msgBuf = msg->GetSSUHeader ();
 
+		std::vector<std::pair<const uint8_t *, size_t> > bufs; // sent at once
 		uint32_t fragmentNum = 0;
 		while (len > 0 && fragmentNum <= 127)
 		{
@@ -352,14 +529,7 @@ namespace transport
 
 			// encrypt message with session key
 			m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, size);
-			try
-			{
-				m_Session.Send (buf, size);
-			}
-			catch (boost::system::system_error& ec)
-			{
-				LogPrint (eLogWarning, "SSU: Can't send data fragment ", ec.what ());
-			}
+			bufs.push_back (std::make_pair (buf, size));
 			if (!isLast)
 			{
 				len -= payloadSize;
@@ -369,6 +539,16 @@ namespace transport
 				len = 0;
 			fragmentNum++;
 		}
+		try
+		{
+			m_Session.Send (bufs);
+		}
+		catch (boost::system::system_error& ec)
+		{
+			LogPrint (eLogWarning, "SSU: Can't send data fragment ", ec.what ());
+		}
+		if (scheduleResend)
+			ScheduleResend ();
 	}
 
 	void SSUData::SendMsgAck (uint32_t msgID)
@@ -388,13 +568,13 @@ namespace transport
 		m_Session.Send (buf, 48);
 	}
 
-	void SSUData::SendFragmentAck (uint32_t msgID, int fragmentNum)
+	void SSUData::SendFragmentAck (uint32_t msgID, const IncompleteMessage& msg)
 	{
-		if (fragmentNum > 64)
-		{
-			LogPrint (eLogWarning, "SSU: Fragment number ", fragmentNum, " exceeds 64");
-			return;
-		}
+		// selective ACK, bits for all fragments received so far
+		int maxFragmentNum = msg.nextFragmentNum - 1;
+		if (!msg.savedFragments.empty ())
+			maxFragmentNum = (*msg.savedFragments.rbegin ())->fragmentNum; // sorted by fragmentNum
+		if (maxFragmentNum < 0) return;
 		uint8_t buf[64 + 18] = {0};
 		uint8_t * payload = buf + sizeof (SSUHeader);
 		*payload = DATA_FLAG_ACK_BITFIELDS_INCLUDED; // flag
@@ -404,14 +584,18 @@ namespace transport
 		// one ack
 		*(uint32_t *)(payload) = htobe32 (msgID); // msgID
 		payload += 4;
-		div_t d = div (fragmentNum, 7);
-		memset (payload, 0x80, d.quot); // 0x80 means non-last
-		payload += d.quot;
-		*payload = 0x01 << d.rem; // set corresponding bit
-		payload++;
+		int numBytes = maxFragmentNum/7 + 1; // 19 max
+		for (int i = 0; i < numBytes; i++)
+		{
+			uint8_t bitfield = (i < numBytes - 1) ? 0x80 : 0; // 0x80 means non-last
+			for (int j = 0; j < 7; j++)
+				if (i*7 + j <= maxFragmentNum && msg.IsFragmentReceived (i*7 + j)) bitfield |= (0x01 << j);
+			*payload = bitfield;
+			payload++;
+		}
 		*payload = 0; // number of fragments
 
-		size_t len = d.quot < 4 ? 48 : 64; // 48 = 37 + 7 + 4 (3+1)
+		size_t len = numBytes <= 4 ? 48 : 64; // 48 = 37 + 7 + 4 (3+1)
 		// encrypt message with session key
 		m_Session.FillHeaderAndEncrypt (PAYLOAD_TYPE_DATA, buf, len);
 		m_Session.Send (buf, len);
@@ -419,8 +603,15 @@ namespace transport
 
 	void SSUData::ScheduleResend()
 	{
+		if (m_SentMessages.empty ()) return;
 		m_ResendTimer.cancel ();
-		m_ResendTimer.expires_from_now (boost::posix_time::seconds(RESEND_INTERVAL));
+		// wake up at earliest resend time
+		uint64_t nextResendTime = m_SentMessages.begin ()->second->nextResendTime;
+		for (const auto& it: m_SentMessages)
+			if (it.second->nextResendTime < nextResendTime) nextResendTime = it.second->nextResendTime;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		int timeout = nextResendTime > ts + SSU_MIN_RTO/4 ? nextResendTime - ts : SSU_MIN_RTO/4;
+		m_ResendTimer.expires_from_now (boost::posix_time::milliseconds(timeout));
 		auto s = m_Session.shared_from_this();
 		m_ResendTimer.async_wait ([s](const boost::system::error_code& ecode)
 			{ s->m_Data.HandleResendTimer (ecode); });
@@ -430,30 +621,34 @@ namespace transport
 	{
 		if (ecode != boost::asio::error::operation_aborted)
 		{
-			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
 			int numResent = 0;
+			bool isLost = false;
 			for (auto it = m_SentMessages.begin (); it != m_SentMessages.end ();)
 			{
 				if (ts >= it->second->nextResendTime)
 				{
 					if (it->second->numResends < MAX_NUM_RESENDS)
 					{
+						std::vector<std::pair<const uint8_t *, size_t> > bufs;
 						for (auto& f: it->second->fragments)
-							if (f)
-							{
-								try
-								{
-									m_Session.Send (f->buf, f->len); // resend
-									numResent++;
-								}
-								catch (boost::system::system_error& ec)
-								{
-									LogPrint (eLogWarning, "SSU: Can't resend data fragment ", ec.what ());
-								}
-							}
+							if (f) bufs.push_back (std::make_pair (f->buf, f->len));
+						try
+						{
+							m_Session.Send (bufs); // resend
+							numResent += bufs.size ();
+						}
+						catch (boost::system::system_error& ec)
+						{
+							LogPrint (eLogWarning, "SSU: Can't resend data fragment ", ec.what ());
+						}
 
 						it->second->numResends++;
-						it->second->nextResendTime += it->second->numResends*RESEND_INTERVAL;
+						// exponential backoff
+						int rto = m_RTO << it->second->numResends;
+						if (rto > SSU_MAX_RTO) rto = SSU_MAX_RTO;
+						it->second->nextResendTime = ts + rto;
+						isLost = true;
 						++it;
 					}
 					else
@@ -465,6 +660,14 @@ namespace transport
 				else
 					++it;
 			}
+			if (isLost)
+			{
+				// timeout, shrink window to minimal
+				m_SlowStartThreshold = m_WindowSize/2;
+				if (m_SlowStartThreshold < SSU_MIN_WINDOW_SIZE) m_SlowStartThreshold = SSU_MIN_WINDOW_SIZE;
+				m_WindowSize = SSU_MIN_WINDOW_SIZE;
+			}
+			SendPendingMessages ();
 			if (m_SentMessages.empty ()) return; // nothing to resend
 			if (numResent < MAX_OUTGOING_WINDOW_SIZE)
 				ScheduleResend ();
@@ -478,35 +681,32 @@ namespace transport
 
 	void SSUData::ScheduleIncompleteMessagesCleanup ()
 	{
-		m_IncompleteMessagesCleanupTimer.cancel ();
-		m_IncompleteMessagesCleanupTimer.expires_from_now (boost::posix_time::seconds(INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT));
+		auto& wheel = m_Session.GetTimeWheel ();
+		if (m_IncompleteMessagesCleanupTimer) wheel.Cancel (m_IncompleteMessagesCleanupTimer);
 		auto s = m_Session.shared_from_this();
-		m_IncompleteMessagesCleanupTimer.async_wait ([s](const boost::system::error_code& ecode)
-			{ s->m_Data.HandleIncompleteMessagesCleanupTimer (ecode); });
+		m_IncompleteMessagesCleanupTimer = wheel.Schedule (INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT*1000,
+			[s]() { s->m_Data.HandleIncompleteMessagesCleanupTimer (); });
 	}
 
-	void SSUData::HandleIncompleteMessagesCleanupTimer (const boost::system::error_code& ecode)
+	void SSUData::HandleIncompleteMessagesCleanupTimer ()
 	{
-		if (ecode != boost::asio::error::operation_aborted)
+		m_IncompleteMessagesCleanupTimer = 0;
+		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+		for (auto it = m_IncompleteMessages.begin (); it != m_IncompleteMessages.end ();)
 		{
-			uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-			for (auto it = m_IncompleteMessages.begin (); it != m_IncompleteMessages.end ();)
+			if (ts > it->second->lastFragmentInsertTime + INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT)
 			{
-				if (ts > it->second->lastFragmentInsertTime + INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT)
-				{
-					LogPrint (eLogWarning, "SSU: message ", it->first, " was not completed  in ", INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT, " seconds, deleted");
-					it = m_IncompleteMessages.erase (it);
-				}
-				else
-					++it;
+				LogPrint (eLogWarning, "SSU: message ", it->first, " was not completed  in ", INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT, " seconds, deleted");
+				it = m_IncompleteMessages.erase (it);
 			}
-			// decay
-			if (m_ReceivedMessages.size () > MAX_NUM_RECEIVED_MESSAGES ||
-			    i2p::util::GetSecondsSinceEpoch () > m_LastMessageReceivedTime + DECAY_INTERVAL)
-				m_ReceivedMessages.clear ();
-
-			ScheduleIncompleteMessagesCleanup ();
+			else
+				++it;
 		}
+		// decay
+		if (i2p::util::GetSecondsSinceEpoch () > m_LastMessageReceivedTime + DECAY_INTERVAL)
+			m_ReceivedMessages.Clear (); // window drops oldest by itself
+
+		ScheduleIncompleteMessagesCleanup ();
 	}
 }
 }
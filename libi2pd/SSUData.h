@@ -4,13 +4,15 @@
 #include <inttypes.h>
 #include <string.h>
 #include <map>
+#include <list>
 #include <vector>
-#include <unordered_set>
+#include <unordered_map>
 #include <memory>
 #include <boost/asio.hpp>
 #include "I2NPProtocol.h"
 #include "Identity.h"
 #include "RouterInfo.h"
+#include "TimeWheel.h"
 
 namespace i2p
 {
@@ -28,11 +30,19 @@ namespace transport
 	const size_t UDP_HEADER_SIZE = 8;
 	const size_t SSU_V4_MAX_PACKET_SIZE = SSU_MTU_V4 - IPV4_HEADER_SIZE - UDP_HEADER_SIZE; // 1456
 	const size_t SSU_V6_MAX_PACKET_SIZE = SSU_MTU_V6 - IPV6_HEADER_SIZE - UDP_HEADER_SIZE; // 1440
-	const int RESEND_INTERVAL = 3; // in seconds
+	const int SSU_INITIAL_RTO = 1000; // in milliseconds
+	const int SSU_MIN_RTO = 200; // in milliseconds
+	const int SSU_MAX_RTO = 12000; // in milliseconds
+	const int SSU_MIN_WINDOW_SIZE = 8; // in fragments
+	const int SSU_INITIAL_WINDOW_SIZE = 32; // in fragments
+	const int SSU_MAX_WINDOW_SIZE = 192; // in fragments, below MAX_OUTGOING_WINDOW_SIZE
+	const int SSU_FAST_RESEND_THRESHOLD = 2; // fragment is lost if that many fragments after it are ACKed
+	const size_t SSU_MAX_NUM_PENDING_MESSAGES = 512; // waiting for window
 	const int MAX_NUM_RESENDS = 5;
 	const int DECAY_INTERVAL = 20; // in seconds
 	const int INCOMPLETE_MESSAGES_CLEANUP_TIMEOUT = 30; // in seconds
 	const unsigned int MAX_NUM_RECEIVED_MESSAGES = 1000; // how many msgID we store for duplicates check
+	const size_t RECEIVED_MESSAGES_FILTER_SIZE = 8192; // counters, must be power of 2
 	const int MAX_OUTGOING_WINDOW_SIZE = 200; // how many unacked message we can store
 	// data flags
 	const uint8_t DATA_FLAG_EXTENDED_DATA_INCLUDED = 0x02;
@@ -69,15 +79,44 @@ namespace transport
 		uint32_t lastFragmentInsertTime; // in seconds
 		std::set<std::unique_ptr<Fragment>, FragmentCmp> savedFragments;
 
-		IncompleteMessage (std::shared_ptr<I2NPMessage> m): msg (m), nextFragmentNum (0), lastFragmentInsertTime (0) {};
+		uint64_t receivedFragments[2]; // bitmap of 128 fragments
+
+		IncompleteMessage (std::shared_ptr<I2NPMessage> m): msg (m), nextFragmentNum (0), lastFragmentInsertTime (0),
+			receivedFragments {0, 0} {};
 		void AttachNextFragment (const uint8_t * fragment, size_t fragmentSize);
+		bool IsFragmentReceived (int fragmentNum) const { return receivedFragments[fragmentNum >> 6] & (1ULL << (fragmentNum & 0x3F)); };
+		void SetFragmentReceived (int fragmentNum) { receivedFragments[fragmentNum >> 6] |= (1ULL << (fragmentNum & 0x3F)); };
 	};
 
 	struct SentMessage
 	{
 		std::vector<std::unique_ptr<Fragment> > fragments;
-		uint32_t nextResendTime; // in seconds
+		uint64_t sendTime; // in milliseconds
+		uint64_t nextResendTime; // in milliseconds
+		uint64_t lastFastResendTime; // in milliseconds
 		int numResends;
+		int numFastResends; // don't count towards MAX_NUM_RESENDS
+	};
+
+	class ReceivedMessagesWindow // last MAX_NUM_RECEIVED_MESSAGES msgIDs, no allocations
+	{
+		public:
+
+			ReceivedMessagesWindow () { Clear (); };
+
+			bool Contains (uint32_t msgID) const;
+			void Insert (uint32_t msgID); // replaces oldest if full
+			void Clear ();
+
+		private:
+
+			static size_t GetFilterIndex (uint32_t msgID) { return (msgID ^ (msgID >> 13)) & (RECEIVED_MESSAGES_FILTER_SIZE - 1); };
+
+		private:
+
+			uint32_t m_MsgIDs[MAX_NUM_RECEIVED_MESSAGES]; // ring
+			size_t m_Size, m_Next;
+			uint8_t m_Filter[RECEIVED_MESSAGES_FILTER_SIZE]; // counters of msgIDs in the ring, saturated at 255
 	};
 
 	class SSUSession;
@@ -97,30 +136,42 @@ namespace transport
 
 			void AdjustPacketSize (std::shared_ptr<const i2p::data::RouterInfo> remoteRouter);
 			void UpdatePacketSize (const i2p::data::IdentHash& remoteIdent);
+			int GetRTT () const { return m_RTT; };
 
 		private:
 
+			void SendMessage (std::shared_ptr<i2p::I2NPMessage> msg);
+			void SendPendingMessages ();
+			bool CanSend (std::shared_ptr<i2p::I2NPMessage> msg) const; // fits to window
+			int GetNumUnackedFragments () const;
 			void SendMsgAck (uint32_t msgID);
-			void SendFragmentAck (uint32_t msgID, int fragmentNum);
+			void SendFragmentAck (uint32_t msgID, const IncompleteMessage& msg); // all received fragments
 			void ProcessAcks (uint8_t *& buf, uint8_t flag);
 			void ProcessFragments (uint8_t * buf);
 			void ProcessSentMessageAck (uint32_t msgID);
+			void FastResend (SentMessage& msg, int highestAckedFragment, uint64_t ts);
+			void UpdateRTT (int rtt);
 
 			void ScheduleResend ();
 			void HandleResendTimer (const boost::system::error_code& ecode);
 
 			void ScheduleIncompleteMessagesCleanup ();
-			void HandleIncompleteMessagesCleanupTimer (const boost::system::error_code& ecode);
+			void HandleIncompleteMessagesCleanupTimer ();
 
 
 		private:
 
 			SSUSession& m_Session;
-			std::map<uint32_t, std::unique_ptr<IncompleteMessage> > m_IncompleteMessages;
-			std::map<uint32_t, std::unique_ptr<SentMessage> > m_SentMessages;
-			std::unordered_set<uint32_t> m_ReceivedMessages;
-			boost::asio::deadline_timer m_ResendTimer, m_IncompleteMessagesCleanupTimer;
+			std::unordered_map<uint32_t, std::unique_ptr<IncompleteMessage> > m_IncompleteMessages;
+			std::unordered_map<uint32_t, std::unique_ptr<SentMessage> > m_SentMessages;
+			std::list<std::shared_ptr<i2p::I2NPMessage> > m_PendingMessages; // not sent yet because of window
+			ReceivedMessagesWindow m_ReceivedMessages;
+			boost::asio::deadline_timer m_ResendTimer;
+			i2p::util::TimeWheel::TimerID m_IncompleteMessagesCleanupTimer; // in session's time wheel
 			int m_MaxPacketSize, m_PacketSize;
+			int m_WindowSize, m_SlowStartThreshold; // in fragments
+			int m_RTT, m_RTTVar, m_RTO; // in milliseconds, m_RTT is 0 until first sample
+			uint64_t m_LastWindowSizeIncreaseTime;
 			i2p::I2NPMessagesHandler m_Handler;
 			uint32_t m_LastMessageReceivedTime; // in second
 	};
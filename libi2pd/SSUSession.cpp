@@ -5,6 +5,7 @@
 #include "RouterContext.h"
 #include "Transports.h"
 #include "NetDb.hpp"
+#include "Metrics.h"
 #include "SSU.h"
 #include "SSUSession.h"
 
@@ -15,7 +16,7 @@ namespace transport
 	SSUSession::SSUSession (SSUServer& server, boost::asio::ip::udp::endpoint& remoteEndpoint,
 		std::shared_ptr<const i2p::data::RouterInfo> router, bool peerTest ):
 		TransportSession (router, SSU_TERMINATION_TIMEOUT),
-		m_Server (server), m_RemoteEndpoint (remoteEndpoint), m_ConnectTimer (GetService ()),
+		m_Server (server), m_RemoteEndpoint (remoteEndpoint), m_ConnectTimer (0),
 		m_IsPeerTest (peerTest),m_State (eSessionStateUnknown), m_IsSessionKey (false),
 		m_RelayTag (0), m_SentRelayTag (0), m_Data (*this), m_IsDataReceived (false)
 	{
@@ -41,7 +42,12 @@ namespace transport
 
 	boost::asio::io_service& SSUSession::GetService ()
 	{
-		return IsV6 () ? m_Server.GetServiceV6 () : m_Server.GetService ();
+		return m_Server.GetSessionService (m_RemoteEndpoint);
+	}
+
+	i2p::util::TimeWheel& SSUSession::GetTimeWheel ()
+	{
+		return m_Server.GetSessionTimeWheel (m_RemoteEndpoint);
 	}
 
 	void SSUSession::CreateAESandMacKey (const uint8_t * pubKey)
@@ -83,7 +89,8 @@ namespace transport
 		m_SessionKeyDecryption.SetKey (m_SessionKey);
 	}
 
-	void SSUSession::ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint)
+	void SSUSession::ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint,
+		const i2p::crypto::MACKey * validatedKey)
 	{
 		m_NumReceivedBytes += len;
 		i2p::transport::transports.UpdateReceivedBytes (len);
@@ -100,7 +107,7 @@ namespace transport
 			if (m_State == eSessionStateEstablished)
 				m_LastActivityTimestamp = i2p::util::GetSecondsSinceEpoch ();
 
-			if (m_IsSessionKey && Validate (buf, len, m_MacKey)) // try session key first
+			if (m_IsSessionKey && ((validatedKey && *validatedKey == m_MacKey) || Validate (buf, len, m_MacKey))) // try session key first
 				DecryptSessionKey (buf, len);
 			else
 			{
@@ -151,6 +158,7 @@ namespace transport
 			LogPrint (eLogError, "SSU header size ", headerSize, " exceeds packet length ", len);
 			return;
 		}
+		i2p::metrics::ssuReceivedPackets.Inc ();
 		SSUHeader * header = (SSUHeader *)buf;
 		switch (header->GetPayloadType ())
 		{
@@ -216,8 +224,32 @@ namespace transport
 			return;
 		}
 		m_RemoteEndpoint = senderEndpoint;
-		if (!m_DHKeysPair)
+		if (!m_DHKeysPair) // first SessionRequest, not retransmission
+		{
+			// cheap checks before DH
+			if (headerSize + 256 > len)
+			{
+				LogPrint (eLogWarning, "SSU: Session request of ", len, " bytes is too short");
+				m_Server.DeleteSession (shared_from_this ());
+				return;
+			}
+			auto ts = i2p::util::GetSecondsSinceEpoch ();
+			uint32_t tsA = bufbe32toh (((const SSUHeader *)buf)->time);
+			if (tsA < ts - SSU_CLOCK_SKEW || tsA > ts + SSU_CLOCK_SKEW)
+			{
+				LogPrint (eLogWarning, "SSU: Session request time difference ", (int)(ts - tsA), " exceeds clock skew");
+				m_Server.DeleteSession (shared_from_this ());
+				return;
+			}
+			auto& filter = transports.GetHandshakesFilter ();
+			if (!filter.Accept (senderEndpoint.address ()) || filter.IsReplay (buf + headerSize, 256))
+			{
+				LogPrint (eLogInfo, "SSU: Session request from ", senderEndpoint.address (), " rejected");
+				m_Server.DeleteSession (shared_from_this ());
+				return;
+			}
 			m_DHKeysPair = transports.GetNextDHKeysPair ();
+		}
 		CreateAESandMacKey (buf + headerSize);
 		SendSessionCreated (buf + headerSize, sendRelayTag);
 	}
@@ -231,7 +263,7 @@ namespace transport
 		}
 
 		LogPrint (eLogDebug, "SSU message: session created");
-		m_ConnectTimer.cancel (); // connect timer
+		CancelConnectTimer ();
 		SignedData s; // x,y, our IP, our port, remote IP, remote port, relayTag, signed on time
 		auto headerSize = GetSSUHeaderSize (buf);
 		if (headerSize >= len)
@@ -382,7 +414,7 @@ namespace transport
 		}
 		// encrypt and send
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		FillHeaderAndEncrypt (PAYLOAD_TYPE_SESSION_REQUEST, buf, isV4 ? 304 : 320, m_IntroKey, iv, m_IntroKey, flag);
 		m_Server.Send (buf, isV4 ? 304 : 320, m_RemoteEndpoint);
 	}
@@ -411,7 +443,7 @@ namespace transport
 		htobe32buf (payload, nonce); // nonce
 
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		if (m_State == eSessionStateEstablished)
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_REQUEST, buf, 96, m_SessionKey, iv, m_MacKey);
 		else
@@ -464,7 +496,7 @@ namespace transport
 		s.Insert<uint16_t> (htobe16 (address->port)); // our port
 		if (sendRelayTag && i2p::context.GetRouterInfo ().IsIntroducer () && !IsV6 ())
 		{
-			RAND_bytes((uint8_t *)&m_SentRelayTag, 4);
+			m_SentRelayTag = i2p::crypto::RandUint32 ();
 			if (!m_SentRelayTag) m_SentRelayTag = 1;
 		}
 		htobe32buf (payload, m_SentRelayTag);
@@ -479,14 +511,14 @@ namespace transport
 		s.Sign (i2p::context.GetPrivateKeys (), payload); // DSA signature
 
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		// encrypt signature and padding with newly created session key
 		size_t signatureLen = i2p::context.GetIdentity ()->GetSignatureLen ();
 		size_t paddingSize = signatureLen & 0x0F; // %16
 		if (paddingSize > 0)
 		{
 			// fill random padding
-			RAND_bytes(payload + signatureLen, (16 - paddingSize));
+			i2p::crypto::RandBytes (payload + signatureLen, (16 - paddingSize));
 			signatureLen += (16 - paddingSize);
 		}
 		m_SessionKeyEncryption.SetIV (iv);
@@ -516,7 +548,7 @@ namespace transport
 		auto signatureLen = i2p::context.GetIdentity ()->GetSignatureLen ();
 		size_t paddingSize = ((payload - buf) + signatureLen)%16;
 		if (paddingSize > 0) paddingSize = 16 - paddingSize;
-		RAND_bytes(payload, paddingSize); // fill padding with random
+		i2p::crypto::RandBytes (payload, paddingSize); // fill padding with random
 		payload += paddingSize; // padding size
 		// signature
 		SignedData s; // x,y, our IP, our port, remote IP, remote port, relayTag, our signed on time
@@ -535,7 +567,7 @@ namespace transport
 
 		size_t msgLen = payload - buf;
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		// encrypt message with session key
 		FillHeaderAndEncrypt (PAYLOAD_TYPE_SESSION_CONFIRMED, buf, msgLen, m_SessionKey, iv, m_MacKey);
 		Send (buf, msgLen);
@@ -610,7 +642,7 @@ namespace transport
 		{
 			// ecrypt with Alice's intro key
 			uint8_t iv[16];
-			RAND_bytes (iv, 16); // random iv
+			i2p::crypto::RandBytes (iv, 16); // random iv
 			FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_RESPONSE, buf, isV4 ? 64 : 80, introKey, iv, introKey);
 			m_Server.Send (buf, isV4 ? 64 : 80, from);
 		}
@@ -636,7 +668,7 @@ namespace transport
 		payload += 2; // port
 		*payload = 0; // challenge size
 		uint8_t iv[16];
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		FillHeaderAndEncrypt (PAYLOAD_TYPE_RELAY_INTRO, buf, 48, session->m_SessionKey, iv, session->m_MacKey);
 		m_Server.Send (buf, 48, session->m_RemoteEndpoint);
 		LogPrint (eLogDebug, "SSU: relay intro sent");
@@ -742,7 +774,7 @@ namespace transport
 			return;
 		}
 		SSUHeader * header = (SSUHeader *)buf;
-		RAND_bytes (header->iv, 16); // random iv
+		i2p::crypto::RandBytes (header->iv, 16); // random iv
 		m_SessionKeyEncryption.SetIV (header->iv);
 		header->flag = payloadType << 4; // MSB is 0
 		htobe32buf (header->time, i2p::util::GetSecondsSinceEpoch ());
@@ -795,15 +827,21 @@ namespace transport
 			LogPrint (eLogError, "SSU: Unexpected packet length ", len);
 			return false;
 		}
+		SSUHeader * header = (SSUHeader *)buf;
+		uint8_t digest[16];
+		i2p::crypto::HMACMD5Digest (&header->flag, PrepareMACData (buf, len), macKey, digest);
+		return !memcmp (header->mac, digest, 16);
+	}
+
+	size_t SSUSession::PrepareMACData (uint8_t * buf, size_t len)
+	{
 		SSUHeader * header = (SSUHeader *)buf;
 		uint8_t * encrypted = &header->flag;
 		uint16_t encryptedLen = len - (encrypted - buf);
 		// assume actual buffer size is 18 (16 + 2) bytes more
 		memcpy (buf + len, header->iv, 16);
 		htobe16buf (buf + len + 16, encryptedLen);
-		uint8_t digest[16];
-		i2p::crypto::HMACMD5Digest (encrypted, encryptedLen + 18, macKey, digest);
-		return !memcmp (header->mac, digest, 16);
+		return encryptedLen + 18;
 	}
 
 	void SSUSession::Connect ()
@@ -827,34 +865,35 @@ namespace transport
 
 	void SSUSession::ScheduleConnectTimer ()
 	{
-		m_ConnectTimer.cancel ();
-		m_ConnectTimer.expires_from_now (boost::posix_time::seconds(SSU_CONNECT_TIMEOUT));
-		m_ConnectTimer.async_wait (std::bind (&SSUSession::HandleConnectTimer,
-			shared_from_this (), std::placeholders::_1));
-}
+		CancelConnectTimer ();
+		m_ConnectTimer = GetTimeWheel ().Schedule (SSU_CONNECT_TIMEOUT*1000,
+			std::bind (&SSUSession::HandleConnectTimer, shared_from_this ()));
+	}
 
-	void SSUSession::HandleConnectTimer (const boost::system::error_code& ecode)
+	void SSUSession::CancelConnectTimer ()
 	{
-		if (!ecode)
+		if (m_ConnectTimer)
 		{
-			// timeout expired
-			LogPrint (eLogWarning, "SSU: session with ", m_RemoteEndpoint, " was not established after ", SSU_CONNECT_TIMEOUT, " seconds");
-			Failed ();
+			GetTimeWheel ().Cancel (m_ConnectTimer);
+			m_ConnectTimer = 0;
 		}
 	}
 
+	void SSUSession::HandleConnectTimer ()
+	{
+		// timeout expired
+		m_ConnectTimer = 0;
+		LogPrint (eLogWarning, "SSU: session with ", m_RemoteEndpoint, " was not established after ", SSU_CONNECT_TIMEOUT, " seconds");
+		Failed ();
+	}
+
 	void SSUSession::Introduce (const i2p::data::RouterInfo::Introducer& introducer,
 		std::shared_ptr<const i2p::data::RouterInfo> to)
 	{
 		if (m_State == eSessionStateUnknown)
-		{
-			// set connect timer
-			m_ConnectTimer.expires_from_now (boost::posix_time::seconds(SSU_CONNECT_TIMEOUT));
-			m_ConnectTimer.async_wait (std::bind (&SSUSession::HandleConnectTimer,
-				shared_from_this (), std::placeholders::_1));
-		}
+			ScheduleConnectTimer (); // set connect timer
 		uint32_t nonce;
-		RAND_bytes ((uint8_t *)&nonce, 4);
+		nonce = i2p::crypto::RandUint32 ();
 		m_RelayRequests[nonce] = to;
 		SendRelayRequest (introducer, nonce);
 	}
@@ -862,10 +901,7 @@ namespace transport
 	void SSUSession::WaitForIntroduction ()
 	{
 		m_State = eSessionStateIntroduced;
-		// set connect timer
-		m_ConnectTimer.expires_from_now (boost::posix_time::seconds(SSU_CONNECT_TIMEOUT));
-		m_ConnectTimer.async_wait (std::bind (&SSUSession::HandleConnectTimer,
-			shared_from_this (), std::placeholders::_1));
+		ScheduleConnectTimer (); // set connect timer
 	}
 
 	void SSUSession::Close ()
@@ -880,7 +916,7 @@ namespace transport
 		m_State = eSessionStateUnknown;
 		transports.PeerDisconnected (shared_from_this ());
 		m_Data.Stop ();
-		m_ConnectTimer.cancel ();
+		CancelConnectTimer ();
 		if (m_SentRelayTag)
 		{
 			m_Server.RemoveRelay (m_SentRelayTag); // relay tag is not valid anymore
@@ -921,11 +957,14 @@ namespace transport
 
 	void SSUSession::SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		GetService ().post (std::bind (&SSUSession::PostI2NPMessages, shared_from_this (), msgs));
+		if (PutOutgoingMessages (msgs))
+			GetService ().post (std::bind (&SSUSession::PostI2NPMessages, shared_from_this ()));
 	}
 
-	void SSUSession::PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs)
+	void SSUSession::PostI2NPMessages ()
 	{
+		std::vector<std::shared_ptr<I2NPMessage> > msgs;
+		GetOutgoingMessages (msgs);
 		if (m_State == eSessionStateEstablished)
 		{
 			for (const auto& it: msgs)
@@ -1108,7 +1147,7 @@ namespace transport
 			memcpy (payload, introKey, 32); // intro key
 
 		// send
-		RAND_bytes (iv, 16); // random iv
+		i2p::crypto::RandBytes (iv, 16); // random iv
 		if (toAddress)
 		{
 			// encrypt message with specified intro key
@@ -1135,7 +1174,7 @@ namespace transport
 			return;
 		}
 		uint32_t nonce;
-		RAND_bytes ((uint8_t *)&nonce, 4);
+		nonce = i2p::crypto::RandUint32 ();
 		if (!nonce) nonce = 1;
 		m_IsPeerTest = false;
 		m_Server.NewPeerTest (nonce, ePeerTestParticipantAlice1, shared_from_this ());
@@ -1199,8 +1238,20 @@ namespace transport
 	{
 		m_NumSentBytes += size;
 		i2p::transport::transports.UpdateSentBytes (size);
+		i2p::metrics::ssuSentPackets.Inc ();
 		m_Server.Send (buf, size, m_RemoteEndpoint);
 	}
+
+	void SSUSession::Send (const std::vector<std::pair<const uint8_t *, size_t> >& bufs)
+	{
+		if (bufs.empty ()) return;
+		size_t size = 0;
+		for (const auto& it: bufs) size += it.second;
+		m_NumSentBytes += size;
+		i2p::transport::transports.UpdateSentBytes (size);
+		i2p::metrics::ssuSentPackets.Inc ();
+		m_Server.Send (bufs, m_RemoteEndpoint);
+	}
 }
 }
 
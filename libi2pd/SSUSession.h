@@ -8,6 +8,7 @@
 #include "I2NPProtocol.h"
 #include "TransportSession.h"
 #include "SSUData.h"
+#include "TimeWheel.h"
 
 namespace i2p
 {
@@ -69,7 +70,8 @@ namespace transport
 
 			SSUSession (SSUServer& server, boost::asio::ip::udp::endpoint& remoteEndpoint,
 				std::shared_ptr<const i2p::data::RouterInfo> router = nullptr, bool peerTest = false);
-			void ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
+			void ProcessNextMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint,
+				const i2p::crypto::MACKey * validatedKey = nullptr); // MAC of buf is already verified with validatedKey
 			~SSUSession ();
 
 			void Connect ();
@@ -81,6 +83,8 @@ namespace transport
 			void Done ();
 			void Failed ();
 			boost::asio::ip::udp::endpoint& GetRemoteEndpoint () { return m_RemoteEndpoint; };
+			boost::asio::io_service& GetService (); // session's thread
+			i2p::util::TimeWheel& GetTimeWheel (); // of session's thread
 			bool IsV6 () const { return m_RemoteEndpoint.address ().is_v6 (); };
 			void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
 			void SendPeerTest (); // Alice
@@ -91,6 +95,9 @@ namespace transport
 
 			void SendKeepAlive ();
 			uint32_t GetRelayTag () const { return m_RelayTag; };
+			int GetRTT () const { return m_Data.GetRTT (); };
+			const i2p::crypto::MACKey * GetDataMACKey () const { return m_IsSessionKey ? &m_MacKey : nullptr; };
+			static size_t PrepareMACData (uint8_t * buf, size_t len); // appends iv and size, returns length of MAC data from flag
 			const i2p::data::RouterInfo::IntroKey& GetIntroKey () const { return m_IntroKey; };
 			uint32_t GetCreationTime () const { return m_CreationTime; };
 
@@ -98,10 +105,9 @@ namespace transport
 
 		private:
 
-			boost::asio::io_service& GetService ();
 			void CreateAESandMacKey (const uint8_t * pubKey);
 			size_t GetSSUHeaderSize (const uint8_t * buf) const;
-			void PostI2NPMessages (std::vector<std::shared_ptr<I2NPMessage> > msgs);
+			void PostI2NPMessages ();
 			void ProcessMessage (uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint); // call for established session
 			void ProcessSessionRequest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
 			void SendSessionRequest ();
@@ -118,13 +124,15 @@ namespace transport
 			void ProcessRelayIntro (const uint8_t * buf, size_t len);
 			void Established ();
 			void ScheduleConnectTimer ();
-			void HandleConnectTimer (const boost::system::error_code& ecode);
+			void CancelConnectTimer ();
+			void HandleConnectTimer ();
 			void ProcessPeerTest (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint& senderEndpoint);
 			void SendPeerTest (uint32_t nonce, const boost::asio::ip::address& address, uint16_t port, const uint8_t * introKey, bool toAddress = true, bool sendAddress = true);
 			void ProcessData (uint8_t * buf, size_t len);
 			void SendSessionDestroyed ();
 			void Send (uint8_t type, const uint8_t * payload, size_t len); // with session key
 			void Send (const uint8_t * buf, size_t size);
+			void Send (const std::vector<std::pair<const uint8_t *, size_t> >& bufs);
 
 			void FillHeaderAndEncrypt (uint8_t payloadType, uint8_t * buf, size_t len, const i2p::crypto::AESKey& aesKey,
 				const uint8_t * iv, const i2p::crypto::MACKey& macKey, uint8_t flag = 0);
@@ -140,7 +148,7 @@ namespace transport
 			friend class SSUData; // TODO: change in later
 			SSUServer& m_Server;
 			boost::asio::ip::udp::endpoint m_RemoteEndpoint;
-			boost::asio::deadline_timer m_ConnectTimer;
+			i2p::util::TimeWheel::TimerID m_ConnectTimer; // 0 if not scheduled
 			bool m_IsPeerTest;
 			SessionState m_State;
 			bool m_IsSessionKey;
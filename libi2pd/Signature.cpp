@@ -1,4 +1,5 @@
 #include <memory>
+#include <vector>
 #include "Log.h"
 #include "Signature.h"
 
@@ -28,6 +29,14 @@ namespace crypto
 	{
 		return EVP_DigestVerify (m_MDCtx, signature, 64, buf, len);
 	}
+
+	void EDDSA25519Verifier::Verify (size_t num, const EDDSA25519Verifier * const * verifiers, const uint8_t * const * bufs,
+		const size_t * lens, const uint8_t * const * signatures, bool * results)
+	{
+		// OpenSSL doesn't provide batch verification
+		for (size_t i = 0; i < num; i++)
+			results[i] = verifiers[i]->Verify (bufs[i], lens[i], signatures[i]);
+	}
 	
 #else	
 	EDDSA25519Verifier::EDDSA25519Verifier ()
@@ -41,9 +50,8 @@ namespace crypto
 	void EDDSA25519Verifier::SetPublicKey (const uint8_t * signingKey)
 	{
 		memcpy (m_PublicKeyEncoded, signingKey, EDDSA25519_PUBLIC_KEY_LENGTH);
-		BN_CTX * ctx = BN_CTX_new ();
-		m_PublicKey = GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, ctx);
-		BN_CTX_free (ctx);
+		m_PublicKey = GetEd25519 ()->DecodePublicKey (m_PublicKeyEncoded, GetThreadBNCtx ());
+		m_NegPublicKey = -m_PublicKey;
 	}	
 	
 	bool EDDSA25519Verifier::Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const
@@ -56,7 +64,27 @@ namespace crypto
 		SHA512_Update (&ctx, buf, len); // data
 		SHA512_Final (digest, &ctx);
 
-		return GetEd25519 ()->Verify (m_PublicKey, digest, signature);
+		return GetEd25519 ()->VerifyNegated (m_NegPublicKey, digest, signature);
+	}
+
+	void EDDSA25519Verifier::Verify (size_t num, const EDDSA25519Verifier * const * verifiers, const uint8_t * const * bufs,
+		const size_t * lens, const uint8_t * const * signatures, bool * results)
+	{
+		std::vector<const EDDSAPoint *> publicKeys (num);
+		std::vector<uint8_t> digests (num*64);
+		std::vector<const uint8_t *> digestPtrs (num);
+		for (size_t i = 0; i < num; i++)
+		{
+			SHA512_CTX ctx;
+			SHA512_Init (&ctx);
+			SHA512_Update (&ctx, signatures[i], EDDSA25519_SIGNATURE_LENGTH/2); // R
+			SHA512_Update (&ctx, verifiers[i]->m_PublicKeyEncoded, EDDSA25519_PUBLIC_KEY_LENGTH); // public key
+			SHA512_Update (&ctx, bufs[i], lens[i]); // data
+			SHA512_Final (digests.data () + i*64, &ctx);
+			digestPtrs[i] = digests.data () + i*64;
+			publicKeys[i] = &verifiers[i]->m_PublicKey;
+		}
+		GetEd25519 ()->Verify (num, publicKeys.data (), digestPtrs.data (), signatures, results);
 	}
 #endif
 
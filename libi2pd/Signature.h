@@ -280,6 +280,12 @@ namespace crypto
 
 
 	// EdDSA
+#if OPENSSL_EDDSA
+	const bool EDDSA25519_BATCH_VERIFICATION = false; // OpenSSL verifies one by one
+#else
+	const bool EDDSA25519_BATCH_VERIFICATION = true;
+#endif
+
 	class EDDSA25519Verifier: public Verifier
 	{
 		public:
@@ -289,6 +295,8 @@ namespace crypto
 			~EDDSA25519Verifier ();
 			
 			bool Verify (const uint8_t * buf, size_t len, const uint8_t * signature) const;
+			static void Verify (size_t num, const EDDSA25519Verifier * const * verifiers, const uint8_t * const * bufs,
+				const size_t * lens, const uint8_t * const * signatures, bool * results); // batch
 
 			size_t GetPublicKeyLen () const { return EDDSA25519_PUBLIC_KEY_LENGTH; };
 			size_t GetSignatureLen () const { return EDDSA25519_SIGNATURE_LENGTH; };
@@ -299,7 +307,7 @@ namespace crypto
 			EVP_PKEY * m_Pkey;
 			EVP_MD_CTX * m_MDCtx;
 #else			
-			EDDSAPoint m_PublicKey;
+			EDDSAPoint m_PublicKey, m_NegPublicKey; // decoded A and -A in extended coordinates
 			uint8_t m_PublicKeyEncoded[EDDSA25519_PUBLIC_KEY_LENGTH];
 #endif			
 	};
@@ -9,9 +9,8 @@
 #define SIPHASH_H
 
 #include <cstdint>
-#include "Crypto.h"
+#include <cstddef>
 
-#if !OPENSSL_SIPHASH
 namespace i2p
 {
 namespace crypto 
@@ -148,8 +147,76 @@ namespace crypto
         b = v0 ^ v1 ^ v2 ^ v3;
         siphash::u64to8le(b, h + 8);
     }
+
+    /** Siphash-2-4 of single 64-bit word, 8 bytes hash */
+    inline uint64_t Siphash24(uint64_t k0, uint64_t k1, uint64_t msg)
+    {
+        uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+        uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+        uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+        uint64_t v3 = 0x7465646279746573ULL ^ k1;
+        const uint64_t b = ((uint64_t)8) << 56;
+        v3 ^= msg;
+        siphash::round(v0, v1, v2, v3);
+        siphash::round(v0, v1, v2, v3);
+        v0 ^= msg;
+        v3 ^= b;
+        siphash::round(v0, v1, v2, v3);
+        siphash::round(v0, v1, v2, v3);
+        v0 ^= b;
+        v2 ^= 0xff;
+        siphash::round(v0, v1, v2, v3);
+        siphash::round(v0, v1, v2, v3);
+        siphash::round(v0, v1, v2, v3);
+        siphash::round(v0, v1, v2, v3);
+        return v0 ^ v1 ^ v2 ^ v3;
+    }
+
+    const std::size_t SIPHASH_LENGTH_MASKS_RING_SIZE = 8;
+
+    /** NTCP2 frame length obfuscation, every next IV is Siphash-2-4 of previous IV */
+    class SiphashLengthMasks
+    {
+        public:
+
+            SiphashLengthMasks(): m_K0 (0), m_K1 (0), m_IV (0), m_Index (SIPHASH_LENGTH_MASKS_RING_SIZE) {};
+
+            /** key is 16 bytes, iv is 8 bytes */
+            void Init(const uint8_t * key, const uint8_t * iv)
+            {
+                m_K0 = siphash::u8to64le(key);
+                m_K1 = siphash::u8to64le(key + 8);
+                m_IV = siphash::u8to64le(iv);
+                m_Index = SIPHASH_LENGTH_MASKS_RING_SIZE;
+            }
+
+            /** 2 first bytes of next IV as little endian */
+            uint16_t GetNext()
+            {
+                if (m_Index >= SIPHASH_LENGTH_MASKS_RING_SIZE) Fill();
+                return m_Masks[m_Index++];
+            }
+
+        private:
+
+            void Fill()
+            {
+                // precompute next masks at once
+                for (std::size_t i = 0; i < SIPHASH_LENGTH_MASKS_RING_SIZE; i++)
+                {
+                    m_IV = Siphash24(m_K0, m_K1, m_IV);
+                    m_Masks[i] = (uint16_t)m_IV;
+                }
+                m_Index = 0;
+            }
+
+        private:
+
+            uint64_t m_K0, m_K1, m_IV;
+            uint16_t m_Masks[SIPHASH_LENGTH_MASKS_RING_SIZE];
+            std::size_t m_Index;
+    };
 }
 }
-#endif
 
 #endif
@@ -1,11 +1,14 @@
+#include <cmath>
 #include "Crypto.h"
 #include "Log.h"
+#include "Config.h"
 #include "RouterInfo.h"
 #include "RouterContext.h"
 #include "Tunnel.h"
 #include "Timestamp.h"
 #include "Destination.h"
 #include "Streaming.h"
+#include "Metrics.h"
 
 namespace i2p
 {
@@ -13,7 +16,25 @@ namespace stream
 {
 	void SendBufferQueue::Add (const uint8_t * buf, size_t len, SendHandler handler)
 	{
-		m_Buffers.push_back (std::make_shared<SendBuffer>(buf, len, handler));
+		ReserveRing (len);
+		WriteToRing (buf, len);
+		m_Buffers.emplace_back (nullptr, len, handler);
+		m_Size += len;
+	}
+
+	void SendBufferQueue::Add (const std::vector<boost::asio::const_buffer>& buffers, SendHandler handler)
+	{
+		size_t len = boost::asio::buffer_size (buffers);
+		ReserveRing (len);
+		for (const auto& it: buffers)
+			WriteToRing (boost::asio::buffer_cast<const uint8_t *>(it), boost::asio::buffer_size (it));
+		m_Buffers.emplace_back (nullptr, len, handler);
+		m_Size += len;
+	}
+
+	void SendBufferQueue::AddNoCopy (const uint8_t * buf, size_t len, SendHandler handler)
+	{
+		m_Buffers.emplace_back (buf, len, handler);
 		m_Size += len;
 	}
 
@@ -22,25 +43,28 @@ namespace stream
 		size_t offset = 0;
 		while (!m_Buffers.empty () && offset < len)
 		{
-			auto nextBuffer = m_Buffers.front ();
-			auto rem = nextBuffer->GetRemainingSize ();
-			if (offset + rem <= len)
-			{
-				// whole buffer
-				memcpy (buf + offset, nextBuffer->GetRemaningBuffer (), rem);
-				offset += rem;
-				m_Buffers.pop_front (); // delete it
-			}
+			auto& nextBuffer = m_Buffers.front ();
+			auto rem = std::min (nextBuffer.GetRemainingSize (), len - offset);
+			if (nextBuffer.buf)
+				memcpy (buf + offset, nextBuffer.buf + nextBuffer.offset, rem);
 			else
+				ReadFromRing (buf + offset, rem);
+			nextBuffer.offset += rem;
+			offset += rem;
+			if (!nextBuffer.GetRemainingSize ())
 			{
-				// partially
-				rem =  len - offset;
-				memcpy (buf + offset, nextBuffer->GetRemaningBuffer (), len - offset);
-				nextBuffer->offset += (len - offset);
-				offset = len; // break
+				// whole buffer
+				auto handler = nextBuffer.handler;
+				m_Buffers.pop_front ();
+				if (handler) handler (boost::system::error_code ());
 			}
 		}
 		m_Size -= offset;
+		if (m_Buffers.empty () && m_Ring.size () > SEND_BUFFER_QUEUE_MAX_IDLE_RING_SIZE)
+		{
+			std::vector<uint8_t>().swap (m_Ring);
+			m_RingHead = 0; m_RingSize = 0;
+		}
 		return offset;
 	}
 
@@ -48,36 +72,84 @@ namespace stream
 	{
 		if (!m_Buffers.empty ())
 		{
-			for (auto it: m_Buffers)
-				it->Cancel ();
+			for (auto& it: m_Buffers)
+				it.Cancel ();
 			m_Buffers.clear ();
 			m_Size = 0;
 		}
+		std::vector<uint8_t>().swap (m_Ring);
+		m_RingHead = 0; m_RingSize = 0;
+	}
+
+	void SendBufferQueue::ReserveRing (size_t len)
+	{
+		if (m_RingSize + len <= m_Ring.size ()) return;
+		size_t size = m_Ring.size () ? m_Ring.size () : SEND_BUFFER_QUEUE_MIN_RING_SIZE;
+		while (size < m_RingSize + len) size <<= 1;
+		std::vector<uint8_t> ring (size);
+		auto ringSize = m_RingSize;
+		ReadFromRing (ring.data (), ringSize);
+		m_Ring.swap (ring);
+		m_RingHead = 0; m_RingSize = ringSize;
+	}
+
+	void SendBufferQueue::WriteToRing (const uint8_t * buf, size_t len)
+	{
+		if (!len) return;
+		size_t mask = m_Ring.size () - 1, tail = (m_RingHead + m_RingSize) & mask;
+		size_t l = std::min (len, m_Ring.size () - tail);
+		memcpy (m_Ring.data () + tail, buf, l);
+		if (l < len) memcpy (m_Ring.data (), buf + l, len - l); // wrap around
+		m_RingSize += len;
+	}
+
+	void SendBufferQueue::ReadFromRing (uint8_t * buf, size_t len)
+	{
+		if (!len) return;
+		size_t l = std::min (len, m_Ring.size () - m_RingHead);
+		memcpy (buf, m_Ring.data () + m_RingHead, l);
+		if (l < len) memcpy (buf + l, m_Ring.data (), len - l); // wrap around
+		m_RingHead = (m_RingHead + len) & (m_Ring.size () - 1);
+		m_RingSize -= len;
+		if (!m_RingSize) m_RingHead = 0;
 	}
 
 	Stream::Stream (boost::asio::io_service& service, StreamingDestination& local,
 		std::shared_ptr<const i2p::data::LeaseSet> remote, int port): m_Service (service),
 		m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1),
-		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local),
+		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_IsChoking (false), m_IsChoked (false), m_LocalDestination (local),
 		m_RemoteLeaseSet (remote), m_ReceiveTimer (m_Service), m_ResendTimer (m_Service),
-		m_AckSendTimer (m_Service),  m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (port),
+		m_AckSendTimer (m_Service), m_SendTimer (m_Service), m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (port),
 		m_WindowSize (MIN_WINDOW_SIZE), m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO),
 		m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
-		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0)
+		m_IsCoalescing (local.GetOwner ()->IsStreamingCoalescing ()),
+		m_Compression (local.GetOwner ()->GetStreamingCompression ()),
+		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0),
+		m_CongestionControl (local.GetOwner ()->GetStreamingCongestionControl ()),
+		m_SlowStartThreshold (MAX_CUBIC_WINDOW_SIZE), m_CubicWindowMax (0), m_CubicK (0), m_WindowSizeFraction (0),
+		m_CubicEpochStart (0), m_NextSendTime (0), m_IsSendScheduled (false), m_SynSentTime (0),
+		m_LastFastRetransmitTime (0), m_IsRTTMeasured (false), m_NumPaths (local.GetOwner ()->GetStreamingNumPaths ())
 	{
-		RAND_bytes ((uint8_t *)&m_RecvStreamID, 4);
+		m_RecvStreamID = i2p::crypto::RandUint32 ();
 		m_RemoteIdentity = remote->GetIdentity ();
+		InitFromMetrics ();
 	}
 
 	Stream::Stream (boost::asio::io_service& service, StreamingDestination& local):
 		m_Service (service), m_SendStreamID (0), m_SequenceNumber (0), m_LastReceivedSequenceNumber (-1),
-		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_LocalDestination (local),
-		m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service),
+		m_Status (eStreamStatusNew), m_IsAckSendScheduled (false), m_IsChoking (false), m_IsChoked (false), m_LocalDestination (local),
+		m_ReceiveTimer (m_Service), m_ResendTimer (m_Service), m_AckSendTimer (m_Service), m_SendTimer (m_Service),
 		m_NumSentBytes (0), m_NumReceivedBytes (0), m_Port (0),  m_WindowSize (MIN_WINDOW_SIZE),
 		m_RTT (INITIAL_RTT), m_RTO (INITIAL_RTO), m_AckDelay (local.GetOwner ()->GetStreamingAckDelay ()),
-		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0)
+		m_IsCoalescing (local.GetOwner ()->IsStreamingCoalescing ()),
+		m_Compression (local.GetOwner ()->GetStreamingCompression ()),
+		m_LastWindowSizeIncreaseTime (0), m_NumResendAttempts (0),
+		m_CongestionControl (local.GetOwner ()->GetStreamingCongestionControl ()),
+		m_SlowStartThreshold (MAX_CUBIC_WINDOW_SIZE), m_CubicWindowMax (0), m_CubicK (0), m_WindowSizeFraction (0),
+		m_CubicEpochStart (0), m_NextSendTime (0), m_IsSendScheduled (false), m_SynSentTime (0),
+		m_LastFastRetransmitTime (0), m_IsRTTMeasured (false), m_NumPaths (local.GetOwner ()->GetStreamingNumPaths ())
 	{
-		RAND_bytes ((uint8_t *)&m_RecvStreamID, 4);
+		m_RecvStreamID = i2p::crypto::RandUint32 ();
 	}
 
 	Stream::~Stream ()
@@ -91,20 +163,38 @@ namespace stream
 		m_AckSendTimer.cancel ();
 		m_ReceiveTimer.cancel ();
 		m_ResendTimer.cancel ();
+		m_SendTimer.cancel ();
 		//CleanUp (); /* Need to recheck - broke working on windows */
+		if (m_IsRTTMeasured && m_RemoteIdentity)
+			m_LocalDestination.UpdateStreamMetrics (m_RemoteIdentity->GetIdentHash (),
+				StreamMetrics{m_RTT, m_RTO, m_WindowSize, m_SlowStartThreshold, 0});
 		m_LocalDestination.DeleteStream (shared_from_this ());
 	}
 
+	void Stream::InitFromMetrics ()
+	{
+		StreamMetrics metrics;
+		if (m_RemoteIdentity && m_LocalDestination.GetStreamMetrics (m_RemoteIdentity->GetIdentHash (), metrics))
+		{
+			m_RTT = metrics.rtt;
+			m_RTO = metrics.rto;
+			m_WindowSize = metrics.windowSize;
+			m_SlowStartThreshold = metrics.slowStartThreshold;
+			LogPrint (eLogDebug, "Streaming: Warm start with rtt=", m_RTT, " window=", m_WindowSize);
+		}
+	}
+
 	void Stream::CleanUp ()
 	{
 		{
 			std::unique_lock<std::mutex> l(m_SendBufferMutex);
 			m_SendBuffer.CleanUp ();
 		}
+		if (m_MemoryBudget) m_MemoryBudget->Release (GetReceivedSize ());
 		while (!m_ReceiveQueue.empty ())
 		{
 			auto packet = m_ReceiveQueue.front ();
-			m_ReceiveQueue.pop ();
+			m_ReceiveQueue.pop_front ();
 			m_LocalDestination.DeletePacket (packet);
 		}
 
@@ -123,8 +213,20 @@ namespace stream
 		if (!m_SendStreamID)
 			m_SendStreamID = packet->GetReceiveStreamID ();
 
+		bool isUnchoked = false;
 		if (!packet->IsNoAck ()) // ack received
+		{
+			bool isChoked = packet->GetOptionalDelay () > 60000;
+			if (isChoked != m_IsChoked)
+			{
+				LogPrint (eLogDebug, "Streaming: ", isChoked ? "Choked" : "Unchoked", " by remote, sSID=", m_SendStreamID);
+				m_IsChoked = isChoked;
+				isUnchoked = !isChoked;
+				if (isUnchoked) m_NextSendTime = 0;
+			}
 			ProcessAck (packet);
+			if (isUnchoked) SendBuffer ();
+		}
 
 		int32_t receivedSeqn = packet->GetSeqn ();
 		bool isSyn = packet->IsSYN ();
@@ -139,21 +241,16 @@ namespace stream
 		LogPrint (eLogDebug, "Streaming: Received seqn=", receivedSeqn, " on sSID=", m_SendStreamID);
 		if (receivedSeqn == m_LastReceivedSequenceNumber + 1)
 		{
+			bool isRequest = isSyn && packet->GetPayload () < packet->GetBuffer () + packet->GetLength (); // 0-RTT, data with SYN
 			// we have received next in sequence message
 			ProcessPacket (packet);
 
 			// we should also try stored messages if any
-			for (auto it = m_SavedPackets.begin (); it != m_SavedPackets.end ();)
+			while (!m_SavedPackets.empty ())
 			{
-				if ((*it)->GetSeqn () == (uint32_t)(m_LastReceivedSequenceNumber + 1))
-				{
-					Packet * savedPacket = *it;
-					m_SavedPackets.erase (it++);
-
-					ProcessPacket (savedPacket);
-				}
-				else
-					break;
+				Packet * savedPacket = m_SavedPackets.Remove (m_LastReceivedSequenceNumber + 1);
+				if (!savedPacket) break;
+				ProcessPacket (savedPacket);
 			}
 
 			// schedule ack for last message
@@ -170,8 +267,19 @@ namespace stream
 				}
 			}
 			else if (isSyn)
+			{
 				// we have to send SYN back to incoming connection
-				SendBuffer (); // also sets m_IsOpen
+				if (isRequest && !m_IsAckSendScheduled)
+				{
+					// give acceptor a chance to send response with it
+					m_IsAckSendScheduled = true;
+					m_AckSendTimer.expires_from_now (boost::posix_time::milliseconds(std::min (SYN_REPLY_DELAY, m_AckDelay)));
+					m_AckSendTimer.async_wait (std::bind (&Stream::HandleAckSendTimer,
+						shared_from_this (), std::placeholders::_1));
+				}
+				else
+					SendBuffer (); // also sets m_IsOpen
+			}
 		}
 		else
 		{
@@ -211,7 +319,7 @@ namespace stream
 
 	void Stream::SavePacket (Packet * packet)
 	{
-		if (!m_SavedPackets.insert (packet).second)
+		if (!m_SavedPackets.Insert (packet, MAX_SAVED_PACKETS_SPAN))
 			m_LocalDestination.DeletePacket (packet);
 	}
 
@@ -240,6 +348,7 @@ namespace stream
 			optionData += m_RemoteIdentity->GetFullLen ();
 			if (!m_RemoteLeaseSet)
 				LogPrint (eLogDebug, "Streaming: Incoming stream from ", m_RemoteIdentity->GetIdentHash ().ToBase64 (), ", sSID=", m_SendStreamID, ", rSID=", m_RecvStreamID);
+			if (m_Status == eStreamStatusNew) InitFromMetrics (); // incoming
 		}
 
 		if (flags & PACKET_FLAG_MAX_PACKET_SIZE_INCLUDED)
@@ -275,7 +384,13 @@ namespace stream
 		packet->offset = packet->GetPayload () - packet->buf;
 		if (packet->GetLength () > 0)
 		{
-			m_ReceiveQueue.push (packet);
+			if (m_SynSentTime)
+			{
+				i2p::metrics::streamFirstDataTime.Observe (i2p::util::GetMillisecondsSinceEpoch () - m_SynSentTime);
+				m_SynSentTime = 0;
+			}
+			m_ReceiveQueue.push_back (packet);
+			if (m_MemoryBudget) m_MemoryBudget->Acquire (packet->GetLength ());
 			m_ReceiveTimer.cancel ();
 		}
 		else
@@ -309,59 +424,85 @@ namespace stream
 			return;
 		}
 		int nackCount = packet->GetNACKCount ();
-		for (auto it = m_SentPackets.begin (); it != m_SentPackets.end ();)
+		std::vector<Packet *> nackedPackets;
+		uint64_t lastAckedSendTime = 0;
+		for (uint32_t seqn = m_SentPackets.GetFirstSeqn (); !m_SentPackets.empty () && seqn <= ackThrough && seqn <= m_SentPackets.GetLastSeqn (); seqn++)
 		{
-			auto seqn = (*it)->GetSeqn ();
-			if (seqn <= ackThrough)
+			if (!m_SentPackets.Get (seqn)) continue; // acknowledged before
+			if (nackCount > 0)
 			{
-				if (nackCount > 0)
-				{
-					bool nacked = false;
-					for (int i = 0; i < nackCount; i++)
-						if (seqn == packet->GetNACK (i))
-						{
-							nacked = true;
-							break;
-						}
-					if (nacked)
+				bool nacked = false;
+				for (int i = 0; i < nackCount; i++)
+					if (seqn == packet->GetNACK (i))
 					{
-						LogPrint (eLogDebug, "Streaming: Packet ", seqn, " NACK");
-						++it;
-						continue;
+						nacked = true;
+						break;
 					}
-				}
-				auto sentPacket = *it;
-				uint64_t rtt = ts - sentPacket->sendTime;
-				if(ts < sentPacket->sendTime)
+				if (nacked)
 				{
-					LogPrint(eLogError, "Streaming: Packet ", seqn, "sent from the future, sendTime=", sentPacket->sendTime);
-					rtt = 1;
+					LogPrint (eLogDebug, "Streaming: Packet ", seqn, " NACK");
+					auto nackedPacket = m_SentPackets.Get (seqn);
+					nackedPacket->numNacks++;
+					nackedPackets.push_back (nackedPacket);
+					continue;
 				}
-				m_RTT = (m_RTT*seqn + rtt)/(seqn + 1);
-				m_RTO = m_RTT*1.5; // TODO: implement it better
-				LogPrint (eLogDebug, "Streaming: Packet ", seqn, " acknowledged rtt=", rtt, " sentTime=", sentPacket->sendTime);
-				m_SentPackets.erase (it++);
-				m_LocalDestination.DeletePacket (sentPacket);
-				acknowledged = true;
-				if (m_WindowSize < WINDOW_SIZE)
-					m_WindowSize++; // slow start
-				else
-				{
-					// linear growth
-					if (ts > m_LastWindowSizeIncreaseTime + m_RTT)
-					{
-						m_WindowSize++;
-						if (m_WindowSize > MAX_WINDOW_SIZE) m_WindowSize = MAX_WINDOW_SIZE;
-						m_LastWindowSizeIncreaseTime = ts;
-					}
-				}
-				if (!seqn && m_RoutingSession) // first message confirmed
+			}
+			auto sentPacket = m_SentPackets.Remove (seqn);
+			if (sentPacket->sendTime > lastAckedSendTime) lastAckedSendTime = sentPacket->sendTime;
+			uint64_t rtt = ts - sentPacket->sendTime;
+			if(ts < sentPacket->sendTime)
+			{
+				LogPrint(eLogError, "Streaming: Packet ", seqn, "sent from the future, sendTime=", sentPacket->sendTime);
+				rtt = 1;
+			}
+			m_RTT = (m_RTT*seqn + rtt)/(seqn + 1);
+			m_RTO = m_RTT*1.5; // TODO: implement it better
+			m_IsRTTMeasured = true;
+			auto outboundTunnel = m_CurrentOutboundTunnel; // packet was sent through
+			auto remoteLease = m_CurrentRemoteLease;
+			if (sentPacket->path < m_Paths.size ())
+			{
+				auto& path = m_Paths[sentPacket->path];
+				path.rtt = (path.rtt*7 + (int)rtt)/8;
+				path.numLosses = 0;
+				outboundTunnel = path.outboundTunnel;
+				remoteLease = path.remoteLease;
+			}
+			if (outboundTunnel) outboundTunnel->SetConfirmed (ts/1000); // alive, no test needed
+			LogPrint (eLogDebug, "Streaming: Packet ", seqn, " acknowledged rtt=", rtt, " sentTime=", sentPacket->sendTime);
+			m_LocalDestination.DeletePacket (sentPacket);
+			acknowledged = true;
+			IncreaseWindowSize (ts);
+			if (m_RoutingSession)
+			{
+				if (!seqn) // first message confirmed
 					m_RoutingSession->SetSharedRoutingPath (
 						std::make_shared<i2p::garlic::GarlicRoutingPath> (
-							i2p::garlic::GarlicRoutingPath{m_CurrentOutboundTunnel, m_CurrentRemoteLease, m_RTT, 0, 0}));
+							i2p::garlic::GarlicRoutingPath{m_CurrentOutboundTunnel, m_CurrentRemoteLease, m_RTT, 0, 0, 0}));
+				else
+					m_RoutingSession->ConfirmSharedRoutingPath (outboundTunnel, remoteLease, rtt);
 			}
-			else
-				break;
+		}
+		// fast retransmit, if NACKed several times or sent well before acknowledged one,
+		// rather than wait for RTO
+		std::vector<Packet *> lostPackets;
+		for (auto it: nackedPackets)
+			if (it->numNacks >= FAST_RETRANSMIT_NACK_THRESHOLD || it->sendTime + m_RTT/4 < lastAckedSendTime)
+			{
+				if (it->path < m_Paths.size ()) m_Paths[it->path].numLosses++;
+				it->numNacks = 0;
+				it->sendTime = ts;
+				lostPackets.push_back (it);
+			}
+		if (!lostPackets.empty ())
+		{
+			LogPrint (eLogDebug, "Streaming: Fast retransmit of ", lostPackets.size (), " packets, sSID=", m_SendStreamID);
+			if (ts > m_LastFastRetransmitTime + m_RTT) // once per round trip
+			{
+				DecreaseWindowSize ();
+				m_LastFastRetransmitTime = ts;
+			}
+			SendPackets (lostPackets);
 		}
 		if (m_SentPackets.empty ())
 			m_ResendTimer.cancel ();
@@ -376,6 +517,84 @@ namespace stream
 			Close (); // check is all outgoing messages have been sent and we can send close
 	}
 
+	void Stream::IncreaseWindowSize (uint64_t ts)
+	{
+		if (m_CongestionControl == eStreamingCongestionControlCubic)
+		{
+			if (m_WindowSize < m_SlowStartThreshold)
+				m_WindowSize++; // slow start, doubles every RTT
+			else
+			{
+				if (!m_CubicEpochStart)
+				{
+					// first ack after loss
+					m_CubicEpochStart = ts;
+					if (m_CubicWindowMax > m_WindowSize)
+						m_CubicK = std::cbrt ((m_CubicWindowMax - m_WindowSize)/CUBIC_C);
+					else
+					{
+						m_CubicK = 0;
+						m_CubicWindowMax = m_WindowSize;
+					}
+				}
+				double t = (ts - m_CubicEpochStart + m_RTT)/1000.0; // in seconds
+				double target = CUBIC_C*(t - m_CubicK)*(t - m_CubicK)*(t - m_CubicK) + m_CubicWindowMax;
+				// don't grow slower than Reno would
+				double renoTarget = m_CubicWindowMax*CUBIC_BETA + 3*(1 - CUBIC_BETA)/(1 + CUBIC_BETA)*(ts - m_CubicEpochStart)/(m_RTT > 0 ? m_RTT : 1);
+				if (target < renoTarget) target = renoTarget;
+				if (target > 1.5*m_WindowSize) target = 1.5*m_WindowSize;
+				if (target > m_WindowSize)
+				{
+					// reach target in one RTT
+					m_WindowSizeFraction += (target - m_WindowSize)/m_WindowSize;
+					if (m_WindowSizeFraction >= 1)
+					{
+						int inc = m_WindowSizeFraction;
+						m_WindowSize += inc;
+						m_WindowSizeFraction -= inc;
+					}
+				}
+			}
+			if (m_WindowSize > MAX_CUBIC_WINDOW_SIZE) m_WindowSize = MAX_CUBIC_WINDOW_SIZE;
+		}
+		else
+		{
+			if (m_WindowSize < WINDOW_SIZE)
+				m_WindowSize++; // slow start
+			else
+			{
+				// linear growth
+				if (ts > m_LastWindowSizeIncreaseTime + m_RTT)
+				{
+					m_WindowSize++;
+					if (m_WindowSize > MAX_WINDOW_SIZE) m_WindowSize = MAX_WINDOW_SIZE;
+					m_LastWindowSizeIncreaseTime = ts;
+				}
+			}
+		}
+	}
+
+	void Stream::DecreaseWindowSize ()
+	{
+		if (m_CongestionControl == eStreamingCongestionControlCubic)
+		{
+			if (m_WindowSize < m_CubicWindowMax)
+				m_CubicWindowMax = m_WindowSize*(1 + CUBIC_BETA)/2; // fast convergence, release bandwidth for others
+			else
+				m_CubicWindowMax = m_WindowSize;
+			m_WindowSize *= CUBIC_BETA;
+			if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
+			m_SlowStartThreshold = m_WindowSize;
+			m_CubicEpochStart = 0;
+			m_WindowSizeFraction = 0;
+		}
+		else
+		{
+			m_WindowSize /= 2;
+			if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
+		}
+	}
+
 	size_t Stream::Send (const uint8_t * buf, size_t len)
 	{
 		size_t sent = len;
@@ -401,12 +620,61 @@ namespace stream
 		m_Service.post (std::bind (&Stream::SendBuffer, shared_from_this ()));
 	}
 
+	void Stream::AsyncSend (const std::vector<boost::asio::const_buffer>& buffers, SendHandler handler)
+	{
+		if (boost::asio::buffer_size (buffers) > 0)
+		{
+			std::unique_lock<std::mutex> l(m_SendBufferMutex);
+			m_SendBuffer.Add (buffers, handler);
+		}
+		else if (handler)
+			 handler(boost::system::error_code ());
+		m_Service.post (std::bind (&Stream::SendBuffer, shared_from_this ()));
+	}
+
+	void Stream::AsyncSendNoCopy (const uint8_t * buf, size_t len, SendHandler handler)
+	{
+		if (len > 0 && buf)
+		{
+			std::unique_lock<std::mutex> l(m_SendBufferMutex);
+			m_SendBuffer.AddNoCopy (buf, len, handler);
+		}
+		else if (handler)
+			 handler(boost::system::error_code ());
+		m_Service.post (std::bind (&Stream::SendBuffer, shared_from_this ()));
+	}
+
 	void Stream::SendBuffer ()
 	{
 		int numMsgs = m_WindowSize - m_SentPackets.size ();
 		if (numMsgs <= 0) return; // window is full
+		bool isChoked = m_IsChoked && m_Status != eStreamStatusNew;
+		if (isChoked)
+		{
+			// receiver is over its memory, one packet per RTO to learn when we are unchoked
+			if (!m_SentPackets.empty ()) return;
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			if (ts < m_NextSendTime)
+			{
+				ScheduleSend (m_NextSendTime - ts);
+				return;
+			}
+			numMsgs = 1;
+		}
+		bool isPaced = !isChoked && m_CongestionControl == eStreamingCongestionControlCubic && m_Status != eStreamStatusNew;
+		if (isPaced)
+		{
+			auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+			if (ts < m_NextSendTime)
+			{
+				ScheduleSend (m_NextSendTime - ts);
+				return;
+			}
+			if (numMsgs > PACING_MAX_BURST) numMsgs = PACING_MAX_BURST;
+		}
 
 		bool isNoAck = m_LastReceivedSequenceNumber < 0; // first packet
+		if (!isNoAck) m_IsChoking = IsChokeNeeded (); // data packets carry acks too
 		std::vector<Packet *> packets;
 		{
 			std::unique_lock<std::mutex> l(m_SendBufferMutex);
@@ -435,6 +703,8 @@ namespace stream
 				{
 					//  initial packet
 					m_Status = eStreamStatusOpen;
+					if (m_LastReceivedSequenceNumber < 0) // outgoing
+						m_SynSentTime = i2p::util::GetMillisecondsSinceEpoch ();
 					uint16_t flags = PACKET_FLAG_SYNCHRONIZE | PACKET_FLAG_FROM_INCLUDED |
 						PACKET_FLAG_SIGNATURE_INCLUDED | PACKET_FLAG_MAX_PACKET_SIZE_INCLUDED;
 					if (isNoAck) flags |= PACKET_FLAG_NO_ACK;
@@ -457,10 +727,22 @@ namespace stream
 				else
 				{
 					// follow on packet
-					htobuf16 (packet + size, 0);
-					size += 2; // flags
-					htobuf16 (packet + size, 0); // no options
-					size += 2; // options size
+					if (m_IsChoking)
+					{
+						htobe16buf (packet + size, PACKET_FLAG_DELAY_REQUESTED);
+						size += 2; // flags
+						htobe16buf (packet + size, 2);
+						size += 2; // options size
+						htobe16buf (packet + size, STREAMING_CHOKE_DELAY);
+						size += 2; // optional delay
+					}
+					else
+					{
+						htobuf16 (packet + size, 0);
+						size += 2; // flags
+						htobuf16 (packet + size, 0); // no options
+						size += 2; // options size
+					}
 					size += m_SendBuffer.Get(packet + size, STREAMING_MTU - size); // payload
 				}
 				p->len = size;
@@ -480,22 +762,48 @@ namespace stream
 			for (auto& it: packets)
 			{
 				it->sendTime = ts;
-				m_SentPackets.insert (it);
+				m_SentPackets.Insert (it);
 			}
 			SendPackets (packets);
 			if (m_Status == eStreamStatusClosing && m_SendBuffer.IsEmpty ())
 				SendClose ();
 			if (isEmpty)
 				ScheduleResend ();
+			if (isChoked)
+				m_NextSendTime = ts + m_RTO;
+			if (isPaced)
+			{
+				// spread window over RTT, faster in slow start to let it grow
+				int interval = (m_WindowSize < m_SlowStartThreshold) ? m_RTT/(2*m_WindowSize) : m_RTT*4/(5*m_WindowSize);
+				m_NextSendTime = ts + packets.size ()*interval;
+				if (interval > 0 && !numMsgs && (int)m_SentPackets.size () < m_WindowSize)
+					ScheduleSend (packets.size ()*interval); // burst limit reached
+			}
 		}
 	}
 
+	void Stream::ScheduleSend (int delay)
+	{
+		if (m_IsSendScheduled) return;
+		m_IsSendScheduled = true;
+		m_SendTimer.expires_from_now (boost::posix_time::milliseconds(delay));
+		m_SendTimer.async_wait (std::bind (&Stream::HandleSendTimer,
+			shared_from_this (), std::placeholders::_1));
+	}
+
+	void Stream::HandleSendTimer (const boost::system::error_code& ecode)
+	{
+		m_IsSendScheduled = false;
+		if (ecode != boost::asio::error::operation_aborted)
+			SendBuffer ();
+	}
+
 	void Stream::SendQuickAck ()
 	{
 		int32_t lastReceivedSeqn = m_LastReceivedSequenceNumber;
 		if (!m_SavedPackets.empty ())
 		{
-			int32_t seqn = (*m_SavedPackets.rbegin ())->GetSeqn ();
+			int32_t seqn = m_SavedPackets.GetLastSeqn ();
 			if (seqn > lastReceivedSeqn) lastReceivedSeqn = seqn;
 		}
 		if (lastReceivedSeqn < 0)
@@ -504,7 +812,7 @@ namespace stream
 			return;
 		}
 
-		Packet p;
+		FullPacket p; // up to 255 NACKs
 		uint8_t * packet = p.GetBuffer ();
 		size_t size = 0;
 		htobe32buf (packet + size, m_SendStreamID);
@@ -549,10 +857,24 @@ namespace stream
 			size++; // NACK count
 		}
 		size++; // resend delay
-		htobuf16 (packet + size, 0); // nof flags set
-		size += 2; // flags
-		htobuf16 (packet + size, 0); // no options
-		size += 2; // options size
+		m_IsChoking = IsChokeNeeded ();
+		if (m_IsChoking)
+		{
+			// remote keeps packets in flight, but doesn't send more until next ack without delay
+			htobe16buf (packet + size, PACKET_FLAG_DELAY_REQUESTED);
+			size += 2; // flags
+			htobe16buf (packet + size, 2);
+			size += 2; // options size
+			htobe16buf (packet + size, STREAMING_CHOKE_DELAY);
+			size += 2; // optional delay
+		}
+		else
+		{
+			htobuf16 (packet + size, 0); // nof flags set
+			size += 2; // flags
+			htobuf16 (packet + size, 0); // no options
+			size += 2; // options size
+		}
 		p.len = size;
 
 		SendPackets (std::vector<Packet *> { &p });
@@ -592,7 +914,8 @@ namespace stream
 
 	void Stream::SendClose ()
 	{
-		Packet * p = m_LocalDestination.NewPacket ();
+		size_t signatureLen = m_LocalDestination.GetOwner ()->GetIdentity ()->GetSignatureLen ();
+		Packet * p = m_LocalDestination.NewPacket (22 + signatureLen); // header without NACKs and options size
 		uint8_t * packet = p->GetBuffer ();
 		size_t size = 0;
 		htobe32buf (packet + size, m_SendStreamID);
@@ -608,7 +931,6 @@ namespace stream
 		size++; // resend delay
 		htobe16buf (packet + size, PACKET_FLAG_CLOSE | PACKET_FLAG_SIGNATURE_INCLUDED);
 		size += 2; // flags
-		size_t signatureLen = m_LocalDestination.GetOwner ()->GetIdentity ()->GetSignatureLen ();
 		htobe16buf (packet + size, signatureLen); // signature only
 		size += 2; // options size
 		uint8_t * signature = packet + size;
@@ -633,13 +955,70 @@ namespace stream
 			packet->offset += l;
 			if (!packet->GetLength ())
 			{
-				m_ReceiveQueue.pop ();
+				m_ReceiveQueue.pop_front ();
 				m_LocalDestination.DeletePacket (packet);
 			}
 		}
+		ReleaseReceived (pos);
+		return pos;
+	}
+
+	size_t Stream::GetReceivedBuffers (std::vector<boost::asio::const_buffer>& buffers, size_t len) const
+	{
+		buffers.clear ();
+		size_t pos = 0;
+		for (auto it = m_ReceiveQueue.begin (); it != m_ReceiveQueue.end () && pos < len; ++it)
+		{
+			size_t l = std::min ((*it)->GetLength (), len - pos);
+			buffers.push_back (boost::asio::const_buffer ((*it)->GetBuffer (), l));
+			pos += l;
+		}
 		return pos;
 	}
 
+	size_t Stream::GetReceivedSize () const
+	{
+		size_t size = 0;
+		for (auto it: m_ReceiveQueue)
+			size += it->GetLength ();
+		return size;
+	}
+
+	void Stream::ConsumeReceived (size_t len)
+	{
+		size_t consumed = 0;
+		while (len > 0 && !m_ReceiveQueue.empty ())
+		{
+			Packet * packet = m_ReceiveQueue.front ();
+			size_t l = std::min (packet->GetLength (), len);
+			packet->offset += l;
+			len -= l;
+			consumed += l;
+			if (!packet->GetLength ())
+			{
+				m_ReceiveQueue.pop_front ();
+				m_LocalDestination.DeletePacket (packet);
+			}
+		}
+		ReleaseReceived (consumed);
+	}
+
+	void Stream::SetMemoryBudget (std::shared_ptr<MemoryBudget> budget)
+	{
+		auto size = GetReceivedSize ();
+		if (m_MemoryBudget) m_MemoryBudget->Release (size);
+		m_MemoryBudget = budget;
+		if (m_MemoryBudget) m_MemoryBudget->Acquire (size);
+	}
+
+	void Stream::ReleaseReceived (size_t len)
+	{
+		if (!m_MemoryBudget || !len) return;
+		m_MemoryBudget->Release (len);
+		if (m_IsChoking && !IsChokeNeeded () && m_Status == eStreamStatusOpen)
+			SendQuickAck (); // unchoke
+	}
+
 	bool Stream::SendPacket (Packet * packet)
 	{
 		if (packet)
@@ -651,7 +1030,7 @@ namespace stream
 			}
 			SendPackets (std::vector<Packet *> { packet });
 			bool isEmpty = m_SentPackets.empty ();
-			m_SentPackets.insert (packet);
+			m_SentPackets.Insert (packet);
 			if (isEmpty)
 				ScheduleResend ();
 			return true;
@@ -662,6 +1041,19 @@ namespace stream
 
 	void Stream::SendPackets (const std::vector<Packet *>& packets)
 	{
+		if (m_RemoteIdentity)
+		{
+			auto loopback = m_LocalDestination.GetOwner ()->GetLoopbackDestination (m_RemoteIdentity->GetIdentHash ());
+			if (loopback) // in-process, bypass garlic and tunnels
+			{
+				for (auto it: packets)
+				{
+					loopback->SendLoopbackMessage (m_LocalDestination.CreateDataMessage (it->GetBuffer (), it->GetLength (), m_Port, false));
+					m_NumSentBytes += it->GetLength ();
+				}
+				return;
+			}
+		}
 		if (!m_RemoteLeaseSet)
 		{
 			UpdateCurrentRemoteLease ();
@@ -699,19 +1091,21 @@ namespace stream
 			UpdateCurrentRemoteLease (true);
 		if (m_CurrentRemoteLease && ts < m_CurrentRemoteLease->endDate + i2p::data::LEASE_ENDDATE_THRESHOLD)
 		{
-			std::vector<i2p::tunnel::TunnelMessageBlock> msgs;
-			for (auto it: packets)
+			if (m_NumPaths > 1 && m_SendStreamID) // stripe data packets after SYN is acknowledged
 			{
-				auto msg = m_RoutingSession->WrapSingleMessage (m_LocalDestination.CreateDataMessage (it->GetBuffer (), it->GetLength (), m_Port));
-				msgs.push_back (i2p::tunnel::TunnelMessageBlock
-					{
-						i2p::tunnel::eDeliveryTypeTunnel,
-						m_CurrentRemoteLease->tunnelGateway, m_CurrentRemoteLease->tunnelID,
-						msg
-					});
-				m_NumSentBytes += it->GetLength ();
+				UpdatePaths ();
+				std::vector<std::vector<Packet *> > packetsByPath (m_Paths.size ());
+				for (auto it: packets)
+				{
+					it->path = it->GetSeqn () ? SelectPath () : 0; // plain acks through current path
+					packetsByPath[it->path].push_back (it);
+				}
+				for (size_t i = 0; i < packetsByPath.size (); i++)
+					if (!packetsByPath[i].empty ())
+						SendPacketsThrough (packetsByPath[i], m_Paths[i].outboundTunnel, m_Paths[i].remoteLease);
 			}
-			m_CurrentOutboundTunnel->SendTunnelDataMsg (msgs);
+			else
+				SendPacketsThrough (packets, m_CurrentOutboundTunnel, m_CurrentRemoteLease);
 		}
 		else
 		{
@@ -721,6 +1115,45 @@ namespace stream
 		}
 	}
 
+	void Stream::SendPacketsThrough (const std::vector<Packet *>& packets,
+		std::shared_ptr<i2p::tunnel::OutboundTunnel> outboundTunnel, std::shared_ptr<const i2p::data::Lease> remoteLease)
+	{
+		std::vector<i2p::tunnel::TunnelMessageBlock> msgs;
+		auto addGarlic = [&msgs, &remoteLease](std::shared_ptr<I2NPMessage> msg)
+			{
+				msgs.push_back (i2p::tunnel::TunnelMessageBlock
+					{
+						i2p::tunnel::eDeliveryTypeTunnel,
+						remoteLease->tunnelGateway, remoteLease->tunnelID,
+						msg
+					});
+			};
+		std::vector<std::shared_ptr<const I2NPMessage> > cloves; // coalesced into one garlic
+		size_t clovesSize = 0;
+		for (auto it: packets)
+		{
+			auto msg = CreateDataMessage (it->GetBuffer (), it->GetLength ());
+			m_NumSentBytes += it->GetLength ();
+			if (!m_IsCoalescing)
+			{
+				addGarlic (m_RoutingSession->WrapSingleMessage (msg));
+				continue;
+			}
+			size_t cloveSize = msg->GetLength () + GARLIC_CLOVE_OVERHEAD;
+			if (!cloves.empty () && clovesSize + cloveSize > MAX_COALESCED_CLOVES_SIZE)
+			{
+				addGarlic (m_RoutingSession->WrapMessages (cloves));
+				cloves.clear ();
+				clovesSize = 0;
+			}
+			cloves.push_back (msg);
+			clovesSize += cloveSize;
+		}
+		if (!cloves.empty ())
+			addGarlic (m_RoutingSession->WrapMessages (cloves));
+		outboundTunnel->SendTunnelDataMsg (msgs);
+	}
+
 	void Stream::SendUpdatedLeaseSet ()
 	{
 		if (m_RoutingSession)
@@ -777,6 +1210,8 @@ namespace stream
 				if (ts >= it->sendTime + m_RTO)
 				{
 					it->sendTime = ts;
+					it->numNacks = 0;
+					if (it->path < m_Paths.size ()) m_Paths[it->path].numLosses++;
 					packets.push_back (it);
 				}
 			}
@@ -789,8 +1224,7 @@ namespace stream
 				switch (m_NumResendAttempts)
 				{
 					case 1: // congesion avoidance
-						m_WindowSize /= 2;
-						if (m_WindowSize < MIN_WINDOW_SIZE) m_WindowSize = MIN_WINDOW_SIZE;
+						DecreaseWindowSize ();
 					break;
 					case 2:
 						m_RTO = INITIAL_RTO; // drop RTO to initial upon tunnels pair change first time
@@ -825,6 +1259,13 @@ namespace stream
 				Close ();
 				return;
 			}
+			if (m_Status == eStreamStatusNew)
+			{
+				// no response to SYN with data yet, send SYN back alone
+				m_IsAckSendScheduled = false;
+				SendBuffer ();
+				return;
+			}
 			if (m_Status == eStreamStatusOpen)
 			{
 				if (m_RoutingSession && m_RoutingSession->IsLeaseSetNonConfirmed ())
@@ -876,7 +1317,7 @@ namespace stream
 				}
 				if (!updated)
 				{
-					uint32_t i = rand () % leases.size ();
+					uint32_t i = i2p::crypto::RandUint32 () % leases.size ();
 					if (m_CurrentRemoteLease && leases[i]->tunnelID == m_CurrentRemoteLease->tunnelID)
 						// make sure we don't select previous
 						i = (i + 1) % leases.size (); // if so, pick next
@@ -898,11 +1339,88 @@ namespace stream
 		}
 	}
 
+	void Stream::UpdatePaths ()
+	{
+		if ((int)m_Paths.size () < m_NumPaths)
+			m_Paths.resize (m_NumPaths, Path{nullptr, nullptr, m_RTT, 0, 0});
+		auto& current = m_Paths[0];
+		if (current.outboundTunnel != m_CurrentOutboundTunnel || current.remoteLease != m_CurrentRemoteLease)
+			current = Path{m_CurrentOutboundTunnel, m_CurrentRemoteLease, m_RTT, 0, 0};
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		std::vector<std::shared_ptr<const i2p::data::Lease> > leases;
+		for (size_t i = 1; i < m_Paths.size (); i++)
+		{
+			auto& path = m_Paths[i];
+			if (path.outboundTunnel && path.outboundTunnel->IsEstablished () &&
+				path.remoteLease && path.remoteLease->endDate && // not excluded from LeaseSet
+				ts < path.remoteLease->endDate - i2p::data::LEASE_ENDDATE_THRESHOLD &&
+				path.numLosses < STREAMING_PATH_MAX_LOSSES)
+				continue;
+			// replace by another tunnel and lease, not used by other paths if possible
+			path = Path{m_LocalDestination.GetOwner ()->GetTunnelPool ()->GetNextOutboundTunnel (m_CurrentOutboundTunnel),
+				nullptr, m_RTT, 0, 0};
+			if (leases.empty () && m_RemoteLeaseSet)
+				leases = m_RemoteLeaseSet->GetNonExpiredLeases (false);
+			for (const auto& lease: leases)
+			{
+				bool used = false;
+				for (const auto& it: m_Paths)
+					if (it.remoteLease && it.remoteLease->tunnelID == lease->tunnelID &&
+						it.remoteLease->tunnelGateway == lease->tunnelGateway)
+					{
+						used = true;
+						break;
+					}
+				if (!used)
+				{
+					path.remoteLease = lease;
+					break;
+				}
+			}
+			if (!path.remoteLease && !leases.empty ())
+				path.remoteLease = leases[i2p::crypto::RandUint32 () % leases.size ()];
+		}
+	}
+
+	int Stream::SelectPath ()
+	{
+		int selected = 0; // current is always set
+		double total = 0;
+		for (size_t i = 0; i < m_Paths.size (); i++)
+		{
+			auto& path = m_Paths[i];
+			if (!path.outboundTunnel || !path.remoteLease) continue;
+			double weight = 1000.0/(path.rtt > 0 ? path.rtt : 1)/(1 + path.numLosses);
+			path.currentWeight += weight;
+			total += weight;
+			if (path.currentWeight > m_Paths[selected].currentWeight) selected = i;
+		}
+		m_Paths[selected].currentWeight -= total;
+		return selected;
+	}
+
+	std::shared_ptr<I2NPMessage> Stream::CreateDataMessage (const uint8_t * payload, size_t len)
+	{
+		if (m_Compression != eStreamingCompressionAuto || len <= COMPRESSION_THRESHOLD_SIZE)
+			return m_LocalDestination.CreateDataMessage (payload, len, m_Port, m_Compression != eStreamingCompressionOff);
+		if (m_IncompressibleSkipper.Skip ())
+			return m_LocalDestination.CreateDataMessage (payload, len, m_Port, false);
+		auto msg = m_LocalDestination.CreateDataMessage (payload, len, m_Port, true);
+		if (msg) m_IncompressibleSkipper.Compressed (len, bufbe32toh (msg->GetPayload ()));
+		return msg;
+	}
+
 	StreamingDestination::StreamingDestination (std::shared_ptr<i2p::client::ClientDestination> owner, uint16_t localPort, bool gzip):
 		m_Owner (owner), m_LocalPort (localPort), m_Gzip (gzip),
 		m_LastIncomingReceiveStreamID (0),
 		m_PendingIncomingTimer (m_Owner->GetService ())
 	{
+		bool lowMemory = false; i2p::config::GetOption("lowmemory", lowMemory);
+		if (lowMemory)
+		{
+			m_PacketsPool.SetMaxNumFree (LOW_MEMORY_MAX_NUM_FREE_PACKETS);
+			m_SmallPacketsPool.SetMaxNumFree (LOW_MEMORY_MAX_NUM_FREE_PACKETS);
+		}
 	}
 
 	StreamingDestination::~StreamingDestination ()
@@ -925,9 +1443,10 @@ namespace stream
 		m_PendingIncomingTimer.cancel ();
 		m_PendingIncomingStreams.clear ();
 		{
-			std::unique_lock<std::mutex> l(m_StreamsMutex);
+			i2p::metrics::ProfiledLock l(m_StreamsMutex);
 			m_Streams.clear ();
 		}
+		m_IncomingStreams.clear ();
 	}
 
 	void StreamingDestination::HandleNextPacket (Packet * packet)
@@ -958,6 +1477,8 @@ namespace stream
 				}
 				auto incomingStream = CreateNewIncomingStream ();
 				incomingStream->HandleNextPacket (packet); // SYN
+				if (m_Streams.count (incomingStream->GetRecvStreamID ())) // not terminated by SYN
+					m_IncomingStreams[receiveStreamID] = incomingStream;
 				auto ident = incomingStream->GetRemoteIdentity();
 			 
 				m_LastIncomingReceiveStreamID = receiveStreamID;
@@ -998,13 +1519,13 @@ namespace stream
 			else // follow on packet without SYN
 			{
 				uint32_t receiveStreamID = packet->GetReceiveStreamID ();
-				for (auto& it: m_Streams)
-					if (it.second->GetSendStreamID () == receiveStreamID)
-					{
-						// found
-						it.second->HandleNextPacket (packet);
-						return;
-					}
+				auto it1 = m_IncomingStreams.find (receiveStreamID);
+				if (it1 != m_IncomingStreams.end ())
+				{
+					// found
+					it1->second->HandleNextPacket (packet);
+					return;
+				}
 				// save follow on packet
 				auto it = m_SavedPackets.find (receiveStreamID);
 				if (it != m_SavedPackets.end ())
@@ -1036,15 +1557,20 @@ namespace stream
 	std::shared_ptr<Stream> StreamingDestination::CreateNewOutgoingStream (std::shared_ptr<const i2p::data::LeaseSet> remote, int port)
 	{
 		auto s = std::make_shared<Stream> (m_Owner->GetService (), *this, remote, port);
-		std::unique_lock<std::mutex> l(m_StreamsMutex);
-		m_Streams[s->GetRecvStreamID ()] = s;
+		// may be called from other thread, added before stream sends anything since sending is posted too
+		auto dest = shared_from_this ();
+		m_Owner->GetService ().post ([dest, s](void)
+			{
+				i2p::metrics::ProfiledLock l(dest->m_StreamsMutex);
+				dest->m_Streams[s->GetRecvStreamID ()] = s;
+			});
 		return s;
 	}
 
 	std::shared_ptr<Stream> StreamingDestination::CreateNewIncomingStream ()
 	{
 		auto s = std::make_shared<Stream> (m_Owner->GetService (), *this);
-		std::unique_lock<std::mutex> l(m_StreamsMutex);
+		i2p::metrics::ProfiledLock l(m_StreamsMutex);
 		m_Streams[s->GetRecvStreamID ()] = s;
 		return s;
 	}
@@ -1053,13 +1579,57 @@ namespace stream
 	{
 		if (stream)
 		{
-			std::unique_lock<std::mutex> l(m_StreamsMutex);
-			auto it = m_Streams.find (stream->GetRecvStreamID ());
-			if (it != m_Streams.end ())
-				m_Streams.erase (it);
+			{
+				i2p::metrics::ProfiledLock l(m_StreamsMutex);
+				m_Streams.erase (stream->GetRecvStreamID ());
+			}
+			auto it = m_IncomingStreams.find (stream->GetSendStreamID ());
+			if (it != m_IncomingStreams.end () && it->second == stream)
+				m_IncomingStreams.erase (it);
 		}
 	}
 
+	void StreamingDestination::UpdateStreamMetrics (const i2p::data::IdentHash& remote, const StreamMetrics& metrics)
+	{
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(m_StreamMetricsMutex);
+		if (m_StreamMetrics.size () >= MAX_NUM_STREAM_METRICS && !m_StreamMetrics.count (remote))
+		{
+			for (auto it = m_StreamMetrics.begin (); it != m_StreamMetrics.end ();)
+			{
+				if (ts > it->second.updateTime + STREAM_METRICS_EXPIRATION_TIMEOUT)
+					it = m_StreamMetrics.erase (it);
+				else
+					++it;
+			}
+			if (m_StreamMetrics.size () >= MAX_NUM_STREAM_METRICS) return; // all recent
+		}
+		auto& m = m_StreamMetrics[remote];
+		m = metrics;
+		m.updateTime = ts;
+	}
+
+	bool StreamingDestination::GetStreamMetrics (const i2p::data::IdentHash& remote, StreamMetrics& metrics) const
+	{
+		std::unique_lock<std::mutex> l(m_StreamMetricsMutex);
+		auto it = m_StreamMetrics.find (remote);
+		if (it == m_StreamMetrics.end () ||
+			i2p::util::GetSecondsSinceEpoch () > it->second.updateTime + STREAM_METRICS_EXPIRATION_TIMEOUT)
+			return false;
+		metrics = it->second;
+		return true;
+	}
+
+	std::vector<std::shared_ptr<const Stream> > StreamingDestination::GetStreams () const
+	{
+		std::vector<std::shared_ptr<const Stream> > streams;
+		i2p::metrics::ProfiledLock l(m_StreamsMutex);
+		streams.reserve (m_Streams.size ());
+		for (const auto& it: m_Streams)
+			streams.push_back (it.second);
+		return streams;
+	}
+
 	void StreamingDestination::SetAcceptor (const Acceptor& acceptor)
 	{
 		m_Acceptor = acceptor; // we must set it immediately for IsAcceptorSet
@@ -1123,16 +1693,25 @@ namespace stream
 		Packet * uncompressed = NewPacket ();
 		uncompressed->offset = 0;
 		uncompressed->len = m_Inflator.Inflate (buf, len, uncompressed->buf, MAX_PACKET_SIZE);
+		if (uncompressed->len && uncompressed->len <= SMALL_PACKET_SIZE)
+		{
+			// acks and control packets may stay in queues, don't hold full buffer for them
+			Packet * p = NewPacket (uncompressed->len);
+			memcpy (p->buf, uncompressed->buf, uncompressed->len);
+			p->len = uncompressed->len;
+			DeletePacket (uncompressed);
+			uncompressed = p;
+		}
 		if (uncompressed->len)
 			HandleNextPacket (uncompressed);
 		else
 			DeletePacket (uncompressed);
 	}
 
-	std::shared_ptr<I2NPMessage> StreamingDestination::CreateDataMessage (const uint8_t * payload, size_t len, uint16_t toPort)
+	std::shared_ptr<I2NPMessage> StreamingDestination::CreateDataMessage (const uint8_t * payload, size_t len, uint16_t toPort, bool compress)
 	{
 		auto msg = NewI2NPShortMessage ();
-		if (!m_Gzip || len <= i2p::stream::COMPRESSION_THRESHOLD_SIZE)
+		if (!m_Gzip || !compress || len <= i2p::stream::COMPRESSION_THRESHOLD_SIZE)
 			m_Deflator.SetCompressionLevel (Z_NO_COMPRESSION);
 		else
 			m_Deflator.SetCompressionLevel (Z_DEFAULT_COMPRESSION);
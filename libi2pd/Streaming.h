@@ -4,11 +4,16 @@
 #include <inttypes.h>
 #include <string>
 #include <map>
+#include <unordered_map>
 #include <set>
+#include <vector>
+#include <algorithm>
 #include <queue>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <atomic>
 #include <boost/asio.hpp>
 #include "Base.h"
 #include "I2PEndian.h"
@@ -18,6 +23,8 @@
 #include "Garlic.h"
 #include "Tunnel.h"
 #include "util.h" // MemoryPool
+#include "Metrics.h"
+#include "Gzip.h"
 
 namespace i2p
 {
@@ -41,25 +48,44 @@ namespace stream
 
 	const size_t STREAMING_MTU = 1730;
 	const size_t MAX_PACKET_SIZE = 4096;
+	const size_t SMALL_PACKET_SIZE = 640; // acks and control packets, fits FIN with largest signature
 	const size_t COMPRESSION_THRESHOLD_SIZE = 66;
 	const int MAX_NUM_RESEND_ATTEMPTS = 6;
+	const uint16_t STREAMING_CHOKE_DELAY = 60001; // optional delay above 60000 milliseconds means choke
 	const int WINDOW_SIZE = 6; // in messages
 	const int MIN_WINDOW_SIZE = 1;
 	const int MAX_WINDOW_SIZE = 128;
+	const int MAX_CUBIC_WINDOW_SIZE = 512; // in messages
+	const double CUBIC_BETA = 0.7; // window is multiplied by on loss
+	const double CUBIC_C = 0.4; // scaling constant, in messages/seconds^3
+	const int PACING_MAX_BURST = 4; // in messages
+	const size_t MAX_COALESCED_CLOVES_SIZE = 2*i2p::tunnel::TUNNEL_DATA_MAX_PAYLOAD_SIZE; // packets per garlic message
+	const size_t GARLIC_CLOVE_OVERHEAD = 48; // delivery instructions, cloveID, expiration and certificate
 	const int INITIAL_RTT = 8000; // in milliseconds
 	const int INITIAL_RTO = 9000; // in milliseconds
 	const int SYN_TIMEOUT = 200; // how long we wait for SYN after follow-on, in milliseconds
+	const int SYN_REPLY_DELAY = 50; // how long SYN back waits for response to SYN with data, in milliseconds
 	const size_t MAX_PENDING_INCOMING_BACKLOG = 128;
 	const int PENDING_INCOMING_TIMEOUT = 10; // in seconds
 	const int MAX_RECEIVE_TIMEOUT = 30; // in seconds
+	const int MAX_STREAMING_PATHS = 4; // outbound tunnel and remote lease pairs used at once
+	const int STREAMING_PATH_MAX_LOSSES = 3; // in a row, then additional path is replaced
+	const int FAST_RETRANSMIT_NACK_THRESHOLD = 2; // packet is resent without waiting for RTO after this many NACKs
+	const int STREAM_METRICS_EXPIRATION_TIMEOUT = 600; // in seconds, metrics of previous stream to same remote destination
+	const size_t MAX_NUM_STREAM_METRICS = 1024; // remote destinations remembered
 
 	struct Packet
 	{
 		size_t len, offset;
-		uint8_t buf[MAX_PACKET_SIZE];
+		uint8_t * buf; // points to PacketBuffer's storage
+		size_t maxLen;
 		uint64_t sendTime;
+		uint8_t path; // index of stream's path it was sent through
+		uint8_t numNacks; // since last sent
 
-		Packet (): len (0), offset (0), sendTime (0) {};
+		Packet (uint8_t * b, size_t max): len (0), offset (0), buf (b), maxLen (max), sendTime (0), path (0), numNacks (0) {};
+		Packet (const Packet&) = delete;
+		Packet& operator= (const Packet&) = delete;
 		uint8_t * GetBuffer () { return buf + offset; };
 		size_t GetLength () const { return len - offset; };
 
@@ -74,50 +100,158 @@ namespace stream
 		uint16_t GetOptionSize () const { return bufbe16toh (GetOption ()); };
 		const uint8_t * GetOptionData () const { return GetOption () + 2; };
 		const uint8_t * GetPayload () const { return GetOptionData () + GetOptionSize (); };
+		uint16_t GetOptionalDelay () const { return (GetFlags () & PACKET_FLAG_DELAY_REQUESTED) && GetOptionSize () >= 2 ? bufbe16toh (GetOptionData ()) : 0; };
 
 		bool IsSYN () const { return GetFlags () & PACKET_FLAG_SYNCHRONIZE; };
 		bool IsNoAck () const { return GetFlags () & PACKET_FLAG_NO_ACK; };
 	};
 
-	struct PacketCmp
+	// bytes received by streams but not consumed yet, shared by streams of a tunnel
+	class MemoryBudget
 	{
-		bool operator() (const Packet * p1, const Packet * p2) const
-		{
-			return p1->GetSeqn () < p2->GetSeqn ();
-		};
+		public:
+
+			MemoryBudget (size_t limit): m_Limit (limit), m_Used (0) {};
+
+			void Acquire (size_t len) { m_Used += len; };
+			void Release (size_t len) { m_Used -= len; };
+			bool IsExceeded () const { return m_Used >= m_Limit; };
+			size_t GetLimit () const { return m_Limit; };
+			size_t GetUsed () const { return m_Used; };
+
+		private:
+
+			size_t m_Limit;
+			std::atomic<size_t> m_Used;
+	};
+
+	template<size_t sz>
+	struct PacketBuffer: public Packet
+	{
+		PacketBuffer (): Packet (storage, sz) {};
+		uint8_t storage[sz];
+	};
+	typedef PacketBuffer<MAX_PACKET_SIZE> FullPacket;
+	typedef PacketBuffer<SMALL_PACKET_SIZE> SmallPacket;
+
+	const size_t LOW_MEMORY_MAX_NUM_FREE_PACKETS = 64; // per pool of destination, default is 1024
+	const size_t PACKETS_WINDOW_INITIAL_CAPACITY = 16; // power of 2
+	const size_t MAX_SAVED_PACKETS_SPAN = 2*MAX_CUBIC_WINDOW_SIZE; // out of order packets further ahead are dropped
+
+	/** packets ordered by sequence number, stored in ring buffer indexed by seqn */
+	class PacketsWindow
+	{
+		public:
+
+			class const_iterator // skips empty slots
+			{
+				public:
+
+					const_iterator (const PacketsWindow& window, uint32_t seqn): m_Window (window), m_Seqn (seqn) {};
+					Packet * operator* () const { return m_Window.Get (m_Seqn); };
+					const_iterator& operator++ ()
+					{
+						do m_Seqn++; while (m_Seqn < m_Window.m_EndSeqn && !m_Window.Get (m_Seqn));
+						return *this;
+					}
+					bool operator!= (const const_iterator& other) const { return m_Seqn != other.m_Seqn; };
+
+				private:
+
+					const PacketsWindow& m_Window;
+					uint32_t m_Seqn;
+			};
+
+			PacketsWindow (): m_Packets (PACKETS_WINDOW_INITIAL_CAPACITY, nullptr), m_FirstSeqn (0), m_EndSeqn (0), m_Size (0) {};
+
+			size_t size () const { return m_Size; };
+			bool empty () const { return !m_Size; };
+			const_iterator begin () const { return const_iterator (*this, m_FirstSeqn); };
+			const_iterator end () const { return const_iterator (*this, m_EndSeqn); };
+			uint32_t GetFirstSeqn () const { return m_FirstSeqn; };
+			uint32_t GetLastSeqn () const { return m_EndSeqn - 1; }; // valid if not empty
+
+			Packet * Get (uint32_t seqn) const
+			{
+				if (seqn < m_FirstSeqn || seqn >= m_EndSeqn) return nullptr;
+				return m_Packets[seqn & (m_Packets.size () - 1)];
+			}
+
+			bool Insert (Packet * packet, size_t maxSpan = 0) // false if already exists or too far away
+			{
+				uint32_t seqn = packet->GetSeqn ();
+				uint32_t firstSeqn = m_Size ? std::min (m_FirstSeqn, seqn) : seqn;
+				uint32_t endSeqn = m_Size ? std::max (m_EndSeqn, seqn + 1) : seqn + 1;
+				if (maxSpan && endSeqn - firstSeqn > maxSpan) return false;
+				if (Get (seqn)) return false;
+				if (endSeqn - firstSeqn > m_Packets.size ())
+				{
+					size_t capacity = m_Packets.size ();
+					while (capacity < endSeqn - firstSeqn) capacity <<= 1;
+					std::vector<Packet *> packets (capacity, nullptr);
+					for (uint32_t i = m_FirstSeqn; i < m_EndSeqn; i++)
+						packets[i & (capacity - 1)] = Get (i);
+					m_Packets.swap (packets);
+				}
+				m_FirstSeqn = firstSeqn; m_EndSeqn = endSeqn;
+				m_Packets[seqn & (m_Packets.size () - 1)] = packet;
+				m_Size++;
+				return true;
+			}
+
+			Packet * Remove (uint32_t seqn)
+			{
+				auto packet = Get (seqn);
+				if (!packet) return nullptr;
+				m_Packets[seqn & (m_Packets.size () - 1)] = nullptr;
+				m_Size--;
+				if (!m_Size)
+					m_FirstSeqn = m_EndSeqn = 0;
+				else
+				{
+					while (!Get (m_FirstSeqn)) m_FirstSeqn++;
+					while (!Get (m_EndSeqn - 1)) m_EndSeqn--;
+				}
+				return packet;
+			}
+
+			void clear ()
+			{
+				std::fill (m_Packets.begin (), m_Packets.end (), nullptr);
+				m_FirstSeqn = m_EndSeqn = 0; m_Size = 0;
+			}
+
+		private:
+
+			std::vector<Packet *> m_Packets; // size is power of 2
+			uint32_t m_FirstSeqn, m_EndSeqn; // [first, end)
+			size_t m_Size;
 	};
 
 	typedef std::function<void (const boost::system::error_code& ecode)> SendHandler;
 	struct SendBuffer
 	{
-		uint8_t * buf;
+		const uint8_t * buf; // caller's buffer, nullptr if data is in queue's ring
 		size_t len, offset;
 		SendHandler handler;
 
-		SendBuffer (const uint8_t * b, size_t l, SendHandler h):
-			len(l), offset (0), handler(h)
-		{
-			buf = new uint8_t[len];
-			memcpy (buf, b, len);
-		}
-		~SendBuffer ()
-		{
-			delete[] buf;
-			if (handler) handler(boost::system::error_code ());
-		}
+		SendBuffer (const uint8_t * b, size_t l, SendHandler h): buf (b), len (l), offset (0), handler (h) {};
 		size_t GetRemainingSize () const { return len - offset; };
-		const uint8_t * GetRemaningBuffer () const { return buf + offset; };
 		void Cancel () { if (handler) handler (boost::asio::error::make_error_code (boost::asio::error::operation_aborted)); handler = nullptr; };
 	};
 
+	const size_t SEND_BUFFER_QUEUE_MIN_RING_SIZE = 4096; // power of 2
+	const size_t SEND_BUFFER_QUEUE_MAX_IDLE_RING_SIZE = 65536; // release bigger ring if queue becomes empty
 	class SendBufferQueue
 	{
 		public:
 
-			SendBufferQueue (): m_Size (0) {};
+			SendBufferQueue (): m_Size (0), m_RingHead (0), m_RingSize (0) {};
 			~SendBufferQueue () { CleanUp (); };
 
-			void Add (const uint8_t * buf, size_t len, SendHandler handler);
+			void Add (const uint8_t * buf, size_t len, SendHandler handler); // copied to ring
+			void Add (const std::vector<boost::asio::const_buffer>& buffers, SendHandler handler); // gathered to ring
+			void AddNoCopy (const uint8_t * buf, size_t len, SendHandler handler); // buf must be valid until handler is called
 			size_t Get (uint8_t * buf, size_t len);
 			size_t GetSize () const { return m_Size; };
 			bool IsEmpty () const { return m_Buffers.empty (); };
@@ -125,8 +259,29 @@ namespace stream
 
 		private:
 
-			std::list<std::shared_ptr<SendBuffer> > m_Buffers;
+			void WriteToRing (const uint8_t * buf, size_t len);
+			void ReadFromRing (uint8_t * buf, size_t len);
+			void ReserveRing (size_t len);
+
+		private:
+
+			std::deque<SendBuffer> m_Buffers;
 			size_t m_Size;
+			std::vector<uint8_t> m_Ring; // size is power of 2
+			size_t m_RingHead, m_RingSize; // occupied [head, head + size)
+	};
+
+	enum StreamingCongestionControl
+	{
+		eStreamingCongestionControlReno = 0,
+		eStreamingCongestionControlCubic // with pacing
+	};
+
+	enum StreamingCompression
+	{
+		eStreamingCompressionOff = 0,
+		eStreamingCompressionAuto, // stored while payloads don't compress
+		eStreamingCompressionOn
 	};
 
 	enum StreamStatus
@@ -139,6 +294,12 @@ namespace stream
 	};
 
 	class StreamingDestination;
+	struct StreamMetrics // measured by last closed stream, new stream starts from
+	{
+		int rtt, rto, windowSize, slowStartThreshold;
+		uint64_t updateTime; // in seconds
+	};
+
 	class Stream: public std::enable_shared_from_this<Stream>
 	{
 		public:
@@ -160,10 +321,16 @@ namespace stream
 			void HandleNextPacket (Packet * packet);
 			size_t Send (const uint8_t * buf, size_t len);
 			void AsyncSend (const uint8_t * buf, size_t len, SendHandler handler);
+			void AsyncSend (const std::vector<boost::asio::const_buffer>& buffers, SendHandler handler);
+			void AsyncSendNoCopy (const uint8_t * buf, size_t len, SendHandler handler); // buf must be valid until handler is called
 
 			template<typename Buffer, typename ReceiveHandler>
-			void AsyncReceive (const Buffer& buffer, ReceiveHandler handler, int timeout = 0);
+			void AsyncReceive (const Buffer& buffer, ReceiveHandler handler, int timeout = 0); // empty buffer waits for data without copying
 			size_t ReadSome (uint8_t * buf, size_t len) { return ConcatenatePackets (buf, len); };
+			size_t GetReceivedBuffers (std::vector<boost::asio::const_buffer>& buffers, size_t len) const; // valid until ConsumeReceived
+			void ConsumeReceived (size_t len);
+			void AsyncConsumeReceived (size_t len) { m_Service.post (std::bind (&Stream::ConsumeReceived, shared_from_this (), len)); }; // from other threads
+			void SetMemoryBudget (std::shared_ptr<MemoryBudget> budget); // remote is choked while exceeded
 
 			void AsyncClose() { m_Service.post(std::bind(&Stream::Close, shared_from_this())); };
 
@@ -191,14 +358,22 @@ namespace stream
 			void SendClose ();
 			bool SendPacket (Packet * packet);
 			void SendPackets (const std::vector<Packet *>& packets);
+			void SendPacketsThrough (const std::vector<Packet *>& packets,
+				std::shared_ptr<i2p::tunnel::OutboundTunnel> outboundTunnel, std::shared_ptr<const i2p::data::Lease> remoteLease);
+			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len); // gzip level picked per stream
 			void SendUpdatedLeaseSet ();
 
 			void SavePacket (Packet * packet);
 			void ProcessPacket (Packet * packet);
 			void ProcessAck (Packet * packet);
 			size_t ConcatenatePackets (uint8_t * buf, size_t len);
+			size_t GetReceivedSize () const;
+			void ReleaseReceived (size_t len); // from memory budget
+			bool IsChokeNeeded () const { return m_MemoryBudget && m_MemoryBudget->IsExceeded () && !m_ReceiveQueue.empty (); }; // only streams not consumed yet
 
 			void UpdateCurrentRemoteLease (bool expired = false);
+			void UpdatePaths ();
+			int SelectPath (); // weighted by rtt and losses
 
 			template<typename Buffer, typename ReceiveHandler>
 			void HandleReceiveTimer (const boost::system::error_code& ecode, const Buffer& buffer, ReceiveHandler handler, int remainingTimeout);
@@ -206,6 +381,12 @@ namespace stream
 			void ScheduleResend ();
 			void HandleResendTimer (const boost::system::error_code& ecode);
 			void HandleAckSendTimer (const boost::system::error_code& ecode);
+			void ScheduleSend (int delay); // in milliseconds
+			void HandleSendTimer (const boost::system::error_code& ecode);
+
+			void IncreaseWindowSize (uint64_t ts); // on ack
+			void DecreaseWindowSize (); // on loss
+			void InitFromMetrics (); // of previous stream to same remote destination
 
 		private:
 
@@ -213,25 +394,48 @@ namespace stream
 			uint32_t m_SendStreamID, m_RecvStreamID, m_SequenceNumber;
 			int32_t m_LastReceivedSequenceNumber;
 			StreamStatus m_Status;
-			bool m_IsAckSendScheduled;
+			bool m_IsAckSendScheduled, m_IsChoking, m_IsChoked; // we choke remote, remote chokes us
 			StreamingDestination& m_LocalDestination;
 			std::shared_ptr<const i2p::data::IdentityEx> m_RemoteIdentity;
 			std::shared_ptr<const i2p::data::LeaseSet> m_RemoteLeaseSet;
 			std::shared_ptr<i2p::garlic::GarlicRoutingSession> m_RoutingSession;
 			std::shared_ptr<const i2p::data::Lease> m_CurrentRemoteLease;
 			std::shared_ptr<i2p::tunnel::OutboundTunnel> m_CurrentOutboundTunnel;
-			std::queue<Packet *> m_ReceiveQueue;
-			std::set<Packet *, PacketCmp> m_SavedPackets;
-			std::set<Packet *, PacketCmp> m_SentPackets;
-			boost::asio::deadline_timer m_ReceiveTimer, m_ResendTimer, m_AckSendTimer;
+			std::deque<Packet *> m_ReceiveQueue;
+			std::shared_ptr<MemoryBudget> m_MemoryBudget;
+			PacketsWindow m_SavedPackets;
+			PacketsWindow m_SentPackets;
+			boost::asio::deadline_timer m_ReceiveTimer, m_ResendTimer, m_AckSendTimer, m_SendTimer;
 			size_t m_NumSentBytes, m_NumReceivedBytes;
 			uint16_t m_Port;
 
 			std::mutex m_SendBufferMutex;
 			SendBufferQueue m_SendBuffer;
 			int m_WindowSize, m_RTT, m_RTO, m_AckDelay;
+			bool m_IsCoalescing;
+			StreamingCompression m_Compression;
+			i2p::data::IncompressibleSkipper m_IncompressibleSkipper;
 			uint64_t m_LastWindowSizeIncreaseTime;
 			int m_NumResendAttempts;
+			// congestion control
+			StreamingCongestionControl m_CongestionControl;
+			int m_SlowStartThreshold;
+			double m_CubicWindowMax, m_CubicK, m_WindowSizeFraction;
+			uint64_t m_CubicEpochStart, m_NextSendTime; // in milliseconds
+			bool m_IsSendScheduled;
+			uint64_t m_SynSentTime; // in milliseconds, until first data received
+			uint64_t m_LastFastRetransmitTime; // in milliseconds
+			bool m_IsRTTMeasured; // metrics are worth to save
+			// multipath
+			struct Path
+			{
+				std::shared_ptr<i2p::tunnel::OutboundTunnel> outboundTunnel;
+				std::shared_ptr<const i2p::data::Lease> remoteLease;
+				int rtt, numLosses; // in milliseconds, losses in a row
+				double currentWeight; // smooth weighted round robin
+			};
+			int m_NumPaths;
+			std::vector<Path> m_Paths; // 0 is current outbound tunnel and remote lease
 	};
 
 	class StreamingDestination: public std::enable_shared_from_this<StreamingDestination>
@@ -248,6 +452,8 @@ namespace stream
 
 			std::shared_ptr<Stream> CreateNewOutgoingStream (std::shared_ptr<const i2p::data::LeaseSet> remote, int port = 0);
 			void DeleteStream (std::shared_ptr<Stream> stream);
+			void UpdateStreamMetrics (const i2p::data::IdentHash& remote, const StreamMetrics& metrics);
+			bool GetStreamMetrics (const i2p::data::IdentHash& remote, StreamMetrics& metrics) const; // false if not known or expired
 			void SetAcceptor (const Acceptor& acceptor);
 			void ResetAcceptor ();
 			bool IsAcceptorSet () const { return m_Acceptor != nullptr; };
@@ -258,10 +464,23 @@ namespace stream
 			uint16_t GetLocalPort () const { return m_LocalPort; };
 
 			void HandleDataMessagePayload (const uint8_t * buf, size_t len);
-			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, uint16_t toPort);
+			std::shared_ptr<I2NPMessage> CreateDataMessage (const uint8_t * payload, size_t len, uint16_t toPort, bool compress = true);
 
-			Packet * NewPacket () { return m_PacketsPool.Acquire(); }
-			void DeletePacket (Packet * p) { return m_PacketsPool.Release(p); }
+			Packet * NewPacket (size_t size = MAX_PACKET_SIZE) // thread-safe, small packet if size fits
+			{
+				if (size <= SMALL_PACKET_SIZE) return m_SmallPacketsPool.AcquireMt ();
+				return m_PacketsPool.AcquireMt ();
+			}
+			void DeletePacket (Packet * p)
+			{
+				if (!p) return;
+				if (p->maxLen <= SMALL_PACKET_SIZE)
+					m_SmallPacketsPool.ReleaseMt (static_cast<SmallPacket *>(p));
+				else
+					m_PacketsPool.ReleaseMt (static_cast<FullPacket *>(p));
+			}
+			const i2p::util::MemoryPoolMt<FullPacket>& GetPacketsPool () const { return m_PacketsPool; };
+			const i2p::util::MemoryPoolMt<SmallPacket>& GetSmallPacketsPool () const { return m_SmallPacketsPool; };
 
 
 			void AcceptOnceAcceptor (std::shared_ptr<Stream> stream, Acceptor acceptor, Acceptor prev);
@@ -275,15 +494,20 @@ namespace stream
 			std::shared_ptr<i2p::client::ClientDestination> m_Owner;
 			uint16_t m_LocalPort;
 			bool m_Gzip; // gzip compression of data messages
-			std::mutex m_StreamsMutex;
-			std::map<uint32_t, std::shared_ptr<Stream> > m_Streams; // sendStreamID->stream
+			// changed and looked up in owner's thread only, mutex is for readers from other threads
+			mutable i2p::metrics::ProfiledMutex m_StreamsMutex { "streaming.streams" };
+			std::unordered_map<uint32_t, std::shared_ptr<Stream> > m_Streams; // sendStreamID->stream
+			std::unordered_map<uint32_t, std::shared_ptr<Stream> > m_IncomingStreams; // remote's receiveStreamID->stream, for follow on packets
 			Acceptor m_Acceptor;
 			uint32_t m_LastIncomingReceiveStreamID;
 			std::list<std::shared_ptr<Stream> > m_PendingIncomingStreams;
 			boost::asio::deadline_timer m_PendingIncomingTimer;
-			std::map<uint32_t, std::list<Packet *> > m_SavedPackets; // receiveStreamID->packets, arrived before SYN
+			std::unordered_map<uint32_t, std::list<Packet *> > m_SavedPackets; // receiveStreamID->packets, arrived before SYN
+			mutable std::mutex m_StreamMetricsMutex;
+			std::map<i2p::data::IdentHash, StreamMetrics> m_StreamMetrics;
 
-			i2p::util::MemoryPool<Packet> m_PacketsPool;
+			i2p::util::MemoryPoolMt<FullPacket> m_PacketsPool;
+			i2p::util::MemoryPoolMt<SmallPacket> m_SmallPacketsPool;
 
 		public:
 
@@ -291,7 +515,7 @@ namespace stream
 			i2p::data::GzipDeflator m_Deflator;
 
 			// for HTTP only
-			const decltype(m_Streams)& GetStreams () const { return m_Streams; };
+			std::vector<std::shared_ptr<const Stream> > GetStreams () const;
 	};
 
 //-------------------------------------------------
@@ -322,7 +546,9 @@ namespace stream
 	template<typename Buffer, typename ReceiveHandler>
 	void Stream::HandleReceiveTimer (const boost::system::error_code& ecode, const Buffer& buffer, ReceiveHandler handler, int remainingTimeout)
 	{
-		size_t received = ConcatenatePackets (boost::asio::buffer_cast<uint8_t *>(buffer), boost::asio::buffer_size(buffer));
+		size_t received = boost::asio::buffer_size(buffer) ?
+			ConcatenatePackets (boost::asio::buffer_cast<uint8_t *>(buffer), boost::asio::buffer_size(buffer)) :
+			GetReceivedSize ();
 		if (received > 0)
 			handler (boost::system::error_code (), received);
 		else if (ecode == boost::asio::error::operation_aborted)
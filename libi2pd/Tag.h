@@ -11,7 +11,9 @@
 
 #include <boost/static_assert.hpp>
 #include <string.h>
+#include <functional>
 #include <openssl/rand.h>
+#include "I2PEndian.h"
 #include "Base.h"
 
 namespace i2p {
@@ -27,9 +29,20 @@ public:
 	Tag () = default;
 	Tag (const uint8_t * buf) { memcpy (m_Buf, buf, sz); }
 
-	bool operator== (const Tag& other) const { return !memcmp (m_Buf, other.m_Buf, sz); }
+	bool operator== (const Tag& other) const
+	{
+		for (size_t i = 0; i < sz/8; i++)
+			if (ll[i] != other.ll[i]) return false;
+		return true;
+	}
 	bool operator!= (const Tag& other) const { return !(*this == other); }
-	bool operator< (const Tag& other) const { return memcmp (m_Buf, other.m_Buf, sz) < 0; }
+	bool operator< (const Tag& other) const
+	{
+		for (size_t i = 0; i < sz/8; i++)
+			if (ll[i] != other.ll[i])
+				return be64toh (ll[i]) < be64toh (other.ll[i]); // same order as memcmp
+		return false;
+	}
 
 	uint8_t * operator()() { return m_Buf; }
 	const uint8_t * operator()() const { return m_Buf; }
@@ -93,4 +106,14 @@ private:
 } // data
 } // i2p
 
+namespace std
+{
+	// tags are hashes or random, first 8 bytes are good enough
+	template<size_t sz>
+	struct hash<i2p::data::Tag<sz> >
+	{
+		size_t operator() (const i2p::data::Tag<sz>& tag) const { return tag.GetLL ()[0]; }
+	};
+}
+
 #endif /* TAG_H__ */
@@ -0,0 +1,134 @@
+#include "TimeWheel.h"
+
+namespace i2p
+{
+namespace util
+{
+	TimeWheel::TimeWheel (boost::asio::io_service& service):
+		m_Service (service), m_Timer (service), m_Slots (TIME_WHEEL_NUM_SLOTS),
+		m_CurrentSlot (0), m_LastID (0), m_TickGeneration (0), m_IsTicking (false), m_IsStopped (false)
+	{
+	}
+
+	TimeWheel::~TimeWheel ()
+	{
+		Stop ();
+	}
+
+	void TimeWheel::Start ()
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		m_IsStopped = false;
+	}
+
+	void TimeWheel::Stop ()
+	{
+		std::vector<Slot> slots (TIME_WHEEL_NUM_SLOTS);
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			m_IsStopped = true;
+			m_Slots.swap (slots);
+			m_Timers.clear ();
+			// pending tick might never be invoked if service stops, next Schedule after Start starts a new one
+			m_IsTicking = false;
+			m_TickGeneration++;
+		}
+		m_Timer.cancel ();
+		// handlers might hold owners whose destructors cancel timers, release them outside of the lock
+		slots.clear ();
+	}
+
+	TimeWheel::TimerID TimeWheel::Schedule (uint64_t delay, Handler handler)
+	{
+		bool startTicking = false;
+		TimerID id;
+		uint64_t generation;
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (m_IsStopped) return 0;
+			uint64_t ticks = delay/TIME_WHEEL_TICK + 1; // never expires earlier than requested
+			size_t slot = (m_CurrentSlot + ticks) % TIME_WHEEL_NUM_SLOTS;
+			id = ++m_LastID;
+			auto it = m_Slots[slot].insert (m_Slots[slot].end (), Entry{ id, (ticks - 1)/TIME_WHEEL_NUM_SLOTS, handler });
+			m_Timers.emplace (id, std::make_pair (slot, it));
+			if (!m_IsTicking)
+			{
+				m_IsTicking = true;
+				startTicking = true;
+			}
+			generation = m_TickGeneration;
+		}
+		if (startTicking)
+			m_Service.post (std::bind (&TimeWheel::ScheduleTick, this, generation)); // timer is touched from service's thread only
+		return id;
+	}
+
+	bool TimeWheel::Cancel (TimerID id)
+	{
+		Handler handler; // destroyed after unlock
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			auto it = m_Timers.find (id);
+			if (it == m_Timers.end ()) return false;
+			handler.swap (it->second.second->handler);
+			m_Slots[it->second.first].erase (it->second.second);
+			m_Timers.erase (it);
+		}
+		return true;
+	}
+
+	size_t TimeWheel::GetNumTimers () const
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		return m_Timers.size ();
+	}
+
+	void TimeWheel::ScheduleTick (uint64_t generation)
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		if (generation != m_TickGeneration) return; // stopped since posted
+		m_Timer.expires_from_now (boost::posix_time::milliseconds (TIME_WHEEL_TICK));
+		m_Timer.async_wait (std::bind (&TimeWheel::HandleTick, this, std::placeholders::_1, generation));
+	}
+
+	void TimeWheel::HandleTick (const boost::system::error_code& ecode, uint64_t generation)
+	{
+		std::vector<Handler> expired;
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (generation != m_TickGeneration) return; // stopped, Stop has reset m_IsTicking
+			if (ecode == boost::asio::error::operation_aborted || m_IsStopped)
+			{
+				m_IsTicking = false;
+				return;
+			}
+			m_CurrentSlot = (m_CurrentSlot + 1) % TIME_WHEEL_NUM_SLOTS;
+			auto& slot = m_Slots[m_CurrentSlot];
+			for (auto it = slot.begin (); it != slot.end ();)
+			{
+				if (!it->rounds)
+				{
+					expired.push_back (std::move (it->handler));
+					m_Timers.erase (it->id);
+					it = slot.erase (it);
+				}
+				else
+				{
+					it->rounds--;
+					++it;
+				}
+			}
+			if (!m_Timers.empty ())
+			{
+				// keep period regardless of handlers' execution time
+				m_Timer.expires_at (m_Timer.expires_at () + boost::posix_time::milliseconds (TIME_WHEEL_TICK));
+				m_Timer.async_wait (std::bind (&TimeWheel::HandleTick, this, std::placeholders::_1, generation));
+			}
+			else
+				m_IsTicking = false;
+		}
+		for (auto& it: expired)
+			it ();
+	}
+}
+}
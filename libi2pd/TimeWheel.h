@@ -0,0 +1,65 @@
+#ifndef TIME_WHEEL_H__
+#define TIME_WHEEL_H__
+
+#include <inttypes.h>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <boost/asio.hpp>
+
+namespace i2p
+{
+namespace util
+{
+	const int TIME_WHEEL_TICK = 100; // in milliseconds
+	const size_t TIME_WHEEL_NUM_SLOTS = 512; // one revolution is 51.2 seconds, longer delays count rounds
+
+	/** @brief hashed timing wheel, one deadline_timer per io_service drives all registered timers.
+	 *  Handlers are invoked in the service's thread, cancelled handlers are never invoked */
+	class TimeWheel
+	{
+		public:
+
+			typedef std::function<void ()> Handler;
+			typedef uint64_t TimerID; // 0 is never used
+
+			TimeWheel (boost::asio::io_service& service);
+			~TimeWheel ();
+
+			void Start (); // after Stop
+			void Stop (); // drops all handlers
+			TimerID Schedule (uint64_t delay, Handler handler); // delay in milliseconds, rounded up to tick
+			bool Cancel (TimerID id); // false if already expired or cancelled
+			size_t GetNumTimers () const;
+
+		private:
+
+			void ScheduleTick (uint64_t generation);
+			void HandleTick (const boost::system::error_code& ecode, uint64_t generation);
+
+		private:
+
+			struct Entry
+			{
+				TimerID id;
+				uint64_t rounds;
+				Handler handler;
+			};
+			typedef std::list<Entry> Slot;
+
+			boost::asio::io_service& m_Service;
+			boost::asio::deadline_timer m_Timer;
+			mutable std::mutex m_Mutex;
+			std::vector<Slot> m_Slots;
+			std::unordered_map<TimerID, std::pair<size_t, Slot::iterator> > m_Timers; // id -> slot, entry
+			size_t m_CurrentSlot;
+			TimerID m_LastID;
+			uint64_t m_TickGeneration; // incremented by Stop, ticks of previous generations are dropped
+			bool m_IsTicking, m_IsStopped;
+	};
+}
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <inttypes.h>
 #include <string.h>
+#include <time.h>
 #include <chrono>
 #include <future>
 #include <boost/asio.hpp>
@@ -7,6 +8,7 @@
 #include "Config.h"
 #include "Log.h"
 #include "I2PEndian.h"
+#include "util.h"
 #include "Timestamp.h"
 
 #ifdef WIN32
@@ -33,10 +35,25 @@ namespace util
 
 	static uint64_t GetLocalSecondsSinceEpoch ()
 	{
+#ifdef CLOCK_REALTIME_COARSE
+		struct timespec ts;
+		if (!clock_gettime (CLOCK_REALTIME_COARSE, &ts)) return ts.tv_sec;
+#endif
 		return std::chrono::duration_cast<std::chrono::seconds>(
 				 std::chrono::system_clock::now().time_since_epoch()).count ();
 	}
 
+	static uint64_t GetLocalCoarseMillisecondsSinceEpoch ()
+	{
+#ifdef CLOCK_REALTIME_COARSE
+		// updated every tick by kernel, not read from hardware
+		struct timespec ts;
+		if (!clock_gettime (CLOCK_REALTIME_COARSE, &ts))
+			return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+#endif
+		return GetLocalMillisecondsSinceEpoch ();
+	}
+
 
 	static int64_t g_TimeOffset = 0; // in seconds
 
@@ -133,11 +150,12 @@ namespace util
 
 	void NTPTimeSync::Run ()
 	{
+		i2p::util::InitThread ("NTP");
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "NTP");
 			}
 			catch (std::exception& ex)
 			{
@@ -169,6 +187,11 @@ namespace util
 		return GetLocalMillisecondsSinceEpoch () + g_TimeOffset*1000;
 	}
 
+	uint64_t GetCoarseMillisecondsSinceEpoch ()
+	{
+		return GetLocalCoarseMillisecondsSinceEpoch () + g_TimeOffset*1000;
+	}
+
 	uint32_t GetHoursSinceEpoch ()
 	{
 		return GetLocalHoursSinceEpoch () + g_TimeOffset/3600;
@@ -11,9 +11,10 @@ namespace i2p
 {
 namespace util
 {
-	uint64_t GetMillisecondsSinceEpoch ();
+	uint64_t GetMillisecondsSinceEpoch (); // exact, for RTT and timers
+	uint64_t GetCoarseMillisecondsSinceEpoch (); // within few milliseconds, cheaper, for expirations
 	uint32_t GetHoursSinceEpoch ();
-	uint64_t GetSecondsSinceEpoch ();
+	uint64_t GetSecondsSinceEpoch (); // coarse
 
 	class NTPTimeSync
 	{
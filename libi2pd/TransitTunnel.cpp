@@ -5,6 +5,7 @@
 #include "I2NPProtocol.h"
 #include "Tunnel.h"
 #include "Transports.h"
+#include "Metrics.h"
 #include "TransitTunnel.h"
 
 namespace i2p
@@ -25,18 +26,31 @@ namespace tunnel
 		i2p::transport::transports.UpdateTotalTransitTransmittedBytes (TUNNEL_DATA_MSG_SIZE);
 	}
 
+	void TransitTunnel::EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in,
+		const std::vector<std::shared_ptr<I2NPMessage> >& out)
+	{
+		auto num = in.size ();
+		std::vector<const uint8_t *> inBufs (num);
+		std::vector<uint8_t *> outBufs (num);
+		for (size_t i = 0; i < num; i++)
+		{
+			inBufs[i] = in[i]->GetPayload () + 4;
+			outBufs[i] = out[i]->GetPayload () + 4;
+		}
+		m_Encryption.Encrypt (inBufs.data (), outBufs.data (), num);
+		i2p::transport::transports.UpdateTotalTransitTransmittedBytes (num*TUNNEL_DATA_MSG_SIZE);
+	}
+
 	TransitTunnelParticipant::~TransitTunnelParticipant ()
 	{
 	}
 
 	void TransitTunnelParticipant::HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg)
 	{
-		auto newMsg = CreateEmptyTunnelDataMsg ();
-		EncryptTunnelMsg (tunnelMsg, newMsg);
-
 		m_NumTransmittedBytes += tunnelMsg->GetLength ();
-		htobe32buf (newMsg->GetPayload (), GetNextTunnelID ());
-		newMsg->FillI2NPMessageHeader (eI2NPTunnelData);
+		m_ReceivedTunnelDataMsgs.push_back (tunnelMsg);
+		auto newMsg = CreateEmptyTunnelDataMsg ();
+		newMsg->traceTime = tunnelMsg->traceTime;
 		m_TunnelDataMsgs.push_back (newMsg);
 	}
 
@@ -44,6 +58,23 @@ namespace tunnel
 	{
 		if (!m_TunnelDataMsgs.empty ())
 		{
+			if (i2p::transport::transports.IsPeerCongested (GetNextIdentHash ()))
+			{
+				// would be dropped by transports anyway, don't waste encryption
+				i2p::metrics::congestedDroppedMessages.Inc (m_TunnelDataMsgs.size ());
+				m_ReceivedTunnelDataMsgs.clear ();
+				m_TunnelDataMsgs.clear ();
+				return;
+			}
+			// encrypt all messages received since last flush at once
+			EncryptTunnelMsgs (m_ReceivedTunnelDataMsgs, m_TunnelDataMsgs);
+			m_ReceivedTunnelDataMsgs.clear ();
+			for (auto& it: m_TunnelDataMsgs)
+			{
+				htobe32buf (it->GetPayload (), GetNextTunnelID ());
+				it->FillI2NPMessageHeader (eI2NPTunnelData);
+				it->isTransit = true;
+			}
 			auto num = m_TunnelDataMsgs.size ();
 			if (num > 1)
 				LogPrint (eLogDebug, "TransitTunnel: ", GetTunnelID (), "->", GetNextTunnelID (), " ", num);
@@ -52,6 +83,16 @@ namespace tunnel
 		}
 	}
 
+	void TransitTunnelParticipant::Cleanup ()
+	{
+		// release capacity left by bursts, most transit tunnels are idle
+		if (m_TunnelDataMsgs.empty ())
+		{
+			std::vector<std::shared_ptr<const i2p::I2NPMessage> >().swap (m_ReceivedTunnelDataMsgs);
+			std::vector<std::shared_ptr<i2p::I2NPMessage> >().swap (m_TunnelDataMsgs);
+		}
+	}
+
 	void TransitTunnel::SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg)
 	{
 		LogPrint (eLogError, "TransitTunnel: We are not a gateway for ", GetTunnelID ());
@@ -81,6 +122,7 @@ namespace tunnel
 	{
 		auto newMsg = CreateEmptyTunnelDataMsg ();
 		EncryptTunnelMsg (tunnelMsg, newMsg);
+		newMsg->traceTime = tunnelMsg->traceTime;
 
 		LogPrint (eLogDebug, "TransitTunnel: handle msg for endpoint ", GetTunnelID ());
 		m_Endpoint.HandleDecryptedTunnelDataMsg (newMsg);
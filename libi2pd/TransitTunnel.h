@@ -29,6 +29,8 @@ namespace tunnel
 			void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
 			void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
 			void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out);
+			void EncryptTunnelMsgs (const std::vector<std::shared_ptr<const I2NPMessage> >& in,
+				const std::vector<std::shared_ptr<I2NPMessage> >& out); // same number of messages
 		private:
 
 			i2p::crypto::TunnelEncryption m_Encryption;
@@ -48,10 +50,12 @@ namespace tunnel
 			size_t GetNumTransmittedBytes () const { return m_NumTransmittedBytes; };
 			void HandleTunnelDataMsg (std::shared_ptr<const i2p::I2NPMessage> tunnelMsg);
 			void FlushTunnelDataMsgs ();
+			void Cleanup ();
 
 		private:
 
 			size_t m_NumTransmittedBytes;
+			std::vector<std::shared_ptr<const i2p::I2NPMessage> > m_ReceivedTunnelDataMsgs; // encrypted on flush
 			std::vector<std::shared_ptr<i2p::I2NPMessage> > m_TunnelDataMsgs;
 	};
 
@@ -63,7 +67,7 @@ namespace tunnel
 				const uint8_t * nextIdent, uint32_t nextTunnelID,
 				const uint8_t * layerKey,const uint8_t * ivKey):
 				TransitTunnel (receiveTunnelID, nextIdent, nextTunnelID,
-				layerKey, ivKey), m_Gateway(this) {};
+				layerKey, ivKey), m_Gateway(this, true) {};
 
 			void SendTunnelDataMsg (std::shared_ptr<i2p::I2NPMessage> msg);
 			void FlushTunnelDataMsgs ();
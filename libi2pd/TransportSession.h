@@ -5,11 +5,13 @@
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <atomic>
 #include "Identity.h"
 #include "Crypto.h"
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "Timestamp.h"
+#include "Queue.h"
 
 namespace i2p
 {
@@ -50,13 +52,36 @@ namespace transport
 			std::stringstream m_Stream;
 	};
 
+	enum TrafficClass // in order of priority
+	{
+		eTrafficLocal = 0, // our own tunnels and destinations
+		eTrafficNetDb, // lookups, stores and replies
+		eTrafficTransit, // relayed for other routers
+		eNumTrafficClasses
+	};
+
+	inline TrafficClass GetTrafficClass (std::shared_ptr<const I2NPMessage> msg)
+	{
+		if (msg->isTransit) return eTrafficTransit;
+		switch (msg->GetTypeID ())
+		{
+			case eI2NPDatabaseStore:
+			case eI2NPDatabaseLookup:
+			case eI2NPDatabaseSearchReply:
+				return eTrafficNetDb;
+			default:
+				return eTrafficLocal;
+		}
+	}
+
 	class TransportSession
 	{
 		public:
 
 			TransportSession (std::shared_ptr<const i2p::data::RouterInfo> router, int terminationTimeout):
 				m_DHKeysPair (nullptr), m_NumSentBytes (0), m_NumReceivedBytes (0), m_IsOutgoing (router), m_TerminationTimeout (terminationTimeout),
-				m_LastActivityTimestamp (i2p::util::GetSecondsSinceEpoch ())
+				m_LastActivityTimestamp (i2p::util::GetSecondsSinceEpoch ()), m_IsCongested (false),
+				m_LastMeasuredNumBytes (0), m_LastMeasurementTime (0), m_IsOutgoingPosted (false)
 			{
 				if (router)
 					m_RemoteIdentity = router->GetRouterIdentity ();
@@ -79,9 +104,40 @@ namespace transport
 			bool IsTerminationTimeoutExpired (uint64_t ts) const
 			{ return ts >= m_LastActivityTimestamp + GetTerminationTimeout (); };
 
+			bool IsCongested () const { return m_IsCongested; }; // outgoing queue is filling up
+
+			virtual int GetRTT () const { return 0; }; // in milliseconds, 0 if not measured
+			uint32_t MeasureBandwidth (uint64_t ts) // bytes per second both directions since previous call, 0 for first
+			{
+				size_t numBytes = m_NumSentBytes + m_NumReceivedBytes;
+				uint32_t bandwidth = (m_LastMeasurementTime && ts > m_LastMeasurementTime) ?
+					(numBytes - m_LastMeasuredNumBytes)/(ts - m_LastMeasurementTime) : 0;
+				m_LastMeasuredNumBytes = numBytes;
+				m_LastMeasurementTime = ts;
+				return bandwidth;
+			}
+
 			virtual void SendLocalRouterInfo () { SendI2NPMessages ({ CreateDatabaseStoreMsg () }); };
 			virtual void SendI2NPMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) = 0;
 
+		protected:
+
+			// producers push without lock, session's thread takes all pending at once
+			bool PutOutgoingMessages (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) // true if session's thread must be woken up
+			{
+				m_OutgoingQueue.Put (msgs);
+				return !m_IsOutgoingPosted.exchange (true);
+			}
+			void GetOutgoingMessages (std::vector<std::shared_ptr<I2NPMessage> >& msgs) // session's thread only
+			{
+				m_IsOutgoingPosted = false;
+				m_OutgoingQueue.GetAll (msgs);
+			}
+			bool SetCongested (bool congested) // true if changed
+			{
+				return m_IsCongested.exchange (congested) != congested;
+			}
+
 		protected:
 
 			std::shared_ptr<const i2p::data::IdentityEx> m_RemoteIdentity;
@@ -90,6 +146,14 @@ namespace transport
 			bool m_IsOutgoing;
 			int m_TerminationTimeout;
 			uint64_t m_LastActivityTimestamp;
+			std::atomic<bool> m_IsCongested;
+
+		private:
+
+			size_t m_LastMeasuredNumBytes;
+			uint64_t m_LastMeasurementTime; // in seconds
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_OutgoingQueue;
+			std::atomic<bool> m_IsOutgoingPosted;
 	};
 }
 }
@@ -5,7 +5,10 @@
 #include "NetDb.hpp"
 #include "Transports.h"
 #include "Config.h"
+#include "Metrics.h"
 #include "HTTP.h"
+#include "FS.h"
+#include "Profiling.h"
 #ifdef WITH_EVENTS
 #include "Event.h"
 #include "util.h"
@@ -17,79 +20,124 @@ namespace i2p
 {
 namespace transport
 {
-	DHKeysPairSupplier::DHKeysPairSupplier (int size):
-		m_QueueSize (size), m_IsRunning (false), m_Thread (nullptr)
+	static void GenerateKeys (std::vector<std::shared_ptr<i2p::crypto::DHKeys> >& keys)
 	{
+		for (auto& it: keys)
+			it->GenerateKeys ();
 	}
 
-	DHKeysPairSupplier::~DHKeysPairSupplier ()
+	static void GenerateKeys (std::vector<std::shared_ptr<i2p::crypto::X25519Keys> >& keys)
+	{
+		std::vector<i2p::crypto::X25519Keys *> ptrs;
+		ptrs.reserve (keys.size ());
+		for (auto& it: keys) ptrs.push_back (it.get ());
+		i2p::crypto::X25519Keys::GenerateKeys (ptrs.size (), ptrs.data ());
+	}
+
+	template<typename Keys>
+	EphemeralKeysSupplier<Keys>::EphemeralKeysSupplier (int size, int maxNumThreads):
+		m_MinQueueSize (size), m_MaxNumThreads (maxNumThreads), m_QueueSize (size), m_NumGenerating (0),
+		m_NumAcquired (0), m_LastAdjustTime (0), m_NumStarvations (0), m_IsRunning (false)
+	{
+	}
+
+	template<typename Keys>
+	EphemeralKeysSupplier<Keys>::~EphemeralKeysSupplier ()
 	{
 		Stop ();
 	}
 
-	void DHKeysPairSupplier::Start ()
+	template<typename Keys>
+	void EphemeralKeysSupplier<Keys>::Start ()
 	{
 		m_IsRunning = true;
-		m_Thread = new std::thread (std::bind (&DHKeysPairSupplier::Run, this));
+		m_LastAdjustTime = i2p::util::GetSecondsSinceEpoch ();
+		int numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > m_MaxNumThreads) numThreads = m_MaxNumThreads;
+		if (numThreads < 1) numThreads = 1;
+		for (int i = 0; i < numThreads; i++)
+			m_Threads.emplace_back (new std::thread (std::bind (&EphemeralKeysSupplier<Keys>::Run, this)));
 	}
 
-	void DHKeysPairSupplier::Stop ()
+	template<typename Keys>
+	void EphemeralKeysSupplier<Keys>::Stop ()
 	{
 		{
 			std::unique_lock<std::mutex> l(m_AcquiredMutex);
 			m_IsRunning = false;
-			m_Acquired.notify_one ();
-		}
-		if (m_Thread)
-		{
-			m_Thread->join ();
-			delete m_Thread;
-			m_Thread = 0;
+			m_Acquired.notify_all ();
 		}
+		for (auto& it: m_Threads)
+			it->join ();
+		m_Threads.clear ();
 	}
 
-	void DHKeysPairSupplier::Run ()
+	template<typename Keys>
+	void EphemeralKeysSupplier<Keys>::Run ()
 	{
+		i2p::util::InitThread ("EphemeralKeys", i2p::util::eThreadGroupCrypto);
+		int total = 0; // generated by this thread without a break
+		std::vector<std::shared_ptr<Keys> > batch;
+		std::unique_lock<std::mutex> l(m_AcquiredMutex);
 		while (m_IsRunning)
 		{
-			int num, total = 0;
-			while ((num = m_QueueSize - (int)m_Queue.size ()) > 0 && total < 10)
+			AdjustQueueSize (i2p::util::GetSecondsSinceEpoch ());
+			int num = m_QueueSize - (int)m_Queue.size () - m_NumGenerating;
+			if (num > 0 && total < 10)
 			{
-				CreateDHKeysPairs (num);
+				if (num > DH_KEYS_GENERATION_BATCH_SIZE) num = DH_KEYS_GENERATION_BATCH_SIZE;
+				m_NumGenerating += num;
+				l.unlock ();
+				for (int i = 0; i < num; i++)
+					batch.push_back (std::make_shared<Keys> ());
+				GenerateKeys (batch);
 				total += num;
+				l.lock ();
+				m_NumGenerating -= num;
+				for (auto& it: batch)
+					m_Queue.push (it);
+				batch.clear ();
 			}
-			if (total >= 10)
+			else if (total >= 10)
 			{
-				LogPrint (eLogWarning, "Transports: ", total, " DH keys generated at the time");
+				LogPrint (eLogWarning, "Transports: ", total, " ephemeral keys generated at the time");
+				total = 0;
+				l.unlock ();
 				std::this_thread::sleep_for (std::chrono::seconds(1)); // take a break
+				l.lock ();
 			}
 			else
 			{
-				std::unique_lock<std::mutex> l(m_AcquiredMutex);
-				if (!m_IsRunning) break;
+				total = 0;
 				m_Acquired.wait (l); // wait for element gets acquired
 			}
 		}
 	}
 
-	void DHKeysPairSupplier::CreateDHKeysPairs (int num)
+	template<typename Keys>
+	void EphemeralKeysSupplier<Keys>::AdjustQueueSize (uint64_t ts)
 	{
-		if (num > 0)
+		// m_AcquiredMutex must be locked
+		if (ts < m_LastAdjustTime + DH_KEYS_ADJUST_INTERVAL) return;
+		// keep enough keys for 10 seconds of acquires at last interval's rate
+		int queueSize = m_NumAcquired*10/(int)(ts - m_LastAdjustTime);
+		if (queueSize < m_MinQueueSize) queueSize = m_MinQueueSize;
+		if (queueSize > DH_KEYS_MAX_QUEUE_SIZE) queueSize = DH_KEYS_MAX_QUEUE_SIZE;
+		if (queueSize != m_QueueSize)
 		{
-			for (int i = 0; i < num; i++)
-			{
-				auto pair = std::make_shared<i2p::crypto::DHKeys> ();
-				pair->GenerateKeys ();
-				std::unique_lock<std::mutex>	l(m_AcquiredMutex);
-				m_Queue.push (pair);
-			}
+			LogPrint (eLogDebug, "Transports: ephemeral keys queue size changed from ", (int)m_QueueSize, " to ", queueSize);
+			m_QueueSize = queueSize;
 		}
+		m_NumAcquired = 0;
+		m_LastAdjustTime = ts;
 	}
 
-	std::shared_ptr<i2p::crypto::DHKeys> DHKeysPairSupplier::Acquire ()
+	template<typename Keys>
+	std::shared_ptr<Keys> EphemeralKeysSupplier<Keys>::Acquire ()
 	{
 		{
 			std::unique_lock<std::mutex>	l(m_AcquiredMutex);
+			m_NumAcquired++;
 			if (!m_Queue.empty ())
 			{
 				auto pair = m_Queue.front ();
@@ -97,14 +145,20 @@ namespace transport
 				m_Acquired.notify_one ();
 				return pair;
 			}
+			// starvation, grow queue right away
+			m_NumStarvations++;
+			int queueSize = m_QueueSize*2;
+			m_QueueSize = queueSize < DH_KEYS_MAX_QUEUE_SIZE ? queueSize : DH_KEYS_MAX_QUEUE_SIZE;
+			m_Acquired.notify_all ();
 		}
 		// queue is empty, create new
-		auto pair = std::make_shared<i2p::crypto::DHKeys> ();
+		auto pair = std::make_shared<Keys> ();
 		pair->GenerateKeys ();
 		return pair;
 	}
 
-	void DHKeysPairSupplier::Return (std::shared_ptr<i2p::crypto::DHKeys> pair)
+	template<typename Keys>
+	void EphemeralKeysSupplier<Keys>::Return (std::shared_ptr<Keys> pair)
 	{
 		if (pair)
 		{
@@ -113,20 +167,187 @@ namespace transport
 				m_Queue.push (pair);
 		}
 		else
-			LogPrint(eLogError, "Transports: return null DHKeys");
+			LogPrint(eLogError, "Transports: return null keys");
+	}
+
+	template class EphemeralKeysSupplier<i2p::crypto::DHKeys>;
+	template class EphemeralKeysSupplier<i2p::crypto::X25519Keys>;
+
+	BandwidthShaper::BandwidthShaper ():
+		m_Tokens (0), m_TransitTokens (0), m_LastUpdateTime (0)
+	{
+	}
+
+	void BandwidthShaper::Update (uint64_t ts)
+	{
+		int64_t rate = i2p::context.GetBandwidthLimit ()*1024, transitRate = i2p::context.GetTransitBandwidthLimit ()*1024; // bytes per second
+		int64_t maxTokens = rate*SHAPER_BURST_DURATION/1000, maxTransitTokens = transitRate*SHAPER_BURST_DURATION/1000;
+		if (!m_LastUpdateTime)
+		{
+			m_Tokens = maxTokens;
+			m_TransitTokens = maxTransitTokens;
+		}
+		else if (ts > m_LastUpdateTime)
+		{
+			auto interval = ts - m_LastUpdateTime;
+			m_Tokens += rate*interval/1000;
+			if (m_Tokens > maxTokens) m_Tokens = maxTokens;
+			m_TransitTokens += transitRate*interval/1000;
+			if (m_TransitTokens > maxTransitTokens) m_TransitTokens = maxTransitTokens;
+		}
+		m_LastUpdateTime = ts;
+	}
+
+	bool BandwidthShaper::Consume (TrafficClass c, size_t len)
+	{
+		if (m_Tokens <= 0) return false;
+		if (c == eTrafficTransit)
+		{
+			if (m_TransitTokens <= 0) return false;
+			m_TransitTokens -= len;
+		}
+		m_Tokens -= len;
+		return true;
+	}
+
+	bool BandwidthShaper::Put (const i2p::data::IdentHash& ident, std::shared_ptr<i2p::I2NPMessage> msg)
+	{
+		auto c = GetTrafficClass (msg);
+		bool queued = false; // by this class or higher priority
+		for (int i = 0; i <= c; i++)
+			if (!m_Queues[i].empty ()) { queued = true; break; }
+		if (!queued && Consume (c, msg->GetLength ())) return true;
+		auto& queue = m_Queues[c];
+		auto size = queue.size ();
+		bool drop = size >= SHAPER_MAX_QUEUE_SIZE;
+		if (!drop && c == eTrafficTransit && size > SHAPER_TRANSIT_EARLY_DROP_SIZE)
+			// drop probability grows linearly with queue size
+			drop = (size_t)i2p::crypto::RandUint32 () % (SHAPER_MAX_QUEUE_SIZE - SHAPER_TRANSIT_EARLY_DROP_SIZE) < size - SHAPER_TRANSIT_EARLY_DROP_SIZE;
+		if (drop)
+			i2p::metrics::shaperDroppedMessages.Inc ();
+		else
+		{
+			queue.emplace_back (ident, msg);
+			i2p::metrics::shaperQueuedMessages.Inc ();
+		}
+		return false;
+	}
+
+	void BandwidthShaper::Drain (uint64_t ts, Messages& out)
+	{
+		for (int i = 0; i < eNumTrafficClasses; i++)
+		{
+			auto& queue = m_Queues[i];
+			while (!queue.empty ())
+			{
+				auto& front = queue.front ();
+				if (front.second->GetExpiration () < ts)
+					i2p::metrics::shaperDroppedMessages.Inc (); // expired while waiting
+				else if (Consume ((TrafficClass)i, front.second->GetLength ()))
+					out[front.first].push_back (front.second);
+				else
+					break;
+				queue.pop_front ();
+			}
+		}
+	}
+
+	bool BandwidthShaper::IsEmpty () const
+	{
+		for (const auto& it: m_Queues)
+			if (!it.empty ()) return false;
+		return true;
+	}
+
+	HandshakesFilter::HandshakesFilter ():
+		m_LastCleanupTime (0), m_ReplayFilter (i2p::util::BloomFilter (HANDSHAKES_REPLAY_FILTER_SIZE)), m_LastDecayTime (0)
+	{
+	}
+
+	bool HandshakesFilter::Accept (const boost::asio::ip::address& addr)
+	{
+		std::string key;
+		if (addr.is_v4 ())
+		{
+			auto bytes = addr.to_v4 ().to_bytes ();
+			key.assign ((const char *)bytes.data (), bytes.size ());
+		}
+		else
+		{
+			auto bytes = addr.to_v6 ().to_bytes ();
+			key.assign ((const char *)bytes.data (), bytes.size ());
+		}
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(m_BucketsMutex);
+		if (m_Buckets.size () > HANDSHAKES_MAX_NUM_IPS && ts > m_LastCleanupTime + 1000) // once per second at most
+		{
+			m_LastCleanupTime = ts;
+			// full buckets are the same as new ones
+			for (auto it = m_Buckets.begin (); it != m_Buckets.end ();)
+			{
+				if (ts > it->second.lastUpdateTime + HANDSHAKES_BURST_PER_IP*1000/HANDSHAKES_RATE_PER_IP)
+					it = m_Buckets.erase (it);
+				else
+					it++;
+			}
+		}
+		auto it = m_Buckets.find (key);
+		if (it == m_Buckets.end ())
+		{
+			m_Buckets[key] = { HANDSHAKES_BURST_PER_IP - 1, ts };
+			return true;
+		}
+		auto& bucket = it->second;
+		if (ts > bucket.lastUpdateTime)
+		{
+			auto tokens = (ts - bucket.lastUpdateTime)*HANDSHAKES_RATE_PER_IP/1000;
+			if (bucket.tokens + tokens >= HANDSHAKES_BURST_PER_IP)
+			{
+				bucket.tokens = HANDSHAKES_BURST_PER_IP;
+				bucket.lastUpdateTime = ts;
+			}
+			else if (tokens > 0)
+			{
+				bucket.tokens += tokens;
+				bucket.lastUpdateTime += tokens*1000/HANDSHAKES_RATE_PER_IP; // keep remainder
+			}
+		}
+		if (bucket.tokens <= 0)
+		{
+			i2p::metrics::handshakesRejected.Inc ();
+			return false;
+		}
+		bucket.tokens--;
+		return true;
+	}
+
+	bool HandshakesFilter::IsReplay (const uint8_t * pub, size_t len)
+	{
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(m_ReplayFilterMutex);
+		if (ts > m_LastDecayTime + HANDSHAKES_REPLAY_FILTER_DECAY_INTERVAL)
+		{
+			m_ReplayFilter->Decay ();
+			m_LastDecayTime = ts;
+		}
+		if (m_ReplayFilter->Add (pub, len)) return false;
+		i2p::metrics::handshakesRejected.Inc ();
+		return true;
 	}
 
 	Transports transports;
 
 	Transports::Transports ():
 		m_IsOnline (true), m_IsRunning (false), m_IsNAT (true), m_Thread (nullptr), m_Service (nullptr),
-		m_Work (nullptr), m_PeerCleanupTimer (nullptr), m_PeerTestTimer (nullptr),
+		m_Work (nullptr), m_PeerCleanupTimer (nullptr), m_PeerTestTimer (nullptr), m_ShaperTimer (nullptr),
 		m_NTCPServer (nullptr), m_SSUServer (nullptr), m_NTCP2Server (nullptr),
 		m_DHKeysPairSupplier (5), // 5 pre-generated keys
+		m_X25519KeysPairSupplier (15, 2), // 15 pre-generated keys, 2 threads
 		m_TotalSentBytes(0), m_TotalReceivedBytes(0), m_TotalTransitTransmittedBytes (0),
 		m_InBandwidth (0), m_OutBandwidth (0), m_TransitBandwidth(0),
 		m_LastInBandwidthUpdateBytes (0), m_LastOutBandwidthUpdateBytes (0),
-		m_LastTransitBandwidthUpdateBytes (0), m_LastBandwidthUpdateTime (0)
+		m_LastTransitBandwidthUpdateBytes (0), m_LastBandwidthUpdateTime (0), m_WarmStartTime (0), m_NumPendingMessages (0),
+		m_IsShaping (false), m_IsShaperScheduled (false), m_HasCongestedPeers (false)
 	{
 	}
 
@@ -137,6 +358,7 @@ namespace transport
 		{
 			delete m_PeerCleanupTimer; m_PeerCleanupTimer = nullptr;
 			delete m_PeerTestTimer; m_PeerTestTimer = nullptr;
+			delete m_ShaperTimer; m_ShaperTimer = nullptr;
 			delete m_Work; m_Work = nullptr;
 			delete m_Service; m_Service = nullptr;
 		}
@@ -150,10 +372,13 @@ namespace transport
 			m_Work = new boost::asio::io_service::work (*m_Service);
 			m_PeerCleanupTimer = new boost::asio::deadline_timer (*m_Service);
 			m_PeerTestTimer = new boost::asio::deadline_timer (*m_Service);
+			m_ShaperTimer = new boost::asio::deadline_timer (*m_Service);
 		}
 
 		i2p::config::GetOption("nat", m_IsNAT);
+		i2p::config::GetOption("bandwidthshaping", m_IsShaping);
 		m_DHKeysPairSupplier.Start ();
+		m_X25519KeysPairSupplier.Start ();
 		m_IsRunning = true;
 		m_Thread = new std::thread (std::bind (&Transports::Run, this));
 		std::string ntcpproxy; i2p::config::GetOption("ntcpproxy", ntcpproxy);
@@ -254,12 +479,15 @@ namespace transport
                     m_PeerTestTimer->expires_from_now (boost::posix_time::minutes(PEER_TEST_INTERVAL));
                     m_PeerTestTimer->async_wait (std::bind (&Transports::HandlePeerTestTimer, this, std::placeholders::_1));
                 }
+		LoadWarmPeers ();
 	}
 
 	void Transports::Stop ()
 	{
 		if (m_PeerCleanupTimer) m_PeerCleanupTimer->cancel ();
 		if (m_PeerTestTimer) m_PeerTestTimer->cancel ();
+		if (m_ShaperTimer) m_ShaperTimer->cancel ();
+		if (m_IsRunning) SaveWarmPeers ();
 		m_Peers.clear ();
 		if (m_SSUServer)
 		{
@@ -282,6 +510,7 @@ namespace transport
 		}
 
 		m_DHKeysPairSupplier.Stop ();
+		m_X25519KeysPairSupplier.Stop ();
 		m_IsRunning = false;
 		if (m_Service) m_Service->stop ();
 		if (m_Thread)
@@ -294,11 +523,12 @@ namespace transport
 
 	void Transports::Run ()
 	{
+		i2p::util::InitThread ("Transports", i2p::util::eThreadGroupTransports);
 		while (m_IsRunning && m_Service)
 		{
 			try
 			{
-				m_Service->run ();
+				i2p::util::RunService (*m_Service, "Transports");
 			}
 			catch (std::exception& ex)
 			{
@@ -344,16 +574,85 @@ namespace transport
 		SendMessages (ident, std::vector<std::shared_ptr<i2p::I2NPMessage> > {msg });
 	}
 
+	// messages collected by current thread between BeginSendBatch and EndSendBatch
+	struct ThreadSendBatch
+	{
+		bool isActive = false;
+		size_t numMessages = 0;
+		std::shared_ptr<std::map<i2p::data::IdentHash, std::vector<std::shared_ptr<i2p::I2NPMessage> > > > msgs;
+	};
+	static thread_local ThreadSendBatch g_SendBatch;
+
 	void Transports::SendMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs)
 	{
 #ifdef WITH_EVENTS
-		QueueIntEvent("transport.send", ident.ToBase64(), msgs.size());
+		QueueIntEvent(i2p::event::eCollectedTransportSend, ident, msgs.size());
 #endif
-		m_Service->post (std::bind (&Transports::PostMessages, this, ident, msgs));
+		if (i2p::metrics::tracer.IsEnabled ())
+			for (const auto& it: msgs)
+				if (it->traceTime) i2p::metrics::tracer.Record (i2p::metrics::eTraceStageTransports, it->traceTime);
+		if (IsPeerCongested (ident))
+		{
+			// peer doesn't keep up, don't make it worse with traffic of others
+			std::vector<std::shared_ptr<i2p::I2NPMessage> > allowed;
+			for (const auto& it: msgs)
+				if (!it->isTransit) allowed.push_back (it);
+			if (allowed.size () < msgs.size ())
+			{
+				i2p::metrics::congestedDroppedMessages.Inc (msgs.size () - allowed.size ());
+				if (!allowed.empty ()) SendMessages (ident, allowed);
+				return;
+			}
+		}
+		m_NumPendingMessages += msgs.size ();
+		if (g_SendBatch.isActive)
+		{
+			if (!g_SendBatch.msgs)
+				g_SendBatch.msgs = std::make_shared<std::map<i2p::data::IdentHash, std::vector<std::shared_ptr<i2p::I2NPMessage> > > >();
+			auto& peerMsgs = (*g_SendBatch.msgs)[ident];
+			peerMsgs.insert (peerMsgs.end (), msgs.begin (), msgs.end ());
+			g_SendBatch.numMessages += msgs.size ();
+			if (g_SendBatch.numMessages >= SEND_BATCH_MAX_NUM_MESSAGES)
+				FlushSendBatch ();
+		}
+		else
+			m_Service->post (std::bind (&Transports::PostMessages, this, ident, msgs));
+	}
+
+	void Transports::BeginSendBatch ()
+	{
+		g_SendBatch.isActive = true;
+	}
+
+	void Transports::EndSendBatch ()
+	{
+		FlushSendBatch ();
+		g_SendBatch.isActive = false;
+	}
+
+	void Transports::FlushSendBatch ()
+	{
+		if (!g_SendBatch.msgs) return;
+		if (g_SendBatch.msgs->size () == 1)
+		{
+			auto& it = *g_SendBatch.msgs->begin ();
+			m_Service->post (std::bind (&Transports::PostMessages, this, it.first, it.second));
+		}
+		else
+			m_Service->post (std::bind (&Transports::PostMessagesBatch, this, g_SendBatch.msgs));
+		g_SendBatch.msgs = nullptr;
+		g_SendBatch.numMessages = 0;
+	}
+
+	void Transports::PostMessagesBatch (std::shared_ptr<std::map<i2p::data::IdentHash, std::vector<std::shared_ptr<i2p::I2NPMessage> > > > batch)
+	{
+		for (auto& it: *batch)
+			PostMessages (it.first, it.second);
 	}
 
 	void Transports::PostMessages (i2p::data::IdentHash ident, std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs)
 	{
+		m_NumPendingMessages -= msgs.size ();
 		if (ident == i2p::context.GetRouterInfo ().GetIdentHash ())
 		{
 			// we send it to ourself
@@ -362,6 +661,42 @@ namespace transport
 			m_LoopbackHandler.Flush ();
 			return;
 		}
+		if (m_IsShaping)
+		{
+			m_Shaper.Update (i2p::util::GetMillisecondsSinceEpoch ());
+			std::vector<std::shared_ptr<i2p::I2NPMessage> > allowed;
+			for (auto& it: msgs)
+				if (m_Shaper.Put (ident, it)) allowed.push_back (it);
+			if (!m_Shaper.IsEmpty ()) ScheduleShaper ();
+			if (!allowed.empty ()) DeliverMessages (ident, allowed);
+		}
+		else
+			DeliverMessages (ident, msgs);
+	}
+
+	void Transports::ScheduleShaper ()
+	{
+		if (m_IsShaperScheduled) return;
+		m_IsShaperScheduled = true;
+		m_ShaperTimer->expires_from_now (boost::posix_time::milliseconds (SHAPER_INTERVAL));
+		m_ShaperTimer->async_wait (std::bind (&Transports::HandleShaperTimer, this, std::placeholders::_1));
+	}
+
+	void Transports::HandleShaperTimer (const boost::system::error_code& ecode)
+	{
+		m_IsShaperScheduled = false;
+		if (ecode == boost::asio::error::operation_aborted) return;
+		auto ts = i2p::util::GetMillisecondsSinceEpoch ();
+		m_Shaper.Update (ts);
+		BandwidthShaper::Messages msgs;
+		m_Shaper.Drain (ts, msgs);
+		for (auto& it: msgs)
+			DeliverMessages (it.first, it.second);
+		if (!m_Shaper.IsEmpty ()) ScheduleShaper ();
+	}
+
+	void Transports::DeliverMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs)
+	{
 		if(RoutesRestricted() && ! IsRestrictedPeer(ident)) return;
 		auto it = m_Peers.find (ident);
 		if (it == m_Peers.end ())
@@ -371,7 +706,7 @@ namespace transport
 			{
 				auto r = netdb.FindRouter (ident);
 				{
-					std::unique_lock<std::mutex>	l(m_PeersMutex);
+					i2p::metrics::ProfiledLock	l(m_PeersMutex);
 					it = m_Peers.insert (std::pair<i2p::data::IdentHash, Peer>(ident, { 0, r, {},
 						i2p::util::GetSecondsSinceEpoch (), {} })).first;
 				}
@@ -379,7 +714,7 @@ namespace transport
 			}
 			catch (std::exception& ex)
 			{
-				LogPrint (eLogError, "Transports: PostMessages exception:", ex.what ());
+				LogPrint (eLogError, "Transports: DeliverMessages exception:", ex.what ());
 			}
 			if (!connected) return;
 		}
@@ -389,13 +724,17 @@ namespace transport
 		{
 			if (it->second.delayedMessages.size () < MAX_NUM_DELAYED_MESSAGES)
 			{
+				auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
 				for (auto& it1: msgs)
-					it->second.delayedMessages.push_back (it1);
+					if (it1 && !it1->IsExpired (ts, 0))
+						it->second.delayedMessages.push_back (it1);
+					else
+						i2p::metrics::delayedExpiredMessages.Inc ();
 			}
 			else
 			{
 				LogPrint (eLogWarning, "Transports: delayed messages queue size exceeds ", MAX_NUM_DELAYED_MESSAGES);
-				std::unique_lock<std::mutex> l(m_PeersMutex);
+				i2p::metrics::ProfiledLock l(m_PeersMutex);
 				m_Peers.erase (it);
 			}
 		}
@@ -484,7 +823,7 @@ namespace transport
 			}
 			LogPrint (eLogInfo, "Transports: No NTCP or SSU addresses available");
 			peer.Done ();
-			std::unique_lock<std::mutex> l(m_PeersMutex);
+			i2p::metrics::ProfiledLock l(m_PeersMutex);
 			m_Peers.erase (ident);
 			return false;
 		}
@@ -516,7 +855,7 @@ namespace transport
 			else
 			{
 				LogPrint (eLogWarning, "Transports: RouterInfo not found, Failed to send messages");
-				std::unique_lock<std::mutex> l(m_PeersMutex);
+				i2p::metrics::ProfiledLock l(m_PeersMutex);
 				m_Peers.erase (it);
 			}
 		}
@@ -604,6 +943,11 @@ namespace transport
 		return m_DHKeysPairSupplier.Acquire ();
 	}
 
+	std::shared_ptr<i2p::crypto::X25519Keys> Transports::GetNextX25519KeysPair ()
+	{
+		return m_X25519KeysPairSupplier.Acquire ();
+	}
+
 	void Transports::ReuseDHKeysPair (std::shared_ptr<i2p::crypto::DHKeys> pair)
 	{
 		m_DHKeysPairSupplier.Return (pair);
@@ -622,6 +966,8 @@ namespace transport
 #ifdef WITH_EVENTS
 				EmitEvent({{"type" , "transport.connected"}, {"ident", ident.ToBase64()}, {"inbound", "false"}});
 #endif
+				auto num = DropExpiredI2NPMessages (it->second.delayedMessages, i2p::util::GetCoarseMillisecondsSinceEpoch ());
+				if (num) i2p::metrics::delayedExpiredMessages.Inc (num);
 				bool sendDatabaseStore = true;
 				if (it->second.delayedMessages.size () > 0)
 				{
@@ -651,7 +997,7 @@ namespace transport
 				EmitEvent({{"type" , "transport.connected"}, {"ident", ident.ToBase64()}, {"inbound", "true"}});
 #endif
 				session->SendI2NPMessages ({ CreateDatabaseStoreMsg () }); // send DatabaseStore
-				std::unique_lock<std::mutex>	l(m_PeersMutex);
+				i2p::metrics::ProfiledLock	l(m_PeersMutex);
 				m_Peers.insert (std::make_pair (ident, Peer{ 0, nullptr, { session }, i2p::util::GetSecondsSinceEpoch (), {} }));
 			}
 		});
@@ -673,11 +1019,13 @@ namespace transport
 				it->second.sessions.remove (session);
 				if (it->second.sessions.empty ()) // TODO: why?
 				{
+					auto num = DropExpiredI2NPMessages (it->second.delayedMessages, i2p::util::GetCoarseMillisecondsSinceEpoch ());
+					if (num) i2p::metrics::delayedExpiredMessages.Inc (num);
 					if (it->second.delayedMessages.size () > 0)
 						ConnectToPeer (ident, it->second);
 					else
 					{
-						std::unique_lock<std::mutex> l(m_PeersMutex);
+						i2p::metrics::ProfiledLock l(m_PeersMutex);
 						m_Peers.erase (it);
 					}
 				}
@@ -685,9 +1033,30 @@ namespace transport
 		});
 	}
 
+	void Transports::SetPeerCongested (const i2p::data::IdentHash& ident, bool congested)
+	{
+		std::unique_lock<std::mutex> l(m_CongestedPeersMutex);
+		if (congested)
+			m_CongestedPeers[ident]++;
+		else
+		{
+			auto it = m_CongestedPeers.find (ident);
+			if (it != m_CongestedPeers.end () && !--it->second)
+				m_CongestedPeers.erase (it);
+		}
+		m_HasCongestedPeers = !m_CongestedPeers.empty ();
+	}
+
+	bool Transports::IsPeerCongested (const i2p::data::IdentHash& ident) const
+	{
+		if (!m_HasCongestedPeers) return false;
+		std::unique_lock<std::mutex> l(m_CongestedPeersMutex);
+		return m_CongestedPeers.count (ident) > 0;
+	}
+
 	bool Transports::IsConnected (const i2p::data::IdentHash& ident) const
 	{
-		std::unique_lock<std::mutex> l(m_PeersMutex);
+		i2p::metrics::ProfiledLock l(m_PeersMutex);
 		auto it = m_Peers.find (ident);
 		return it != m_Peers.end ();
 	}
@@ -707,13 +1076,28 @@ namespace transport
 					{
 						profile->TunnelNonReplied();
 					}
-					std::unique_lock<std::mutex>	l(m_PeersMutex);
+					i2p::metrics::ProfiledLock	l(m_PeersMutex);
 					it = m_Peers.erase (it);
 				}
 				else
+				{
+					if (!it->second.sessions.empty ())
+					{
+						// peer's capacity for tunnel peers selection
+						auto& session = it->second.sessions.front ();
+						uint32_t bandwidth = session->MeasureBandwidth (ts);
+						int rtt = session->GetRTT ();
+						if (rtt > 0 || bandwidth > 0)
+						{
+							auto profile = i2p::data::GetRouterProfile (it->first);
+							if (profile) profile->TransportMeasured (rtt, bandwidth);
+						}
+					}
 					++it;
+				}
 			}
 			UpdateBandwidth (); // TODO: use separate timer(s) for it
+			FillWarmPool ();
 			if (i2p::context.GetStatus () == eRouterStatusTesting) // if still testing,	 repeat peer test
 				DetectExternalIP ();
 			m_PeerCleanupTimer->expires_from_now (boost::posix_time::seconds(5*SESSION_CREATION_TIMEOUT));
@@ -734,11 +1118,107 @@ namespace transport
 	std::shared_ptr<const i2p::data::RouterInfo> Transports::GetRandomPeer () const
 	{
 		if (m_Peers.empty ()) return nullptr;
-		std::unique_lock<std::mutex> l(m_PeersMutex);
+		i2p::metrics::ProfiledLock l(m_PeersMutex);
 		auto it = m_Peers.begin ();
-		std::advance (it, rand () % m_Peers.size ());
+		std::advance (it, i2p::crypto::RandUint32 () % m_Peers.size ());
 		return it != m_Peers.end () ? it->second.router : nullptr;
 	}
+	bool Transports::IsWarmingUp () const
+	{
+		return m_WarmStartTime && i2p::util::GetSecondsSinceEpoch () < m_WarmStartTime + WARM_START_DURATION;
+	}
+
+	void Transports::SaveWarmPeers ()
+	{
+		// connected peers with sessions, most tunnels agreed first
+		std::vector<std::pair<uint32_t, i2p::data::IdentHash> > peers;
+		{
+			i2p::metrics::ProfiledLock l(m_PeersMutex);
+			for (auto& it: m_Peers)
+			{
+				if (it.second.sessions.empty () || !it.second.router) continue;
+				auto profile = it.second.router->GetProfile ();
+				if (profile->IsBad ()) continue;
+				peers.push_back ({ profile->GetNumTunnelsAgreed (), it.first });
+			}
+		}
+		if (peers.empty ()) return;
+		std::sort (peers.begin (), peers.end (),
+			[](const std::pair<uint32_t, i2p::data::IdentHash>& a, const std::pair<uint32_t, i2p::data::IdentHash>& b)
+			{
+				return a.first > b.first;
+			});
+		if (peers.size () > WARM_PEERS_MAX_NUM) peers.resize (WARM_PEERS_MAX_NUM);
+		std::ofstream f (i2p::fs::DataDirPath (WARM_PEERS_FILENAME), std::ofstream::out | std::ofstream::trunc);
+		if (!f.is_open ())
+		{
+			LogPrint (eLogWarning, "Transports: Can't save warm peers to ", WARM_PEERS_FILENAME);
+			return;
+		}
+		for (auto& it: peers)
+			f << it.second.ToBase64 () << "\n";
+		LogPrint (eLogInfo, "Transports: ", peers.size (), " warm peers saved");
+	}
+
+	void Transports::LoadWarmPeers ()
+	{
+		auto filename = i2p::fs::DataDirPath (WARM_PEERS_FILENAME);
+		std::ifstream f (filename);
+		if (!f.is_open ()) return;
+		std::vector<i2p::data::IdentHash> idents;
+		std::string line;
+		while (std::getline (f, line) && idents.size () < WARM_PEERS_MAX_NUM)
+		{
+			if (line.length () != 44) continue; // base64 of 32 bytes
+			i2p::data::IdentHash ident;
+			ident.FromBase64 (line);
+			idents.push_back (ident);
+		}
+		f.close ();
+		i2p::fs::Remove (filename); // use snapshot once
+		if (idents.empty ()) return;
+		LogPrint (eLogInfo, "Transports: Connecting to ", idents.size (), " warm peers");
+		m_WarmStartTime = i2p::util::GetSecondsSinceEpoch ();
+		m_Service->post (std::bind (&Transports::ConnectToPeers, this, idents));
+	}
+
+	void Transports::PreConnect (const i2p::data::IdentHash& ident)
+	{
+		if (!m_IsRunning || ident == i2p::context.GetIdentHash ()) return;
+		m_Service->post (std::bind (&Transports::ConnectToPeers, this, std::vector<i2p::data::IdentHash>{ ident }));
+	}
+
+	void Transports::FillWarmPool ()
+	{
+		if (RoutesRestricted () || m_Peers.size () >= WARM_POOL_MIN_NUM_PEERS) return;
+		auto router = i2p::context.GetSharedRouterInfo ();
+		std::vector<i2p::data::IdentHash> idents;
+		for (int i = 0; i < WARM_POOL_MAX_NUM_CONNECTS; i++)
+		{
+			auto r = netdb.GetHighBandwidthRandomRouter (router);
+			if (r) idents.push_back (r->GetIdentHash ());
+		}
+		if (!idents.empty ()) ConnectToPeers (idents);
+	}
+
+	void Transports::ConnectToPeers (std::vector<i2p::data::IdentHash> idents)
+	{
+		for (auto& ident: idents)
+		{
+			if (RoutesRestricted () && !IsRestrictedPeer (ident)) continue;
+			if (m_Peers.count (ident)) continue;
+			auto r = netdb.FindRouter (ident);
+			if (!r || r->IsUnreachable () || r->GetProfile ()->IsBad ()) continue;
+			std::map<i2p::data::IdentHash, Peer>::iterator it;
+			{
+				i2p::metrics::ProfiledLock l(m_PeersMutex);
+				it = m_Peers.insert (std::pair<i2p::data::IdentHash, Peer>(ident, { 0, r, {},
+					i2p::util::GetSecondsSinceEpoch (), {} })).first;
+			}
+			ConnectToPeer (ident, it->second); // removes peer if failed
+		}
+	}
+
 	void Transports::RestrictRoutesToFamilies(std::set<std::string> families)
 	{
 		std::lock_guard<std::mutex> lock(m_FamilyMutex);
@@ -6,8 +6,10 @@
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <unordered_map>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <string>
 #include <memory>
 #include <atomic>
@@ -19,37 +21,54 @@
 #include "RouterInfo.h"
 #include "I2NPProtocol.h"
 #include "Identity.h"
+#include "Metrics.h"
+#include "BloomFilter.h"
 
 namespace i2p
 {
 namespace transport
 {
-	class DHKeysPairSupplier
+	const int DH_KEYS_MAX_NUM_THREADS = 4;
+	const int DH_KEYS_MAX_QUEUE_SIZE = 64;
+	const int DH_KEYS_ADJUST_INTERVAL = 60; // in seconds
+	const int DH_KEYS_GENERATION_BATCH_SIZE = 8; // keys generated at once without lock
+	template<typename Keys>
+	class EphemeralKeysSupplier // pool of pre-generated keys, ElGamal for NTCP/SSU and x25519 for NTCP2
 	{
 		public:
 
-			DHKeysPairSupplier (int size);
-			~DHKeysPairSupplier ();
+			EphemeralKeysSupplier (int size, int maxNumThreads = DH_KEYS_MAX_NUM_THREADS);
+			~EphemeralKeysSupplier ();
 			void Start ();
 			void Stop ();
-			std::shared_ptr<i2p::crypto::DHKeys> Acquire ();
-			void Return (std::shared_ptr<i2p::crypto::DHKeys> pair);
+			std::shared_ptr<Keys> Acquire ();
+			void Return (std::shared_ptr<Keys> pair);
+
+			int GetQueueSize () const { return m_QueueSize; };
+			uint64_t GetNumStarvations () const { return m_NumStarvations; };
 
 		private:
 
 			void Run ();
-			void CreateDHKeysPairs (int num);
+			void AdjustQueueSize (uint64_t ts);
 
 		private:
 
-			const int m_QueueSize;
-			std::queue<std::shared_ptr<i2p::crypto::DHKeys> > m_Queue;
+			const int m_MinQueueSize, m_MaxNumThreads;
+			std::atomic<int> m_QueueSize; // adjusted by acquire rate
+			std::queue<std::shared_ptr<Keys> > m_Queue;
+			int m_NumGenerating; // being created by threads now
+			int m_NumAcquired; // since last adjustment
+			uint64_t m_LastAdjustTime;
+			std::atomic<uint64_t> m_NumStarvations; // acquires from empty queue
 
 			bool m_IsRunning;
-			std::thread * m_Thread;
+			std::vector<std::unique_ptr<std::thread> > m_Threads;
 			std::condition_variable m_Acquired;
 			std::mutex m_AcquiredMutex;
 	};
+	typedef EphemeralKeysSupplier<i2p::crypto::DHKeys> DHKeysPairSupplier;
+	typedef EphemeralKeysSupplier<i2p::crypto::X25519Keys> X25519KeysPairSupplier;
 
 	struct Peer
 	{
@@ -69,6 +88,77 @@ namespace transport
 	const size_t SESSION_CREATION_TIMEOUT = 10; // in seconds
 	const int PEER_TEST_INTERVAL = 71; // in minutes
 	const int MAX_NUM_DELAYED_MESSAGES = 50;
+	const size_t SEND_BATCH_MAX_NUM_MESSAGES = 256; // posted before batch ends if more
+	const char WARM_PEERS_FILENAME[] = "warmpeers.txt"; // connected peers at shutdown
+	const size_t WARM_PEERS_MAX_NUM = 100;
+	const int WARM_START_DURATION = 300; // in seconds, connected peers used for first hops
+	const size_t WARM_POOL_MIN_NUM_PEERS = 25; // keep sessions to high-bandwidth routers if less
+	const int WARM_POOL_MAX_NUM_CONNECTS = 5; // per cleanup interval
+	const int SEND_OVERLOAD_NUM_PENDING_MESSAGES = 4096; // posted to transports thread, transit builds rejected if more
+
+	const int SHAPER_INTERVAL = 10; // in milliseconds
+	const int SHAPER_BURST_DURATION = 1000; // in milliseconds, bucket depth at configured rate
+	const size_t SHAPER_MAX_QUEUE_SIZE = 4096; // messages per class
+	const size_t SHAPER_TRANSIT_EARLY_DROP_SIZE = 512; // transit is dropped randomly above it, always at max
+	/** @brief token buckets for total and transit bandwidth, messages over limit wait in per-class queues.
+	 *  Used from transports thread only */
+	class BandwidthShaper
+	{
+		public:
+
+			typedef std::map<i2p::data::IdentHash, std::vector<std::shared_ptr<i2p::I2NPMessage> > > Messages;
+
+			BandwidthShaper ();
+
+			void Update (uint64_t ts); // refill buckets, ts in milliseconds
+			bool Put (const i2p::data::IdentHash& ident, std::shared_ptr<i2p::I2NPMessage> msg); // true if can be sent now, queued or dropped otherwise
+			void Drain (uint64_t ts, Messages& out); // queued messages allowed by buckets
+			bool IsEmpty () const;
+			size_t GetQueueSize (TrafficClass c) const { return m_Queues[c].size (); };
+
+		private:
+
+			bool Consume (TrafficClass c, size_t len);
+
+		private:
+
+			int64_t m_Tokens, m_TransitTokens; // in bytes, might be negative after long message
+			uint64_t m_LastUpdateTime;
+			std::deque<std::pair<i2p::data::IdentHash, std::shared_ptr<i2p::I2NPMessage> > > m_Queues[eNumTrafficClasses];
+	};
+
+	const int HANDSHAKES_RATE_PER_IP = 2; // per second
+	const int HANDSHAKES_BURST_PER_IP = 10;
+	const size_t HANDSHAKES_MAX_NUM_IPS = 8192; // buckets of idle addresses are removed if more
+	const size_t HANDSHAKES_REPLAY_FILTER_SIZE = 64*1024; // in bytes
+	const int HANDSHAKES_REPLAY_FILTER_DECAY_INTERVAL = 120; // in seconds, covers clock skew
+	/** @brief cheap checks of incoming NTCP2 and SSU handshakes before key agreement:
+	 *  token bucket per source address and replay filter of ephemeral keys. Thread safe */
+	class HandshakesFilter
+	{
+		public:
+
+			HandshakesFilter ();
+
+			bool Accept (const boost::asio::ip::address& addr); // false if rate exceeded
+			bool IsReplay (const uint8_t * pub, size_t len); // remembers key otherwise
+
+		private:
+
+			struct Bucket
+			{
+				int tokens;
+				uint64_t lastUpdateTime; // in milliseconds
+			};
+
+			std::mutex m_BucketsMutex;
+			std::unordered_map<std::string, Bucket> m_Buckets; // address bytes -> bucket
+			uint64_t m_LastCleanupTime;
+			std::mutex m_ReplayFilterMutex;
+			i2p::util::BloomFilterPtr m_ReplayFilter;
+			uint64_t m_LastDecayTime;
+	};
+
 	class Transports
 	{
 		public:
@@ -89,9 +179,17 @@ namespace transport
 			boost::asio::io_service& GetService () { return *m_Service; };
 			std::shared_ptr<i2p::crypto::DHKeys> GetNextDHKeysPair ();
 			void ReuseDHKeysPair (std::shared_ptr<i2p::crypto::DHKeys> pair);
+			int GetDHKeysQueueSize () const { return m_DHKeysPairSupplier.GetQueueSize (); };
+			uint64_t GetNumDHKeysStarvations () const { return m_DHKeysPairSupplier.GetNumStarvations (); };
+			std::shared_ptr<i2p::crypto::X25519Keys> GetNextX25519KeysPair ();
+			int GetX25519KeysQueueSize () const { return m_X25519KeysPairSupplier.GetQueueSize (); };
+			uint64_t GetNumX25519KeysStarvations () const { return m_X25519KeysPairSupplier.GetNumStarvations (); };
+			HandshakesFilter& GetHandshakesFilter () { return m_HandshakesFilter; };
 
 			void SendMessage (const i2p::data::IdentHash& ident, std::shared_ptr<i2p::I2NPMessage> msg);
 			void SendMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs);
+			void BeginSendBatch (); // messages sent by this thread are collected and posted at once on EndSendBatch
+			void EndSendBatch ();
 			void CloseSession (std::shared_ptr<const i2p::data::RouterInfo> router);
 
 			void PeerConnected (std::shared_ptr<TransportSession> session);
@@ -109,8 +207,14 @@ namespace transport
 			uint32_t GetTransitBandwidth () const { return m_TransitBandwidth; };
 			bool IsBandwidthExceeded () const;
 			bool IsTransitBandwidthExceeded () const;
+			int GetNumPendingMessages () const { return m_NumPendingMessages; };
+			bool IsSendOverloaded () const { return m_NumPendingMessages > SEND_OVERLOAD_NUM_PENDING_MESSAGES; };
+			void SetPeerCongested (const i2p::data::IdentHash& ident, bool congested); // from session's thread
+			bool IsPeerCongested (const i2p::data::IdentHash& ident) const; // transit traffic to it should be dropped
 			size_t GetNumPeers () const { return m_Peers.size (); };
 			std::shared_ptr<const i2p::data::RouterInfo> GetRandomPeer () const;
+			bool IsWarmingUp () const;
+			void PreConnect (const i2p::data::IdentHash& ident);
 
     /** get a trusted first hop for restricted routes */
     std::shared_ptr<const i2p::data::RouterInfo> GetRestrictedPeer() const;
@@ -131,6 +235,11 @@ namespace transport
 			void RequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, const i2p::data::IdentHash& ident);
 			void HandleRequestComplete (std::shared_ptr<const i2p::data::RouterInfo> r, i2p::data::IdentHash ident);
 			void PostMessages (i2p::data::IdentHash ident, std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs);
+			void DeliverMessages (const i2p::data::IdentHash& ident, const std::vector<std::shared_ptr<i2p::I2NPMessage> >& msgs);
+			void ScheduleShaper ();
+			void HandleShaperTimer (const boost::system::error_code& ecode);
+			void PostMessagesBatch (std::shared_ptr<std::map<i2p::data::IdentHash, std::vector<std::shared_ptr<i2p::I2NPMessage> > > > batch);
+			void FlushSendBatch ();
 			void PostCloseSession (std::shared_ptr<const i2p::data::RouterInfo> router);
 			bool ConnectToPeer (const i2p::data::IdentHash& ident, Peer& peer);
 			void HandlePeerCleanupTimer (const boost::system::error_code& ecode);
@@ -139,26 +248,40 @@ namespace transport
 			void UpdateBandwidth ();
 			void DetectExternalIP ();
 
+			void SaveWarmPeers ();
+			void LoadWarmPeers ();
+			void ConnectToPeers (std::vector<i2p::data::IdentHash> idents);
+			void FillWarmPool ();
+
 		private:
 
 			bool m_IsOnline, m_IsRunning, m_IsNAT;
 			std::thread * m_Thread;
 			boost::asio::io_service * m_Service;
 			boost::asio::io_service::work * m_Work;
-			boost::asio::deadline_timer * m_PeerCleanupTimer, * m_PeerTestTimer;
+			boost::asio::deadline_timer * m_PeerCleanupTimer, * m_PeerTestTimer, * m_ShaperTimer;
 
 			NTCPServer * m_NTCPServer;
 			SSUServer * m_SSUServer;
 			NTCP2Server * m_NTCP2Server;
-			mutable std::mutex m_PeersMutex;
+			mutable i2p::metrics::ProfiledMutex m_PeersMutex { "transports.peers" };
 			std::map<i2p::data::IdentHash, Peer> m_Peers;
 
 			DHKeysPairSupplier m_DHKeysPairSupplier;
+			X25519KeysPairSupplier m_X25519KeysPairSupplier;
+			HandshakesFilter m_HandshakesFilter;
 
 			std::atomic<uint64_t> m_TotalSentBytes, m_TotalReceivedBytes, m_TotalTransitTransmittedBytes;
 			uint32_t m_InBandwidth, m_OutBandwidth, m_TransitBandwidth; // bytes per second
 			uint64_t m_LastInBandwidthUpdateBytes, m_LastOutBandwidthUpdateBytes, m_LastTransitBandwidthUpdateBytes;
 			uint64_t m_LastBandwidthUpdateTime;
+			uint64_t m_WarmStartTime; // 0 if no warm peers loaded
+			std::atomic<int> m_NumPendingMessages; // sent but not handled by transports thread yet
+			bool m_IsShaping, m_IsShaperScheduled;
+			BandwidthShaper m_Shaper;
+			mutable std::mutex m_CongestedPeersMutex;
+			std::map<i2p::data::IdentHash, int> m_CongestedPeers; // ident -> number of congested sessions
+			std::atomic<bool> m_HasCongestedPeers; // to skip lock if none
 
 			/** which router families to trust for first hops */
 			std::vector<std::string> m_TrustedFamilies;
@@ -180,6 +303,18 @@ namespace transport
 	};
 
 	extern Transports transports;
+
+	class SendBatch // sends of current thread are batched within scope
+	{
+		public:
+
+			SendBatch (Transports& owner): m_Owner (owner) { m_Owner.BeginSendBatch (); };
+			~SendBatch () { m_Owner.EndSendBatch (); };
+
+		private:
+
+			Transports& m_Owner;
+	};
 }
 }
 
@@ -13,6 +13,7 @@
 #include "Config.h"
 #include "Tunnel.h"
 #include "TunnelPool.h"
+#include "Metrics.h"
 #ifdef WITH_EVENTS
 #include "Event.h"
 #endif
@@ -24,7 +25,7 @@ namespace tunnel
 	Tunnel::Tunnel (std::shared_ptr<const TunnelConfig> config):
 		TunnelBase (config->GetTunnelID (), config->GetNextTunnelID (), config->GetNextIdentHash ()),
 		m_Config (config), m_Pool (nullptr), m_State (eTunnelStatePending), m_IsRecreated (false),
-		m_Latency (0)
+		m_Latency (0), m_BuildStartTime (i2p::util::GetMillisecondsSinceEpoch ()), m_LastConfirmedTime (0)
 	{
 	}
 
@@ -33,6 +34,11 @@ namespace tunnel
 	}
 
 	void Tunnel::Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel)
+	{
+		SendTunnelBuildMsg (CreateTunnelBuildMsg (replyMsgID), outboundTunnel);
+	}
+
+	std::shared_ptr<I2NPMessage> Tunnel::CreateTunnelBuildMsg (uint32_t replyMsgID)
 	{
 #ifdef WITH_EVENTS
 		std::string peers = i2p::context.GetIdentity()->GetIdentHash().ToBase64();
@@ -56,7 +62,7 @@ namespace tunnel
 		{
 			uint32_t msgID;
 			if (hop->next) // we set replyMsgID for last hop only
-				RAND_bytes ((uint8_t *)&msgID, 4);
+				msgID = i2p::crypto::RandUint32 ();
 			else
 				msgID = replyMsgID;
 			int idx = recordIndicies[i];
@@ -76,7 +82,7 @@ namespace tunnel
 		for (int i = numHops; i < numRecords; i++)
 		{
 			int idx = recordIndicies[i];
-			RAND_bytes (records + idx*TUNNEL_BUILD_RECORD_SIZE, TUNNEL_BUILD_RECORD_SIZE);
+			i2p::crypto::RandBytes (records + idx*TUNNEL_BUILD_RECORD_SIZE, TUNNEL_BUILD_RECORD_SIZE);
 		}
 
 		// decrypt real records
@@ -97,8 +103,11 @@ namespace tunnel
 			hop = hop->prev;
 		}
 		msg->FillI2NPMessageHeader (eI2NPVariableTunnelBuild);
+		return msg;
+	}
 
-		// send message
+	void Tunnel::SendTunnelBuildMsg (std::shared_ptr<I2NPMessage> msg, std::shared_ptr<OutboundTunnel> outboundTunnel)
+	{
 		if (outboundTunnel)
 			outboundTunnel->SendTunnelDataMsg (GetNextIdentHash (), 0, msg);
 		else
@@ -161,10 +170,24 @@ namespace tunnel
 			}
 			m_Config = nullptr;
 		}
-		if (established) m_State = eTunnelStateEstablished;
+		if (established)
+		{
+			m_State = eTunnelStateEstablished;
+			i2p::metrics::tunnelBuildTime.Observe (i2p::util::GetMillisecondsSinceEpoch () - m_BuildStartTime);
+		}
 		return established;
 	}
 
+	void Tunnel::AddLatencySample(const uint64_t ms)
+	{
+		// exponentially weighted moving average, first sample is taken as is
+		uint64_t sample = ms ? ms : 1; // 0 means unknown
+		if (m_Latency)
+			m_Latency = (m_Latency*(TUNNEL_LATENCY_EWMA_WEIGHT - 1) + sample)/TUNNEL_LATENCY_EWMA_WEIGHT;
+		else
+			m_Latency = sample;
+	}
+
 	bool Tunnel::LatencyFitsRange(uint64_t lower, uint64_t upper) const
 	{
 		auto latency = GetMeanLatency();
@@ -225,6 +248,7 @@ namespace tunnel
 	void InboundTunnel::HandleTunnelDataMsg (std::shared_ptr<const I2NPMessage> msg)
 	{
 		if (IsFailed ()) SetState (eTunnelStateEstablished); // incoming messages means a tunnel is alive
+		SetConfirmed (i2p::util::GetSecondsSinceEpoch ());
 		auto newMsg = CreateEmptyTunnelDataMsg ();
 		EncryptTunnelMsg (msg, newMsg);
 		newMsg->from = shared_from_this ();
@@ -331,9 +355,65 @@ namespace tunnel
 		s << GetTunnelID () << ":me &#8658; ";
 	}
 
+	TunnelDataWorker::TunnelDataWorker (Tunnels& owner, int index):
+		m_Owner (owner), m_Index (index), m_IsRunning (false), m_Thread (nullptr)
+	{
+	}
+
+	TunnelDataWorker::~TunnelDataWorker ()
+	{
+		Stop ();
+	}
+
+	void TunnelDataWorker::Start ()
+	{
+		m_IsRunning = true;
+		m_Thread = new std::thread (std::bind (&TunnelDataWorker::Run, this));
+	}
+
+	void TunnelDataWorker::Stop ()
+	{
+		m_IsRunning = false;
+		m_Queue.WakeUp ();
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			delete m_Thread;
+			m_Thread = nullptr;
+		}
+	}
+
+	void TunnelDataWorker::Run ()
+	{
+		i2p::util::InitThread ("TunnelData", i2p::util::eThreadGroupTunnels);
+		uint64_t nextCleanup = i2p::util::GetMillisecondsSinceEpoch () + TUNNEL_WORKER_CLEANUP_INTERVAL*1000LL;
+		while (m_IsRunning)
+		{
+			try
+			{
+				uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
+				auto msg = ts < nextCleanup ? m_Queue.GetNextWithTimeout (nextCleanup - ts) : m_Queue.Get ();
+				if (msg)
+					m_Owner.ProcessTunnelMessages (msg, m_Queue);
+
+				ts = i2p::util::GetMillisecondsSinceEpoch ();
+				if (ts >= nextCleanup)
+				{
+					m_Owner.CleanupTunnels (m_Index);
+					nextCleanup = ts + TUNNEL_WORKER_CLEANUP_INTERVAL*1000LL;
+				}
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: worker ", m_Index, " runtime exception: ", ex.what ());
+			}
+		}
+	}
+
 	Tunnels tunnels;
 
 	Tunnels::Tunnels (): m_IsRunning (false), m_Thread (nullptr),
+		m_Schedule (TUNNELS_SCHEDULE_RING_SIZE), m_LastScheduleTime (0), m_NumTransitTunnels (0), m_ProcessingTime (0),
 		m_NumSuccesiveTunnelCreations (0), m_NumFailedTunnelCreations (0)
 	{
 	}
@@ -344,10 +424,9 @@ namespace tunnel
 
 	std::shared_ptr<TunnelBase> Tunnels::GetTunnel (uint32_t tunnelID)
 	{
-		auto it = m_Tunnels.find(tunnelID);
-		if (it != m_Tunnels.end ())
-			return it->second;
-		return nullptr;
+		std::unique_lock<std::mutex> l(m_TunnelsMutex);
+		auto tunnel = m_Tunnels.Find (tunnelID);
+		return tunnel ? *tunnel : nullptr;
 	}
 
 	std::shared_ptr<InboundTunnel> Tunnels::GetPendingInboundTunnel (uint32_t replyMsgID)
@@ -361,13 +440,13 @@ namespace tunnel
 	}
 
 	template<class TTunnel>
-	std::shared_ptr<TTunnel> Tunnels::GetPendingTunnel (uint32_t replyMsgID, const std::map<uint32_t, std::shared_ptr<TTunnel> >& pendingTunnels)
+	std::shared_ptr<TTunnel> Tunnels::GetPendingTunnel (uint32_t replyMsgID, i2p::util::FlatHashMap<std::shared_ptr<TTunnel> >& pendingTunnels)
 	{
-		auto it = pendingTunnels.find(replyMsgID);
-		if (it != pendingTunnels.end () && it->second->GetState () == eTunnelStatePending)
+		auto tunnel = pendingTunnels.Find (replyMsgID);
+		if (tunnel && (*tunnel)->GetState () == eTunnelStatePending)
 		{
-			it->second->SetState (eTunnelStateBuildReplyReceived);
-			return it->second;
+			(*tunnel)->SetState (eTunnelStateBuildReplyReceived);
+			return *tunnel;
 		}
 		return nullptr;
 	}
@@ -391,7 +470,7 @@ namespace tunnel
 	std::shared_ptr<OutboundTunnel> Tunnels::GetNextOutboundTunnel ()
 	{
 		if (m_OutboundTunnels.empty ()) return nullptr;
-		uint32_t ind = rand () % m_OutboundTunnels.size (), i = 0;
+		uint32_t ind = i2p::crypto::RandUint32 () % m_OutboundTunnels.size (), i = 0;
 		std::shared_ptr<OutboundTunnel> tunnel;
 		for (const auto& it: m_OutboundTunnels)
 		{
@@ -409,7 +488,7 @@ namespace tunnel
 		int numOutboundHops, int numInboundTunnels, int numOutboundTunnels)
 	{
 		auto pool = std::make_shared<TunnelPool> (numInboundHops, numOutboundHops, numInboundTunnels, numOutboundTunnels);
-		std::unique_lock<std::mutex> l(m_PoolsMutex);
+		i2p::metrics::ProfiledLock l(m_PoolsMutex);
 		m_Pools.push_back (pool);
 		return pool;
 	}
@@ -420,7 +499,7 @@ namespace tunnel
 		{
 			StopTunnelPool (pool);
 			{
-				std::unique_lock<std::mutex> l(m_PoolsMutex);
+				i2p::metrics::ProfiledLock l(m_PoolsMutex);
 				m_Pools.remove (pool);
 			}
 		}
@@ -437,8 +516,20 @@ namespace tunnel
 
 	void Tunnels::AddTransitTunnel (std::shared_ptr<TransitTunnel> tunnel)
 	{
-		if (m_Tunnels.emplace (tunnel->GetTunnelID (), tunnel).second)
-			m_TransitTunnels.push_back (tunnel);
+		bool inserted;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			inserted = m_Tunnels.Insert (tunnel->GetTunnelID (), tunnel);
+		}
+		if (inserted)
+		{
+			uint32_t bucketTime = tunnel->GetCreationTime () - tunnel->GetCreationTime () % TRANSIT_TUNNELS_BUCKET_INTERVAL;
+			i2p::metrics::ProfiledLock l(m_TransitTunnelsMutex);
+			if (m_TransitTunnels.empty () || m_TransitTunnels.back ().creationTime < bucketTime)
+				m_TransitTunnels.push_back ({ bucketTime, {} });
+			m_TransitTunnels.back ().tunnels.push_back (tunnel);
+			m_NumTransitTunnels++;
+		}
 		else
 			LogPrint (eLogError, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " already exists");
 	}
@@ -446,6 +537,17 @@ namespace tunnel
 	void Tunnels::Start ()
 	{
 		m_IsRunning = true;
+		uint16_t numWorkers; i2p::config::GetOption("limits.tunnelthreads", numWorkers);
+		for (int i = 0; i < numWorkers; i++)
+		{
+			m_Workers.emplace_back (new TunnelDataWorker (*this, i));
+			m_Workers.back ()->Start ();
+		}
+		if (numWorkers > 0)
+			LogPrint (eLogInfo, "Tunnel: ", (int)numWorkers, " tunnel data workers started");
+		uint16_t numBuildWorkers; i2p::config::GetOption("limits.tunnelbuildthreads", numBuildWorkers);
+		for (int i = 0; i < numBuildWorkers; i++)
+			m_BuildWorkers.emplace_back (new std::thread (std::bind (&Tunnels::RunBuildWorker, this)));
 		m_Thread = new std::thread (std::bind (&Tunnels::Run, this));
 	}
 
@@ -459,78 +561,88 @@ namespace tunnel
 			delete m_Thread;
 			m_Thread = 0;
 		}
+		m_BuildRequests.WakeUp ();
+		for (auto& it: m_BuildWorkers)
+			it->join ();
+		m_BuildWorkers.clear ();
+		for (auto& it: m_Workers)
+			it->Stop ();
+		m_Workers.clear ();
+	}
+
+	void Tunnels::RunBuildWorker ()
+	{
+		i2p::util::InitThread ("TunnelBuild", i2p::util::eThreadGroupCrypto);
+		while (m_IsRunning)
+		{
+			try
+			{
+				// our own builds first, they are waited for by pools
+				auto build = m_OutboundBuilds.Get ();
+				if (build)
+				{
+					build ();
+					continue;
+				}
+				auto msg = m_BuildRequests.GetNextWithTimeout (1000); // 1 sec
+				if (msg)
+				{
+					// reject rather than accept more if we can't keep up
+					bool isOverloaded = m_BuildRequests.GetSize () > TUNNEL_BUILD_REQUESTS_OVERLOAD_QUEUE_SIZE;
+					if (msg->GetTypeID () == eI2NPVariableTunnelBuild)
+						HandleVariableTunnelBuildRequestMsg (msg->GetPayload (), msg->GetPayloadLength (), isOverloaded);
+					else
+						HandleTunnelBuildMsg (msg->GetPayload (), msg->GetPayloadLength (), isOverloaded);
+				}
+			}
+			catch (std::exception& ex)
+			{
+				LogPrint (eLogError, "Tunnel: build worker runtime exception: ", ex.what ());
+			}
+		}
+	}
+
+	bool Tunnels::PostTunnelBuildRequest (std::shared_ptr<I2NPMessage> msg)
+	{
+		if (m_BuildWorkers.empty ()) return false;
+		auto typeID = msg->GetTypeID ();
+		if (typeID == eI2NPVariableTunnelBuild)
+		{
+			if (GetPendingInboundTunnel (msg->GetMsgID ())) return false; // reply for our inbound tunnel
+		}
+		else if (typeID != eI2NPTunnelBuild)
+			return false;
+		if (m_BuildRequests.GetSize () >= TUNNEL_BUILD_REQUESTS_MAX_QUEUE_SIZE)
+			LogPrint (eLogWarning, "Tunnel: too many tunnel build requests, dropped");
+		else
+			m_BuildRequests.Put (msg);
+		return true;
 	}
 
 	void Tunnels::Run ()
 	{
+		i2p::util::InitThread ("Tunnels", i2p::util::eThreadGroupTunnels);
 		std::this_thread::sleep_for (std::chrono::seconds(1)); // wait for other parts are ready
 
-		uint64_t lastTs = 0;
+		uint64_t nextManage = 0; // in milliseconds
 		while (m_IsRunning)
 		{
 			try
 			{
-				auto msg = m_Queue.GetNextWithTimeout (1000); // 1 sec
+				// sleep until messages or managing is due, Stop wakes us up
+				uint64_t ts = i2p::util::GetMillisecondsSinceEpoch ();
+				auto msg = ts < nextManage ? m_Queue.GetNextWithTimeout (nextManage - ts) : m_Queue.Get ();
 				if (msg)
 				{
-					uint32_t prevTunnelID = 0, tunnelID = 0;
-					std::shared_ptr<TunnelBase> prevTunnel;
-					do
-					{
-						std::shared_ptr<TunnelBase> tunnel;
-						uint8_t typeID = msg->GetTypeID ();
-						switch (typeID)
-						{
-							case eI2NPTunnelData:
-							case eI2NPTunnelGateway:
-							{
-								tunnelID = bufbe32toh (msg->GetPayload ());
-								if (tunnelID == prevTunnelID)
-									tunnel = prevTunnel;
-								else if (prevTunnel)
-									prevTunnel->FlushTunnelDataMsgs ();
-
-								if (!tunnel)
-									tunnel = GetTunnel (tunnelID);
-								if (tunnel)
-								{
-									if (typeID == eI2NPTunnelData)
-										tunnel->HandleTunnelDataMsg (msg);
-									else // tunnel gateway assumed
-										HandleTunnelGatewayMsg (tunnel, msg);
-								}
-								else
-									LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
-
-								break;
-							}
-							case eI2NPVariableTunnelBuild:
-							case eI2NPVariableTunnelBuildReply:
-							case eI2NPTunnelBuild:
-							case eI2NPTunnelBuildReply:
-								HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
-							break;
-							default:
-								LogPrint (eLogWarning, "Tunnel: unexpected message type ", (int) typeID);
-						}
-
-						msg = m_Queue.Get ();
-						if (msg)
-						{
-							prevTunnelID = tunnelID;
-							prevTunnel = tunnel;
-						}
-						else if (tunnel)
-							tunnel->FlushTunnelDataMsgs ();
-					}
-					while (msg);
+					i2p::metrics::tunnelsQueueSize.Observe (m_Queue.GetSize ());
+					ProcessTunnelMessages (msg, m_Queue);
 				}
 
-				uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
-				if (ts - lastTs >= 15) // manage tunnels every 15 seconds
+				ts = i2p::util::GetMillisecondsSinceEpoch ();
+				if (ts >= nextManage)
 				{
 					ManageTunnels ();
-					lastTs = ts;
+					nextManage = ts + TUNNEL_MANAGE_INTERVAL*1000LL;
 				}
 			}
 			catch (std::exception& ex)
@@ -540,6 +652,97 @@ namespace tunnel
 		}
 	}
 
+	void Tunnels::ProcessTunnelMessages (std::shared_ptr<I2NPMessage> msg, i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> >& queue)
+	{
+		auto start = std::chrono::steady_clock::now ();
+		uint32_t prevTunnelID = 0, tunnelID = 0;
+		std::shared_ptr<TunnelBase> prevTunnel;
+		// tunnels are flushed together, so messages of different tunnels to the same next hop are sent at once
+		std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > unflushed;
+		int numUnflushedMsgs = 0;
+		i2p::transport::SendBatch batch (i2p::transport::transports); // tunnels flushed below send to transports at once
+		do
+		{
+			std::shared_ptr<TunnelBase> tunnel;
+			uint8_t typeID = msg->GetTypeID ();
+			if (msg->traceTime) i2p::metrics::tracer.Record (i2p::metrics::eTraceStageTunnels, msg->traceTime);
+			switch (typeID)
+			{
+				case eI2NPTunnelData:
+				case eI2NPTunnelGateway:
+				{
+					if (msg->IsExpired (i2p::util::GetCoarseMillisecondsSinceEpoch (), I2NP_MESSAGE_CLOCK_SKEW))
+					{
+						// expired while waiting in queue, would be dropped by endpoint anyway
+						i2p::metrics::tunnelsExpiredMessages.Inc ();
+						break;
+					}
+					tunnelID = bufbe32toh (msg->GetPayload ());
+					if (i2p::metrics::tunnelCapture.IsEnabled ())
+						i2p::metrics::tunnelCapture.Record (typeID == eI2NPTunnelGateway, tunnelID, msg->GetPayloadLength ());
+					if (tunnelID == prevTunnelID)
+						tunnel = prevTunnel;
+					if (!tunnel)
+					{
+						tunnel = GetTunnel (tunnelID);
+						if (tunnel) unflushed.emplace (tunnelID, tunnel);
+					}
+					if (tunnel)
+					{
+						if (typeID == eI2NPTunnelData)
+							tunnel->HandleTunnelDataMsg (msg);
+						else // tunnel gateway assumed
+							HandleTunnelGatewayMsg (tunnel, msg);
+						numUnflushedMsgs++;
+					}
+					else
+						LogPrint (eLogWarning, "Tunnel: tunnel not found, tunnelID=", tunnelID, " previousTunnelID=", prevTunnelID, " type=", (int)typeID);
+					prevTunnelID = tunnelID;
+					prevTunnel = tunnel;
+					break;
+				}
+				case eI2NPVariableTunnelBuild:
+				case eI2NPVariableTunnelBuildReply:
+				case eI2NPTunnelBuild:
+				case eI2NPTunnelBuildReply:
+					if (!PostTunnelBuildRequest (msg))
+						HandleI2NPMessage (msg->GetBuffer (), msg->GetLength ());
+				break;
+				default:
+					LogPrint (eLogWarning, "Tunnel: unexpected message type ", (int) typeID);
+			}
+
+			msg = queue.Get ();
+			if (!msg || numUnflushedMsgs >= TUNNEL_DATA_MAX_NUM_UNFLUSHED_MSGS)
+			{
+				for (auto& it: unflushed)
+					it.second->FlushTunnelDataMsgs ();
+				unflushed.clear ();
+				numUnflushedMsgs = 0;
+				prevTunnel = nullptr; prevTunnelID = 0; // next tunnel must be added to unflushed again
+			}
+		}
+		while (msg);
+		// shared by tunnels thread and data workers, a lost update is harmless
+		uint64_t sample = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now () - start).count ();
+		m_ProcessingTime = (m_ProcessingTime*(TUNNEL_LATENCY_EWMA_WEIGHT - 1) + sample)/TUNNEL_LATENCY_EWMA_WEIGHT;
+	}
+
+	void Tunnels::CleanupTunnels (int workerIndex)
+	{
+		std::vector<std::shared_ptr<TunnelBase> > tunnels;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			m_Tunnels.ForEach ([&tunnels, workerIndex, this](uint32_t tunnelID, const std::shared_ptr<TunnelBase>& tunnel)
+				{
+					if ((int)(tunnelID % m_Workers.size ()) == workerIndex)
+						tunnels.push_back (tunnel);
+				});
+		}
+		for (auto& it: tunnels)
+			it->Cleanup ();
+	}
+
 	void Tunnels::HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg)
 	{
 		if (!tunnel)
@@ -569,123 +772,202 @@ namespace tunnel
 
 	void Tunnels::ManageTunnels ()
 	{
-		ManagePendingTunnels ();
+		ProcessSchedule (i2p::util::GetSecondsSinceEpoch ());
 		ManageInboundTunnels ();
 		ManageOutboundTunnels ();
 		ManageTransitTunnels ();
 		ManageTunnelPools ();
 	}
 
-	void Tunnels::ManagePendingTunnels ()
+	void Tunnels::Schedule (uint64_t ts, const TunnelsScheduleEntry& entry)
 	{
-		ManagePendingTunnels (m_PendingInboundTunnels);
-		ManagePendingTunnels (m_PendingOutboundTunnels);
+		if (!m_LastScheduleTime) m_LastScheduleTime = i2p::util::GetSecondsSinceEpoch ();
+		if (ts <= m_LastScheduleTime)
+			ts = m_LastScheduleTime + 1;
+		else if (ts > m_LastScheduleTime + TUNNELS_SCHEDULE_RING_SIZE)
+			ts = m_LastScheduleTime + TUNNELS_SCHEDULE_RING_SIZE;
+		m_Schedule[ts % TUNNELS_SCHEDULE_RING_SIZE].push_back (entry);
 	}
 
-	template<class PendingTunnels>
-	void Tunnels::ManagePendingTunnels (PendingTunnels& pendingTunnels)
+	void Tunnels::ScheduleTunnel (std::shared_ptr<Tunnel> tunnel, uint64_t ts)
+	{
+		uint64_t expiration = tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT, next = expiration + 1;
+		if (tunnel->IsEstablished ())
+		{
+			if (!tunnel->IsRecreated () && ts + TUNNEL_RECREATION_THRESHOLD <= expiration)
+				next = expiration - TUNNEL_RECREATION_THRESHOLD + 1;
+			else if (ts + TUNNEL_EXPIRATION_THRESHOLD <= expiration)
+				next = expiration - TUNNEL_EXPIRATION_THRESHOLD + 1;
+		}
+		else if (tunnel->GetState () != eTunnelStateExpiring)
+			// might get established again after failed test
+			next = std::min (next, ts + TUNNELS_SCHEDULE_RECHECK_INTERVAL);
+		Schedule (next, { tunnel, 0, false });
+	}
+
+	void Tunnels::ProcessSchedule (uint64_t ts)
 	{
-		// check pending tunnel. delete failed or timeout
-		uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
-		for (auto it = pendingTunnels.begin (); it != pendingTunnels.end ();)
+		if (!m_LastScheduleTime) m_LastScheduleTime = ts;
+		if (ts <= m_LastScheduleTime) return; // clock went back, wait for it
+		uint64_t from = m_LastScheduleTime + 1;
+		if (ts - m_LastScheduleTime > TUNNELS_SCHEDULE_RING_SIZE) from = ts - TUNNELS_SCHEDULE_RING_SIZE + 1;
+		m_LastScheduleTime = ts; // rescheduled entries go to next buckets
+		for (uint64_t t = from; t <= ts; t++)
 		{
-			auto tunnel = it->second;
-			auto pool = tunnel->GetTunnelPool();
-			switch (tunnel->GetState ())
+			std::vector<TunnelsScheduleEntry> entries;
+			entries.swap (m_Schedule[t % TUNNELS_SCHEDULE_RING_SIZE]);
+			for (auto& it: entries)
 			{
-				case eTunnelStatePending:
-					if (ts > tunnel->GetCreationTime () + TUNNEL_CREATION_TIMEOUT)
+				if (it.isPending)
+				{
+					if (it.tunnel->IsInbound ())
+						ManagePendingTunnel (it.replyMsgID, it.tunnel, m_PendingInboundTunnels, ts);
+					else
+						ManagePendingTunnel (it.replyMsgID, it.tunnel, m_PendingOutboundTunnels, ts);
+				}
+				else
+					ProcessScheduledTunnel (it.tunnel, ts);
+			}
+		}
+	}
+
+	void Tunnels::PendingTunnelCompleted (uint32_t replyMsgID, bool isInbound)
+	{
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		if (isInbound)
+		{
+			auto tunnel = m_PendingInboundTunnels.Find (replyMsgID);
+			if (tunnel)
+				ManagePendingTunnel (replyMsgID, *tunnel, m_PendingInboundTunnels, ts);
+		}
+		else
+		{
+			auto tunnel = m_PendingOutboundTunnels.Find (replyMsgID);
+			if (tunnel)
+				ManagePendingTunnel (replyMsgID, *tunnel, m_PendingOutboundTunnels, ts);
+		}
+	}
+
+	template<class PendingTunnels>
+	void Tunnels::ManagePendingTunnel (uint32_t replyMsgID, std::shared_ptr<Tunnel> tunnel, PendingTunnels& pendingTunnels, uint64_t ts)
+	{
+		// delete failed, timed out or established tunnel
+		auto pending = pendingTunnels.Find (replyMsgID);
+		if (!pending || *pending != tunnel) return; // already deleted
+		auto pool = tunnel->GetTunnelPool();
+		switch (tunnel->GetState ())
+		{
+			case eTunnelStatePending:
+				if (ts > tunnel->GetCreationTime () + TUNNEL_CREATION_TIMEOUT)
+				{
+					LogPrint (eLogDebug, "Tunnel: pending build request ", replyMsgID, " timeout, deleted");
+					// update stats
+					auto config = tunnel->GetTunnelConfig ();
+					if (config)
 					{
-						LogPrint (eLogDebug, "Tunnel: pending build request ", it->first, " timeout, deleted");
-						// update stats
-						auto config = tunnel->GetTunnelConfig ();
-						if (config)
+						auto hop = config->GetFirstHop ();
+						while (hop)
 						{
-							auto hop = config->GetFirstHop ();
-							while (hop)
+							if (hop->ident)
 							{
-								if (hop->ident)
-								{
-									auto profile = i2p::data::netdb.FindRouterProfile (hop->ident->GetIdentHash ());
-									if (profile)
-										profile->TunnelNonReplied ();
-								}
-								hop = hop->next;
+								auto profile = i2p::data::netdb.FindRouterProfile (hop->ident->GetIdentHash ());
+								if (profile)
+									profile->TunnelNonReplied ();
 							}
+							hop = hop->next;
 						}
-#ifdef WITH_EVENTS
-						EmitTunnelEvent("tunnel.state", tunnel.get(), eTunnelStateBuildFailed);
-#endif
-						// for i2lua
-						if(pool) pool->OnTunnelBuildResult(tunnel, eBuildResultTimeout);
-						// delete
-						it = pendingTunnels.erase (it);
-						m_NumFailedTunnelCreations++;
 					}
-					else
-						++it;
-				break;
-				case eTunnelStateBuildFailed:
-					LogPrint (eLogDebug, "Tunnel: pending build request ", it->first, " failed, deleted");
 #ifdef WITH_EVENTS
 					EmitTunnelEvent("tunnel.state", tunnel.get(), eTunnelStateBuildFailed);
 #endif
 					// for i2lua
-					if(pool) pool->OnTunnelBuildResult(tunnel, eBuildResultRejected);
-
-					it = pendingTunnels.erase (it);
+					if(pool) pool->OnTunnelBuildResult(*pending, eBuildResultTimeout);
+					// delete
+					pendingTunnels.Erase (replyMsgID);
 					m_NumFailedTunnelCreations++;
-				break;
-				case eTunnelStateBuildReplyReceived:
-					// intermediate state, will be either established of build failed
-					++it;
-				break;
-				default:
-					// success
-					it = pendingTunnels.erase (it);
-					m_NumSuccesiveTunnelCreations++;
-			}
+				}
+			break;
+			case eTunnelStateBuildFailed:
+				LogPrint (eLogDebug, "Tunnel: pending build request ", replyMsgID, " failed, deleted");
+#ifdef WITH_EVENTS
+				EmitTunnelEvent("tunnel.state", tunnel.get(), eTunnelStateBuildFailed);
+#endif
+				// for i2lua
+				if(pool) pool->OnTunnelBuildResult(*pending, eBuildResultRejected);
+
+				pendingTunnels.Erase (replyMsgID);
+				m_NumFailedTunnelCreations++;
+			break;
+			case eTunnelStateBuildReplyReceived:
+				// intermediate state, will be either established of build failed
+			break;
+			default:
+				// success
+				pendingTunnels.Erase (replyMsgID);
+				m_NumSuccesiveTunnelCreations++;
 		}
 	}
 
-	void Tunnels::ManageOutboundTunnels ()
+	void Tunnels::ProcessScheduledTunnel (std::shared_ptr<Tunnel> tunnel, uint64_t ts)
 	{
-		uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
+		uint64_t expiration = tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT;
+		if (ts > expiration)
 		{
-			for (auto it = m_OutboundTunnels.begin (); it != m_OutboundTunnels.end ();)
+			LogPrint (eLogDebug, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " expired");
+			if (tunnel->IsInbound ())
 			{
-				auto tunnel = *it;
-				if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
+				auto inboundTunnel = std::static_pointer_cast<InboundTunnel>(tunnel);
+				auto pool = tunnel->GetTunnelPool ();
+				if (pool)
+					pool->TunnelExpired (inboundTunnel);
 				{
-					LogPrint (eLogDebug, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " expired");
-					auto pool = tunnel->GetTunnelPool ();
-					if (pool)
-						pool->TunnelExpired (tunnel);
-					// we don't have outbound tunnels in m_Tunnels
-					it = m_OutboundTunnels.erase (it);
+					std::unique_lock<std::mutex> l(m_TunnelsMutex);
+					m_Tunnels.Erase (tunnel->GetTunnelID ());
 				}
-				else
+				m_InboundTunnels.remove (inboundTunnel);
+			}
+			else
+			{
+				auto outboundTunnel = std::static_pointer_cast<OutboundTunnel>(tunnel);
+				auto pool = tunnel->GetTunnelPool ();
+				if (pool)
+					pool->TunnelExpired (outboundTunnel);
+				// we don't have outbound tunnels in m_Tunnels
+				m_OutboundTunnels.remove (outboundTunnel);
+			}
+			return;
+		}
+		if (tunnel->IsEstablished ())
+		{
+			if (!tunnel->IsRecreated () && ts + TUNNEL_RECREATION_THRESHOLD > expiration)
+			{
+				auto pool = tunnel->GetTunnelPool ();
+				// let it die if the tunnel pool has been reconfigured and has different number of hops
+				if (pool)
 				{
-					if (tunnel->IsEstablished ())
+					if (tunnel->IsInbound ())
 					{
-						if (!tunnel->IsRecreated () && ts + TUNNEL_RECREATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
+						if (tunnel->GetNumHops() == pool->GetNumInboundHops())
 						{
-							auto pool = tunnel->GetTunnelPool ();
-							// let it die if the tunnel pool has been reconfigured and this is old
-							if (pool && tunnel->GetNumHops() == pool->GetNumOutboundHops())
-							{
-								tunnel->SetIsRecreated ();
-								pool->RecreateOutboundTunnel (tunnel);
-							}
+							tunnel->SetIsRecreated ();
+							pool->RecreateInboundTunnel (std::static_pointer_cast<InboundTunnel>(tunnel));
 						}
-						if (ts + TUNNEL_EXPIRATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
-							tunnel->SetState (eTunnelStateExpiring);
 					}
-					++it;
+					else if (tunnel->GetNumHops() == pool->GetNumOutboundHops())
+					{
+						tunnel->SetIsRecreated ();
+						pool->RecreateOutboundTunnel (std::static_pointer_cast<OutboundTunnel>(tunnel));
+					}
 				}
 			}
+			if (ts + TUNNEL_EXPIRATION_THRESHOLD > expiration)
+				tunnel->SetState (eTunnelStateExpiring);
 		}
+		ScheduleTunnel (tunnel, ts);
+	}
 
+	void Tunnels::ManageOutboundTunnels ()
+	{
 		if (m_OutboundTunnels.size () < 3)
 		{
 			// trying to create one more oubound tunnel
@@ -704,44 +986,9 @@ namespace tunnel
 
 	void Tunnels::ManageInboundTunnels ()
 	{
-		uint64_t ts = i2p::util::GetSecondsSinceEpoch ();
-		{
-			for (auto it = m_InboundTunnels.begin (); it != m_InboundTunnels.end ();)
-			{
-				auto tunnel = *it;
-				if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
-				{
-					LogPrint (eLogDebug, "Tunnel: tunnel with id ", tunnel->GetTunnelID (), " expired");
-					auto pool = tunnel->GetTunnelPool ();
-					if (pool)
-						pool->TunnelExpired (tunnel);
-					m_Tunnels.erase (tunnel->GetTunnelID ());
-					it = m_InboundTunnels.erase (it);
-				}
-				else
-				{
-					if (tunnel->IsEstablished ())
-					{
-						if (!tunnel->IsRecreated () && ts + TUNNEL_RECREATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
-						{
-							auto pool = tunnel->GetTunnelPool ();
-							// let it die if the tunnel pool was reconfigured and has different number of hops
-							if (pool && tunnel->GetNumHops() == pool->GetNumInboundHops())
-							{
-								tunnel->SetIsRecreated ();
-								pool->RecreateInboundTunnel (tunnel);
-							}
-						}
-
-						if (ts + TUNNEL_EXPIRATION_THRESHOLD > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
-							tunnel->SetState (eTunnelStateExpiring);
-						else // we don't need to cleanup expiring tunnels
-							tunnel->Cleanup ();
-					}
-					it++;
-				}
-			}
-		}
+		if (m_Workers.empty ()) // workers cleanup their own
+			for (auto& it: m_InboundTunnels)
+				if (it->IsEstablished ()) it->Cleanup (); // we don't need to cleanup expiring tunnels
 
 		if (m_InboundTunnels.empty ())
 		{
@@ -755,6 +1002,7 @@ namespace tunnel
 				int ibNum; i2p::config::GetOption("exploratory.inbound.quantity", ibNum);
 				int obNum; i2p::config::GetOption("exploratory.outbound.quantity", obNum);
 				m_ExploratoryPool = CreateTunnelPool (ibLen, obLen, ibNum, obNum);
+				m_ExploratoryPool->SetCritical (true); // other pools' builds go through it
 				m_ExploratoryPool->SetLocalDestination (i2p::context.GetSharedDestination ());
 			}
 			return;
@@ -780,44 +1028,93 @@ namespace tunnel
 	void Tunnels::ManageTransitTunnels ()
 	{
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-		for (auto it = m_TransitTunnels.begin (); it != m_TransitTunnels.end ();)
+		i2p::metrics::ProfiledLock l(m_TransitTunnelsMutex);
+		while (!m_TransitTunnels.empty () &&
+			ts > m_TransitTunnels.front ().creationTime + TRANSIT_TUNNELS_BUCKET_INTERVAL + TUNNEL_EXPIRATION_TIMEOUT)
 		{
-			auto tunnel = *it;
-			if (ts > tunnel->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT)
-			{
-				LogPrint (eLogDebug, "Tunnel: Transit tunnel with id ", tunnel->GetTunnelID (), " expired");
-				m_Tunnels.erase (tunnel->GetTunnelID ());
-				it = m_TransitTunnels.erase (it);
-			}
-			else
+			auto& expired = m_TransitTunnels.front ().tunnels;
+			LogPrint (eLogDebug, "Tunnel: ", expired.size (), " transit tunnels expired");
 			{
-				tunnel->Cleanup ();
-				it++;
+				std::unique_lock<std::mutex> l(m_TunnelsMutex);
+				for (const auto& it: expired)
+					m_Tunnels.Erase (it->GetTunnelID ());
 			}
+			m_NumTransitTunnels -= expired.size ();
+			m_TransitTunnels.pop_front ();
 		}
+		if (m_Workers.empty ()) // otherwise cleaned up by worker
+			for (auto& bucket: m_TransitTunnels)
+				for (auto& it: bucket.tunnels)
+					it->Cleanup ();
 	}
 
 	void Tunnels::ManageTunnelPools ()
 	{
-		std::unique_lock<std::mutex> l(m_PoolsMutex);
+		i2p::metrics::ProfiledLock l(m_PoolsMutex);
+		// critical pools are completed first, others ramp up within common budget
 		for (auto& pool : m_Pools)
+			if (pool && pool->IsActive () && pool->IsCritical ())
+				pool->CreateTunnels ();
+		int numBuilds = 0;
+		auto it = m_Pools.begin ();
+		for (; it != m_Pools.end () && numBuilds < TUNNEL_POOLS_MAX_NUM_BUILDS_PER_MANAGE; ++it)
 		{
+			auto& pool = *it;
+			if (pool && pool->IsActive () && !pool->IsCritical ())
+				numBuilds += pool->CreateTunnels (TUNNEL_POOL_RAMP_UP_NUM_BUILDS);
+		}
+		if (it != m_Pools.end ()) // pools left out go first next time
+			m_Pools.splice (m_Pools.end (), m_Pools, m_Pools.begin (), it);
+		for (auto& pool : m_Pools)
 			if (pool && pool->IsActive ())
-			{
-				pool->CreateTunnels ();
 				pool->TestTunnels ();
-			}
-		}
+	}
+
+	TunnelDataWorker * Tunnels::GetTunnelDataWorker (std::shared_ptr<I2NPMessage> msg) const
+	{
+		if (m_Workers.empty ()) return nullptr;
+		auto typeID = msg->GetTypeID ();
+		if (typeID != eI2NPTunnelData && typeID != eI2NPTunnelGateway) return nullptr; // build messages go to tunnels thread
+		uint32_t tunnelID = bufbe32toh (msg->GetPayload ());
+		return m_Workers[tunnelID % m_Workers.size ()].get ();
 	}
 
 	void Tunnels::PostTunnelData (std::shared_ptr<I2NPMessage> msg)
 	{
-		if (msg) m_Queue.Put (msg);
+		if (!msg) return;
+		if (msg->IsExpired (i2p::util::GetCoarseMillisecondsSinceEpoch (), I2NP_MESSAGE_CLOCK_SKEW))
+		{
+			i2p::metrics::tunnelsExpiredMessages.Inc ();
+			return;
+		}
+		auto worker = GetTunnelDataWorker (msg);
+		if (worker)
+			worker->PostTunnelData (msg);
+		else
+			m_Queue.Put (msg);
 	}
 
 	void Tunnels::PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs)
 	{
-		m_Queue.Put (msgs);
+		if (m_Workers.empty ())
+		{
+			m_Queue.Put (msgs);
+			return;
+		}
+		// split by worker, preserve order within every tunnel
+		std::vector<std::vector<std::shared_ptr<I2NPMessage> > > shards (m_Workers.size ());
+		std::vector<std::shared_ptr<I2NPMessage> > others;
+		for (const auto& it: msgs)
+		{
+			auto typeID = it->GetTypeID ();
+			if (typeID == eI2NPTunnelData || typeID == eI2NPTunnelGateway)
+				shards[bufbe32toh (it->GetPayload ()) % m_Workers.size ()].push_back (it);
+			else
+				others.push_back (it);
+		}
+		for (size_t i = 0; i < shards.size (); i++)
+			m_Workers[i]->PostTunnelData (shards[i]);
+		m_Queue.Put (others);
 	}
 
 	template<class TTunnel>
@@ -825,9 +1122,19 @@ namespace tunnel
 	{
 		auto newTunnel = std::make_shared<TTunnel> (config);
 		uint32_t replyMsgID;
-		RAND_bytes ((uint8_t *)&replyMsgID, 4);
+		replyMsgID = i2p::crypto::RandUint32 ();
 		AddPendingTunnel (replyMsgID, newTunnel);
-		newTunnel->Build (replyMsgID, outboundTunnel);
+		if (!m_BuildWorkers.empty ())
+		{
+			// records encryption is expensive, builds of all pools are encrypted by build workers in parallel
+			m_OutboundBuilds.Put ([newTunnel, replyMsgID, outboundTunnel]()
+				{
+					newTunnel->SendTunnelBuildMsg (newTunnel->CreateTunnelBuildMsg (replyMsgID), outboundTunnel);
+				});
+			m_BuildRequests.WakeUp (); // workers wait for build requests
+		}
+		else
+			newTunnel->Build (replyMsgID, outboundTunnel);
 		return newTunnel;
 	}
 
@@ -849,18 +1156,21 @@ namespace tunnel
 
 	void Tunnels::AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<InboundTunnel> tunnel)
 	{
-		m_PendingInboundTunnels[replyMsgID] = tunnel;
+		m_PendingInboundTunnels.Set (replyMsgID, tunnel);
+		Schedule (tunnel->GetCreationTime () + TUNNEL_CREATION_TIMEOUT + 1, { tunnel, replyMsgID, true });
 	}
 
 	void Tunnels::AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> tunnel)
 	{
-		m_PendingOutboundTunnels[replyMsgID] = tunnel;
+		m_PendingOutboundTunnels.Set (replyMsgID, tunnel);
+		Schedule (tunnel->GetCreationTime () + TUNNEL_CREATION_TIMEOUT + 1, { tunnel, replyMsgID, true });
 	}
 
 	void Tunnels::AddOutboundTunnel (std::shared_ptr<OutboundTunnel> newTunnel)
 	{
 		// we don't need to insert it to m_Tunnels
 		m_OutboundTunnels.push_back (newTunnel);
+		ScheduleTunnel (newTunnel, i2p::util::GetSecondsSinceEpoch ());
 		auto pool = newTunnel->GetTunnelPool ();
 		if (pool && pool->IsActive ())
 			pool->TunnelCreated (newTunnel);
@@ -870,9 +1180,15 @@ namespace tunnel
 
 	void Tunnels::AddInboundTunnel (std::shared_ptr<InboundTunnel> newTunnel)
 	{
-		if (m_Tunnels.emplace (newTunnel->GetTunnelID (), newTunnel).second)
+		bool inserted;
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			inserted = m_Tunnels.Insert (newTunnel->GetTunnelID (), newTunnel);
+		}
+		if (inserted)
 		{
 			m_InboundTunnels.push_back (newTunnel);
+			ScheduleTunnel (newTunnel, i2p::util::GetSecondsSinceEpoch ());
 			auto pool = newTunnel->GetTunnelPool ();
 			if (!pool)
 			{
@@ -899,7 +1215,11 @@ namespace tunnel
 		auto inboundTunnel = std::make_shared<ZeroHopsInboundTunnel> ();
 		inboundTunnel->SetState (eTunnelStateEstablished);
 		m_InboundTunnels.push_back (inboundTunnel);
-		m_Tunnels[inboundTunnel->GetTunnelID ()] = inboundTunnel;
+		ScheduleTunnel (inboundTunnel, i2p::util::GetSecondsSinceEpoch ());
+		{
+			std::unique_lock<std::mutex> l(m_TunnelsMutex);
+			m_Tunnels.Set (inboundTunnel->GetTunnelID (), inboundTunnel);
+		}
 		return inboundTunnel;
 	}
 
@@ -908,27 +1228,29 @@ namespace tunnel
 		auto outboundTunnel = std::make_shared<ZeroHopsOutboundTunnel> ();
 		outboundTunnel->SetState (eTunnelStateEstablished);
 		m_OutboundTunnels.push_back (outboundTunnel);
+		ScheduleTunnel (outboundTunnel, i2p::util::GetSecondsSinceEpoch ());
 		// we don't insert into m_Tunnels
 		return outboundTunnel;
 	}
 
 	int Tunnels::GetTransitTunnelsExpirationTimeout ()
 	{
-		int timeout = 0;
 		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
-		// TODO: possible race condition with I2PControl
-		for (const auto& it : m_TransitTunnels)
-		{
-			int t = it->GetCreationTime () + TUNNEL_EXPIRATION_TIMEOUT - ts;
-			if (t > timeout) timeout = t;
-		}
-		return timeout;
+		i2p::metrics::ProfiledLock l(m_TransitTunnelsMutex);
+		if (m_TransitTunnels.empty ()) return 0;
+		int timeout = m_TransitTunnels.back ().creationTime + TRANSIT_TUNNELS_BUCKET_INTERVAL + TUNNEL_EXPIRATION_TIMEOUT - ts;
+		return timeout > 0 ? timeout : 0;
+	}
+
+	bool Tunnels::IsOverloaded ()
+	{
+		return GetQueueSize () > TUNNELS_OVERLOAD_QUEUE_SIZE ||
+			m_ProcessingTime > TUNNELS_OVERLOAD_PROCESSING_TIME*1000LL;
 	}
 
 	size_t Tunnels::CountTransitTunnels() const
 	{
-		// TODO: locking
-		return m_TransitTunnels.size();
+		return m_NumTransitTunnels;
 	}
 
 	size_t Tunnels::CountInboundTunnels() const
@@ -5,12 +5,16 @@
 #include <map>
 #include <unordered_map>
 #include <list>
+#include <deque>
 #include <vector>
 #include <string>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <memory>
+#include <functional>
 #include "Queue.h"
+#include "util.h"
 #include "Crypto.h"
 #include "TunnelConfig.h"
 #include "TunnelPool.h"
@@ -20,6 +24,7 @@
 #include "TunnelBase.h"
 #include "I2NPProtocol.h"
 #include "Event.h"
+#include "Metrics.h"
 
 namespace i2p
 {
@@ -67,6 +72,20 @@ namespace tunnel
 	const int TUNNEL_RECREATION_THRESHOLD = 90; // 1.5 minutes
 	const int TUNNEL_CREATION_TIMEOUT = 30; // 30 seconds
 	const int STANDARD_NUM_RECORDS = 5; // in VariableTunnelBuild message
+	const int TUNNEL_WORKER_CLEANUP_INTERVAL = 15; // in seconds
+	const int TUNNEL_MANAGE_INTERVAL = 15; // in seconds
+	const int TUNNEL_POOLS_MAX_NUM_BUILDS_PER_MANAGE = 200; // for pools not critical, the rest wait for next manage
+	const int TUNNEL_POOL_RAMP_UP_NUM_BUILDS = 1; // per direction per manage, for pools not critical
+	const int TUNNEL_BUILD_REQUESTS_MAX_QUEUE_SIZE = 256; // dropped if more
+	const int TUNNEL_BUILD_REQUESTS_OVERLOAD_QUEUE_SIZE = 64; // rejected with bandwidth reason if more
+	const int TUNNEL_LATENCY_EWMA_WEIGHT = 4; // new latency sample contributes 1/4
+	const int TUNNEL_CONFIRMATION_TIMEOUT = 2*TUNNEL_MANAGE_INTERVAL; // in seconds, tunnel with data delivered since is not tested
+	const int TUNNEL_DATA_MAX_NUM_UNFLUSHED_MSGS = 256; // tunnels of a batch are flushed together after that many messages
+	const int TUNNELS_SCHEDULE_RING_SIZE = 1024; // in seconds, longer than tunnel lifetime
+	const int TUNNELS_SCHEDULE_RECHECK_INTERVAL = 15; // in seconds, for tunnels not established at their event
+	const int TRANSIT_TUNNELS_BUCKET_INTERVAL = 15; // in seconds, transit tunnels created within it expire together
+	const int TUNNELS_OVERLOAD_QUEUE_SIZE = 2048; // tunnel data messages waiting, transit builds rejected if more
+	const int TUNNELS_OVERLOAD_PROCESSING_TIME = 200; // in milliseconds, average batch, transit builds rejected if longer
 
 	enum TunnelState
 	{
@@ -95,6 +114,8 @@ namespace tunnel
 			~Tunnel ();
 
 			void Build (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> outboundTunnel = nullptr);
+			std::shared_ptr<I2NPMessage> CreateTunnelBuildMsg (uint32_t replyMsgID); // encrypt records, doesn't send
+			void SendTunnelBuildMsg (std::shared_ptr<I2NPMessage> msg, std::shared_ptr<OutboundTunnel> outboundTunnel);
 
 			std::shared_ptr<const TunnelConfig> GetTunnelConfig () const { return m_Config; }
 			std::vector<std::shared_ptr<const i2p::data::IdentityEx> > GetPeers () const;
@@ -120,13 +141,16 @@ namespace tunnel
 			void EncryptTunnelMsg (std::shared_ptr<const I2NPMessage> in, std::shared_ptr<I2NPMessage> out);
 
 			/** @brief add latency sample */
-			void AddLatencySample(const uint64_t ms) { m_Latency = (m_Latency + ms) >> 1; }
+			void AddLatencySample(const uint64_t ms);
 			/** @brief get this tunnel's estimated latency */
 			uint64_t GetMeanLatency() const { return m_Latency; }
 			/** @brief return true if this tunnel's latency fits in range [lowerbound, upperbound] */
 			bool LatencyFitsRange(uint64_t lowerbound, uint64_t upperbound) const;
 
 			bool LatencyIsKnown() const { return m_Latency > 0; }
+
+			void SetConfirmed (uint32_t ts) { m_LastConfirmedTime = ts; }; // data delivered through, from any thread
+			bool IsConfirmedRecently (uint32_t ts) const { return ts < m_LastConfirmedTime + TUNNEL_CONFIRMATION_TIMEOUT; };
 		protected:
 
 			void PrintHops (std::stringstream& s) const;
@@ -139,6 +163,8 @@ namespace tunnel
 			TunnelState m_State;
 			bool m_IsRecreated;
 			uint64_t m_Latency; // in milliseconds
+			uint64_t m_BuildStartTime; // in milliseconds
+			std::atomic<uint32_t> m_LastConfirmedTime; // in seconds
 	};
 
 	class OutboundTunnel: public Tunnel
@@ -212,6 +238,47 @@ namespace tunnel
 			size_t m_NumSentBytes;
 	};
 
+	class Tunnels;
+	class TunnelDataWorker
+	{
+		public:
+
+			TunnelDataWorker (Tunnels& owner, int index);
+			~TunnelDataWorker ();
+
+			void Start ();
+			void Stop ();
+
+			void PostTunnelData (std::shared_ptr<I2NPMessage> msg) { m_Queue.Put (msg); };
+			void PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs) { m_Queue.Put (msgs); };
+			int GetQueueSize () { return m_Queue.GetSize (); };
+
+		private:
+
+			void Run ();
+
+		private:
+
+			Tunnels& m_Owner;
+			int m_Index;
+			bool m_IsRunning;
+			std::thread * m_Thread;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_Queue;
+	};
+
+	struct TunnelsScheduleEntry
+	{
+		std::shared_ptr<Tunnel> tunnel;
+		uint32_t replyMsgID; // for pending tunnel
+		bool isPending; // build timeout, otherwise recreation, expiring or expiration
+	};
+
+	struct TransitTunnelsBucket
+	{
+		uint32_t creationTime; // start of interval
+		std::vector<std::shared_ptr<TransitTunnel> > tunnels;
+	};
+
 	class Tunnels
 	{
 		public:
@@ -237,31 +304,43 @@ namespace tunnel
 			void PostTunnelData (const std::vector<std::shared_ptr<I2NPMessage> >& msgs);
 			void AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<InboundTunnel> tunnel);
 			void AddPendingTunnel (uint32_t replyMsgID, std::shared_ptr<OutboundTunnel> tunnel);
+			void PendingTunnelCompleted (uint32_t replyMsgID, bool isInbound); // after build reply is handled
 			std::shared_ptr<TunnelPool> CreateTunnelPool (int numInboundHops,
 				int numOuboundHops, int numInboundTunnels, int numOutboundTunnels);
 			void DeleteTunnelPool (std::shared_ptr<TunnelPool> pool);
 			void StopTunnelPool (std::shared_ptr<TunnelPool> pool);
 
+			// called from tunnel data workers
+			void ProcessTunnelMessages (std::shared_ptr<I2NPMessage> msg, i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> >& queue);
+			void CleanupTunnels (int workerIndex);
+
 		private:
 
 			template<class TTunnel>
 			std::shared_ptr<TTunnel> CreateTunnel (std::shared_ptr<TunnelConfig> config, std::shared_ptr<OutboundTunnel> outboundTunnel = nullptr);
 
 			template<class TTunnel>
-			std::shared_ptr<TTunnel> GetPendingTunnel (uint32_t replyMsgID, const std::map<uint32_t, std::shared_ptr<TTunnel> >& pendingTunnels);
+			std::shared_ptr<TTunnel> GetPendingTunnel (uint32_t replyMsgID, i2p::util::FlatHashMap<std::shared_ptr<TTunnel> >& pendingTunnels);
 
 			void HandleTunnelGatewayMsg (std::shared_ptr<TunnelBase> tunnel, std::shared_ptr<I2NPMessage> msg);
+			TunnelDataWorker * GetTunnelDataWorker (std::shared_ptr<I2NPMessage> msg) const;
+			bool PostTunnelBuildRequest (std::shared_ptr<I2NPMessage> msg); // false if not a request or no build workers
+			void RunBuildWorker ();
 
 			void Run ();
 			void ManageTunnels ();
 			void ManageOutboundTunnels ();
 			void ManageInboundTunnels ();
 			void ManageTransitTunnels ();
-			void ManagePendingTunnels ();
 			template<class PendingTunnels>
-			void ManagePendingTunnels (PendingTunnels& pendingTunnels);
+			void ManagePendingTunnel (uint32_t replyMsgID, std::shared_ptr<Tunnel> tunnel, PendingTunnels& pendingTunnels, uint64_t ts);
 			void ManageTunnelPools ();
 
+			void Schedule (uint64_t ts, const TunnelsScheduleEntry& entry); // ts in seconds
+			void ScheduleTunnel (std::shared_ptr<Tunnel> tunnel, uint64_t ts); // at next state change
+			void ProcessSchedule (uint64_t ts);
+			void ProcessScheduledTunnel (std::shared_ptr<Tunnel> tunnel, uint64_t ts);
+
 			std::shared_ptr<ZeroHopsInboundTunnel> CreateZeroHopsInboundTunnel ();
 			std::shared_ptr<ZeroHopsOutboundTunnel> CreateZeroHopsOutboundTunnel ();
 
@@ -269,16 +348,26 @@ namespace tunnel
 
 			bool m_IsRunning;
 			std::thread * m_Thread;
-			std::map<uint32_t, std::shared_ptr<InboundTunnel> > m_PendingInboundTunnels; // by replyMsgID
-			std::map<uint32_t, std::shared_ptr<OutboundTunnel> > m_PendingOutboundTunnels; // by replyMsgID
+			i2p::util::FlatHashMap<std::shared_ptr<InboundTunnel> > m_PendingInboundTunnels; // by replyMsgID, timeouts are in m_Schedule
+			i2p::util::FlatHashMap<std::shared_ptr<OutboundTunnel> > m_PendingOutboundTunnels; // by replyMsgID
 			std::list<std::shared_ptr<InboundTunnel> > m_InboundTunnels;
 			std::list<std::shared_ptr<OutboundTunnel> > m_OutboundTunnels;
-			std::list<std::shared_ptr<TransitTunnel> > m_TransitTunnels;
-			std::unordered_map<uint32_t, std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel known by this id
-			std::mutex m_PoolsMutex;
+			std::vector<std::vector<TunnelsScheduleEntry> > m_Schedule; // ring of buckets by second of next event
+			uint64_t m_LastScheduleTime; // last processed second
+			std::deque<TransitTunnelsBucket> m_TransitTunnels; // oldest first, expired by whole buckets
+			std::atomic<size_t> m_NumTransitTunnels;
+			i2p::metrics::ProfiledMutex m_TransitTunnelsMutex { "tunnels.transit" }; // transit tunnels are added from build workers
+			i2p::util::FlatHashMap<std::shared_ptr<TunnelBase> > m_Tunnels; // tunnelID->tunnel known by this id
+			std::mutex m_TunnelsMutex; // guards m_Tunnels, accessed from data workers
+			i2p::metrics::ProfiledMutex m_PoolsMutex { "tunnels.pools" };
 			std::list<std::shared_ptr<TunnelPool>> m_Pools;
 			std::shared_ptr<TunnelPool> m_ExploratoryPool;
-			i2p::util::Queue<std::shared_ptr<I2NPMessage> > m_Queue;
+			i2p::util::MPSCQueue<std::shared_ptr<I2NPMessage> > m_Queue;
+			std::vector<std::unique_ptr<TunnelDataWorker> > m_Workers; // tunnel data sharded by tunnelID, empty if processed by tunnels thread
+			i2p::util::Queue<std::shared_ptr<I2NPMessage> > m_BuildRequests;
+			std::atomic<uint64_t> m_ProcessingTime; // average of messages batch in microseconds, messages wait about that long
+			i2p::util::Queue<std::function<void ()> > m_OutboundBuilds; // our tunnel builds to encrypt and send by build workers
+			std::vector<std::unique_ptr<std::thread> > m_BuildWorkers; // decrypt build requests, empty if processed by tunnels thread
 
 			// some stats
 			int m_NumSuccesiveTunnelCreations, m_NumFailedTunnelCreations;
@@ -294,7 +383,14 @@ namespace tunnel
 			size_t CountInboundTunnels() const;
 			size_t CountOutboundTunnels() const;
 
-			int GetQueueSize () { return m_Queue.GetSize (); };
+			int GetQueueSize ()
+			{
+				int size = m_Queue.GetSize ();
+				for (auto& it: m_Workers) size += it->GetQueueSize ();
+				return size;
+			}
+			uint64_t GetProcessingTime () const { return m_ProcessingTime; }; // in microseconds
+			bool IsOverloaded (); // can't forward more transit traffic
 			int GetTunnelCreationSuccessRate () const // in percents
 			{
 				int totalNum = m_NumSuccesiveTunnelCreations + m_NumFailedTunnelCreations;
@@ -13,6 +13,23 @@ namespace i2p
 {
 namespace tunnel
 {
+	static size_t GetExpectedMessageLength (std::shared_ptr<const I2NPMessage> msg, size_t fragmentSize)
+	{
+		// first fragment starts with I2NP header, use declared size to avoid growing buffer multiple times
+		size_t len = msg->GetLength () + fragmentSize;
+		if (msg->GetLength () >= I2NP_HEADER_SIZE)
+		{
+			size_t declared = msg->GetSize () + I2NP_HEADER_SIZE;
+			if (declared > len) len = declared;
+		}
+		return len;
+	}
+
+	static uint64_t GetFragmentKey (uint32_t msgID, uint8_t fragmentNum)
+	{
+		return ((uint64_t)msgID << 8) | fragmentNum;
+	}
+
 	TunnelEndpoint::~TunnelEndpoint ()
 	{
 	}
@@ -36,7 +53,8 @@ namespace tunnel
 				return;
 			}
 			// process fragments
-			while (fragment < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
+			uint8_t * end = decrypted + TUNNEL_DATA_ENCRYPTED_SIZE;
+			while (fragment < end)
 			{
 				uint8_t flag = fragment[0];
 				fragment++;
@@ -96,13 +114,29 @@ namespace tunnel
 					LogPrint (eLogError, "TunnelMessage: fragment is too long ", (int)size);
 					return;
 				}
-				if (fragment + size < decrypted + TUNNEL_DATA_ENCRYPTED_SIZE)
+				uint8_t * next = fragment + size;
+				if (next < end)
 				{
-					// this is not last message. we have to copy it
-					m.data = NewI2NPTunnelMessage ();
-					m.data->offset += TUNNEL_GATEWAY_HEADER_SIZE; // reserve room for TunnelGateway header
-					m.data->len += TUNNEL_GATEWAY_HEADER_SIZE;
-					*(m.data) = *msg;
+					// this is not last message, we have to copy either it or the rest
+					size_t rest = end - next, restOffset = next - msg->buf;
+					auto copy = NewI2NPTunnelMessage ();
+					if (rest < size && restOffset + rest <= copy->maxLen)
+					{
+						// keep this message in place and continue with the rest at the same offset
+						memcpy (copy->buf + restOffset, next, rest);
+						copy->from = msg->from;
+						m.data = msg;
+						msg = copy;
+						next = copy->buf + restOffset;
+						end = next + rest;
+					}
+					else
+					{
+						copy->offset += TUNNEL_GATEWAY_HEADER_SIZE; // reserve room for TunnelGateway header
+						copy->len += TUNNEL_GATEWAY_HEADER_SIZE;
+						*copy = *msg;
+						m.data = copy;
+					}
 				}
 				else
 					m.data = msg;
@@ -116,7 +150,7 @@ namespace tunnel
 						if (!isFollowOnFragment) // create new incomlete message
 						{
 							m.nextFragmentNum = 1;
-							m.receiveTime = i2p::util::GetMillisecondsSinceEpoch ();
+							m.receiveTime = i2p::util::GetCoarseMillisecondsSinceEpoch ();
 							auto ret = m_IncompleteMessages.insert (std::pair<uint32_t, TunnelMessageBlockEx>(msgID, m));
 							if (ret.second)
 								HandleOutOfSequenceFragments (msgID, ret.first->second);
@@ -133,7 +167,7 @@ namespace tunnel
 						LogPrint (eLogError, "TunnelMessage: Message is fragmented, but msgID is not presented");
 				}
 
-				fragment += size;
+				fragment = next;
 			}
 		}
 		else
@@ -155,7 +189,7 @@ namespace tunnel
 					if (msg.data->len + size > msg.data->maxLen)
 					{
 					//	LogPrint (eLogWarning, "TunnelMessage: I2NP message size ", msg.data->maxLen, " is not enough");
-						auto newMsg = NewI2NPMessage ();
+						auto newMsg = NewI2NPMessage (GetExpectedMessageLength (msg.data, size));
 						*newMsg = *(msg.data);
 						msg.data = newMsg;
 					}
@@ -194,7 +228,7 @@ namespace tunnel
 
 	void TunnelEndpoint::AddOutOfSequenceFragment (uint32_t msgID, uint8_t fragmentNum, bool isLastFragment, std::shared_ptr<I2NPMessage> data)
 	{
-		if (!m_OutOfSequenceFragments.insert ({{msgID, fragmentNum}, {isLastFragment, data, i2p::util::GetMillisecondsSinceEpoch () }}).second)
+		if (!m_OutOfSequenceFragments.insert ({GetFragmentKey (msgID, fragmentNum), {isLastFragment, data, i2p::util::GetCoarseMillisecondsSinceEpoch () }}).second)
 			LogPrint (eLogInfo, "TunnelMessage: duplicate out-of-sequence fragment ", fragmentNum, " of message ", msgID);
 	}
 
@@ -213,7 +247,7 @@ namespace tunnel
 
 	bool TunnelEndpoint::ConcatNextOutOfSequenceFragment (uint32_t msgID, TunnelMessageBlockEx& msg)
 	{
-		auto it = m_OutOfSequenceFragments.find ({msgID, msg.nextFragmentNum});
+		auto it = m_OutOfSequenceFragments.find (GetFragmentKey (msgID, msg.nextFragmentNum));
 		if (it != m_OutOfSequenceFragments.end ())
 		{
 			LogPrint (eLogDebug, "TunnelMessage: Out-of-sequence fragment ", (int)msg.nextFragmentNum, " of message ", msgID, " found");
@@ -221,7 +255,7 @@ namespace tunnel
 			if (msg.data->len + size > msg.data->maxLen)
 			{
 				LogPrint (eLogWarning, "TunnelMessage: Tunnel endpoint I2NP message size ", msg.data->maxLen, " is not enough");
-				auto newMsg = NewI2NPMessage ();
+				auto newMsg = NewI2NPMessage (GetExpectedMessageLength (msg.data, size));
 				*newMsg = *(msg.data);
 				msg.data = newMsg;
 			}
@@ -259,13 +293,20 @@ namespace tunnel
 			break;
 			case eDeliveryTypeTunnel:
 				if (!m_IsInbound) // outbound transit tunnel
-					i2p::transport::transports.SendMessage (msg.hash, i2p::CreateTunnelGatewayMsg (msg.tunnelID, msg.data));
+				{
+					auto gatewayMsg = i2p::CreateTunnelGatewayMsg (msg.tunnelID, msg.data);
+					gatewayMsg->isTransit = true;
+					i2p::transport::transports.SendMessage (msg.hash, gatewayMsg);
+				}
 				else
 					LogPrint (eLogError, "TunnelMessage: Delivery type 'tunnel' arrived from an inbound tunnel, dropped");
 			break;
 			case eDeliveryTypeRouter:
 				if (!m_IsInbound) // outbound transit tunnel
+				{
+					msg.data->isTransit = true;
 					i2p::transport::transports.SendMessage (msg.hash, msg.data);
+				}
 				else // we shouldn't send this message. possible leakage
 					LogPrint (eLogError, "TunnelMessage: Delivery type 'router' arrived from an inbound tunnel, dropped");
 			break;
@@ -2,7 +2,7 @@
 #define TUNNEL_ENDPOINT_H__
 
 #include <inttypes.h>
-#include <map>
+#include <unordered_map>
 #include <string>
 #include "I2NPProtocol.h"
 #include "TunnelBase.h"
@@ -46,8 +46,8 @@ namespace tunnel
 
 		private:
 
-			std::map<uint32_t, TunnelMessageBlockEx> m_IncompleteMessages;
-			std::map<std::pair<uint32_t, uint8_t>, Fragment> m_OutOfSequenceFragments; // (msgID, fragment#)->fragment
+			std::unordered_map<uint32_t, TunnelMessageBlockEx> m_IncompleteMessages;
+			std::unordered_map<uint64_t, Fragment> m_OutOfSequenceFragments; // ((msgID << 8) + fragment#)->fragment
 			bool m_IsInbound;
 			size_t m_NumReceivedBytes;
 	};
@@ -1,9 +1,12 @@
 #include <string.h>
+#include <algorithm>
 #include "Crypto.h"
 #include "I2PEndian.h"
 #include "Log.h"
+#include "Timestamp.h"
 #include "RouterContext.h"
 #include "Transports.h"
+#include "Metrics.h"
 #include "TunnelGateway.h"
 
 namespace i2p
@@ -31,6 +34,8 @@ namespace tunnel
 			CreateCurrentTunnelDataMessage ();
 			messageCreated = true;
 		}
+		if (block.data && block.data->traceTime && !m_CurrentTunnelDataMsg->traceTime)
+			m_CurrentTunnelDataMsg->traceTime = block.data->traceTime; // trace first tunnel message of it
 
 		// create delivery instructions
 		uint8_t di[43]; // max delivery instruction length is 43 for tunnel
@@ -140,6 +145,51 @@ namespace tunnel
 		}
 	}
 
+	size_t TunnelGatewayBuffer::GetFullMessageLength (const TunnelMessageBlock& block)
+	{
+		size_t diLen = 1; // flag
+		if (block.deliveryType == eDeliveryTypeTunnel)
+			diLen += 4 + 32; // tunnelID and hash
+		else if (block.deliveryType == eDeliveryTypeRouter)
+			diLen += 32; // hash
+		return diLen + 2 + block.data->GetLength (); // 2 bytes length
+	}
+
+	void TunnelGatewayBuffer::PutI2NPMsgs (const std::vector<TunnelMessageBlock>& blocks)
+	{
+		if (blocks.size () < 2)
+		{
+			for (const auto& it: blocks)
+				PutI2NPMsg (it);
+			return;
+		}
+		// largest first, fragmented ones start new tunnel messages anyway,
+		// then space left in current tunnel message is filled by largest messages which fit
+		std::vector<std::pair<size_t, const TunnelMessageBlock *> > sorted;
+		sorted.reserve (blocks.size ());
+		for (const auto& it: blocks)
+			sorted.emplace_back (GetFullMessageLength (it), &it);
+		std::stable_sort (sorted.begin (), sorted.end (),
+			[](const std::pair<size_t, const TunnelMessageBlock *>& l, const std::pair<size_t, const TunnelMessageBlock *>& r)
+			{ return l.first > r.first; });
+		std::vector<bool> isPut (sorted.size (), false);
+		for (size_t i = 0; i < sorted.size (); i++)
+		{
+			if (isPut[i]) continue;
+			for (size_t j = i; j < sorted.size () && m_CurrentTunnelDataMsg && m_RemainingSize > 0; j++)
+				if (!isPut[j] && sorted[j].first <= m_RemainingSize)
+				{
+					PutI2NPMsg (*sorted[j].second);
+					isPut[j] = true;
+				}
+			if (!isPut[i])
+			{
+				PutI2NPMsg (*sorted[i].second);
+				isPut[i] = true;
+			}
+		}
+	}
+
 	void TunnelGatewayBuffer::ClearTunnelDataMsgs ()
 	{
 		m_TunnelDataMsgs.clear ();
@@ -165,7 +215,7 @@ namespace tunnel
 
 		m_CurrentTunnelDataMsg->offset = m_CurrentTunnelDataMsg->len - TUNNEL_DATA_MSG_SIZE - I2NP_HEADER_SIZE;
 		uint8_t * buf = m_CurrentTunnelDataMsg->GetPayload ();
-		RAND_bytes (buf + 4, 16); // original IV
+		i2p::crypto::RandBytes (buf + 4, 16); // original IV
 		memcpy (payload + size, buf + 4, 16); // copy IV for checksum
 		uint8_t hash[32];
 		SHA256(payload, size+16, hash);
@@ -175,7 +225,7 @@ namespace tunnel
 		if (paddingSize > 0)
 		{
 			// non-zero padding
-			auto randomOffset = rand () % (TUNNEL_DATA_MAX_PAYLOAD_SIZE - paddingSize + 1);
+			auto randomOffset = i2p::crypto::RandUint32 () % (TUNNEL_DATA_MAX_PAYLOAD_SIZE - paddingSize + 1);
 			memcpy (buf + 24, m_NonZeroRandomBuffer + randomOffset, paddingSize);
 		}
 
@@ -196,11 +246,27 @@ namespace tunnel
 	void TunnelGateway::PutTunnelDataMsg (const TunnelMessageBlock& block)
 	{
 		if (block.data)
-			m_Buffer.PutI2NPMsg (block);
+		{
+			if (block.data->IsExpired (i2p::util::GetCoarseMillisecondsSinceEpoch (), I2NP_MESSAGE_CLOCK_SKEW))
+			{
+				i2p::metrics::gatewayExpiredMessages.Inc ();
+				return;
+			}
+			m_PendingBlocks.push_back (block);
+		}
 	}
 
 	void TunnelGateway::SendBuffer ()
 	{
+		// don't fragment messages expired while pending, endpoint would drop them
+		auto ts = i2p::util::GetCoarseMillisecondsSinceEpoch ();
+		auto size = m_PendingBlocks.size ();
+		m_PendingBlocks.erase (std::remove_if (m_PendingBlocks.begin (), m_PendingBlocks.end (),
+			[ts](const TunnelMessageBlock& block) { return block.data->IsExpired (ts, I2NP_MESSAGE_CLOCK_SKEW); }), m_PendingBlocks.end ());
+		if (size != m_PendingBlocks.size ())
+			i2p::metrics::gatewayExpiredMessages.Inc (size - m_PendingBlocks.size ());
+		m_Buffer.PutI2NPMsgs (m_PendingBlocks);
+		m_PendingBlocks.clear ();
 		m_Buffer.CompleteCurrentTunnelDataMessage ();
 		std::vector<std::shared_ptr<I2NPMessage> > newTunnelMsgs;
 		const auto& tunnelDataMsgs = m_Buffer.GetTunnelDataMsgs ();
@@ -208,8 +274,14 @@ namespace tunnel
 		{
 			auto newMsg = CreateEmptyTunnelDataMsg ();
 			m_Tunnel->EncryptTunnelMsg (tunnelMsg, newMsg);
+			if (tunnelMsg->traceTime)
+			{
+				i2p::metrics::tracer.Record (i2p::metrics::eTraceStageGateway, tunnelMsg->traceTime);
+				newMsg->traceTime = tunnelMsg->traceTime;
+			}
 			htobe32buf (newMsg->GetPayload (), m_Tunnel->GetNextTunnelID ());
 			newMsg->FillI2NPMessageHeader (eI2NPTunnelData);
+			newMsg->isTransit = m_IsTransit;
 			newTunnelMsgs.push_back (newMsg);
 			m_NumSentBytes += TUNNEL_DATA_MSG_SIZE;
 		}
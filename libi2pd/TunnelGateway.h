@@ -17,6 +17,7 @@ namespace tunnel
 			TunnelGatewayBuffer ();
 			~TunnelGatewayBuffer ();
 			void PutI2NPMsg (const TunnelMessageBlock& block);
+			void PutI2NPMsgs (const std::vector<TunnelMessageBlock>& blocks); // reordered for fewer tunnel messages
 			const std::vector<std::shared_ptr<const I2NPMessage> >& GetTunnelDataMsgs () const { return m_TunnelDataMsgs; };
 			void ClearTunnelDataMsgs ();
 			void CompleteCurrentTunnelDataMessage ();
@@ -24,6 +25,7 @@ namespace tunnel
 		private:
 
 			void CreateCurrentTunnelDataMessage ();
+			static size_t GetFullMessageLength (const TunnelMessageBlock& block); // with delivery instructions
 
 		private:
 
@@ -37,8 +39,8 @@ namespace tunnel
 	{
 		public:
 
-			TunnelGateway (TunnelBase * tunnel):
-				m_Tunnel (tunnel), m_NumSentBytes (0) {};
+			TunnelGateway (TunnelBase * tunnel, bool isTransit = false):
+				m_Tunnel (tunnel), m_IsTransit (isTransit), m_NumSentBytes (0) {};
 			void SendTunnelDataMsg (const TunnelMessageBlock& block);
 			void PutTunnelDataMsg (const TunnelMessageBlock& block);
 			void SendBuffer ();
@@ -47,6 +49,8 @@ namespace tunnel
 		private:
 
 			TunnelBase * m_Tunnel;
+			bool m_IsTransit;
+			std::vector<TunnelMessageBlock> m_PendingBlocks; // until SendBuffer
 			TunnelGatewayBuffer m_Buffer;
 			size_t m_NumSentBytes;
 	};
@@ -21,8 +21,10 @@ namespace tunnel
 
 	TunnelPool::TunnelPool (int numInboundHops, int numOutboundHops, int numInboundTunnels, int numOutboundTunnels):
 		m_NumInboundHops (numInboundHops), m_NumOutboundHops (numOutboundHops),
-		m_NumInboundTunnels (numInboundTunnels), m_NumOutboundTunnels (numOutboundTunnels), m_IsActive (true),
-		m_CustomPeerSelector(nullptr)
+		m_NumInboundTunnels (numInboundTunnels), m_NumOutboundTunnels (numOutboundTunnels),
+		m_MaxNumInboundTunnels (0), m_MaxNumOutboundTunnels (0),
+		m_CurrentNumInboundTunnels (numInboundTunnels), m_CurrentNumOutboundTunnels (numOutboundTunnels), m_IsActive (true),
+		m_IsCritical (false), m_IsMeasuredPeers (false), m_CustomPeerSelector(nullptr)
 	{
 	}
 
@@ -49,6 +51,7 @@ namespace tunnel
 			}
 			m_NumInboundTunnels = 1;
 			m_NumOutboundTunnels = 1;
+			SetMaxNumTunnels (0, 0);
 		}
 	}
 
@@ -76,10 +79,20 @@ namespace tunnel
 			m_NumOutboundHops = outHops;
 			m_NumInboundTunnels = inQuant;
 			m_NumOutboundTunnels = outQuant;
+			SetMaxNumTunnels (m_MaxNumInboundTunnels, m_MaxNumOutboundTunnels);
 			return true;
 		}
 		return false;
 	}
+
+	void TunnelPool::SetMaxNumTunnels (int maxInbound, int maxOutbound)
+	{
+		m_MaxNumInboundTunnels = maxInbound;
+		m_MaxNumOutboundTunnels = maxOutbound;
+		// start from quantity, grows with load
+		m_CurrentNumInboundTunnels = m_NumInboundTunnels;
+		m_CurrentNumOutboundTunnels = m_NumOutboundTunnels;
+	}
 	
 	void TunnelPool::TunnelCreated (std::shared_ptr<InboundTunnel> createdTunnel)
 	{
@@ -177,35 +190,48 @@ namespace tunnel
 	typename TTunnels::value_type TunnelPool::GetNextTunnel (TTunnels& tunnels, typename TTunnels::value_type excluded) const
 	{
 		if (tunnels.empty ()) return nullptr;
-		uint32_t ind = rand () % (tunnels.size ()/2 + 1), i = 0;
-		typename TTunnels::value_type tunnel = nullptr;
+		std::vector<typename TTunnels::value_type> candidates;
+		candidates.reserve (tunnels.size ());
 		for (const auto& it: tunnels)
+			if (it->IsEstablished () && it != excluded &&
+				!(HasLatencyRequirement() && it->LatencyIsKnown() && !it->LatencyFitsRange(m_MinLatency, m_MaxLatency)))
+				candidates.push_back (it);
+		if (HasLatencyRequirement() && candidates.empty ())
 		{
-			if (it->IsEstablished () && it != excluded)
-			{
-				if(HasLatencyRequirement() && it->LatencyIsKnown() && !it->LatencyFitsRange(m_MinLatency, m_MaxLatency)) {
-					i ++;
-					continue;
-				}
-				tunnel = it;
-				i++;
-			}
-			if (i > ind && tunnel) break;
-		}
-		if(HasLatencyRequirement() && !tunnel) {
-			ind = rand () % (tunnels.size ()/2 + 1), i = 0;
 			for (const auto& it: tunnels)
-			{
 				if (it->IsEstablished () && it != excluded)
-				{
-						tunnel = it;
-						i++;
-				}
-				if (i > ind && tunnel) break;
+					candidates.push_back (it);
+		}
+		if (candidates.empty ())
+			return (excluded && excluded->IsEstablished ()) ? excluded : nullptr;
+		if (candidates.size () == 1) return candidates[0];
+		// weighted random, weight is inverse to tunnel latency, unknown latency is taken as average
+		uint64_t totalLatency = 0; int numKnown = 0;
+		for (const auto& it: candidates)
+			if (it->LatencyIsKnown ())
+			{
+				totalLatency += it->GetMeanLatency ();
+				numKnown++;
 			}
+		uint64_t defaultLatency = numKnown ? totalLatency/numKnown : 1;
+		if (!defaultLatency) defaultLatency = 1;
+		std::vector<double> weights;
+		weights.reserve (candidates.size ());
+		double totalWeight = 0;
+		for (const auto& it: candidates)
+		{
+			auto latency = it->LatencyIsKnown () ? it->GetMeanLatency () : defaultLatency;
+			double weight = 1.0/latency;
+			weights.push_back (weight);
+			totalWeight += weight;
 		}
-		if (!tunnel && excluded && excluded->IsEstablished ()) tunnel = excluded;
-		return tunnel;
+		double r = totalWeight*i2p::crypto::RandUint32 ()/4294967296.0;
+		for (size_t i = 0; i < candidates.size (); i++)
+		{
+			if (r < weights[i]) return candidates[i];
+			r -= weights[i];
+		}
+		return candidates.back ();
 	}
 
 	std::shared_ptr<OutboundTunnel> TunnelPool::GetNewOutboundTunnel (std::shared_ptr<OutboundTunnel> old) const
@@ -228,16 +254,19 @@ namespace tunnel
 		return tunnel;
 	}
 
-	void TunnelPool::CreateTunnels ()
+	int TunnelPool::CreateTunnels (int maxNum)
 	{
-		int num = 0;
+		int numBuilds = 0, num = 0;
 		{
 			std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
 			for (const auto& it : m_OutboundTunnels)
 				if (it->IsEstablished ()) num++;
 		}
-		for (int i = num; i < m_NumOutboundTunnels; i++)
+		for (int i = num; i < m_CurrentNumOutboundTunnels && (maxNum <= 0 || i < num + maxNum); i++)
+		{
 			CreateOutboundTunnel ();
+			numBuilds++;
+		}
 
 		num = 0;
 		{
@@ -245,15 +274,85 @@ namespace tunnel
 			for (const auto& it : m_InboundTunnels)
 				if (it->IsEstablished ()) num++;
 		}
-		for (int i = num; i < m_NumInboundTunnels; i++)
+		for (int i = num; i < m_CurrentNumInboundTunnels && (maxNum <= 0 || i < num + maxNum); i++)
+		{
 			CreateInboundTunnel ();
+			numBuilds++;
+		}
 
-		if (num < m_NumInboundTunnels && m_NumInboundHops <= 0 && m_LocalDestination) // zero hops IB
+		if (num < m_CurrentNumInboundTunnels && m_NumInboundHops <= 0 && m_LocalDestination) // zero hops IB
 			m_LocalDestination->SetLeaseSetUpdated (); // update LeaseSet immediately
+		return numBuilds;
+	}
+
+	static size_t GetNumTransmittedBytes (const std::shared_ptr<InboundTunnel>& tunnel)
+	{
+		return tunnel->GetNumReceivedBytes ();
+	}
+
+	static size_t GetNumTransmittedBytes (const std::shared_ptr<OutboundTunnel>& tunnel)
+	{
+		return tunnel->GetNumSentBytes ();
+	}
+
+	template<class TTunnels>
+	void TunnelPool::GetTunnelsLoad (const TTunnels& tunnels, std::mutex& mutex, uint64_t& rate, uint64_t& latency) const
+	{
+		// mean bytes per second and latency of established tunnels
+		rate = 0; latency = 0;
+		int num = 0, numLatencies = 0;
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		std::unique_lock<std::mutex> l(mutex);
+		for (const auto& it: tunnels)
+			if (it->IsEstablished ())
+			{
+				auto age = ts > it->GetCreationTime () ? ts - it->GetCreationTime () : 1;
+				rate += GetNumTransmittedBytes (it)/age;
+				num++;
+				if (it->LatencyIsKnown ())
+				{
+					latency += it->GetMeanLatency ();
+					numLatencies++;
+				}
+			}
+		if (num) rate /= num;
+		if (numLatencies) latency /= numLatencies;
+	}
+
+	static void ScaleNumTunnels (int& current, int min, int max, uint64_t rate, uint64_t latency, const char * direction)
+	{
+		if (max <= min) return;
+		if (current < max && (rate > TUNNEL_POOL_SCALE_UP_RATE ||
+			(rate > TUNNEL_POOL_SCALE_DOWN_RATE && latency > TUNNEL_POOL_SCALE_UP_LATENCY)))
+		{
+			current++;
+			LogPrint (eLogDebug, "Tunnels: ", direction, " tunnels scaled up to ", current, " rate=", rate, " latency=", latency);
+		}
+		else if (current > min && rate < TUNNEL_POOL_SCALE_DOWN_RATE)
+		{
+			current--;
+			LogPrint (eLogDebug, "Tunnels: ", direction, " tunnels scaled down to ", current, " rate=", rate);
+		}
+	}
+
+	void TunnelPool::ScaleTunnels ()
+	{
+		uint64_t rate, latency;
+		if (m_MaxNumInboundTunnels > m_NumInboundTunnels)
+		{
+			GetTunnelsLoad (m_InboundTunnels, m_InboundTunnelsMutex, rate, latency);
+			ScaleNumTunnels (m_CurrentNumInboundTunnels, m_NumInboundTunnels, m_MaxNumInboundTunnels, rate, latency, "inbound");
+		}
+		if (m_MaxNumOutboundTunnels > m_NumOutboundTunnels)
+		{
+			GetTunnelsLoad (m_OutboundTunnels, m_OutboundTunnelsMutex, rate, latency);
+			ScaleNumTunnels (m_CurrentNumOutboundTunnels, m_NumOutboundTunnels, m_MaxNumOutboundTunnels, rate, latency, "outbound");
+		}
 	}
 
 	void TunnelPool::TestTunnels ()
 	{
+		ScaleTunnels (); // by load of previous period
 		decltype(m_Tests) tests;
 		{
 			std::unique_lock<std::mutex> l(m_TestsMutex);
@@ -292,7 +391,15 @@ namespace tunnel
 			}
 		}
 
-		// new tests
+		// new tests, for idle tunnels only. Data delivered through tunnel proves it's alive
+		uint32_t ts = i2p::util::GetSecondsSinceEpoch ();
+		auto isActive = [ts](std::shared_ptr<Tunnel> tunnel)
+			{
+				if (!tunnel->IsConfirmedRecently (ts) || !tunnel->LatencyIsKnown ()) return false;
+				if (tunnel->GetState () == eTunnelStateTestFailed)
+					tunnel->SetState (eTunnelStateEstablished);
+				return true;
+			};
 		auto it1 = m_OutboundTunnels.begin ();
 		auto it2 = m_InboundTunnels.begin ();
 		while (it1 != m_OutboundTunnels.end () && it2 != m_InboundTunnels.end ())
@@ -310,8 +417,14 @@ namespace tunnel
 			}
 			if (!failed)
 			{
+				bool isActive1 = isActive (*it1), isActive2 = isActive (*it2);
+				if (isActive1 && isActive2)
+				{
+					++it1; ++it2;
+					continue;
+				}
 				uint32_t msgID;
-				RAND_bytes ((uint8_t *)&msgID, 4);
+				msgID = i2p::crypto::RandUint32 ();
 				{
 					std::unique_lock<std::mutex> l(m_TestsMutex);
 					m_Tests[msgID] = std::make_pair (*it1, *it2);
@@ -381,6 +494,13 @@ namespace tunnel
 
 		if (!hop || hop->GetProfile ()->IsBad ())
 			hop = i2p::data::netdb.GetRandomRouter (prevHop);
+		else if (!isExploratory && m_IsMeasuredPeers)
+		{
+			// best of two random routers by capacity measured by transports, unmeasured are last
+			auto hop1 = i2p::data::netdb.GetHighBandwidthRandomRouter (prevHop);
+			if (hop1 && hop1 != hop && hop1->GetProfile ()->GetCapacityScore () > hop->GetProfile ()->GetCapacityScore ())
+				hop = hop1;
+		}
 		return hop;
 	}
 
@@ -395,7 +515,8 @@ namespace tunnel
 			peers.push_back(hop->GetRouterIdentity());
 			prevHop = hop;
 		}
-		else if (i2p::transport::transports.GetNumPeers () > 25)
+		else if (i2p::transport::transports.GetNumPeers () > 25 ||
+			(i2p::transport::transports.IsWarmingUp () && i2p::transport::transports.GetNumPeers () > 0)) // reuse warm peers after restart
 		{
 			auto r = i2p::transport::transports.GetRandomPeer ();
 			if (r && !r->GetProfile ()->IsBad ())
@@ -432,8 +553,12 @@ namespace tunnel
 					return m_CustomPeerSelector->SelectPeers(peers, numHops, isInbound);
 		}
 		// explicit peers in use
-		if (m_ExplicitPeers) return SelectExplicitPeers (peers, isInbound);
-		return StandardSelectPeers(peers, numHops, isInbound, std::bind(&TunnelPool::SelectNextHop, this, std::placeholders::_1));
+		bool ret = m_ExplicitPeers ? SelectExplicitPeers (peers, isInbound) :
+			StandardSelectPeers(peers, numHops, isInbound, std::bind(&TunnelPool::SelectNextHop, this, std::placeholders::_1));
+		// start handshake with first hop while build records are being encrypted
+		if (ret && !isInbound && !peers.empty ())
+			i2p::transport::transports.PreConnect (peers.front ()->GetIdentHash ());
+		return ret;
 	}
 
 	bool TunnelPool::SelectExplicitPeers (std::vector<std::shared_ptr<const i2p::data::IdentityEx> >& peers, bool isInbound)
@@ -486,6 +611,15 @@ namespace tunnel
 
 	void TunnelPool::RecreateInboundTunnel (std::shared_ptr<InboundTunnel> tunnel)
 	{
+		if (m_MaxNumInboundTunnels > m_NumInboundTunnels)
+		{
+			// let it expire if scaled down
+			std::unique_lock<std::mutex> l(m_InboundTunnelsMutex);
+			int num = 0;
+			for (const auto& it : m_InboundTunnels)
+				if (it->IsEstablished ()) num++;
+			if (num > m_CurrentNumInboundTunnels) return;
+		}
 		auto outboundTunnel = GetNextOutboundTunnel ();
 		if (!outboundTunnel)
 			outboundTunnel = tunnels.GetNextOutboundTunnel ();
@@ -532,6 +666,15 @@ namespace tunnel
 
 	void TunnelPool::RecreateOutboundTunnel (std::shared_ptr<OutboundTunnel> tunnel)
 	{
+		if (m_MaxNumOutboundTunnels > m_NumOutboundTunnels)
+		{
+			// let it expire if scaled down
+			std::unique_lock<std::mutex> l(m_OutboundTunnelsMutex);
+			int num = 0;
+			for (const auto& it : m_OutboundTunnels)
+				if (it->IsEstablished ()) num++;
+			if (num > m_CurrentNumOutboundTunnels) return;
+		}
 		auto inboundTunnel = GetNextInboundTunnel ();
 		if (!inboundTunnel)
 			inboundTunnel = tunnels.GetNextInboundTunnel ();
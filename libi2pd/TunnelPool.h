@@ -19,6 +19,10 @@ namespace i2p
 {
 namespace tunnel
 {
+	const int TUNNEL_POOL_SCALE_UP_RATE = 24*1024; // bytes per second per tunnel, add tunnel if more
+	const int TUNNEL_POOL_SCALE_DOWN_RATE = 2*1024; // bytes per second per tunnel, remove tunnel if less
+	const int TUNNEL_POOL_SCALE_UP_LATENCY = 2000; // in milliseconds, add tunnel if loaded and slower
+
 	class Tunnel;
 	class InboundTunnel;
 	class OutboundTunnel;
@@ -57,7 +61,7 @@ namespace tunnel
 			void SetLocalDestination (std::shared_ptr<i2p::garlic::GarlicDestination> destination) { m_LocalDestination = destination; };
 			void SetExplicitPeers (std::shared_ptr<std::vector<i2p::data::IdentHash> > explicitPeers);
 
-			void CreateTunnels ();
+			int CreateTunnels (int maxNum = 0); // at most maxNum builds per direction if positive, returns number of builds
 			void TunnelCreated (std::shared_ptr<InboundTunnel> createdTunnel);
 			void TunnelExpired (std::shared_ptr<InboundTunnel> expiredTunnel);
 			void TunnelCreated (std::shared_ptr<OutboundTunnel> createdTunnel);
@@ -74,15 +78,22 @@ namespace tunnel
 
 			bool IsActive () const { return m_IsActive; };
 			void SetActive (bool isActive) { m_IsActive = isActive; };
+			bool IsCritical () const { return m_IsCritical; };
+			void SetCritical (bool isCritical) { m_IsCritical = isCritical; };
+			void SetMeasuredPeers (bool isMeasuredPeers) { m_IsMeasuredPeers = isMeasuredPeers; };
 			void DetachTunnels ();
 
 			int GetNumInboundTunnels () const { return m_NumInboundTunnels; };
 			int GetNumOutboundTunnels () const { return m_NumOutboundTunnels; };
+			int GetCurrentNumInboundTunnels () const { return m_CurrentNumInboundTunnels; };
+			int GetCurrentNumOutboundTunnels () const { return m_CurrentNumOutboundTunnels; };
 			int GetNumInboundHops() const { return m_NumInboundHops; };
 			int GetNumOutboundHops() const { return m_NumOutboundHops; };
 
 			/** i2cp reconfigure */
 			bool Reconfigure(int inboundHops, int outboundHops, int inboundQuant, int outboundQuant);
+			/** number of tunnels grows up to max with load, no auto-scaling if max is not more than quantity */
+			void SetMaxNumTunnels (int maxInbound, int maxOutbound);
     
 			void SetCustomPeerSelector(ITunnelPeerSelector * selector);
 			void UnsetCustomPeerSelector();
@@ -112,11 +123,16 @@ namespace tunnel
 			typename TTunnels::value_type GetNextTunnel (TTunnels& tunnels, typename TTunnels::value_type excluded) const;
 			bool SelectPeers (std::vector<std::shared_ptr<const i2p::data::IdentityEx> >& hops, bool isInbound);
 			bool SelectExplicitPeers (std::vector<std::shared_ptr<const i2p::data::IdentityEx> >& hops, bool isInbound);
+			void ScaleTunnels ();
+			template<class TTunnels>
+			void GetTunnelsLoad (const TTunnels& tunnels, std::mutex& mutex, uint64_t& rate, uint64_t& latency) const;
 
 		private:
 
 			std::shared_ptr<i2p::garlic::GarlicDestination> m_LocalDestination;
 			int m_NumInboundHops, m_NumOutboundHops, m_NumInboundTunnels, m_NumOutboundTunnels;
+			int m_MaxNumInboundTunnels, m_MaxNumOutboundTunnels; // auto-scaling bounds
+			int m_CurrentNumInboundTunnels, m_CurrentNumOutboundTunnels; // between quantity and max
 			std::shared_ptr<std::vector<i2p::data::IdentHash> > m_ExplicitPeers;
 			mutable std::mutex m_InboundTunnelsMutex;
 			std::set<std::shared_ptr<InboundTunnel>, TunnelCreationTimeCmp> m_InboundTunnels; // recent tunnel appears first
@@ -124,7 +140,7 @@ namespace tunnel
 			std::set<std::shared_ptr<OutboundTunnel>, TunnelCreationTimeCmp> m_OutboundTunnels;
 			mutable std::mutex m_TestsMutex;
 			std::map<uint32_t, std::pair<std::shared_ptr<OutboundTunnel>, std::shared_ptr<InboundTunnel> > > m_Tests;
-			bool m_IsActive;
+			bool m_IsActive, m_IsCritical, m_IsMeasuredPeers;
 			std::mutex m_CustomPeerSelectorMutex;
 			ITunnelPeerSelector * m_CustomPeerSelector;
 
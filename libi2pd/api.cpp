@@ -29,7 +29,10 @@ namespace api
 		i2p::fs::Init();
 
 		bool precomputation; i2p::config::GetOption("precomputation.elgamal", precomputation);
-		i2p::crypto::InitCrypto (precomputation);
+		int elgamalWindowSize; i2p::config::GetOption("precomputation.elgamalwindow", elgamalWindowSize);
+		i2p::crypto::InitCrypto (precomputation, elgamalWindowSize);
+		bool lowMemory; i2p::config::GetOption("lowmemory", lowMemory);
+		i2p::SetI2NPMessagePoolsLowMemory (lowMemory);
 
         int netID; i2p::config::GetOption("netid", netID);
         i2p::context.SetNetID (netID);
@@ -131,6 +134,53 @@ namespace api
 		if (stream)
 			stream->Close ();
 	}
+
+	void AsyncWaitStream (std::shared_ptr<i2p::stream::Stream> stream, StreamReadyHandler handler, int timeout)
+	{
+		if (!stream) return;
+		// empty buffer, received data stays in stream
+		stream->AsyncReceive (boost::asio::mutable_buffer (), handler, timeout);
+	}
+
+	size_t PeekStream (std::shared_ptr<i2p::stream::Stream> stream, std::vector<boost::asio::const_buffer>& buffers, size_t len)
+	{
+		if (!stream)
+		{
+			buffers.clear ();
+			return 0;
+		}
+		return stream->GetReceivedBuffers (buffers, len);
+	}
+
+	void ConsumeStream (std::shared_ptr<i2p::stream::Stream> stream, size_t len)
+	{
+		if (stream)
+			stream->ConsumeReceived (len);
+	}
+
+	void SendStream (std::shared_ptr<i2p::stream::Stream> stream, const std::vector<boost::asio::const_buffer>& buffers,
+		i2p::stream::SendHandler handler)
+	{
+		if (stream)
+			stream->AsyncSend (buffers, handler);
+	}
+
+	void SetDatagramReceiver (std::shared_ptr<i2p::client::ClientDestination> dest, const DatagramReceiver& receiver)
+	{
+		if (!dest) return;
+		auto datagram = dest->GetDatagramDestination ();
+		if (!datagram) datagram = dest->CreateDatagramDestination ();
+		datagram->SetReceiver (receiver);
+	}
+
+	void SendDatagrams (std::shared_ptr<i2p::client::ClientDestination> dest, const i2p::data::IdentHash& remote,
+		const std::vector<std::pair<const uint8_t *, size_t> >& payloads, uint16_t fromPort, uint16_t toPort)
+	{
+		if (!dest || payloads.empty ()) return;
+		auto datagram = dest->GetDatagramDestination ();
+		if (!datagram) datagram = dest->CreateDatagramDestination ();
+		datagram->SendDatagramsTo (payloads, remote, fromPort, toPort);
+	}
 }
 }
 
@@ -6,6 +6,7 @@
 #include "Identity.h"
 #include "Destination.h"
 #include "Streaming.h"
+#include "Datagram.h"
 
 namespace i2p
 {
@@ -31,6 +32,20 @@ namespace api
 	std::shared_ptr<i2p::stream::Stream> CreateStream (std::shared_ptr<i2p::client::ClientDestination> dest, const i2p::data::IdentHash& remote);
 	void AcceptStream (std::shared_ptr<i2p::client::ClientDestination> dest, const i2p::stream::StreamingDestination::Acceptor& acceptor);
 	void DestroyStream (std::shared_ptr<i2p::stream::Stream> stream);
+
+	// streams without copies for embedded apps, handlers are called from destination's thread
+	typedef std::function<void (const boost::system::error_code& ecode, size_t available)> StreamReadyHandler;
+	void AsyncWaitStream (std::shared_ptr<i2p::stream::Stream> stream, StreamReadyHandler handler, int timeout); // in seconds, timed_out if nothing received
+	size_t PeekStream (std::shared_ptr<i2p::stream::Stream> stream, std::vector<boost::asio::const_buffer>& buffers, size_t len); // from handler only, valid until ConsumeStream
+	void ConsumeStream (std::shared_ptr<i2p::stream::Stream> stream, size_t len); // from handler only
+	void SendStream (std::shared_ptr<i2p::stream::Stream> stream, const std::vector<boost::asio::const_buffer>& buffers,
+		i2p::stream::SendHandler handler = nullptr); // gathered to one buffer, handler is called when it's sent
+
+	// datagrams
+	typedef std::function<void (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)> DatagramReceiver;
+	void SetDatagramReceiver (std::shared_ptr<i2p::client::ClientDestination> dest, const DatagramReceiver& receiver); // buf is valid during call only
+	void SendDatagrams (std::shared_ptr<i2p::client::ClientDestination> dest, const i2p::data::IdentHash& remote,
+		const std::vector<std::pair<const uint8_t *, size_t> >& payloads, uint16_t fromPort = 0, uint16_t toPort = 0); // same session for all
 }
 }
 
@@ -1,5 +1,11 @@
 #include <cstdlib>
 #include <string>
+#include <vector>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
 #include <boost/asio.hpp>
 
 #include "util.h"
@@ -49,12 +55,199 @@ int inet_pton(int af, const char *src, void *dst)
 #else /* !WIN32 => UNIX */
 #include <sys/types.h>
 #include <ifaddrs.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 #endif
 
 namespace i2p
 {
 namespace util
 {
+	static std::atomic<bool> g_IsIOTracing (false);
+
+	static uint64_t GetTraceTime ()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+	}
+
+	struct IOTraceEvent
+	{
+		uint64_t ts, dur;
+		bool isWait; // queue wait probe, handler otherwise
+	};
+
+	struct IOTraceLoop
+	{
+		IOTraceLoop (const std::string& n, int t): name (n), tid (t), next (0) {};
+
+		void Add (uint64_t ts, uint64_t dur, bool isWait)
+		{
+			std::unique_lock<std::mutex> l(mutex);
+			if (events.size () < IO_TRACE_MAX_NUM_EVENTS)
+				events.push_back ({ ts, dur, isWait });
+			else
+			{
+				events[next] = { ts, dur, isWait };
+				next = (next + 1) % IO_TRACE_MAX_NUM_EVENTS;
+			}
+		}
+
+		std::string name;
+		int tid;
+		std::mutex mutex;
+		std::vector<IOTraceEvent> events; // ring, next is oldest when full
+		size_t next;
+	};
+
+	static std::mutex g_IOTraceLoopsMutex;
+	static std::list<std::shared_ptr<IOTraceLoop> > g_IOTraceLoops;
+
+	void SetIOTracing (bool enable)
+	{
+		g_IsIOTracing = enable;
+	}
+
+	bool IsIOTracing ()
+	{
+		return g_IsIOTracing;
+	}
+
+	static std::string g_ThreadGroupsAffinity[eNumThreadGroups];
+
+	void SetThreadGroupAffinity (ThreadGroup group, const std::string& cpus)
+	{
+		g_ThreadGroupsAffinity[group] = cpus;
+	}
+
+#ifdef __linux__
+	static bool ParseCPUList (const std::string& cpus, cpu_set_t& set)
+	{
+		if (!cpus.compare (0, 4, "node"))
+		{
+			// CPUs of NUMA node
+			std::ifstream f ("/sys/devices/system/node/" + cpus + "/cpulist");
+			std::string list;
+			if (!std::getline (f, list)) return false;
+			return ParseCPUList (list, set);
+		}
+		std::stringstream ss (cpus);
+		std::string range;
+		bool found = false;
+		while (std::getline (ss, range, ','))
+		{
+			int first = 0, last = 0;
+			auto n = sscanf (range.c_str (), "%d-%d", &first, &last);
+			if (n < 1 || first < 0) return false;
+			if (n == 1) last = first;
+			for (int i = first; i <= last && i < CPU_SETSIZE; i++)
+			{
+				CPU_SET (i, &set);
+				found = true;
+			}
+		}
+		return found;
+	}
+#endif
+
+	void InitThread (const std::string& name, ThreadGroup group)
+	{
+		const auto& cpus = g_ThreadGroupsAffinity[group];
+#ifdef __linux__
+		pthread_setname_np (pthread_self (), name.substr (0, 15).c_str ());
+		if (!cpus.empty ())
+		{
+			cpu_set_t set;
+			CPU_ZERO (&set);
+			if (!ParseCPUList (cpus, set))
+				LogPrint (eLogError, "Util: invalid CPU list ", cpus, " for thread ", name);
+			else if (sched_setaffinity (0, sizeof (set), &set)) // calling thread
+				LogPrint (eLogError, "Util: can't pin thread ", name, " to CPUs ", cpus, ": ", strerror (errno));
+		}
+#else
+#if defined(__APPLE__)
+		pthread_setname_np (name.c_str ());
+#endif
+		if (!cpus.empty ())
+			LogPrint (eLogWarning, "Util: CPU affinity is not supported on this platform");
+#endif
+	}
+
+	void RunService (boost::asio::io_service& service, const std::string& name)
+	{
+		if (!g_IsIOTracing)
+		{
+			service.run ();
+			return;
+		}
+		static std::atomic<int> numLoops (0);
+		auto loop = std::make_shared<IOTraceLoop> (name, ++numLoops);
+		{
+			std::unique_lock<std::mutex> l(g_IOTraceLoopsMutex);
+			g_IOTraceLoops.push_back (loop);
+		}
+		struct Unregister
+		{
+			std::shared_ptr<IOTraceLoop> loop;
+			~Unregister ()
+			{
+				std::unique_lock<std::mutex> l(g_IOTraceLoopsMutex);
+				g_IOTraceLoops.remove (loop);
+			}
+		} unregister { loop }; // also if handler throws
+		uint64_t lastProbe = 0;
+		for (;;)
+		{
+			auto start = GetTraceTime ();
+			if (service.poll_one ())
+				loop->Add (start, GetTraceTime () - start, false);
+			else if (!service.run_one ()) // waits, handler woken up from idle is not measured
+				break; // stopped
+			if (start >= lastProbe + IO_TRACE_PROBE_INTERVAL*1000)
+			{
+				lastProbe = start;
+				auto posted = GetTraceTime ();
+				service.post ([loop, posted]()
+					{
+						loop->Add (posted, GetTraceTime () - posted, true);
+					});
+			}
+		}
+	}
+
+	void WriteIOTraceJSON (std::stringstream& s)
+	{
+		std::list<std::shared_ptr<IOTraceLoop> > loops;
+		{
+			std::unique_lock<std::mutex> l(g_IOTraceLoopsMutex);
+			loops = g_IOTraceLoops;
+		}
+		s << "{\"traceEvents\":[";
+		bool first = true;
+		for (auto& loop: loops)
+		{
+			if (!first) s << ",";
+			first = false;
+			s << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << loop->tid
+				<< ",\"args\":{\"name\":\"" << loop->name << "\"}}";
+			std::unique_lock<std::mutex> l(loop->mutex);
+			for (size_t i = 0; i < loop->events.size (); i++)
+			{
+				const auto& ev = loop->events[(loop->next + i) % loop->events.size ()];
+				if (ev.isWait) // counter track, doesn't nest with handlers
+					s << ",{\"name\":\"" << loop->name << " queue wait\",\"cat\":\"io\",\"ph\":\"C\",\"ts\":" << ev.ts
+						<< ",\"pid\":1,\"tid\":" << loop->tid << ",\"args\":{\"us\":" << ev.dur << "}}";
+				else
+					s << ",{\"name\":\"handler\",\"cat\":\"io\",\"ph\":\"X\",\"ts\":" << ev.ts << ",\"dur\":" << ev.dur
+						<< ",\"pid\":1,\"tid\":" << loop->tid << "}";
+			}
+		}
+		s << "],\"displayTimeUnit\":\"ms\"}";
+	}
+
 namespace net
 {
 #ifdef WIN32
@@ -1,11 +1,16 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <inttypes.h>
 #include <string>
+#include <vector>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <thread>
 #include <utility>
+#include <sstream>
 #include <boost/asio.hpp>
 
 #ifdef ANDROID
@@ -32,6 +37,9 @@ namespace i2p
 namespace util
 {
 
+	const size_t MEMORY_POOL_DEFAULT_MAX_NUM_FREE = 1024; // objects above it are returned to the system
+	const int MEMORY_POOL_MT_NUM_SHARDS = 8;
+
 	template<class T>
 	class MemoryPool
 	{
@@ -39,25 +47,31 @@ namespace util
 
 		public:
 
-			MemoryPool (): m_Head (nullptr) {}
+			MemoryPool (): m_Head (nullptr), m_NumFree (0), m_NumInUse (0), m_MaxNumFree (MEMORY_POOL_DEFAULT_MAX_NUM_FREE) {}
 			~MemoryPool ()
 			{
 				while (m_Head)
 				{
 					auto tmp = m_Head;
 					m_Head = static_cast<T*>(*(void * *)m_Head); // next
-					delete tmp;
+					::operator delete (tmp); // destroyed already
 				}
 			}
 
+			void SetMaxNumFree (size_t maxNumFree) { m_MaxNumFree = maxNumFree; };
+			size_t GetNumFree () const { return m_NumFree; };
+			size_t GetNumInUse () const { return m_NumInUse; };
+
 			template<typename... TArgs>
 			T * Acquire (TArgs&&... args)
 			{
+				m_NumInUse++;
 				if (!m_Head) return new T(std::forward<TArgs>(args)...);
 				else
 				{
 					auto tmp = m_Head;
 					m_Head = static_cast<T*>(*(void * *)m_Head); // next
+					m_NumFree--;
 					return new (tmp)T(std::forward<TArgs>(args)...);
 				}
 			}
@@ -65,9 +79,16 @@ namespace util
 			void Release (T * t)
 			{
 				if (!t) return;
+				m_NumInUse--;
+				if (m_NumFree >= m_MaxNumFree)
+				{
+					delete t;
+					return;
+				}
 				t->~T ();
 				*(void * *)t = m_Head; // next
 				m_Head = t;
+				m_NumFree++;
 			}
 
 			template<typename... TArgs>
@@ -87,40 +108,247 @@ namespace util
 		protected:
 
 			T * m_Head;
+			size_t m_NumFree, m_NumInUse, m_MaxNumFree;
 	};
 
+	/** @brief pool shared by threads, free objects are kept in shards.
+	 *  A thread releases to and acquires from own shard first, so producer and consumer threads don't contend on one lock */
 	template<class T>
-	class MemoryPoolMt: public MemoryPool<T>
+	class MemoryPoolMt
 	{
 		public:
 
-			MemoryPoolMt () {}
+			MemoryPoolMt (): m_NumInUse (0), m_MaxNumFree (MEMORY_POOL_DEFAULT_MAX_NUM_FREE) {}
+
+			void SetMaxNumFree (size_t maxNumFree) { m_MaxNumFree = maxNumFree; };
+			size_t GetNumInUse () const { return m_NumInUse; };
+			size_t GetNumFree () const
+			{
+				size_t num = 0;
+				for (const auto& it: m_Shards) num += it.numFree;
+				return num;
+			}
+
 			template<typename... TArgs>
 			T * AcquireMt (TArgs&&... args)
 			{
-				if (!this->m_Head) return new T(std::forward<TArgs>(args)...);
-				std::lock_guard<std::mutex> l(m_Mutex);
-				return this->Acquire (std::forward<TArgs>(args)...);
+				m_NumInUse++;
+				auto index = GetShardIndex ();
+				for (int i = 0; i < MEMORY_POOL_MT_NUM_SHARDS; i++)
+				{
+					auto& shard = m_Shards[(index + i) % MEMORY_POOL_MT_NUM_SHARDS];
+					if (!shard.numFree) continue;
+					std::unique_lock<std::mutex> l(shard.mutex, std::defer_lock);
+					if (!i) l.lock ();
+					else if (!l.try_lock ()) continue; // don't wait for shards of other threads
+					if (!shard.head) continue;
+					auto tmp = shard.head;
+					shard.head = static_cast<T*>(*(void * *)tmp); // next
+					shard.numFree--;
+					l.unlock ();
+					return new (tmp)T(std::forward<TArgs>(args)...);
+				}
+				return new T(std::forward<TArgs>(args)...);
 			}
 
 			void ReleaseMt (T * t)
 			{
-				std::lock_guard<std::mutex> l(m_Mutex);
-				this->Release (t);
+				if (!t) return;
+				m_NumInUse--;
+				auto& shard = m_Shards[GetShardIndex ()];
+				t->~T ();
+				{
+					std::lock_guard<std::mutex> l(shard.mutex);
+					if (shard.numFree < m_MaxNumFree/MEMORY_POOL_MT_NUM_SHARDS + 1)
+					{
+						*(void * *)t = shard.head; // next
+						shard.head = t;
+						shard.numFree++;
+						return;
+					}
+				}
+				::operator delete (t); // trimmed
 			}
 
 			template<template<typename, typename...>class C, typename... R>
 			void ReleaseMt(const C<T *, R...>& c)
 			{
-				std::lock_guard<std::mutex> l(m_Mutex);
 				for (auto& it: c)
-					this->Release (it);
+					ReleaseMt (it);
+			}
+
+			~MemoryPoolMt ()
+			{
+				for (auto& it: m_Shards)
+					while (it.head)
+					{
+						auto tmp = it.head;
+						it.head = static_cast<T*>(*(void * *)tmp); // next
+						::operator delete (tmp); // destroyed already
+					}
+			}
+
+		private:
+
+			static size_t GetShardIndex ()
+			{
+				static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id ());
+				return index % MEMORY_POOL_MT_NUM_SHARDS;
 			}
 
 		private:
 
-			std::mutex m_Mutex;
+			struct Shard
+			{
+				Shard (): head (nullptr), numFree (0) {};
+
+				std::mutex mutex;
+				T * head;
+				std::atomic<size_t> numFree;
+			};
+			Shard m_Shards[MEMORY_POOL_MT_NUM_SHARDS];
+			std::atomic<size_t> m_NumInUse;
+			size_t m_MaxNumFree;
+	};
+
+	const int FLAT_HASH_MAP_MIN_BITS = 6; // 64 slots
+
+	/** @brief open addressing hash map for uint32_t keys, linear probing and backward shift deletion.
+	 *  Keeps entries in one array without per-entry allocations, not thread safe */
+	template<typename V>
+	class FlatHashMap
+	{
+		struct Slot
+		{
+			uint32_t key = 0;
+			bool used = false;
+			V value;
+		};
+
+		public:
+
+			FlatHashMap (): m_Slots ((size_t)1 << FLAT_HASH_MAP_MIN_BITS), m_Bits (FLAT_HASH_MAP_MIN_BITS), m_Size (0) {};
+
+			size_t GetSize () const { return m_Size; };
+
+			V * Find (uint32_t key)
+			{
+				auto i = Lookup (key);
+				return m_Slots[i].used ? &m_Slots[i].value : nullptr;
+			}
+
+			bool Insert (uint32_t key, const V& value) // false if already exists
+			{
+				auto i = Lookup (key);
+				if (m_Slots[i].used) return false;
+				Put (i, key, value);
+				return true;
+			}
+
+			void Set (uint32_t key, const V& value) // inserts or replaces
+			{
+				auto i = Lookup (key);
+				if (m_Slots[i].used)
+					m_Slots[i].value = value;
+				else
+					Put (i, key, value);
+			}
+
+			bool Erase (uint32_t key)
+			{
+				auto i = Lookup (key);
+				if (!m_Slots[i].used) return false;
+				// move following entries of the probe sequence back instead of leaving a tombstone
+				size_t mask = m_Slots.size () - 1;
+				for (size_t j = (i + 1) & mask; m_Slots[j].used; j = (j + 1) & mask)
+				{
+					auto home = GetIndex (m_Slots[j].key);
+					if (i <= j ? (home <= i || home > j) : (home <= i && home > j))
+					{
+						m_Slots[i] = std::move (m_Slots[j]);
+						i = j;
+					}
+				}
+				m_Slots[i] = Slot ();
+				m_Size--;
+				if (m_Bits > FLAT_HASH_MAP_MIN_BITS && m_Size*8 < m_Slots.size ())
+					Resize (m_Bits - 1);
+				return true;
+			}
+
+			template<typename F>
+			void ForEach (F f) const // f (key, value)
+			{
+				for (const auto& it: m_Slots)
+					if (it.used) f (it.key, it.value);
+			}
+
+		private:
+
+			size_t GetIndex (uint32_t key) const
+			{
+				return (key*0x9E3779B97F4A7C15ULL) >> (64 - m_Bits); // Fibonacci hashing
+			}
+
+			size_t Lookup (uint32_t key) const // slot with key or first free slot
+			{
+				size_t mask = m_Slots.size () - 1, i = GetIndex (key);
+				while (m_Slots[i].used && m_Slots[i].key != key)
+					i = (i + 1) & mask;
+				return i;
+			}
+
+			void Put (size_t i, uint32_t key, const V& value)
+			{
+				if ((m_Size + 1)*10 > m_Slots.size ()*7) // keep load factor below 0.7
+				{
+					Resize (m_Bits + 1);
+					i = Lookup (key);
+				}
+				m_Slots[i].key = key;
+				m_Slots[i].used = true;
+				m_Slots[i].value = value;
+				m_Size++;
+			}
+
+			void Resize (int bits)
+			{
+				std::vector<Slot> slots ((size_t)1 << bits);
+				m_Slots.swap (slots);
+				m_Bits = bits;
+				for (auto& it: slots)
+					if (it.used)
+						m_Slots[Lookup (it.key)] = std::move (it);
+			}
+
+		private:
+
+			std::vector<Slot> m_Slots;
+			int m_Bits;
+			size_t m_Size;
+	};
+
+	const size_t IO_TRACE_MAX_NUM_EVENTS = 4096; // per io_service, oldest are overwritten
+	const int IO_TRACE_PROBE_INTERVAL = 100; // in milliseconds, queue wait probe
+
+	/** @brief runs service like run (), measures handlers and queue wait if io tracing is enabled */
+	void RunService (boost::asio::io_service& service, const std::string& name);
+	void SetIOTracing (bool enable); // affects services started afterwards
+	bool IsIOTracing ();
+	void WriteIOTraceJSON (std::stringstream& s); // Chrome trace event format
+
+	enum ThreadGroup
+	{
+		eThreadGroupOther = 0,
+		eThreadGroupTransports,
+		eThreadGroupTunnels,
+		eThreadGroupCrypto,
+		eThreadGroupClients,
+		eNumThreadGroups
 	};
+	void SetThreadGroupAffinity (ThreadGroup group, const std::string& cpus); // like 0-3,6 or node0, before threads start
+	/** @brief names current thread for top and perf, truncated to 15 chars, and pins it to CPUs of group */
+	void InitThread (const std::string& name, ThreadGroup group = eThreadGroupOther);
 
 	namespace net
 	{
@@ -7,12 +7,16 @@
 #include <condition_variable>
 #include <openssl/rand.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include "Base.h"
 #include "util.h"
 #include "Identity.h"
 #include "FS.h"
 #include "Log.h"
 #include "HTTP.h"
+#include "I2PEndian.h"
 #include "NetDb.hpp"
 #include "ClientContext.h"
 #include "AddressBook.h"
@@ -22,12 +26,179 @@ namespace i2p
 {
 namespace client
 {
+	AddressBookIndex::AddressBookIndex (): m_Data (nullptr), m_NumRecords (0)
+	{
+	}
+
+	AddressBookIndex::~AddressBookIndex ()
+	{
+		Close ();
+	}
+
+	bool AddressBookIndex::Open (const std::string& filename)
+	{
+		Close ();
+		if (!i2p::fs::Exists (filename)) return false;
+		try
+		{
+			m_File.reset (new boost::interprocess::file_mapping (filename.c_str (), boost::interprocess::read_only));
+			m_Region.reset (new boost::interprocess::mapped_region (*m_File, boost::interprocess::read_only));
+		}
+		catch (std::exception& ex)
+		{
+			LogPrint (eLogError, "Addressbook: can't map ", filename, ": ", ex.what ());
+			Close ();
+			return false;
+		}
+		auto data = (const uint8_t *)m_Region->get_address ();
+		size_t len = m_Region->get_size ();
+		if (len < ADDRESSBOOK_INDEX_HEADER_SIZE || memcmp (data, ADDRESSBOOK_INDEX_SIGNATURE, 8) ||
+			bufbe32toh (data + 8) != ADDRESSBOOK_INDEX_VERSION)
+		{
+			LogPrint (eLogError, "Addressbook: ", filename, " is not an index file");
+			Close ();
+			return false;
+		}
+		size_t numRecords = bufbe32toh (data + 12);
+		size_t namesOffset = ADDRESSBOOK_INDEX_HEADER_SIZE + numRecords*ADDRESSBOOK_INDEX_RECORD_SIZE;
+		if (namesOffset > len)
+		{
+			LogPrint (eLogError, "Addressbook: index file ", filename, " is truncated");
+			Close ();
+			return false;
+		}
+		// check that all names are inside file, records are not parsed
+		for (size_t i = 0; i < numRecords; i++)
+		{
+			auto record = data + ADDRESSBOOK_INDEX_HEADER_SIZE + i*ADDRESSBOOK_INDEX_RECORD_SIZE;
+			size_t offset = bufbe32toh (record);
+			if (offset < namesOffset || offset + bufbe16toh (record + 4) > len)
+			{
+				LogPrint (eLogError, "Addressbook: index file ", filename, " is corrupted");
+				Close ();
+				return false;
+			}
+		}
+		m_Data = data;
+		m_NumRecords = numRecords;
+		return true;
+	}
+
+	void AddressBookIndex::Close ()
+	{
+		m_Data = nullptr;
+		m_NumRecords = 0;
+		m_Region = nullptr;
+		m_File = nullptr;
+	}
+
+	int AddressBookIndex::Compare (size_t i, const std::string& name) const
+	{
+		auto record = GetRecord (i);
+		size_t len = bufbe16toh (record + 4);
+		int ret = memcmp (m_Data + bufbe32toh (record), name.c_str (), std::min (len, name.length ()));
+		if (ret) return ret;
+		if (len == name.length ()) return 0;
+		return len < name.length () ? -1 : 1;
+	}
+
+	bool AddressBookIndex::Find (const std::string& name, i2p::data::IdentHash& ident) const
+	{
+		size_t l = 0, r = m_NumRecords;
+		while (l < r)
+		{
+			size_t m = l + (r - l)/2;
+			int cmp = Compare (m, name);
+			if (!cmp)
+			{
+				ident = i2p::data::IdentHash (GetRecord (m) + 8);
+				return true;
+			}
+			if (cmp < 0)
+				l = m + 1;
+			else
+				r = m;
+		}
+		return false;
+	}
+
+	int AddressBookIndex::Create (const std::string& filename, const AddressBookIndex& index,
+		const std::map<std::string, i2p::data::IdentHash>& addresses)
+	{
+		std::vector<uint8_t> records;
+		records.reserve ((index.m_NumRecords + addresses.size ())*ADDRESSBOOK_INDEX_RECORD_SIZE);
+		std::string names;
+		auto addRecord = [&records, &names](const uint8_t * name, size_t len, const uint8_t * ident)
+		{
+			uint8_t record[ADDRESSBOOK_INDEX_RECORD_SIZE];
+			htobe32buf (record, names.length ()); // relative to names yet
+			htobe16buf (record + 4, len);
+			memset (record + 6, 0, 2);
+			memcpy (record + 8, ident, 32);
+			records.insert (records.end (), record, record + ADDRESSBOOK_INDEX_RECORD_SIZE);
+			names.append ((const char *)name, len);
+		};
+		// both are sorted by name
+		size_t i = 0;
+		auto it = addresses.begin ();
+		while (i < index.m_NumRecords || it != addresses.end ())
+		{
+			if (it != addresses.end () && it->first.length () > 0xFFFF)
+			{
+				LogPrint (eLogWarning, "Addressbook: name is too long, skipped");
+				it++;
+				continue;
+			}
+			int cmp = (i >= index.m_NumRecords) ? 1 : (it == addresses.end () ? -1 : index.Compare (i, it->first));
+			if (cmp < 0)
+			{
+				auto record = index.GetRecord (i);
+				addRecord (index.m_Data + bufbe32toh (record), bufbe16toh (record + 4), record + 8);
+				i++;
+			}
+			else
+			{
+				addRecord ((const uint8_t *)it->first.c_str (), it->first.length (), it->second);
+				if (!cmp) i++; // replaced
+				it++;
+			}
+		}
+		size_t numRecords = records.size ()/ADDRESSBOOK_INDEX_RECORD_SIZE;
+		size_t namesOffset = ADDRESSBOOK_INDEX_HEADER_SIZE + records.size ();
+		for (size_t j = 0; j < numRecords; j++)
+		{
+			auto record = records.data () + j*ADDRESSBOOK_INDEX_RECORD_SIZE;
+			htobe32buf (record, bufbe32toh (record) + namesOffset);
+		}
+		uint8_t header[ADDRESSBOOK_INDEX_HEADER_SIZE];
+		memcpy (header, ADDRESSBOOK_INDEX_SIGNATURE, 8);
+		htobe32buf (header + 8, ADDRESSBOOK_INDEX_VERSION);
+		htobe32buf (header + 12, numRecords);
+
+		std::ofstream f (filename, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+		if (!f.is_open ())
+		{
+			LogPrint (eLogWarning, "Addressbook: Can't open ", filename);
+			return -1;
+		}
+		f.write ((const char *)header, ADDRESSBOOK_INDEX_HEADER_SIZE);
+		f.write ((const char *)records.data (), records.size ());
+		f.write (names.data (), names.length ());
+		f.close ();
+		if (f.fail ())
+		{
+			LogPrint (eLogWarning, "Addressbook: Can't write ", filename);
+			return -1;
+		}
+		return numRecords;
+	}
+
 	// TODO: this is actually proxy class
 	class AddressBookFilesystemStorage: public AddressBookStorage
 	{
 		private:
 			i2p::fs::HashedStorage storage;
-			std::string etagsPath, indexPath, localPath;
+			std::string etagsPath, indexPath, localPath, binaryIndexPath, deltaPath;
 
 		public:
 			AddressBookFilesystemStorage (): storage("addressbook", "b", "", "b32") {};
@@ -36,9 +207,12 @@ namespace client
 			void RemoveAddress (const i2p::data::IdentHash& ident);
 
 			bool Init ();
+			bool LoadIndex (AddressBookIndex& index);
 			int Load (std::map<std::string, i2p::data::IdentHash>& addresses);
+			int LoadDelta (std::map<std::string, i2p::data::IdentHash>& addresses);
+			int Append (const std::map<std::string, i2p::data::IdentHash>& addresses);
 			int LoadLocal (std::map<std::string, i2p::data::IdentHash>& addresses);
-			int Save (const std::map<std::string, i2p::data::IdentHash>& addresses);
+			int Save (AddressBookIndex& index, const std::map<std::string, i2p::data::IdentHash>& addresses);
 
 			void SaveEtag (const i2p::data::IdentHash& subsciption, const std::string& etag, const std::string& lastModified);
 			bool GetEtag (const i2p::data::IdentHash& subscription, std::string& etag, std::string& lastModified);
@@ -62,6 +236,8 @@ namespace client
 			// init address files
 			indexPath = i2p::fs::StorageRootPath (storage, "addresses.csv");
 			localPath = i2p::fs::StorageRootPath (storage, "local.csv");
+			binaryIndexPath = i2p::fs::StorageRootPath (storage, "addresses.dat");
+			deltaPath = i2p::fs::StorageRootPath (storage, "addresses.delta");
 			return true;
 		}
 		return false;
@@ -138,6 +314,13 @@ namespace client
 		return num;
 	}
 
+	bool AddressBookFilesystemStorage::LoadIndex (AddressBookIndex& index)
+	{
+		if (!index.Open (binaryIndexPath)) return false;
+		LogPrint (eLogInfo, "Addressbook: ", index.GetNumRecords (), " addresses mapped from ", binaryIndexPath);
+		return true;
+	}
+
 	int AddressBookFilesystemStorage::Load (std::map<std::string, i2p::data::IdentHash>& addresses)
 	{
 		int num = LoadFromFile (indexPath, addresses);
@@ -152,6 +335,29 @@ namespace client
 		return num;
 	}
 
+	int AddressBookFilesystemStorage::LoadDelta (std::map<std::string, i2p::data::IdentHash>& addresses)
+	{
+		int num = LoadFromFile (deltaPath, addresses);
+		if (num < 0) return 0;
+		LogPrint (eLogInfo, "Addressbook: ", num, " not indexed addresses loaded");
+		return num;
+	}
+
+	int AddressBookFilesystemStorage::Append (const std::map<std::string, i2p::data::IdentHash>& addresses)
+	{
+		std::ofstream f (deltaPath, std::ofstream::out | std::ofstream::app); // in text mode
+		if (!f.is_open ()) {
+			LogPrint (eLogWarning, "Addressbook: Can't open ", deltaPath);
+			return 0;
+		}
+		int num = 0;
+		for (const auto& it: addresses) {
+			f << it.first << "," << it.second.ToBase32 () << "\n";
+			num++;
+		}
+		return num;
+	}
+
 	int AddressBookFilesystemStorage::LoadLocal (std::map<std::string, i2p::data::IdentHash>& addresses)
 	{
 		int num = LoadFromFile (localPath, addresses);
@@ -160,25 +366,27 @@ namespace client
 		return num;
 	}
 
-	int AddressBookFilesystemStorage::Save (const std::map<std::string, i2p::data::IdentHash>& addresses)
+	int AddressBookFilesystemStorage::Save (AddressBookIndex& index, const std::map<std::string, i2p::data::IdentHash>& addresses)
 	{
 		if (addresses.empty()) {
-			LogPrint(eLogWarning, "Addressbook: not saving empty addressbook");
+			LogPrint(eLogDebug, "Addressbook: no new addresses to save");
 			return 0;
 		}
 
-		int num = 0;
-		std::ofstream f (indexPath, std::ofstream::out); // in text mode
-
-		if (!f.is_open ()) {
-			LogPrint (eLogWarning, "Addressbook: Can't open ", indexPath);
+		std::string tmpPath = binaryIndexPath + ".tmp";
+		int num = AddressBookIndex::Create (tmpPath, index, addresses);
+		if (num < 0) return 0;
+		index.Close (); // must be unmapped before replacement
+		boost::system::error_code ec;
+		boost::filesystem::rename (tmpPath, binaryIndexPath, ec); // replaces atomically, old index stays if interrupted
+		if (ec)
+		{
+			LogPrint (eLogError, "Addressbook: Can't rename ", tmpPath, " to ", binaryIndexPath, ": ", ec.message ());
+			index.Open (tmpPath);
 			return 0;
 		}
-
-		for (const auto& it: addresses) {
-			f << it.first << "," << it.second.ToBase32 () << std::endl;
-			num++;
-		}
+		if (!index.Open (binaryIndexPath)) return 0;
+		i2p::fs::Remove (deltaPath); // everything is in index now
 		LogPrint (eLogInfo, "Addressbook: ", num, " addresses saved");
 		return num;
 	}
@@ -257,7 +465,11 @@ namespace client
 		}
 		if (m_Storage)
 		{
-			m_Storage->Save (m_Addresses);
+			{
+				std::unique_lock<std::mutex> l(m_AddressBookMutex);
+				SaveAddresses ();
+				m_Index.Close ();
+			}
 			delete m_Storage;
 			m_Storage = nullptr;
 		}
@@ -299,12 +511,30 @@ namespace client
 		return true;
 	}
 
-	const i2p::data::IdentHash * AddressBook::FindAddress (const std::string& address)
+	std::shared_ptr<const i2p::data::IdentHash> AddressBook::FindAddress (const std::string& address)
+	{
+		std::unique_lock<std::mutex> l(m_AddressBookMutex);
+		i2p::data::IdentHash ident;
+		if (FindIdentHash (address, ident))
+			return std::make_shared<const i2p::data::IdentHash>(ident);
+		return nullptr;
+	}
+
+	bool AddressBook::FindIdentHash (const std::string& address, i2p::data::IdentHash& ident)
 	{
 		auto it = m_Addresses.find (address);
 		if (it != m_Addresses.end ())
-			return &it->second;
-		return nullptr;
+		{
+			ident = it->second;
+			return true;
+		}
+		return m_Index.Find (address, ident);
+	}
+
+	void AddressBook::SaveAddresses ()
+	{
+		if (m_Storage->Save (m_Index, m_Addresses) > 0)
+			m_Addresses.clear (); // in index now
 	}
 
 	void AddressBook::InsertAddress (const std::string& address, const std::string& base64)
@@ -312,7 +542,12 @@ namespace client
 		auto ident = std::make_shared<i2p::data::IdentityEx>();
 		ident->FromBase64 (base64);
 		m_Storage->AddAddress (ident);
-		m_Addresses[address] = ident->GetIdentHash ();
+		{
+			std::unique_lock<std::mutex> l(m_AddressBookMutex);
+			m_Addresses[address] = ident->GetIdentHash ();
+			std::map<std::string, i2p::data::IdentHash> added{ { address, ident->GetIdentHash () } };
+			m_Storage->Append (added);
+		}
 		LogPrint (eLogInfo, "Addressbook: added ", address," -> ", ToAddress(ident->GetIdentHash ()));
 	}
 
@@ -330,10 +565,25 @@ namespace client
 
 	void AddressBook::LoadHosts ()
 	{
-		if (m_Storage->Load (m_Addresses) > 0)
 		{
-			m_IsLoaded = true;
-			return;
+			std::unique_lock<std::mutex> l(m_AddressBookMutex);
+			bool loaded = m_Storage->LoadIndex (m_Index);
+			if (!loaded) // then try old text index
+				loaded = m_Storage->Load (m_Addresses) > 0;
+			std::map<std::string, i2p::data::IdentHash> delta;
+			if (m_Storage->LoadDelta (delta) > 0)
+			{
+				for (const auto& it: delta)
+					m_Addresses[it.first] = it.second;
+				loaded = true;
+			}
+			if (loaded)
+			{
+				if (!m_Index.GetNumRecords () || m_Addresses.size () > ADDRESSBOOK_MAX_DELTA_SIZE)
+					SaveAddresses ();
+				m_IsLoaded = true;
+				return;
+			}
 		}
 
 		// then try hosts.txt
@@ -350,6 +600,7 @@ namespace client
 		std::unique_lock<std::mutex> l(m_AddressBookMutex);
 		int numAddresses = 0;
 		bool incomplete = false;
+		std::map<std::string, i2p::data::IdentHash> changes; // new or updated only
 		std::string s;
 		while (!f.eof ())
 		{
@@ -363,11 +614,7 @@ namespace client
 			if (pos != std::string::npos)
 			{
 				std::string name = s.substr(0, pos++);
-				std::string addr = s.substr(pos);
-
-				size_t pos = s.find('#');
-				if (pos != std::string::npos)
-					addr = addr.substr(pos); // remove comments
+				std::string addr = s.substr(pos, s.find('#', pos) - pos); // remove comments
 
 				auto ident = std::make_shared<i2p::data::IdentityEx> ();
 				if (!ident->FromBase64(addr)) {
@@ -376,19 +623,19 @@ namespace client
 					continue;
 				}
 				numAddresses++;
-				auto it = m_Addresses.find (name);
-				if (it != m_Addresses.end ()) // already exists ?
+				i2p::data::IdentHash existing;
+				if (FindIdentHash (name, existing)) // already exists ?
 				{
-					if (it->second != ident->GetIdentHash ()) // address changed?
+					if (existing != ident->GetIdentHash ()) // address changed?
 					{
-						it->second = ident->GetIdentHash ();
+						changes[name] = ident->GetIdentHash ();
 						m_Storage->AddAddress (ident);
 						LogPrint (eLogInfo, "Addressbook: updated host: ", name);
 					}
 				}
-				else
+				else if (!changes.count (name))
 				{
-					m_Addresses.insert (std::make_pair (name, ident->GetIdentHash ()));
+					changes.insert (std::make_pair (name, ident->GetIdentHash ()));
 					m_Storage->AddAddress (ident);
 					if (is_update)
 						LogPrint (eLogInfo, "Addressbook: added new host: ", name);
@@ -397,11 +644,17 @@ namespace client
 			else
 				incomplete = f.eof ();
 		}
-		LogPrint (eLogInfo, "Addressbook: ", numAddresses, " addresses processed");
-		if (numAddresses > 0)
+		LogPrint (eLogInfo, "Addressbook: ", numAddresses, " addresses processed, ", changes.size (), " new or updated");
+		if (numAddresses > 0 && !incomplete) m_IsLoaded = true;
+		if (!changes.empty ())
 		{
-			if (!incomplete) m_IsLoaded = true;
-			m_Storage->Save (m_Addresses);
+			// only changes are written, index is rebuilt when delta grows big
+			for (const auto& it: changes)
+				m_Addresses[it.first] = it.second;
+			if (!m_Index.GetNumRecords () || m_Addresses.size () > ADDRESSBOOK_MAX_DELTA_SIZE)
+				SaveAddresses ();
+			else
+				m_Storage->Append (changes);
 		}
 		return !incomplete;
 	}
@@ -451,22 +704,22 @@ namespace client
 			if (dot != std::string::npos)
 			{
 				auto domain = it.first.substr (dot + 1);
-				auto it1 = m_Addresses.find (domain);  // find domain in our addressbook
-				if (it1 != m_Addresses.end ())
+				auto ident = FindAddress (domain);  // find domain in our addressbook
+				if (ident)
 				{
-					auto dest = context.FindLocalDestination (it1->second);
+					auto dest = context.FindLocalDestination (*ident);
 					if (dest)
 					{
 						// address is ours
 						std::shared_ptr<AddressResolver> resolver;
-						auto it2 = m_Resolvers.find (it1->second);
+						auto it2 = m_Resolvers.find (*ident);
 						if (it2 != m_Resolvers.end ())
 							resolver = it2->second; // resolver exists
 						else
 						{
 							// create new resolver
 							resolver = std::make_shared<AddressResolver>(dest);
-							m_Resolvers.insert (std::make_pair(it1->second, resolver));
+							m_Resolvers.insert (std::make_pair(*ident, resolver));
 						}
 						resolver->AddAddress (it.first, it.second);
 					}
@@ -598,7 +851,7 @@ namespace client
 
 	void AddressBook::LookupAddress (const std::string& address)
 	{
-		const i2p::data::IdentHash * ident = nullptr;
+		std::shared_ptr<const i2p::data::IdentHash> ident;
 		auto dot = address.find ('.');
 		if (dot != std::string::npos)
 			ident = FindAddress (address.substr (dot + 1));
@@ -657,7 +910,10 @@ namespace client
 			// TODO: verify from
 			i2p::data::IdentHash hash(buf + 8);
 			if (!hash.IsZero ())
+			{
+				std::unique_lock<std::mutex> l(m_AddressBookMutex);
 				m_Addresses[address] = hash;
+			}
 			else
 				LogPrint (eLogInfo, "AddressBook: Lookup response: ", address, " not found");
 		}
@@ -784,7 +1040,7 @@ namespace client
 		if (res.code == 304)
 		{
 			LogPrint (eLogInfo, "Addressbook: no updates from ", dest_host, ", code 304");
-			return false;
+			return true; // nothing to process, but hosts are up to date
 		}
 		if (res.code != 200)
 		{
@@ -805,27 +1061,28 @@ namespace client
 		/* assert: res.code == 200 */
 		auto it = res.headers.find("ETag");
 		if (it != res.headers.end()) m_Etag = it->second;
-		it = res.headers.find("If-Modified-Since");
+		it = res.headers.find("Last-Modified");
 		if (it != res.headers.end()) m_LastModified = it->second;
+		// decoded body is parsed from stream directly without copying it back to string
+		std::stringstream ss;
 		if (res.is_chunked())
 		{
-			std::stringstream in(response), out;
-			i2p::http::MergeChunkedResponse (in, out);
-			response = out.str();
+			std::stringstream in(response);
+			i2p::http::MergeChunkedResponse (in, ss);
 		}
 		else if (res.is_gzipped())
 		{
-			std::stringstream out;
 			i2p::data::GzipInflator inflator;
-			inflator.Inflate ((const uint8_t *) response.data(), response.length(), out);
-			if (out.fail())
+			inflator.Inflate ((const uint8_t *) response.data(), response.length(), ss);
+			if (ss.fail())
 			{
 				LogPrint(eLogError, "Addressbook: can't gunzip http response");
 				return false;
 			}
-			response = out.str();
 		}
-		std::stringstream ss(response);
+		else
+			ss.str (response);
+		response.clear ();
 		LogPrint (eLogInfo, "Addressbook: got update from ", dest_host);
 		m_Book.LoadHostsFromStream (ss, true);
 		return true;
@@ -14,6 +14,15 @@
 #include "Log.h"
 #include "Destination.h"
 
+namespace boost
+{
+namespace interprocess
+{
+	class file_mapping;
+	class mapped_region;
+}
+}
+
 namespace i2p
 {
 namespace client
@@ -24,12 +33,47 @@ namespace client
 	const int CONTINIOUS_SUBSCRIPTION_RETRY_TIMEOUT = 5; // in minutes
 	const int CONTINIOUS_SUBSCRIPTION_MAX_NUM_RETRIES = 10; // then update timeout
 	const int SUBSCRIPTION_REQUEST_TIMEOUT = 120; //in second
+	const size_t ADDRESSBOOK_MAX_DELTA_SIZE = 1000; // not indexed addresses, merged to index then
 
 	const uint16_t ADDRESS_RESOLVER_DATAGRAM_PORT = 53;
 	const uint16_t ADDRESS_RESPONSE_DATAGRAM_PORT = 54;
 
+	const char ADDRESSBOOK_INDEX_SIGNATURE[] = "i2pdhost"; // 8 bytes
+	const uint32_t ADDRESSBOOK_INDEX_VERSION = 1;
+	const size_t ADDRESSBOOK_INDEX_HEADER_SIZE = 16; // signature, version, number of records
+	const size_t ADDRESSBOOK_INDEX_RECORD_SIZE = 40; // name offset (4), name length (2), reserved (2), ident hash (32)
+
 	inline std::string GetB32Address(const i2p::data::IdentHash& ident) { return ident.ToBase32().append(".b32.i2p"); }
 
+	class AddressBookIndex // read-only table of addresses sorted by name, mapped from file
+	{
+		public:
+
+			AddressBookIndex ();
+			~AddressBookIndex ();
+
+			bool Open (const std::string& filename);
+			void Close ();
+			bool Find (const std::string& name, i2p::data::IdentHash& ident) const; // binary search
+			size_t GetNumRecords () const { return m_NumRecords; };
+
+			// writes index merged with addresses (which take precedence), returns number of records or -1
+			static int Create (const std::string& filename, const AddressBookIndex& index,
+				const std::map<std::string, i2p::data::IdentHash>& addresses);
+
+		private:
+
+			const uint8_t * GetRecord (size_t i) const { return m_Data + ADDRESSBOOK_INDEX_HEADER_SIZE + i*ADDRESSBOOK_INDEX_RECORD_SIZE; };
+			int Compare (size_t i, const std::string& name) const;
+
+		private:
+
+			std::unique_ptr<boost::interprocess::file_mapping> m_File;
+			std::unique_ptr<boost::interprocess::mapped_region> m_Region;
+			const uint8_t * m_Data;
+			size_t m_NumRecords;
+	};
+
 	class AddressBookStorage // interface for storage
 	{
 		public:
@@ -40,9 +84,12 @@ namespace client
 			virtual void RemoveAddress (const i2p::data::IdentHash& ident) = 0;
 
 			virtual bool Init () = 0;
-			virtual int Load (std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
+			virtual bool LoadIndex (AddressBookIndex& index) = 0;
+			virtual int Load (std::map<std::string, i2p::data::IdentHash>& addresses) = 0; // from old text index
+			virtual int LoadDelta (std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
+			virtual int Append (const std::map<std::string, i2p::data::IdentHash>& addresses) = 0; // to delta
 			virtual int LoadLocal (std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
-			virtual int Save (const std::map<std::string, i2p::data::IdentHash>& addresses) = 0;
+			virtual int Save (AddressBookIndex& index, const std::map<std::string, i2p::data::IdentHash>& addresses) = 0; // merges addresses into index, clears delta
 
 			virtual void SaveEtag (const i2p::data::IdentHash& subscription, const std::string& etag, const std::string& lastModified) = 0;
 			virtual bool GetEtag (const i2p::data::IdentHash& subscription, std::string& etag, std::string& lastModified) = 0;
@@ -61,7 +108,7 @@ namespace client
 			void Stop ();
 			bool GetIdentHash (const std::string& address, i2p::data::IdentHash& ident);
 			std::shared_ptr<const i2p::data::IdentityEx> GetAddress (const std::string& address);
-			const i2p::data::IdentHash * FindAddress (const std::string& address);
+			std::shared_ptr<const i2p::data::IdentHash> FindAddress (const std::string& address);
 			void LookupAddress (const std::string& address);
 			void InsertAddress (const std::string& address, const std::string& base64); // for jump service
 			void InsertAddress (std::shared_ptr<const i2p::data::IdentityEx> address);
@@ -82,6 +129,8 @@ namespace client
 			void LoadHosts ();
 			void LoadSubscriptions ();
 			void LoadLocal ();
+			bool FindIdentHash (const std::string& address, i2p::data::IdentHash& ident); // caller must lock m_AddressBookMutex
+			void SaveAddresses (); // caller must lock m_AddressBookMutex
 
 			void HandleSubscriptionsUpdateTimer (const boost::system::error_code& ecode);
 
@@ -92,7 +141,8 @@ namespace client
 		private:
 
 			std::mutex m_AddressBookMutex;
-			std::map<std::string, i2p::data::IdentHash>  m_Addresses;
+			AddressBookIndex m_Index;
+			std::map<std::string, i2p::data::IdentHash>  m_Addresses; // not saved to index yet, delta
 			std::map<i2p::data::IdentHash, std::shared_ptr<AddressResolver> > m_Resolvers; // local destination->resolver
 			std::mutex m_LookupsMutex;
 			std::map<uint32_t, std::string> m_Lookups; // nonce -> address
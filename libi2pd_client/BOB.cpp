@@ -455,7 +455,7 @@ namespace client
 		}
 
 
-		m_Keys = i2p::data::PrivateKeys::CreateRandomKeys (signatureType, cryptoType);
+		m_Keys = i2p::client::context.CreateTransientKeys (signatureType, cryptoType);
 		SendReplyOK (m_Keys.GetPublic ()->ToBase64 ().c_str ());
 	}
 
@@ -692,11 +692,12 @@ namespace client
 
 	void BOBCommandChannel::Run ()
 	{
+		i2p::util::InitThread ("BOB", i2p::util::eThreadGroupClients);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "BOB");
 			}
 			catch (std::exception& ex)
 			{
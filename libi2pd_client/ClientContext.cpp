@@ -1,5 +1,7 @@
 #include <fstream>
 #include <iostream>
+#include <atomic>
+#include <functional>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 #include "Config.h"
@@ -16,6 +18,88 @@ namespace i2p
 {
 namespace client
 {
+	TransientKeysPool::TransientKeysPool (): m_IsRunning (false)
+	{
+	}
+
+	TransientKeysPool::~TransientKeysPool ()
+	{
+		Stop ();
+	}
+
+	void TransientKeysPool::Start ()
+	{
+		if (m_IsRunning) return;
+		{
+			std::unique_lock<std::mutex> l(m_KeysMutex);
+			m_Keys[KeyType (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519, i2p::data::CRYPTO_KEY_TYPE_ELGAMAL)]; // default of transient destinations
+			m_IsRunning = true;
+		}
+		m_Thread.reset (new std::thread (std::bind (&TransientKeysPool::Run, this)));
+	}
+
+	void TransientKeysPool::Stop ()
+	{
+		{
+			std::unique_lock<std::mutex> l(m_KeysMutex);
+			m_IsRunning = false;
+			m_Acquired.notify_all ();
+		}
+		if (m_Thread)
+		{
+			m_Thread->join ();
+			m_Thread = nullptr;
+		}
+		m_Keys.clear ();
+	}
+
+	i2p::data::PrivateKeys TransientKeysPool::Acquire (i2p::data::SigningKeyType sigType, i2p::data::CryptoKeyType cryptoType)
+	{
+		{
+			std::unique_lock<std::mutex> l(m_KeysMutex);
+			if (m_IsRunning)
+			{
+				auto it = m_Keys.find (KeyType (sigType, cryptoType));
+				if (it != m_Keys.end ())
+				{
+					if (!it->second.empty ())
+					{
+						i2p::data::PrivateKeys keys = it->second.front ();
+						it->second.pop_front ();
+						m_Acquired.notify_one ();
+						return keys;
+					}
+				}
+				else if (m_Keys.size () < TRANSIENT_KEYS_POOL_MAX_NUM_TYPES)
+					m_Keys[KeyType (sigType, cryptoType)]; // start pooling this type
+				m_Acquired.notify_one ();
+			}
+		}
+		return i2p::data::PrivateKeys::CreateRandomKeys (sigType, cryptoType);
+	}
+
+	void TransientKeysPool::Run ()
+	{
+		std::unique_lock<std::mutex> l(m_KeysMutex);
+		while (m_IsRunning)
+		{
+			bool isFull = true;
+			for (auto& it: m_Keys)
+				if (it.second.size () < TRANSIENT_KEYS_POOL_SIZE)
+				{
+					auto type = it.first;
+					isFull = false;
+					l.unlock ();
+					auto keys = i2p::data::PrivateKeys::CreateRandomKeys (type.first, type.second);
+					l.lock ();
+					if (m_IsRunning) m_Keys[type].push_back (keys);
+					break; // m_Keys might be changed while unlocked
+				}
+			if (isFull)
+				m_Acquired.wait (l);
+		}
+	}
+
 	ClientContext context;
 
 	ClientContext::ClientContext (): m_SharedLocalDestination (nullptr),
@@ -35,6 +119,12 @@ namespace client
 
 	void ClientContext::Start ()
 	{
+		// relay buffers are sized before any tunnel starts
+		bool lowMemory; i2p::config::GetOption("lowmemory", lowMemory);
+		GetTunnelBufferPool ().SetLowMemory (lowMemory);
+
+		m_TransientKeysPool.Start ();
+
 		// shared local destination
 		if (!m_SharedLocalDestination)
 			CreateNewSharedLocalDestination ();
@@ -171,6 +261,7 @@ namespace client
 			m_ServerForwards.clear();
 			m_ClientForwards.clear();
 		}
+		m_TunnelSections.clear ();
 
 		if (m_CleanupUDPTimer)
 		{
@@ -182,6 +273,8 @@ namespace client
 			it.second->Stop ();
 		m_Destinations.clear ();
 		m_SharedLocalDestination = nullptr;
+
+		m_TransientKeysPool.Stop ();
 	}
 
 	void ClientContext::ReloadConfig ()
@@ -190,33 +283,19 @@ namespace client
 		/*std::string config; i2p::config::GetOption("conf", config);
 		i2p::config::ParseConfig(config);*/
 
-		// handle tunnels
+		// handle tunnels, only changed sections are touched
 		// reset isUpdated for each tunnel
 		VisitTunnels ([](I2PService * s)->bool { s->isUpdated = false; return true; });
 		// reload tunnels
+		auto prevSections = m_TunnelSections;
 		ReadTunnels();
 		// delete not updated tunnels (not in config anymore)
 		VisitTunnels ([](I2PService * s)->bool { return s->isUpdated; });
+		for (auto& it: prevSections)
+			if (!m_TunnelSections.count (it.first))
+				RemoveForwards (it.first);
 
-		// change shared local destination
-		m_SharedLocalDestination->Release ();
-		CreateNewSharedLocalDestination ();
-
-		// recreate HTTP proxy
-		if (m_HttpProxy)
-		{
-			m_HttpProxy->Stop ();
-			m_HttpProxy = nullptr;
-		}		
-		ReadHttpProxy ();
-	
-		// recreate SOCKS proxy
-		if (m_SocksProxy)
-		{
-			m_SocksProxy->Stop ();
-			m_SocksProxy = nullptr;
-		}		
-		ReadSocksProxy ();	
+		// shared local destination, HTTP and SOCKS proxies are kept, main config is not reloaded
 
 		// delete unused destinations
 		std::unique_lock<std::mutex> l(m_DestinationsMutex);
@@ -304,7 +383,7 @@ namespace client
 		i2p::data::SigningKeyType sigType, i2p::data::CryptoKeyType cryptoType,
 		const std::map<std::string, std::string> * params)
 	{
-		i2p::data::PrivateKeys keys = i2p::data::PrivateKeys::CreateRandomKeys (sigType, cryptoType);
+		i2p::data::PrivateKeys keys = m_TransientKeysPool.Acquire (sigType, cryptoType);
 		auto localDestination = std::make_shared<ClientDestination> (keys, isPublic, params);
 		std::unique_lock<std::mutex> l(m_DestinationsMutex);
 		m_Destinations[localDestination->GetIdentHash ()] = localDestination;
@@ -359,6 +438,7 @@ namespace client
 	{
 		m_SharedLocalDestination = CreateNewLocalDestination (); // non-public, EDDSA
 		m_SharedLocalDestination->Acquire ();
+		m_SharedLocalDestination->GetTunnelPool ()->SetCritical (true); // used by proxies
 	}
 
 	std::shared_ptr<ClientDestination> ClientContext::FindLocalDestination (const i2p::data::IdentHash& destination) const
@@ -382,10 +462,24 @@ namespace client
 		options[I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH] = GetI2CPOption (section, I2CP_PARAM_OUTBOUND_TUNNEL_LENGTH, DEFAULT_OUTBOUND_TUNNEL_LENGTH);
 		options[I2CP_PARAM_INBOUND_TUNNELS_QUANTITY] = GetI2CPOption (section, I2CP_PARAM_INBOUND_TUNNELS_QUANTITY, DEFAULT_INBOUND_TUNNELS_QUANTITY);
 		options[I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY] = GetI2CPOption (section, I2CP_PARAM_OUTBOUND_TUNNELS_QUANTITY, DEFAULT_OUTBOUND_TUNNELS_QUANTITY);
+		options[I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY] = GetI2CPOption (section, I2CP_PARAM_INBOUND_TUNNELS_MAX_QUANTITY, DEFAULT_TUNNELS_MAX_QUANTITY);
+		options[I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY] = GetI2CPOption (section, I2CP_PARAM_OUTBOUND_TUNNELS_MAX_QUANTITY, DEFAULT_TUNNELS_MAX_QUANTITY);
 		options[I2CP_PARAM_TAGS_TO_SEND] = GetI2CPOption (section, I2CP_PARAM_TAGS_TO_SEND, DEFAULT_TAGS_TO_SEND);
 		options[I2CP_PARAM_MIN_TUNNEL_LATENCY] = GetI2CPOption(section, I2CP_PARAM_MIN_TUNNEL_LATENCY, DEFAULT_MIN_TUNNEL_LATENCY);
 		options[I2CP_PARAM_MAX_TUNNEL_LATENCY] = GetI2CPOption(section, I2CP_PARAM_MAX_TUNNEL_LATENCY, DEFAULT_MAX_TUNNEL_LATENCY);
 		options[I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY] = GetI2CPOption(section, I2CP_PARAM_STREAMING_INITIAL_ACK_DELAY, DEFAULT_INITIAL_ACK_DELAY);
+		options[I2CP_PARAM_STREAMING_CONGESTION_CONTROL] = section.second.get (boost::property_tree::ptree::path_type (I2CP_PARAM_STREAMING_CONGESTION_CONTROL, '/'),
+			std::string (DEFAULT_STREAMING_CONGESTION_CONTROL));
+		options[I2CP_PARAM_STREAMING_COALESCE_PACKETS] = GetI2CPOption(section, I2CP_PARAM_STREAMING_COALESCE_PACKETS, DEFAULT_STREAMING_COALESCE_PACKETS);
+		options[I2CP_PARAM_STREAMING_COMPRESSION] = section.second.get (boost::property_tree::ptree::path_type (I2CP_PARAM_STREAMING_COMPRESSION, '/'),
+			std::string (DEFAULT_STREAMING_COMPRESSION));
+		options[I2CP_PARAM_STREAMING_MULTIPATH] = GetI2CPOption(section, I2CP_PARAM_STREAMING_MULTIPATH, DEFAULT_STREAMING_MULTIPATH);
+		options[I2CP_PARAM_SHARE_LEASESETS] = GetI2CPOption(section, I2CP_PARAM_SHARE_LEASESETS, DEFAULT_SHARE_LEASESETS);
+		options[I2CP_PARAM_DEDICATED_THREAD] = GetI2CPOption(section, I2CP_PARAM_DEDICATED_THREAD, DEFAULT_DEDICATED_THREAD);
+		options[I2CP_PARAM_LOOPBACK] = GetI2CPOption(section, I2CP_PARAM_LOOPBACK, DEFAULT_LOOPBACK);
+		options[I2CP_PARAM_CRITICAL] = GetI2CPOption(section, I2CP_PARAM_CRITICAL, DEFAULT_CRITICAL);
+		options[I2CP_PARAM_MEASURED_PEERS] = GetI2CPOption(section, I2CP_PARAM_MEASURED_PEERS, DEFAULT_MEASURED_PEERS);
+		options[I2CP_PARAM_MULTIHOME] = GetI2CPOption(section, I2CP_PARAM_MULTIHOME, DEFAULT_MULTIHOME);
 	}
 
 	void ClientContext::ReadI2CPOptionsFromConfig (const std::string& prefix, std::map<std::string, std::string>& options) const
@@ -408,6 +502,7 @@ namespace client
 	void ClientContext::ReadTunnels ()
 	{
 		int numClientTunnels = 0, numServerTunnels = 0;
+		std::map<std::string, std::string> sections;
 		std::string tunConf; i2p::config::GetOption("tunconf", tunConf);
 		if (tunConf.empty ()) 
 		{
@@ -419,7 +514,7 @@ namespace client
 				tunConf = i2p::fs::DataDirPath ("tunnels.conf");
 		}
 		LogPrint(eLogDebug, "Clients: tunnels config file: ", tunConf);
-		ReadTunnels (tunConf, numClientTunnels, numServerTunnels);
+		std::vector<std::string> tunConfs{ tunConf };
 		
 		std::string tunDir; i2p::config::GetOption("tunnelsdir", tunDir);
 		if (tunDir.empty ())
@@ -432,17 +527,174 @@ namespace client
 				for (auto& it: files)
 				{
 					LogPrint(eLogDebug, "Clients: tunnels extra config file: ", it);
-					ReadTunnels (it, numClientTunnels, numServerTunnels);
+					tunConfs.push_back (it);
 				}
 			}
 		}
 
+		TunnelsDestinations destinations;
+		CreateTunnelsDestinations (tunConfs, destinations);
+		for (auto& it: tunConfs)
+			ReadTunnels (it, numClientTunnels, numServerTunnels, sections, destinations);
+
 		LogPrint (eLogInfo, "Clients: ", numClientTunnels, " I2P client tunnels created");
 		LogPrint (eLogInfo, "Clients: ", numServerTunnels, " I2P server tunnels created");
+		m_TunnelSections = sections;
 	}
 
 	
-	void ClientContext::ReadTunnels (const std::string& tunConf, int& numClientTunnels, int& numServerTunnels)
+	static void RunInParallel (size_t num, std::function<void (size_t)> f)
+	{
+		size_t numThreads = std::thread::hardware_concurrency ();
+		if (numThreads > (size_t)TUNNELS_MAX_NUM_LOADING_THREADS) numThreads = TUNNELS_MAX_NUM_LOADING_THREADS;
+		if (numThreads > num) numThreads = num;
+		std::atomic<size_t> next (0);
+		auto run = [num, &f, &next]()
+			{
+				size_t i;
+				while ((i = next++) < num)
+				{
+					try
+					{
+						f (i);
+					}
+					catch (std::exception& ex)
+					{
+						LogPrint (eLogError, "Clients: ", ex.what ());
+					}
+				}
+			};
+		std::vector<std::thread> threads;
+		for (size_t i = 1; i < numThreads; i++)
+			threads.emplace_back (run);
+		run (); // in this thread too
+		for (auto& it: threads)
+			it.join ();
+	}
+
+	void ClientContext::CreateTunnelsDestinations (const std::vector<std::string>& tunConfs, TunnelsDestinations& destinations)
+	{
+		// keys are loaded and destinations are created in parallel for new and changed sections,
+		// ReadTunnels picks them up, matched and existing destinations are left for it
+		struct Task
+		{
+			std::string keys;
+			i2p::data::SigningKeyType sigType;
+			i2p::data::CryptoKeyType cryptoType;
+			bool isPublic, isLoaded;
+			std::map<std::string, std::string> options;
+			std::vector<std::pair<std::string, std::string> > sections; // sharing same keys file
+			i2p::data::PrivateKeys k;
+			std::shared_ptr<ClientDestination> destination;
+		};
+		std::vector<std::shared_ptr<Task> > tasks; // PrivateKeys can't be copied empty
+		std::map<std::string, size_t> tasksByKeys;
+		for (auto& tunConf: tunConfs)
+		{
+			boost::property_tree::ptree pt;
+			try
+			{
+				boost::property_tree::read_ini (tunConf, pt);
+			}
+			catch (std::exception& ex)
+			{
+				continue; // reported by ReadTunnels
+			}
+			for (auto& section: pt)
+			{
+				std::string params;
+				for (auto& it: section.second)
+					params += it.first + "=" + it.second.data () + "\n";
+				auto prev = m_TunnelSections.find (section.first);
+				if (prev != m_TunnelSections.end () && prev->second == params) continue; // unchanged
+				try
+				{
+					auto task = std::make_shared<Task> ();
+					std::string type = section.second.get<std::string> (I2P_TUNNELS_SECTION_TYPE);
+					if (type == I2P_TUNNELS_SECTION_TYPE_CLIENT
+							|| type == I2P_TUNNELS_SECTION_TYPE_SOCKS
+							|| type == I2P_TUNNELS_SECTION_TYPE_WEBSOCKS
+							|| type == I2P_TUNNELS_SECTION_TYPE_HTTPPROXY
+							|| type == I2P_TUNNELS_SECTION_TYPE_UDPCLIENT)
+					{
+						if (section.second.get (I2P_CLIENT_TUNNEL_MATCH_TUNNELS, false)) continue;
+						task->keys = section.second.get (I2P_CLIENT_TUNNEL_KEYS, "transient");
+						task->sigType = section.second.get (I2P_CLIENT_TUNNEL_SIGNATURE_TYPE, i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519);
+						task->cryptoType = section.second.get (I2P_CLIENT_TUNNEL_CRYPTO_TYPE, i2p::data::CRYPTO_KEY_TYPE_ELGAMAL);
+						task->isPublic = type == I2P_TUNNELS_SECTION_TYPE_UDPCLIENT;
+					}
+					else if (type == I2P_TUNNELS_SECTION_TYPE_SERVER
+							|| type == I2P_TUNNELS_SECTION_TYPE_HTTP
+							|| type == I2P_TUNNELS_SECTION_TYPE_IRC
+							|| type == I2P_TUNNELS_SECTION_TYPE_UDPSERVER)
+					{
+						task->keys = section.second.get<std::string> (I2P_SERVER_TUNNEL_KEYS);
+						task->sigType = section.second.get (I2P_SERVER_TUNNEL_SIGNATURE_TYPE, i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519);
+						task->cryptoType = section.second.get (I2P_CLIENT_TUNNEL_CRYPTO_TYPE, i2p::data::CRYPTO_KEY_TYPE_ELGAMAL);
+						task->isPublic = true;
+					}
+					else
+						continue;
+					if (task->keys.empty ()) continue;
+					auto section1 = std::make_pair (tunConf, section.first);
+					if (task->keys != "transient")
+					{
+						auto it = tasksByKeys.find (task->keys);
+						if (it != tasksByKeys.end ())
+						{
+							tasks[it->second]->sections.push_back (section1);
+							continue;
+						}
+						tasksByKeys[task->keys] = tasks.size ();
+					}
+					ReadI2CPOptions (section, task->options);
+					task->isLoaded = false;
+					task->sections.push_back (section1);
+					tasks.push_back (task);
+				}
+				catch (std::exception& ex)
+				{
+					// reported by ReadTunnels
+				}
+			}
+		}
+		if (tasks.empty ()) return;
+
+		RunInParallel (tasks.size (), [this, &tasks](size_t i)
+			{
+				auto& task = tasks[i];
+				task->isLoaded = LoadPrivateKeys (task->k, task->keys, task->sigType, task->cryptoType);
+			});
+		std::vector<Task *> newTasks;
+		for (auto& it: tasks)
+			if (it->isLoaded && !FindLocalDestination (it->k.GetPublic ()->GetIdentHash ()))
+				newTasks.push_back (it.get ());
+		RunInParallel (newTasks.size (), [&newTasks](size_t i)
+			{
+				auto task = newTasks[i];
+				task->destination = std::make_shared<ClientDestination> (task->k, task->isPublic, &task->options);
+			});
+		int numCreated = 0;
+		for (auto it: newTasks)
+		{
+			if (!it->destination) continue;
+			auto localDestination = FindLocalDestination (it->destination->GetIdentHash ());
+			if (!localDestination) // same keys in different files otherwise
+			{
+				localDestination = it->destination;
+				std::unique_lock<std::mutex> l(m_DestinationsMutex);
+				m_Destinations[localDestination->GetIdentHash ()] = localDestination;
+				localDestination->Start ();
+				numCreated++;
+			}
+			for (auto& section: it->sections)
+				destinations[section] = localDestination;
+		}
+		LogPrint (eLogInfo, "Clients: ", numCreated, " tunnels destinations created in parallel");
+	}
+
+	void ClientContext::ReadTunnels (const std::string& tunConf, int& numClientTunnels, int& numServerTunnels,
+		std::map<std::string, std::string>& sections, const TunnelsDestinations& destinations)
 	{
 		boost::property_tree::ptree pt;
 		try
@@ -458,6 +710,13 @@ namespace client
 		for (auto& section: pt)
 		{
 			std::string name = section.first;
+			// compare with previous read, unchanged tunnels and their destinations are kept as is
+			std::string params;
+			for (auto& it: section.second)
+				params += it.first + "=" + it.second.data () + "\n";
+			auto prev = m_TunnelSections.find (name);
+			bool isNew = prev == m_TunnelSections.end (), isChanged = isNew || prev->second != params;
+			sections[name] = params;
 			try
 			{
 				std::string type = section.second.get<std::string> (I2P_TUNNELS_SECTION_TYPE);
@@ -479,12 +738,34 @@ namespace client
 					int destinationPort = section.second.get (I2P_CLIENT_TUNNEL_DESTINATION_PORT, 0);
 					i2p::data::SigningKeyType sigType = section.second.get (I2P_CLIENT_TUNNEL_SIGNATURE_TYPE, i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519);
 					i2p::data::CryptoKeyType cryptoType = section.second.get (I2P_CLIENT_TUNNEL_CRYPTO_TYPE, i2p::data::CRYPTO_KEY_TYPE_ELGAMAL);
+					if (!isChanged)
+					{
+						auto localAddress = boost::asio::ip::address::from_string(address);
+						if (type == I2P_TUNNELS_SECTION_TYPE_UDPCLIENT)
+						{
+							std::lock_guard<std::mutex> lock(m_ForwardsMutex);
+							if (m_ClientForwards.count (boost::asio::ip::udp::endpoint (localAddress, port)))
+								continue;
+						}
+						else
+						{
+							auto it = m_ClientTunnels.find (boost::asio::ip::tcp::endpoint (localAddress, port));
+							if (it != m_ClientTunnels.end ())
+							{
+								it->second->isUpdated = true;
+								continue;
+							}
+						}
+					}
 					// I2CP
 					std::map<std::string, std::string> options;
 					ReadI2CPOptions (section, options);
 
 					std::shared_ptr<ClientDestination> localDestination = nullptr;
-					if (keys.length () > 0)
+					auto prepared = destinations.find (std::make_pair (tunConf, name));
+					if (prepared != destinations.end ())
+						localDestination = prepared->second;
+					else if (keys.length () > 0)
 					{
 						i2p::data::PrivateKeys k;
 						if(LoadPrivateKeys (k, keys, sigType, cryptoType))
@@ -497,6 +778,8 @@ namespace client
 								else
 									localDestination = CreateNewLocalDestination (k, type == I2P_TUNNELS_SECTION_TYPE_UDPCLIENT, &options);
 							}
+							else if (!isNew)
+								localDestination->Reconfigure (options);
 						}
 					}
 
@@ -508,7 +791,9 @@ namespace client
 						{
 							localDestination = m_SharedLocalDestination;
 						}
+						RemoveForwards (name);
 						auto clientTunnel = std::make_shared<I2PUDPClientTunnel>(name, dest, end, localDestination, destinationPort);
+						std::lock_guard<std::mutex> lock(m_ForwardsMutex);
 						if(m_ClientForwards.insert(std::make_pair(end, clientTunnel)).second)
 						{
 							clientTunnel->Start();
@@ -546,6 +831,7 @@ namespace client
 						{
 							// tcp client
 							auto tun = std::make_shared<I2PClientTunnel> (name, dest, address, port, localDestination, destinationPort);
+							tun->SetZeroRTT (section.second.get (I2P_CLIENT_TUNNEL_ZERO_RTT, false));
 							clientTunnel = tun;	
 							clientEndpoint = tun->GetLocalEndpoint ();
 						}
@@ -562,14 +848,16 @@ namespace client
 							clientTunnel->Start ();
 							numClientTunnels++;
 						}
+						else if (isChanged)
+						{
+							// section changed, replace tunnel on same endpoint
+							ins.first->second->Stop ();
+							ins.first->second = clientTunnel;
+							clientTunnel->Start ();
+							LogPrint (eLogInfo, "Clients: I2P client tunnel for endpoint ", clientEndpoint, " updated");
+						}
 						else
 						{
-							// TODO: update
-							if (ins.first->second->GetLocalDestination () != clientTunnel->GetLocalDestination ())
-							{
-								LogPrint (eLogInfo, "Clients: I2P client tunnel destination updated");
-								ins.first->second->SetLocalDestination (clientTunnel->GetLocalDestination ());
-							}
 							ins.first->second->isUpdated = true;
 							LogPrint (eLogInfo, "Clients: I2P client tunnel for endpoint ", clientEndpoint, " already exists");
 						}
@@ -595,20 +883,55 @@ namespace client
 
 					std::string address = section.second.get<std::string> (I2P_SERVER_TUNNEL_ADDRESS, "127.0.0.1");
 					bool isUniqueLocal = section.second.get(I2P_SERVER_TUNNEL_ENABLE_UNIQUE_LOCAL, true);
+					size_t memoryLimit = section.second.get (I2P_SERVER_TUNNEL_MEMORY_LIMIT, 0);
 
 					// I2CP
 					std::map<std::string, std::string> options;
 					ReadI2CPOptions (section, options);
 
 					std::shared_ptr<ClientDestination> localDestination = nullptr;
+					auto prepared = destinations.find (std::make_pair (tunConf, name));
 					i2p::data::PrivateKeys k;
-					if(!LoadPrivateKeys (k, keys, sigType, cryptoType))
-						continue;
-					localDestination = FindLocalDestination (k.GetPublic ()->GetIdentHash ());
-					if (!localDestination)
-						localDestination = CreateNewLocalDestination (k, true, &options);
+					i2p::data::IdentHash ident;
+					if (prepared != destinations.end ())
+						ident = prepared->second->GetIdentHash ();
+					else
+					{
+						if(!LoadPrivateKeys (k, keys, sigType, cryptoType))
+							continue;
+						ident = k.GetPublic ()->GetIdentHash ();
+					}
+					if (!isChanged)
+					{
+						if (type == I2P_TUNNELS_SECTION_TYPE_UDPSERVER)
+						{
+							std::lock_guard<std::mutex> lock(m_ForwardsMutex);
+							if (m_ServerForwards.count (std::make_pair (ident, port)))
+								continue;
+						}
+						else
+						{
+							auto it = m_ServerTunnels.find (std::make_pair (ident, inPort));
+							if (it != m_ServerTunnels.end ())
+							{
+								it->second->isUpdated = true;
+								continue;
+							}
+						}
+					}
+					if (prepared != destinations.end ())
+						localDestination = prepared->second;
+					else
+					{
+						localDestination = FindLocalDestination (ident);
+						if (!localDestination)
+							localDestination = CreateNewLocalDestination (k, true, &options);
+						else if (!isNew)
+							localDestination->Reconfigure (options);
+					}
 					if (type == I2P_TUNNELS_SECTION_TYPE_UDPSERVER)
 					{
+						RemoveForwards (name);
 						// udp server tunnel
 						// TODO: hostnames
 						auto localAddress = boost::asio::ip::address::from_string(address);
@@ -648,6 +971,8 @@ namespace client
 						LogPrint(eLogInfo, "Clients: disabling loopback address mapping");
 						serverTunnel->SetUniqueLocal(isUniqueLocal);
 					}
+					if (memoryLimit > 0)
+						serverTunnel->SetMemoryLimit (memoryLimit*1024);
 
 					if (accessList.length () > 0)
 					{
@@ -672,14 +997,16 @@ namespace client
 						serverTunnel->Start ();
 						numServerTunnels++;
 					}
+					else if (isChanged)
+					{
+						// section changed, replace tunnel on same destination/port
+						ins.first->second->Stop ();
+						ins.first->second = serverTunnel;
+						serverTunnel->Start ();
+						LogPrint (eLogInfo, "Clients: I2P server tunnel for destination/port ",   m_AddressBook.ToAddress(localDestination->GetIdentHash ()), "/", inPort, " updated");
+					}
 					else
 					{
-						// TODO: update
-						if (ins.first->second->GetLocalDestination () != serverTunnel->GetLocalDestination ())
-						{
-							LogPrint (eLogInfo, "Clients: I2P server tunnel destination updated");
-							ins.first->second->SetLocalDestination (serverTunnel->GetLocalDestination ());
-						}
 						ins.first->second->isUpdated = true;
 						LogPrint (eLogInfo, "Clients: I2P server tunnel for destination/port ",   m_AddressBook.ToAddress(localDestination->GetIdentHash ()), "/", inPort, " already exists");
 					}
@@ -696,6 +1023,25 @@ namespace client
 		}
 	}
 
+	void ClientContext::RemoveForwards (const std::string& name)
+	{
+		std::lock_guard<std::mutex> lock(m_ForwardsMutex);
+		for (auto it = m_ClientForwards.begin (); it != m_ClientForwards.end ();)
+		{
+			if (name == it->second->GetName ())
+				it = m_ClientForwards.erase (it); // stopped by destructor
+			else
+				it++;
+		}
+		for (auto it = m_ServerForwards.begin (); it != m_ServerForwards.end ();)
+		{
+			if (name == it->second->GetName ())
+				it = m_ServerForwards.erase (it);
+			else
+				it++;
+		}
+	}
+
 	void ClientContext::ReadHttpProxy ()
 	{
 		std::shared_ptr<ClientDestination> localDestination;
@@ -2,7 +2,10 @@
 #define CLIENT_CONTEXT_H__
 
 #include <map>
+#include <list>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <memory>
 #include <boost/asio.hpp>
 #include "Destination.h"
@@ -38,6 +41,7 @@ namespace client
 	const char I2P_CLIENT_TUNNEL_DESTINATION_PORT[] = "destinationport";
 	const char I2P_CLIENT_TUNNEL_MATCH_TUNNELS[] = "matchtunnels";
   const char I2P_CLIENT_TUNNEL_CONNECT_TIMEOUT[] = "connecttimeout";
+	const char I2P_CLIENT_TUNNEL_ZERO_RTT[] = "zerortt";
 	const char I2P_SERVER_TUNNEL_HOST[] = "host";
 	const char I2P_SERVER_TUNNEL_HOST_OVERRIDE[] = "hostoverride";
 	const char I2P_SERVER_TUNNEL_PORT[] = "port";
@@ -49,8 +53,39 @@ namespace client
 	const char I2P_SERVER_TUNNEL_WEBIRC_PASSWORD[] = "webircpassword";
 	const char I2P_SERVER_TUNNEL_ADDRESS[] = "address";
 	const char I2P_SERVER_TUNNEL_ENABLE_UNIQUE_LOCAL[] = "enableuniquelocal";
+	const char I2P_SERVER_TUNNEL_MEMORY_LIMIT[] = "memorylimit"; // in KBytes
 
 
+	const size_t TRANSIENT_KEYS_POOL_SIZE = 4; // per signature and crypto type
+	const size_t TRANSIENT_KEYS_POOL_MAX_NUM_TYPES = 8; // type is added when requested first time
+	const int TUNNELS_MAX_NUM_LOADING_THREADS = 8; // keys and destinations of tunnels.conf sections are created in parallel
+	/** @brief keys of transient destinations generated ahead by own thread, for SAM and BOB */
+	class TransientKeysPool
+	{
+		public:
+
+			TransientKeysPool ();
+			~TransientKeysPool ();
+
+			void Start ();
+			void Stop ();
+			i2p::data::PrivateKeys Acquire (i2p::data::SigningKeyType sigType, i2p::data::CryptoKeyType cryptoType); // generated now if pool is empty
+
+		private:
+
+			void Run ();
+
+		private:
+
+			typedef std::pair<i2p::data::SigningKeyType, i2p::data::CryptoKeyType> KeyType;
+
+			bool m_IsRunning;
+			std::unique_ptr<std::thread> m_Thread;
+			std::mutex m_KeysMutex;
+			std::condition_variable m_Acquired;
+			std::map<KeyType, std::list<i2p::data::PrivateKeys> > m_Keys;
+	};
+
 	class ClientContext
 	{
 		public:
@@ -70,6 +105,8 @@ namespace client
 				const std::map<std::string, std::string> * params = nullptr); // used by SAM only
 			std::shared_ptr<ClientDestination> CreateNewLocalDestination (const i2p::data::PrivateKeys& keys, bool isPublic = true,
 				const std::map<std::string, std::string> * params = nullptr);
+			i2p::data::PrivateKeys CreateTransientKeys (i2p::data::SigningKeyType sigType, i2p::data::CryptoKeyType cryptoType)
+				{ return m_TransientKeysPool.Acquire (sigType, cryptoType); };
 			std::shared_ptr<ClientDestination> CreateNewMatchedTunnelDestination(const i2p::data::PrivateKeys &keys, const std::string & name, const std::map<std::string, std::string> * params = nullptr);
 			void DeleteLocalDestination (std::shared_ptr<ClientDestination> destination);
 			std::shared_ptr<ClientDestination> FindLocalDestination (const i2p::data::IdentHash& destination) const;
@@ -86,8 +123,12 @@ namespace client
 
 		private:
 
+			typedef std::map<std::pair<std::string, std::string>, std::shared_ptr<ClientDestination> > TunnelsDestinations; // (file, section)
+
 			void ReadTunnels ();
-			void ReadTunnels (const std::string& tunConf, int& numClientTunnels, int& numServerTunnels);
+			void ReadTunnels (const std::string& tunConf, int& numClientTunnels, int& numServerTunnels,
+				std::map<std::string, std::string>& sections, const TunnelsDestinations& destinations);
+			void CreateTunnelsDestinations (const std::vector<std::string>& tunConfs, TunnelsDestinations& destinations);
 			void ReadHttpProxy ();
 			void ReadSocksProxy ();
 			template<typename Section, typename Type>
@@ -96,6 +137,8 @@ namespace client
 			void ReadI2CPOptions (const Section& section, std::map<std::string, std::string>& options) const; // for tunnels
 			void ReadI2CPOptionsFromConfig (const std::string& prefix, std::map<std::string, std::string>& options) const; // for HTTP and SOCKS proxy
 
+			void RemoveForwards (const std::string& name); // udp tunnels of section
+
 			void CleanupUDP(const boost::system::error_code & ecode);
 			void ScheduleCleanupUDP();
 
@@ -110,6 +153,7 @@ namespace client
 			std::map<i2p::data::IdentHash, std::shared_ptr<ClientDestination> > m_Destinations;
 			std::shared_ptr<ClientDestination>  m_SharedLocalDestination;
 
+			TransientKeysPool m_TransientKeysPool;
 			AddressBook m_AddressBook;
 
 			i2p::proxy::HTTPProxy * m_HttpProxy;
@@ -120,6 +164,7 @@ namespace client
 			std::mutex m_ForwardsMutex;
 			std::map<boost::asio::ip::udp::endpoint, std::shared_ptr<I2PUDPClientTunnel> > m_ClientForwards; // local endpoint -> udp tunnel
 			std::map<std::pair<i2p::data::IdentHash, int>, std::shared_ptr<I2PUDPServerTunnel> > m_ServerForwards; // <destination,port> -> udp tunnel
+			std::map<std::string, std::string> m_TunnelSections; // section name -> params as read last time
 
 			SAMBridge * m_SamBridge;
 			BOBCommandChannel * m_BOBCommandChannel;
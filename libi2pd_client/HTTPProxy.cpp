@@ -4,6 +4,9 @@
 #include <atomic>
 #include <memory>
 #include <set>
+#include <sstream>
+#include <algorithm>
+#include <vector>
 #include <boost/asio.hpp>
 #include <mutex>
 
@@ -19,6 +22,7 @@
 #include "I2PTunnel.h"
 #include "Config.h"
 #include "HTTP.h"
+#include "Timestamp.h"
 
 namespace i2p {
 namespace proxy {
@@ -80,6 +84,20 @@ namespace proxy {
 		void SocksProxySuccess();
 		void HandoverToUpstreamProxy();
 
+		/* keep-alive upstream stream, response is relayed until its end */
+		bool IsKeepAliveRequest();
+		void HandleKeepAliveStreamRequestComplete(std::shared_ptr<i2p::stream::Stream> stream);
+		void RelayResponse(std::shared_ptr<i2p::stream::Stream> stream, bool isPooled);
+		void StreamReceive();
+		void HandleStreamReceive(const boost::system::error_code & ecode, std::size_t bytes_transferred);
+		void HandleStreamData(size_t len);
+		void HandleStreamClosed();
+		void HandleResponseHeader(const i2p::http::HTTPRes & res);
+		size_t ConsumeResponseBody(const uint8_t * buf, size_t len);
+		void WriteToClient(const uint8_t * buf, size_t len);
+		void HandleClientWrite(const boost::system::error_code & ecode);
+		void FinishResponse();
+
 			uint8_t m_recv_chunk[8192];
 			std::string m_recv_buf; // from client
 			std::string m_send_buf; // to upstream
@@ -94,14 +112,28 @@ namespace proxy {
 		i2p::http::URL m_ClientRequestURL;
 		i2p::http::HTTPReq m_ClientRequest;
 		i2p::http::HTTPRes m_ClientResponse;
-		std::stringstream m_ClientRequestBuffer;
+		std::string m_ClientRequestBuffer;
+		size_t m_eoh_checked; // part of m_recv_buf checked for end of headers already
+		/* keep-alive relay */
+		enum ResponseBody { eBodyLength, eBodyChunked, eBodyUntilClose };
+		std::shared_ptr<i2p::stream::Stream> m_stream;
+		i2p::data::IdentHash m_dest_ident;
+		uint16_t m_dest_port;
+		std::vector<uint8_t> m_stream_buf;
+		std::string m_response_buf; // header until received, then rewritten for client
+		ResponseBody m_response_body;
+		size_t m_body_remaining; // content or current chunk with CRLF
+		std::string m_chunk_line;
+		bool m_is_pooled, m_is_reusable, m_header_received, m_in_trailer, m_body_complete;
 		public:
 
 			HTTPReqHandler(HTTPProxy * parent, std::shared_ptr<boost::asio::ip::tcp::socket> sock) :
 				I2PServiceHandler(parent), m_sock(sock),
 				m_proxysock(std::make_shared<boost::asio::ip::tcp::socket>(parent->GetService())),
 				m_proxy_resolver(parent->GetService()),
-				m_OutproxyUrl(parent->GetOutproxyURL()) {}
+				m_OutproxyUrl(parent->GetOutproxyURL()), m_eoh_checked(0), m_dest_port(0), m_response_body(eBodyUntilClose),
+				m_body_remaining(0), m_is_pooled(false), m_is_reusable(false), m_header_received(false),
+				m_in_trailer(false), m_body_complete(false) {}
 			~HTTPReqHandler() { Terminate(); }
 			void Handle () { AsyncSockRead(); } /* overload */
 	};
@@ -120,6 +152,11 @@ namespace proxy {
 
 	void HTTPReqHandler::Terminate() {
 		if (Kill()) return;
+		if (m_stream)
+		{
+			m_stream->Close();
+			m_stream = nullptr;
+		}
 		if (m_sock)
 		{
 			LogPrint(eLogDebug, "HTTPProxy: close sock");
@@ -219,7 +256,7 @@ namespace proxy {
 		/* replace headers */
 		req.UpdateHeader("User-Agent", "MYOB/6.66 (AN/ON)");
 		/* add headers */
-		req.UpdateHeader("Connection", "close"); /* keep-alive conns not supported yet */
+		req.UpdateHeader("Connection", "close"); /* keep-alive is set later for requests without body */
 	}
 
 	/**
@@ -366,11 +403,32 @@ namespace proxy {
 		m_RequestURL.host   = "";
 		m_ClientRequest.uri = m_RequestURL.to_string();
 
-		/* drop original request from recv buffer */
-		m_recv_buf.erase(0, m_req_len);
+		/* original request in recv buffer is skipped, not erased */
+		if (IsKeepAliveRequest())
+		{
+			/* reuse upstream stream if any, relay response ourself */
+			m_ClientRequest.UpdateHeader("Connection", "keep-alive");
+			m_send_buf = m_ClientRequest.to_string();
+			m_dest_ident = identHash;
+			m_dest_port = dest_port;
+			auto stream = static_cast<HTTPProxy *>(GetOwner())->AcquireStream (identHash, dest_port);
+			if (stream)
+			{
+				LogPrint(eLogDebug, "HTTPProxy: reusing stream to ", dest_host, ":", dest_port);
+				RelayResponse(stream, true);
+			}
+			else
+			{
+				LogPrint(eLogDebug, "HTTPProxy: connecting to host ", dest_host, ":", dest_port, " with keep-alive");
+				GetOwner()->CreateStream (std::bind (&HTTPReqHandler::HandleKeepAliveStreamRequestComplete,
+					shared_from_this(), std::placeholders::_1), identHash, dest_port);
+			}
+			return true;
+		}
 		/* build new buffer from modified request and data from original request */
-		m_send_buf = m_ClientRequest.to_string();
-		m_send_buf.append(m_recv_buf);
+		m_send_buf.clear();
+		m_ClientRequest.write(m_send_buf);
+		m_send_buf.append(m_recv_buf, m_req_len, std::string::npos);
 		/* connect to destination */
 		LogPrint(eLogDebug, "HTTPProxy: connecting to host ", dest_host, ":", dest_port);
 		GetOwner()->CreateStream (std::bind (&HTTPReqHandler::HandleStreamRequestComplete,
@@ -394,8 +452,9 @@ namespace proxy {
 		if(m_ClientRequest.method != "CONNECT")
 			m_ClientRequest.UpdateHeader("User-Agent", "Mozilla/5.0 (Windows NT 6.1; rv:52.0) Gecko/20100101 Firefox/52.0");
 
+		m_ClientRequestBuffer.clear();
 		m_ClientRequest.write(m_ClientRequestBuffer);
-		m_ClientRequestBuffer << m_recv_buf.substr(m_req_len);
+		m_ClientRequestBuffer.append(m_recv_buf, m_req_len, std::string::npos);
 		
 		// assume http if empty schema
 		if (m_ProxyURL.schema == "" || m_ProxyURL.schema == "http") 
@@ -413,9 +472,9 @@ namespace proxy {
 					std::string s = "Basic " + i2p::data::ToBase64Standard (m_ProxyURL.user + ":" + m_ProxyURL.pass);
 					m_ClientRequest.AddHeader("Proxy-Authorization", s);
 				}
-				m_send_buf = m_ClientRequest.to_string();
-				m_recv_buf.erase(0, m_req_len);
-				m_send_buf.append(m_recv_buf);
+				m_send_buf.clear();
+				m_ClientRequest.write(m_send_buf);
+				m_send_buf.append(m_recv_buf, m_req_len, std::string::npos);
 				GetOwner()->CreateStream (std::bind (&HTTPReqHandler::HandleStreamRequestComplete,
 					shared_from_this(), std::placeholders::_1), m_ProxyURL.host, m_ProxyURL.port);
 			}
@@ -542,7 +601,7 @@ namespace proxy {
 					else HandoverToUpstreamProxy();
 				});
 		} else {
-			m_send_buf = m_ClientRequestBuffer.str();
+			m_send_buf = std::move(m_ClientRequestBuffer);
 			LogPrint(eLogDebug, "HTTPProxy: send ", m_send_buf.size(), " bytes");
 			boost::asio::async_write(*m_proxysock, boost::asio::buffer(m_send_buf), boost::asio::transfer_all(), [&](const boost::system::error_code & ec, std::size_t transferred) {
 					if(ec) GenericProxyError("failed to send request to upstream", ec.message().c_str());
@@ -589,8 +648,17 @@ namespace proxy {
 		}
 
 		m_recv_buf.append(reinterpret_cast<const char *>(m_recv_chunk), len);
+		/* parse only when whole header is received, check new data only */
+		size_t from = m_eoh_checked > 3 ? m_eoh_checked - 3 : 0;
+		m_eoh_checked = m_recv_buf.length();
+		if (i2p::http::find_eoh(m_recv_buf.data(), m_recv_buf.length(), from) == std::string::npos)
+		{
+			AsyncSockRead();
+			return;
+		}
 		if (HandleRequest()) {
 			m_recv_buf.clear();
+			m_eoh_checked = 0;
 			return;
 		}
 		AsyncSockRead();
@@ -619,12 +687,341 @@ namespace proxy {
 		Done (shared_from_this());
 	}
 
+	bool HTTPReqHandler::IsKeepAliveRequest()
+	{
+		/* only requests without body, whole request is in m_send_buf */
+		if (m_ClientRequest.method != "GET" && m_ClientRequest.method != "HEAD")
+			return false;
+		if (m_ClientRequest.GetHeader("Content-Length").length() > 0 || m_ClientRequest.GetHeader("Transfer-Encoding").length() > 0)
+			return false;
+		return m_recv_buf.length() == (size_t)m_req_len;
+	}
+
+	void HTTPReqHandler::HandleKeepAliveStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream)
+	{
+		if (!stream) {
+			LogPrint (eLogError, "HTTPProxy: error when creating the stream, check the previous warnings for more info");
+			GenericProxyError("Host is down", "Can't create connection to requested host, it may be down. Please try again later.");
+			return;
+		}
+		if (Dead())
+		{
+			stream->Close();
+			return;
+		}
+		LogPrint (eLogDebug, "HTTPProxy: Created new keep-alive stream, sSID=", stream->GetSendStreamID(), ", rSID=", stream->GetRecvStreamID());
+		RelayResponse(stream, false);
+	}
+
+	void HTTPReqHandler::RelayResponse(std::shared_ptr<i2p::stream::Stream> stream, bool isPooled)
+	{
+		m_stream = stream;
+		m_is_pooled = isPooled;
+		m_is_reusable = false;
+		m_header_received = false;
+		m_response_buf.clear();
+		if (m_stream_buf.empty())
+			m_stream_buf.resize(i2p::client::GetTunnelBufferPool ().GetBufferSize ());
+		m_stream->Send(reinterpret_cast<const uint8_t*>(m_send_buf.data()), m_send_buf.length());
+		StreamReceive();
+	}
+
+	void HTTPReqHandler::StreamReceive()
+	{
+		if (!m_stream) return;
+		if (m_stream->GetStatus () == i2p::stream::eStreamStatusNew ||
+			m_stream->GetStatus () == i2p::stream::eStreamStatusOpen)
+			m_stream->AsyncReceive (boost::asio::buffer (m_stream_buf.data (), m_stream_buf.size ()),
+				std::bind (&HTTPReqHandler::HandleStreamReceive, shared_from_this (),
+					std::placeholders::_1, std::placeholders::_2),
+				i2p::client::I2P_TUNNEL_CONNECTION_MAX_IDLE);
+		else
+		{
+			/* closed by peer, get remaining data */
+			auto len = m_stream->ReadSome (m_stream_buf.data (), m_stream_buf.size ());
+			if (len > 0)
+				HandleStreamData(len);
+			else
+				HandleStreamClosed();
+		}
+	}
+
+	void HTTPReqHandler::HandleStreamReceive(const boost::system::error_code & ecode, std::size_t bytes_transferred)
+	{
+		if (Dead()) return;
+		if (bytes_transferred > 0)
+			HandleStreamData(bytes_transferred);
+		else if (ecode == boost::asio::error::timed_out && m_stream && m_stream->IsOpen ())
+			StreamReceive();
+		else
+			HandleStreamClosed();
+	}
+
+	void HTTPReqHandler::HandleStreamData(size_t len)
+	{
+		if (m_header_received)
+		{
+			size_t l = ConsumeResponseBody(m_stream_buf.data(), len);
+			WriteToClient(m_stream_buf.data(), l);
+			return;
+		}
+		m_response_buf.append((const char *)m_stream_buf.data(), len);
+		i2p::http::HTTPRes res;
+		int hdrLen = res.parse(m_response_buf);
+		if (hdrLen == 0 && m_response_buf.length() < m_stream_buf.size())
+		{
+			StreamReceive(); /* need more data */
+			return;
+		}
+		m_header_received = true;
+		if (hdrLen <= 0)
+		{
+			/* not a HTTP response, relay as is */
+			LogPrint(eLogWarning, "HTTPProxy: can't parse response header");
+			m_response_body = eBodyUntilClose;
+			m_is_reusable = false;
+			WriteToClient((const uint8_t *)m_response_buf.data(), m_response_buf.length());
+			return;
+		}
+		HandleResponseHeader(res);
+		/* rewrite header for the client, connection to it is not kept */
+		std::string body = m_response_buf.substr(hdrLen);
+		std::stringstream header;
+		std::size_t pos = 0, eol;
+		while ((eol = m_response_buf.find("\r\n", pos)) != std::string::npos && eol < (size_t)hdrLen - 2)
+		{
+			std::string line = m_response_buf.substr(pos, eol - pos);
+			std::string name = line.substr(0, line.find(':'));
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			if (name != "connection" && name != "keep-alive" && name != "proxy-connection")
+				header << line << "\r\n";
+			pos = eol + 2;
+		}
+		header << "Connection: close\r\n\r\n";
+		size_t l = ConsumeResponseBody((const uint8_t *)body.data(), body.length());
+		m_response_buf = header.str();
+		m_response_buf.append(body, 0, l);
+		WriteToClient((const uint8_t *)m_response_buf.data(), m_response_buf.length());
+	}
+
+	void HTTPReqHandler::HandleResponseHeader(const i2p::http::HTTPRes & res)
+	{
+		bool keepAlive = true;
+		auto it = res.headers.find("Connection");
+		if (it != res.headers.end())
+		{
+			if (it->second.find("close") != std::string::npos)
+				keepAlive = false;
+		}
+		else if (res.version == "HTTP/1.0")
+			keepAlive = false;
+		m_body_complete = false;
+		m_in_trailer = false;
+		m_chunk_line.clear();
+		m_body_remaining = 0;
+		auto te = res.headers.find("Transfer-Encoding");
+		if (m_ClientRequest.method == "HEAD" || res.code == 204 || res.code == 304)
+		{
+			m_response_body = eBodyLength;
+			m_body_complete = true;
+		}
+		else if (res.code < 200)
+			m_response_body = eBodyUntilClose; /* interim response */
+		else if (te != res.headers.end() && te->second.find("chunked") != std::string::npos)
+			m_response_body = eBodyChunked;
+		else if (res.content_length() >= 0)
+		{
+			m_response_body = eBodyLength;
+			m_body_remaining = res.content_length();
+			m_body_complete = !m_body_remaining;
+		}
+		else
+			m_response_body = eBodyUntilClose;
+		m_is_reusable = keepAlive && m_response_body != eBodyUntilClose;
+	}
+
+	size_t HTTPReqHandler::ConsumeResponseBody(const uint8_t * buf, size_t len)
+	{
+		/* returns number of bytes belonging to response */
+		if (m_response_body == eBodyUntilClose)
+			return len;
+		size_t pos = 0;
+		while (pos < len && !m_body_complete)
+		{
+			if (m_body_remaining > 0)
+			{
+				size_t l = std::min (m_body_remaining, len - pos);
+				pos += l;
+				m_body_remaining -= l;
+				if (!m_body_remaining && m_response_body == eBodyLength)
+					m_body_complete = true;
+				continue;
+			}
+			/* chunk size or trailer line */
+			char c = buf[pos++];
+			if (c != '\n')
+			{
+				m_chunk_line += c;
+				if (m_chunk_line.length() > 1024)
+				{
+					LogPrint(eLogWarning, "HTTPProxy: malformed chunked response");
+					m_response_body = eBodyUntilClose;
+					m_is_reusable = false;
+					return len;
+				}
+				continue;
+			}
+			if (m_in_trailer)
+			{
+				if (m_chunk_line == "\r" || m_chunk_line.empty())
+					m_body_complete = true;
+			}
+			else
+			{
+				size_t chunkLen = std::strtoul(m_chunk_line.c_str(), nullptr, 16);
+				if (chunkLen)
+					m_body_remaining = chunkLen + 2; /* data and CRLF */
+				else
+					m_in_trailer = true; /* last chunk */
+			}
+			m_chunk_line.clear();
+		}
+		if (pos < len)
+		{
+			/* something after response end, can't reuse */
+			LogPrint(eLogWarning, "HTTPProxy: ", len - pos, " unexpected bytes after response");
+			m_is_reusable = false;
+		}
+		return pos;
+	}
+
+	void HTTPReqHandler::WriteToClient(const uint8_t * buf, size_t len)
+	{
+		if (!m_sock) return;
+		boost::asio::async_write(*m_sock, boost::asio::buffer(buf, len), boost::asio::transfer_all(),
+			std::bind(&HTTPReqHandler::HandleClientWrite, shared_from_this(), std::placeholders::_1));
+	}
+
+	void HTTPReqHandler::HandleClientWrite(const boost::system::error_code & ecode)
+	{
+		if (ecode)
+		{
+			LogPrint(eLogError, "HTTPProxy: write error: ", ecode.message());
+			Terminate();
+		}
+		else if (m_body_complete)
+			FinishResponse();
+		else
+			StreamReceive();
+	}
+
+	void HTTPReqHandler::HandleStreamClosed()
+	{
+		if (m_is_pooled && m_response_buf.empty())
+		{
+			/* pooled stream has been closed by other side meanwhile, try new one */
+			LogPrint(eLogDebug, "HTTPProxy: pooled stream closed, connecting again");
+			m_stream->Close();
+			m_stream = nullptr;
+			GetOwner()->CreateStream (std::bind (&HTTPReqHandler::HandleKeepAliveStreamRequestComplete,
+				shared_from_this(), std::placeholders::_1), m_dest_ident, m_dest_port);
+			return;
+		}
+		if (!m_header_received && !m_response_buf.empty())
+		{
+			/* incomplete header, send what we have got */
+			m_header_received = true;
+			m_response_body = eBodyUntilClose;
+			m_body_complete = true;
+			m_is_reusable = false;
+			WriteToClient((const uint8_t *)m_response_buf.data(), m_response_buf.length());
+			return;
+		}
+		m_is_reusable = false;
+		FinishResponse();
+	}
+
+	void HTTPReqHandler::FinishResponse()
+	{
+		if (m_stream)
+		{
+			if (m_is_reusable && m_stream->IsOpen ())
+				static_cast<HTTPProxy *>(GetOwner())->ReleaseStream (m_dest_ident, m_dest_port, m_stream);
+			else
+				m_stream->Close();
+			m_stream = nullptr;
+		}
+		if (m_sock)
+		{
+			boost::system::error_code ec;
+			m_sock->shutdown(boost::asio::ip::tcp::socket::shutdown_send, ec); // avoid RST
+		}
+		Terminate();
+	}
+
 	HTTPProxy::HTTPProxy(const std::string& name, const std::string& address, int port, const std::string & outproxy, std::shared_ptr<i2p::client::ClientDestination> localDestination):
 		TCPIPAcceptor(address, port, localDestination ? localDestination : i2p::client::context.GetSharedLocalDestination ()),
 		m_Name (name), m_OutproxyUrl(outproxy)
 	{
 	}
 
+	HTTPProxy::~HTTPProxy()
+	{
+		for (auto& it: m_StreamsPool)
+			for (auto& s: it.second)
+				s.first->AsyncClose();
+	}
+
+	std::shared_ptr<i2p::stream::Stream> HTTPProxy::AcquireStream (const i2p::data::IdentHash& ident, int port)
+	{
+		std::unique_lock<std::mutex> l(m_StreamsPoolMutex);
+		auto it = m_StreamsPool.find (std::make_pair (ident, port));
+		if (it == m_StreamsPool.end ()) return nullptr;
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		std::shared_ptr<i2p::stream::Stream> stream;
+		while (!it->second.empty ())
+		{
+			auto s = it->second.back (); // most recently used
+			it->second.pop_back ();
+			if (ts < s.second + HTTP_PROXY_POOLED_STREAM_IDLE_TIMEOUT && s.first->IsOpen () && !s.first->GetReceiveQueueSize ())
+			{
+				stream = s.first;
+				break;
+			}
+			s.first->AsyncClose ();
+		}
+		if (it->second.empty ())
+			m_StreamsPool.erase (it);
+		return stream;
+	}
+
+	void HTTPProxy::ReleaseStream (const i2p::data::IdentHash& ident, int port, std::shared_ptr<i2p::stream::Stream> stream)
+	{
+		std::unique_lock<std::mutex> l(m_StreamsPoolMutex);
+		auto ts = i2p::util::GetSecondsSinceEpoch ();
+		// drop expired
+		for (auto it = m_StreamsPool.begin (); it != m_StreamsPool.end ();)
+		{
+			auto& streams = it->second;
+			while (!streams.empty () && ts >= streams.front ().second + HTTP_PROXY_POOLED_STREAM_IDLE_TIMEOUT)
+			{
+				streams.front ().first->AsyncClose ();
+				streams.pop_front ();
+			}
+			if (streams.empty ())
+				it = m_StreamsPool.erase (it);
+			else
+				++it;
+		}
+		auto& streams = m_StreamsPool[std::make_pair (ident, port)];
+		if (streams.size () >= HTTP_PROXY_MAX_POOLED_STREAMS)
+		{
+			streams.front ().first->AsyncClose ();
+			streams.pop_front ();
+		}
+		streams.push_back (std::make_pair (stream, ts));
+	}
+
 	std::shared_ptr<i2p::client::I2PServiceHandler> HTTPProxy::CreateHandler(std::shared_ptr<boost::asio::ip::tcp::socket> socket)
 	{
 		return std::make_shared<HTTPReqHandler> (this, socket);
@@ -1,18 +1,33 @@
 #ifndef HTTP_PROXY_H__
 #define HTTP_PROXY_H__
 
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include "Identity.h"
+#include "Streaming.h"
+#include "I2PService.h"
+
 namespace i2p {
 namespace proxy {
+	const int HTTP_PROXY_POOLED_STREAM_IDLE_TIMEOUT = 30; // in seconds
+	const size_t HTTP_PROXY_MAX_POOLED_STREAMS = 4; // per destination and port
+
 	class HTTPProxy: public i2p::client::TCPIPAcceptor
 	{
 		public:
 			HTTPProxy(const std::string& name, const std::string& address, int port, const std::string & outproxy, std::shared_ptr<i2p::client::ClientDestination> localDestination);
 			HTTPProxy(const std::string& name, const std::string& address, int port, std::shared_ptr<i2p::client::ClientDestination> localDestination = nullptr) :
 				HTTPProxy(name, address, port, "", localDestination) {} ;
-			~HTTPProxy() {};
+			~HTTPProxy();
 
 			std::string GetOutproxyURL() const { return m_OutproxyUrl; }
 
+			// keep-alive upstream streams
+			std::shared_ptr<i2p::stream::Stream> AcquireStream (const i2p::data::IdentHash& ident, int port);
+			void ReleaseStream (const i2p::data::IdentHash& ident, int port, std::shared_ptr<i2p::stream::Stream> stream);
+
 		protected:
 			// Implements TCPIPAcceptor
 			std::shared_ptr<i2p::client::I2PServiceHandler> CreateHandler(std::shared_ptr<boost::asio::ip::tcp::socket> socket);
@@ -21,6 +36,8 @@ namespace proxy {
 		private:
 			std::string m_Name;
 			std::string m_OutproxyUrl;
+			std::mutex m_StreamsPoolMutex;
+			std::map<std::pair<i2p::data::IdentHash, int>, std::list<std::pair<std::shared_ptr<i2p::stream::Stream>, uint64_t> > > m_StreamsPool; // with idle since
 	};
 } // http
 } // i2p
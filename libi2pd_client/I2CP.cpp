@@ -16,6 +16,7 @@
 #include "ClientContext.h"
 #include "Transports.h"
 #include "Signature.h"
+#include "util.h"
 #include "I2CP.h"
 
 namespace i2p
@@ -132,7 +133,7 @@ namespace client
 				remoteLease = leases[rand () % leases.size ()];
 			if (remoteLease && outboundTunnel)
 				remoteSession->SetSharedRoutingPath (std::make_shared<i2p::garlic::GarlicRoutingPath> (
-					i2p::garlic::GarlicRoutingPath{outboundTunnel, remoteLease, 10000, 0, 0})); // 10 secs RTT
+					i2p::garlic::GarlicRoutingPath{outboundTunnel, remoteLease, 10000, 0, 0, 0})); // 10 secs RTT
 			else
 				remoteSession->SetSharedRoutingPath (nullptr);
 		}
@@ -160,14 +161,13 @@ namespace client
 	}
 
 	I2CPSession::I2CPSession (I2CPServer& owner, std::shared_ptr<proto::socket> socket):
-		m_Owner (owner), m_Socket (socket), m_Payload (nullptr),
-		m_SessionID (0xFFFF), m_MessageID (0), m_IsSendAccepted (true)
+		m_Owner (owner), m_Socket (socket), m_Buffer (I2CP_SESSION_BUFFER_SIZE), m_BufferLen (0),
+		m_IsSending (false), m_SessionID (0xFFFF), m_MessageID (0), m_IsSendAccepted (true)
 	{
 	}
 
 	I2CPSession::~I2CPSession ()
 	{
-		delete[] m_Payload;
 	}
 
 	void I2CPSession::Start ()
@@ -185,72 +185,79 @@ namespace client
 		if (m_Socket)
 		{
 			auto s = shared_from_this ();
-			m_Socket->async_read_some (boost::asio::buffer (m_Header, 1),
+			m_Socket->async_read_some (boost::asio::buffer (m_Buffer.data (), 1),
 				[s](const boost::system::error_code& ecode, std::size_t bytes_transferred)
 				    {
-						if (!ecode && bytes_transferred > 0 && s->m_Header[0] == I2CP_PROTOCOL_BYTE)
-							s->ReceiveHeader ();
+						if (!ecode && bytes_transferred > 0 && s->m_Buffer[0] == I2CP_PROTOCOL_BYTE)
+							s->Receive ();
 						else
 							s->Terminate ();
 					});
 		}
 	}
 
-	void I2CPSession::ReceiveHeader ()
+	void I2CPSession::Receive ()
 	{
-		boost::asio::async_read (*m_Socket, boost::asio::buffer (m_Header, I2CP_HEADER_SIZE),
-			boost::asio::transfer_all (),
-			std::bind (&I2CPSession::HandleReceivedHeader, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+		if (!m_Socket) return;
+		m_Socket->async_read_some (boost::asio::buffer (m_Buffer.data () + m_BufferLen, m_Buffer.size () - m_BufferLen),
+			std::bind (&I2CPSession::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
 	}
 
-	void I2CPSession::HandleReceivedHeader (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	void I2CPSession::HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
 	{
 		if (ecode)
 			Terminate ();
 		else
 		{
-			m_PayloadLen = bufbe32toh (m_Header + I2CP_HEADER_LENGTH_OFFSET);
-			if (m_PayloadLen > 0)
+			m_BufferLen += bytes_transferred;
+			// handle all complete messages
+			size_t offset = 0;
+			while (m_BufferLen - offset >= I2CP_HEADER_SIZE)
 			{
-				m_Payload = new uint8_t[m_PayloadLen];
-				ReceivePayload ();
+				size_t payloadLen = bufbe32toh (m_Buffer.data () + offset + I2CP_HEADER_LENGTH_OFFSET);
+				if (payloadLen > I2CP_MAX_MESSAGE_LENGTH)
+				{
+					LogPrint (eLogError, "I2CP: message length ", payloadLen, " exceeds ", I2CP_MAX_MESSAGE_LENGTH);
+					Terminate ();
+					return;
+				}
+				if (m_BufferLen - offset < I2CP_HEADER_SIZE + payloadLen)
+				{
+					// incomplete message
+					if (I2CP_HEADER_SIZE + payloadLen > m_Buffer.size ())
+					{
+						// doesn't fit, move to beginning of larger buffer
+						std::vector<uint8_t> buf (I2CP_HEADER_SIZE + payloadLen);
+						memcpy (buf.data (), m_Buffer.data () + offset, m_BufferLen - offset);
+						m_Buffer.swap (buf);
+						m_BufferLen -= offset;
+						offset = 0;
+					}
+					break;
+				}
+				HandleMessage (m_Buffer[offset + I2CP_HEADER_TYPE_OFFSET], m_Buffer.data () + offset + I2CP_HEADER_SIZE, payloadLen);
+				if (!m_Socket) return; // terminated by handler
+				offset += I2CP_HEADER_SIZE + payloadLen;
 			}
-			else // no following payload
+			if (offset > 0)
 			{
-				HandleMessage ();
-				ReceiveHeader (); // next message
+				m_BufferLen -= offset;
+				if (m_BufferLen > 0)
+					memmove (m_Buffer.data (), m_Buffer.data () + offset, m_BufferLen);
+				else if (m_Buffer.size () > I2CP_SESSION_BUFFER_SIZE)
+					m_Buffer.resize (I2CP_SESSION_BUFFER_SIZE); // large message handled, shrink back
 			}
+			Receive (); // next messages
 		}
 	}
 
-	void I2CPSession::ReceivePayload ()
-	{
-		boost::asio::async_read (*m_Socket, boost::asio::buffer (m_Payload, m_PayloadLen),
-			boost::asio::transfer_all (),
-			std::bind (&I2CPSession::HandleReceivedPayload, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
-	}
-
-	void I2CPSession::HandleReceivedPayload (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	void I2CPSession::HandleMessage (uint8_t type, const uint8_t * buf, size_t len)
 	{
-		if (ecode)
-			Terminate ();
-		else
-		{
-			HandleMessage ();
-			delete[] m_Payload;
-			m_Payload = nullptr;
-			m_PayloadLen = 0;
-			ReceiveHeader (); // next message
-		}
-	}
-
-	void I2CPSession::HandleMessage ()
-	{
-		auto handler = m_Owner.GetMessagesHandlers ()[m_Header[I2CP_HEADER_TYPE_OFFSET]];
+		auto handler = m_Owner.GetMessagesHandlers ()[type];
 		if (handler)
-			(this->*handler)(m_Payload, m_PayloadLen);
+			(this->*handler)(buf, len);
 		else
-			LogPrint (eLogError, "I2CP: Unknown I2CP message ", (int)m_Header[I2CP_HEADER_TYPE_OFFSET]);
+			LogPrint (eLogError, "I2CP: Unknown I2CP message ", (int)type);
 	}
 
 	void I2CPSession::Terminate ()
@@ -270,28 +277,69 @@ namespace client
 	}
 
 	void I2CPSession::SendI2CPMessage (uint8_t type, const uint8_t * payload, size_t len)
+	{
+		std::vector<uint8_t> buf (len + I2CP_HEADER_SIZE);
+		htobe32buf (buf.data () + I2CP_HEADER_LENGTH_OFFSET, len);
+		buf[I2CP_HEADER_TYPE_OFFSET] = type;
+		memcpy (buf.data () + I2CP_HEADER_SIZE, payload, len);
+		SendBuffer (std::move (buf));
+	}
+
+	void I2CPSession::SendBuffer (std::vector<uint8_t>&& buf)
+	{
+		if (!m_Socket)
+		{
+			LogPrint (eLogError, "I2CP: Can't write to the socket");
+			return;
+		}
+		std::unique_lock<std::mutex> l(m_SendQueueMutex);
+		m_SendQueue.push_back (std::move (buf));
+		if (!m_IsSending)
+		{
+			// messages queued until flush are coalesced
+			m_IsSending = true;
+			m_Owner.GetService ().post (std::bind (&I2CPSession::Flush, shared_from_this ()));
+		}
+	}
+
+	void I2CPSession::Flush ()
 	{
 		auto socket = m_Socket;
-		if (socket)
+		std::vector<boost::asio::const_buffer> buffers;
 		{
-			auto l = len + I2CP_HEADER_SIZE;
-			uint8_t * buf = new uint8_t[l];
-			htobe32buf (buf + I2CP_HEADER_LENGTH_OFFSET, len);
-			buf[I2CP_HEADER_TYPE_OFFSET] = type;
-			memcpy (buf + I2CP_HEADER_SIZE, payload, len);
-			boost::asio::async_write (*socket, boost::asio::buffer (buf, l), boost::asio::transfer_all (),
-			std::bind(&I2CPSession::HandleI2CPMessageSent, shared_from_this (),
-							std::placeholders::_1, std::placeholders::_2, buf));
+			std::unique_lock<std::mutex> l(m_SendQueueMutex);
+			m_SentBuffers.clear ();
+			if (m_SendQueue.empty () || !socket)
+			{
+				m_SendQueue.clear ();
+				m_IsSending = false;
+				return;
+			}
+			m_SentBuffers.swap (m_SendQueue);
 		}
-		else
-			LogPrint (eLogError, "I2CP: Can't write to the socket");
+		buffers.reserve (m_SentBuffers.size ());
+		for (const auto& it: m_SentBuffers)
+			buffers.push_back (boost::asio::buffer (it));
+		boost::asio::async_write (*socket, buffers, boost::asio::transfer_all (),
+			std::bind(&I2CPSession::HandleI2CPMessageSent, shared_from_this (),
+				std::placeholders::_1, std::placeholders::_2));
 	}
 
-	void I2CPSession::HandleI2CPMessageSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, const uint8_t * buf)
+	void I2CPSession::HandleI2CPMessageSent (const boost::system::error_code& ecode, std::size_t bytes_transferred)
 	{
-		delete[] buf;
-		if (ecode && ecode != boost::asio::error::operation_aborted)
-			Terminate ();
+		if (ecode)
+		{
+			{
+				std::unique_lock<std::mutex> l(m_SendQueueMutex);
+				m_SentBuffers.clear ();
+				m_SendQueue.clear ();
+				m_IsSending = false;
+			}
+			if (ecode != boost::asio::error::operation_aborted)
+				Terminate ();
+		}
+		else
+			Flush (); // messages queued meanwhile
 	}
 
 	std::string I2CPSession::ExtractString (const uint8_t * buf, size_t len)
@@ -676,17 +724,14 @@ namespace client
 	void I2CPSession::SendMessagePayloadMessage (const uint8_t * payload, size_t len)
 	{
 		// we don't use SendI2CPMessage to eliminate additional copy
-		auto l = len + 10 + I2CP_HEADER_SIZE;
-		uint8_t * buf = new uint8_t[l];
-		htobe32buf (buf + I2CP_HEADER_LENGTH_OFFSET, len + 10);
+		std::vector<uint8_t> buf (len + 10 + I2CP_HEADER_SIZE);
+		htobe32buf (buf.data () + I2CP_HEADER_LENGTH_OFFSET, len + 10);
 		buf[I2CP_HEADER_TYPE_OFFSET] = I2CP_MESSAGE_PAYLOAD_MESSAGE;
-		htobe16buf (buf + I2CP_HEADER_SIZE, m_SessionID);
-		htobe32buf (buf + I2CP_HEADER_SIZE + 2, m_MessageID++);
-		htobe32buf (buf + I2CP_HEADER_SIZE + 6, len);
-		memcpy (buf + I2CP_HEADER_SIZE + 10, payload, len);
-		boost::asio::async_write (*m_Socket, boost::asio::buffer (buf, l), boost::asio::transfer_all (),
-		std::bind(&I2CPSession::HandleI2CPMessageSent, shared_from_this (),
-						std::placeholders::_1, std::placeholders::_2, buf));
+		htobe16buf (buf.data () + I2CP_HEADER_SIZE, m_SessionID);
+		htobe32buf (buf.data () + I2CP_HEADER_SIZE + 2, m_MessageID++);
+		htobe32buf (buf.data () + I2CP_HEADER_SIZE + 6, len);
+		memcpy (buf.data () + I2CP_HEADER_SIZE + 10, payload, len);
+		SendBuffer (std::move (buf));
 	}
 
 	I2CPServer::I2CPServer (const std::string& interface, int port):
@@ -742,11 +787,12 @@ namespace client
 
 	void I2CPServer::Run ()
 	{
+		i2p::util::InitThread ("I2CP", i2p::util::eThreadGroupClients);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "I2CP");
 			}
 			catch (std::exception& ex)
 			{
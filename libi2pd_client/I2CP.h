@@ -14,6 +14,8 @@
 #include <memory>
 #include <thread>
 #include <map>
+#include <vector>
+#include <mutex>
 #include <boost/asio.hpp>
 #include "Destination.h"
 
@@ -22,7 +24,8 @@ namespace i2p
 namespace client
 {
 	const uint8_t I2CP_PROTOCOL_BYTE = 0x2A;
-	const size_t I2CP_SESSION_BUFFER_SIZE = 4096;
+	const size_t I2CP_SESSION_BUFFER_SIZE = 32768; // initial, grows up to a message
+	const size_t I2CP_MAX_MESSAGE_LENGTH = 65535;
 
 	const size_t I2CP_HEADER_LENGTH_OFFSET = 0;
 	const size_t I2CP_HEADER_TYPE_OFFSET = I2CP_HEADER_LENGTH_OFFSET + 4;
@@ -135,14 +138,14 @@ namespace client
 		private:
 
 			void ReadProtocolByte ();
-			void ReceiveHeader ();
-			void HandleReceivedHeader (const boost::system::error_code& ecode, std::size_t bytes_transferred);
-			void ReceivePayload ();
-			void HandleReceivedPayload (const boost::system::error_code& ecode, std::size_t bytes_transferred);
-			void HandleMessage ();
+			void Receive ();
+			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleMessage (uint8_t type, const uint8_t * buf, size_t len);
 			void Terminate ();
 
-			void HandleI2CPMessageSent (const boost::system::error_code& ecode, std::size_t bytes_transferred, const uint8_t * buf);
+			void SendBuffer (std::vector<uint8_t>&& buf);
+			void Flush (); // all queued messages in one write
+			void HandleI2CPMessageSent (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			std::string ExtractString (const uint8_t * buf, size_t len);
 			size_t PutString (uint8_t * buf, size_t len, const std::string& str);
 			void ExtractMapping (const uint8_t * buf, size_t len, std::map<std::string, std::string>& mapping);
@@ -154,8 +157,11 @@ namespace client
 
 			I2CPServer& m_Owner;
 			std::shared_ptr<proto::socket> m_Socket;
-			uint8_t m_Header[I2CP_HEADER_SIZE], * m_Payload;
-			size_t m_PayloadLen;
+			std::vector<uint8_t> m_Buffer; // received
+			size_t m_BufferLen;
+			std::mutex m_SendQueueMutex;
+			std::vector<std::vector<uint8_t> > m_SendQueue, m_SentBuffers; // sent are being written
+			bool m_IsSending;
 
 			std::shared_ptr<I2CPDestination> m_Destination;
 			uint16_t m_SessionID;
@@ -1,6 +1,9 @@
 #include <cassert>
+#include <stdlib.h>
+#include <boost/algorithm/string.hpp>
 #include "Base.h"
 #include "Log.h"
+#include "HTTP.h"
 #include "Destination.h"
 #include "ClientContext.h"
 #include "I2PTunnel.h"
@@ -15,35 +18,101 @@ namespace client
 	{
 		if (socket && socket->is_open())
 		{
-			boost::asio::socket_base::receive_buffer_size option(I2P_TUNNEL_CONNECTION_BUFFER_SIZE);
+			boost::asio::socket_base::receive_buffer_size option(GetTunnelBufferPool ().GetBufferSize ());
 			socket->set_option(option);
 		}
 	}
 
 	I2PTunnelConnection::I2PTunnelConnection (I2PService * owner, std::shared_ptr<boost::asio::ip::tcp::socket> socket,
 		std::shared_ptr<const i2p::data::LeaseSet> leaseSet, int port):
-		I2PServiceHandler(owner), m_Socket (socket), m_RemoteEndpoint (socket->remote_endpoint ()),
-		m_IsQuiet (true)
+		I2PServiceHandler(owner), m_Buffer (nullptr), m_StreamBuffer (nullptr), m_Socket (socket),
+		m_RemoteEndpoint (socket->remote_endpoint ()), m_IsQuiet (true)
 	{
 		m_Stream = GetOwner()->GetLocalDestination ()->CreateStream (leaseSet, port);
 	}
 
 	I2PTunnelConnection::I2PTunnelConnection (I2PService * owner,
 		std::shared_ptr<boost::asio::ip::tcp::socket> socket, std::shared_ptr<i2p::stream::Stream> stream):
-		I2PServiceHandler(owner), m_Socket (socket), m_Stream (stream),
-		m_RemoteEndpoint (socket->remote_endpoint ()), m_IsQuiet (true)
+		I2PServiceHandler(owner), m_Buffer (nullptr), m_StreamBuffer (nullptr), m_Socket (socket),
+		m_Stream (stream), m_RemoteEndpoint (socket->remote_endpoint ()), m_IsQuiet (true)
 	{
 	}
 
 	I2PTunnelConnection::I2PTunnelConnection (I2PService * owner, std::shared_ptr<i2p::stream::Stream> stream,
 		std::shared_ptr<boost::asio::ip::tcp::socket> socket, const boost::asio::ip::tcp::endpoint& target, bool quiet):
-		I2PServiceHandler(owner), m_Socket (socket), m_Stream (stream),
-		m_RemoteEndpoint (target), m_IsQuiet (quiet)
+		I2PServiceHandler(owner), m_Buffer (nullptr), m_StreamBuffer (nullptr), m_Socket (socket),
+		m_Stream (stream), m_RemoteEndpoint (target), m_IsQuiet (quiet)
+	{
+	}
+
+	I2PTunnelBufferPool::~I2PTunnelBufferPool ()
+	{
+		for (auto it: m_Free)
+			delete[] it;
+	}
+
+	void I2PTunnelBufferPool::SetLowMemory (bool lowMemory)
 	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		for (auto it: m_Free)
+			delete[] it;
+		m_Free.clear ();
+		m_BufferSize = lowMemory ? I2P_TUNNEL_LOW_MEMORY_BUFFER_SIZE : I2P_TUNNEL_CONNECTION_BUFFER_SIZE;
+		m_MaxNumFree = lowMemory ? I2P_TUNNEL_LOW_MEMORY_BUFFER_POOL_MAX_FREE : I2P_TUNNEL_BUFFER_POOL_MAX_FREE;
+	}
+
+	uint8_t * I2PTunnelBufferPool::Acquire ()
+	{
+		m_NumInUse++;
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (!m_Free.empty ())
+			{
+				auto buf = m_Free.back ();
+				m_Free.pop_back ();
+				return buf;
+			}
+		}
+		return new uint8_t[m_BufferSize];
+	}
+
+	void I2PTunnelBufferPool::Release (uint8_t * buf)
+	{
+		if (!buf) return;
+		m_NumInUse--;
+		{
+			std::unique_lock<std::mutex> l(m_Mutex);
+			if (m_Free.size () < m_MaxNumFree)
+			{
+				m_Free.push_back (buf);
+				return;
+			}
+		}
+		delete[] buf;
+	}
+
+	size_t I2PTunnelBufferPool::GetNumFree () const
+	{
+		std::unique_lock<std::mutex> l(m_Mutex);
+		return m_Free.size ();
+	}
+
+	I2PTunnelBufferPool& GetTunnelBufferPool ()
+	{
+		static I2PTunnelBufferPool pool;
+		return pool;
 	}
 
 	I2PTunnelConnection::~I2PTunnelConnection ()
 	{
+		ReleaseBuffer (m_Buffer);
+		ReleaseBuffer (m_StreamBuffer);
+	}
+
+	void I2PTunnelConnection::SetMemoryBudget (std::shared_ptr<I2PTunnelMemoryBudget> budget)
+	{
+		m_MemoryBudget = budget;
+		if (m_Stream) m_Stream->SetMemoryBudget (budget); // stream chokes remote while exceeded
 	}
 
 	void I2PTunnelConnection::I2PConnect (const uint8_t * msg, size_t len)
@@ -53,7 +122,7 @@ namespace client
 			if (msg)
 				m_Stream->Send (msg, len); // connect and send
 			else
-				m_Stream->Send (m_Buffer, 0); // connect
+				m_Stream->Send (nullptr, 0); // connect
 		}
 		StreamReceive ();
 		Receive ();
@@ -115,9 +184,30 @@ namespace client
 
 	void I2PTunnelConnection::Receive ()
 	{
-		m_Socket->async_read_some (boost::asio::buffer(m_Buffer, I2P_TUNNEL_CONNECTION_BUFFER_SIZE),
-			std::bind(&I2PTunnelConnection::HandleReceived, shared_from_this (),
-			std::placeholders::_1, std::placeholders::_2));
+		// idle connection doesn't hold a buffer, it's taken when data arrives
+		m_Socket->async_wait (boost::asio::ip::tcp::socket::wait_read,
+			std::bind(&I2PTunnelConnection::HandleReadable, shared_from_this (), std::placeholders::_1));
+	}
+
+	void I2PTunnelConnection::HandleReadable (const boost::system::error_code& ecode)
+	{
+		if (ecode)
+		{
+			HandleReceived (ecode, 0);
+			return;
+		}
+		boost::system::error_code ec;
+		if (!m_Socket->non_blocking ())
+			m_Socket->non_blocking (true, ec);
+		AcquireBuffer (m_Buffer);
+		auto len = m_Socket->read_some (boost::asio::buffer (m_Buffer, GetTunnelBufferPool ().GetBufferSize ()), ec);
+		if (ec == boost::asio::error::would_block || ec == boost::asio::error::try_again)
+		{
+			ReleaseBuffer (m_Buffer);
+			Receive ();
+			return;
+		}
+		HandleReceived (ec, len);
 	}
 
 	void I2PTunnelConnection::HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
@@ -135,16 +225,19 @@ namespace client
 			if (m_Stream)
 			{
 				auto s = shared_from_this ();
-				m_Stream->AsyncSend (m_Buffer, bytes_transferred,
+				m_Stream->AsyncSendNoCopy (m_Buffer, bytes_transferred, // m_Buffer is held until sent
 					[s](const boost::system::error_code& ecode)
 					{
+						s->ReleaseBuffer (s->m_Buffer);
 						if (!ecode)
 							s->Receive ();
 						else
 							s->Terminate ();
 					});
+				return;
 			}
 		}
+		ReleaseBuffer (m_Buffer);
 	}
 
 	void I2PTunnelConnection::HandleWrite (const boost::system::error_code& ecode)
@@ -156,7 +249,10 @@ namespace client
 				Terminate ();
 		}
 		else
+		{
+			ReleaseBuffer (m_StreamBuffer); // idle until next data from stream
 			StreamReceive ();
+		}
 	}
 
 	void I2PTunnelConnection::StreamReceive ()
@@ -166,7 +262,8 @@ namespace client
 			if (m_Stream->GetStatus () == i2p::stream::eStreamStatusNew ||
 				m_Stream->GetStatus () == i2p::stream::eStreamStatusOpen) // regular
 			{
-				m_Stream->AsyncReceive (boost::asio::buffer (m_StreamBuffer, I2P_TUNNEL_CONNECTION_BUFFER_SIZE),
+				// wait for data without buffer, received data stays in stream's queue
+				m_Stream->AsyncReceive (boost::asio::mutable_buffer (),
 					std::bind (&I2PTunnelConnection::HandleStreamReceive, shared_from_this (),
 						std::placeholders::_1, std::placeholders::_2),
 					I2P_TUNNEL_CONNECTION_MAX_IDLE);
@@ -174,9 +271,8 @@ namespace client
 			else // closed by peer
 			{
 				// get remaning data
-				auto len = m_Stream->ReadSome (m_StreamBuffer, I2P_TUNNEL_CONNECTION_BUFFER_SIZE);
-				if (len > 0) // still some data
-					Write (m_StreamBuffer, len);
+				if (m_Stream->GetReceiveQueueSize () > 0) // still some data
+					WriteReceived ();
 				else // no more data
 					Terminate ();
 			}
@@ -190,8 +286,8 @@ namespace client
 			if (ecode != boost::asio::error::operation_aborted)
 			{
 				LogPrint (eLogError, "I2PTunnel: stream read error: ", ecode.message ());
-				if (bytes_transferred > 0)
-					Write (m_StreamBuffer, bytes_transferred); // postpone termination
+				if (bytes_transferred > 0) // postpone termination
+					WriteReceived ();
 				else if (ecode == boost::asio::error::timed_out && m_Stream && m_Stream->IsOpen ())
 					StreamReceive ();
 				else
@@ -201,7 +297,51 @@ namespace client
 				Terminate ();
 		}
 		else
-			Write (m_StreamBuffer, bytes_transferred);
+			WriteReceived ();
+	}
+
+	void I2PTunnelConnection::WriteReceived ()
+	{
+		if (!IsZeroCopy ())
+		{
+			// copy to buffer for Write, released after write completes
+			auto len = m_Stream->ReadSome (GetStreamBuffer (), GetTunnelBufferPool ().GetBufferSize ());
+			Write (m_StreamBuffer, len);
+			return;
+		}
+		std::vector<boost::asio::const_buffer> buffers;
+		auto len = m_Stream->GetReceivedBuffers (buffers, GetTunnelBufferPool ().GetBufferSize ());
+		auto s = shared_from_this ();
+		auto stream = m_Stream; // keeps packets referenced by buffers until write completes, counted in stream's queue
+		boost::asio::async_write (*m_Socket, buffers, boost::asio::transfer_all (),
+			[s, stream, len](const boost::system::error_code& ecode, std::size_t bytes_transferred)
+			{
+				if (!ecode)
+					stream->ConsumeReceived (len);
+				s->HandleWrite (ecode);
+			});
+	}
+
+	uint8_t * I2PTunnelConnection::GetStreamBuffer ()
+	{
+		if (!m_StreamBuffer)
+			AcquireBuffer (m_StreamBuffer);
+		return m_StreamBuffer;
+	}
+
+	void I2PTunnelConnection::AcquireBuffer (uint8_t *& buffer)
+	{
+		if (buffer) return;
+		buffer = GetTunnelBufferPool ().Acquire ();
+		if (m_MemoryBudget) m_MemoryBudget->Acquire (GetTunnelBufferPool ().GetBufferSize ());
+	}
+
+	void I2PTunnelConnection::ReleaseBuffer (uint8_t *& buffer)
+	{
+		if (!buffer) return;
+		GetTunnelBufferPool ().Release (buffer);
+		buffer = nullptr;
+		if (m_MemoryBudget) m_MemoryBudget->Release (GetTunnelBufferPool ().GetBufferSize ());
 	}
 
 	void I2PTunnelConnection::Write (const uint8_t * buf, size_t len)
@@ -210,6 +350,12 @@ namespace client
 			std::bind (&I2PTunnelConnection::HandleWrite, shared_from_this (), std::placeholders::_1));
 	}
 
+	void I2PTunnelConnection::WriteBuffers (const std::vector<boost::asio::const_buffer>& buffers)
+	{
+		boost::asio::async_write (*m_Socket, buffers, boost::asio::transfer_all (),
+			std::bind (&I2PTunnelConnection::HandleWrite, shared_from_this (), std::placeholders::_1));
+	}
+
 	void I2PTunnelConnection::HandleConnect (const boost::system::error_code& ecode)
 	{
 		if (ecode)
@@ -227,10 +373,10 @@ namespace client
 				// send destination first like received from I2P
 				std::string dest = m_Stream->GetRemoteIdentity ()->ToBase64 ();
 				dest += "\n";
-				if(sizeof(m_StreamBuffer) >= dest.size()) {
-					memcpy (m_StreamBuffer, dest.c_str (), dest.size ());
+				if(GetTunnelBufferPool ().GetBufferSize () >= dest.size()) {
+					memcpy (GetStreamBuffer (), dest.c_str (), dest.size ());
 				}
-				HandleStreamReceive (boost::system::error_code (), dest.size ());
+				Write (m_StreamBuffer, dest.size ()); // continues with StreamReceive
 			}
 			Receive ();
 		}
@@ -288,54 +434,196 @@ namespace client
 	I2PServerTunnelConnectionHTTP::I2PServerTunnelConnectionHTTP (I2PService * owner, std::shared_ptr<i2p::stream::Stream> stream,
 		std::shared_ptr<boost::asio::ip::tcp::socket> socket,
 		const boost::asio::ip::tcp::endpoint& target, const std::string& host):
-		I2PTunnelConnection (owner, stream, socket, target), m_Host (host), m_HeaderSent (false), m_From (stream->GetRemoteIdentity ())
+		I2PTunnelConnection (owner, stream, socket, target), m_Host (host), m_State (eRequestHeader), m_Remaining (0)
 	{
+		auto from = stream->GetRemoteIdentity ();
+		if (from)
+		{
+			m_I2PHeaders.emplace_back (X_I2P_DEST_B32, context.GetAddressBook ().ToAddress (from->GetIdentHash ()));
+			m_I2PHeaders.emplace_back (X_I2P_DEST_HASH, from->GetIdentHash ().ToBase64 ());
+			m_I2PHeaders.emplace_back (X_I2P_DEST_B64, from->ToBase64 ());
+		}
 	}
 
 	void I2PServerTunnelConnectionHTTP::Write (const uint8_t * buf, size_t len)
 	{
-		if (m_HeaderSent)
-			I2PTunnelConnection::Write (buf, len);
-		else
+		// bodies are passed from buf as is, rewritten headers are inserted between them
+		m_OutHeaders.clear ();
+		m_Segments.clear ();
+		size_t offset = 0;
+		while (offset < len)
 		{
-			m_InHeader.clear ();
-			m_InHeader.write ((const char *)buf, len);
-			std::string line;
-			bool endOfHeader = false;
-			while (!endOfHeader)
+			switch (m_State)
 			{
-				std::getline(m_InHeader, line);
-				if (!m_InHeader.fail ())
+				case eRequestHeader:
 				{
-					if (line == "\r") endOfHeader = true;
-					else
+					const char * data = (const char *)buf + offset;
+					size_t size = len - offset, headerLen = 0;
+					if (m_InHeader.empty ())
 					{
-						if (m_Host.length () > 0 && line.find ("Host:") != std::string::npos)
-							m_OutHeader << "Host: " << m_Host << "\r\n"; // override host
+						auto eoh = i2p::http::find_eoh (data, size);
+						if (eoh != std::string::npos)
+						{
+							// whole header in buffer, parse in place
+							headerLen = eoh + 4;
+							if (!RewriteHeader (data, headerLen)) return;
+						}
+					}
+					if (!headerLen)
+					{
+						size_t prevLen = m_InHeader.length ();
+						m_InHeader.append (data, std::min (size, I2P_TUNNEL_HTTP_MAX_HEADER_SIZE + 4));
+						auto eoh = i2p::http::find_eoh (m_InHeader.c_str (), m_InHeader.length (), prevLen > 3 ? prevLen - 3 : 0);
+						if (eoh == std::string::npos)
+						{
+							if (m_InHeader.length () > I2P_TUNNEL_HTTP_MAX_HEADER_SIZE)
+							{
+								LogPrint (eLogError, "I2PTunnel: HTTP request header exceeds ", I2P_TUNNEL_HTTP_MAX_HEADER_SIZE, " bytes");
+								Terminate ();
+								return;
+							}
+							headerLen = size; // wait for the rest
+						}
 						else
-							m_OutHeader << line << "\n";
+						{
+							if (!RewriteHeader (m_InHeader.c_str (), eoh + 4)) return;
+							headerLen = eoh + 4 - prevLen;
+							m_InHeader.clear ();
+						}
 					}
+					offset += headerLen;
+					break;
 				}
-				else
+				case eRequestBody:
+				case eRequestChunkData:
+				{
+					size_t l = std::min ((uint64_t)(len - offset), m_Remaining);
+					AddSegment (false, offset, l);
+					offset += l;
+					m_Remaining -= l;
+					if (!m_Remaining)
+						m_State = (m_State == eRequestBody) ? eRequestHeader : eRequestChunkSize;
+					break;
+				}
+				case eRequestChunkSize:
+				case eRequestChunkTrailer:
+				{
+					// pass line as is, but collect it to find out what's next
+					const uint8_t * eol = (const uint8_t *)memchr (buf + offset, '\n', len - offset);
+					size_t l = eol ? eol + 1 - (buf + offset) : len - offset;
+					AddSegment (false, offset, l);
+					m_InHeader.append ((const char *)buf + offset, l);
+					offset += l;
+					if (!eol)
+					{
+						if (m_InHeader.length () > I2P_TUNNEL_HTTP_MAX_HEADER_SIZE)
+						{
+							LogPrint (eLogError, "I2PTunnel: HTTP chunk line exceeds ", I2P_TUNNEL_HTTP_MAX_HEADER_SIZE, " bytes");
+							Terminate ();
+							return;
+						}
+						break;
+					}
+					if (m_State == eRequestChunkSize)
+					{
+						char * end = nullptr;
+						m_Remaining = strtoull (m_InHeader.c_str (), &end, 16);
+						if (end == m_InHeader.c_str ())
+						{
+							LogPrint (eLogError, "I2PTunnel: invalid HTTP chunk size ", m_InHeader);
+							Terminate ();
+							return;
+						}
+						if (m_Remaining)
+						{
+							m_Remaining += 2; // CRLF after data
+							m_State = eRequestChunkData;
+						}
+						else
+							m_State = eRequestChunkTrailer;
+					}
+					else if (m_InHeader == "\r\n" || m_InHeader == "\n") // end of trailer
+						m_State = eRequestHeader;
+					m_InHeader.clear ();
 					break;
+				}
+				default: // eRequestRaw
+					AddSegment (false, offset, len - offset);
+					offset = len;
 			}
-			// add X-I2P fields
-			if (m_From)
+		}
+		if (m_Segments.empty ()) // incomplete header, read more
+		{
+			HandleWrite (boost::system::error_code ());
+			return;
+		}
+		std::vector<boost::asio::const_buffer> buffers;
+		buffers.reserve (m_Segments.size ());
+		for (const auto& it: m_Segments)
+			buffers.push_back (boost::asio::buffer ((std::get<0>(it) ? (const uint8_t *)m_OutHeaders.c_str () : buf) + std::get<1>(it), std::get<2>(it)));
+		WriteBuffers (buffers);
+	}
+
+	bool I2PServerTunnelConnectionHTTP::RewriteHeader (const char * header, size_t len)
+	{
+		i2p::http::HTTPReq req;
+		if (req.parse (header, len) <= 0)
+		{
+			LogPrint (eLogError, "I2PTunnel: malformed HTTP request");
+			Terminate ();
+			return false;
+		}
+		m_State = eRequestHeader; // no body
+		if (req.method == "CONNECT") m_State = eRequestRaw;
+		for (auto it = req.headers.begin (); it != req.headers.end ();)
+		{
+			if (boost::istarts_with (it->first, "X-I2P-")) // must come from us only
 			{
-				m_OutHeader << X_I2P_DEST_B32 << ": " << context.GetAddressBook ().ToAddress(m_From->GetIdentHash ()) << "\r\n";
-				m_OutHeader << X_I2P_DEST_HASH << ": " << m_From->GetIdentHash ().ToBase64 () << "\r\n";
-				m_OutHeader << X_I2P_DEST_B64 << ": " << m_From->ToBase64 () << "\r\n";
+				it = req.headers.erase (it);
+				continue;
 			}
+			if (boost::iequals (it->first, "Host"))
+			{
+				if (m_Host.length () > 0) it->second = m_Host; // override host
+			}
+			else if (boost::iequals (it->first, "Upgrade"))
+				m_State = eRequestRaw;
+			else if (boost::iequals (it->first, "Transfer-Encoding"))
+			{
+				if (m_State != eRequestRaw && boost::icontains (it->second, "chunked"))
+					m_State = eRequestChunkSize;
+			}
+			else if (boost::iequals (it->first, "Content-Length"))
+			{
+				if (m_State == eRequestHeader)
+				{
+					m_Remaining = strtoull (it->second.c_str (), nullptr, 10);
+					if (m_Remaining) m_State = eRequestBody;
+				}
+			}
+			it++;
+		}
+		for (const auto& it: m_I2PHeaders)
+			req.AddHeader (it.first, it.second);
+		size_t start = m_OutHeaders.length ();
+		req.write (m_OutHeaders);
+		AddSegment (true, start, m_OutHeaders.length () - start);
+		return true;
+	}
 
-			if (endOfHeader)
+	void I2PServerTunnelConnectionHTTP::AddSegment (bool isHeader, size_t offset, size_t len)
+	{
+		if (!len) return;
+		if (!m_Segments.empty ())
+		{
+			auto& last = m_Segments.back ();
+			if (std::get<0>(last) == isHeader && std::get<1>(last) + std::get<2>(last) == offset)
 			{
-				m_OutHeader << "\r\n"; // end of header
-				m_OutHeader << m_InHeader.str ().substr (m_InHeader.tellg ()); // data right after header
-				m_InHeader.str ("");
-				m_HeaderSent = true;
-				I2PTunnelConnection::Write ((uint8_t *)m_OutHeader.str ().c_str (), m_OutHeader.str ().length ());
+				std::get<2>(last) += len; // continuation
+				return;
 			}
 		}
+		m_Segments.emplace_back (isHeader, offset, len);
 	}
 
 	I2PTunnelConnectionIRC::I2PTunnelConnectionIRC (I2PService * owner, std::shared_ptr<i2p::stream::Stream> stream,
@@ -388,19 +676,65 @@ namespace client
 	{
 		public:
 			I2PClientTunnelHandler (I2PClientTunnel * parent, i2p::data::IdentHash destination,
-				int destinationPort, std::shared_ptr<boost::asio::ip::tcp::socket> socket):
+				int destinationPort, std::shared_ptr<boost::asio::ip::tcp::socket> socket, bool zeroRTT):
 				I2PServiceHandler(parent), m_DestinationIdentHash(destination),
-				m_DestinationPort (destinationPort), m_Socket(socket) {};
+				m_DestinationPort (destinationPort), m_Socket(socket), m_IsZeroRTT (zeroRTT),
+				m_IsRequestReceived (false), m_RequestLen (0), m_RequestTimer (parent->GetService ()) {};
 			void Handle();
 			void Terminate();
 		private:
+			void CreateStream ();
+			void HandleRequestReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void HandleRequestTimer (const boost::system::error_code& ecode);
 			void HandleStreamRequestComplete (std::shared_ptr<i2p::stream::Stream> stream);
 			i2p::data::IdentHash m_DestinationIdentHash;
 			int m_DestinationPort;
 			std::shared_ptr<boost::asio::ip::tcp::socket> m_Socket;
+			// 0-RTT
+			bool m_IsZeroRTT, m_IsRequestReceived;
+			uint8_t m_Request[I2P_TUNNEL_ZERO_RTT_MAX_REQUEST_SIZE];
+			size_t m_RequestLen;
+			boost::asio::deadline_timer m_RequestTimer;
 	};
 
 	void I2PClientTunnelHandler::Handle()
+	{
+		if (m_IsZeroRTT)
+		{
+			// read request first, for protocols where client speaks first
+			m_Socket->async_read_some (boost::asio::buffer (m_Request, I2P_TUNNEL_ZERO_RTT_MAX_REQUEST_SIZE),
+				std::bind (&I2PClientTunnelHandler::HandleRequestReceived, shared_from_this (),
+				std::placeholders::_1, std::placeholders::_2));
+			m_RequestTimer.expires_from_now (boost::posix_time::milliseconds (I2P_TUNNEL_ZERO_RTT_TIMEOUT));
+			m_RequestTimer.async_wait (std::bind (&I2PClientTunnelHandler::HandleRequestTimer,
+				shared_from_this (), std::placeholders::_1));
+		}
+		else
+			CreateStream ();
+	}
+
+	void I2PClientTunnelHandler::HandleRequestReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
+	{
+		m_IsRequestReceived = true;
+		m_RequestTimer.cancel ();
+		if (Dead ()) return; // terminated
+		if (ecode && ecode != boost::asio::error::operation_aborted)
+		{
+			LogPrint (eLogDebug, "I2PTunnel: Client closed before request: ", ecode.message ());
+			Terminate ();
+			return;
+		}
+		m_RequestLen = bytes_transferred; // 0 if timeout
+		CreateStream ();
+	}
+
+	void I2PClientTunnelHandler::HandleRequestTimer (const boost::system::error_code& ecode)
+	{
+		if (ecode != boost::asio::error::operation_aborted && !m_IsRequestReceived && m_Socket)
+			m_Socket->cancel (); // no request, connect without it
+	}
+
+	void I2PClientTunnelHandler::CreateStream ()
 	{
 		GetOwner()->CreateStream (
 			std::bind (&I2PClientTunnelHandler::HandleStreamRequestComplete, shared_from_this(), std::placeholders::_1),
@@ -415,7 +749,10 @@ namespace client
 			LogPrint (eLogDebug, "I2PTunnel: new connection");
 			auto connection = std::make_shared<I2PTunnelConnection>(GetOwner(), m_Socket, stream);
 			GetOwner()->AddHandler (connection);
-			connection->I2PConnect ();
+			if (m_RequestLen)
+				connection->I2PConnect (m_Request, m_RequestLen);
+			else
+				connection->I2PConnect ();
 			Done(shared_from_this());
 		}
 		else
@@ -439,7 +776,7 @@ namespace client
 	I2PClientTunnel::I2PClientTunnel (const std::string& name, const std::string& destination,
 		const std::string& address, int port, std::shared_ptr<ClientDestination> localDestination, int destinationPort):
 		TCPIPAcceptor (address, port, localDestination), m_Name (name), m_Destination (destination),
-		m_DestinationIdentHash (nullptr), m_DestinationPort (destinationPort)
+		m_DestinationIdentHash (nullptr), m_DestinationPort (destinationPort), m_IsZeroRTT (false)
 	{
 	}
 
@@ -475,7 +812,7 @@ namespace client
 	{
 		const i2p::data::IdentHash *identHash = GetIdentHash();
 		if (identHash)
-			return  std::make_shared<I2PClientTunnelHandler>(this, *identHash, m_DestinationPort, socket);
+			return  std::make_shared<I2PClientTunnelHandler>(this, *identHash, m_DestinationPort, socket, m_IsZeroRTT);
 		else
 			return nullptr;
 	}
@@ -561,11 +898,20 @@ namespace client
 			}
 			// new connection
 			auto conn = CreateI2PConnection (stream);
+			if (m_MemoryBudget) conn->SetMemoryBudget (m_MemoryBudget);
 			AddHandler (conn);
 			conn->Connect (m_IsUniqueLocal);
 		}
 	}
 
+	void I2PServerTunnel::SetMemoryLimit (size_t limit)
+	{
+		if (limit)
+			m_MemoryBudget = std::make_shared<I2PTunnelMemoryBudget> (limit);
+		else
+			m_MemoryBudget = nullptr;
+	}
+
 	std::shared_ptr<I2PTunnelConnection> I2PServerTunnel::CreateI2PConnection (std::shared_ptr<i2p::stream::Stream> stream)
 	{
 		return std::make_shared<I2PTunnelConnection> (this, stream, std::make_shared<boost::asio::ip::tcp::socket> (GetService ()), GetEndpoint ());
@@ -599,23 +945,89 @@ namespace client
 		return std::make_shared<I2PTunnelConnectionIRC> (this, stream, std::make_shared<boost::asio::ip::tcp::socket> (GetService ()), GetEndpoint (), this->m_WebircPass);
 	}
 
+	void UDPSendQueue::Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint & to)
+	{
+		std::lock_guard<std::mutex> lock(m_QueueMutex);
+		if (!m_IsSending)
+		{
+			boost::system::error_code ec;
+			m_Socket.send_to (boost::asio::buffer (buf, len), to, 0, ec);
+			if (ec != boost::asio::error::would_block)
+			{
+				if (ec) LogPrint (eLogWarning, "UDP: send to ", to, " error: ", ec.message ());
+				return;
+			}
+		}
+		if (m_Queue.size () >= I2P_UDP_SEND_QUEUE_MAX_SIZE)
+		{
+			LogPrint (eLogWarning, "UDP: send queue to ", to, " is full, datagram dropped");
+			return;
+		}
+		m_Queue.emplace_back (std::vector<uint8_t> (buf, buf + len), to);
+		if (!m_IsSending)
+		{
+			m_IsSending = true;
+			SendNext ();
+		}
+	}
+
+	void UDPSendQueue::SendNext ()
+	{
+		auto& front = m_Queue.front ();
+		m_Socket.async_send_to (boost::asio::buffer (front.first), front.second,
+			std::bind (&UDPSendQueue::HandleSent, this, std::placeholders::_1));
+	}
+
+	void UDPSendQueue::HandleSent (const boost::system::error_code & ecode)
+	{
+		if (ecode == boost::asio::error::operation_aborted) return; // socket is closed
+		if (ecode) LogPrint (eLogWarning, "UDP: send error: ", ecode.message ());
+		std::lock_guard<std::mutex> lock(m_QueueMutex);
+		m_Queue.pop_front ();
+		if (!m_Queue.empty ())
+			SendNext ();
+		else
+			m_IsSending = false;
+	}
+
+	void ReceiveUDPBatch (boost::asio::ip::udp::socket & socket, uint8_t * buf, size_t len,
+		std::vector<std::pair<const uint8_t *, size_t> > & payloads, std::vector<boost::asio::ip::udp::endpoint> & from)
+	{
+		// first datagram and its endpoint are already in payloads and from
+		size_t offset = len;
+		boost::system::error_code ec;
+		while (payloads.size () < I2P_UDP_MAX_BATCH_SIZE)
+		{
+			size_t available = socket.available (ec); // size of next datagram
+			if (ec || !available || offset + available > I2P_UDP_MAX_MTU) break;
+			boost::asio::ip::udp::endpoint ep;
+			size_t l = socket.receive_from (boost::asio::buffer (buf + offset, I2P_UDP_MAX_MTU - offset), ep, 0, ec);
+			if (ec) break;
+			payloads.push_back (std::make_pair (buf + offset, l));
+			from.push_back (ep);
+			offset += l;
+		}
+	}
+
 	void I2PUDPServerTunnel::HandleRecvFromI2P(const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
 	{
-		std::lock_guard<std::mutex> lock(m_SessionsMutex);
 		auto session = ObtainUDPSession(from, toPort, fromPort);
-		session->IPSocket.send_to(boost::asio::buffer(buf, len), m_RemoteEndpoint);
+		session->SendQueue.Send(buf, len, m_RemoteEndpoint);
 		session->LastActivity = i2p::util::GetMillisecondsSinceEpoch();
 	}
 
 	void I2PUDPServerTunnel::ExpireStale(const uint64_t delta) {
-		std::lock_guard<std::mutex> lock(m_SessionsMutex);
 		uint64_t now = i2p::util::GetMillisecondsSinceEpoch();
-		auto itr = m_Sessions.begin();
-		while(itr != m_Sessions.end()) {
-			if(now - (*itr)->LastActivity >= delta )
-				itr = m_Sessions.erase(itr);
-			else
-				++itr;
+		for (auto& shard: m_Shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.m_SessionsMutex);
+			auto itr = shard.m_Sessions.begin();
+			while(itr != shard.m_Sessions.end()) {
+				if(now - itr->second->LastActivity >= delta )
+					itr = shard.m_Sessions.erase(itr);
+				else
+					++itr;
+			}
 		}
 	}
 
@@ -635,15 +1047,12 @@ namespace client
 	UDPSessionPtr I2PUDPServerTunnel::ObtainUDPSession(const i2p::data::IdentityEx& from, uint16_t localPort, uint16_t remotePort)
 	{
 		auto ih = from.GetIdentHash();
-		for (auto & s : m_Sessions )
-		{
-			if ( s->Identity == ih)
-			{
-				/** found existing session */
-				LogPrint(eLogDebug, "UDPServer: found session ", s->IPSocket.local_endpoint(), " ", ih.ToBase32());
-				return s;
-			}
-		}
+		UDPSessionKey key(ih, remotePort);
+		auto& shard = m_Shards[UDPSessionKeyHash()(key) % I2P_UDP_SESSIONS_NUM_SHARDS];
+		std::lock_guard<std::mutex> lock(shard.m_SessionsMutex);
+		auto it = shard.m_Sessions.find(key);
+		if (it != shard.m_Sessions.end())
+			return it->second; // found existing session
 		boost::asio::ip::address addr;
 		/** create new udp session */
 		if(m_IsUniqueLocal && m_LocalAddress.is_loopback())
@@ -654,9 +1063,10 @@ namespace client
 		else
 			addr = m_LocalAddress;
 		boost::asio::ip::udp::endpoint ep(addr, 0);
-		m_Sessions.push_back(std::make_shared<UDPSession>(ep, m_LocalDest, m_RemoteEndpoint, &ih, localPort, remotePort));
-		auto & back = m_Sessions.back();
-		return back;
+		auto session = std::make_shared<UDPSession>(ep, m_LocalDest, m_RemoteEndpoint, &ih, localPort, remotePort);
+		shard.m_Sessions.emplace(key, session);
+		LogPrint(eLogDebug, "UDPServer: new session ", session->IPSocket.local_endpoint(), " ", ih.ToBase32(), ":", remotePort);
+		return session;
 	}
 
 	UDPSession::UDPSession(boost::asio::ip::udp::endpoint localEndpoint,
@@ -668,9 +1078,11 @@ namespace client
 		SendEndpoint(endpoint),
 		LastActivity(i2p::util::GetMillisecondsSinceEpoch()),
 		LocalPort(ourPort),
-		RemotePort(theirPort)
+		RemotePort(theirPort),
+		SendQueue(IPSocket)
 	{
 		memcpy(Identity, to->data(), 32);
+		IPSocket.non_blocking(true); // send queue takes datagrams if local socket would block
 		Receive();
 	}
 
@@ -686,7 +1098,12 @@ namespace client
 		{
 			LogPrint(eLogDebug, "UDPSession: forward ", len, "B from ", FromEndpoint);
 			LastActivity = i2p::util::GetMillisecondsSinceEpoch();
-			m_Destination->SendDatagramTo(m_Buffer, len, Identity, LocalPort, RemotePort);
+			std::vector<std::pair<const uint8_t *, size_t> > payloads;
+			std::vector<boost::asio::ip::udp::endpoint> from;
+			payloads.push_back(std::make_pair(m_Buffer, len));
+			from.push_back(FromEndpoint);
+			ReceiveUDPBatch(IPSocket, m_Buffer, len, payloads, from);
+			m_Destination->SendDatagramsTo(payloads, Identity, LocalPort, RemotePort);
 			Receive();
 		} else {
 			LogPrint(eLogError, "UDPSession: ", ecode.message());
@@ -721,21 +1138,25 @@ namespace client
 	std::vector<std::shared_ptr<DatagramSessionInfo> > I2PUDPServerTunnel::GetSessions()
 	{
 		std::vector<std::shared_ptr<DatagramSessionInfo> > sessions;
-		std::lock_guard<std::mutex> lock(m_SessionsMutex);
 
-		for ( UDPSessionPtr s : m_Sessions )
+		for (auto& shard: m_Shards)
 		{
-			if (!s->m_Destination) continue;
-			auto info = s->m_Destination->GetInfoForRemote(s->Identity);
-			if(!info) continue;
-
-			auto sinfo = std::make_shared<DatagramSessionInfo>();
-			sinfo->Name = m_Name;
-			sinfo->LocalIdent = std::make_shared<i2p::data::IdentHash>(m_LocalDest->GetIdentHash().data());
-			sinfo->RemoteIdent = std::make_shared<i2p::data::IdentHash>(s->Identity.data());
-			sinfo->CurrentIBGW = info->IBGW;
-			sinfo->CurrentOBEP = info->OBEP;
-			sessions.push_back(sinfo);
+			std::lock_guard<std::mutex> lock(shard.m_SessionsMutex);
+			for (const auto& it: shard.m_Sessions)
+			{
+				auto s = it.second;
+				if (!s->m_Destination) continue;
+				auto info = s->m_Destination->GetInfoForRemote(s->Identity);
+				if(!info) continue;
+
+				auto sinfo = std::make_shared<DatagramSessionInfo>();
+				sinfo->Name = m_Name;
+				sinfo->LocalIdent = std::make_shared<i2p::data::IdentHash>(m_LocalDest->GetIdentHash().data());
+				sinfo->RemoteIdent = std::make_shared<i2p::data::IdentHash>(s->Identity.data());
+				sinfo->CurrentIBGW = info->IBGW;
+				sinfo->CurrentOBEP = info->OBEP;
+				sessions.push_back(sinfo);
+			}
 		}
 		return sessions;
 	}
@@ -751,9 +1172,11 @@ namespace client
 		m_RemoteIdent(nullptr),
 		m_ResolveThread(nullptr),
 		m_LocalSocket(localDestination->GetService(), localEndpoint),
+		m_LocalSendQueue(m_LocalSocket),
 		RemotePort(remotePort),
 		m_cancel_resolve(false)
 	{
+		m_LocalSocket.non_blocking(true);
 		auto dgram = m_LocalDest->CreateDatagramDestination();
 		dgram->SetReceiver(std::bind(&I2PUDPClientTunnel::HandleRecvFromI2P, this,
 			std::placeholders::_1, std::placeholders::_2,
@@ -785,20 +1208,40 @@ namespace client
 			RecvFromLocal();
 			return; // drop, remote not resolved
 		}
-		auto remotePort = m_RecvEndpoint.port();
-		auto itr = m_Sessions.find(remotePort);
-		if (itr == m_Sessions.end()) {
-			// track new udp convo
-			m_Sessions[remotePort] = {boost::asio::ip::udp::endpoint(m_RecvEndpoint), 0};
-		}
-		// send off to remote i2p destination
-		LogPrint(eLogDebug, "UDP Client: send ", transferred, " to ", m_RemoteIdent->ToBase32(), ":", RemotePort);
-		m_LocalDest->GetDatagramDestination()->SendDatagramTo(m_RecvBuff, transferred, *m_RemoteIdent, remotePort, RemotePort);
-		// mark convo as active
-		m_Sessions[remotePort].second = i2p::util::GetMillisecondsSinceEpoch();
+		std::vector<std::pair<const uint8_t *, size_t> > payloads;
+		std::vector<boost::asio::ip::udp::endpoint> from;
+		payloads.push_back(std::make_pair(m_RecvBuff, transferred));
+		from.push_back(m_RecvEndpoint);
+		ReceiveUDPBatch(m_LocalSocket, m_RecvBuff, transferred, payloads, from);
+		auto ts = i2p::util::GetMillisecondsSinceEpoch();
+		{
+			std::lock_guard<std::mutex> lock(m_SessionsMutex);
+			for (const auto& ep: from)
+			{
+				// track new udp convo and mark it as active
+				auto& convo = m_Sessions[ep.port()];
+				convo.first = ep;
+				convo.second = ts;
+			}
+		}
+		// send off to remote i2p destination, consecutive datagrams from the same local port together
+		size_t first = 0;
+		for (size_t i = 1; i <= payloads.size(); i++)
+			if (i == payloads.size() || from[i].port() != from[first].port())
+			{
+				std::vector<std::pair<const uint8_t *, size_t> > batch(payloads.begin() + first, payloads.begin() + i);
+				SendToI2P(from[first].port(), batch);
+				first = i;
+			}
 		RecvFromLocal();
 	}
 
+	void I2PUDPClientTunnel::SendToI2P(uint16_t localPort, const std::vector<std::pair<const uint8_t *, size_t> > & payloads)
+	{
+		LogPrint(eLogDebug, "UDP Client: send ", payloads.size(), " datagrams to ", m_RemoteIdent->ToBase32(), ":", RemotePort);
+		m_LocalDest->GetDatagramDestination()->SendDatagramsTo(payloads, *m_RemoteIdent, localPort, RemotePort);
+	}
+
 	std::vector<std::shared_ptr<DatagramSessionInfo> > I2PUDPClientTunnel::GetSessions()
 	{
 		// TODO: implement
@@ -828,16 +1271,22 @@ namespace client
 	{
 		if(m_RemoteIdent && from.GetIdentHash() == *m_RemoteIdent)
 		{
-			auto itr = m_Sessions.find(toPort);
-			// found convo ?
-			if(itr != m_Sessions.end())
+			boost::asio::ip::udp::endpoint to;
+			{
+				std::lock_guard<std::mutex> lock(m_SessionsMutex);
+				auto itr = m_Sessions.find(toPort);
+				if(itr != m_Sessions.end())
+				{
+					// found convo, mark it as active
+					to = itr->second.first;
+					itr->second.second = i2p::util::GetMillisecondsSinceEpoch();
+				}
+			}
+			if(to.port())
 			{
-				// found convo
 				if (len > 0) {
 					LogPrint(eLogDebug, "UDP Client: got ", len, "B from ", from.GetIdentHash().ToBase32());
-					m_LocalSocket.send_to(boost::asio::buffer(buf, len), itr->second.first);
-					// mark convo as active
-					itr->second.second = i2p::util::GetMillisecondsSinceEpoch();
+					m_LocalSendQueue.Send(buf, len, to);
 				}
 			}
 			else
@@ -5,7 +5,12 @@
 #include <string>
 #include <set>
 #include <tuple>
+#include <vector>
+#include <deque>
+#include <unordered_map>
 #include <memory>
+#include <atomic>
+#include <mutex>
 #include <sstream>
 #include <boost/asio.hpp>
 #include "Identity.h"
@@ -19,13 +24,48 @@ namespace i2p
 namespace client
 {
 	const size_t I2P_TUNNEL_CONNECTION_BUFFER_SIZE = 65536;
+	const size_t I2P_TUNNEL_LOW_MEMORY_BUFFER_SIZE = 16384;
 	const int I2P_TUNNEL_CONNECTION_MAX_IDLE = 3600; // in seconds
 	const int I2P_TUNNEL_DESTINATION_REQUEST_TIMEOUT = 10; // in seconds
+	const size_t I2P_TUNNEL_BUFFER_POOL_MAX_FREE = 64; // buffers kept for reuse, rest are freed
+	const size_t I2P_TUNNEL_LOW_MEMORY_BUFFER_POOL_MAX_FREE = 8;
+	const size_t I2P_TUNNEL_HTTP_MAX_HEADER_SIZE = 65536; // request header, chunk size and trailer lines
+	const int I2P_TUNNEL_ZERO_RTT_TIMEOUT = 50; // in milliseconds, how long client tunnel waits for request to send with SYN
+	const size_t I2P_TUNNEL_ZERO_RTT_MAX_REQUEST_SIZE = 1024; // fits SYN packet with identity and signature
 	// for HTTP tunnels
 	const char X_I2P_DEST_HASH[] = "X-I2P-DestHash"; // hash  in base64
 	const char X_I2P_DEST_B64[] = "X-I2P-DestB64"; // full address in base64
 	const char X_I2P_DEST_B32[] = "X-I2P-DestB32"; // .b32.i2p address
 
+	// memory shared by all connections of a tunnel, streams' receive queues and buffers in flight
+	typedef i2p::stream::MemoryBudget I2PTunnelMemoryBudget;
+
+	// relay buffers of GetBufferSize () shared by all connections,
+	// taken when socket has data and returned once it's passed to stream
+	class I2PTunnelBufferPool
+	{
+		public:
+
+			I2PTunnelBufferPool (): m_BufferSize (I2P_TUNNEL_CONNECTION_BUFFER_SIZE),
+				m_MaxNumFree (I2P_TUNNEL_BUFFER_POOL_MAX_FREE), m_NumInUse (0) {};
+			~I2PTunnelBufferPool ();
+
+			void SetLowMemory (bool lowMemory); // before any buffer is acquired
+			uint8_t * Acquire ();
+			void Release (uint8_t * buf);
+			size_t GetBufferSize () const { return m_BufferSize; };
+			size_t GetNumInUse () const { return m_NumInUse; };
+			size_t GetNumFree () const;
+
+		private:
+
+			size_t m_BufferSize, m_MaxNumFree;
+			mutable std::mutex m_Mutex;
+			std::vector<uint8_t *> m_Free;
+			std::atomic<size_t> m_NumInUse;
+	};
+	I2PTunnelBufferPool& GetTunnelBufferPool ();
+
 	class I2PTunnelConnection: public I2PServiceHandler, public std::enable_shared_from_this<I2PTunnelConnection>
 	{
 		public:
@@ -38,23 +78,33 @@ namespace client
 			~I2PTunnelConnection ();
 			void I2PConnect (const uint8_t * msg = nullptr, size_t len = 0);
 			void Connect (bool isUniqueLocal = true);
+			void SetMemoryBudget (std::shared_ptr<I2PTunnelMemoryBudget> budget);
 
 		protected:
 			void Terminate ();
 
 			void Receive ();
+			void HandleReadable (const boost::system::error_code& ecode);
 			void HandleReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			virtual void Write (const uint8_t * buf, size_t len); // can be overloaded
+			void WriteBuffers (const std::vector<boost::asio::const_buffer>& buffers); // must stay valid until HandleWrite
+			virtual bool IsZeroCopy () const { return true; }; // false if Write is overloaded
 			void HandleWrite (const boost::system::error_code& ecode);
 
 			void StreamReceive ();
 			void HandleStreamReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void WriteReceived (); // stream's packets to socket, directly if zero copy
 			void HandleConnect (const boost::system::error_code& ecode);
 
 			std::shared_ptr<const boost::asio::ip::tcp::socket> GetSocket () const { return m_Socket; };
 
 		private:
-			uint8_t m_Buffer[I2P_TUNNEL_CONNECTION_BUFFER_SIZE], m_StreamBuffer[I2P_TUNNEL_CONNECTION_BUFFER_SIZE];
+			uint8_t * GetStreamBuffer ();
+			void AcquireBuffer (uint8_t *& buffer);
+			void ReleaseBuffer (uint8_t *& buffer);
+
+			uint8_t * m_Buffer, * m_StreamBuffer; // from pool, only while data is in flight
+			std::shared_ptr<I2PTunnelMemoryBudget> m_MemoryBudget;
 			std::shared_ptr<boost::asio::ip::tcp::socket> m_Socket;
 			std::shared_ptr<i2p::stream::Stream> m_Stream;
 			boost::asio::ip::tcp::endpoint m_RemoteEndpoint;
@@ -71,6 +121,7 @@ namespace client
 
 		protected:
 			void Write (const uint8_t * buf, size_t len);
+			bool IsZeroCopy () const { return false; };
 
 		private:
 			std::stringstream m_InHeader, m_OutHeader;
@@ -86,12 +137,31 @@ namespace client
 
 		protected:
 			void Write (const uint8_t * buf, size_t len);
+			bool IsZeroCopy () const { return false; };
+
+		private:
+
+			enum RequestState // of the current request in keep-alive pipeline
+			{
+				eRequestHeader = 0,
+				eRequestBody, // Content-Length
+				eRequestChunkSize,
+				eRequestChunkData,
+				eRequestChunkTrailer,
+				eRequestRaw // upgraded or CONNECT, pass everything as is
+			};
+
+			bool RewriteHeader (const char * header, size_t len); // appends to m_OutHeaders, sets state for body
+			void AddSegment (bool isHeader, size_t offset, size_t len);
 
 		private:
 			std::string m_Host;
-			std::stringstream m_InHeader, m_OutHeader;
-			bool m_HeaderSent;
-			std::shared_ptr<const i2p::data::IdentityEx> m_From;
+			std::vector<std::pair<std::string, std::string> > m_I2PHeaders; // X-I2P fields for every request
+			RequestState m_State;
+			uint64_t m_Remaining; // of body or chunk
+			std::string m_InHeader; // incomplete header or chunk line from previous buffers
+			std::string m_OutHeaders; // rewritten headers of current buffer
+			std::vector<std::tuple<bool, size_t, size_t> > m_Segments; // header or buffer, offset, length
 	};
 
 	class I2PTunnelConnectionIRC: public I2PTunnelConnection
@@ -103,6 +173,7 @@ namespace client
 
 		protected:
 			void Write (const uint8_t * buf, size_t len);
+			bool IsZeroCopy () const { return false; };
 
 		private:
 			std::shared_ptr<const i2p::data::IdentityEx> m_From;
@@ -127,6 +198,7 @@ namespace client
 			void Stop ();
 
 			const char* GetName() { return m_Name.c_str (); }
+			void SetZeroRTT (bool zeroRTT) { m_IsZeroRTT = zeroRTT; };
 
 		private:
 			const i2p::data::IdentHash * GetIdentHash ();
@@ -135,6 +207,7 @@ namespace client
 			std::string m_Name, m_Destination;
 			const i2p::data::IdentHash * m_DestinationIdentHash;
 			int m_DestinationPort;
+			bool m_IsZeroRTT; // wait for client's request and send it with SYN
 	};
 
 
@@ -143,6 +216,34 @@ namespace client
 
 	/** max size for i2p udp */
 	const size_t I2P_UDP_MAX_MTU = i2p::datagram::MAX_DATAGRAM_SIZE;
+	/** max datagrams read from local socket at once and sent to i2p together */
+	const size_t I2P_UDP_MAX_BATCH_SIZE = 16;
+	/** max datagrams waiting for local socket, new ones are dropped */
+	const size_t I2P_UDP_SEND_QUEUE_MAX_SIZE = 256;
+	/** shards of server tunnel's sessions table, each with own mutex */
+	const size_t I2P_UDP_SESSIONS_NUM_SHARDS = 16;
+
+	/** sends to local udp socket, datagrams are queued while socket would block */
+	class UDPSendQueue
+	{
+		public:
+			UDPSendQueue (boost::asio::ip::udp::socket & socket): m_Socket (socket), m_IsSending (false) {};
+			void Send (const uint8_t * buf, size_t len, const boost::asio::ip::udp::endpoint & to);
+
+		private:
+			void SendNext ();
+			void HandleSent (const boost::system::error_code & ecode);
+
+		private:
+			boost::asio::ip::udp::socket & m_Socket;
+			std::mutex m_QueueMutex;
+			std::deque<std::pair<std::vector<uint8_t>, boost::asio::ip::udp::endpoint> > m_Queue;
+			bool m_IsSending;
+	};
+
+	/** reads up to I2P_UDP_MAX_BATCH_SIZE datagrams already received by socket, first one is in buf */
+	void ReceiveUDPBatch (boost::asio::ip::udp::socket & socket, uint8_t * buf, size_t len,
+		std::vector<std::pair<const uint8_t *, size_t> > & payloads, std::vector<boost::asio::ip::udp::endpoint> & from);
 
 	struct UDPSession
 	{
@@ -157,6 +258,7 @@ namespace client
 		uint16_t RemotePort;
 
 		uint8_t m_Buffer[I2P_UDP_MAX_MTU];
+		UDPSendQueue SendQueue;
 
 		UDPSession(boost::asio::ip::udp::endpoint localEndpoint,
 							 const std::shared_ptr<i2p::client::ClientDestination> & localDestination,
@@ -189,6 +291,12 @@ namespace client
 	};
 
 	typedef std::shared_ptr<UDPSession> UDPSessionPtr;
+	/** remote ident and its port */
+	typedef std::pair<i2p::data::IdentHash, uint16_t> UDPSessionKey;
+	struct UDPSessionKeyHash
+	{
+		size_t operator() (const UDPSessionKey & key) const { return key.first.GetLL ()[0] ^ key.second; }
+	};
 
 	/** server side udp tunnel, many i2p inbound to 1 ip outbound */
 	class I2PUDPServerTunnel
@@ -213,12 +321,17 @@ namespace client
 			UDPSessionPtr ObtainUDPSession(const i2p::data::IdentityEx& from, uint16_t localPort, uint16_t remotePort);
 
 		private:
+			struct SessionsShard
+			{
+				std::mutex m_SessionsMutex;
+				std::unordered_map<UDPSessionKey, UDPSessionPtr, UDPSessionKeyHash> m_Sessions;
+			};
+
 			bool m_IsUniqueLocal;
 			const std::string m_Name;
 			boost::asio::ip::address m_LocalAddress;
 			boost::asio::ip::udp::endpoint m_RemoteEndpoint;
-			std::mutex m_SessionsMutex;
-			std::vector<UDPSessionPtr> m_Sessions;
+			SessionsShard m_Shards[I2P_UDP_SESSIONS_NUM_SHARDS];
 			std::shared_ptr<i2p::client::ClientDestination> m_LocalDest;
 	};
 
@@ -242,11 +355,12 @@ namespace client
 			typedef std::pair<boost::asio::ip::udp::endpoint, uint64_t> UDPConvo;
 			void RecvFromLocal();
 			void HandleRecvFromLocal(const boost::system::error_code & e, std::size_t transferred);
+			void SendToI2P(uint16_t localPort, const std::vector<std::pair<const uint8_t *, size_t> > & payloads);
 			void HandleRecvFromI2P(const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 			void TryResolving();
 			const std::string m_Name;
 			std::mutex m_SessionsMutex;
-			std::map<uint16_t, UDPConvo > m_Sessions; // maps i2p port -> local udp convo
+			std::unordered_map<uint16_t, UDPConvo > m_Sessions; // maps i2p port -> local udp convo
 			const std::string m_RemoteDest;
 			std::shared_ptr<i2p::client::ClientDestination> m_LocalDest;
 			const boost::asio::ip::udp::endpoint m_LocalEndpoint;
@@ -255,6 +369,7 @@ namespace client
 			boost::asio::ip::udp::socket m_LocalSocket;
 			boost::asio::ip::udp::endpoint m_RecvEndpoint;
 			uint8_t m_RecvBuff[I2P_UDP_MAX_MTU];
+			UDPSendQueue m_LocalSendQueue;
 			uint16_t RemotePort;
 			bool m_cancel_resolve;
 	};
@@ -269,6 +384,8 @@ namespace client
 			void Stop ();
 
 			void SetAccessList (const std::set<i2p::data::IdentHash>& accessList);
+			void SetMemoryLimit (size_t limit); // in bytes, 0 means unlimited
+			std::shared_ptr<const I2PTunnelMemoryBudget> GetMemoryBudget () const { return m_MemoryBudget; };
 
 			void SetUniqueLocal (bool isUniqueLocal) { m_IsUniqueLocal = isUniqueLocal; }
 			bool IsUniqueLocal () const { return m_IsUniqueLocal; }
@@ -296,6 +413,7 @@ namespace client
 			std::shared_ptr<i2p::stream::StreamingDestination> m_PortDestination;
 			std::set<i2p::data::IdentHash> m_AccessList;
 			bool m_IsAccessList;
+			std::shared_ptr<I2PTunnelMemoryBudget> m_MemoryBudget;
 	};
 
 	class I2PServerTunnelHTTP: public I2PServerTunnel
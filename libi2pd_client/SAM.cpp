@@ -1,5 +1,9 @@
 #include <string.h>
 #include <stdio.h>
+#ifdef __linux__
+#include <errno.h>
+#include <sys/socket.h>
+#endif
 #ifdef _MSC_VER
 #include <stdlib.h>
 #endif
@@ -17,7 +21,7 @@ namespace client
 {
 	SAMSocket::SAMSocket (SAMBridge& owner):
 		m_Owner (owner), m_Socket(owner.GetService()), m_Timer (m_Owner.GetService ()),
-		m_BufferOffset (0), 
+		m_BufferOffset (0), m_StreamBuffer (SAM_SOCKET_BUFFER_SIZE),
 		m_SocketType (eSAMSocketTypeUnknown), m_IsSilent (false),
 		m_IsAccepting (false), m_Stream (nullptr)
 	{
@@ -50,7 +54,7 @@ namespace client
 				if (Session)
 				{
 					if (m_IsAccepting && Session->localDestination)
-						Session->localDestination->StopAcceptingStreams ();
+						Session->GetStreamingDestination ()->ResetAcceptor ();
 				}
 				break;
 			}
@@ -67,6 +71,21 @@ namespace client
 		m_Owner.RemoveSocket(shared_from_this());
 	}
 
+	static void AdaptBufferSize (std::vector<uint8_t>& buffer, size_t received)
+	{
+		if (received >= buffer.size ())
+		{
+			// buffer filled up, bulk transfer
+			if (buffer.size () < SAM_SOCKET_MAX_BUFFER_SIZE)
+				buffer.resize (buffer.size () << 1);
+		}
+		else if (received < (buffer.size () >> 2) && buffer.size () > SAM_SOCKET_BUFFER_SIZE)
+		{
+			buffer.resize (buffer.size () >> 1);
+			buffer.shrink_to_fit ();
+		}
+	}
+
 	void SAMSocket::ReceiveHandshake ()
 	{		
 		m_Socket.async_read_some (boost::asio::buffer(m_Buffer, SAM_SOCKET_BUFFER_SIZE),
@@ -76,7 +95,7 @@ namespace client
 
 	static bool SAMVersionAcceptable(const std::string & ver)
 	{
-		return ver == "3.0" || ver == "3.1";
+		return ver == "3.0" || ver == "3.1" || ver == "3.2" || ver == "3.3";
 	}
 
 	static bool SAMVersionTooLow(const std::string & ver)
@@ -86,7 +105,7 @@ namespace client
 
 	static bool SAMVersionTooHigh(const std::string & ver)
 	{
-		return ver.size() && ver > "3.1";
+		return ver.size() && ver > "3.3";
 	}
 
 	void SAMSocket::HandleHandshakeReceived (const boost::system::error_code& ecode, std::size_t bytes_transferred)
@@ -251,6 +270,10 @@ namespace client
 
 					if (!strcmp (m_Buffer, SAM_SESSION_CREATE))
 						ProcessSessionCreate (separator + 1, bytes_transferred - (separator - m_Buffer) - 1);
+					else if (!strcmp (m_Buffer, SAM_SESSION_ADD))
+						ProcessSessionAdd (separator + 1, bytes_transferred - (separator - m_Buffer) - 1);
+					else if (!strcmp (m_Buffer, SAM_SESSION_REMOVE))
+						ProcessSessionRemove (separator + 1, bytes_transferred - (separator - m_Buffer) - 1);
 					else if (!strcmp (m_Buffer, SAM_STREAM_CONNECT))
 						ProcessStreamConnect (separator + 1, bytes_transferred - (separator - m_Buffer) - 1, bytes_transferred - (eol - m_Buffer) - 1);
 					else if (!strcmp (m_Buffer, SAM_STREAM_ACCEPT))
@@ -314,6 +337,70 @@ namespace client
 		return true;
 	}
 
+	static bool ExtractPortParam (const std::map<std::string, std::string>& params, const char * name, uint16_t& port)
+	{
+		auto it = params.find (name);
+		if (it == params.end ()) return true; // default
+		try
+		{
+			int p = std::stoi (it->second);
+			if (p < 0 || p > 65535) return false;
+			port = p;
+		}
+		catch (std::exception&)
+		{
+			return false;
+		}
+		return true;
+	}
+
+	bool SAMSocket::ExtractUDPForward (std::map<std::string, std::string>& params, std::shared_ptr<boost::asio::ip::udp::endpoint>& forward)
+	{
+		if (params.find(SAM_VALUE_HOST) == params.end() || params.find(SAM_VALUE_PORT) == params.end())
+			return true; // no udp forward
+		boost::system::error_code e;
+		// TODO: support hostnames in udp forward
+		auto addr = boost::asio::ip::address::from_string(params[SAM_VALUE_HOST], e);
+		if (e)
+		{
+			// not an ip address
+			LogPrint (eLogError, "SAM: Invalid IP Address in HOST ", params[SAM_VALUE_HOST]);
+			return false;
+		}
+		uint16_t port = 0;
+		if (!ExtractPortParam (params, SAM_VALUE_PORT, port) || !port)
+		{
+			LogPrint (eLogError, "SAM: Invalid PORT ", params[SAM_VALUE_PORT]);
+			return false;
+		}
+		forward = std::make_shared<boost::asio::ip::udp::endpoint>(addr, port);
+		return true;
+	}
+
+	void SAMSocket::SetDatagramReceiver (std::shared_ptr<SAMSession> session)
+	{
+		// subsession receives on its listen port, other sessions on all ports
+		auto dest = session->localDestination->CreateDatagramDestination ();
+		if (session->Type == eSAMSessionTypeRaw)
+		{
+			auto receiver = std::bind (&SAMSocket::HandleI2PRawDatagramReceive, shared_from_this (), session->Name,
+				std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4);
+			if (session->ListenPort)
+				dest->SetRawReceiver (receiver, session->ListenPort);
+			else
+				dest->SetRawReceiver (receiver);
+		}
+		else
+		{
+			auto receiver = std::bind (&SAMSocket::HandleI2PDatagramReceive, shared_from_this (), session->Name,
+				std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5);
+			if (session->ListenPort)
+				dest->SetReceiver (receiver, session->ListenPort);
+			else
+				dest->SetReceiver (receiver);
+		}
+	}
+
 	void SAMSocket::ProcessSessionCreate (char * buf, size_t len)
 	{
 		LogPrint (eLogDebug, "SAM: session create: ", buf);
@@ -337,27 +424,19 @@ namespace client
 			return;
 		}
 
+		SAMSessionType type = eSAMSessionTypeStream;
+		if (style == SAM_VALUE_DATAGRAM)
+			type = eSAMSessionTypeDatagram;
+		else if (style == SAM_VALUE_RAW)
+			type = eSAMSessionTypeRaw;
+		else if (style == SAM_VALUE_PRIMARY || style == SAM_VALUE_MASTER)
+			type = eSAMSessionTypePrimary;
+
 		std::shared_ptr<boost::asio::ip::udp::endpoint> forward = nullptr;
-		if (style == SAM_VALUE_DATAGRAM && params.find(SAM_VALUE_HOST) != params.end() && params.find(SAM_VALUE_PORT) != params.end())
+		if ((type == eSAMSessionTypeDatagram || type == eSAMSessionTypeRaw) && !ExtractUDPForward (params, forward))
 		{
-			// udp forward selected
-			boost::system::error_code e;
-			// TODO: support hostnames in udp forward
-			auto addr = boost::asio::ip::address::from_string(params[SAM_VALUE_HOST], e);
-			if (e)
-			{
-				// not an ip address
-				SendI2PError("Invalid IP Address in HOST");
-				return;
-			}
-
-			auto port = std::stoi(params[SAM_VALUE_PORT]);
-			if (port == -1)
-			{
-				SendI2PError("Invalid port");
-				return;
-			}
-			forward = std::make_shared<boost::asio::ip::udp::endpoint>(addr, port);
+			SendI2PError("Invalid HOST or PORT");
+			return;
 		}
 
 		// create destination
@@ -365,12 +444,11 @@ namespace client
 		if (session)
 		{
 			m_SocketType = eSAMSocketTypeSession;
-			if (style == SAM_VALUE_DATAGRAM)
+			session->Type = type;
+			if (type == eSAMSessionTypeDatagram || type == eSAMSessionTypeRaw)
 			{
 				session->UDPEndpoint = forward;
-				auto dest = session->localDestination->CreateDatagramDestination ();
-				dest->SetReceiver (std::bind (&SAMSocket::HandleI2PDatagramReceive, shared_from_this (),
-					std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4, std::placeholders::_5));
+				SetDatagramReceiver (session);
 			}
 
 			if (session->localDestination->IsReady ())
@@ -386,6 +464,102 @@ namespace client
 			SendMessageReply (SAM_SESSION_CREATE_DUPLICATED_DEST, strlen(SAM_SESSION_CREATE_DUPLICATED_DEST), true);
 	}
 
+	void SAMSocket::ProcessSessionAdd (char * buf, size_t len)
+	{
+		LogPrint (eLogDebug, "SAM: session add: ", buf);
+		// errors don't close PRIMARY session
+		auto primary = m_Owner.FindSession (m_ID);
+		if (m_SocketType != eSAMSocketTypeSession || !primary || primary->Type != eSAMSessionTypePrimary)
+		{
+			SendI2PError ("Not a PRIMARY session", false);
+			return;
+		}
+		std::map<std::string, std::string> params;
+		ExtractParams (buf, params);
+		std::string& style = params[SAM_PARAM_STYLE];
+		std::string& id = params[SAM_PARAM_ID];
+		SAMSessionType type;
+		if (style == SAM_VALUE_STREAM)
+			type = eSAMSessionTypeStream;
+		else if (style == SAM_VALUE_DATAGRAM)
+			type = eSAMSessionTypeDatagram;
+		else if (style == SAM_VALUE_RAW)
+			type = eSAMSessionTypeRaw;
+		else
+		{
+			SendI2PError ("Unsupported STYLE", false);
+			return;
+		}
+		if (id.empty () || !IsAcceptableSessionName (id))
+		{
+			SendMessageReply (SAM_SESSION_CREATE_INVALID_ID, strlen(SAM_SESSION_CREATE_INVALID_ID), false);
+			return;
+		}
+		if (m_Owner.FindSession (id))
+		{
+			SendMessageReply (SAM_SESSION_CREATE_DUPLICATED_ID, strlen(SAM_SESSION_CREATE_DUPLICATED_ID), false);
+			return;
+		}
+		uint16_t fromPort = 0, toPort = 0;
+		if (!ExtractPortParam (params, SAM_PARAM_FROM_PORT, fromPort) || !ExtractPortParam (params, SAM_PARAM_TO_PORT, toPort))
+		{
+			SendI2PError ("Invalid FROM_PORT or TO_PORT", false);
+			return;
+		}
+		uint16_t listenPort = fromPort;
+		if (!ExtractPortParam (params, SAM_PARAM_LISTEN_PORT, listenPort))
+		{
+			SendI2PError ("Invalid LISTEN_PORT", false);
+			return;
+		}
+		std::shared_ptr<boost::asio::ip::udp::endpoint> forward = nullptr;
+		if (type != eSAMSessionTypeStream && !ExtractUDPForward (params, forward))
+		{
+			SendI2PError ("Invalid HOST or PORT", false);
+			return;
+		}
+
+		std::string error;
+		auto session = m_Owner.CreateSubsession (m_ID, id, type, listenPort, fromPort, toPort, error);
+		if (session)
+		{
+			if (type != eSAMSessionTypeStream)
+			{
+				session->UDPEndpoint = forward;
+				SetDatagramReceiver (session);
+			}
+#ifdef _MSC_VER
+			size_t l = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_ADD_REPLY_OK, id.c_str ());
+#else
+			size_t l = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_ADD_REPLY_OK, id.c_str ());
+#endif
+			SendMessageReply (m_Buffer, l, false);
+		}
+		else
+			SendI2PError (error, false);
+	}
+
+	void SAMSocket::ProcessSessionRemove (char * buf, size_t len)
+	{
+		LogPrint (eLogDebug, "SAM: session remove: ", buf);
+		std::map<std::string, std::string> params;
+		ExtractParams (buf, params);
+		std::string& id = params[SAM_PARAM_ID];
+		auto session = m_Owner.FindSession (id);
+		if (m_SocketType != eSAMSocketTypeSession || !session || session->PrimaryName != m_ID)
+		{
+			SendI2PError ("Not a subsession of this session", false);
+			return;
+		}
+		m_Owner.CloseSession (id);
+#ifdef _MSC_VER
+		size_t l = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_REMOVE_REPLY_OK, id.c_str ());
+#else
+		size_t l = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_REMOVE_REPLY_OK, id.c_str ());
+#endif
+		SendMessageReply (m_Buffer, l, false);
+	}
+
 	void SAMSocket::HandleSessionReadinessCheckTimer (const boost::system::error_code& ecode)
 	{
 		if (ecode != boost::asio::error::operation_aborted)
@@ -472,8 +646,13 @@ namespace client
 		auto session = m_Owner.FindSession(m_ID);
 		if(session)
 		{
+			m_Stream = session->CreateStream (remote);
+			if (!m_Stream)
+			{
+				SendMessageReply (SAM_STREAM_STATUS_I2P_ERROR, strlen(SAM_STREAM_STATUS_I2P_ERROR), true);
+				return;
+			}
 			m_SocketType = eSAMSocketTypeStream;
-			m_Stream = session->localDestination->CreateStream (remote);
 			m_Stream->Send ((uint8_t *)m_Buffer, m_BufferOffset); // connect and send
 			m_BufferOffset = 0;
 			I2PReceive ();
@@ -505,10 +684,11 @@ namespace client
 		if (session)
 		{
 			m_SocketType = eSAMSocketTypeAcceptor;
-			if (!session->localDestination->IsAcceptingStreams ())
+			auto dest = session->GetStreamingDestination ();
+			if (!dest->IsAcceptorSet ())
 			{
 				m_IsAccepting = true;	
-				session->localDestination->AcceptOnce (std::bind (&SAMSocket::HandleI2PAccept, shared_from_this (), std::placeholders::_1));
+				dest->AcceptOnce (std::bind (&SAMSocket::HandleI2PAccept, shared_from_this (), std::placeholders::_1));
 			}
 			SendMessageReply (SAM_STREAM_STATUS_OK, strlen(SAM_STREAM_STATUS_OK), false);
 		}
@@ -563,7 +743,7 @@ namespace client
 		it = params.find (SAM_PARAM_CRYPTO_TYPE);
 		if (it != params.end ())
 			cryptoType = std::stoi(it->second);
-		auto keys = i2p::data::PrivateKeys::CreateRandomKeys (signatureType, cryptoType);
+		auto keys = i2p::client::context.CreateTransientKeys (signatureType, cryptoType);
 #ifdef _MSC_VER
 		size_t l = sprintf_s (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_DEST_REPLY,
 			keys.GetPublic ()->ToBase64 ().c_str (), keys.ToBase64 ().c_str ());
@@ -610,7 +790,7 @@ namespace client
 		}
 	}
 
-	void SAMSocket::SendI2PError(const std::string & msg)
+	void SAMSocket::SendI2PError(const std::string & msg, bool close)
 	{
 		LogPrint (eLogError, "SAM: i2p error ", msg);
 #ifdef _MSC_VER
@@ -618,7 +798,7 @@ namespace client
 #else
 		size_t len = snprintf (m_Buffer, SAM_SOCKET_BUFFER_SIZE, SAM_SESSION_STATUS_I2P_ERROR, msg.c_str());
 #endif
-		SendMessageReply (m_Buffer, len, true);
+		SendMessageReply (m_Buffer, len, close);
 	}
 
 	void SAMSocket::HandleNamingLookupLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet, i2p::data::IdentHash ident)
@@ -674,6 +854,15 @@ namespace client
 
 	void SAMSocket::Receive ()
 	{
+		if (m_SocketType == eSAMSocketTypeStream && !m_BufferOffset)
+		{
+			// no command leftover, read stream data into own buffer
+			if (m_SocketBuffer.empty ())
+				m_SocketBuffer.resize (SAM_SOCKET_BUFFER_SIZE);
+			m_Socket.async_read_some (boost::asio::buffer(m_SocketBuffer.data (), m_SocketBuffer.size ()),
+				std::bind(&SAMSocket::HandleReceived, shared_from_this (), std::placeholders::_1, std::placeholders::_2));
+			return;
+		}
 		m_Socket.async_read_some (boost::asio::buffer(m_Buffer + m_BufferOffset, SAM_SOCKET_BUFFER_SIZE - m_BufferOffset),
 			std::bind((m_SocketType == eSAMSocketTypeStream) ? &SAMSocket::HandleReceived : &SAMSocket::HandleMessage,
 			shared_from_this (), std::placeholders::_1, std::placeholders::_2));
@@ -691,10 +880,32 @@ namespace client
 		{
 			if (m_Stream)
 			{
-				bytes_transferred += m_BufferOffset;
-				m_BufferOffset = 0;
-				m_Stream->AsyncSend ((uint8_t *)m_Buffer, bytes_transferred,
-					std::bind(&SAMSocket::HandleStreamSend, shared_from_this(), std::placeholders::_1));
+				if (m_BufferOffset) // leftover after command
+				{
+					bytes_transferred += m_BufferOffset;
+					m_BufferOffset = 0;
+					m_Stream->AsyncSend ((uint8_t *)m_Buffer, bytes_transferred,
+						std::bind(&SAMSocket::HandleStreamSend, shared_from_this(), std::placeholders::_1));
+				}
+				else
+				{
+					// m_SocketBuffer is held by stream until sent, adapt it before next read
+					auto s = shared_from_this ();
+					m_Stream->AsyncSendNoCopy (m_SocketBuffer.data (), bytes_transferred,
+						[s, bytes_transferred](const boost::system::error_code& ec)
+						{
+							s->m_Owner.GetService ().post ([s, ec, bytes_transferred]()
+								{
+									if (!ec)
+									{
+										AdaptBufferSize (s->m_SocketBuffer, bytes_transferred);
+										s->Receive ();
+									}
+									else
+										s->TerminateClose ();
+								});
+						});
+				}
 			}
 			else
 			{
@@ -707,51 +918,37 @@ namespace client
 	{
 		if (m_Stream)
 		{
-			if (m_Stream->GetStatus () == i2p::stream::eStreamStatusNew ||
-					 m_Stream->GetStatus () == i2p::stream::eStreamStatusOpen) // regular
-			{
-				m_Stream->AsyncReceive (boost::asio::buffer (m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE),
-						std::bind (&SAMSocket::HandleI2PReceive, shared_from_this(),
-						std::placeholders::_1, std::placeholders::_2),
-							SAM_SOCKET_CONNECTION_MAX_IDLE);
-			}
-			else // closed by peer
-			{
-				uint8_t * buff = new uint8_t[SAM_SOCKET_BUFFER_SIZE];
-				// get remaning data
-				auto len = m_Stream->ReadSome (buff, SAM_SOCKET_BUFFER_SIZE);
-				if (len > 0) // still some data
-				{
-					WriteI2PDataImmediate(buff, len);
-				}
-				else // no more data
-				{
-					delete [] buff;
-					Terminate ("no more data");
-				}
-			}
+			bool isOpen = m_Stream->GetStatus () == i2p::stream::eStreamStatusNew ||
+				m_Stream->GetStatus () == i2p::stream::eStreamStatusOpen;
+			// data stays in stream's packets and is written from there,
+			// if closed by peer get remaining data, zero timeout terminates if nothing left
+			m_Stream->AsyncReceive (boost::asio::mutable_buffer (),
+				std::bind (&SAMSocket::HandleI2PReceive, shared_from_this(),
+					std::placeholders::_1, std::placeholders::_2),
+				isOpen ? SAM_SOCKET_CONNECTION_MAX_IDLE : 0);
 		}
 	}
 
-	void SAMSocket::WriteI2PDataImmediate(uint8_t * buff, size_t sz)
+	void SAMSocket::WriteReceived ()
 	{
-		boost::asio::async_write (
-			m_Socket,
-			boost::asio::buffer (buff, sz),
-			boost::asio::transfer_all(),
-			std::bind (&SAMSocket::HandleWriteI2PDataImmediate, shared_from_this (), std::placeholders::_1, buff)); // postpone termination
+		std::vector<boost::asio::const_buffer> buffers;
+		auto len = m_Stream->GetReceivedBuffers (buffers, SAM_SOCKET_BUFFER_SIZE);
+		auto s = shared_from_this ();
+		auto stream = m_Stream; // keeps packets referenced by buffers until write completes
+		boost::asio::async_write (m_Socket, buffers, boost::asio::transfer_all (),
+			[s, stream, len](const boost::system::error_code& ecode, std::size_t bytes_transferred)
+			{
+				if (!ecode)
+					stream->AsyncConsumeReceived (len); // before next receive, both are posted to stream's thread
+				s->HandleWriteI2PData (ecode, bytes_transferred);
+			});
 	}
 
-	void SAMSocket::HandleWriteI2PDataImmediate(const boost::system::error_code & ec, uint8_t * buff)
-	{
-		delete [] buff;
-	}
-	
 	void SAMSocket::WriteI2PData(size_t sz)
 	{
 		boost::asio::async_write (
 			m_Socket,
-			boost::asio::buffer (m_StreamBuffer, sz),
+			boost::asio::buffer (m_StreamBuffer.data (), sz),
 			boost::asio::transfer_all(),
 			std::bind(&SAMSocket::HandleWriteI2PData, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
 	}
@@ -765,7 +962,7 @@ namespace client
 			{
 				if (bytes_transferred > 0)
 				{
-					WriteI2PData(bytes_transferred);
+					WriteReceived ();
 				}
 				else
 				{
@@ -784,9 +981,7 @@ namespace client
 			if (m_SocketType != eSAMSocketTypeTerminated)
 			{
 				if (bytes_transferred > 0)
-				{
-					WriteI2PData(bytes_transferred);
-				}
+					WriteReceived ();
 				else
 					I2PReceive();
 			}
@@ -824,7 +1019,7 @@ namespace client
 					if (it->m_SocketType == eSAMSocketTypeAcceptor)
 					{
 						it->m_IsAccepting = true;
-						session->localDestination->AcceptOnce (std::bind (&SAMSocket::HandleI2PAccept, it, std::placeholders::_1));
+						session->GetStreamingDestination ()->AcceptOnce (std::bind (&SAMSocket::HandleI2PAccept, it, std::placeholders::_1));
 						break;
 					}
 			}
@@ -837,7 +1032,7 @@ namespace client
 
 				// send remote peer address as base64
 				const size_t l = ident_ptr->ToBuffer (ident, ident_len);
-				const size_t l1 = i2p::data::ByteStreamToBase64 (ident, l, (char *)m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE);
+				const size_t l1 = i2p::data::ByteStreamToBase64 (ident, l, (char *)m_StreamBuffer.data (), m_StreamBuffer.size ());
 				delete[] ident;
 				m_StreamBuffer[l1] = '\n';
 				HandleI2PReceive (boost::system::error_code (), l1 +1); // we send identity like it has been received from stream
@@ -849,11 +1044,11 @@ namespace client
 			LogPrint (eLogWarning, "SAM: I2P acceptor has been reset");
 	}
 
-	void SAMSocket::HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
+	void SAMSocket::HandleI2PDatagramReceive (const std::string& id, const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
 	{
 		LogPrint (eLogDebug, "SAM: datagram received ", len);
 		auto base64 = from.ToBase64 ();
-		auto session = m_Owner.FindSession(m_ID);
+		auto session = m_Owner.FindSession(id);
 		if(session)
 		{
 			auto ep = session->UDPEndpoint;
@@ -877,13 +1072,13 @@ namespace client
 			else
 			{
 #ifdef _MSC_VER
-				size_t l = sprintf_s ((char *)m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE, SAM_DATAGRAM_RECEIVED, base64.c_str (), (long unsigned int)len);
+				size_t l = sprintf_s ((char *)m_StreamBuffer.data (), m_StreamBuffer.size (), SAM_DATAGRAM_RECEIVED, base64.c_str (), (long unsigned int)len);
 #else
-				size_t l = snprintf ((char *)m_StreamBuffer, SAM_SOCKET_BUFFER_SIZE, SAM_DATAGRAM_RECEIVED, base64.c_str (), (long unsigned int)len);
+				size_t l = snprintf ((char *)m_StreamBuffer.data (), m_StreamBuffer.size (), SAM_DATAGRAM_RECEIVED, base64.c_str (), (long unsigned int)len);
 #endif
-				if (len < SAM_SOCKET_BUFFER_SIZE - l)
+				if (len < m_StreamBuffer.size () - l)
 				{
-					memcpy (m_StreamBuffer + l, buf, len);
+					memcpy (m_StreamBuffer.data () + l, buf, len);
 					WriteI2PData(len + l);
 				}
 				else
@@ -892,6 +1087,34 @@ namespace client
 		}
 	}
 
+	void SAMSocket::HandleI2PRawDatagramReceive (const std::string& id, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len)
+	{
+		LogPrint (eLogDebug, "SAM: raw datagram received ", len);
+		auto session = m_Owner.FindSession(id);
+		if(session)
+		{
+			auto ep = session->UDPEndpoint;
+			if (ep)
+				// udp forward enabled, payload only
+				m_Owner.SendTo(buf, len, ep);
+			else
+			{
+#ifdef _MSC_VER
+				size_t l = sprintf_s ((char *)m_StreamBuffer.data (), m_StreamBuffer.size (), SAM_RAW_RECEIVED, (long unsigned int)len, (int)fromPort, (int)toPort);
+#else
+				size_t l = snprintf ((char *)m_StreamBuffer.data (), m_StreamBuffer.size (), SAM_RAW_RECEIVED, (long unsigned int)len, (int)fromPort, (int)toPort);
+#endif
+				if (len < m_StreamBuffer.size () - l)
+				{
+					memcpy (m_StreamBuffer.data () + l, buf, len);
+					WriteI2PData(len + l);
+				}
+				else
+					LogPrint (eLogWarning, "SAM: received raw datagram size ", len," exceeds buffer");
+			}
+		}
+	}
+
 	void SAMSocket::HandleStreamSend(const boost::system::error_code & ec)
 	{
 		m_Owner.GetService ().post (std::bind( !ec ? &SAMSocket::Receive : &SAMSocket::TerminateClose, shared_from_this()));
@@ -901,13 +1124,45 @@ namespace client
 		m_Bridge(parent),
 		localDestination (dest),
 		UDPEndpoint(nullptr),
-		Name(id)
+		Name(id), Type (eSAMSessionTypeStream),
+		ListenPort (0), FromPort (0), ToPort (0)
 	{
 	}
 	
 	SAMSession::~SAMSession ()
 	{
-		i2p::client::context.DeleteLocalDestination (localDestination);
+		if (!IsSubsession ()) // destination belongs to PRIMARY
+			i2p::client::context.DeleteLocalDestination (localDestination);
+	}
+
+	std::shared_ptr<i2p::stream::StreamingDestination> SAMSession::GetStreamingDestination () const
+	{
+		return streamingDestination ? streamingDestination : localDestination->GetStreamingDestination ();
+	}
+
+	std::shared_ptr<i2p::stream::Stream> SAMSession::CreateStream (std::shared_ptr<const i2p::data::LeaseSet> remote)
+	{
+		auto dest = GetStreamingDestination ();
+		return dest ? dest->CreateNewOutgoingStream (remote, ToPort) : nullptr;
+	}
+
+	void SAMSession::SendDatagramsTo (const std::vector<std::pair<const uint8_t *, size_t> >& payloads, const i2p::data::IdentHash& ident)
+	{
+		auto d = localDestination->GetDatagramDestination ();
+		if (!d)
+		{
+			LogPrint (eLogError, "SAM: missing datagram destination for session ", Name);
+			return;
+		}
+		if (Type == eSAMSessionTypeRaw)
+		{
+			for (const auto& it: payloads)
+				d->SendRawDatagramTo (it.first, it.second, ident, FromPort, ToPort);
+		}
+		else if (payloads.size () == 1)
+			d->SendDatagramTo (payloads[0].first, payloads[0].second, ident, FromPort, ToPort);
+		else
+			d->SendDatagramsTo (payloads, ident, FromPort, ToPort);
 	}
 
 	void SAMSession::CloseStreams ()
@@ -921,7 +1176,8 @@ namespace client
 	SAMBridge::SAMBridge (const std::string& address, int port):
 		m_IsRunning (false), m_Thread (nullptr),
 		m_Acceptor (m_Service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string(address), port)),
-		m_DatagramEndpoint (boost::asio::ip::address::from_string(address), port-1), m_DatagramSocket (m_Service, m_DatagramEndpoint)
+		m_DatagramEndpoint (boost::asio::ip::address::from_string(address), port-1), m_DatagramSocket (m_Service, m_DatagramEndpoint),
+		m_DatagramReceiveBuffers (SAM_DATAGRAM_BATCH_SIZE*(i2p::datagram::MAX_DATAGRAM_SIZE+1))
 	{
 	}
 
@@ -957,11 +1213,12 @@ namespace client
 
 	void SAMBridge::Run ()
 	{
+		i2p::util::InitThread ("SAM", i2p::util::eThreadGroupClients);
 		while (m_IsRunning)
 		{
 			try
 			{
-				m_Service.run ();
+				i2p::util::RunService (m_Service, "SAM");
 			}
 			catch (std::exception& ex)
 			{
@@ -1066,9 +1323,49 @@ namespace client
 		return nullptr;
 	}
 
+	std::shared_ptr<SAMSession> SAMBridge::CreateSubsession (const std::string& primary, const std::string& id, SAMSessionType type,
+		uint16_t listenPort, uint16_t fromPort, uint16_t toPort, std::string& error)
+	{
+		std::unique_lock<std::mutex> l(m_SessionsMutex);
+		auto it = m_Sessions.find (primary);
+		if (it == m_Sessions.end () || it->second->Type != eSAMSessionTypePrimary)
+		{
+			error = "PRIMARY session not found";
+			return nullptr;
+		}
+		auto primarySession = it->second;
+		if (m_Sessions.count (id))
+		{
+			error = "Duplicated ID";
+			return nullptr;
+		}
+		// incoming are dispatched by protocol and port
+		for (const auto& name: primarySession->Subsessions)
+		{
+			auto s = m_Sessions.find (name);
+			if (s != m_Sessions.end () && s->second->Type == type && s->second->ListenPort == listenPort)
+			{
+				error = "Duplicated LISTEN_PORT";
+				return nullptr;
+			}
+		}
+		auto session = std::make_shared<SAMSession>(*this, id, primarySession->localDestination);
+		session->Type = type;
+		session->PrimaryName = primary;
+		session->ListenPort = listenPort;
+		session->FromPort = fromPort;
+		session->ToPort = toPort;
+		if (type == eSAMSessionTypeStream && listenPort)
+			session->streamingDestination = session->localDestination->CreateStreamingDestination (listenPort);
+		primarySession->Subsessions.insert (id);
+		m_Sessions[id] = session;
+		return session;
+	}
+
 	void SAMBridge::CloseSession (const std::string& id)
 	{
 		std::shared_ptr<SAMSession> session;
+		std::vector<std::shared_ptr<SAMSession> > subsessions;
 		{
 			std::unique_lock<std::mutex> l(m_SessionsMutex);
 			auto it = m_Sessions.find (id);
@@ -1076,13 +1373,61 @@ namespace client
 			{
 				session = it->second;
 				m_Sessions.erase (it);
+				if (session->IsSubsession ())
+				{
+					auto primary = m_Sessions.find (session->PrimaryName);
+					if (primary != m_Sessions.end ())
+						primary->second->Subsessions.erase (id);
+				}
+				else
+				{
+					for (const auto& name: session->Subsessions)
+					{
+						auto s = m_Sessions.find (name);
+						if (s != m_Sessions.end ())
+						{
+							subsessions.push_back (s->second);
+							m_Sessions.erase (s);
+						}
+					}
+					session->Subsessions.clear ();
+				}
 			}
 		}
 		if (session)
 		{
-			session->localDestination->Release ();
-			session->localDestination->StopAcceptingStreams ();
-			session->CloseStreams ();
+			if (session->IsSubsession ())
+				subsessions.push_back (session);
+			for (auto& it: subsessions)
+			{
+				// stop receiving on subsession's port, destination stays with PRIMARY
+				auto dest = it->localDestination;
+				if (it->Type == eSAMSessionTypeStream)
+				{
+					it->GetStreamingDestination ()->ResetAcceptor ();
+					if (it->ListenPort)
+						dest->DeleteStreamingDestination (it->ListenPort);
+				}
+				else if (dest->GetDatagramDestination ())
+				{
+					auto d = dest->GetDatagramDestination ();
+					if (it->Type == eSAMSessionTypeRaw)
+					{
+						if (it->ListenPort) d->ResetRawReceiver (it->ListenPort); else d->ResetRawReceiver ();
+					}
+					else
+					{
+						if (it->ListenPort) d->ResetReceiver (it->ListenPort); else d->ResetReceiver ();
+					}
+				}
+				it->CloseStreams ();
+			}
+			if (!session->IsSubsession ())
+			{
+				session->localDestination->Release ();
+				session->localDestination->StopAcceptingStreams ();
+				session->CloseStreams ();
+			}
 		}
 	}
 
@@ -1111,56 +1456,183 @@ namespace client
 	{
 		if(remote)
 		{
-			m_DatagramSocket.send_to(boost::asio::buffer(buf, len), *remote);
+			// called from destinations' threads, sent in batch from ours
+			std::unique_lock<std::mutex> l(m_DatagramSendQueueMutex);
+			if (m_DatagramSendQueue.size () >= SAM_DATAGRAM_SEND_QUEUE_MAX_SIZE)
+			{
+				LogPrint (eLogWarning, "SAM: datagram send queue is full, dropped");
+				return;
+			}
+			m_DatagramSendQueue.push_back (std::make_pair (std::vector<uint8_t>(buf, buf + len), *remote));
+			if (m_DatagramSendQueue.size () == 1)
+				m_Service.post (std::bind (&SAMBridge::FlushDatagrams, this));
+		}
+	}
+
+	void SAMBridge::FlushDatagrams ()
+	{
+		std::vector<std::pair<std::vector<uint8_t>, boost::asio::ip::udp::endpoint> > queue;
+		{
+			std::unique_lock<std::mutex> l(m_DatagramSendQueueMutex);
+			queue.swap (m_DatagramSendQueue);
 		}
+		boost::system::error_code ec;
+#ifdef __linux__
+		struct mmsghdr msgs[SAM_DATAGRAM_BATCH_SIZE];
+		struct iovec iovs[SAM_DATAGRAM_BATCH_SIZE];
+		size_t offset = 0;
+		while (offset < queue.size ())
+		{
+			size_t num = queue.size () - offset;
+			if (num > SAM_DATAGRAM_BATCH_SIZE) num = SAM_DATAGRAM_BATCH_SIZE;
+			memset (msgs, 0, num*sizeof (struct mmsghdr));
+			for (size_t i = 0; i < num; i++)
+			{
+				auto& it = queue[offset + i];
+				iovs[i].iov_base = it.first.data ();
+				iovs[i].iov_len = it.first.size ();
+				msgs[i].msg_hdr.msg_iov = &iovs[i];
+				msgs[i].msg_hdr.msg_iovlen = 1;
+				msgs[i].msg_hdr.msg_name = it.second.data ();
+				msgs[i].msg_hdr.msg_namelen = it.second.size ();
+			}
+			int sent = sendmmsg (m_DatagramSocket.native_handle (), msgs, num, 0);
+			if (sent <= 0)
+			{
+				// send one by one, waits if socket is busy
+				m_DatagramSocket.send_to (boost::asio::buffer (queue[offset].first), queue[offset].second, 0, ec);
+				if (ec)
+					LogPrint (eLogError, "SAM: datagram send error: ", ec.message ());
+				sent = 1;
+			}
+			offset += sent;
+		}
+#else
+		for (const auto& it: queue)
+		{
+			m_DatagramSocket.send_to (boost::asio::buffer (it.first), it.second, 0, ec);
+			if (ec)
+				LogPrint (eLogError, "SAM: datagram send error: ", ec.message ());
+		}
+#endif
 	}
 
 	void SAMBridge::ReceiveDatagram ()
 	{
 		m_DatagramSocket.async_receive_from (
-			boost::asio::buffer (m_DatagramReceiveBuffer, i2p::datagram::MAX_DATAGRAM_SIZE),
+			boost::asio::buffer (m_DatagramReceiveBuffers.data (), i2p::datagram::MAX_DATAGRAM_SIZE),
 			m_SenderEndpoint,
 			std::bind (&SAMBridge::HandleReceivedDatagram, this, std::placeholders::_1, std::placeholders::_2));
 	}
 
+	size_t SAMBridge::ReceiveMoreDatagrams (size_t * lens)
+	{
+		const size_t stride = i2p::datagram::MAX_DATAGRAM_SIZE + 1;
+		uint8_t * buf = m_DatagramReceiveBuffers.data () + stride; // first one is taken
+		size_t num = SAM_DATAGRAM_BATCH_SIZE - 1;
+#ifdef __linux__
+		// pick up everything available with one syscall
+		struct mmsghdr msgs[SAM_DATAGRAM_BATCH_SIZE];
+		struct iovec iovs[SAM_DATAGRAM_BATCH_SIZE];
+		memset (msgs, 0, num*sizeof (struct mmsghdr));
+		for (size_t i = 0; i < num; i++)
+		{
+			iovs[i].iov_base = buf + i*stride;
+			iovs[i].iov_len = i2p::datagram::MAX_DATAGRAM_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int received = recvmmsg (m_DatagramSocket.native_handle (), msgs, num, MSG_DONTWAIT, nullptr);
+		if (received < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				LogPrint (eLogError, "SAM: recvmmsg error: ", strerror (errno));
+			return 0;
+		}
+		for (size_t i = 0; i < (size_t)received; i++)
+			lens[i] = msgs[i].msg_len;
+		return received;
+#else
+		size_t received = 0;
+		boost::system::error_code ec;
+		size_t moreBytes = m_DatagramSocket.available (ec);
+		while (!ec && moreBytes && received < num)
+		{
+			lens[received] = m_DatagramSocket.receive_from (boost::asio::buffer (buf + received*stride,
+				i2p::datagram::MAX_DATAGRAM_SIZE), m_SenderEndpoint, 0, ec);
+			if (ec)
+			{
+				LogPrint (eLogError, "SAM: datagram receive error: ", ec.message ());
+				break;
+			}
+			received++;
+			moreBytes = m_DatagramSocket.available (ec);
+		}
+		return received;
+#endif
+	}
+
 	void SAMBridge::HandleReceivedDatagram (const boost::system::error_code& ecode, std::size_t bytes_transferred)
 	{
 		if (!ecode)
 		{
-			m_DatagramReceiveBuffer[bytes_transferred] = 0;
-			char * eol = strchr ((char *)m_DatagramReceiveBuffer, '\n');
-			if(eol)
+			size_t lens[SAM_DATAGRAM_BATCH_SIZE];
+			lens[0] = bytes_transferred;
+			size_t numDatagrams = 1 + ReceiveMoreDatagrams (lens + 1);
+			// consecutive datagrams of the same session to the same destination are sent together
+			std::shared_ptr<SAMSession> batchSession;
+			i2p::data::IdentHash batchIdent;
+			std::vector<std::pair<const uint8_t *, size_t> > batch;
+			auto sendBatch = [&batchSession, &batchIdent, &batch]()
+				{
+					if (batch.empty ()) return;
+					batchSession->SendDatagramsTo (batch, batchIdent);
+					batch.clear ();
+				};
+			for (size_t i = 0; i < numDatagrams; i++)
 			{
-				*eol = 0; eol++;
-				size_t payloadLen = bytes_transferred - ((uint8_t *)eol - m_DatagramReceiveBuffer);
-				LogPrint (eLogDebug, "SAM: datagram received ", m_DatagramReceiveBuffer," size=", payloadLen);
-				char * sessionID = strchr ((char *)m_DatagramReceiveBuffer, ' ');
-				if (sessionID)
+				uint8_t * datagram = m_DatagramReceiveBuffers.data () + i*(i2p::datagram::MAX_DATAGRAM_SIZE + 1);
+				datagram[lens[i]] = 0;
+				char * eol = strchr ((char *)datagram, '\n');
+				if(eol)
 				{
-					sessionID++;
-					char * destination = strchr (sessionID, ' ');
-					if (destination)
+					*eol = 0; eol++;
+					size_t payloadLen = lens[i] - ((uint8_t *)eol - datagram);
+					LogPrint (eLogDebug, "SAM: datagram received ", datagram," size=", payloadLen);
+					char * sessionID = strchr ((char *)datagram, ' ');
+					if (sessionID)
 					{
-						*destination = 0; destination++;
-						auto session = FindSession (sessionID);
-						if (session)
+						sessionID++;
+						char * destination = strchr (sessionID, ' ');
+						if (destination)
 						{
-							i2p::data::IdentityEx dest;
-							dest.FromBase64 (destination);
-							session->localDestination->GetDatagramDestination ()->
-								SendDatagramTo ((uint8_t *)eol, payloadLen, dest.GetIdentHash ());
+							*destination = 0; destination++;
+							auto session = FindSession (sessionID);
+							if (session)
+							{
+								i2p::data::IdentityEx dest;
+								dest.FromBase64 (destination);
+								if (session != batchSession || dest.GetIdentHash () != batchIdent)
+								{
+									sendBatch ();
+									batchSession = session;
+									batchIdent = dest.GetIdentHash ();
+								}
+								batch.push_back (std::make_pair ((const uint8_t *)eol, payloadLen));
+							}
+							else
+								LogPrint (eLogError, "SAM: Session ", sessionID, " not found");
 						}
 						else
-							LogPrint (eLogError, "SAM: Session ", sessionID, " not found");
+							LogPrint (eLogError, "SAM: Missing destination key");
 					}
 					else
-						LogPrint (eLogError, "SAM: Missing destination key");
+						LogPrint (eLogError, "SAM: Missing sessionID");
 				}
 				else
-					LogPrint (eLogError, "SAM: Missing sessionID");
+					LogPrint(eLogError, "SAM: invalid datagram");
 			}
-			else
-				LogPrint(eLogError, "SAM: invalid datagram");
+			sendBatch ();
 			ReceiveDatagram ();
 		}
 		else
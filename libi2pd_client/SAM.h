@@ -5,6 +5,8 @@
 #include <string>
 #include <map>
 #include <list>
+#include <set>
+#include <vector>
 #include <thread>
 #include <mutex>
 #include <memory>
@@ -19,8 +21,11 @@ namespace i2p
 namespace client
 {
 	const size_t SAM_SOCKET_BUFFER_SIZE = 8192;
+	const size_t SAM_SOCKET_MAX_BUFFER_SIZE = 262144; // stream buffers grow up to
 	const int SAM_SOCKET_CONNECTION_MAX_IDLE = 3600; // in seconds
 	const int SAM_SESSION_READINESS_CHECK_INTERVAL = 20; // in seconds
+	const size_t SAM_DATAGRAM_BATCH_SIZE = 16; // datagrams per syscall
+	const size_t SAM_DATAGRAM_SEND_QUEUE_MAX_SIZE = 1024;
 	const char SAM_HANDSHAKE[] = "HELLO VERSION";
 	const char SAM_HANDSHAKE_REPLY[] = "HELLO REPLY RESULT=OK VERSION=%s\n";
 	const char SAM_HANDSHAKE_NOVERSION[] = "HELLO REPLY RESULT=NOVERSION\n";
@@ -32,6 +37,10 @@ namespace client
 	const char SAM_SESSION_CREATE_INVALID_ID[] = "SESSION STATUS RESULT=INVALID_ID\n";
 	const char SAM_SESSION_STATUS_INVALID_KEY[] = "SESSION STATUS RESULT=INVALID_KEY\n";
 	const char SAM_SESSION_STATUS_I2P_ERROR[] = "SESSION STATUS RESULT=I2P_ERROR MESSAGE=%s\n";
+	const char SAM_SESSION_ADD[] = "SESSION ADD";
+	const char SAM_SESSION_ADD_REPLY_OK[] = "SESSION STATUS RESULT=OK ID=%s MESSAGE=ADD\n";
+	const char SAM_SESSION_REMOVE[] = "SESSION REMOVE";
+	const char SAM_SESSION_REMOVE_REPLY_OK[] = "SESSION STATUS RESULT=OK ID=%s MESSAGE=REMOVE\n";
 	const char SAM_STREAM_CONNECT[] = "STREAM CONNECT";
 	const char SAM_STREAM_STATUS_OK[] = "STREAM STATUS RESULT=OK\n";
 	const char SAM_STREAM_STATUS_INVALID_ID[] = "STREAM STATUS RESULT=INVALID_ID\n";
@@ -45,6 +54,7 @@ namespace client
 	const char SAM_NAMING_LOOKUP[] = "NAMING LOOKUP";
 	const char SAM_NAMING_REPLY[] = "NAMING REPLY RESULT=OK NAME=ME VALUE=%s\n";
 	const char SAM_DATAGRAM_RECEIVED[] = "DATAGRAM RECEIVED DESTINATION=%s SIZE=%lu\n";
+	const char SAM_RAW_RECEIVED[] = "RAW RECEIVED SIZE=%lu FROM_PORT=%d TO_PORT=%d\n";
 	const char SAM_NAMING_REPLY_INVALID_KEY[] = "NAMING REPLY RESULT=INVALID_KEY NAME=%s\n";
 	const char SAM_NAMING_REPLY_KEY_NOT_FOUND[] = "NAMING REPLY RESULT=KEY_NOT_FOUND NAME=%s\n";
 	const char SAM_PARAM_MIN[] = "MIN";
@@ -57,10 +67,15 @@ namespace client
 	const char SAM_PARAM_SIGNATURE_TYPE[] = "SIGNATURE_TYPE";
 	const char SAM_PARAM_CRYPTO_TYPE[] = "CRYPTO_TYPE";
 	const char SAM_PARAM_SIZE[] = "SIZE";
+	const char SAM_PARAM_FROM_PORT[] = "FROM_PORT";
+	const char SAM_PARAM_TO_PORT[] = "TO_PORT";
+	const char SAM_PARAM_LISTEN_PORT[] = "LISTEN_PORT";
 	const char SAM_VALUE_TRANSIENT[] = "TRANSIENT";
 	const char SAM_VALUE_STREAM[] = "STREAM";
 	const char SAM_VALUE_DATAGRAM[] = "DATAGRAM";
 	const char SAM_VALUE_RAW[] = "RAW";
+	const char SAM_VALUE_PRIMARY[] = "PRIMARY";
+	const char SAM_VALUE_MASTER[] = "MASTER"; // old name of PRIMARY
 	const char SAM_VALUE_TRUE[] = "true";
 	const char SAM_VALUE_FALSE[] = "false";
 	const char SAM_VALUE_HOST[] = "HOST";
@@ -75,6 +90,14 @@ namespace client
 		eSAMSocketTypeTerminated
 	};
 
+	enum SAMSessionType
+	{
+		eSAMSessionTypeStream,
+		eSAMSessionTypeDatagram,
+		eSAMSessionTypeRaw,
+		eSAMSessionTypePrimary // subsessions share its destination
+	};
+
 	class SAMBridge;
 	struct SAMSession;
 	class SAMSocket: public std::enable_shared_from_this<SAMSocket>
@@ -109,16 +132,21 @@ namespace client
 			void HandleI2PReceive (const boost::system::error_code& ecode, std::size_t bytes_transferred);
 			void HandleI2PAccept (std::shared_ptr<i2p::stream::Stream> stream);
 			void HandleWriteI2PData (const boost::system::error_code& ecode, size_t sz);
-			void HandleI2PDatagramReceive (const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
+			void HandleI2PDatagramReceive (const std::string& id, const i2p::data::IdentityEx& from, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
+			void HandleI2PRawDatagramReceive (const std::string& id, uint16_t fromPort, uint16_t toPort, const uint8_t * buf, size_t len);
 
 			void ProcessSessionCreate (char * buf, size_t len);
+			void ProcessSessionAdd (char * buf, size_t len);
+			void ProcessSessionRemove (char * buf, size_t len);
 			void ProcessStreamConnect (char * buf, size_t len, size_t rem);
 			void ProcessStreamAccept (char * buf, size_t len);
 			void ProcessDestGenerate (char * buf, size_t len);
 			void ProcessNamingLookup (char * buf, size_t len);
-			void SendI2PError(const std::string & msg);
+			void SendI2PError(const std::string & msg, bool close = true);
 			size_t ProcessDatagramSend (char * buf, size_t len, const char * data); // from SAM 1.0
 			void ExtractParams (char * buf, std::map<std::string, std::string>& params);
+			bool ExtractUDPForward (std::map<std::string, std::string>& params, std::shared_ptr<boost::asio::ip::udp::endpoint>& forward);
+			void SetDatagramReceiver (std::shared_ptr<SAMSession> session);
 
 			void Connect (std::shared_ptr<const i2p::data::LeaseSet> remote);
 			void HandleConnectLeaseSetRequestComplete (std::shared_ptr<i2p::data::LeaseSet> leaseSet);
@@ -128,9 +156,7 @@ namespace client
 			void SendSessionCreateReplyOk ();
 
 			void WriteI2PData(size_t sz);
-			void WriteI2PDataImmediate(uint8_t * ptr, size_t sz);
-
-			void HandleWriteI2PDataImmediate(const boost::system::error_code & ec, uint8_t * buff);
+			void WriteReceived (); // from stream's packets without copying
 			void HandleStreamSend(const boost::system::error_code & ec);
 		
 		private:
@@ -140,7 +166,8 @@ namespace client
 			boost::asio::deadline_timer m_Timer;
 			char m_Buffer[SAM_SOCKET_BUFFER_SIZE + 1];
 			size_t m_BufferOffset;
-			uint8_t m_StreamBuffer[SAM_SOCKET_BUFFER_SIZE];
+			std::vector<uint8_t> m_SocketBuffer; // stream data to I2P, adaptive
+			std::vector<uint8_t> m_StreamBuffer; // accepted destination and datagrams to client
 			SAMSocketType m_SocketType;
 			std::string m_ID; // nickname
 			bool m_IsSilent;
@@ -154,10 +181,21 @@ namespace client
 		std::shared_ptr<ClientDestination> localDestination;
 		std::shared_ptr<boost::asio::ip::udp::endpoint> UDPEndpoint;
 		std::string Name;
+		SAMSessionType Type;
+		// subsession of PRIMARY
+		std::string PrimaryName; // empty if destination is own
+		uint16_t ListenPort, FromPort, ToPort;
+		std::shared_ptr<i2p::stream::StreamingDestination> streamingDestination; // for STREAM subsession
+		// PRIMARY
+		std::set<std::string> Subsessions;
 
 		SAMSession (SAMBridge & parent, const std::string & name, std::shared_ptr<ClientDestination> dest);
 		~SAMSession ();
 
+		bool IsSubsession () const { return !PrimaryName.empty (); };
+		std::shared_ptr<i2p::stream::StreamingDestination> GetStreamingDestination () const;
+		std::shared_ptr<i2p::stream::Stream> CreateStream (std::shared_ptr<const i2p::data::LeaseSet> remote);
+		void SendDatagramsTo (const std::vector<std::pair<const uint8_t *, size_t> >& payloads, const i2p::data::IdentHash& ident);
 		void CloseStreams ();
 	};
 
@@ -174,6 +212,9 @@ namespace client
 			boost::asio::io_service& GetService () { return m_Service; };
 			std::shared_ptr<SAMSession> CreateSession (const std::string& id, const std::string& destination, // empty string	 means transient
 				const std::map<std::string, std::string> * params);
+			/** subsession of PRIMARY session on the same destination, receives on listenPort */
+			std::shared_ptr<SAMSession> CreateSubsession (const std::string& primary, const std::string& id, SAMSessionType type,
+				uint16_t listenPort, uint16_t fromPort, uint16_t toPort, std::string& error);
 			void CloseSession (const std::string& id);
 			std::shared_ptr<SAMSession> FindSession (const std::string& id) const;
 
@@ -192,7 +233,9 @@ namespace client
 			void HandleAccept(const boost::system::error_code& ecode, std::shared_ptr<SAMSocket> socket);
 
 			void ReceiveDatagram ();
+			size_t ReceiveMoreDatagrams (size_t * lens); // returns number of datagrams after the first one
 			void HandleReceivedDatagram (const boost::system::error_code& ecode, std::size_t bytes_transferred);
+			void FlushDatagrams ();
 
 		private:
 
@@ -206,7 +249,9 @@ namespace client
 			std::map<std::string, std::shared_ptr<SAMSession> > m_Sessions;
 			mutable std::mutex m_OpenSocketsMutex;
 			std::list<std::shared_ptr<SAMSocket> > m_OpenSockets;
-			uint8_t m_DatagramReceiveBuffer[i2p::datagram::MAX_DATAGRAM_SIZE+1];
+			std::vector<uint8_t> m_DatagramReceiveBuffers; // SAM_DATAGRAM_BATCH_SIZE of MAX_DATAGRAM_SIZE+1
+			std::mutex m_DatagramSendQueueMutex;
+			std::vector<std::pair<std::vector<uint8_t>, boost::asio::ip::udp::endpoint> > m_DatagramSendQueue;
 
 		public:
 
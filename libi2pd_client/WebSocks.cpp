@@ -26,6 +26,8 @@ namespace client
 
 	typedef std::function<void(std::shared_ptr<i2p::stream::Stream>)> StreamConnectFunc;
 
+	const size_t WEBSOCKS_MAX_FRAME_SIZE = 65536; // stream data received at once goes in one frame
+
 
 	struct IWebSocksConn : public I2PServiceHandler
 	{
@@ -105,6 +107,7 @@ namespace client
 			m_Server.start_accept();
 			m_Run = true;
 			m_Thread = new std::thread([&] (){
+					i2p::util::InitThread ("WebSocks", i2p::util::eThreadGroupClients);
 					while(m_Run) {
 						try {
 							m_Server.run();
@@ -181,7 +184,7 @@ namespace client
 		WebSocksImpl * m_Parent;
 		std::string m_RemoteAddr;
 		int m_RemotePort;
-		uint8_t m_RecvBuf[2048];
+		uint8_t m_RecvBuf[WEBSOCKS_MAX_FRAME_SIZE];
 		bool m_IsDatagram;
 		i2p::datagram::DatagramDestination * m_Datagram;
 
@@ -343,16 +346,17 @@ namespace client
 				EnterState(eWSCClose);
 			} else {
 				// forward data
+				// coalesce the rest of received packets into the same frame
+				n += m_Stream->ReadSome(m_RecvBuf + n, sizeof(m_RecvBuf) - n);
 				LogPrint(eLogDebug, "websocks recv ", n);
 
-				std::string str((char*)m_RecvBuf, n);
 				auto conn = m_Parent->GetConn(m_Conn);
 				if(!conn)	 {
 					LogPrint(eLogWarning, "websocks: connection is gone");
 					EnterState(eWSCClose);
 					return;
 				}
-				conn->send(str);
+				conn->send(m_RecvBuf, n, websocketpp::frame::opcode::binary);
 				AsyncRecv();
 
 			}
@@ -402,12 +406,13 @@ namespace client
 		virtual void GotMessage(const websocketpp::connection_hdl & conn, WebSocksServerImpl::message_ptr msg)
 		{
 			(void) conn;
-			std::string payload = msg->get_payload();
+			const std::string & payload = msg->get_payload();
 			if(m_State == eWSCOkayConnect)
 			{
-				// forward to server
+				// forward to server, stream sends from frame's payload kept by handler
 				LogPrint(eLogDebug, "websocks: forward ", payload.size());
-				m_Stream->Send((uint8_t*)payload.c_str(), payload.size());
+				m_Stream->AsyncSendNoCopy((const uint8_t *)payload.data(), payload.size(),
+					[msg](const boost::system::error_code&) {});
 			} else if (m_State == eWSCInitial) {
 				// recv connect request
 				auto itr = payload.find(":");
@@ -1,6 +1,7 @@
 #ifdef WITH_EVENTS
 #include "Websocket.h"
 #include "Log.h"
+#include "util.h"
 
 #include <set>
 #include <functional>
@@ -51,6 +52,7 @@ namespace i2p
 				m_run = true;
 				m_server.start_accept();
 				m_ws_thread = new std::thread([&] () {
+						i2p::util::InitThread ("Websocket");
 						while(m_run) {
 							try {
 								m_server.run();
@@ -60,6 +62,7 @@ namespace i2p
 						}
 					});
 				m_ev_thread = new std::thread([&] () {
+						i2p::util::InitThread ("WebsocketEvents");
 						while(m_run) {
 							try {
 								m_Service.run();
@@ -29,6 +29,7 @@ SOURCES += DaemonQT.cpp mainwindow.cpp \
     ../../libi2pd/Identity.cpp \
     ../../libi2pd/LeaseSet.cpp \
     ../../libi2pd/Log.cpp \
+    ../../libi2pd/Metrics.cpp \
     ../../libi2pd/NetDb.cpp \
     ../../libi2pd/NetDbRequests.cpp \
     ../../libi2pd/NTCPSession.cpp \
@@ -42,6 +43,8 @@ SOURCES += DaemonQT.cpp mainwindow.cpp \
     ../../libi2pd/SSUSession.cpp \
     ../../libi2pd/Streaming.cpp \
     ../../libi2pd/Timestamp.cpp \
+    ../../libi2pd/TimeWheel.cpp \
+    ../../libi2pd/IOUring.cpp \
     ../../libi2pd/TransitTunnel.cpp \
     ../../libi2pd/Transports.cpp \
     ../../libi2pd/Tunnel.cpp \
@@ -113,6 +116,7 @@ HEADERS  += DaemonQT.h mainwindow.h \
     ../../libi2pd/LeaseSet.h \
     ../../libi2pd/LittleBigEndian.h \
     ../../libi2pd/Log.h \
+    ../../libi2pd/Metrics.h \
     ../../libi2pd/NetDb.hpp \
     ../../libi2pd/NetDbRequests.h \
     ../../libi2pd/NTCPSession.h \
@@ -128,6 +132,8 @@ HEADERS  += DaemonQT.h mainwindow.h \
     ../../libi2pd/Streaming.h \
     ../../libi2pd/Tag.h \
     ../../libi2pd/Timestamp.h \
+    ../../libi2pd/TimeWheel.h \
+    ../../libi2pd/IOUring.h \
     ../../libi2pd/TransitTunnel.h \
     ../../libi2pd/Transports.h \
     ../../libi2pd/TransportSession.h \
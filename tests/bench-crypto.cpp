@@ -0,0 +1,196 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#include "Crypto.h"
+#include "Ed25519.h"
+#include "Poly1305.h"
+#include "Siphash.h"
+#include "Base.h"
+#include "Tag.h"
+#include "I2NPProtocol.h"
+
+const int BENCH_DURATION = 500; // in milliseconds per primitive
+
+static void Bench (const char * name, size_t bytesPerOp, std::function<void ()> op)
+{
+	op (); // warm up
+	uint64_t num = 0, batch = 1;
+	auto start = std::chrono::steady_clock::now ();
+	std::chrono::nanoseconds elapsed (0);
+	while (elapsed < std::chrono::milliseconds (BENCH_DURATION))
+	{
+		for (uint64_t i = 0; i < batch; i++) op ();
+		num += batch;
+		if (batch < 1024) batch <<= 1;
+		elapsed = std::chrono::steady_clock::now () - start;
+	}
+	double ns = (double)elapsed.count ()/num;
+	std::cout << std::left << std::setw (36) << name << std::right << std::fixed << std::setprecision (1)
+		<< std::setw (12) << ns << " ns/op";
+	if (bytesPerOp)
+		std::cout << std::setw (10) << bytesPerOp*1000.0/ns << " MB/s";
+	std::cout << std::endl;
+}
+
+int main ()
+{
+	i2p::cpu::Detect (); // AES-NI
+	// AES
+	i2p::crypto::AESKey key1, key2;
+	RAND_bytes (key1, 32); RAND_bytes (key2, 32);
+	uint8_t tunnelMsg[1024], tunnelOut[1024];
+	RAND_bytes (tunnelMsg, 1024);
+	i2p::crypto::TunnelEncryption tunnelEncryption;
+	tunnelEncryption.SetKeys (key1, key2);
+	Bench ("TunnelEncryption::Encrypt", 1024, [&]() { tunnelEncryption.Encrypt (tunnelMsg, tunnelOut); });
+	const int numTunnelMsgs = 8;
+	uint8_t tunnelMsgs[numTunnelMsgs][1024];
+	const uint8_t * ins[numTunnelMsgs]; uint8_t * outs[numTunnelMsgs];
+	for (int i = 0; i < numTunnelMsgs; i++) { ins[i] = tunnelMsgs[i]; outs[i] = tunnelMsgs[i]; }
+	Bench ("TunnelEncryption::Encrypt x8", 8*1024, [&]() { tunnelEncryption.Encrypt (ins, outs, numTunnelMsgs); });
+	i2p::crypto::CBCEncryption cbc;
+	cbc.SetKey (key1); cbc.SetIV (tunnelMsg);
+	Bench ("CBCEncryption 1KB", 1024, [&]() { cbc.Encrypt (tunnelMsg, 1024, tunnelOut); });
+	i2p::crypto::CBCDecryption cbcd;
+	cbcd.SetKey (key1); cbcd.SetIV (tunnelMsg);
+	Bench ("CBCDecryption 1KB", 1024, [&]() { cbcd.Decrypt (tunnelMsg, 1024, tunnelOut); });
+	i2p::crypto::TunnelDecryption tunnelDecryption;
+	tunnelDecryption.SetKeys (key1, key2);
+	Bench ("TunnelDecryption::Decrypt", 1024, [&]() { tunnelDecryption.Decrypt (tunnelMsg, tunnelOut); });
+	uint8_t md5[16];
+	Bench ("HMACMD5Digest 1KB", 1024, [&]() { i2p::crypto::HMACMD5Digest (tunnelMsg, 1024, key2, md5); });
+	const i2p::crypto::MACKey * macKeys[numTunnelMsgs]; uint8_t md5s[numTunnelMsgs][16]; uint8_t * md5Digests[numTunnelMsgs];
+	size_t md5Lens[numTunnelMsgs];
+	for (int i = 0; i < numTunnelMsgs; i++) { macKeys[i] = &key2; md5Digests[i] = md5s[i]; md5Lens[i] = 1024; }
+	Bench ("HMACMD5DigestMulti 1KB x8", 8*1024, [&]() { i2p::crypto::HMACMD5DigestMulti (numTunnelMsgs, outs, md5Lens, macKeys, md5Digests); });
+	Bench ("ChaCha20 8 bytes", 8, [&]() { i2p::crypto::ChaCha20 (tunnelOut, 8, key1, tunnelMsg, tunnelOut); });
+
+	// SHA256, routing keys are 40 bytes, identities are 391
+	uint8_t digests[numTunnelMsgs][32];
+	uint8_t * ds[numTunnelMsgs]; size_t lens[numTunnelMsgs];
+	for (int i = 0; i < numTunnelMsgs; i++) ds[i] = digests[i];
+	for (size_t len: {40, 391})
+	{
+		std::string l = std::to_string (len);
+		Bench (("SHA256 " + l + " bytes x8").c_str (), 8*len, [&]() { for (int i = 0; i < numTunnelMsgs; i++) SHA256 (ins[i], len, ds[i]); });
+		for (int i = 0; i < numTunnelMsgs; i++) lens[i] = len;
+		Bench (("SHA256Multi " + l + " bytes x8").c_str (), 8*len, [&]() { i2p::crypto::SHA256Multi (numTunnelMsgs, ins, lens, ds); });
+	}
+
+	// ChaCha20/Poly1305
+	uint8_t key[32], nonce[12], buf[1024 + 16];
+	RAND_bytes (key, 32); RAND_bytes (nonce, 12); RAND_bytes (buf, 1024);
+	Bench ("AEADChaCha20Poly1305 1KB", 1024, [&]()
+		{ i2p::crypto::AEADChaCha20Poly1305 (buf, 1024, nullptr, 0, key, nonce, buf, 1024 + 16, true); });
+#if !OPENSSL_AEAD_CHACHA20_POLY1305
+	uint64_t mac[2];
+	Bench ("Poly1305HMAC 1KB", 1024, [&]() { i2p::crypto::Poly1305HMAC (mac, (const uint64_t *)key, buf, 1024); });
+#endif
+
+	// Siphash
+	uint8_t h[8];
+	Bench ("Siphash 8 bytes", 8, [&]() { i2p::crypto::Siphash<8> (h, buf, 8, key); });
+	Bench ("Siphash 1KB", 1024, [&]() { i2p::crypto::Siphash<8> (h, buf, 1024, key); });
+
+	// Base64
+	char b64[1400];
+	size_t b64Len = i2p::data::ByteStreamToBase64 (buf, 1024, b64, sizeof (b64));
+	Bench ("ByteStreamToBase64 1KB", 1024, [&]() { i2p::data::ByteStreamToBase64 (buf, 1024, b64, sizeof (b64)); });
+	Bench ("Base64ToByteStream 1KB", 1024, [&]() { i2p::data::Base64ToByteStream (b64, b64Len, buf, 1024); });
+	size_t identLen = 391; // typical destination
+	b64Len = i2p::data::ByteStreamToBase64 (buf, identLen, b64, sizeof (b64));
+	Bench ("ByteStreamToBase64 identity", identLen, [&]() { i2p::data::ByteStreamToBase64 (buf, identLen, b64, sizeof (b64)); });
+	Bench ("Base64ToByteStream identity", identLen, [&]() { i2p::data::Base64ToByteStream (b64, b64Len, buf, identLen); });
+
+	// Ed25519
+	auto& ed25519 = i2p::crypto::GetEd25519 ();
+	BN_CTX * ctx = BN_CTX_new ();
+	uint8_t edKey[32], expandedKey[64], publicKeyEncoded[32], signature[64], digest[64];
+	RAND_bytes (edKey, 32);
+	i2p::crypto::Ed25519::ExpandPrivateKey (edKey, expandedKey);
+	auto publicKey = ed25519->GeneratePublicKey (expandedKey, ctx);
+	ed25519->EncodePublicKey (publicKey, publicKeyEncoded, ctx);
+	ed25519->Sign (expandedKey, publicKeyEncoded, buf, 100, signature);
+	SHA512_CTX sha;
+	SHA512_Init (&sha);
+	SHA512_Update (&sha, signature, 32); // R
+	SHA512_Update (&sha, publicKeyEncoded, 32);
+	SHA512_Update (&sha, buf, 100);
+	SHA512_Final (digest, &sha);
+	Bench ("Ed25519::GeneratePublicKey", 0, [&]() { ed25519->GeneratePublicKey (expandedKey, ctx); });
+	Bench ("Ed25519::Sign", 0, [&]() { ed25519->Sign (expandedKey, publicKeyEncoded, buf, 100, signature); });
+	Bench ("Ed25519::Verify", 0, [&]() { ed25519->Verify (publicKey, digest, signature); });
+
+	// X25519
+	i2p::crypto::X25519Keys alice, bob;
+	alice.GenerateKeys (); bob.GenerateKeys ();
+	uint8_t shared[32];
+	Bench ("X25519Keys::Agree", 0, [&]() { alice.Agree (bob.GetPublicKey (), shared); });
+
+	// ElGamal
+	uint8_t priv[256], pub[256], data[222], encrypted[514];
+	RAND_bytes (data, 222);
+	i2p::crypto::InitCrypto (false);
+	i2p::crypto::GenerateElGamalKeyPair (priv, pub);
+	Bench ("ElGamalEncrypt", 0, [&]() { i2p::crypto::ElGamalEncrypt (pub, data, encrypted, ctx, true); });
+	i2p::crypto::TerminateCrypto ();
+	for (int windowSize = 1; windowSize <= i2p::crypto::ELGAMAL_MAX_WINDOW_SIZE; windowSize++)
+	{
+		i2p::crypto::InitCrypto (true, windowSize);
+		Bench (("ElGamalEncrypt window " + std::to_string (windowSize)).c_str (), 0,
+			[&]() { i2p::crypto::ElGamalEncrypt (pub, data, encrypted, ctx, true); });
+		i2p::crypto::TerminateCrypto ();
+	}
+	BN_CTX_free (ctx);
+
+	// IdentHash containers
+	typedef i2p::data::Tag<32> IdentHash;
+	struct MemcmpLess // memcmp baseline
+	{
+		bool operator() (const IdentHash& l, const IdentHash& r) const { return memcmp (l, r, 32) < 0; }
+	};
+	const size_t numIdents = 10000;
+	std::vector<IdentHash> idents (numIdents);
+	std::map<IdentHash, int, MemcmpLess> memcmpMap;
+	std::map<IdentHash, int> identsMap;
+	std::unordered_map<IdentHash, int> identsHashMap;
+	for (size_t i = 0; i < numIdents; i++)
+	{
+		idents[i].Randomize ();
+		memcmpMap[idents[i]] = i; identsMap[idents[i]] = i; identsHashMap[idents[i]] = i;
+	}
+	size_t next = 0, found = 0;
+	Bench ("std::map<IdentHash> memcmp find 10K", 0, [&]() { found += memcmpMap.count (idents[next++ % numIdents]); });
+	Bench ("std::map<IdentHash> find 10K", 0, [&]() { found += identsMap.count (idents[next++ % numIdents]); });
+	Bench ("std::unordered_map<IdentHash> find 10K", 0, [&]() { found += identsHashMap.count (idents[next++ % numIdents]); });
+	if (found != next) std::cout << "IdentHash lookup mismatch" << std::endl;
+
+	// transport headers of I2NP message, payload stays in place
+	i2p::I2NPMessageBuffer<i2p::I2NP_MAX_SHORT_MESSAGE_SIZE> i2np;
+	i2np.len += 1024;
+	i2np.SetTypeID (i2p::eI2NPData); i2np.SetMsgID (12345); i2np.SetExpiration (1600000000000LL);
+	i2np.SetSize (1024); i2np.SetChks (0);
+	uint32_t msgID = 0;
+	Bench ("I2NPMessage ToNTCP2/FromNTCP2", 0, [&]() { i2np.ToNTCP2 (); i2np.FromNTCP2 (); });
+	Bench ("I2NPMessage ToSSU/FromSSU", 0, [&]() { msgID = i2np.ToSSU (); i2np.len = i2np.offset + i2p::I2NP_HEADER_SIZE + 1024; i2np.FromSSU (msgID); });
+	if (i2np.GetMsgID () != 12345 || i2np.GetSize () != 1024) std::cout << "I2NP header mismatch" << std::endl;
+
+	// clocks
+	uint64_t clockSum = 0;
+	Bench ("system_clock::now", 0, [&]() { clockSum += std::chrono::system_clock::now ().time_since_epoch ().count (); });
+#ifdef CLOCK_REALTIME_COARSE
+	struct timespec coarse;
+	Bench ("clock_gettime CLOCK_REALTIME_COARSE", 0, [&]() { clock_gettime (CLOCK_REALTIME_COARSE, &coarse); clockSum += coarse.tv_nsec; });
+#endif
+	if (!clockSum) std::cout << "clock mismatch" << std::endl;
+}
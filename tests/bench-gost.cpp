@@ -0,0 +1,57 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <inttypes.h>
+#include <string.h>
+#include <openssl/rand.h>
+
+#include "Gost.h"
+#include "Signature.h"
+
+const int BENCH_DURATION = 500; // in milliseconds per operation
+
+static void Bench (const char * name, std::function<void ()> op)
+{
+	op (); // warm up
+	uint64_t num = 0, batch = 1;
+	auto start = std::chrono::steady_clock::now ();
+	std::chrono::nanoseconds elapsed (0);
+	while (elapsed < std::chrono::milliseconds (BENCH_DURATION))
+	{
+		for (uint64_t i = 0; i < batch; i++) op ();
+		num += batch;
+		if (batch < 64) batch <<= 1;
+		elapsed = std::chrono::steady_clock::now () - start;
+	}
+	double us = (double)elapsed.count ()/num/1000.0;
+	std::cout << std::left << std::setw (36) << name << std::right << std::fixed << std::setprecision (1)
+		<< std::setw (10) << us << " us/op" << std::setw (10) << 1000000.0/us << " op/s" << std::endl;
+}
+
+template<typename Signer, typename Verifier>
+static void BenchParamSet (const char * name, i2p::crypto::GOSTR3410ParamSet paramSet, size_t sigLen)
+{
+	uint8_t priv[64], pub[128], signature[128], msg[1024];
+	RAND_bytes (msg, 1024);
+	std::string n (name);
+	Bench ((n + " keys").c_str (), [&]() { i2p::crypto::CreateGOSTR3410RandomKeys (paramSet, priv, pub); });
+	Signer signer (paramSet, priv);
+	Bench ((n + " sign").c_str (), [&]() { signer.Sign (msg, 1024, signature); });
+	Verifier verifier (paramSet);
+	verifier.SetPublicKey (pub);
+	bool ok = true;
+	Bench ((n + " verify").c_str (), [&]() { ok &= verifier.Verify (msg, 1024, signature); });
+	signature[sigLen - 1]++;
+	if (!ok || verifier.Verify (msg, 1024, signature))
+		std::cout << n << " verification FAILED" << std::endl;
+}
+
+int main ()
+{
+	BenchParamSet<i2p::crypto::GOSTR3410_256_Signer, i2p::crypto::GOSTR3410_256_Verifier>
+		("GOSTR3410 CryptoProA 256", i2p::crypto::eGOSTR3410CryptoProA, 64);
+	BenchParamSet<i2p::crypto::GOSTR3410_512_Signer, i2p::crypto::GOSTR3410_512_Verifier>
+		("GOSTR3410 TC26A 512", i2p::crypto::eGOSTR3410TC26A512, 128);
+	return 0;
+}
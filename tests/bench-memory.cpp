@@ -0,0 +1,139 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <new>
+#include <cstdlib>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <openssl/rand.h>
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+
+#include "Crypto.h"
+#include "Log.h"
+#include "Config.h"
+#include "FS.h"
+#include "RouterContext.h"
+#include "RouterInfo.h"
+#include "TransitTunnel.h"
+#include "NTCP2.h"
+#include "SSU.h"
+#include "SSUSession.h"
+#include "Garlic.h"
+#include "Destination.h"
+#include "Streaming.h"
+
+// Heap bytes held by one object of every type we count hosts by, in typical state.
+// N objects of a type are created and kept alive, difference of live heap bytes
+// before and after (by allocator hooks) is divided by N. Shared parts, like
+// destination of streams or server of sessions, are created before and not counted.
+// Router's keys and RouterInfo are created in a temporary data directory, nothing is sent.
+
+const int NUM_OBJECTS = 1000;
+
+static uint64_t g_LiveBytes = 0, g_NumAllocations = 0; // single threaded
+
+void * operator new (size_t size)
+{
+	void * p = malloc (size ? size : 1);
+	if (!p) throw std::bad_alloc ();
+	g_LiveBytes += malloc_usable_size (p);
+	g_NumAllocations++;
+	return p;
+}
+
+void operator delete (void * p) noexcept
+{
+	if (!p) return;
+	g_LiveBytes -= malloc_usable_size (p);
+	free (p);
+}
+
+typedef std::function<std::shared_ptr<void> (int)> Creator;
+
+static void Measure (const char * name, size_t size, Creator create)
+{
+	std::vector<std::shared_ptr<void> > objects;
+	objects.reserve (NUM_OBJECTS);
+	create (0).reset (); // warm up, lazily created shared parts
+	uint64_t bytes = g_LiveBytes, allocations = g_NumAllocations;
+	for (int i = 0; i < NUM_OBJECTS; i++)
+		objects.push_back (create (i));
+	bytes = g_LiveBytes - bytes; allocations = g_NumAllocations - allocations;
+	std::cout << std::left << std::setw (32) << name << std::right
+		<< std::setw (10) << size << " sizeof"
+		<< std::setw (10) << bytes/NUM_OBJECTS << " bytes/object"
+		<< std::fixed << std::setprecision (1) << std::setw (8) << (double)allocations/NUM_OBJECTS << " allocs/object" << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+	char dir[] = "/tmp/bench-memory-XXXXXX";
+	if (!mkdtemp (dir))
+	{
+		std::cerr << "Can't create temporary data directory" << std::endl;
+		return 1;
+	}
+	i2p::log::Logger ().SetLogLevel ("none");
+	i2p::config::Init ();
+	i2p::config::ParseCmdline (argc, argv, true);
+	i2p::fs::DetectDataDir (dir, false);
+	i2p::fs::Init ();
+	i2p::config::Finalize ();
+	i2p::crypto::InitCrypto (true);
+	i2p::context.Init ();
+
+	const auto& ri = i2p::context.GetRouterInfo ();
+	std::vector<uint8_t> riBuffer (ri.GetBuffer (), ri.GetBuffer () + ri.GetBufferLen ());
+	auto remote = std::make_shared<i2p::data::RouterInfo> (riBuffer.data (), riBuffer.size ());
+	std::cout << NUM_OBJECTS << " objects of every type" << std::endl;
+
+	// netdb
+	Measure ("RouterInfo", sizeof (i2p::data::RouterInfo), [&riBuffer](int)
+		{ return std::make_shared<i2p::data::RouterInfo> (riBuffer.data (), riBuffer.size ()); });
+
+	// transit tunnels
+	uint8_t keys[32 + 32 + 32];
+	RAND_bytes (keys, sizeof (keys));
+	auto transitTunnel = [&keys](bool isGateway, bool isEndpoint)
+		{
+			return [&keys, isGateway, isEndpoint](int i)
+				{ return i2p::tunnel::CreateTransitTunnel (i + 1, keys, i + 2, keys + 32, keys + 64, isGateway, isEndpoint); };
+		};
+	Measure ("TransitTunnel participant", sizeof (i2p::tunnel::TransitTunnelParticipant), transitTunnel (false, false));
+	Measure ("TransitTunnel gateway", sizeof (i2p::tunnel::TransitTunnelGateway), transitTunnel (true, false));
+	Measure ("TransitTunnel endpoint", sizeof (i2p::tunnel::TransitTunnelEndpoint), transitTunnel (false, true));
+
+	// transports, outgoing sessions before connect
+	i2p::transport::NTCP2Server ntcp2Server;
+	Measure ("NTCP2Session", sizeof (i2p::transport::NTCP2Session), [&ntcp2Server, remote](int)
+		{ return std::make_shared<i2p::transport::NTCP2Session> (ntcp2Server, remote); });
+	i2p::transport::SSUServer ssuServer (0);
+	boost::asio::ip::udp::endpoint ssuEndpoint (boost::asio::ip::address::from_string ("127.0.0.1"), 1);
+	Measure ("SSUSession", sizeof (i2p::transport::SSUSession), [&ssuServer, &ssuEndpoint, remote](int)
+		{ return std::make_shared<i2p::transport::SSUSession> (ssuServer, ssuEndpoint, remote); });
+
+	// client
+	auto destination = std::make_shared<i2p::client::ClientDestination> (i2p::data::PrivateKeys::CreateRandomKeys (), false);
+	auto streamingDestination = std::make_shared<i2p::stream::StreamingDestination> (destination);
+	boost::asio::io_service service;
+	Measure ("Stream", sizeof (i2p::stream::Stream), [&service, streamingDestination](int)
+		{ return std::make_shared<i2p::stream::Stream> (service, *streamingDestination); });
+	std::vector<uint8_t> data (4096);
+	Measure ("Stream with 4 KiB to send", sizeof (i2p::stream::Stream), [&service, streamingDestination, &data](int)
+		{
+			auto s = std::make_shared<i2p::stream::Stream> (service, *streamingDestination);
+			s->Send (data.data (), data.size ());
+			return s;
+		});
+	Measure ("GarlicRoutingSession", sizeof (i2p::garlic::GarlicRoutingSession), [destination, remote](int)
+		{ return std::make_shared<i2p::garlic::GarlicRoutingSession> (destination.get (), remote, i2p::client::DEFAULT_TAGS_TO_SEND, false); });
+
+	i2p::crypto::TerminateCrypto ();
+	boost::filesystem::remove_all (dir);
+	return 0;
+}
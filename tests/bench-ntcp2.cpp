@@ -0,0 +1,153 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <boost/filesystem.hpp>
+
+#include "Crypto.h"
+#include "Log.h"
+#include "Config.h"
+#include "FS.h"
+#include "RouterContext.h"
+#include "NTCP2.h"
+
+// NTCP2 handshakes of router with itself in process, without sockets:
+// Alice's and Bob's establishers exchange SessionRequest, SessionCreated and SessionConfirmed
+// through memory, with router's static keys and RouterInfo from a temporary data directory.
+// Handshakes run by several threads concurrently, as reconnections after restart do.
+// Ephemeral keys supplier is not running, so every key pair is generated inline.
+
+const int NUM_HANDSHAKES = 2000;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<uint64_t> g_NumAllocations (0);
+
+void * operator new (size_t size)
+{
+	g_NumAllocations.fetch_add (1, std::memory_order_relaxed);
+	void * p = malloc (size ? size : 1);
+	if (!p) throw std::bad_alloc ();
+	return p;
+}
+
+void operator delete (void * p) noexcept
+{
+	free (p);
+}
+
+static bool Handshake ()
+{
+	i2p::transport::NTCP2Establisher alice, bob;
+	uint8_t nonce[12];
+	uint16_t paddingLen = 0;
+	// Alice -> Bob SessionRequest
+	alice.CreateEphemeralKey ();
+	memcpy (alice.m_RemoteStaticKey, i2p::context.GetNTCP2StaticPublicKey (), 32);
+	memcpy (alice.m_IV, i2p::context.GetNTCP2IV (), 16);
+	alice.m_RemoteIdentHash = i2p::context.GetIdentHash ();
+	alice.CreateSessionRequestMessage ();
+	bob.CreateEphemeralKey ();
+	memcpy (bob.m_SessionRequestBuffer, alice.m_SessionRequestBuffer, alice.m_SessionRequestBufferLen);
+	if (!bob.ProcessSessionRequestMessage (paddingLen)) return false;
+	// Bob -> Alice SessionCreated
+	bob.CreateSessionCreatedMessage ();
+	memcpy (alice.m_SessionCreatedBuffer, bob.m_SessionCreatedBuffer, bob.m_SessionCreatedBufferLen);
+	if (!alice.ProcessSessionCreatedMessage (paddingLen)) return false;
+	alice.m_SessionCreatedBufferLen += paddingLen;
+	// Alice -> Bob SessionConfirmed
+	memset (nonce, 0, 12); nonce[4] = 1;
+	alice.CreateSessionConfirmedMessagePart1 (nonce);
+	memset (nonce, 0, 12);
+	alice.CreateSessionConfirmedMessagePart2 (nonce);
+	bob.CreateSessionConfirmedBuffer ();
+	memcpy (bob.m_SessionConfirmedBuffer, alice.m_SessionConfirmedBuffer, alice.m3p2Len + 48);
+	memset (nonce, 0, 12); nonce[4] = 1;
+	if (!bob.ProcessSessionConfirmedMessagePart1 (nonce)) return false;
+	std::vector<uint8_t> buf (bob.m3p2Len - 16);
+	memset (nonce, 0, 12);
+	return bob.ProcessSessionConfirmedMessagePart2 (nonce, buf.data ()) && buf[0] == i2p::transport::eNTCP2BlkRouterInfo;
+}
+
+static void Run (int numThreads)
+{
+	int numPerThread = NUM_HANDSHAKES/numThreads;
+	std::vector<std::vector<double> > latencies (numThreads); // in microseconds
+	std::atomic<int> numFailed (0);
+	std::vector<std::thread> threads;
+	uint64_t allocations = g_NumAllocations;
+	auto start = Clock::now ();
+	for (int i = 0; i < numThreads; i++)
+		threads.emplace_back ([&latencies, &numFailed, numPerThread, i]()
+			{
+				auto& l = latencies[i];
+				l.reserve (numPerThread);
+				for (int j = 0; j < numPerThread; j++)
+				{
+					auto s = Clock::now ();
+					if (!Handshake ()) numFailed++;
+					l.push_back (std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now () - s).count ()/1000.0);
+				}
+			});
+	for (auto& it: threads) it.join ();
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now () - start).count ()/1000.0;
+	allocations = g_NumAllocations - allocations;
+
+	std::vector<double> all;
+	for (auto& it: latencies) all.insert (all.end (), it.begin (), it.end ());
+	std::sort (all.begin (), all.end ());
+	double sum = 0;
+	for (auto it: all) sum += it;
+	int num = all.size ();
+	std::cout << std::left << std::setw (12) << (std::to_string (numThreads) + " threads") << std::right << std::fixed << std::setprecision (1)
+		<< std::setw (10) << (elapsed > 0 ? num*1000000.0/elapsed : 0) << " handshakes/s"
+		<< "  latency avg " << std::setw (8) << sum/num << " us"
+		<< "  p50 " << std::setw (8) << all[num/2] << " us"
+		<< "  p99 " << std::setw (8) << all[num*99/100] << " us"
+		<< std::setprecision (2) << std::setw (8) << (double)allocations/num << " allocs/handshake";
+	if (numFailed) std::cout << "  " << numFailed << " FAILED";
+	std::cout << std::endl;
+}
+
+int main (int argc, char* argv[])
+{
+	char dir[] = "/tmp/bench-ntcp2-XXXXXX";
+	if (!mkdtemp (dir))
+	{
+		std::cerr << "Can't create temporary data directory" << std::endl;
+		return 1;
+	}
+	i2p::log::Logger ().SetLogLevel ("none");
+	i2p::config::Init ();
+	i2p::config::ParseCmdline (argc, argv, true);
+	i2p::fs::DetectDataDir (dir, false);
+	i2p::fs::Init ();
+	i2p::config::Finalize ();
+	i2p::crypto::InitCrypto (true);
+	i2p::context.Init ();
+	if (!i2p::context.GetNTCP2StaticPublicKey ())
+	{
+		std::cerr << "NTCP2 keys are not created" << std::endl;
+		return 1;
+	}
+
+	std::cout << NUM_HANDSHAKES << " handshakes, RouterInfo " << i2p::context.GetRouterInfo ().GetBufferLen () << " bytes" << std::endl;
+	Handshake (); // warm up
+	std::vector<int> numsThreads{1, 2, 4};
+	int numCores = std::thread::hardware_concurrency ();
+	if (numCores > 4) numsThreads.push_back (numCores);
+	for (auto it: numsThreads)
+		Run (it);
+
+	i2p::crypto::TerminateCrypto ();
+	boost::filesystem::remove_all (dir);
+	return 0;
+}
@@ -0,0 +1,337 @@
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <inttypes.h>
+#include <string.h>
+#include <openssl/rand.h>
+
+#include "Crypto.h"
+#include "Log.h"
+#include "Identity.h"
+#include "I2NPProtocol.h"
+#include "TunnelConfig.h"
+#include "TunnelGateway.h"
+#include "TunnelEndpoint.h"
+
+// Forwarding pipeline of one tunnel in process, without network:
+// build records creation and processing by hops, gateway fragmentation,
+// layer encryption by every hop, decryption by tunnel owner and endpoint reassembly.
+// Global router objects are not involved, delivered messages are dropped by local handler.
+// With a file recorded by router's tunnelcapture option: bench-tunnel <file>,
+// synthetic messages with captured sizes and tunnels are replayed instead.
+
+const int NUM_HOPS = 3;
+const int NUM_BUILDS = 20;
+const int NUM_MESSAGES = 20000;
+const size_t MIN_MESSAGE_SIZE = 100, MAX_MESSAGE_SIZE = 4000;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<uint64_t> g_NumAllocations (0);
+
+void * operator new (size_t size)
+{
+	g_NumAllocations.fetch_add (1, std::memory_order_relaxed);
+	void * p = malloc (size ? size : 1);
+	if (!p) throw std::bad_alloc ();
+	return p;
+}
+
+void operator delete (void * p) noexcept
+{
+	free (p);
+}
+
+static double GetMicroseconds (Clock::duration d)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count ()/1000.0;
+}
+
+static void Report (const char * stage, Clock::duration d, uint64_t num, const char * unit, uint64_t bytes = 0)
+{
+	double us = GetMicroseconds (d);
+	std::cout << std::left << std::setw (32) << stage << std::right << std::fixed << std::setprecision (1)
+		<< std::setw (12) << (us*1000.0/num) << " ns/" << unit
+		<< std::setw (12) << (us > 0 ? num*1000000.0/us : 0) << " " << unit << "s/s";
+	if (bytes)
+		std::cout << std::setw (10) << (us > 0 ? bytes/us : 0) << " MB/s";
+	std::cout << std::endl;
+}
+
+struct CapturedMessage
+{
+	uint64_t ts; // milliseconds
+	bool isGateway;
+	uint32_t tunnel, len;
+};
+
+// gateway messages are fragmented and reassembled by endpoint of their tunnel,
+// data messages are encrypted by one layer as by transit participant
+static int Replay (const char * path)
+{
+	std::vector<CapturedMessage> captured;
+	std::ifstream f (path);
+	std::string type;
+	CapturedMessage m;
+	while (f >> m.ts >> type >> m.tunnel >> m.len)
+	{
+		m.isGateway = type == "G";
+		captured.push_back (m);
+	}
+	if (captured.empty ())
+	{
+		std::cerr << "No messages in " << path << std::endl;
+		return 1;
+	}
+
+	struct ReplayTunnel
+	{
+		ReplayTunnel (): endpoint (true) {};
+		i2p::tunnel::TunnelGatewayBuffer gateway;
+		i2p::tunnel::TunnelEndpoint endpoint;
+		i2p::crypto::TunnelEncryption layer;
+		bool isUnflushed = false;
+	};
+	std::map<uint32_t, std::unique_ptr<ReplayTunnel> > tunnels;
+	uint8_t payload[i2p::I2NP_MAX_MESSAGE_SIZE];
+	RAND_bytes (payload, sizeof (payload));
+	std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs; // created before, not measured
+	uint64_t numGateway = 0, numData = 0, numBytes = 0;
+	for (auto& it: captured)
+	{
+		auto& tunnel = tunnels[it.tunnel];
+		if (!tunnel)
+		{
+			tunnel.reset (new ReplayTunnel ());
+			i2p::crypto::AESKey layerKey, ivKey;
+			RAND_bytes (layerKey, 32); RAND_bytes (ivKey, 32);
+			tunnel->layer.SetKeys (layerKey, ivKey);
+		}
+		if (it.isGateway)
+		{
+			// tunnelID, length and I2NP message
+			size_t len = it.len > 6 + i2p::I2NP_HEADER_SIZE ? it.len - 6 - i2p::I2NP_HEADER_SIZE : 0;
+			if (len > sizeof (payload) - 16) len = sizeof (payload) - 16;
+			msgs.push_back (i2p::CreateI2NPMessage (i2p::eI2NPData, payload, len));
+			numGateway++;
+		}
+		else
+		{
+			msgs.push_back (i2p::CreateEmptyTunnelDataMsg ());
+			RAND_bytes (msgs.back ()->GetPayload (), i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+			numData++;
+		}
+		numBytes += it.len;
+	}
+
+	uint64_t numTunnelMsgs = 0;
+	auto flush = [&]()
+		{
+			for (auto& it: tunnels)
+			{
+				auto& tunnel = *it.second;
+				if (!tunnel.isUnflushed) continue;
+				tunnel.gateway.CompleteCurrentTunnelDataMessage ();
+				for (auto& tunnelMsg: tunnel.gateway.GetTunnelDataMsgs ())
+				{
+					auto msg = i2p::CreateEmptyTunnelDataMsg ();
+					memcpy (msg->GetPayload (), tunnelMsg->GetPayload (), i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+					tunnel.endpoint.HandleDecryptedTunnelDataMsg (msg);
+					numTunnelMsgs++;
+				}
+				tunnel.gateway.ClearTunnelDataMsgs ();
+				tunnel.isUnflushed = false;
+			}
+		};
+	uint64_t allocations = g_NumAllocations;
+	auto start = Clock::now ();
+	uint64_t prevTs = captured[0].ts;
+	for (size_t i = 0; i < captured.size (); i++)
+	{
+		auto& it = captured[i];
+		if (it.ts != prevTs) { flush (); prevTs = it.ts; } // messages of same millisecond as one batch
+		auto& tunnel = *tunnels[it.tunnel];
+		if (it.isGateway)
+		{
+			i2p::tunnel::TunnelMessageBlock block;
+			block.deliveryType = i2p::tunnel::eDeliveryTypeLocal;
+			block.data = msgs[i];
+			tunnel.gateway.PutI2NPMsg (block);
+			tunnel.isUnflushed = true;
+		}
+		else
+			tunnel.layer.Encrypt (msgs[i]->GetPayload () + 4, msgs[i]->GetPayload () + 4);
+	}
+	flush ();
+	auto replayTime = Clock::now () - start;
+	allocations = g_NumAllocations - allocations;
+
+	std::cout << "replay of " << path << ": " << captured.size () << " messages over "
+		<< (captured.back ().ts - captured[0].ts) << " ms, " << tunnels.size () << " tunnels, "
+		<< numGateway << " gateway, " << numData << " data, " << numTunnelMsgs << " tunnel messages from gateways" << std::endl;
+	Report ("replay", replayTime, captured.size (), "msg", numBytes);
+	std::cout << std::left << std::setw (32) << "allocations" << std::right << std::fixed << std::setprecision (2)
+		<< std::setw (12) << (double)allocations/captured.size () << " per msg" << std::endl;
+	return 0;
+}
+
+int main (int argc, char* argv[])
+{
+	i2p::log::Logger ().SetLogLevel ("none");
+	i2p::crypto::InitCrypto (true);
+	if (argc > 1)
+	{
+		int ret = Replay (argv[1]);
+		i2p::crypto::TerminateCrypto ();
+		return ret;
+	}
+	BN_CTX * ctx = BN_CTX_new ();
+
+	// tunnel build
+	std::vector<i2p::data::PrivateKeys> keys;
+	std::vector<std::shared_ptr<const i2p::data::IdentityEx> > peers;
+	for (int i = 0; i < NUM_HOPS; i++)
+	{
+		keys.push_back (i2p::data::PrivateKeys::CreateRandomKeys (i2p::data::SIGNING_KEY_TYPE_EDDSA_SHA512_ED25519));
+		peers.push_back (keys.back ().GetPublic ());
+	}
+	Clock::duration createTime (0), processTime (0);
+	uint8_t record[i2p::TUNNEL_BUILD_RECORD_SIZE], clearText[i2p::BUILD_REQUEST_RECORD_CLEAR_TEXT_SIZE];
+	for (int n = 0; n < NUM_BUILDS; n++)
+	{
+		i2p::tunnel::TunnelConfig config (peers, 1, peers[0]->GetIdentHash ());
+		auto hop = config.GetFirstHop ();
+		int i = 0;
+		while (hop)
+		{
+			auto start = Clock::now ();
+			hop->CreateBuildRequestRecord (record, 1, ctx);
+			auto mid = Clock::now ();
+			bool ok = keys[i].CreateDecryptor (nullptr)->Decrypt (record + i2p::BUILD_REQUEST_RECORD_ENCRYPTED_OFFSET, clearText, ctx, false);
+			processTime += Clock::now () - mid;
+			createTime += mid - start;
+			assert (ok); (void)ok;
+			hop = hop->next; i++;
+		}
+	}
+	Report ("build record create", createTime, NUM_BUILDS*NUM_HOPS, "record");
+	Report ("build record process (hop)", processTime, NUM_BUILDS*NUM_HOPS, "record");
+	Report ("tunnel build crypto", createTime + processTime, NUM_BUILDS, "tunnel");
+
+	// hops' layer keys
+	i2p::crypto::TunnelEncryption encryption[NUM_HOPS];
+	i2p::crypto::TunnelDecryption decryption[NUM_HOPS];
+	for (int i = 0; i < NUM_HOPS; i++)
+	{
+		i2p::crypto::AESKey layerKey, ivKey;
+		RAND_bytes (layerKey, 32); RAND_bytes (ivKey, 32);
+		encryption[i].SetKeys (layerKey, ivKey);
+		decryption[i].SetKeys (layerKey, ivKey);
+	}
+
+	// messages
+	std::vector<std::shared_ptr<i2p::I2NPMessage> > msgs;
+	uint8_t payload[MAX_MESSAGE_SIZE];
+	RAND_bytes (payload, MAX_MESSAGE_SIZE);
+	uint64_t numBytes = 0;
+	for (int i = 0; i < NUM_MESSAGES; i++)
+	{
+		size_t len = MIN_MESSAGE_SIZE + rand () % (MAX_MESSAGE_SIZE - MIN_MESSAGE_SIZE);
+		msgs.push_back (i2p::CreateI2NPMessage (i2p::eI2NPData, payload, len));
+		numBytes += msgs.back ()->GetLength ();
+	}
+
+	// gateway
+	i2p::tunnel::TunnelGatewayBuffer gateway;
+	auto start = Clock::now ();
+	for (auto& it: msgs)
+	{
+		i2p::tunnel::TunnelMessageBlock block;
+		block.deliveryType = i2p::tunnel::eDeliveryTypeLocal;
+		block.data = it;
+		gateway.PutI2NPMsg (block);
+	}
+	gateway.CompleteCurrentTunnelDataMessage ();
+	auto gatewayTime = Clock::now () - start;
+	auto tunnelMsgs = gateway.GetTunnelDataMsgs ();
+	uint64_t numTunnelMsgs = tunnelMsgs.size ();
+
+	// packing, flushes of small messages as from streaming, in arrival order and reordered
+	const int FLUSH_SIZE = 8;
+	i2p::tunnel::TunnelGatewayBuffer sequential, packed;
+	std::vector<i2p::tunnel::TunnelMessageBlock> flush;
+	uint64_t numSequential = 0, numPacked = 0;
+	Clock::duration sequentialTime (0), packedTime (0);
+	for (int i = 0; i < NUM_MESSAGES; i++)
+	{
+		i2p::tunnel::TunnelMessageBlock block;
+		block.deliveryType = i2p::tunnel::eDeliveryTypeTunnel;
+		block.tunnelID = i;
+		block.data = i2p::CreateI2NPMessage (i2p::eI2NPData, payload, MIN_MESSAGE_SIZE + rand () % 1000);
+		flush.push_back (block);
+		if (flush.size () < FLUSH_SIZE) continue;
+		auto t0 = Clock::now ();
+		for (auto& it: flush)
+			sequential.PutI2NPMsg (it);
+		sequential.CompleteCurrentTunnelDataMessage ();
+		auto t1 = Clock::now ();
+		packed.PutI2NPMsgs (flush);
+		packed.CompleteCurrentTunnelDataMessage ();
+		packedTime += Clock::now () - t1;
+		sequentialTime += t1 - t0;
+		numSequential += sequential.GetTunnelDataMsgs ().size (); sequential.ClearTunnelDataMsgs ();
+		numPacked += packed.GetTunnelDataMsgs ().size (); packed.ClearTunnelDataMsgs ();
+		flush.clear ();
+	}
+	std::cout << "flushes of " << FLUSH_SIZE << " messages: " << numSequential << " tunnel messages in order, "
+		<< numPacked << " packed" << std::endl;
+	Report ("gateway flush in order", sequentialTime, NUM_MESSAGES, "msg");
+	Report ("gateway flush packed", packedTime, NUM_MESSAGES, "msg");
+
+	// participants
+	std::vector<std::shared_ptr<i2p::I2NPMessage> > encrypted;
+	for (auto& it: tunnelMsgs)
+	{
+		auto msg = i2p::CreateEmptyTunnelDataMsg ();
+		memcpy (msg->GetPayload (), it->GetPayload (), i2p::tunnel::TUNNEL_DATA_MSG_SIZE);
+		encrypted.push_back (msg);
+	}
+	start = Clock::now ();
+	for (auto& it: encrypted)
+		for (int i = 0; i < NUM_HOPS; i++)
+			encryption[i].Encrypt (it->GetPayload () + 4, it->GetPayload () + 4);
+	auto participantsTime = Clock::now () - start;
+
+	// tunnel owner and endpoint
+	i2p::tunnel::TunnelEndpoint endpoint (true);
+	Clock::duration decryptTime (0), endpointTime (0);
+	for (auto& it: encrypted)
+	{
+		auto t0 = Clock::now ();
+		for (int i = NUM_HOPS - 1; i >= 0; i--)
+			decryption[i].Decrypt (it->GetPayload () + 4, it->GetPayload () + 4);
+		auto t1 = Clock::now ();
+		endpoint.HandleDecryptedTunnelDataMsg (it);
+		endpointTime += Clock::now () - t1;
+		decryptTime += t1 - t0;
+	}
+
+	uint64_t tunnelBytes = numTunnelMsgs*i2p::tunnel::TUNNEL_DATA_MSG_SIZE;
+	std::cout << NUM_MESSAGES << " I2NP messages, " << numBytes << " bytes, " << numTunnelMsgs << " tunnel messages, "
+		<< NUM_HOPS << " hops" << std::endl;
+	Report ("gateway", gatewayTime, NUM_MESSAGES, "msg", numBytes);
+	Report ("transit participant (hop)", participantsTime/NUM_HOPS, numTunnelMsgs, "msg", tunnelBytes);
+	Report ("owner layers decryption", decryptTime, numTunnelMsgs, "msg", tunnelBytes);
+	Report ("endpoint", endpointTime, NUM_MESSAGES, "msg", numBytes);
+	Report ("total", gatewayTime + participantsTime + decryptTime + endpointTime, NUM_MESSAGES, "msg", numBytes);
+
+	BN_CTX_free (ctx);
+	i2p::crypto::TerminateCrypto ();
+}
@@ -41,5 +41,51 @@ int main() {
 //  assert(Base64ToByteStream(in, strlen(in), (uint8_t *) out, sizeof(out)) == 0);
 //  ^^^ fails, current implementation not checks acceptable symbols
 
+  /* long input, vectorized blocks and scalar tail */
+  static const uint8_t alphabet[48] = { /* encodes to whole alphabet, '-' and '~' included */
+    0x00, 0x10, 0x83, 0x10, 0x51, 0x87, 0x20, 0x92, 0x8b, 0x30, 0xd3, 0x8f, 0x41, 0x14, 0x93, 0x51,
+    0x55, 0x97, 0x61, 0x96, 0x9b, 0x71, 0xd7, 0x9f, 0x82, 0x18, 0xa3, 0x92, 0x59, 0xa7, 0xa2, 0x9a,
+    0xab, 0xb2, 0xdb, 0xaf, 0xc3, 0x1c, 0xb3, 0xd3, 0x5d, 0xb7, 0xe3, 0x9e, 0xbb, 0xf3, 0xdf, 0xbf
+  };
+  const char *alphabet_b64 =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-~"
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-~"
+    "dGVzdA==";
+  uint8_t bytes[100], decoded[300];
+  char encoded[400];
+  memcpy(bytes, alphabet, 48);
+  memcpy(bytes + 48, alphabet, 48);
+  memcpy(bytes + 96, "test", 4);
+
+  assert(ByteStreamToBase64(bytes, 100, encoded, sizeof(encoded)) == 136);
+  assert(memcmp(encoded, alphabet_b64, 136) == 0);
+  assert(Base64ToByteStream(alphabet_b64, 136, decoded, sizeof(decoded)) == 100);
+  assert(memcmp(decoded, bytes, 100) == 0);
+
+  /* round trip of every length */
+  uint8_t random[300];
+  for (size_t i = 0; i < sizeof(random); i++)
+    random[i] = (uint8_t)(i*167 + 13) ^ alphabet[i % 48];
+  for (size_t l = 1; l <= sizeof(random); l++) {
+    size_t encoded_len = ByteStreamToBase64(random, l, encoded, sizeof(encoded));
+    assert(encoded_len == Base64EncodingBufferSize(l));
+    assert(Base64ToByteStream(encoded, encoded_len, decoded, sizeof(decoded)) == l);
+    assert(memcmp(decoded, random, l) == 0);
+  }
+
+  /* char not from alphabet inside a vectorized block must not change other groups */
+  uint8_t corrupted[100];
+  char invalid[136];
+  const size_t positions[] = { 5, 70 }; /* first block and in the middle */
+  for (size_t p = 0; p < sizeof(positions)/sizeof(positions[0]); p++) {
+    memcpy(invalid, alphabet_b64, 136);
+    invalid[positions[p]] = '.';
+    assert(Base64ToByteStream(invalid, 136, corrupted, sizeof(corrupted)) == 100);
+    size_t group = positions[p]/4*3; /* 3 bytes decoded from 4 chars */
+    assert(memcmp(corrupted, bytes, group) == 0);
+    assert(memcmp(corrupted + group, bytes + group, 3) != 0);
+    assert(memcmp(corrupted + group + 3, bytes + group + 3, 100 - group - 3) == 0);
+  }
+
   return 0;
 }
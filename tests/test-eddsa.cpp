@@ -0,0 +1,73 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <openssl/sha.h>
+#include <openssl/rand.h>
+
+#include "Ed25519.h"
+
+const size_t NUM_SIGNATURES = 16;
+
+int main ()
+{
+	auto& ed25519 = i2p::crypto::GetEd25519 ();
+	BN_CTX * ctx = BN_CTX_new ();
+	i2p::crypto::EDDSAPoint publicKeys[NUM_SIGNATURES];
+	uint8_t signatures[NUM_SIGNATURES][64], digests[NUM_SIGNATURES][64], msgs[NUM_SIGNATURES][100];
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+	{
+		uint8_t key[32], expandedKey[64], publicKeyEncoded[32];
+		RAND_bytes (key, 32);
+		RAND_bytes (msgs[i], 100);
+		i2p::crypto::Ed25519::ExpandPrivateKey (key, expandedKey);
+		publicKeys[i] = ed25519->GeneratePublicKey (expandedKey, ctx);
+		ed25519->EncodePublicKey (publicKeys[i], publicKeyEncoded, ctx);
+		ed25519->Sign (expandedKey, publicKeyEncoded, msgs[i], 100, signatures[i]);
+		SHA512_CTX sha;
+		SHA512_Init (&sha);
+		SHA512_Update (&sha, signatures[i], 32); // R
+		SHA512_Update (&sha, publicKeyEncoded, 32);
+		SHA512_Update (&sha, msgs[i], 100);
+		SHA512_Final (digests[i], &sha);
+	}
+	BN_CTX_free (ctx);
+
+	const i2p::crypto::EDDSAPoint * pks[NUM_SIGNATURES];
+	const uint8_t * sigs[NUM_SIGNATURES], * dgsts[NUM_SIGNATURES];
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+	{
+		pks[i] = &publicKeys[i]; sigs[i] = signatures[i]; dgsts[i] = digests[i];
+	}
+	bool results[NUM_SIGNATURES];
+	ed25519->Verify (NUM_SIGNATURES, pks, dgsts, sigs, results);
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+		assert (results[i]);
+
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+		assert (ed25519->Verify (publicKeys[i], digests[i], signatures[i]));
+
+	// S + l is the same scalar, but must be rejected by single and batch verification
+	static const uint8_t l[32] =
+	{
+		0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+	};
+	uint8_t original[64];
+	memcpy (original, signatures[3], 64);
+	int carry = 0;
+	for (int i = 0; i < 32; i++)
+	{
+		int sum = signatures[3][32 + i] + l[i] + carry;
+		signatures[3][32 + i] = sum; carry = sum >> 8;
+	}
+	assert (!ed25519->Verify (publicKeys[3], digests[3], signatures[3]));
+	ed25519->Verify (NUM_SIGNATURES, pks, dgsts, sigs, results);
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+		assert (results[i] == (i != 3));
+	memcpy (signatures[3], original, 64);
+
+	signatures[5][40] ^= 0x01; // corrupt S
+	ed25519->Verify (NUM_SIGNATURES, pks, dgsts, sigs, results);
+	for (size_t i = 0; i < NUM_SIGNATURES; i++)
+		assert (results[i] == (i != 5));
+}
@@ -0,0 +1,24 @@
+#include <cassert>
+#include <inttypes.h>
+#include <string.h>
+#include <openssl/rand.h>
+
+#include "Crypto.h"
+
+int main ()
+{
+	uint8_t priv[256], pub[256], data[222], encrypted[514], decrypted[222];
+	RAND_bytes (data, 222);
+	BN_CTX * ctx = BN_CTX_new ();
+	for (int windowSize = 0; windowSize <= i2p::crypto::ELGAMAL_MAX_WINDOW_SIZE; windowSize++)
+	{
+		// 0 means no precomputation
+		i2p::crypto::InitCrypto (windowSize > 0, windowSize);
+		i2p::crypto::GenerateElGamalKeyPair (priv, pub);
+		i2p::crypto::ElGamalEncrypt (pub, data, encrypted, ctx, true);
+		assert (i2p::crypto::ElGamalDecrypt (priv, encrypted, decrypted, ctx, true));
+		assert (!memcmp (data, decrypted, 222));
+		i2p::crypto::TerminateCrypto ();
+	}
+	BN_CTX_free (ctx);
+}